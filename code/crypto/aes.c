@@ -1,5 +1,11 @@
 #include "..\zmodule.h"
 #include "aes.h"
+#include "cpu.h"
+#include "impl.h"
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
 
 #define KEY_SIZE 256
 #define NUMBER_OF_ROUNDS 14 // 256bit AES
@@ -405,3 +411,108 @@ int aes_crypt_cbc(aes_context_t *ctx, int mode, size_t length, uint8_t iv[16], c
 
     return 0;
 }
+
+/*
+ * Increment a 128-bit big endian counter
+ */
+static void aes_ctr_inc( uint8_t counter[16] )
+{
+    int i;
+
+    for( i = 16; i > 0; i-- )
+        if( ++counter[i - 1] != 0 )
+            break;
+}
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#define AES_CTR_LANES   8
+
+/*
+ * AES-NI counter mode. aesenc has a latency of several cycles but a
+ * throughput of one or two per cycle, so eight independent blocks go
+ * through each round together. The round keys produced by
+ * aes_setkey_enc() are already in the byte order aesenc expects.
+ */
+static void aes_ctr_blocks_aesni( aes_context_t *ctx, uint8_t counter[16],
+                                  size_t blocks, uint8_t *output )
+{
+    const uint32_t *rk = ctx->rk;
+    __m128i k[NUMBER_OF_ROUNDS + 1], b[AES_CTR_LANES];
+    size_t i, j, n;
+
+    for( i = 0; i <= NUMBER_OF_ROUNDS; i++ )
+        k[i] = _mm_loadu_si128( (const __m128i *) ( rk + 4 * i ) );
+
+    while( blocks >= AES_CTR_LANES )
+    {
+        for( j = 0; j < AES_CTR_LANES; j++ )
+        {
+            aes_ctr_inc( counter );
+            b[j] = _mm_xor_si128( _mm_loadu_si128( (const __m128i *) counter ), k[0] );
+        }
+
+        for( i = 1; i < NUMBER_OF_ROUNDS; i++ )
+            for( j = 0; j < AES_CTR_LANES; j++ )
+                b[j] = _mm_aesenc_si128( b[j], k[i] );
+
+        for( j = 0; j < AES_CTR_LANES; j++ )
+            _mm_storeu_si128( (__m128i *) output + j,
+                              _mm_aesenclast_si128( b[j], k[NUMBER_OF_ROUNDS] ) );
+
+        output += 16 * AES_CTR_LANES;
+        blocks -= AES_CTR_LANES;
+    }
+
+    n = blocks;
+
+    for( j = 0; j < n; j++ )
+    {
+        aes_ctr_inc( counter );
+        b[j] = _mm_xor_si128( _mm_loadu_si128( (const __m128i *) counter ), k[0] );
+    }
+
+    for( i = 1; i < NUMBER_OF_ROUNDS; i++ )
+        for( j = 0; j < n; j++ )
+            b[j] = _mm_aesenc_si128( b[j], k[i] );
+
+    for( j = 0; j < n; j++ )
+        _mm_storeu_si128( (__m128i *) output + j,
+                          _mm_aesenclast_si128( b[j], k[NUMBER_OF_ROUNDS] ) );
+}
+#endif /* POLARSSL_HAVE_X86_SIMD */
+
+static void aes_ctr_blocks_c( aes_context_t *ctx, uint8_t counter[16],
+                              size_t blocks, uint8_t *output )
+{
+    while( blocks-- > 0 )
+    {
+        aes_ctr_inc( counter );
+        aes_crypt_ecb( ctx, AES_ENCRYPT, counter, output );
+        output += 16;
+    }
+}
+
+const impl_backend_t aes_ctr_aesni_impl =
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    { IMPL_AES_CTR, "aesni", CPU_AESNI, 10, IMPL_FN( aes_ctr_blocks_aesni ) };
+#else
+    { IMPL_AES_CTR, "aesni", CPU_AESNI, 10, NULL };
+#endif
+
+const impl_backend_t aes_ctr_c_impl =
+    { IMPL_AES_CTR, "c", 0, 0, IMPL_FN( aes_ctr_blocks_c ) };
+
+/*
+ * AES-CTR keystream blocks
+ */
+int aes_crypt_ctr_blocks( aes_context_t *ctx, uint8_t counter[16], size_t blocks, uint8_t *output )
+{
+    const impl_backend_t *impl = impl_select( IMPL_AES_CTR );
+
+    if( impl != NULL )
+        ( (impl_aes_ctr_t) impl->fn )( ctx, counter, blocks, output );
+    else
+        aes_ctr_blocks_c( ctx, counter, blocks, output );
+
+    return( 0 );
+}
@@ -77,6 +77,23 @@ int aes_crypt_ecb( aes_context_t *ctx, int mode, const uint8_t input[16], uint8_
  */
 int aes_crypt_cbc( aes_context_t *ctx, int mode, size_t length, uint8_t iv[16], const uint8_t *input, uint8_t *output );
 
+/**
+ * \brief          AES-CTR keystream: for each block, increment the 128-bit
+ *                 big endian counter, then encrypt it into output
+ *                 (the order used by CTR_DRBG)
+ *
+ *                 Several blocks are kept in flight with AES-NI when
+ *                 available.
+ *
+ * \param ctx      AES context (encryption key)
+ * \param counter  128-bit counter, updated to the last value encrypted
+ * \param blocks   number of 16-byte blocks to produce
+ * \param output   buffer of 16 * blocks bytes
+ *
+ * \return         0 if successful
+ */
+int aes_crypt_ctr_blocks( aes_context_t *ctx, uint8_t counter[16], size_t blocks, uint8_t *output );
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,5 +1,10 @@
 #include "..\zmodule.h"
 #include "base64.h"
+#include "cpu.h"
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
 
 static const uint8_t base64_enc_map[64] =
 {
@@ -29,13 +34,284 @@ static const uint8_t base64_dec_map[128] =
      49,  50,  51, 127, 127, 127, 127, 127
 };
 
+#define BASE64_SIMD_NONE    0
+#define BASE64_SIMD_SSSE3   1
+#define BASE64_SIMD_AVX2    2
+
+static int base64_simd_level(void)
+{
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    if (cpu_supports(CPU_AVX2)) {
+        return BASE64_SIMD_AVX2;
+    }
+    if (cpu_supports(CPU_SSSE3)) {
+        return BASE64_SIMD_SSSE3;
+    }
+#endif
+    return BASE64_SIMD_NONE;
+}
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+/*
+ * Vector kernels after W. Mula and D. Lemire, "Faster Base64 Encoding and
+ * Decoding using AVX2 Instructions". Each 128-bit lane turns 12 bytes into
+ * 16 characters and back; a lane holding anything but the 64 alphabet
+ * characters is left to the scalar code.
+ */
+
+static __m128i base64_enc_lookup_128(__m128i idx)
+{
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                        '/' - 63, 'A', 0, 0);
+    __m128i r;
+
+    /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+    r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx),
+                                      _mm_set1_epi8(13)));
+
+    return _mm_add_epi8(idx, _mm_shuffle_epi8(shift, r));
+}
+
+static size_t base64_encode_ssse3(uint8_t *dst, const uint8_t *src, size_t slen)
+{
+    const __m128i shuf = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                       7, 6, 8, 7, 10, 9, 11, 10);
+    size_t i;
+    __m128i in, t0, t1;
+
+    /* 16 bytes are loaded for every 12 consumed */
+    for (i = 0; i + 16 <= slen; i += 12, dst += 16) {
+        in = _mm_loadu_si128((const __m128i *)(src + i));
+        in = _mm_shuffle_epi8(in, shuf);
+        t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+                             _mm_set1_epi32(0x04000040));
+        t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+                             _mm_set1_epi32(0x01000010));
+        _mm_storeu_si128((__m128i *)dst, base64_enc_lookup_128(_mm_or_si128(t0, t1)));
+    }
+
+    return i;
+}
+
+static size_t base64_encode_avx2(uint8_t *dst, const uint8_t *src, size_t slen)
+{
+    const __m256i shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                          7, 6, 8, 7, 10, 9, 11, 10,
+                                          1, 0, 2, 1, 4, 3, 5, 4,
+                                          7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0);
+    size_t i;
+    __m256i in, t0, t1, r;
+
+    /* each lane loads 16 bytes, the upper one starting 12 bytes in */
+    for (i = 0; i + 28 <= slen; i += 24, dst += 32) {
+        in = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i)));
+        in = _mm256_inserti128_si256(in, _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, shuf);
+        t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)),
+                                _mm256_set1_epi32(0x04000040));
+        t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)),
+                                _mm256_set1_epi32(0x01000010));
+        in = _mm256_or_si256(t0, t1);
+
+        r = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+        r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), in),
+                                                _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i *)dst, _mm256_add_epi8(in, _mm256_shuffle_epi8(shift, r)));
+    }
+
+    _mm256_zeroupper();
+
+    return i;
+}
+
+/*
+ * Classify by nibbles: a character is in the alphabet iff the bits picked
+ * by its low nibble and its high nibble do not intersect.
+ */
+#define BASE64_LUT_LO   0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
+                        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A
+#define BASE64_LUT_HI   0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, \
+                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+#define BASE64_LUT_ROLL 0, 16, 19, 4, -65, -65, -71, -71, \
+                        0, 0, 0, 0, 0, 0, 0, 0
+#define BASE64_PACK     2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+/*
+ * Decode 16 characters into 12 bytes. 16 bytes are stored. Returns 0 and
+ * writes nothing if a character is outside the alphabet.
+ */
+static int base64_decode_ssse3(uint8_t *dst, const uint8_t *src)
+{
+    __m128i in, hi, lo, v;
+
+    in = _mm_loadu_si128((const __m128i *)src);
+    hi = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+    lo = _mm_shuffle_epi8(_mm_setr_epi8(BASE64_LUT_LO), _mm_and_si128(in, _mm_set1_epi8(0x0F)));
+    v  = _mm_and_si128(lo, _mm_shuffle_epi8(_mm_setr_epi8(BASE64_LUT_HI), hi));
+
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_setzero_si128())) != 0) {
+        return 0;
+    }
+
+    v = _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hi);
+    v = _mm_add_epi8(in, _mm_shuffle_epi8(_mm_setr_epi8(BASE64_LUT_ROLL), v));
+
+    /* 4 x 6 bits -> 24 bits per dword, then drop the top byte */
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(BASE64_PACK));
+
+    _mm_storeu_si128((__m128i *)dst, v);
+
+    return 1;
+}
+
+/*
+ * Decode 32 characters into 24 bytes. 32 bytes are stored.
+ */
+static int base64_decode_avx2(uint8_t *dst, const uint8_t *src)
+{
+    __m256i in, hi, lo, v;
+
+    in = _mm256_loadu_si256((const __m256i *)src);
+    hi = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0F));
+    lo = _mm256_shuffle_epi8(_mm256_setr_epi8(BASE64_LUT_LO, BASE64_LUT_LO),
+                             _mm256_and_si256(in, _mm256_set1_epi8(0x0F)));
+    v  = _mm256_and_si256(lo, _mm256_shuffle_epi8(_mm256_setr_epi8(BASE64_LUT_HI, BASE64_LUT_HI), hi));
+
+    if (!_mm256_testz_si256(v, v)) {
+        _mm256_zeroupper();
+        return 0;
+    }
+
+    v = _mm256_add_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')), hi);
+    v = _mm256_add_epi8(in, _mm256_shuffle_epi8(_mm256_setr_epi8(BASE64_LUT_ROLL, BASE64_LUT_ROLL), v));
+
+    v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(BASE64_PACK, BASE64_PACK));
+    v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+    _mm256_storeu_si256((__m256i *)dst, v);
+    _mm256_zeroupper();
+
+    return 1;
+}
+
+/*
+ * Length of the leading run of alphabet characters, in whole vectors.
+ */
+static size_t base64_scan_simd(const uint8_t *src, size_t slen, int simd)
+{
+    size_t i = 0;
+    __m128i in, lo, hi, v;
+
+    if (simd == BASE64_SIMD_AVX2) {
+        __m256i in2, lo2, hi2, v2;
+
+        for (; i + 32 <= slen; i += 32) {
+            in2 = _mm256_loadu_si256((const __m256i *)(src + i));
+            hi2 = _mm256_and_si256(_mm256_srli_epi32(in2, 4), _mm256_set1_epi8(0x0F));
+            lo2 = _mm256_shuffle_epi8(_mm256_setr_epi8(BASE64_LUT_LO, BASE64_LUT_LO),
+                                      _mm256_and_si256(in2, _mm256_set1_epi8(0x0F)));
+            v2  = _mm256_and_si256(lo2, _mm256_shuffle_epi8(_mm256_setr_epi8(BASE64_LUT_HI, BASE64_LUT_HI), hi2));
+            if (!_mm256_testz_si256(v2, v2)) {
+                break;
+            }
+        }
+
+        _mm256_zeroupper();
+    }
+
+    for (; i + 16 <= slen; i += 16) {
+        in = _mm_loadu_si128((const __m128i *)(src + i));
+        hi = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+        lo = _mm_shuffle_epi8(_mm_setr_epi8(BASE64_LUT_LO), _mm_and_si128(in, _mm_set1_epi8(0x0F)));
+        v  = _mm_and_si128(lo, _mm_shuffle_epi8(_mm_setr_epi8(BASE64_LUT_HI), hi));
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_setzero_si128())) != 0) {
+            break;
+        }
+    }
+
+    return i;
+}
+#endif /* POLARSSL_HAVE_X86_SIMD */
+
+/*
+ * Encode whole 3-byte groups; returns the end of the output
+ */
+static uint8_t *base64_encode_blocks(uint8_t *p, const uint8_t *src, size_t n, int simd)
+{
+    size_t i = 0;
+    int C1, C2, C3;
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    if (simd == BASE64_SIMD_AVX2) {
+        i = base64_encode_avx2(p, src, n);
+        p += (i / 3) * 4;
+    }
+    if (simd != BASE64_SIMD_NONE) {
+        size_t k = base64_encode_ssse3(p, src + i, n - i);
+        p += (k / 3) * 4;
+        i += k;
+    }
+#else
+    (void)simd;
+#endif
+
+    for (src += i; i < n; i += 3) {
+        C1 = *src++;
+        C2 = *src++;
+        C3 = *src++;
+
+        *p++ = base64_enc_map[(C1 >> 2) & 0x3F];
+        *p++ = base64_enc_map[(((C1 &  3) << 4) + (C2 >> 4)) & 0x3F];
+        *p++ = base64_enc_map[(((C2 & 15) << 2) + (C3 >> 6)) & 0x3F];
+        *p++ = base64_enc_map[C3 & 0x3F];
+    }
+
+    return p;
+}
+
+/*
+ * Encode the final 1 or 2 bytes with padding
+ */
+static uint8_t *base64_encode_tail(uint8_t *p, const uint8_t *src, size_t n)
+{
+    int C1, C2;
+
+    C1 = src[0];
+    C2 = (n > 1) ? src[1] : 0;
+
+    *p++ = base64_enc_map[(C1 >> 2) & 0x3F];
+    *p++ = base64_enc_map[(((C1 & 3) << 4) + (C2 >> 4)) & 0x3F];
+
+    if (n > 1)
+         *p++ = base64_enc_map[((C2 & 15) << 2) & 0x3F];
+    else *p++ = '=';
+
+    *p++ = '=';
+
+    return p;
+}
+
 /*
  * Encode a buffer into base64 format
  */
 int base64_encode(uint8_t *dst, size_t* dlen, const uint8_t* src, size_t slen)
 {
-    size_t i, n;
-    int C1, C2, C3;
+    size_t n;
     uint8_t *p;
 
     if (slen == 0) {
@@ -57,33 +333,90 @@ int base64_encode(uint8_t *dst, size_t* dlen, const uint8_t* src, size_t slen)
 
     n = (slen / 3) * 3;
 
-    for (i = 0, p = dst; i < n; i += 3) {
-        C1 = *src++;
-        C2 = *src++;
-        C3 = *src++;
+    p = base64_encode_blocks(dst, src, n, base64_simd_level());
 
-        *p++ = base64_enc_map[(C1 >> 2) & 0x3F];
-        *p++ = base64_enc_map[(((C1 &  3) << 4) + (C2 >> 4)) & 0x3F];
-        *p++ = base64_enc_map[(((C2 & 15) << 2) + (C3 >> 6)) & 0x3F];
-        *p++ = base64_enc_map[C3 & 0x3F];
+    if (n < slen) {
+        p = base64_encode_tail(p, src + n, slen - n);
     }
 
-    if (i < slen) {
-        C1 = *src++;
-        C2 = ((i + 1) < slen) ? *src++ : 0;
+    *dlen = p - dst;
+    *p = 0;
 
-        *p++ = base64_enc_map[(C1 >> 2) & 0x3F];
-        *p++ = base64_enc_map[(((C1 & 3) << 4) + (C2 >> 4)) & 0x3F];
+    return 0;
+}
+
+/*
+ * Decode characters, carrying a partial quartet in *px / *pn and the number
+ * of '=' seen in *pj. Line breaks are skipped. *olen receives the number of
+ * bytes written; dst must hold ((*pn + slen) / 4) * 3 bytes.
+ */
+static int base64_decode_run(uint8_t *dst, size_t dsize, size_t *olen,
+                             const uint8_t *src, size_t slen,
+                             uint32_t *px, int *pn, int *pj, int simd)
+{
+    size_t i;
+    uint32_t x = *px, c;
+    int n = *pn, j = *pj;
+    uint8_t *p = dst, *end = dst + dsize;
 
-        if( (i + 1) < slen )
-             *p++ = base64_enc_map[((C2 & 15) << 2) & 0x3F];
-        else *p++ = '=';
+    for (i = 0; i < slen; ) {
+#if defined(POLARSSL_HAVE_X86_SIMD)
+        /* whole quartets only, and never past the caller's buffer */
+        if (n == 0 && j == 0 && simd != BASE64_SIMD_NONE) {
+            if (simd == BASE64_SIMD_AVX2 && slen - i >= 32 && end - p >= 32 &&
+                base64_decode_avx2(p, src + i)) {
+                p += 24;
+                i += 32;
+                continue;
+            }
+            if (slen - i >= 16 && end - p >= 16 && base64_decode_ssse3(p, src + i)) {
+                p += 12;
+                i += 16;
+                continue;
+            }
+        }
+#else
+        (void)simd;
+        (void)end;
+#endif
+        c = src[i++];
+
+        if (c == '\r' || c == '\n') {
+            continue;
+        }
 
-        *p++ = '=';
+        if (c > 127 || base64_dec_map[c] == 127) {
+            return POLARSSL_ERR_BASE64_INVALID_CHARACTER;
+        }
+
+        c = base64_dec_map[c];
+
+        if (c == 64) {
+            if (++j > 2) {
+                return POLARSSL_ERR_BASE64_INVALID_CHARACTER;
+            }
+        } else if (j != 0) {
+            return POLARSSL_ERR_BASE64_INVALID_CHARACTER;
+        }
+
+        x = (x << 6) | (c & 0x3F);
+
+        if (++n == 4) {
+            n = 0;
+            *p++ = (uint8_t)(x >> 16);
+            if (j < 2) {
+                *p++ = (uint8_t)(x >> 8);
+            }
+            if (j < 1) {
+                *p++ = (uint8_t)(x);
+            }
+        }
     }
 
-    *dlen = p - dst;
-    *p = 0;
+    *px = x;
+    *pn = n;
+    *pj = j;
+    *olen = p - dst;
 
     return 0;
 }
@@ -95,9 +428,20 @@ int base64_decode(uint8_t *dst, size_t *dlen, const uint8_t *src, size_t slen)
 {
     size_t i, n;
     uint32_t j, x;
-    uint8_t *p;
+    int simd = base64_simd_level();
+    int qn = 0, qj = 0;
 
     for (i = n = j = 0; i < slen; ++i) {
+#if defined(POLARSSL_HAVE_X86_SIMD)
+        if (j == 0 && simd != BASE64_SIMD_NONE) {
+            size_t k = base64_scan_simd(src + i, slen - i, simd);
+            n += k;
+            i += k;
+            if (i == slen) {
+                break;
+            }
+        }
+#endif
         if ((slen - i) >= 2 && src[i] == '\r' && src[i + 1] == '\n') {
             continue;
         }
@@ -131,29 +475,107 @@ int base64_decode(uint8_t *dst, size_t *dlen, const uint8_t *src, size_t slen)
         return POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL;
     }
 
-    for (j = 3, n = x = 0, p = dst; i > 0; i--, ++src) {
-        if (*src == '\r' || *src == '\n') {
-            continue;
-        }
+    /* input is valid; a trailing partial quartet is dropped as before */
+    x = 0;
+    return base64_decode_run(dst, *dlen, dlen, src, slen, &x, &qn, &qj, simd);
+}
 
-        j -= ( base64_dec_map[*src] == 64 );
-        x  = (x << 6) | ( base64_dec_map[*src] & 0x3F );
+void base64_init(base64_context *ctx)
+{
+    __stosb((uint8_t *)ctx, 0, sizeof(base64_context));
+}
 
-        if (++n == 4) {
-            n = 0;
-            if (j > 0) {
-                *p++ = (uint8_t)(x >> 16);
-            }
-            if (j > 1) {
-                *p++ = (uint8_t)(x >> 8);
-            }
-            if (j > 2) {
-                *p++ = (uint8_t)(x);
-            }
+int base64_encode_update(base64_context *ctx, uint8_t *dst, size_t *dlen,
+                         const uint8_t *src, size_t slen)
+{
+    size_t n, fill;
+    uint8_t *p = dst;
+
+    n = ((ctx->n + slen) / 3) * 4;
+
+    if (*dlen < n) {
+        *dlen = n;
+        return POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+
+    if (ctx->n != 0) {
+        fill = 3 - ctx->n;
+        if (fill > slen) {
+            fill = slen;
+        }
+        __movsb(ctx->buf + ctx->n, src, fill);
+        ctx->n += (int)fill;
+        src += fill;
+        slen -= fill;
+
+        if (ctx->n < 3) {
+            *dlen = 0;
+            return 0;
         }
+
+        p = base64_encode_blocks(p, ctx->buf, 3, BASE64_SIMD_NONE);
+        ctx->n = 0;
+    }
+
+    n = (slen / 3) * 3;
+    p = base64_encode_blocks(p, src, n, base64_simd_level());
+
+    ctx->n = (int)(slen - n);
+    if (ctx->n != 0) {
+        __movsb(ctx->buf, src + n, ctx->n);
     }
 
     *dlen = p - dst;
 
     return 0;
 }
+
+int base64_encode_finish(base64_context *ctx, uint8_t *dst, size_t *dlen)
+{
+    size_t n = (ctx->n != 0) ? 4 : 0;
+
+    if (*dlen < n) {
+        *dlen = n;
+        return POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+
+    if (n != 0) {
+        base64_encode_tail(dst, ctx->buf, ctx->n);
+    }
+
+    *dlen = n;
+    base64_init(ctx);
+
+    return 0;
+}
+
+int base64_decode_update(base64_context *ctx, uint8_t *dst, size_t *dlen,
+                         const uint8_t *src, size_t slen)
+{
+    size_t n;
+    int ret;
+
+    n = ((ctx->n + slen) / 4) * 3;
+
+    if (*dlen < n) {
+        *dlen = n;
+        return POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+
+    if ((ret = base64_decode_run(dst, *dlen, dlen, src, slen, &ctx->acc,
+                                 &ctx->n, &ctx->pad, base64_simd_level())) != 0) {
+        *dlen = 0;
+        base64_init(ctx);
+    }
+
+    return ret;
+}
+
+int base64_decode_finish(base64_context *ctx)
+{
+    int n = ctx->n;
+
+    base64_init(ctx);
+
+    return (n != 0) ? POLARSSL_ERR_BASE64_INVALID_CHARACTER : 0;
+}
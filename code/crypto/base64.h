@@ -8,6 +8,18 @@
 extern "C" {
 #endif
 
+/**
+ * \brief          Base64 streaming context
+ */
+typedef struct
+{
+    uint32_t acc;               /*!< decode: sextets of a partial quartet   */
+    int n;                      /*!< bytes in buf / sextets in acc          */
+    int pad;                    /*!< decode: '=' characters seen            */
+    uint8_t buf[3];             /*!< encode: bytes of a partial group       */
+}
+base64_context;
+
 /**
  * \brief          Encode a buffer into base64 format
  *
@@ -45,6 +57,74 @@ int base64_encode( uint8_t *dst, size_t *dlen,
 int base64_decode( uint8_t *dst, size_t *dlen,
                    const uint8_t *src, size_t slen );
 
+/**
+ * \brief          Initialize (or reset) a streaming context
+ *
+ * \param ctx      context to be initialized
+ */
+void base64_init( base64_context *ctx );
+
+/**
+ * \brief          Encode the next part of a stream
+ *
+ *                 Bytes that do not complete a 3-byte group are kept in
+ *                 the context until the next call. No NUL is written.
+ *
+ * \param ctx      streaming context
+ * \param dst      destination buffer
+ * \param dlen     size of the buffer, at least ((pending + slen) / 3) * 4
+ * \param src      source buffer
+ * \param slen     amount of data to be encoded
+ *
+ * \return         0 if successful, or POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL
+ *                 with the required size in *dlen. On success *dlen is set
+ *                 to the amount of data written.
+ */
+int base64_encode_update( base64_context *ctx, uint8_t *dst, size_t *dlen,
+                          const uint8_t *src, size_t slen );
+
+/**
+ * \brief          Finish an encoded stream, writing the padded last group
+ *
+ * \param ctx      streaming context, reset on success
+ * \param dst      destination buffer (4 bytes are enough)
+ * \param dlen     size of the buffer, set to the amount of data written
+ *
+ * \return         0 if successful, or POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL
+ */
+int base64_encode_finish( base64_context *ctx, uint8_t *dst, size_t *dlen );
+
+/**
+ * \brief          Decode the next part of a stream
+ *
+ *                 Characters may be split anywhere between calls; '\r' and
+ *                 '\n' are skipped. Characters that do not complete a
+ *                 quartet are kept in the context.
+ *
+ * \param ctx      streaming context
+ * \param dst      destination buffer
+ * \param dlen     size of the buffer, at least ((pending + slen) / 4) * 3
+ * \param src      source buffer
+ * \param slen     amount of data to be decoded
+ *
+ * \return         0 if successful, POLARSSL_ERR_BASE64_BUFFER_TOO_SMALL with
+ *                 the required size in *dlen, or
+ *                 POLARSSL_ERR_BASE64_INVALID_CHARACTER (the context is reset).
+ *                 On success *dlen is set to the amount of data written.
+ */
+int base64_decode_update( base64_context *ctx, uint8_t *dst, size_t *dlen,
+                          const uint8_t *src, size_t slen );
+
+/**
+ * \brief          Finish a decoded stream
+ *
+ * \param ctx      streaming context, always reset
+ *
+ * \return         0 if successful, or POLARSSL_ERR_BASE64_INVALID_CHARACTER
+ *                 if the input ended inside a quartet
+ */
+int base64_decode_finish( base64_context *ctx );
+
 /**
  * \brief          Checkup routine
  *
@@ -3,6 +3,18 @@
 
 #include "bignum.h"
 #include "bn_mul.h"
+#include "cpu.h"
+#include "impl.h"
+
+/*
+ * MULX/ADX kernels are only worth it with 64-bit limbs: with 32-bit limbs
+ * a plain MUL already gives the double limb product, and the fused loops
+ * on t_udbl keep the carries in registers where intrinsics cannot.
+ */
+#if defined(POLARSSL_HAVE_X86_SIMD) && defined(POLARSSL_HAVE_INT64)
+#define POLARSSL_MPI_HAVE_ADX
+#include <immintrin.h>
+#endif
 
 #define ciL    (sizeof(t_uint))         /* chars in limb  */
 #define biL    (ciL << 3)               /* bits  in limb  */
@@ -14,6 +26,235 @@
 #define BITS_TO_LIMBS(i)  (((i) + biL - 1) / biL)
 #define CHARS_TO_LIMBS(i) (((i) + ciL - 1) / ciL)
 
+#if defined(POLARSSL_MPI_ARENA)
+/*
+ * Per-thread scratch arena.
+ *
+ * Each outermost scope gets an id, unique across threads, and mpi_init()
+ * tags the MPI with the id of the scope open on the thread, if any. Limbs
+ * of an MPI tagged with the current scope are bumped from the arena: it is
+ * a temporary of the scope. Everything else (results and contexts
+ * initialized before the scope, MPIs from mpi_init_persistent()) keeps
+ * using the heap, and blocks are told apart on release by their address.
+ */
+typedef struct
+{
+    uint8_t *buf;               /*!<  arena memory, or NULL             */
+    size_t size;                /*!<  size of buf                       */
+    size_t used;                /*!<  bytes handed out                  */
+    size_t top;                 /*!<  highest used in this scope        */
+    size_t want;                /*!<  highest used + overflow requests  */
+    long scope;                 /*!<  id of the open scope              */
+    int depth;                  /*!<  nesting depth of scopes           */
+    mpi_arena_stats stats;
+}
+mpi_arena;
+
+static async_key_t mpi_arena_key;
+static async_once_t mpi_arena_once = ASYNC_ONCE_INIT;
+static volatile long mpi_arena_scopes;
+static int mpi_arena_key_ok = 0;
+
+static void mpi_arena_init_key( void )
+{
+    mpi_arena_key_ok = ( async_key_create( &mpi_arena_key ) == 0 );
+}
+
+/*
+ * Arena of the calling thread, created on request
+ */
+static mpi_arena *mpi_arena_get( int create )
+{
+    mpi_arena *a;
+
+    if( ! mpi_arena_key_ok )
+    {
+        if( ! create )
+            return( NULL );
+
+        async_once( &mpi_arena_once, mpi_arena_init_key );
+        if( ! mpi_arena_key_ok )
+            return( NULL );
+    }
+
+    a = (mpi_arena *) async_key_get( &mpi_arena_key );
+    if( a == NULL && create )
+    {
+        if( ( a = (mpi_arena *) memory_alloc( sizeof( mpi_arena ) ) ) == NULL )
+            return( NULL );
+
+        __stosb( a, 0, sizeof( mpi_arena ) );
+        async_key_set( &mpi_arena_key, a );
+    }
+
+    return( a );
+}
+
+/*
+ * Arena blocks are followed by a size_t holding their total length, with
+ * bit 0 set once released, so that blocks released out of order are
+ * popped together with the last one.
+ */
+#define MPI_ARENA_BLOCK( n )                                                \
+    ( ( ( (n) * ciL + sizeof( size_t ) - 1 ) & ~( sizeof( size_t ) - 1 ) )  \
+      + sizeof( size_t ) )
+
+/*
+ * Limbs for X, or scratch limbs if X is NULL
+ */
+static t_uint *mpi_limbs_alloc( const mpi_t *X, size_t nblimbs )
+{
+    uint8_t *p;
+    size_t len = MPI_ARENA_BLOCK( nblimbs );
+    mpi_arena *a = mpi_arena_get( 0 );
+
+    if( a == NULL )
+        return( (t_uint *) memory_alloc( nblimbs * ciL ) );
+
+    if( a->depth > 0 && a->buf != NULL &&
+        ( X == NULL || X->scope == a->scope ) )
+    {
+        if( a->want < a->used + len )
+            a->want = a->used + len;
+
+        if( a->size - a->used >= len )
+        {
+            p = a->buf + a->used;
+            a->used += len;
+            if( a->top < a->used )
+                a->top = a->used;
+
+            *(size_t *)( p + len - sizeof( size_t ) ) = len;
+
+            a->stats.arena_allocs++;
+            return( (t_uint *) p );
+        }
+    }
+
+    a->stats.heap_allocs++;
+    return( (t_uint *) memory_alloc( nblimbs * ciL ) );
+}
+
+/*
+ * Release limbs from mpi_limbs_alloc()
+ */
+static void mpi_limbs_free( t_uint *p, size_t nblimbs )
+{
+    size_t *t;
+    mpi_arena *a = mpi_arena_get( 0 );
+
+    if( a == NULL || (uint8_t *) p < a->buf || (uint8_t *) p >= a->buf + a->size )
+    {
+        memory_free( p );
+        return;
+    }
+
+    t = (size_t *)( (uint8_t *) p + MPI_ARENA_BLOCK( nblimbs ) - sizeof( size_t ) );
+    *t |= 1;
+
+    while( a->used > 0 )
+    {
+        t = (size_t *)( a->buf + a->used - sizeof( size_t ) );
+        if( ( *t & 1 ) == 0 )
+            break;
+
+        a->used -= *t & ~(size_t) 1;
+    }
+}
+
+/*
+ * Id of the scope open on the calling thread, or 0
+ */
+static long mpi_arena_scope( void )
+{
+    mpi_arena *a = mpi_arena_get( 0 );
+
+    return( ( a != NULL && a->depth > 0 ) ? a->scope : 0 );
+}
+
+void mpi_arena_begin( void )
+{
+    mpi_arena *a;
+
+    if( ( a = mpi_arena_get( 1 ) ) == NULL || a->depth++ > 0 )
+        return;
+
+    /* 0 stands for "no scope" in mpi_t.scope */
+    while( ( a->scope = _InterlockedIncrement( &mpi_arena_scopes ) ) == 0 )
+        ;
+
+    if( a->buf == NULL &&
+        ( a->buf = (uint8_t *) memory_alloc( POLARSSL_MPI_ARENA_SIZE ) ) != NULL )
+        a->size = POLARSSL_MPI_ARENA_SIZE;
+}
+
+void mpi_arena_end( void )
+{
+    size_t size;
+    mpi_arena *a = mpi_arena_get( 0 );
+
+    if( a == NULL || a->depth == 0 || --a->depth > 0 )
+        return;
+
+    if( a->buf != NULL )
+        __stosb( a->buf, 0, a->top );
+
+    a->stats.scopes++;
+    if( a->stats.peak < a->want )
+        a->stats.peak = a->want;
+
+    /* Everything handed out is dead now, so the arena can move */
+    if( a->want > a->size && a->size < POLARSSL_MPI_ARENA_MAX )
+    {
+        size = ( a->want > 2 * a->size ) ? a->want : 2 * a->size;
+        size = ( size + 4095 ) & ~(size_t) 4095;
+        if( size > POLARSSL_MPI_ARENA_MAX )
+            size = POLARSSL_MPI_ARENA_MAX;
+
+        if( a->buf != NULL )
+            memory_free( a->buf );
+
+        if( ( a->buf = (uint8_t *) memory_alloc( size ) ) != NULL )
+            a->size = size;
+        else
+            a->size = 0;
+    }
+
+    a->used = a->top = a->want = 0;
+}
+
+void mpi_arena_free( void )
+{
+    mpi_arena *a = mpi_arena_get( 0 );
+
+    if( a == NULL || a->depth > 0 )
+        return;
+
+    if( a->buf != NULL )
+        memory_free( a->buf );
+
+    memory_free( a );
+    async_key_set( &mpi_arena_key, NULL );
+}
+
+void mpi_arena_get_stats( mpi_arena_stats *stats )
+{
+    mpi_arena *a = mpi_arena_get( 1 );
+
+    if( a == NULL )
+    {
+        __stosb( stats, 0, sizeof( mpi_arena_stats ) );
+        return;
+    }
+
+    __movsb( stats, &a->stats, sizeof( mpi_arena_stats ) );
+    stats->size = a->size;
+}
+#else
+#define mpi_limbs_alloc( X, n )     (t_uint *) memory_alloc( (n) * ciL )
+#define mpi_limbs_free( p, n )      memory_free( p )
+#endif /* POLARSSL_MPI_ARENA */
+
 /*
  * Initialize one MPI
  */
@@ -25,7 +266,24 @@ void mpi_init( mpi_t *X )
     X->s = 1;
     X->n = 0;
     X->p = NULL;
+#if defined(POLARSSL_MPI_ARENA)
+    X->scope = mpi_arena_scope();
+#endif
+}
+
+#if defined(POLARSSL_MPI_ARENA)
+/*
+ * Initialize one MPI whose limbs never come from the arena
+ */
+void mpi_init_persistent( mpi_t *X )
+{
+    if( X == NULL )
+        return;
+
+    mpi_init( X );
+    X->scope = 0;
 }
+#endif /* POLARSSL_MPI_ARENA */
 
 /*
  * Unallocate one MPI
@@ -38,7 +296,7 @@ void mpi_free( mpi_t *X )
     if( X->p != NULL )
     {
         __stosb( X->p, 0, X->n * ciL );
-        memory_free( X->p );
+        mpi_limbs_free( X->p, X->n );
     }
 
     X->s = 1;
@@ -58,7 +316,7 @@ int mpi_grow( mpi_t *X, size_t nblimbs )
 
     if( X->n < nblimbs )
     {
-        if( ( p = (t_uint *) memory_alloc( nblimbs * ciL ) ) == NULL )
+        if( ( p = mpi_limbs_alloc( X, nblimbs ) ) == NULL )
             return( POLARSSL_ERR_MPI_MALLOC_FAILED );
 
         __stosb( p, 0, nblimbs * ciL );
@@ -67,7 +325,7 @@ int mpi_grow( mpi_t *X, size_t nblimbs )
         {
             __movsb( p, X->p, X->n * ciL );
             __stosb( X->p, 0, X->n * ciL );
-            memory_free( X->p );
+            mpi_limbs_free( X->p, X->n );
         }
 
         X->n = nblimbs;
@@ -98,7 +356,7 @@ int mpi_shrink( mpi_t *X, size_t nblimbs )
     if( i < nblimbs )
         i = nblimbs;
 
-    if( ( p = (t_uint *) memory_alloc( i * ciL ) ) == NULL )
+    if( ( p = mpi_limbs_alloc( X, i ) ) == NULL )
         return( POLARSSL_ERR_MPI_MALLOC_FAILED );
 
     __stosb( p, 0, i * ciL );
@@ -107,7 +365,7 @@ int mpi_shrink( mpi_t *X, size_t nblimbs )
     {
         __movsb( p, X->p, i * ciL );
         __stosb( X->p, 0, X->n * ciL );
-        memory_free( X->p );
+        mpi_limbs_free( X->p, X->n );
     }
 
     X->n = i;
@@ -550,6 +808,45 @@ int mpi_write_binary(const mpi_t *X, uint8_t *buf, size_t buflen )
     return 0;
 }
 
+/*
+ * Import X from unsigned binary data, little endian
+ */
+int mpi_read_binary_le( mpi_t *X, const uint8_t *buf, size_t buflen )
+{
+    int ret;
+    size_t i;
+
+    MPI_CHK( mpi_grow( X, CHARS_TO_LIMBS( buflen ) ) );
+    MPI_CHK( mpi_lset( X, 0 ) );
+
+    for( i = 0; i < buflen; i++ )
+        X->p[i / ciL] |= ((t_uint) buf[i]) << ((i % ciL) << 3);
+
+cleanup:
+
+    return( ret );
+}
+
+/*
+ * Export X into unsigned binary data, little endian
+ */
+int mpi_write_binary_le( const mpi_t *X, uint8_t *buf, size_t buflen )
+{
+    size_t i, n;
+
+    n = mpi_size( X );
+
+    if( buflen < n )
+        return( POLARSSL_ERR_MPI_BUFFER_TOO_SMALL );
+
+    __stosb( buf, 0, buflen );
+
+    for( i = 0; i < n; i++ )
+        buf[i] = (uint8_t)( X->p[i / ciL] >> ((i % ciL) << 3) );
+
+    return( 0 );
+}
+
 /*
  * Left-shift: X <<= count
  */
@@ -1004,14 +1301,242 @@ void mpi_mul_hlp( size_t i, t_uint *s, t_uint *d, t_uint b )
     while( c != 0 );
 }
 
+#if defined(POLARSSL_MPI_HAVE_ADX)
+/*
+ * MULX/ADCX/ADOX versions of the multiply-accumulate loops
+ */
+#define MPI_MULX( a, b, hi )        _mulx_u64( a, b, hi )
+#define MPI_ADCX( c, a, b, r )      _addcarryx_u64( c, a, b, r )
+
+/*
+ * d[0..n] += s[0..n-1] * b, returns the carry out of d[n] (0, 1 or 2).
+ *
+ * The low halves of the products go down one carry chain and the high
+ * halves down another, so the compiler can use ADCX and ADOX side by side.
+ */
+static t_uint mpi_muladd_adx( size_t n, const t_uint *s, t_uint *d, t_uint b )
+{
+    size_t j;
+    t_uint lo, hi;
+    uint8_t c1 = 0, c2 = 0;
+
+    for( j = 0; j < n; j++ )
+    {
+        lo = MPI_MULX( s[j], b, &hi );
+        c1 = MPI_ADCX( c1, d[j], lo, &d[j] );
+        c2 = MPI_ADCX( c2, d[j + 1], hi, &d[j + 1] );
+    }
+
+    c1 = MPI_ADCX( c1, d[n], 0, &d[n] );
+
+    return( (t_uint) c1 + c2 );
+}
+
+/*
+ * Same contract as mpi_mul_hlp()
+ */
+static void mpi_mul_hlp_adx( size_t i, t_uint *s, t_uint *d, t_uint b )
+{
+    t_uint c;
+
+    c = mpi_muladd_adx( i, s, d, b );
+    d += i + 1;
+
+    while( c != 0 )
+    {
+        *d += c; c = ( *d < c ); d++;
+    }
+}
+#endif /* POLARSSL_MPI_HAVE_ADX */
+
+typedef impl_mpi_muladd_t mpi_mul_hlp_t;
+
+const impl_backend_t mpi_muladd_adx_impl =
+#if defined(POLARSSL_MPI_HAVE_ADX)
+    { IMPL_MPI_MULADD, "adx", CPU_BMI2 | CPU_ADX, 10,
+      IMPL_FN( mpi_mul_hlp_adx ) };
+#else
+    { IMPL_MPI_MULADD, "adx", CPU_BMI2 | CPU_ADX, 10, NULL };
+#endif
+
+const impl_backend_t mpi_muladd_c_impl =
+    { IMPL_MPI_MULADD, "c", 0, 0, IMPL_FN( mpi_mul_hlp ) };
+
+/*
+ * Pick the multiply-accumulate loop once per operation
+ */
+static mpi_mul_hlp_t mpi_mul_hlp_select( void )
+{
+    const impl_backend_t *impl = impl_select( IMPL_MPI_MULADD );
+
+    return( ( impl != NULL ) ? (mpi_mul_hlp_t) impl->fn : mpi_mul_hlp );
+}
+
+/*
+ * r = a + b over n limbs, returns the carry
+ */
+static t_uint mpi_add_n( t_uint *r, const t_uint *a, const t_uint *b, size_t n )
+{
+    size_t i;
+    t_uint c = 0, t;
+
+    for( i = 0; i < n; i++ )
+    {
+        t = a[i] + c; c = ( t < c );
+        r[i] = t + b[i]; c += ( r[i] < t );
+    }
+
+    return( c );
+}
+
+/*
+ * r = a - b over n limbs, returns the borrow
+ */
+static t_uint mpi_sub_n( t_uint *r, const t_uint *a, const t_uint *b, size_t n )
+{
+    size_t i;
+    t_uint c = 0, t, z;
+
+    for( i = 0; i < n; i++ )
+    {
+        z = ( a[i] < c ); t = a[i] - c;
+        c = ( t < b[i] ) + z; r[i] = t - b[i];
+    }
+
+    return( c );
+}
+
+/*
+ * r = |x - y| over k limbs, x and y zero-extended from nx and ny limbs;
+ * returns 1 if x < y
+ */
+static int mpi_diff_n( t_uint *r, const t_uint *x, size_t nx,
+                       const t_uint *y, size_t ny, size_t k )
+{
+    size_t i;
+    t_uint c = 0, a, b, z, mask;
+
+    for( i = 0; i < k; i++ )
+    {
+        a = ( i < nx ) ? x[i] : 0;
+        b = ( i < ny ) ? y[i] : 0;
+        z = ( a < c ); a -= c;
+        c = ( a < b ) + z; r[i] = a - b;
+    }
+
+    /* Negate if x < y, without branching on the data */
+    mask = (t_uint) 0 - c;
+    z = c;
+    for( i = 0; i < k; i++ )
+    {
+        a = ( r[i] ^ mask ) + z;
+        z = ( a < z );
+        r[i] = a;
+    }
+
+    return( (int) c );
+}
+
+/*
+ * Schoolbook product: r[0..na+nb-1] = a * b
+ */
+static void mpi_mul_school( mpi_mul_hlp_t mul, t_uint *r,
+                            const t_uint *a, size_t na,
+                            const t_uint *b, size_t nb )
+{
+    size_t j;
+
+    __stosb( r, 0, ( na + nb ) * ciL );
+
+    for( j = nb; j > 0; j-- )
+        mul( na, (t_uint *) a, r + j - 1, b[j - 1] );
+}
+
+/*
+ * Scratch limbs needed by mpi_mul_kara() for n-limb operands
+ */
+static size_t mpi_kara_ws( size_t n )
+{
+    size_t k, ws = 0;
+
+    while( n >= POLARSSL_MPI_KARATSUBA_LIMBS )
+    {
+        k = n - n / 2;
+        ws += 6 * k + 1;
+        n = k;
+    }
+
+    return( ws );
+}
+
+/*
+ * Karatsuba product: r[0..2n-1] = a * b, a and b of n limbs.
+ *
+ * With a = a1 X + a0 and b = b1 X + b0 (X = 2^(m biL)), the middle term
+ * a1 b0 + a0 b1 is a0 b0 + a1 b1 + (a0 - a1)(b1 - b0), which only needs
+ * limb-sized differences rather than the one-bit-longer sums.
+ */
+static void mpi_mul_kara( mpi_mul_hlp_t mul, t_uint *r,
+                          const t_uint *a, const t_uint *b, size_t n,
+                          t_uint *ws )
+{
+    size_t m, k, i;
+    t_uint *da, *db, *z1, *mid, c;
+    int neg;
+
+    if( n < POLARSSL_MPI_KARATSUBA_LIMBS )
+    {
+        mpi_mul_school( mul, r, a, n, b, n );
+        return;
+    }
+
+    m = n / 2;
+    k = n - m;
+
+    da  = ws;
+    db  = da + k;
+    z1  = db + k;
+    mid = z1 + 2 * k;
+    ws  = mid + 2 * k + 1;
+
+    neg  = mpi_diff_n( da, a, m, a + m, k, k );
+    neg ^= mpi_diff_n( db, b + m, k, b, m, k );
+
+    mpi_mul_kara( mul, r, a, b, m, ws );
+    mpi_mul_kara( mul, r + 2 * m, a + m, b + m, k, ws );
+    mpi_mul_kara( mul, z1, da, db, k, ws );
+
+    /* mid = a0 b0 + a1 b1 +/- |a0 - a1| |b1 - b0| */
+    __movsb( mid, r, 2 * m * ciL );
+    for( i = 2 * m; i < 2 * k + 1; i++ )
+        mid[i] = 0;
+
+    mid[2 * k] = mpi_add_n( mid, mid, r + 2 * m, 2 * k );
+
+    if( neg )
+        mid[2 * k] -= mpi_sub_n( mid, mid, z1, 2 * k );
+    else
+        mid[2 * k] += mpi_add_n( mid, mid, z1, 2 * k );
+
+    /* r += mid X */
+    c = mpi_add_n( r + m, r + m, mid, 2 * k + 1 );
+    for( i = m + 2 * k + 1; c != 0 && i < 2 * n; i++ )
+    {
+        r[i] += c; c = ( r[i] < c );
+    }
+}
+
 /*
- * Baseline multiplication: X = A * B  (HAC 14.12)
+ * Baseline multiplication: X = A * B  (HAC 14.12), Karatsuba for large
+ * operands
  */
 int mpi_mul_mpi( mpi_t *X, const mpi_t *A, const mpi_t *B )
 {
     int ret;
-    size_t i, j;
+    size_t i, j, k, len;
     mpi_t TA, TB;
+    t_uint *P = NULL, c;
+    mpi_mul_hlp_t mul = mpi_mul_hlp_select();
 
     mpi_init( &TA ); mpi_init( &TB );
 
@@ -1029,8 +1554,49 @@ int mpi_mul_mpi( mpi_t *X, const mpi_t *A, const mpi_t *B )
     MPI_CHK( mpi_grow( X, i + j ) );
     MPI_CHK( mpi_lset( X, 0 ) );
 
-    for( i++; j > 0; j-- )
-        mpi_mul_hlp( i - 1, A->p, X->p + j - 1, B->p[j - 1] );
+    if( i < POLARSSL_MPI_KARATSUBA_LIMBS || j < POLARSSL_MPI_KARATSUBA_LIMBS )
+    {
+        for( i++; j > 0; j-- )
+            mul( i - 1, A->p, X->p + j - 1, B->p[j - 1] );
+    }
+    else
+    {
+        /*
+         * Let A be the longer operand and cut it into slices of the length
+         * of B; full slices go through Karatsuba, the last one may not.
+         */
+        if( i < j )
+        {
+            const mpi_t *T = A; A = B; B = T;
+            k = i; i = j; j = k;
+        }
+
+        P = mpi_limbs_alloc( NULL, 2 * j + mpi_kara_ws( j ) );
+        if( P == NULL )
+        {
+            ret = POLARSSL_ERR_MPI_MALLOC_FAILED;
+            goto cleanup;
+        }
+
+        for( k = 0; k < i; k += j )
+        {
+            len = ( i - k < j ) ? i - k : j;
+
+            if( len == j )
+                mpi_mul_kara( mul, P, A->p + k, B->p, j, P + 2 * j );
+            else
+                mpi_mul_school( mul, P, A->p + k, len, B->p, j );
+
+            c = mpi_add_n( X->p + k, X->p + k, P, len + j );
+            for( len += k + j; c != 0; len++ )
+            {
+                X->p[len] += c; c = ( X->p[len] < c );
+            }
+        }
+
+        __stosb( P, 0, ( 2 * j + mpi_kara_ws( j ) ) * ciL );
+        mpi_limbs_free( P, 2 * j + mpi_kara_ws( j ) );
+    }
 
     X->s = A->s * B->s;
 
@@ -1344,6 +1910,227 @@ static void mpi_montg_init( t_uint *mm, const mpi_t *N )
     *mm = ~x + 1;
 }
 
+#if defined(POLARSSL_HAVE_UDBL)
+/*
+ * Montgomery rows, fused (CIOS): each step adds a_i * b_j and u * n_j in
+ * the same pass, so T is walked once per row instead of twice.
+ * d slides by one limb per row; the result ends up in d[n..2n].
+ */
+#define MPI_CIOS_STEP( j )                                  \
+    z  = (t_udbl) ai * b[j] + d[j] + c0;                    \
+    c0 = (t_uint)( z >> biL );                              \
+    z  = (t_udbl) u * N[j] + (t_uint) z + c1;               \
+    c1 = (t_uint)( z >> biL );                              \
+    d[j] = (t_uint) z;
+
+static void mpi_montmul_cios( size_t n, t_uint *d, const t_uint *a,
+                              const t_uint *b, const t_uint *N, t_uint mm )
+{
+    size_t i, j;
+    t_udbl z;
+    t_uint ai, u, c0, c1;
+
+    for( i = 0; i < n; i++, d++ )
+    {
+        ai = a[i];
+        z  = (t_udbl) ai * b[0] + d[0];
+        c0 = (t_uint)( z >> biL );
+        u  = (t_uint) z * mm;
+        z  = (t_udbl) u * N[0] + (t_uint) z;
+        c1 = (t_uint)( z >> biL );
+
+        /* Unrolled by 8: RSA moduli are multiples of 256 bits */
+        for( j = 1; j + 8 <= n; j += 8 )
+        {
+            MPI_CIOS_STEP( j     ) MPI_CIOS_STEP( j + 1 )
+            MPI_CIOS_STEP( j + 2 ) MPI_CIOS_STEP( j + 3 )
+            MPI_CIOS_STEP( j + 4 ) MPI_CIOS_STEP( j + 5 )
+            MPI_CIOS_STEP( j + 6 ) MPI_CIOS_STEP( j + 7 )
+        }
+
+        for( ; j < n; j++ )
+        {
+            MPI_CIOS_STEP( j )
+        }
+
+        z = (t_udbl) d[n] + c0 + c1;
+        d[n] = (t_uint) z;
+        d[n + 1] = (t_uint)( z >> biL );
+    }
+}
+
+#define MPI_MULADD_STEP( k )                                \
+    z = (t_udbl) ai * s[k] + d[k] + c;                      \
+    d[k] = (t_uint) z;                                      \
+    c = (t_uint)( z >> biL );
+
+/*
+ * d[0..len-1] += s * ai, returns the carry
+ */
+static t_uint mpi_muladd_row( size_t len, const t_uint *s, t_uint *d,
+                              t_uint ai )
+{
+    size_t k;
+    t_udbl z;
+    t_uint c = 0;
+
+    for( k = 0; k + 8 <= len; k += 8 )
+    {
+        MPI_MULADD_STEP( k     ) MPI_MULADD_STEP( k + 1 )
+        MPI_MULADD_STEP( k + 2 ) MPI_MULADD_STEP( k + 3 )
+        MPI_MULADD_STEP( k + 4 ) MPI_MULADD_STEP( k + 5 )
+        MPI_MULADD_STEP( k + 6 ) MPI_MULADD_STEP( k + 7 )
+    }
+
+    for( ; k < len; k++ )
+    {
+        MPI_MULADD_STEP( k )
+    }
+
+    return( c );
+}
+
+/*
+ * Montgomery squaring rows: t[0..2n] = a^2, then reduced in place so that
+ * the result ends up in t[n..2n]
+ */
+static void mpi_montsqr_rows( size_t n, t_uint *t, const t_uint *a,
+                              const t_uint *N, t_uint mm )
+{
+    size_t i;
+    t_udbl z;
+    t_uint lo, hi, sc, c;
+
+    /* Off-diagonal products a_i a_j, i < j; t[i + n] is still free */
+    for( i = 0; i + 1 < n; i++ )
+        t[i + n] = mpi_muladd_row( n - 1 - i, a + i + 1, t + 2 * i + 1, a[i] );
+
+    /* Double them and add the squares a_i^2 */
+    for( i = 0, sc = 0, c = 0; i < n; i++ )
+    {
+        lo = t[2 * i];
+        hi = t[2 * i + 1];
+        z  = (t_udbl) a[i] * a[i] + ( ( lo << 1 ) | sc ) + c;
+        t[2 * i] = (t_uint) z;
+        z  = ( z >> biL ) + ( ( hi << 1 ) | ( lo >> ( biL - 1 ) ) );
+        t[2 * i + 1] = (t_uint) z;
+        c  = (t_uint)( z >> biL );
+        sc = hi >> ( biL - 1 );
+    }
+
+    /* Reduce: the carry out of t[i + n] is held back for the next row */
+    for( i = 0, c = 0; i < n; i++ )
+    {
+        z = (t_udbl) t[i + n] + c +
+            mpi_muladd_row( n, N, t + i, t[i] * mm );
+        t[i + n] = (t_uint) z;
+        c = (t_uint)( z >> biL );
+    }
+
+    t[2 * n] = c;
+}
+#endif /* POLARSSL_HAVE_UDBL */
+
+#if defined(POLARSSL_MPI_HAVE_ADX)
+/*
+ * Montgomery rows with MULX/ADX: one dual-chain pass for a_i * B and one
+ * for u * N. d[n + 1] is still zero when a row starts.
+ */
+static void mpi_montmul_adx( size_t n, t_uint *d, const t_uint *a,
+                             const t_uint *b, const t_uint *N, t_uint mm )
+{
+    size_t i;
+    t_uint u;
+
+    for( i = 0; i < n; i++, d++ )
+    {
+        d[n + 1] = mpi_muladd_adx( n, b, d, a[i] );
+        u = d[0] * mm;
+        d[n + 1] += mpi_muladd_adx( n, N, d, u );
+    }
+}
+#endif /* POLARSSL_MPI_HAVE_ADX */
+
+const impl_backend_t mpi_montmul_adx_impl =
+#if defined(POLARSSL_MPI_HAVE_ADX)
+    { IMPL_MPI_MONTMUL, "adx", CPU_BMI2 | CPU_ADX, 10,
+      IMPL_FN( mpi_montmul_adx ) };
+#else
+    { IMPL_MPI_MONTMUL, "adx", CPU_BMI2 | CPU_ADX, 10, NULL };
+#endif
+
+const impl_backend_t mpi_montmul_cios_impl =
+#if defined(POLARSSL_HAVE_UDBL)
+    { IMPL_MPI_MONTMUL, "cios", 0, 0, IMPL_FN( mpi_montmul_cios ) };
+#else
+    { IMPL_MPI_MONTMUL, "cios", 0, 0, NULL };
+#endif
+
+/*
+ * A = d mod N, where d < 2N has n + 1 limbs (last step of HAC 14.36)
+ */
+static void mpi_montg_final( mpi_t *A, const mpi_t *N, t_uint *d,
+                             const mpi_t *T )
+{
+    size_t n = N->n;
+
+    __movsb( A->p, d, (n + 1) * ciL );
+
+    if( mpi_cmp_abs( A, N ) >= 0 )
+        mpi_sub_hlp( n, N->p, A->p );
+    else
+        /* prevent timing attacks */
+        mpi_sub_hlp( n, A->p, T->p );
+}
+
+/*
+ * Montgomery squaring: A = A * A * R^-1 mod N.
+ * The off-diagonal products are computed once and doubled, then reduced
+ * one limb at a time: about 3/4 of the multiplications of mpi_montmul().
+ */
+static void mpi_montsqr( mpi_t *A, const mpi_t *N, t_uint mm, const mpi_t *T )
+{
+    size_t i, n;
+    t_uint *a, *t, c, u;
+    mpi_mul_hlp_t mul = mpi_mul_hlp_select();
+
+    __stosb( T->p, 0, T->n * ciL );
+
+    a = A->p;
+    t = T->p;
+    n = N->n;
+
+#if defined(POLARSSL_HAVE_UDBL)
+    if( mul == mpi_mul_hlp )
+    {
+        mpi_montsqr_rows( n, t, a, N->p, mm );
+        mpi_montg_final( A, N, t + n, T );
+        return;
+    }
+#endif
+
+    for( i = 0; i + 1 < n; i++ )
+        mul( n - 1 - i, a + i + 1, t + 2 * i + 1, a[i] );
+
+    for( i = 0, c = 0; i < 2 * n; i++ )
+    {
+        u = t[i] >> ( biL - 1 );
+        t[i] = ( t[i] << 1 ) | c;
+        c = u;
+    }
+
+    for( i = 0; i < n; i++ )
+        mul( 1, a + i, t + 2 * i, a[i] );
+
+    for( i = 0; i < n; i++ )
+    {
+        u = t[i] * mm;
+        mul( n, N->p, t + i, u );
+    }
+
+    mpi_montg_final( A, N, t + n, T );
+}
+
 /*
  * Montgomery multiplication: A = A * B * R^-1 mod N  (HAC 14.36)
  */
@@ -1352,6 +2139,13 @@ static void mpi_montmul( mpi_t *A, const mpi_t *B, const mpi_t *N, t_uint mm,
 {
     size_t i, n, m;
     t_uint u0, u1, *d;
+    const impl_backend_t *impl;
+
+    if( A == B )
+    {
+        mpi_montsqr( A, N, mm, T );
+        return;
+    }
 
     __stosb( T->p, 0, T->n * ciL );
 
@@ -1359,6 +2153,13 @@ static void mpi_montmul( mpi_t *A, const mpi_t *B, const mpi_t *N, t_uint mm,
     n = N->n;
     m = ( B->n < n ) ? B->n : n;
 
+    if( m == n && ( impl = impl_select( IMPL_MPI_MONTMUL ) ) != NULL )
+    {
+        ( (impl_mpi_montmul_t) impl->fn )( n, d, A->p, B->p, N->p, mm );
+        mpi_montg_final( A, N, d + n, T );
+        return;
+    }
+
     for( i = 0; i < n; i++ )
     {
         /*
@@ -1373,13 +2174,7 @@ static void mpi_montmul( mpi_t *A, const mpi_t *B, const mpi_t *N, t_uint mm,
         *d++ = u0; d[n + 1] = 0;
     }
 
-    __movsb( A->p, d, (n + 1) * ciL );
-
-    if( mpi_cmp_abs( A, N ) >= 0 )
-        mpi_sub_hlp( n, N->p, A->p );
-    else
-        /* prevent timing attacks */
-        mpi_sub_hlp( n, A->p, T->p );
+    mpi_montg_final( A, N, d, T );
 }
 
 /*
@@ -1421,7 +2216,8 @@ int mpi_exp_mod( mpi_t *X, const mpi_t *A, const mpi_t *E, const mpi_t *N, mpi_t
     mpi_montg_init( &mm, N );
     mpi_init( &RR ); mpi_init( &T );
     mpi_init( &Apos );
-    __stosb( W, 0, sizeof( W ) );
+    for( i = 0; i < sizeof( W ) / sizeof( W[0] ); i++ )
+        mpi_init( &W[i] );
 
     i = mpi_msb( E );
 
@@ -1456,8 +2252,9 @@ int mpi_exp_mod( mpi_t *X, const mpi_t *A, const mpi_t *E, const mpi_t *N, mpi_t
         MPI_CHK( mpi_shift_l( &RR, N->n * 2 * biL ) );
         MPI_CHK( mpi_mod_mpi( &RR, &RR, N ) );
 
+        /* A copy, since the limbs of RR may come from the scratch arena */
         if( _RR != NULL )
-            __movsb( _RR, &RR, sizeof( mpi_t ) );
+            MPI_CHK( mpi_copy( _RR, &RR ) );
     }
     else
         __movsb( &RR, _RR, sizeof( mpi_t ) );
@@ -1598,7 +2395,7 @@ cleanup:
 
     mpi_free( &W[1] ); mpi_free( &T ); mpi_free( &Apos );
 
-    if( _RR == NULL || _RR->p == NULL )
+    if( _RR == NULL || _RR->p != RR.p )
         mpi_free( &RR );
 
     return( ret );
@@ -1949,17 +2746,114 @@ int mpi_is_prime( mpi_t *X,
     return( mpi_miller_rabin( &XX, f_rng, p_rng ) );
 }
 
+/*
+ * Odd primes below MPI_SIEVE_BOUND, which mpi_gen_prime() sieves its
+ * candidates with, built on first use. Stepping residues is cheap enough
+ * to use far more primes than the trial division of mpi_is_prime(), so
+ * that fewer candidates reach Miller-Rabin.
+ */
+#define MPI_SIEVE_BOUND     16384
+#define MPI_SIEVE_PRIMES    1899
+
+/*
+ * Candidates must be above the bound, or the sieve would reject primes
+ */
+#define MPI_SIEVE_MIN_BITS  16
+
+static uint16_t mpi_sieve_prime[MPI_SIEVE_PRIMES];
+static async_once_t mpi_sieve_once = ASYNC_ONCE_INIT;
+
+static void mpi_sieve_build( void )
+{
+    uint8_t composite[MPI_SIEVE_BOUND / 16];    /* bit i: 2i + 1 */
+    size_t i, j, n = 0;
+
+    __stosb( composite, 0, sizeof( composite ) );
+
+    for( i = 1; i < MPI_SIEVE_BOUND / 2 && n < MPI_SIEVE_PRIMES; i++ )
+    {
+        if( composite[i >> 3] & ( 1 << ( i & 7 ) ) )
+            continue;
+
+        mpi_sieve_prime[n++] = (uint16_t)( 2 * i + 1 );
+
+        /* Odd multiples from the square: ( 2i + 1 )^2 = 2( 2i^2 + 2i ) + 1 */
+        for( j = 2 * i * ( i + 1 ); j < MPI_SIEVE_BOUND / 2; j += 2 * i + 1 )
+            composite[j >> 3] |= (uint8_t)( 1 << ( j & 7 ) );
+    }
+}
+
+/*
+ * Residues of X modulo the sieve primes
+ */
+static int mpi_sieve_init( uint16_t *res, const mpi_t *X )
+{
+    int ret = 0;
+    size_t i;
+    t_uint r;
+
+    for( i = 0; i < MPI_SIEVE_PRIMES; i++ )
+    {
+        MPI_CHK( mpi_mod_int( &r, X, mpi_sieve_prime[i] ) );
+        res[i] = (uint16_t) r;
+    }
+
+cleanup:
+    return( ret );
+}
+
+/*
+ * Tell whether the candidate (and with dh_flag, (candidate - 1) / 2,
+ * which a sieve prime divides when the candidate is 1 modulo it) has no
+ * factor among the sieve primes
+ */
+static int mpi_sieve_passes( const uint16_t *res, int dh_flag )
+{
+    size_t i;
+
+    for( i = 0; i < MPI_SIEVE_PRIMES; i++ )
+        if( res[i] == 0 || ( dh_flag && res[i] == 1 ) )
+            return( 0 );
+
+    return( 1 );
+}
+
+/*
+ * Advance the residues to those of candidate + step
+ */
+static void mpi_sieve_step( uint16_t *res, int step )
+{
+    size_t i;
+    int r;
+
+    for( i = 0; i < MPI_SIEVE_PRIMES; i++ )
+    {
+        r = res[i] + step;
+        while( r >= mpi_sieve_prime[i] )
+            r -= mpi_sieve_prime[i];
+        res[i] = (uint16_t) r;
+    }
+}
+
 /*
  * Prime number generation
+ *
+ * Candidates advance by a fixed step. Their residues modulo the small
+ * primes are computed once and then stepped along, so that trial division
+ * costs a few additions per candidate and only the survivors are carried
+ * into X for Miller-Rabin.
  */
 int mpi_gen_prime( mpi_t *X, size_t nbits, int dh_flag,
                    int (*f_rng)(void *, uint8_t *, size_t),
                    void *p_rng )
 {
-    int ret;
+    int ret, step;
     size_t k, n;
     t_uint r;
+    t_sint delta = 0;
     mpi_t Y;
+    uint16_t *res = NULL;
+    int sieve = ( nbits >= MPI_SIEVE_MIN_BITS );
 
     if( nbits < 3 || nbits > POLARSSL_MPI_MAX_BITS )
         return( POLARSSL_ERR_MPI_BAD_INPUT_DATA );
@@ -1977,15 +2871,7 @@ int mpi_gen_prime( mpi_t *X, size_t nbits, int dh_flag,
     X->p[0] |= 3;
 
     if( dh_flag == 0 )
-    {
-        while( ( ret = mpi_is_prime( X, f_rng, p_rng ) ) != 0 )
-        {
-            if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
-                goto cleanup;
-
-            MPI_CHK( mpi_add_int( X, X, 2 ) );
-        }
-    }
+        step = 2;
     else
     {
         /*
@@ -2003,36 +2889,70 @@ int mpi_gen_prime( mpi_t *X, size_t nbits, int dh_flag,
         MPI_CHK( mpi_copy( &Y, X ) );
         MPI_CHK( mpi_shift_r( &Y, 1 ) );
 
-        while( 1 )
+        /*
+         * We want to preserve Y = (X-1) / 2 and Y = 1 mod 2 and Y = 2 mod 3
+         * (eq X = 3 mod 4 and X = 2 mod 3) so up Y by 6 and X by 12.
+         */
+        step = 12;
+    }
+
+    if( sieve )
+    {
+        async_once( &mpi_sieve_once, mpi_sieve_build );
+
+        res = (uint16_t *) memory_alloc( MPI_SIEVE_PRIMES * sizeof( uint16_t ) );
+        if( res == NULL )
+        {
+            ret = POLARSSL_ERR_MPI_MALLOC_FAILED;
+            goto cleanup;
+        }
+
+        MPI_CHK( mpi_sieve_init( res, X ) );
+    }
+
+    while( 1 )
+    {
+        if( ! sieve || mpi_sieve_passes( res, dh_flag ) )
         {
+            /*
+             * Catch up with the candidates the sieve skipped
+             */
+            MPI_CHK( mpi_add_int( X, X, delta ) );
+            if( dh_flag != 0 )
+                MPI_CHK( mpi_add_int( &Y, &Y, delta / 2 ) );
+            delta = 0;
+
+            if( dh_flag == 0 )
+                ret = sieve ? mpi_miller_rabin( X, f_rng, p_rng ) :
+                              mpi_is_prime( X, f_rng, p_rng );
             /*
              * First, check small factors for X and Y
              * before doing Miller-Rabin on any of them
              */
-            if( ( ret = mpi_check_small_factors(  X         ) ) == 0 &&
-                ( ret = mpi_check_small_factors( &Y         ) ) == 0 &&
-                ( ret = mpi_miller_rabin(  X, f_rng, p_rng  ) ) == 0 &&
-                ( ret = mpi_miller_rabin( &Y, f_rng, p_rng  ) ) == 0 )
-            {
+            else if( ( sieve ||
+                       ( ( ret = mpi_check_small_factors(  X ) ) == 0 &&
+                         ( ret = mpi_check_small_factors( &Y ) ) == 0 ) ) &&
+                     ( ret = mpi_miller_rabin(  X, f_rng, p_rng ) ) == 0 )
+                ret = mpi_miller_rabin( &Y, f_rng, p_rng );
+
+            if( ret == 0 )
                 break;
-            }
 
             if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
                 goto cleanup;
-
-            /*
-             * Next candidates. We want to preserve Y = (X-1) / 2 and
-             * Y = 1 mod 2 and Y = 2 mod 3 (eq X = 3 mod 4 and X = 2 mod 3)
-             * so up Y by 6 and X by 12.
-             */
-            MPI_CHK( mpi_add_int(  X,  X, 12 ) );
-            MPI_CHK( mpi_add_int( &Y, &Y, 6  ) );
         }
+
+        if( sieve )
+            mpi_sieve_step( res, step );
+        delta += step;
     }
 
 cleanup:
 
     mpi_free( &Y );
 
+    if( res != NULL )
+        memory_free( res );
+
     return( ret );
 }
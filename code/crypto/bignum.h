@@ -1,6 +1,8 @@
 #ifndef POLARSSL_BIGNUM_H
 #define POLARSSL_BIGNUM_H
 
+#include "config.h"
+
 #define POLARSSL_ERR_MPI_FILE_IO_ERROR                     -0x0002  /**< An error occurred while reading from or writing to a file. */
 #define POLARSSL_ERR_MPI_BAD_INPUT_DATA                    -0x0004  /**< Bad input parameters to function. */
 #define POLARSSL_ERR_MPI_INVALID_CHARACTER                 -0x0006  /**< There is an invalid character in the digit string. */
@@ -30,6 +32,26 @@
 #define POLARSSL_MPI_WINDOW_SIZE                           6        /**< Maximum windows size used. */
 #endif /* !POLARSSL_MPI_WINDOW_SIZE */
 
+#if !defined(POLARSSL_MPI_KARATSUBA_LIMBS)
+/*
+ * Operand size, in limbs, from which mpi_mul_mpi() switches from schoolbook
+ * to Karatsuba multiplication. Default: 32. Minimum value: 4.
+ */
+#define POLARSSL_MPI_KARATSUBA_LIMBS                       32       /**< Karatsuba threshold. */
+#endif /* !POLARSSL_MPI_KARATSUBA_LIMBS */
+
+#if !defined(POLARSSL_MPI_ARENA_SIZE)
+/*
+ * Initial size in bytes of the per-thread scratch arena (POLARSSL_MPI_ARENA).
+ * The arena grows when a scope needed more, up to POLARSSL_MPI_ARENA_MAX.
+ */
+#define POLARSSL_MPI_ARENA_SIZE                            16384    /**< Initial arena size. */
+#endif /* !POLARSSL_MPI_ARENA_SIZE */
+
+#if !defined(POLARSSL_MPI_ARENA_MAX)
+#define POLARSSL_MPI_ARENA_MAX                             262144   /**< Maximum arena size. */
+#endif /* !POLARSSL_MPI_ARENA_MAX */
+
 #if !defined(POLARSSL_MPI_MAX_SIZE)
 /*
  * Maximum size of MPIs allowed in bits and bytes for user-MPIs.
@@ -87,6 +109,9 @@ typedef struct
     int s;              /*!<  integer sign      */
     size_t n;           /*!<  total # of limbs  */
     t_uint* p;          /*!<  pointer to limbs  */
+#if defined(POLARSSL_MPI_ARENA)
+    long scope;         /*!<  scratch scope it was initialized in, or 0 */
+#endif
 } mpi_t;
 
 /**
@@ -96,6 +121,23 @@ typedef struct
  */
 void mpi_init(mpi_t* X);
 
+#if defined(POLARSSL_MPI_ARENA)
+/**
+ * \brief           Initialize one MPI that outlives the current scratch
+ *                  scope
+ *
+ *                  Same as mpi_init(), but the limbs of X always come from
+ *                  the heap, even inside mpi_arena_begin() /
+ *                  mpi_arena_end(). For values built inside a scope and
+ *                  kept afterwards, such as cached tables.
+ *
+ * \param X         One MPI to initialize.
+ */
+void mpi_init_persistent(mpi_t* X);
+#else
+#define mpi_init_persistent( X )    mpi_init( X )
+#endif /* POLARSSL_MPI_ARENA */
+
 /**
  * \brief          Unallocate one MPI
  *
@@ -298,6 +340,30 @@ int mpi_read_binary( mpi_t *X, const uint8_t *buf, size_t buflen );
  */
 int mpi_write_binary( const mpi_t *X, uint8_t *buf, size_t buflen );
 
+/**
+ * \brief          Import X from unsigned binary data, little endian
+ *
+ * \param X        Destination MPI
+ * \param buf      Input buffer
+ * \param buflen   Input buffer size
+ *
+ * \return         0 if successful,
+ *                 POLARSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed
+ */
+int mpi_read_binary_le( mpi_t *X, const uint8_t *buf, size_t buflen );
+
+/**
+ * \brief          Export X into unsigned binary data, little endian
+ *
+ * \param X        Source MPI
+ * \param buf      Output buffer
+ * \param buflen   Output buffer size
+ *
+ * \return         0 if successful,
+ *                 POLARSSL_ERR_MPI_BUFFER_TOO_SMALL if buf isn't large enough
+ */
+int mpi_write_binary_le( const mpi_t *X, uint8_t *buf, size_t buflen );
+
 /**
  * \brief          Left-shift: X <<= count
  *
@@ -605,6 +671,70 @@ int mpi_is_prime( mpi_t *X, int (*f_rng)(void *, uint8_t *, size_t), void *p_rng
  */
 int mpi_gen_prime( mpi_t *X, size_t nbits, int dh_flag, int (*f_rng)(void *, uint8_t *, size_t), void *p_rng );
 
+#if defined(POLARSSL_MPI_ARENA)
+/**
+ * \brief          Bignum allocation counters of the calling thread
+ */
+typedef struct
+{
+    size_t arena_allocs;    /*!<  limb blocks taken from the arena      */
+    size_t heap_allocs;     /*!<  limb blocks taken from the heap       */
+    size_t scopes;          /*!<  outermost scopes closed               */
+    size_t peak;            /*!<  most arena bytes wanted by one scope  */
+    size_t size;            /*!<  current arena size in bytes           */
+}
+mpi_arena_stats;
+
+/**
+ * \brief          Open a scratch scope on the calling thread
+ *
+ *                 Until the matching mpi_arena_end(), limbs of MPIs
+ *                 initialized with mpi_init() inside the scope are taken
+ *                 from a per-thread bump arena instead of the heap. MPIs
+ *                 initialized before the scope (results, contexts) or with
+ *                 mpi_init_persistent() still use the heap, so they
+ *                 survive it.
+ *
+ * \note           Scopes nest; only the outermost one counts.
+ *                 An MPI initialized inside the scope must be freed before
+ *                 it ends, and its value must not be moved into another
+ *                 MPI by structure copy or mpi_swap(): use mpi_copy().
+ *                 Falls back to the heap when the arena cannot be set up
+ *                 or is full.
+ */
+void mpi_arena_begin( void );
+
+/**
+ * \brief          Close a scope opened with mpi_arena_begin()
+ *
+ *                 Closing the outermost scope wipes and resets the arena,
+ *                 and enlarges it if the scope did not fit.
+ */
+void mpi_arena_end( void );
+
+/**
+ * \brief          Release the arena of the calling thread
+ *
+ * \note           Call before a thread that used bignum operations exits.
+ *                 Must not be called inside a scope.
+ */
+void mpi_arena_free( void );
+
+/**
+ * \brief          Get the allocation counters of the calling thread
+ *
+ *                 Counting starts with the first scope or the first call
+ *                 to this function on the thread.
+ *
+ * \param stats    Destination, zeroed if counters are not available
+ */
+void mpi_arena_get_stats( mpi_arena_stats *stats );
+#else
+#define mpi_arena_begin()
+#define mpi_arena_end()
+#define mpi_arena_free()
+#endif /* POLARSSL_MPI_ARENA */
+
 #ifdef __cplusplus
 }
 #endif
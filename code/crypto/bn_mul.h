@@ -9,16 +9,13 @@
 
 #define MULADDC_INIT                    \
 {                                       \
-    t_udbl r;                           \
-    t_uint r0, r1;
+    t_udbl r;
 
+/* b * s + c + d never overflows a double limb */
 #define MULADDC_CORE                    \
-    r   = *(s++) * (t_udbl) b;          \
-    r0  = r;                            \
-    r1  = r >> biL;                     \
-    r0 += c;  r1 += (r0 <  c);          \
-    r0 += *d; r1 += (r0 < *d);          \
-    c = r1; *(d++) = r0;
+    r   = *(s++) * (t_udbl) b + c + *d; \
+    c   = (t_uint)( r >> biL );         \
+    *(d++) = (t_uint) r;
 
 #define MULADDC_STOP                    \
 }
@@ -26,6 +26,10 @@
 #error "POLARSSL_ECP_C defined, but not all prerequisites"
 #endif
 
+#if defined(POLARSSL_IMPL_C) && !defined(POLARSSL_CPU_C)
+#error "POLARSSL_IMPL_C defined, but not all prerequisites"
+#endif
+
 #if defined(POLARSSL_PK_PARSE_C) && !defined(POLARSSL_PK_C)
 #error "POLARSSL_PK_PARSE_C defined, but not all prerequisites"
 #endif
@@ -42,6 +46,10 @@
 #error "POLARSSL_SSL_SRV_C defined, but not all prerequisites"
 #endif
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS) && !defined(POLARSSL_SHA256_C)
+#error "POLARSSL_SSL_SESSION_TICKETS defined, but not all prerequisites"
+#endif
+
 #if defined(POLARSSL_SSL_SERVER_NAME_INDICATION) && \
         !defined(POLARSSL_X509_CRT_PARSE_C)
 #error "POLARSSL_SSL_SERVER_NAME_INDICATION defined, but not all prerequisites"
@@ -75,6 +75,35 @@
  */
 #define POLARSSL_ECP_NIST_OPTIM
 
+/**
+ * \def POLARSSL_ECP_NIST_FIXED
+ *
+ * Use fixed-size, allocation-free field and point arithmetic for
+ * secp256r1 and secp384r1 in ecp_mul().
+ *
+ * Module:  library/ecp_nist.c
+ * Caller:  library/ecp.c
+ *
+ * Comment this macro to use the generic MPI code for these curves too.
+ */
+#define POLARSSL_ECP_NIST_FIXED
+
+/**
+ * \def POLARSSL_MPI_ARENA
+ *
+ * Take the limbs of bignum temporaries from a per-thread bump arena, reset
+ * when rsa_public(), rsa_private(), ecp_mul() or ecdh_compute_shared()
+ * return, instead of one heap allocation per mpi_grow().
+ *
+ * Module:  library/bignum.c
+ * Caller:  library/ecdh.c
+ *          library/ecp.c
+ *          library/rsa.c
+ *
+ * Comment this macro to allocate every MPI from the heap.
+ */
+#define POLARSSL_MPI_ARENA
+
 /**
  * \def POLARSSL_PK_PARSE_EC_EXTENDED
  *
@@ -150,6 +179,27 @@
  */
 #define POLARSSL_SSL_TRUNCATED_HMAC
 
+/**
+ * \def POLARSSL_SSL_ENCRYPT_THEN_MAC
+ *
+ * Enable support for RFC 7366 encrypt-then-MAC in SSL: the MAC covers the
+ * CBC ciphertext and is checked before anything is decrypted.
+ *
+ * Comment this macro to disable support for encrypt-then-MAC in SSL
+ */
+#define POLARSSL_SSL_ENCRYPT_THEN_MAC
+
+/**
+ * \def POLARSSL_SSL_SESSION_TICKETS
+ *
+ * Enable support for RFC 5077 session tickets in SSL.
+ *
+ * Requires: POLARSSL_SHA256_C
+ *
+ * Comment this macro to disable support for SSL session tickets
+ */
+#define POLARSSL_SSL_SESSION_TICKETS
+
 /**
  * \def POLARSSL_X509_CHECK_KEY_USAGE
  *
@@ -164,6 +214,20 @@
  */
 #define POLARSSL_X509_CHECK_KEY_USAGE
 
+/**
+ * \def POLARSSL_X509_VERIFY_CACHE
+ *
+ * Remember, process-wide, which (certificate, issuer) pairs already passed
+ * the signature check in x509_crt_verify(), so that chains seen again skip
+ * the RSA/ECDSA operation. Entries are keyed on a SHA-256 of both
+ * certificates; only successful checks are stored.
+ *
+ * Requires: POLARSSL_SHA256_C
+ *
+ * Comment this macro to verify every signature on every call.
+ */
+#define POLARSSL_X509_VERIFY_CACHE
+
 /**
  * \def POLARSSL_X509_CHECK_EXTENDED_KEY_USAGE
  *
@@ -177,6 +241,13 @@
  */
 #define POLARSSL_X509_CHECK_EXTENDED_KEY_USAGE
 
+/**
+ * \def POLARSSL_SELF_TEST
+ *
+ * Enable the checkup functions (*_self_test).
+ */
+//#define POLARSSL_SELF_TEST
+
 /* \} name SECTION: PolarSSL feature support */
 
 /**
@@ -228,6 +299,44 @@
  */
 //#define POLARSSL_CERTS_C
 
+/**
+ * \def POLARSSL_CPU_C
+ *
+ * Enable run-time CPU feature detection.
+ *
+ * Module:  library/cpu.c
+ * Caller:  library/base64.c
+ *          library/bignum.c
+ *          library/crc.c
+ *          library/sha256.c
+ *          library/sha512.c
+ *
+ * This module lets hash, cipher and bignum code pick SIMD kernels
+ * (SHA extensions, AVX2, PCLMULQDQ, ...) at run time. Without it only
+ * the portable C implementations are built.
+ */
+#define POLARSSL_CPU_C
+
+/**
+ * \def POLARSSL_IMPL_C
+ *
+ * Enable the registry of interchangeable kernels.
+ *
+ * Module:  library/impl.c
+ * Caller:  library/aes.c
+ *          library/bignum.c
+ *          library/ecp_nist.c
+ *          library/sha256.c
+ *          library/sha512.c
+ *
+ * Requires: POLARSSL_CPU_C
+ *
+ * Each kernel registers its backends (portable C, AES-NI, SHA, AVX2, ADX,
+ * ...) with the CPU features they need. A backend is only selected once
+ * it passes a known-answer test, and impl_bench() times all of them.
+ */
+#define POLARSSL_IMPL_C
+
 /**
  * \def POLARSSL_MD_C
  *
@@ -558,6 +667,9 @@
 /* MPI / BIGNUM options */
 //#define POLARSSL_MPI_WINDOW_SIZE            6 /**< Maximum windows size used. */
 //#define POLARSSL_MPI_MAX_SIZE             512 /**< Maximum number of bytes for usable MPIs. */
+//#define POLARSSL_MPI_KARATSUBA_LIMBS       32 /**< Karatsuba threshold in limbs. */
+//#define POLARSSL_MPI_ARENA_SIZE         16384 /**< Initial per-thread arena size. */
+//#define POLARSSL_MPI_ARENA_MAX         262144 /**< Maximum per-thread arena size. */
 
 /* CTR_DRBG options */
 //#define CTR_DRBG_ENTROPY_LEN               48 /**< Amount of entropy used per seed by default (48 with SHA-512, 32 with SHA-256) */
@@ -576,6 +688,10 @@
 //#define POLARSSL_ECP_MAX_BITS             521 /**< Maximum bit size of groups */
 //#define POLARSSL_ECP_WINDOW_SIZE            6 /**< Maximum window size used */
 //#define POLARSSL_ECP_FIXED_POINT_OPTIM      1 /**< Enable fixed-point speed-up */
+//#define POLARSSL_ECP_FIXED_WINDOW_SIZE      7 /**< Window size for shared tables */
+
+/* X.509 options */
+//#define POLARSSL_X509_VERIFY_CACHE_SIZE    64 /**< Number of remembered signature checks */
 
 /* Entropy options */
 //#define ENTROPY_MAX_SOURCES                20 /**< Maximum number of sources supported */
@@ -594,6 +710,7 @@
 /* SSL Cache options */
 //#define SSL_CACHE_DEFAULT_TIMEOUT       86400 /**< 1 day  */
 //#define SSL_CACHE_DEFAULT_MAX_ENTRIES      50 /**< Maximum entries in cache */
+//#define SSL_CACHE_SHARDS                    8 /**< Separately locked parts of the cache, a power of 2 */
 
 /* SSL options */
 //#define SSL_MAX_CONTENT_LEN             16384 /**< Size of the input / output buffer */
@@ -0,0 +1,96 @@
+#include "..\zmodule.h"
+#include "config.h"
+
+#if defined(POLARSSL_CPU_C)
+
+#include "cpu.h"
+
+#define CPU_DETECTED    0x80000000
+
+/*
+ * Detection is idempotent, so concurrent first calls may both run it and
+ * store the same value.
+ */
+static volatile uint32_t cpu_detected = 0;
+static volatile uint32_t cpu_hidden = 0;
+
+static uint32_t cpu_detect( void )
+{
+    uint32_t features = 0;
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    int regs[4];
+    int max_leaf;
+    uint32_t ecx1, edx1, ebx7 = 0;
+    uint64_t xcr0 = 0;
+
+    __cpuid( regs, 0 );
+    max_leaf = regs[0];
+
+    __cpuid( regs, 1 );
+    ecx1 = (uint32_t) regs[2];
+    edx1 = (uint32_t) regs[3];
+
+    if( max_leaf >= 7 )
+    {
+        __cpuidex( regs, 7, 0 );
+        ebx7 = (uint32_t) regs[1];
+    }
+
+    /* OSXSAVE: the OS tells us which register files it preserves */
+    if( ecx1 & ( 1 << 27 ) )
+        xcr0 = _xgetbv( 0 );
+
+    if( edx1 & ( 1 << 26 ) ) features |= CPU_SSE2;
+    if( ecx1 & ( 1 <<  9 ) ) features |= CPU_SSSE3;
+    if( ecx1 & ( 1 << 19 ) ) features |= CPU_SSE41;
+    if( ecx1 & ( 1 <<  1 ) ) features |= CPU_PCLMULQDQ;
+    if( ecx1 & ( 1 << 25 ) ) features |= CPU_AESNI;
+    if( ebx7 & ( 1 <<  8 ) ) features |= CPU_BMI2;
+    if( ebx7 & ( 1 << 19 ) ) features |= CPU_ADX;
+    if( ebx7 & ( 1 << 29 ) ) features |= CPU_SHA;
+
+    if( ( ecx1 & ( 1 << 28 ) ) && ( xcr0 & 0x06 ) == 0x06 )
+    {
+        features |= CPU_AVX;
+
+        if( ebx7 & ( 1 << 5 ) )
+            features |= CPU_AVX2;
+
+        /* opmask, ZMM0-15 upper halves and ZMM16-31 must all be saved */
+        if( ( ebx7 & ( 1 << 16 ) ) && ( xcr0 & 0xE0 ) == 0xE0 )
+        {
+            features |= CPU_AVX512F;
+
+            if( ebx7 & ( 1U << 31 ) )
+                features |= CPU_AVX512VL;
+        }
+    }
+#endif /* POLARSSL_HAVE_X86_SIMD */
+
+    return( features );
+}
+
+uint32_t cpu_features( void )
+{
+    uint32_t features = cpu_detected;
+
+    if( ( features & CPU_DETECTED ) == 0 )
+    {
+        features = cpu_detect() | CPU_DETECTED;
+        cpu_detected = features;
+    }
+
+    return( features & ~( CPU_DETECTED | cpu_hidden ) );
+}
+
+int cpu_supports( uint32_t what )
+{
+    return( ( cpu_features() & what ) == what );
+}
+
+void cpu_mask( uint32_t what )
+{
+    cpu_hidden = what & ~CPU_DETECTED;
+}
+
+#endif /* POLARSSL_CPU_C */
@@ -0,0 +1,64 @@
+#ifndef POLARSSL_CPU_H
+#define POLARSSL_CPU_H
+
+#include "config.h"
+
+/*
+ * SIMD kernels are only built for x86/x64 with MSVC intrinsics.
+ */
+#if defined(POLARSSL_CPU_C) && defined(_MSC_VER) && \
+    ( defined(_M_IX86) || defined(_M_X64) )
+#define POLARSSL_HAVE_X86_SIMD
+#endif
+
+#define CPU_SSE2        0x00000001  /**< SSE2                       */
+#define CPU_SSSE3       0x00000002  /**< SSSE3 (pshufb)             */
+#define CPU_SSE41       0x00000004  /**< SSE4.1                     */
+#define CPU_PCLMULQDQ   0x00000008  /**< Carry-less multiplication  */
+#define CPU_AESNI       0x00000010  /**< AES new instructions       */
+#define CPU_AVX         0x00000020  /**< AVX (OS saves YMM state)   */
+#define CPU_AVX2        0x00000040  /**< AVX2                       */
+#define CPU_BMI2        0x00000080  /**< BMI2 (mulx)                */
+#define CPU_ADX         0x00000100  /**< ADX (adcx/adox)            */
+#define CPU_SHA         0x00000200  /**< SHA extensions             */
+#define CPU_AVX512F     0x00000400  /**< AVX-512 foundation         */
+#define CPU_AVX512VL    0x00000800  /**< AVX-512 vector length      */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          Return the set of CPU_XXX features usable by this process
+ *
+ *                 The CPU is queried once; later calls return the cached
+ *                 value minus any features masked with cpu_mask().
+ *
+ * \return         bitmask of CPU_XXX values
+ */
+uint32_t cpu_features( void );
+
+/**
+ * \brief          Check whether all the requested features are usable
+ *
+ * \param what     bitmask of CPU_XXX values
+ *
+ * \return         1 if every feature in what is available, 0 otherwise
+ */
+int cpu_supports( uint32_t what );
+
+/**
+ * \brief          Hide features from cpu_supports()
+ *
+ *                 Kernels dispatch on every call, so this takes effect
+ *                 immediately. Used to force portable code paths.
+ *
+ * \param what     bitmask of CPU_XXX values to hide, 0 to restore all
+ */
+void cpu_mask( uint32_t what );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* cpu.h */
@@ -0,0 +1,237 @@
+#include "..\zmodule.h"
+#include "crc.h"
+#include "cpu.h"
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
+
+#include "crc_tables.h"
+
+/* Shorter buffers are not worth the PCLMULQDQ setup */
+#define CRC_FOLD_MIN    128
+
+#define CRC32_SLICE(w,k)                                \
+    ( crc32_table[(k) + 3][(w) & 0xFF] ^                \
+      crc32_table[(k) + 2][((w) >> 8) & 0xFF] ^         \
+      crc32_table[(k) + 1][((w) >> 16) & 0xFF] ^        \
+      crc32_table[(k)    ][(w) >> 24] )
+
+#define CRC64_SLICE(w,k)                                \
+    ( crc64_table[(k) + 3][(w) & 0xFF] ^                \
+      crc64_table[(k) + 2][((w) >> 8) & 0xFF] ^         \
+      crc64_table[(k) + 1][((w) >> 16) & 0xFF] ^        \
+      crc64_table[(k)    ][(w) >> 24] )
+
+static uint32_t crc32_slice16(uint32_t crc, const uint8_t* p, size_t len)
+{
+    uint32_t w0, w1, w2, w3;
+
+    while (len >= 16) {
+        w0 = ((const uint32_t*)p)[0] ^ crc;
+        w1 = ((const uint32_t*)p)[1];
+        w2 = ((const uint32_t*)p)[2];
+        w3 = ((const uint32_t*)p)[3];
+
+        crc = CRC32_SLICE(w0, 12) ^ CRC32_SLICE(w1, 8) ^
+              CRC32_SLICE(w2, 4) ^ CRC32_SLICE(w3, 0);
+
+        p += 16;
+        len -= 16;
+    }
+
+    while (len--) {
+        crc = crc32_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+static uint64_t crc64_slice16(uint64_t crc, const uint8_t* p, size_t len)
+{
+    uint32_t w0, w1, w2, w3;
+
+    while (len >= 16) {
+        w0 = ((const uint32_t*)p)[0] ^ (uint32_t)crc;
+        w1 = ((const uint32_t*)p)[1] ^ (uint32_t)(crc >> 32);
+        w2 = ((const uint32_t*)p)[2];
+        w3 = ((const uint32_t*)p)[3];
+
+        crc = CRC64_SLICE(w0, 12) ^ CRC64_SLICE(w1, 8) ^
+              CRC64_SLICE(w2, 4) ^ CRC64_SLICE(w3, 0);
+
+        p += 16;
+        len -= 16;
+    }
+
+    while (len--) {
+        crc = crc64_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+/*
+ * x holds 128 message bits, lowest address first (bit n is the coefficient
+ * of x^(127-n)). Multiplying the low half by x^(D+63) mod P and the high half
+ * by x^(D-1) mod P moves x forward by D bits; the extra x^-1 absorbs the
+ * one-bit offset of a reflected carry-less product.
+ */
+#define CRC_FOLD(x,k,next)                                              \
+    _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x, k, 0x00 ),   \
+                                  _mm_clmulepi64_si128( x, k, 0x11 ) ), next )
+
+/*
+ * Fold len bytes (a multiple of 16, at least 64) into a 16-byte remainder
+ * with the same CRC. The running CRC is added into the first bytes.
+ */
+static void crc_fold_pclmul(const uint64_t fold[4], uint64_t crc, const uint8_t* p, size_t len, uint8_t rem[16])
+{
+    __m128i x0, x1, x2, x3, k;
+
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_set_epi32(0, 0, (int)(crc >> 32), (int)crc));
+    x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+    x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+    x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+    p += 64;
+    len -= 64;
+
+    // Four independent streams, each folded by 512 bits.
+    k = _mm_loadu_si128((const __m128i*)fold);
+    while (len >= 64) {
+        x0 = CRC_FOLD(x0, k, _mm_loadu_si128((const __m128i*)p));
+        x1 = CRC_FOLD(x1, k, _mm_loadu_si128((const __m128i*)(p + 16)));
+        x2 = CRC_FOLD(x2, k, _mm_loadu_si128((const __m128i*)(p + 32)));
+        x3 = CRC_FOLD(x3, k, _mm_loadu_si128((const __m128i*)(p + 48)));
+        p += 64;
+        len -= 64;
+    }
+
+    // Merge the streams and the remaining blocks by 128 bits at a time.
+    k = _mm_loadu_si128((const __m128i*)(fold + 2));
+    x0 = CRC_FOLD(x0, k, x1);
+    x0 = CRC_FOLD(x0, k, x2);
+    x0 = CRC_FOLD(x0, k, x3);
+    while (len >= 16) {
+        x0 = CRC_FOLD(x0, k, _mm_loadu_si128((const __m128i*)p));
+        p += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i*)rem, x0);
+}
+#endif // POLARSSL_HAVE_X86_SIMD
+
+uint32_t __stdcall crc32_update(uint32_t crc, const void* buf, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)buf;
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    uint8_t rem[16];
+    size_t n;
+#endif
+
+    crc = ~crc;
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    if (len >= CRC_FOLD_MIN && cpu_supports(CPU_PCLMULQDQ)) {
+        n = len & ~(size_t)15;
+        crc_fold_pclmul(crc32_fold, crc, p, n, rem);
+        crc = crc32_slice16(0, rem, sizeof(rem));
+        p += n;
+        len -= n;
+    }
+#endif
+
+    return ~crc32_slice16(crc, p, len);
+}
+
+uint64_t __stdcall crc64(uint64_t crc, void* buf, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)buf;
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    uint8_t rem[16];
+    size_t n;
+#endif
+
+    crc = ~crc;
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    if (len >= CRC_FOLD_MIN && cpu_supports(CPU_PCLMULQDQ)) {
+        n = len & ~(size_t)15;
+        crc_fold_pclmul(crc64_fold, crc, p, n, rem);
+        crc = crc64_slice16(0, rem, sizeof(rem));
+        p += n;
+        len -= n;
+    }
+#endif
+
+    return ~crc64_slice16(crc, p, len);
+}
+
+/*
+ * a * b mod P, both reflected.
+ */
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 0x80000000, p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ 0xEDB88320 : b >> 1;
+    }
+
+    return p;
+}
+
+static uint64_t crc64_multmodp(uint64_t a, uint64_t b)
+{
+    uint64_t m = 0x8000000000000000ULL, p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ 0xC96C5795D7870F42ULL : b >> 1;
+    }
+
+    return p;
+}
+
+uint32_t __stdcall crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    uint32_t xn = 0x80000000; // x^0
+    int k = 3;                // len2 counts bytes: x^(8 * len2)
+
+    for ( ; len2 != 0; len2 >>= 1, ++k) {
+        if (len2 & 1) {
+            xn = crc32_multmodp(crc32_x2n[k & 31], xn);
+        }
+    }
+
+    return crc32_multmodp(xn, crc1) ^ crc2;
+}
+
+uint64_t __stdcall crc64_combine(uint64_t crc1, uint64_t crc2, uint64_t len2)
+{
+    uint64_t xn = 0x8000000000000000ULL;
+    int k = 3;
+
+    for ( ; len2 != 0; len2 >>= 1, ++k) {
+        if (len2 & 1) {
+            xn = crc64_multmodp(crc64_x2n[k & 63], xn);
+        }
+    }
+
+    return crc64_multmodp(xn, crc1) ^ crc2;
+}
@@ -0,0 +1,22 @@
+#ifndef __0LIB_CRC_H_
+#define __0LIB_CRC_H_
+
+/*
+ * CRC-32 (IEEE 802.3, as in zip/png) and CRC-64 (ECMA-182, as in xz).
+ *
+ * Both use static slicing-by-16 tables and, when the CPU has PCLMULQDQ,
+ * fold 64 bytes per step with carry-less multiplication. The value passed
+ * in is the result of the previous call (0 to start).
+ */
+uint32_t __stdcall crc32_update(uint32_t crc, const void* buf, size_t len);
+uint64_t __stdcall crc64(uint64_t crc, void* buf, size_t len);
+
+/*
+ * Return the CRC of A followed by B, given crc1 = CRC(A), crc2 = CRC(B) and
+ * len2 = length of B. This lets a large buffer be checksummed in parallel
+ * chunks and the partial results merged in order.
+ */
+uint32_t __stdcall crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+uint64_t __stdcall crc64_combine(uint64_t crc1, uint64_t crc2, uint64_t len2);
+
+#endif // __0LIB_CRC_H_
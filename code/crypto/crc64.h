@@ -1,6 +0,0 @@
-#ifndef __0LIB_CRC64_H_
-#define __0LIB_CRC64_H_
-
-uint64_t __stdcall crc64(uint64_t crc, void* buf, size_t len);
-
-#endif // __0LIB_CRC64_H_
@@ -0,0 +1,2192 @@
+/*
+ * CRC lookup and folding tables, generated from the reflected polynomials
+ * 0xEDB88320 (CRC-32, IEEE 802.3) and 0xC96C5795D7870F42 (CRC-64, ECMA-182).
+ *
+ * crcNN_table[k][n]  CRC of byte n followed by k zero bytes (slicing-by-16)
+ * crcNN_x2n[k]       x^(2^k) mod P, reflected, for crcNN_combine()
+ * crcNN_fold[]       x^575, x^511, x^191, x^127 mod P, reflected to 64 bits,
+ *                    for folding by 512 and 128 bits with PCLMULQDQ
+ */
+
+static const uint32_t crc32_table[16][256] =
+{
+    {
+        0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+        0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+        0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+        0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+        0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+        0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+        0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+        0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+        0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+        0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+        0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+        0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+        0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+        0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+        0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+        0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+        0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+        0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+        0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+        0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+        0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+        0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+        0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+        0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+        0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+        0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+        0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+        0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+        0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+        0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+        0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+        0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+        0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+        0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+        0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+        0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+        0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+        0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+        0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+        0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+        0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+        0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+        0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+    },
+    {
+        0x00000000, 0x191B3141, 0x32366282, 0x2B2D53C3, 0x646CC504, 0x7D77F445,
+        0x565AA786, 0x4F4196C7, 0xC8D98A08, 0xD1C2BB49, 0xFAEFE88A, 0xE3F4D9CB,
+        0xACB54F0C, 0xB5AE7E4D, 0x9E832D8E, 0x87981CCF, 0x4AC21251, 0x53D92310,
+        0x78F470D3, 0x61EF4192, 0x2EAED755, 0x37B5E614, 0x1C98B5D7, 0x05838496,
+        0x821B9859, 0x9B00A918, 0xB02DFADB, 0xA936CB9A, 0xE6775D5D, 0xFF6C6C1C,
+        0xD4413FDF, 0xCD5A0E9E, 0x958424A2, 0x8C9F15E3, 0xA7B24620, 0xBEA97761,
+        0xF1E8E1A6, 0xE8F3D0E7, 0xC3DE8324, 0xDAC5B265, 0x5D5DAEAA, 0x44469FEB,
+        0x6F6BCC28, 0x7670FD69, 0x39316BAE, 0x202A5AEF, 0x0B07092C, 0x121C386D,
+        0xDF4636F3, 0xC65D07B2, 0xED705471, 0xF46B6530, 0xBB2AF3F7, 0xA231C2B6,
+        0x891C9175, 0x9007A034, 0x179FBCFB, 0x0E848DBA, 0x25A9DE79, 0x3CB2EF38,
+        0x73F379FF, 0x6AE848BE, 0x41C51B7D, 0x58DE2A3C, 0xF0794F05, 0xE9627E44,
+        0xC24F2D87, 0xDB541CC6, 0x94158A01, 0x8D0EBB40, 0xA623E883, 0xBF38D9C2,
+        0x38A0C50D, 0x21BBF44C, 0x0A96A78F, 0x138D96CE, 0x5CCC0009, 0x45D73148,
+        0x6EFA628B, 0x77E153CA, 0xBABB5D54, 0xA3A06C15, 0x888D3FD6, 0x91960E97,
+        0xDED79850, 0xC7CCA911, 0xECE1FAD2, 0xF5FACB93, 0x7262D75C, 0x6B79E61D,
+        0x4054B5DE, 0x594F849F, 0x160E1258, 0x0F152319, 0x243870DA, 0x3D23419B,
+        0x65FD6BA7, 0x7CE65AE6, 0x57CB0925, 0x4ED03864, 0x0191AEA3, 0x188A9FE2,
+        0x33A7CC21, 0x2ABCFD60, 0xAD24E1AF, 0xB43FD0EE, 0x9F12832D, 0x8609B26C,
+        0xC94824AB, 0xD05315EA, 0xFB7E4629, 0xE2657768, 0x2F3F79F6, 0x362448B7,
+        0x1D091B74, 0x04122A35, 0x4B53BCF2, 0x52488DB3, 0x7965DE70, 0x607EEF31,
+        0xE7E6F3FE, 0xFEFDC2BF, 0xD5D0917C, 0xCCCBA03D, 0x838A36FA, 0x9A9107BB,
+        0xB1BC5478, 0xA8A76539, 0x3B83984B, 0x2298A90A, 0x09B5FAC9, 0x10AECB88,
+        0x5FEF5D4F, 0x46F46C0E, 0x6DD93FCD, 0x74C20E8C, 0xF35A1243, 0xEA412302,
+        0xC16C70C1, 0xD8774180, 0x9736D747, 0x8E2DE606, 0xA500B5C5, 0xBC1B8484,
+        0x71418A1A, 0x685ABB5B, 0x4377E898, 0x5A6CD9D9, 0x152D4F1E, 0x0C367E5F,
+        0x271B2D9C, 0x3E001CDD, 0xB9980012, 0xA0833153, 0x8BAE6290, 0x92B553D1,
+        0xDDF4C516, 0xC4EFF457, 0xEFC2A794, 0xF6D996D5, 0xAE07BCE9, 0xB71C8DA8,
+        0x9C31DE6B, 0x852AEF2A, 0xCA6B79ED, 0xD37048AC, 0xF85D1B6F, 0xE1462A2E,
+        0x66DE36E1, 0x7FC507A0, 0x54E85463, 0x4DF36522, 0x02B2F3E5, 0x1BA9C2A4,
+        0x30849167, 0x299FA026, 0xE4C5AEB8, 0xFDDE9FF9, 0xD6F3CC3A, 0xCFE8FD7B,
+        0x80A96BBC, 0x99B25AFD, 0xB29F093E, 0xAB84387F, 0x2C1C24B0, 0x350715F1,
+        0x1E2A4632, 0x07317773, 0x4870E1B4, 0x516BD0F5, 0x7A468336, 0x635DB277,
+        0xCBFAD74E, 0xD2E1E60F, 0xF9CCB5CC, 0xE0D7848D, 0xAF96124A, 0xB68D230B,
+        0x9DA070C8, 0x84BB4189, 0x03235D46, 0x1A386C07, 0x31153FC4, 0x280E0E85,
+        0x674F9842, 0x7E54A903, 0x5579FAC0, 0x4C62CB81, 0x8138C51F, 0x9823F45E,
+        0xB30EA79D, 0xAA1596DC, 0xE554001B, 0xFC4F315A, 0xD7626299, 0xCE7953D8,
+        0x49E14F17, 0x50FA7E56, 0x7BD72D95, 0x62CC1CD4, 0x2D8D8A13, 0x3496BB52,
+        0x1FBBE891, 0x06A0D9D0, 0x5E7EF3EC, 0x4765C2AD, 0x6C48916E, 0x7553A02F,
+        0x3A1236E8, 0x230907A9, 0x0824546A, 0x113F652B, 0x96A779E4, 0x8FBC48A5,
+        0xA4911B66, 0xBD8A2A27, 0xF2CBBCE0, 0xEBD08DA1, 0xC0FDDE62, 0xD9E6EF23,
+        0x14BCE1BD, 0x0DA7D0FC, 0x268A833F, 0x3F91B27E, 0x70D024B9, 0x69CB15F8,
+        0x42E6463B, 0x5BFD777A, 0xDC656BB5, 0xC57E5AF4, 0xEE530937, 0xF7483876,
+        0xB809AEB1, 0xA1129FF0, 0x8A3FCC33, 0x9324FD72
+    },
+    {
+        0x00000000, 0x01C26A37, 0x0384D46E, 0x0246BE59, 0x0709A8DC, 0x06CBC2EB,
+        0x048D7CB2, 0x054F1685, 0x0E1351B8, 0x0FD13B8F, 0x0D9785D6, 0x0C55EFE1,
+        0x091AF964, 0x08D89353, 0x0A9E2D0A, 0x0B5C473D, 0x1C26A370, 0x1DE4C947,
+        0x1FA2771E, 0x1E601D29, 0x1B2F0BAC, 0x1AED619B, 0x18ABDFC2, 0x1969B5F5,
+        0x1235F2C8, 0x13F798FF, 0x11B126A6, 0x10734C91, 0x153C5A14, 0x14FE3023,
+        0x16B88E7A, 0x177AE44D, 0x384D46E0, 0x398F2CD7, 0x3BC9928E, 0x3A0BF8B9,
+        0x3F44EE3C, 0x3E86840B, 0x3CC03A52, 0x3D025065, 0x365E1758, 0x379C7D6F,
+        0x35DAC336, 0x3418A901, 0x3157BF84, 0x3095D5B3, 0x32D36BEA, 0x331101DD,
+        0x246BE590, 0x25A98FA7, 0x27EF31FE, 0x262D5BC9, 0x23624D4C, 0x22A0277B,
+        0x20E69922, 0x2124F315, 0x2A78B428, 0x2BBADE1F, 0x29FC6046, 0x283E0A71,
+        0x2D711CF4, 0x2CB376C3, 0x2EF5C89A, 0x2F37A2AD, 0x709A8DC0, 0x7158E7F7,
+        0x731E59AE, 0x72DC3399, 0x7793251C, 0x76514F2B, 0x7417F172, 0x75D59B45,
+        0x7E89DC78, 0x7F4BB64F, 0x7D0D0816, 0x7CCF6221, 0x798074A4, 0x78421E93,
+        0x7A04A0CA, 0x7BC6CAFD, 0x6CBC2EB0, 0x6D7E4487, 0x6F38FADE, 0x6EFA90E9,
+        0x6BB5866C, 0x6A77EC5B, 0x68315202, 0x69F33835, 0x62AF7F08, 0x636D153F,
+        0x612BAB66, 0x60E9C151, 0x65A6D7D4, 0x6464BDE3, 0x662203BA, 0x67E0698D,
+        0x48D7CB20, 0x4915A117, 0x4B531F4E, 0x4A917579, 0x4FDE63FC, 0x4E1C09CB,
+        0x4C5AB792, 0x4D98DDA5, 0x46C49A98, 0x4706F0AF, 0x45404EF6, 0x448224C1,
+        0x41CD3244, 0x400F5873, 0x4249E62A, 0x438B8C1D, 0x54F16850, 0x55330267,
+        0x5775BC3E, 0x56B7D609, 0x53F8C08C, 0x523AAABB, 0x507C14E2, 0x51BE7ED5,
+        0x5AE239E8, 0x5B2053DF, 0x5966ED86, 0x58A487B1, 0x5DEB9134, 0x5C29FB03,
+        0x5E6F455A, 0x5FAD2F6D, 0xE1351B80, 0xE0F771B7, 0xE2B1CFEE, 0xE373A5D9,
+        0xE63CB35C, 0xE7FED96B, 0xE5B86732, 0xE47A0D05, 0xEF264A38, 0xEEE4200F,
+        0xECA29E56, 0xED60F461, 0xE82FE2E4, 0xE9ED88D3, 0xEBAB368A, 0xEA695CBD,
+        0xFD13B8F0, 0xFCD1D2C7, 0xFE976C9E, 0xFF5506A9, 0xFA1A102C, 0xFBD87A1B,
+        0xF99EC442, 0xF85CAE75, 0xF300E948, 0xF2C2837F, 0xF0843D26, 0xF1465711,
+        0xF4094194, 0xF5CB2BA3, 0xF78D95FA, 0xF64FFFCD, 0xD9785D60, 0xD8BA3757,
+        0xDAFC890E, 0xDB3EE339, 0xDE71F5BC, 0xDFB39F8B, 0xDDF521D2, 0xDC374BE5,
+        0xD76B0CD8, 0xD6A966EF, 0xD4EFD8B6, 0xD52DB281, 0xD062A404, 0xD1A0CE33,
+        0xD3E6706A, 0xD2241A5D, 0xC55EFE10, 0xC49C9427, 0xC6DA2A7E, 0xC7184049,
+        0xC25756CC, 0xC3953CFB, 0xC1D382A2, 0xC011E895, 0xCB4DAFA8, 0xCA8FC59F,
+        0xC8C97BC6, 0xC90B11F1, 0xCC440774, 0xCD866D43, 0xCFC0D31A, 0xCE02B92D,
+        0x91AF9640, 0x906DFC77, 0x922B422E, 0x93E92819, 0x96A63E9C, 0x976454AB,
+        0x9522EAF2, 0x94E080C5, 0x9FBCC7F8, 0x9E7EADCF, 0x9C381396, 0x9DFA79A1,
+        0x98B56F24, 0x99770513, 0x9B31BB4A, 0x9AF3D17D, 0x8D893530, 0x8C4B5F07,
+        0x8E0DE15E, 0x8FCF8B69, 0x8A809DEC, 0x8B42F7DB, 0x89044982, 0x88C623B5,
+        0x839A6488, 0x82580EBF, 0x801EB0E6, 0x81DCDAD1, 0x8493CC54, 0x8551A663,
+        0x8717183A, 0x86D5720D, 0xA9E2D0A0, 0xA820BA97, 0xAA6604CE, 0xABA46EF9,
+        0xAEEB787C, 0xAF29124B, 0xAD6FAC12, 0xACADC625, 0xA7F18118, 0xA633EB2F,
+        0xA4755576, 0xA5B73F41, 0xA0F829C4, 0xA13A43F3, 0xA37CFDAA, 0xA2BE979D,
+        0xB5C473D0, 0xB40619E7, 0xB640A7BE, 0xB782CD89, 0xB2CDDB0C, 0xB30FB13B,
+        0xB1490F62, 0xB08B6555, 0xBBD72268, 0xBA15485F, 0xB853F606, 0xB9919C31,
+        0xBCDE8AB4, 0xBD1CE083, 0xBF5A5EDA, 0xBE9834ED
+    },
+    {
+        0x00000000, 0xB8BC6765, 0xAA09C88B, 0x12B5AFEE, 0x8F629757, 0x37DEF032,
+        0x256B5FDC, 0x9DD738B9, 0xC5B428EF, 0x7D084F8A, 0x6FBDE064, 0xD7018701,
+        0x4AD6BFB8, 0xF26AD8DD, 0xE0DF7733, 0x58631056, 0x5019579F, 0xE8A530FA,
+        0xFA109F14, 0x42ACF871, 0xDF7BC0C8, 0x67C7A7AD, 0x75720843, 0xCDCE6F26,
+        0x95AD7F70, 0x2D111815, 0x3FA4B7FB, 0x8718D09E, 0x1ACFE827, 0xA2738F42,
+        0xB0C620AC, 0x087A47C9, 0xA032AF3E, 0x188EC85B, 0x0A3B67B5, 0xB28700D0,
+        0x2F503869, 0x97EC5F0C, 0x8559F0E2, 0x3DE59787, 0x658687D1, 0xDD3AE0B4,
+        0xCF8F4F5A, 0x7733283F, 0xEAE41086, 0x525877E3, 0x40EDD80D, 0xF851BF68,
+        0xF02BF8A1, 0x48979FC4, 0x5A22302A, 0xE29E574F, 0x7F496FF6, 0xC7F50893,
+        0xD540A77D, 0x6DFCC018, 0x359FD04E, 0x8D23B72B, 0x9F9618C5, 0x272A7FA0,
+        0xBAFD4719, 0x0241207C, 0x10F48F92, 0xA848E8F7, 0x9B14583D, 0x23A83F58,
+        0x311D90B6, 0x89A1F7D3, 0x1476CF6A, 0xACCAA80F, 0xBE7F07E1, 0x06C36084,
+        0x5EA070D2, 0xE61C17B7, 0xF4A9B859, 0x4C15DF3C, 0xD1C2E785, 0x697E80E0,
+        0x7BCB2F0E, 0xC377486B, 0xCB0D0FA2, 0x73B168C7, 0x6104C729, 0xD9B8A04C,
+        0x446F98F5, 0xFCD3FF90, 0xEE66507E, 0x56DA371B, 0x0EB9274D, 0xB6054028,
+        0xA4B0EFC6, 0x1C0C88A3, 0x81DBB01A, 0x3967D77F, 0x2BD27891, 0x936E1FF4,
+        0x3B26F703, 0x839A9066, 0x912F3F88, 0x299358ED, 0xB4446054, 0x0CF80731,
+        0x1E4DA8DF, 0xA6F1CFBA, 0xFE92DFEC, 0x462EB889, 0x549B1767, 0xEC277002,
+        0x71F048BB, 0xC94C2FDE, 0xDBF98030, 0x6345E755, 0x6B3FA09C, 0xD383C7F9,
+        0xC1366817, 0x798A0F72, 0xE45D37CB, 0x5CE150AE, 0x4E54FF40, 0xF6E89825,
+        0xAE8B8873, 0x1637EF16, 0x048240F8, 0xBC3E279D, 0x21E91F24, 0x99557841,
+        0x8BE0D7AF, 0x335CB0CA, 0xED59B63B, 0x55E5D15E, 0x47507EB0, 0xFFEC19D5,
+        0x623B216C, 0xDA874609, 0xC832E9E7, 0x708E8E82, 0x28ED9ED4, 0x9051F9B1,
+        0x82E4565F, 0x3A58313A, 0xA78F0983, 0x1F336EE6, 0x0D86C108, 0xB53AA66D,
+        0xBD40E1A4, 0x05FC86C1, 0x1749292F, 0xAFF54E4A, 0x322276F3, 0x8A9E1196,
+        0x982BBE78, 0x2097D91D, 0x78F4C94B, 0xC048AE2E, 0xD2FD01C0, 0x6A4166A5,
+        0xF7965E1C, 0x4F2A3979, 0x5D9F9697, 0xE523F1F2, 0x4D6B1905, 0xF5D77E60,
+        0xE762D18E, 0x5FDEB6EB, 0xC2098E52, 0x7AB5E937, 0x680046D9, 0xD0BC21BC,
+        0x88DF31EA, 0x3063568F, 0x22D6F961, 0x9A6A9E04, 0x07BDA6BD, 0xBF01C1D8,
+        0xADB46E36, 0x15080953, 0x1D724E9A, 0xA5CE29FF, 0xB77B8611, 0x0FC7E174,
+        0x9210D9CD, 0x2AACBEA8, 0x38191146, 0x80A57623, 0xD8C66675, 0x607A0110,
+        0x72CFAEFE, 0xCA73C99B, 0x57A4F122, 0xEF189647, 0xFDAD39A9, 0x45115ECC,
+        0x764DEE06, 0xCEF18963, 0xDC44268D, 0x64F841E8, 0xF92F7951, 0x41931E34,
+        0x5326B1DA, 0xEB9AD6BF, 0xB3F9C6E9, 0x0B45A18C, 0x19F00E62, 0xA14C6907,
+        0x3C9B51BE, 0x842736DB, 0x96929935, 0x2E2EFE50, 0x2654B999, 0x9EE8DEFC,
+        0x8C5D7112, 0x34E11677, 0xA9362ECE, 0x118A49AB, 0x033FE645, 0xBB838120,
+        0xE3E09176, 0x5B5CF613, 0x49E959FD, 0xF1553E98, 0x6C820621, 0xD43E6144,
+        0xC68BCEAA, 0x7E37A9CF, 0xD67F4138, 0x6EC3265D, 0x7C7689B3, 0xC4CAEED6,
+        0x591DD66F, 0xE1A1B10A, 0xF3141EE4, 0x4BA87981, 0x13CB69D7, 0xAB770EB2,
+        0xB9C2A15C, 0x017EC639, 0x9CA9FE80, 0x241599E5, 0x36A0360B, 0x8E1C516E,
+        0x866616A7, 0x3EDA71C2, 0x2C6FDE2C, 0x94D3B949, 0x090481F0, 0xB1B8E695,
+        0xA30D497B, 0x1BB12E1E, 0x43D23E48, 0xFB6E592D, 0xE9DBF6C3, 0x516791A6,
+        0xCCB0A91F, 0x740CCE7A, 0x66B96194, 0xDE0506F1
+    },
+    {
+        0x00000000, 0x3D6029B0, 0x7AC05360, 0x47A07AD0, 0xF580A6C0, 0xC8E08F70,
+        0x8F40F5A0, 0xB220DC10, 0x30704BC1, 0x0D106271, 0x4AB018A1, 0x77D03111,
+        0xC5F0ED01, 0xF890C4B1, 0xBF30BE61, 0x825097D1, 0x60E09782, 0x5D80BE32,
+        0x1A20C4E2, 0x2740ED52, 0x95603142, 0xA80018F2, 0xEFA06222, 0xD2C04B92,
+        0x5090DC43, 0x6DF0F5F3, 0x2A508F23, 0x1730A693, 0xA5107A83, 0x98705333,
+        0xDFD029E3, 0xE2B00053, 0xC1C12F04, 0xFCA106B4, 0xBB017C64, 0x866155D4,
+        0x344189C4, 0x0921A074, 0x4E81DAA4, 0x73E1F314, 0xF1B164C5, 0xCCD14D75,
+        0x8B7137A5, 0xB6111E15, 0x0431C205, 0x3951EBB5, 0x7EF19165, 0x4391B8D5,
+        0xA121B886, 0x9C419136, 0xDBE1EBE6, 0xE681C256, 0x54A11E46, 0x69C137F6,
+        0x2E614D26, 0x13016496, 0x9151F347, 0xAC31DAF7, 0xEB91A027, 0xD6F18997,
+        0x64D15587, 0x59B17C37, 0x1E1106E7, 0x23712F57, 0x58F35849, 0x659371F9,
+        0x22330B29, 0x1F532299, 0xAD73FE89, 0x9013D739, 0xD7B3ADE9, 0xEAD38459,
+        0x68831388, 0x55E33A38, 0x124340E8, 0x2F236958, 0x9D03B548, 0xA0639CF8,
+        0xE7C3E628, 0xDAA3CF98, 0x3813CFCB, 0x0573E67B, 0x42D39CAB, 0x7FB3B51B,
+        0xCD93690B, 0xF0F340BB, 0xB7533A6B, 0x8A3313DB, 0x0863840A, 0x3503ADBA,
+        0x72A3D76A, 0x4FC3FEDA, 0xFDE322CA, 0xC0830B7A, 0x872371AA, 0xBA43581A,
+        0x9932774D, 0xA4525EFD, 0xE3F2242D, 0xDE920D9D, 0x6CB2D18D, 0x51D2F83D,
+        0x167282ED, 0x2B12AB5D, 0xA9423C8C, 0x9422153C, 0xD3826FEC, 0xEEE2465C,
+        0x5CC29A4C, 0x61A2B3FC, 0x2602C92C, 0x1B62E09C, 0xF9D2E0CF, 0xC4B2C97F,
+        0x8312B3AF, 0xBE729A1F, 0x0C52460F, 0x31326FBF, 0x7692156F, 0x4BF23CDF,
+        0xC9A2AB0E, 0xF4C282BE, 0xB362F86E, 0x8E02D1DE, 0x3C220DCE, 0x0142247E,
+        0x46E25EAE, 0x7B82771E, 0xB1E6B092, 0x8C869922, 0xCB26E3F2, 0xF646CA42,
+        0x44661652, 0x79063FE2, 0x3EA64532, 0x03C66C82, 0x8196FB53, 0xBCF6D2E3,
+        0xFB56A833, 0xC6368183, 0x74165D93, 0x49767423, 0x0ED60EF3, 0x33B62743,
+        0xD1062710, 0xEC660EA0, 0xABC67470, 0x96A65DC0, 0x248681D0, 0x19E6A860,
+        0x5E46D2B0, 0x6326FB00, 0xE1766CD1, 0xDC164561, 0x9BB63FB1, 0xA6D61601,
+        0x14F6CA11, 0x2996E3A1, 0x6E369971, 0x5356B0C1, 0x70279F96, 0x4D47B626,
+        0x0AE7CCF6, 0x3787E546, 0x85A73956, 0xB8C710E6, 0xFF676A36, 0xC2074386,
+        0x4057D457, 0x7D37FDE7, 0x3A978737, 0x07F7AE87, 0xB5D77297, 0x88B75B27,
+        0xCF1721F7, 0xF2770847, 0x10C70814, 0x2DA721A4, 0x6A075B74, 0x576772C4,
+        0xE547AED4, 0xD8278764, 0x9F87FDB4, 0xA2E7D404, 0x20B743D5, 0x1DD76A65,
+        0x5A7710B5, 0x67173905, 0xD537E515, 0xE857CCA5, 0xAFF7B675, 0x92979FC5,
+        0xE915E8DB, 0xD475C16B, 0x93D5BBBB, 0xAEB5920B, 0x1C954E1B, 0x21F567AB,
+        0x66551D7B, 0x5B3534CB, 0xD965A31A, 0xE4058AAA, 0xA3A5F07A, 0x9EC5D9CA,
+        0x2CE505DA, 0x11852C6A, 0x562556BA, 0x6B457F0A, 0x89F57F59, 0xB49556E9,
+        0xF3352C39, 0xCE550589, 0x7C75D999, 0x4115F029, 0x06B58AF9, 0x3BD5A349,
+        0xB9853498, 0x84E51D28, 0xC34567F8, 0xFE254E48, 0x4C059258, 0x7165BBE8,
+        0x36C5C138, 0x0BA5E888, 0x28D4C7DF, 0x15B4EE6F, 0x521494BF, 0x6F74BD0F,
+        0xDD54611F, 0xE03448AF, 0xA794327F, 0x9AF41BCF, 0x18A48C1E, 0x25C4A5AE,
+        0x6264DF7E, 0x5F04F6CE, 0xED242ADE, 0xD044036E, 0x97E479BE, 0xAA84500E,
+        0x4834505D, 0x755479ED, 0x32F4033D, 0x0F942A8D, 0xBDB4F69D, 0x80D4DF2D,
+        0xC774A5FD, 0xFA148C4D, 0x78441B9C, 0x4524322C, 0x028448FC, 0x3FE4614C,
+        0x8DC4BD5C, 0xB0A494EC, 0xF704EE3C, 0xCA64C78C
+    },
+    {
+        0x00000000, 0xCB5CD3A5, 0x4DC8A10B, 0x869472AE, 0x9B914216, 0x50CD91B3,
+        0xD659E31D, 0x1D0530B8, 0xEC53826D, 0x270F51C8, 0xA19B2366, 0x6AC7F0C3,
+        0x77C2C07B, 0xBC9E13DE, 0x3A0A6170, 0xF156B2D5, 0x03D6029B, 0xC88AD13E,
+        0x4E1EA390, 0x85427035, 0x9847408D, 0x531B9328, 0xD58FE186, 0x1ED33223,
+        0xEF8580F6, 0x24D95353, 0xA24D21FD, 0x6911F258, 0x7414C2E0, 0xBF481145,
+        0x39DC63EB, 0xF280B04E, 0x07AC0536, 0xCCF0D693, 0x4A64A43D, 0x81387798,
+        0x9C3D4720, 0x57619485, 0xD1F5E62B, 0x1AA9358E, 0xEBFF875B, 0x20A354FE,
+        0xA6372650, 0x6D6BF5F5, 0x706EC54D, 0xBB3216E8, 0x3DA66446, 0xF6FAB7E3,
+        0x047A07AD, 0xCF26D408, 0x49B2A6A6, 0x82EE7503, 0x9FEB45BB, 0x54B7961E,
+        0xD223E4B0, 0x197F3715, 0xE82985C0, 0x23755665, 0xA5E124CB, 0x6EBDF76E,
+        0x73B8C7D6, 0xB8E41473, 0x3E7066DD, 0xF52CB578, 0x0F580A6C, 0xC404D9C9,
+        0x4290AB67, 0x89CC78C2, 0x94C9487A, 0x5F959BDF, 0xD901E971, 0x125D3AD4,
+        0xE30B8801, 0x28575BA4, 0xAEC3290A, 0x659FFAAF, 0x789ACA17, 0xB3C619B2,
+        0x35526B1C, 0xFE0EB8B9, 0x0C8E08F7, 0xC7D2DB52, 0x4146A9FC, 0x8A1A7A59,
+        0x971F4AE1, 0x5C439944, 0xDAD7EBEA, 0x118B384F, 0xE0DD8A9A, 0x2B81593F,
+        0xAD152B91, 0x6649F834, 0x7B4CC88C, 0xB0101B29, 0x36846987, 0xFDD8BA22,
+        0x08F40F5A, 0xC3A8DCFF, 0x453CAE51, 0x8E607DF4, 0x93654D4C, 0x58399EE9,
+        0xDEADEC47, 0x15F13FE2, 0xE4A78D37, 0x2FFB5E92, 0xA96F2C3C, 0x6233FF99,
+        0x7F36CF21, 0xB46A1C84, 0x32FE6E2A, 0xF9A2BD8F, 0x0B220DC1, 0xC07EDE64,
+        0x46EAACCA, 0x8DB67F6F, 0x90B34FD7, 0x5BEF9C72, 0xDD7BEEDC, 0x16273D79,
+        0xE7718FAC, 0x2C2D5C09, 0xAAB92EA7, 0x61E5FD02, 0x7CE0CDBA, 0xB7BC1E1F,
+        0x31286CB1, 0xFA74BF14, 0x1EB014D8, 0xD5ECC77D, 0x5378B5D3, 0x98246676,
+        0x852156CE, 0x4E7D856B, 0xC8E9F7C5, 0x03B52460, 0xF2E396B5, 0x39BF4510,
+        0xBF2B37BE, 0x7477E41B, 0x6972D4A3, 0xA22E0706, 0x24BA75A8, 0xEFE6A60D,
+        0x1D661643, 0xD63AC5E6, 0x50AEB748, 0x9BF264ED, 0x86F75455, 0x4DAB87F0,
+        0xCB3FF55E, 0x006326FB, 0xF135942E, 0x3A69478B, 0xBCFD3525, 0x77A1E680,
+        0x6AA4D638, 0xA1F8059D, 0x276C7733, 0xEC30A496, 0x191C11EE, 0xD240C24B,
+        0x54D4B0E5, 0x9F886340, 0x828D53F8, 0x49D1805D, 0xCF45F2F3, 0x04192156,
+        0xF54F9383, 0x3E134026, 0xB8873288, 0x73DBE12D, 0x6EDED195, 0xA5820230,
+        0x2316709E, 0xE84AA33B, 0x1ACA1375, 0xD196C0D0, 0x5702B27E, 0x9C5E61DB,
+        0x815B5163, 0x4A0782C6, 0xCC93F068, 0x07CF23CD, 0xF6999118, 0x3DC542BD,
+        0xBB513013, 0x700DE3B6, 0x6D08D30E, 0xA65400AB, 0x20C07205, 0xEB9CA1A0,
+        0x11E81EB4, 0xDAB4CD11, 0x5C20BFBF, 0x977C6C1A, 0x8A795CA2, 0x41258F07,
+        0xC7B1FDA9, 0x0CED2E0C, 0xFDBB9CD9, 0x36E74F7C, 0xB0733DD2, 0x7B2FEE77,
+        0x662ADECF, 0xAD760D6A, 0x2BE27FC4, 0xE0BEAC61, 0x123E1C2F, 0xD962CF8A,
+        0x5FF6BD24, 0x94AA6E81, 0x89AF5E39, 0x42F38D9C, 0xC467FF32, 0x0F3B2C97,
+        0xFE6D9E42, 0x35314DE7, 0xB3A53F49, 0x78F9ECEC, 0x65FCDC54, 0xAEA00FF1,
+        0x28347D5F, 0xE368AEFA, 0x16441B82, 0xDD18C827, 0x5B8CBA89, 0x90D0692C,
+        0x8DD55994, 0x46898A31, 0xC01DF89F, 0x0B412B3A, 0xFA1799EF, 0x314B4A4A,
+        0xB7DF38E4, 0x7C83EB41, 0x6186DBF9, 0xAADA085C, 0x2C4E7AF2, 0xE712A957,
+        0x15921919, 0xDECECABC, 0x585AB812, 0x93066BB7, 0x8E035B0F, 0x455F88AA,
+        0xC3CBFA04, 0x089729A1, 0xF9C19B74, 0x329D48D1, 0xB4093A7F, 0x7F55E9DA,
+        0x6250D962, 0xA90C0AC7, 0x2F987869, 0xE4C4ABCC
+    },
+    {
+        0x00000000, 0xA6770BB4, 0x979F1129, 0x31E81A9D, 0xF44F2413, 0x52382FA7,
+        0x63D0353A, 0xC5A73E8E, 0x33EF4E67, 0x959845D3, 0xA4705F4E, 0x020754FA,
+        0xC7A06A74, 0x61D761C0, 0x503F7B5D, 0xF64870E9, 0x67DE9CCE, 0xC1A9977A,
+        0xF0418DE7, 0x56368653, 0x9391B8DD, 0x35E6B369, 0x040EA9F4, 0xA279A240,
+        0x5431D2A9, 0xF246D91D, 0xC3AEC380, 0x65D9C834, 0xA07EF6BA, 0x0609FD0E,
+        0x37E1E793, 0x9196EC27, 0xCFBD399C, 0x69CA3228, 0x582228B5, 0xFE552301,
+        0x3BF21D8F, 0x9D85163B, 0xAC6D0CA6, 0x0A1A0712, 0xFC5277FB, 0x5A257C4F,
+        0x6BCD66D2, 0xCDBA6D66, 0x081D53E8, 0xAE6A585C, 0x9F8242C1, 0x39F54975,
+        0xA863A552, 0x0E14AEE6, 0x3FFCB47B, 0x998BBFCF, 0x5C2C8141, 0xFA5B8AF5,
+        0xCBB39068, 0x6DC49BDC, 0x9B8CEB35, 0x3DFBE081, 0x0C13FA1C, 0xAA64F1A8,
+        0x6FC3CF26, 0xC9B4C492, 0xF85CDE0F, 0x5E2BD5BB, 0x440B7579, 0xE27C7ECD,
+        0xD3946450, 0x75E36FE4, 0xB044516A, 0x16335ADE, 0x27DB4043, 0x81AC4BF7,
+        0x77E43B1E, 0xD19330AA, 0xE07B2A37, 0x460C2183, 0x83AB1F0D, 0x25DC14B9,
+        0x14340E24, 0xB2430590, 0x23D5E9B7, 0x85A2E203, 0xB44AF89E, 0x123DF32A,
+        0xD79ACDA4, 0x71EDC610, 0x4005DC8D, 0xE672D739, 0x103AA7D0, 0xB64DAC64,
+        0x87A5B6F9, 0x21D2BD4D, 0xE47583C3, 0x42028877, 0x73EA92EA, 0xD59D995E,
+        0x8BB64CE5, 0x2DC14751, 0x1C295DCC, 0xBA5E5678, 0x7FF968F6, 0xD98E6342,
+        0xE86679DF, 0x4E11726B, 0xB8590282, 0x1E2E0936, 0x2FC613AB, 0x89B1181F,
+        0x4C162691, 0xEA612D25, 0xDB8937B8, 0x7DFE3C0C, 0xEC68D02B, 0x4A1FDB9F,
+        0x7BF7C102, 0xDD80CAB6, 0x1827F438, 0xBE50FF8C, 0x8FB8E511, 0x29CFEEA5,
+        0xDF879E4C, 0x79F095F8, 0x48188F65, 0xEE6F84D1, 0x2BC8BA5F, 0x8DBFB1EB,
+        0xBC57AB76, 0x1A20A0C2, 0x8816EAF2, 0x2E61E146, 0x1F89FBDB, 0xB9FEF06F,
+        0x7C59CEE1, 0xDA2EC555, 0xEBC6DFC8, 0x4DB1D47C, 0xBBF9A495, 0x1D8EAF21,
+        0x2C66B5BC, 0x8A11BE08, 0x4FB68086, 0xE9C18B32, 0xD82991AF, 0x7E5E9A1B,
+        0xEFC8763C, 0x49BF7D88, 0x78576715, 0xDE206CA1, 0x1B87522F, 0xBDF0599B,
+        0x8C184306, 0x2A6F48B2, 0xDC27385B, 0x7A5033EF, 0x4BB82972, 0xEDCF22C6,
+        0x28681C48, 0x8E1F17FC, 0xBFF70D61, 0x198006D5, 0x47ABD36E, 0xE1DCD8DA,
+        0xD034C247, 0x7643C9F3, 0xB3E4F77D, 0x1593FCC9, 0x247BE654, 0x820CEDE0,
+        0x74449D09, 0xD23396BD, 0xE3DB8C20, 0x45AC8794, 0x800BB91A, 0x267CB2AE,
+        0x1794A833, 0xB1E3A387, 0x20754FA0, 0x86024414, 0xB7EA5E89, 0x119D553D,
+        0xD43A6BB3, 0x724D6007, 0x43A57A9A, 0xE5D2712E, 0x139A01C7, 0xB5ED0A73,
+        0x840510EE, 0x22721B5A, 0xE7D525D4, 0x41A22E60, 0x704A34FD, 0xD63D3F49,
+        0xCC1D9F8B, 0x6A6A943F, 0x5B828EA2, 0xFDF58516, 0x3852BB98, 0x9E25B02C,
+        0xAFCDAAB1, 0x09BAA105, 0xFFF2D1EC, 0x5985DA58, 0x686DC0C5, 0xCE1ACB71,
+        0x0BBDF5FF, 0xADCAFE4B, 0x9C22E4D6, 0x3A55EF62, 0xABC30345, 0x0DB408F1,
+        0x3C5C126C, 0x9A2B19D8, 0x5F8C2756, 0xF9FB2CE2, 0xC813367F, 0x6E643DCB,
+        0x982C4D22, 0x3E5B4696, 0x0FB35C0B, 0xA9C457BF, 0x6C636931, 0xCA146285,
+        0xFBFC7818, 0x5D8B73AC, 0x03A0A617, 0xA5D7ADA3, 0x943FB73E, 0x3248BC8A,
+        0xF7EF8204, 0x519889B0, 0x6070932D, 0xC6079899, 0x304FE870, 0x9638E3C4,
+        0xA7D0F959, 0x01A7F2ED, 0xC400CC63, 0x6277C7D7, 0x539FDD4A, 0xF5E8D6FE,
+        0x647E3AD9, 0xC209316D, 0xF3E12BF0, 0x55962044, 0x90311ECA, 0x3646157E,
+        0x07AE0FE3, 0xA1D90457, 0x579174BE, 0xF1E67F0A, 0xC00E6597, 0x66796E23,
+        0xA3DE50AD, 0x05A95B19, 0x34414184, 0x92364A30
+    },
+    {
+        0x00000000, 0xCCAA009E, 0x4225077D, 0x8E8F07E3, 0x844A0EFA, 0x48E00E64,
+        0xC66F0987, 0x0AC50919, 0xD3E51BB5, 0x1F4F1B2B, 0x91C01CC8, 0x5D6A1C56,
+        0x57AF154F, 0x9B0515D1, 0x158A1232, 0xD92012AC, 0x7CBB312B, 0xB01131B5,
+        0x3E9E3656, 0xF23436C8, 0xF8F13FD1, 0x345B3F4F, 0xBAD438AC, 0x767E3832,
+        0xAF5E2A9E, 0x63F42A00, 0xED7B2DE3, 0x21D12D7D, 0x2B142464, 0xE7BE24FA,
+        0x69312319, 0xA59B2387, 0xF9766256, 0x35DC62C8, 0xBB53652B, 0x77F965B5,
+        0x7D3C6CAC, 0xB1966C32, 0x3F196BD1, 0xF3B36B4F, 0x2A9379E3, 0xE639797D,
+        0x68B67E9E, 0xA41C7E00, 0xAED97719, 0x62737787, 0xECFC7064, 0x205670FA,
+        0x85CD537D, 0x496753E3, 0xC7E85400, 0x0B42549E, 0x01875D87, 0xCD2D5D19,
+        0x43A25AFA, 0x8F085A64, 0x562848C8, 0x9A824856, 0x140D4FB5, 0xD8A74F2B,
+        0xD2624632, 0x1EC846AC, 0x9047414F, 0x5CED41D1, 0x299DC2ED, 0xE537C273,
+        0x6BB8C590, 0xA712C50E, 0xADD7CC17, 0x617DCC89, 0xEFF2CB6A, 0x2358CBF4,
+        0xFA78D958, 0x36D2D9C6, 0xB85DDE25, 0x74F7DEBB, 0x7E32D7A2, 0xB298D73C,
+        0x3C17D0DF, 0xF0BDD041, 0x5526F3C6, 0x998CF358, 0x1703F4BB, 0xDBA9F425,
+        0xD16CFD3C, 0x1DC6FDA2, 0x9349FA41, 0x5FE3FADF, 0x86C3E873, 0x4A69E8ED,
+        0xC4E6EF0E, 0x084CEF90, 0x0289E689, 0xCE23E617, 0x40ACE1F4, 0x8C06E16A,
+        0xD0EBA0BB, 0x1C41A025, 0x92CEA7C6, 0x5E64A758, 0x54A1AE41, 0x980BAEDF,
+        0x1684A93C, 0xDA2EA9A2, 0x030EBB0E, 0xCFA4BB90, 0x412BBC73, 0x8D81BCED,
+        0x8744B5F4, 0x4BEEB56A, 0xC561B289, 0x09CBB217, 0xAC509190, 0x60FA910E,
+        0xEE7596ED, 0x22DF9673, 0x281A9F6A, 0xE4B09FF4, 0x6A3F9817, 0xA6959889,
+        0x7FB58A25, 0xB31F8ABB, 0x3D908D58, 0xF13A8DC6, 0xFBFF84DF, 0x37558441,
+        0xB9DA83A2, 0x7570833C, 0x533B85DA, 0x9F918544, 0x111E82A7, 0xDDB48239,
+        0xD7718B20, 0x1BDB8BBE, 0x95548C5D, 0x59FE8CC3, 0x80DE9E6F, 0x4C749EF1,
+        0xC2FB9912, 0x0E51998C, 0x04949095, 0xC83E900B, 0x46B197E8, 0x8A1B9776,
+        0x2F80B4F1, 0xE32AB46F, 0x6DA5B38C, 0xA10FB312, 0xABCABA0B, 0x6760BA95,
+        0xE9EFBD76, 0x2545BDE8, 0xFC65AF44, 0x30CFAFDA, 0xBE40A839, 0x72EAA8A7,
+        0x782FA1BE, 0xB485A120, 0x3A0AA6C3, 0xF6A0A65D, 0xAA4DE78C, 0x66E7E712,
+        0xE868E0F1, 0x24C2E06F, 0x2E07E976, 0xE2ADE9E8, 0x6C22EE0B, 0xA088EE95,
+        0x79A8FC39, 0xB502FCA7, 0x3B8DFB44, 0xF727FBDA, 0xFDE2F2C3, 0x3148F25D,
+        0xBFC7F5BE, 0x736DF520, 0xD6F6D6A7, 0x1A5CD639, 0x94D3D1DA, 0x5879D144,
+        0x52BCD85D, 0x9E16D8C3, 0x1099DF20, 0xDC33DFBE, 0x0513CD12, 0xC9B9CD8C,
+        0x4736CA6F, 0x8B9CCAF1, 0x8159C3E8, 0x4DF3C376, 0xC37CC495, 0x0FD6C40B,
+        0x7AA64737, 0xB60C47A9, 0x3883404A, 0xF42940D4, 0xFEEC49CD, 0x32464953,
+        0xBCC94EB0, 0x70634E2E, 0xA9435C82, 0x65E95C1C, 0xEB665BFF, 0x27CC5B61,
+        0x2D095278, 0xE1A352E6, 0x6F2C5505, 0xA386559B, 0x061D761C, 0xCAB77682,
+        0x44387161, 0x889271FF, 0x825778E6, 0x4EFD7878, 0xC0727F9B, 0x0CD87F05,
+        0xD5F86DA9, 0x19526D37, 0x97DD6AD4, 0x5B776A4A, 0x51B26353, 0x9D1863CD,
+        0x1397642E, 0xDF3D64B0, 0x83D02561, 0x4F7A25FF, 0xC1F5221C, 0x0D5F2282,
+        0x079A2B9B, 0xCB302B05, 0x45BF2CE6, 0x89152C78, 0x50353ED4, 0x9C9F3E4A,
+        0x121039A9, 0xDEBA3937, 0xD47F302E, 0x18D530B0, 0x965A3753, 0x5AF037CD,
+        0xFF6B144A, 0x33C114D4, 0xBD4E1337, 0x71E413A9, 0x7B211AB0, 0xB78B1A2E,
+        0x39041DCD, 0xF5AE1D53, 0x2C8E0FFF, 0xE0240F61, 0x6EAB0882, 0xA201081C,
+        0xA8C40105, 0x646E019B, 0xEAE10678, 0x264B06E6
+    },
+    {
+        0x00000000, 0x177B1443, 0x2EF62886, 0x398D3CC5, 0x5DEC510C, 0x4A97454F,
+        0x731A798A, 0x64616DC9, 0xBBD8A218, 0xACA3B65B, 0x952E8A9E, 0x82559EDD,
+        0xE634F314, 0xF14FE757, 0xC8C2DB92, 0xDFB9CFD1, 0xACC04271, 0xBBBB5632,
+        0x82366AF7, 0x954D7EB4, 0xF12C137D, 0xE657073E, 0xDFDA3BFB, 0xC8A12FB8,
+        0x1718E069, 0x0063F42A, 0x39EEC8EF, 0x2E95DCAC, 0x4AF4B165, 0x5D8FA526,
+        0x640299E3, 0x73798DA0, 0x82F182A3, 0x958A96E0, 0xAC07AA25, 0xBB7CBE66,
+        0xDF1DD3AF, 0xC866C7EC, 0xF1EBFB29, 0xE690EF6A, 0x392920BB, 0x2E5234F8,
+        0x17DF083D, 0x00A41C7E, 0x64C571B7, 0x73BE65F4, 0x4A335931, 0x5D484D72,
+        0x2E31C0D2, 0x394AD491, 0x00C7E854, 0x17BCFC17, 0x73DD91DE, 0x64A6859D,
+        0x5D2BB958, 0x4A50AD1B, 0x95E962CA, 0x82927689, 0xBB1F4A4C, 0xAC645E0F,
+        0xC80533C6, 0xDF7E2785, 0xE6F31B40, 0xF1880F03, 0xDE920307, 0xC9E91744,
+        0xF0642B81, 0xE71F3FC2, 0x837E520B, 0x94054648, 0xAD887A8D, 0xBAF36ECE,
+        0x654AA11F, 0x7231B55C, 0x4BBC8999, 0x5CC79DDA, 0x38A6F013, 0x2FDDE450,
+        0x1650D895, 0x012BCCD6, 0x72524176, 0x65295535, 0x5CA469F0, 0x4BDF7DB3,
+        0x2FBE107A, 0x38C50439, 0x014838FC, 0x16332CBF, 0xC98AE36E, 0xDEF1F72D,
+        0xE77CCBE8, 0xF007DFAB, 0x9466B262, 0x831DA621, 0xBA909AE4, 0xADEB8EA7,
+        0x5C6381A4, 0x4B1895E7, 0x7295A922, 0x65EEBD61, 0x018FD0A8, 0x16F4C4EB,
+        0x2F79F82E, 0x3802EC6D, 0xE7BB23BC, 0xF0C037FF, 0xC94D0B3A, 0xDE361F79,
+        0xBA5772B0, 0xAD2C66F3, 0x94A15A36, 0x83DA4E75, 0xF0A3C3D5, 0xE7D8D796,
+        0xDE55EB53, 0xC92EFF10, 0xAD4F92D9, 0xBA34869A, 0x83B9BA5F, 0x94C2AE1C,
+        0x4B7B61CD, 0x5C00758E, 0x658D494B, 0x72F65D08, 0x169730C1, 0x01EC2482,
+        0x38611847, 0x2F1A0C04, 0x6655004F, 0x712E140C, 0x48A328C9, 0x5FD83C8A,
+        0x3BB95143, 0x2CC24500, 0x154F79C5, 0x02346D86, 0xDD8DA257, 0xCAF6B614,
+        0xF37B8AD1, 0xE4009E92, 0x8061F35B, 0x971AE718, 0xAE97DBDD, 0xB9ECCF9E,
+        0xCA95423E, 0xDDEE567D, 0xE4636AB8, 0xF3187EFB, 0x97791332, 0x80020771,
+        0xB98F3BB4, 0xAEF42FF7, 0x714DE026, 0x6636F465, 0x5FBBC8A0, 0x48C0DCE3,
+        0x2CA1B12A, 0x3BDAA569, 0x025799AC, 0x152C8DEF, 0xE4A482EC, 0xF3DF96AF,
+        0xCA52AA6A, 0xDD29BE29, 0xB948D3E0, 0xAE33C7A3, 0x97BEFB66, 0x80C5EF25,
+        0x5F7C20F4, 0x480734B7, 0x718A0872, 0x66F11C31, 0x029071F8, 0x15EB65BB,
+        0x2C66597E, 0x3B1D4D3D, 0x4864C09D, 0x5F1FD4DE, 0x6692E81B, 0x71E9FC58,
+        0x15889191, 0x02F385D2, 0x3B7EB917, 0x2C05AD54, 0xF3BC6285, 0xE4C776C6,
+        0xDD4A4A03, 0xCA315E40, 0xAE503389, 0xB92B27CA, 0x80A61B0F, 0x97DD0F4C,
+        0xB8C70348, 0xAFBC170B, 0x96312BCE, 0x814A3F8D, 0xE52B5244, 0xF2504607,
+        0xCBDD7AC2, 0xDCA66E81, 0x031FA150, 0x1464B513, 0x2DE989D6, 0x3A929D95,
+        0x5EF3F05C, 0x4988E41F, 0x7005D8DA, 0x677ECC99, 0x14074139, 0x037C557A,
+        0x3AF169BF, 0x2D8A7DFC, 0x49EB1035, 0x5E900476, 0x671D38B3, 0x70662CF0,
+        0xAFDFE321, 0xB8A4F762, 0x8129CBA7, 0x9652DFE4, 0xF233B22D, 0xE548A66E,
+        0xDCC59AAB, 0xCBBE8EE8, 0x3A3681EB, 0x2D4D95A8, 0x14C0A96D, 0x03BBBD2E,
+        0x67DAD0E7, 0x70A1C4A4, 0x492CF861, 0x5E57EC22, 0x81EE23F3, 0x969537B0,
+        0xAF180B75, 0xB8631F36, 0xDC0272FF, 0xCB7966BC, 0xF2F45A79, 0xE58F4E3A,
+        0x96F6C39A, 0x818DD7D9, 0xB800EB1C, 0xAF7BFF5F, 0xCB1A9296, 0xDC6186D5,
+        0xE5ECBA10, 0xF297AE53, 0x2D2E6182, 0x3A5575C1, 0x03D84904, 0x14A35D47,
+        0x70C2308E, 0x67B924CD, 0x5E341808, 0x494F0C4B
+    },
+    {
+        0x00000000, 0xEFC26B3E, 0x04F5D03D, 0xEB37BB03, 0x09EBA07A, 0xE629CB44,
+        0x0D1E7047, 0xE2DC1B79, 0x13D740F4, 0xFC152BCA, 0x172290C9, 0xF8E0FBF7,
+        0x1A3CE08E, 0xF5FE8BB0, 0x1EC930B3, 0xF10B5B8D, 0x27AE81E8, 0xC86CEAD6,
+        0x235B51D5, 0xCC993AEB, 0x2E452192, 0xC1874AAC, 0x2AB0F1AF, 0xC5729A91,
+        0x3479C11C, 0xDBBBAA22, 0x308C1121, 0xDF4E7A1F, 0x3D926166, 0xD2500A58,
+        0x3967B15B, 0xD6A5DA65, 0x4F5D03D0, 0xA09F68EE, 0x4BA8D3ED, 0xA46AB8D3,
+        0x46B6A3AA, 0xA974C894, 0x42437397, 0xAD8118A9, 0x5C8A4324, 0xB348281A,
+        0x587F9319, 0xB7BDF827, 0x5561E35E, 0xBAA38860, 0x51943363, 0xBE56585D,
+        0x68F38238, 0x8731E906, 0x6C065205, 0x83C4393B, 0x61182242, 0x8EDA497C,
+        0x65EDF27F, 0x8A2F9941, 0x7B24C2CC, 0x94E6A9F2, 0x7FD112F1, 0x901379CF,
+        0x72CF62B6, 0x9D0D0988, 0x763AB28B, 0x99F8D9B5, 0x9EBA07A0, 0x71786C9E,
+        0x9A4FD79D, 0x758DBCA3, 0x9751A7DA, 0x7893CCE4, 0x93A477E7, 0x7C661CD9,
+        0x8D6D4754, 0x62AF2C6A, 0x89989769, 0x665AFC57, 0x8486E72E, 0x6B448C10,
+        0x80733713, 0x6FB15C2D, 0xB9148648, 0x56D6ED76, 0xBDE15675, 0x52233D4B,
+        0xB0FF2632, 0x5F3D4D0C, 0xB40AF60F, 0x5BC89D31, 0xAAC3C6BC, 0x4501AD82,
+        0xAE361681, 0x41F47DBF, 0xA32866C6, 0x4CEA0DF8, 0xA7DDB6FB, 0x481FDDC5,
+        0xD1E70470, 0x3E256F4E, 0xD512D44D, 0x3AD0BF73, 0xD80CA40A, 0x37CECF34,
+        0xDCF97437, 0x333B1F09, 0xC2304484, 0x2DF22FBA, 0xC6C594B9, 0x2907FF87,
+        0xCBDBE4FE, 0x24198FC0, 0xCF2E34C3, 0x20EC5FFD, 0xF6498598, 0x198BEEA6,
+        0xF2BC55A5, 0x1D7E3E9B, 0xFFA225E2, 0x10604EDC, 0xFB57F5DF, 0x14959EE1,
+        0xE59EC56C, 0x0A5CAE52, 0xE16B1551, 0x0EA97E6F, 0xEC756516, 0x03B70E28,
+        0xE880B52B, 0x0742DE15, 0xE6050901, 0x09C7623F, 0xE2F0D93C, 0x0D32B202,
+        0xEFEEA97B, 0x002CC245, 0xEB1B7946, 0x04D91278, 0xF5D249F5, 0x1A1022CB,
+        0xF12799C8, 0x1EE5F2F6, 0xFC39E98F, 0x13FB82B1, 0xF8CC39B2, 0x170E528C,
+        0xC1AB88E9, 0x2E69E3D7, 0xC55E58D4, 0x2A9C33EA, 0xC8402893, 0x278243AD,
+        0xCCB5F8AE, 0x23779390, 0xD27CC81D, 0x3DBEA323, 0xD6891820, 0x394B731E,
+        0xDB976867, 0x34550359, 0xDF62B85A, 0x30A0D364, 0xA9580AD1, 0x469A61EF,
+        0xADADDAEC, 0x426FB1D2, 0xA0B3AAAB, 0x4F71C195, 0xA4467A96, 0x4B8411A8,
+        0xBA8F4A25, 0x554D211B, 0xBE7A9A18, 0x51B8F126, 0xB364EA5F, 0x5CA68161,
+        0xB7913A62, 0x5853515C, 0x8EF68B39, 0x6134E007, 0x8A035B04, 0x65C1303A,
+        0x871D2B43, 0x68DF407D, 0x83E8FB7E, 0x6C2A9040, 0x9D21CBCD, 0x72E3A0F3,
+        0x99D41BF0, 0x761670CE, 0x94CA6BB7, 0x7B080089, 0x903FBB8A, 0x7FFDD0B4,
+        0x78BF0EA1, 0x977D659F, 0x7C4ADE9C, 0x9388B5A2, 0x7154AEDB, 0x9E96C5E5,
+        0x75A17EE6, 0x9A6315D8, 0x6B684E55, 0x84AA256B, 0x6F9D9E68, 0x805FF556,
+        0x6283EE2F, 0x8D418511, 0x66763E12, 0x89B4552C, 0x5F118F49, 0xB0D3E477,
+        0x5BE45F74, 0xB426344A, 0x56FA2F33, 0xB938440D, 0x520FFF0E, 0xBDCD9430,
+        0x4CC6CFBD, 0xA304A483, 0x48331F80, 0xA7F174BE, 0x452D6FC7, 0xAAEF04F9,
+        0x41D8BFFA, 0xAE1AD4C4, 0x37E20D71, 0xD820664F, 0x3317DD4C, 0xDCD5B672,
+        0x3E09AD0B, 0xD1CBC635, 0x3AFC7D36, 0xD53E1608, 0x24354D85, 0xCBF726BB,
+        0x20C09DB8, 0xCF02F686, 0x2DDEEDFF, 0xC21C86C1, 0x292B3DC2, 0xC6E956FC,
+        0x104C8C99, 0xFF8EE7A7, 0x14B95CA4, 0xFB7B379A, 0x19A72CE3, 0xF66547DD,
+        0x1D52FCDE, 0xF29097E0, 0x039BCC6D, 0xEC59A753, 0x076E1C50, 0xE8AC776E,
+        0x0A706C17, 0xE5B20729, 0x0E85BC2A, 0xE147D714
+    },
+    {
+        0x00000000, 0xC18EDFC0, 0x586CB9C1, 0x99E26601, 0xB0D97382, 0x7157AC42,
+        0xE8B5CA43, 0x293B1583, 0xBAC3E145, 0x7B4D3E85, 0xE2AF5884, 0x23218744,
+        0x0A1A92C7, 0xCB944D07, 0x52762B06, 0x93F8F4C6, 0xAEF6C4CB, 0x6F781B0B,
+        0xF69A7D0A, 0x3714A2CA, 0x1E2FB749, 0xDFA16889, 0x46430E88, 0x87CDD148,
+        0x1435258E, 0xD5BBFA4E, 0x4C599C4F, 0x8DD7438F, 0xA4EC560C, 0x656289CC,
+        0xFC80EFCD, 0x3D0E300D, 0x869C8FD7, 0x47125017, 0xDEF03616, 0x1F7EE9D6,
+        0x3645FC55, 0xF7CB2395, 0x6E294594, 0xAFA79A54, 0x3C5F6E92, 0xFDD1B152,
+        0x6433D753, 0xA5BD0893, 0x8C861D10, 0x4D08C2D0, 0xD4EAA4D1, 0x15647B11,
+        0x286A4B1C, 0xE9E494DC, 0x7006F2DD, 0xB1882D1D, 0x98B3389E, 0x593DE75E,
+        0xC0DF815F, 0x01515E9F, 0x92A9AA59, 0x53277599, 0xCAC51398, 0x0B4BCC58,
+        0x2270D9DB, 0xE3FE061B, 0x7A1C601A, 0xBB92BFDA, 0xD64819EF, 0x17C6C62F,
+        0x8E24A02E, 0x4FAA7FEE, 0x66916A6D, 0xA71FB5AD, 0x3EFDD3AC, 0xFF730C6C,
+        0x6C8BF8AA, 0xAD05276A, 0x34E7416B, 0xF5699EAB, 0xDC528B28, 0x1DDC54E8,
+        0x843E32E9, 0x45B0ED29, 0x78BEDD24, 0xB93002E4, 0x20D264E5, 0xE15CBB25,
+        0xC867AEA6, 0x09E97166, 0x900B1767, 0x5185C8A7, 0xC27D3C61, 0x03F3E3A1,
+        0x9A1185A0, 0x5B9F5A60, 0x72A44FE3, 0xB32A9023, 0x2AC8F622, 0xEB4629E2,
+        0x50D49638, 0x915A49F8, 0x08B82FF9, 0xC936F039, 0xE00DE5BA, 0x21833A7A,
+        0xB8615C7B, 0x79EF83BB, 0xEA17777D, 0x2B99A8BD, 0xB27BCEBC, 0x73F5117C,
+        0x5ACE04FF, 0x9B40DB3F, 0x02A2BD3E, 0xC32C62FE, 0xFE2252F3, 0x3FAC8D33,
+        0xA64EEB32, 0x67C034F2, 0x4EFB2171, 0x8F75FEB1, 0x169798B0, 0xD7194770,
+        0x44E1B3B6, 0x856F6C76, 0x1C8D0A77, 0xDD03D5B7, 0xF438C034, 0x35B61FF4,
+        0xAC5479F5, 0x6DDAA635, 0x77E1359F, 0xB66FEA5F, 0x2F8D8C5E, 0xEE03539E,
+        0xC738461D, 0x06B699DD, 0x9F54FFDC, 0x5EDA201C, 0xCD22D4DA, 0x0CAC0B1A,
+        0x954E6D1B, 0x54C0B2DB, 0x7DFBA758, 0xBC757898, 0x25971E99, 0xE419C159,
+        0xD917F154, 0x18992E94, 0x817B4895, 0x40F59755, 0x69CE82D6, 0xA8405D16,
+        0x31A23B17, 0xF02CE4D7, 0x63D41011, 0xA25ACFD1, 0x3BB8A9D0, 0xFA367610,
+        0xD30D6393, 0x1283BC53, 0x8B61DA52, 0x4AEF0592, 0xF17DBA48, 0x30F36588,
+        0xA9110389, 0x689FDC49, 0x41A4C9CA, 0x802A160A, 0x19C8700B, 0xD846AFCB,
+        0x4BBE5B0D, 0x8A3084CD, 0x13D2E2CC, 0xD25C3D0C, 0xFB67288F, 0x3AE9F74F,
+        0xA30B914E, 0x62854E8E, 0x5F8B7E83, 0x9E05A143, 0x07E7C742, 0xC6691882,
+        0xEF520D01, 0x2EDCD2C1, 0xB73EB4C0, 0x76B06B00, 0xE5489FC6, 0x24C64006,
+        0xBD242607, 0x7CAAF9C7, 0x5591EC44, 0x941F3384, 0x0DFD5585, 0xCC738A45,
+        0xA1A92C70, 0x6027F3B0, 0xF9C595B1, 0x384B4A71, 0x11705FF2, 0xD0FE8032,
+        0x491CE633, 0x889239F3, 0x1B6ACD35, 0xDAE412F5, 0x430674F4, 0x8288AB34,
+        0xABB3BEB7, 0x6A3D6177, 0xF3DF0776, 0x3251D8B6, 0x0F5FE8BB, 0xCED1377B,
+        0x5733517A, 0x96BD8EBA, 0xBF869B39, 0x7E0844F9, 0xE7EA22F8, 0x2664FD38,
+        0xB59C09FE, 0x7412D63E, 0xEDF0B03F, 0x2C7E6FFF, 0x05457A7C, 0xC4CBA5BC,
+        0x5D29C3BD, 0x9CA71C7D, 0x2735A3A7, 0xE6BB7C67, 0x7F591A66, 0xBED7C5A6,
+        0x97ECD025, 0x56620FE5, 0xCF8069E4, 0x0E0EB624, 0x9DF642E2, 0x5C789D22,
+        0xC59AFB23, 0x041424E3, 0x2D2F3160, 0xECA1EEA0, 0x754388A1, 0xB4CD5761,
+        0x89C3676C, 0x484DB8AC, 0xD1AFDEAD, 0x1021016D, 0x391A14EE, 0xF894CB2E,
+        0x6176AD2F, 0xA0F872EF, 0x33008629, 0xF28E59E9, 0x6B6C3FE8, 0xAAE2E028,
+        0x83D9F5AB, 0x42572A6B, 0xDBB54C6A, 0x1A3B93AA
+    },
+    {
+        0x00000000, 0x9BA54C6F, 0xEC3B9E9F, 0x779ED2F0, 0x03063B7F, 0x98A37710,
+        0xEF3DA5E0, 0x7498E98F, 0x060C76FE, 0x9DA93A91, 0xEA37E861, 0x7192A40E,
+        0x050A4D81, 0x9EAF01EE, 0xE931D31E, 0x72949F71, 0x0C18EDFC, 0x97BDA193,
+        0xE0237363, 0x7B863F0C, 0x0F1ED683, 0x94BB9AEC, 0xE325481C, 0x78800473,
+        0x0A149B02, 0x91B1D76D, 0xE62F059D, 0x7D8A49F2, 0x0912A07D, 0x92B7EC12,
+        0xE5293EE2, 0x7E8C728D, 0x1831DBF8, 0x83949797, 0xF40A4567, 0x6FAF0908,
+        0x1B37E087, 0x8092ACE8, 0xF70C7E18, 0x6CA93277, 0x1E3DAD06, 0x8598E169,
+        0xF2063399, 0x69A37FF6, 0x1D3B9679, 0x869EDA16, 0xF10008E6, 0x6AA54489,
+        0x14293604, 0x8F8C7A6B, 0xF812A89B, 0x63B7E4F4, 0x172F0D7B, 0x8C8A4114,
+        0xFB1493E4, 0x60B1DF8B, 0x122540FA, 0x89800C95, 0xFE1EDE65, 0x65BB920A,
+        0x11237B85, 0x8A8637EA, 0xFD18E51A, 0x66BDA975, 0x3063B7F0, 0xABC6FB9F,
+        0xDC58296F, 0x47FD6500, 0x33658C8F, 0xA8C0C0E0, 0xDF5E1210, 0x44FB5E7F,
+        0x366FC10E, 0xADCA8D61, 0xDA545F91, 0x41F113FE, 0x3569FA71, 0xAECCB61E,
+        0xD95264EE, 0x42F72881, 0x3C7B5A0C, 0xA7DE1663, 0xD040C493, 0x4BE588FC,
+        0x3F7D6173, 0xA4D82D1C, 0xD346FFEC, 0x48E3B383, 0x3A772CF2, 0xA1D2609D,
+        0xD64CB26D, 0x4DE9FE02, 0x3971178D, 0xA2D45BE2, 0xD54A8912, 0x4EEFC57D,
+        0x28526C08, 0xB3F72067, 0xC469F297, 0x5FCCBEF8, 0x2B545777, 0xB0F11B18,
+        0xC76FC9E8, 0x5CCA8587, 0x2E5E1AF6, 0xB5FB5699, 0xC2658469, 0x59C0C806,
+        0x2D582189, 0xB6FD6DE6, 0xC163BF16, 0x5AC6F379, 0x244A81F4, 0xBFEFCD9B,
+        0xC8711F6B, 0x53D45304, 0x274CBA8B, 0xBCE9F6E4, 0xCB772414, 0x50D2687B,
+        0x2246F70A, 0xB9E3BB65, 0xCE7D6995, 0x55D825FA, 0x2140CC75, 0xBAE5801A,
+        0xCD7B52EA, 0x56DE1E85, 0x60C76FE0, 0xFB62238F, 0x8CFCF17F, 0x1759BD10,
+        0x63C1549F, 0xF86418F0, 0x8FFACA00, 0x145F866F, 0x66CB191E, 0xFD6E5571,
+        0x8AF08781, 0x1155CBEE, 0x65CD2261, 0xFE686E0E, 0x89F6BCFE, 0x1253F091,
+        0x6CDF821C, 0xF77ACE73, 0x80E41C83, 0x1B4150EC, 0x6FD9B963, 0xF47CF50C,
+        0x83E227FC, 0x18476B93, 0x6AD3F4E2, 0xF176B88D, 0x86E86A7D, 0x1D4D2612,
+        0x69D5CF9D, 0xF27083F2, 0x85EE5102, 0x1E4B1D6D, 0x78F6B418, 0xE353F877,
+        0x94CD2A87, 0x0F6866E8, 0x7BF08F67, 0xE055C308, 0x97CB11F8, 0x0C6E5D97,
+        0x7EFAC2E6, 0xE55F8E89, 0x92C15C79, 0x09641016, 0x7DFCF999, 0xE659B5F6,
+        0x91C76706, 0x0A622B69, 0x74EE59E4, 0xEF4B158B, 0x98D5C77B, 0x03708B14,
+        0x77E8629B, 0xEC4D2EF4, 0x9BD3FC04, 0x0076B06B, 0x72E22F1A, 0xE9476375,
+        0x9ED9B185, 0x057CFDEA, 0x71E41465, 0xEA41580A, 0x9DDF8AFA, 0x067AC695,
+        0x50A4D810, 0xCB01947F, 0xBC9F468F, 0x273A0AE0, 0x53A2E36F, 0xC807AF00,
+        0xBF997DF0, 0x243C319F, 0x56A8AEEE, 0xCD0DE281, 0xBA933071, 0x21367C1E,
+        0x55AE9591, 0xCE0BD9FE, 0xB9950B0E, 0x22304761, 0x5CBC35EC, 0xC7197983,
+        0xB087AB73, 0x2B22E71C, 0x5FBA0E93, 0xC41F42FC, 0xB381900C, 0x2824DC63,
+        0x5AB04312, 0xC1150F7D, 0xB68BDD8D, 0x2D2E91E2, 0x59B6786D, 0xC2133402,
+        0xB58DE6F2, 0x2E28AA9D, 0x489503E8, 0xD3304F87, 0xA4AE9D77, 0x3F0BD118,
+        0x4B933897, 0xD03674F8, 0xA7A8A608, 0x3C0DEA67, 0x4E997516, 0xD53C3979,
+        0xA2A2EB89, 0x3907A7E6, 0x4D9F4E69, 0xD63A0206, 0xA1A4D0F6, 0x3A019C99,
+        0x448DEE14, 0xDF28A27B, 0xA8B6708B, 0x33133CE4, 0x478BD56B, 0xDC2E9904,
+        0xABB04BF4, 0x3015079B, 0x428198EA, 0xD924D485, 0xAEBA0675, 0x351F4A1A,
+        0x4187A395, 0xDA22EFFA, 0xADBC3D0A, 0x36197165
+    },
+    {
+        0x00000000, 0xDD96D985, 0x605CB54B, 0xBDCA6CCE, 0xC0B96A96, 0x1D2FB313,
+        0xA0E5DFDD, 0x7D730658, 0x5A03D36D, 0x87950AE8, 0x3A5F6626, 0xE7C9BFA3,
+        0x9ABAB9FB, 0x472C607E, 0xFAE60CB0, 0x2770D535, 0xB407A6DA, 0x69917F5F,
+        0xD45B1391, 0x09CDCA14, 0x74BECC4C, 0xA92815C9, 0x14E27907, 0xC974A082,
+        0xEE0475B7, 0x3392AC32, 0x8E58C0FC, 0x53CE1979, 0x2EBD1F21, 0xF32BC6A4,
+        0x4EE1AA6A, 0x937773EF, 0xB37E4BF5, 0x6EE89270, 0xD322FEBE, 0x0EB4273B,
+        0x73C72163, 0xAE51F8E6, 0x139B9428, 0xCE0D4DAD, 0xE97D9898, 0x34EB411D,
+        0x89212DD3, 0x54B7F456, 0x29C4F20E, 0xF4522B8B, 0x49984745, 0x940E9EC0,
+        0x0779ED2F, 0xDAEF34AA, 0x67255864, 0xBAB381E1, 0xC7C087B9, 0x1A565E3C,
+        0xA79C32F2, 0x7A0AEB77, 0x5D7A3E42, 0x80ECE7C7, 0x3D268B09, 0xE0B0528C,
+        0x9DC354D4, 0x40558D51, 0xFD9FE19F, 0x2009381A, 0xBD8D91AB, 0x601B482E,
+        0xDDD124E0, 0x0047FD65, 0x7D34FB3D, 0xA0A222B8, 0x1D684E76, 0xC0FE97F3,
+        0xE78E42C6, 0x3A189B43, 0x87D2F78D, 0x5A442E08, 0x27372850, 0xFAA1F1D5,
+        0x476B9D1B, 0x9AFD449E, 0x098A3771, 0xD41CEEF4, 0x69D6823A, 0xB4405BBF,
+        0xC9335DE7, 0x14A58462, 0xA96FE8AC, 0x74F93129, 0x5389E41C, 0x8E1F3D99,
+        0x33D55157, 0xEE4388D2, 0x93308E8A, 0x4EA6570F, 0xF36C3BC1, 0x2EFAE244,
+        0x0EF3DA5E, 0xD36503DB, 0x6EAF6F15, 0xB339B690, 0xCE4AB0C8, 0x13DC694D,
+        0xAE160583, 0x7380DC06, 0x54F00933, 0x8966D0B6, 0x34ACBC78, 0xE93A65FD,
+        0x944963A5, 0x49DFBA20, 0xF415D6EE, 0x29830F6B, 0xBAF47C84, 0x6762A501,
+        0xDAA8C9CF, 0x073E104A, 0x7A4D1612, 0xA7DBCF97, 0x1A11A359, 0xC7877ADC,
+        0xE0F7AFE9, 0x3D61766C, 0x80AB1AA2, 0x5D3DC327, 0x204EC57F, 0xFDD81CFA,
+        0x40127034, 0x9D84A9B1, 0xA06A2517, 0x7DFCFC92, 0xC036905C, 0x1DA049D9,
+        0x60D34F81, 0xBD459604, 0x008FFACA, 0xDD19234F, 0xFA69F67A, 0x27FF2FFF,
+        0x9A354331, 0x47A39AB4, 0x3AD09CEC, 0xE7464569, 0x5A8C29A7, 0x871AF022,
+        0x146D83CD, 0xC9FB5A48, 0x74313686, 0xA9A7EF03, 0xD4D4E95B, 0x094230DE,
+        0xB4885C10, 0x691E8595, 0x4E6E50A0, 0x93F88925, 0x2E32E5EB, 0xF3A43C6E,
+        0x8ED73A36, 0x5341E3B3, 0xEE8B8F7D, 0x331D56F8, 0x13146EE2, 0xCE82B767,
+        0x7348DBA9, 0xAEDE022C, 0xD3AD0474, 0x0E3BDDF1, 0xB3F1B13F, 0x6E6768BA,
+        0x4917BD8F, 0x9481640A, 0x294B08C4, 0xF4DDD141, 0x89AED719, 0x54380E9C,
+        0xE9F26252, 0x3464BBD7, 0xA713C838, 0x7A8511BD, 0xC74F7D73, 0x1AD9A4F6,
+        0x67AAA2AE, 0xBA3C7B2B, 0x07F617E5, 0xDA60CE60, 0xFD101B55, 0x2086C2D0,
+        0x9D4CAE1E, 0x40DA779B, 0x3DA971C3, 0xE03FA846, 0x5DF5C488, 0x80631D0D,
+        0x1DE7B4BC, 0xC0716D39, 0x7DBB01F7, 0xA02DD872, 0xDD5EDE2A, 0x00C807AF,
+        0xBD026B61, 0x6094B2E4, 0x47E467D1, 0x9A72BE54, 0x27B8D29A, 0xFA2E0B1F,
+        0x875D0D47, 0x5ACBD4C2, 0xE701B80C, 0x3A976189, 0xA9E01266, 0x7476CBE3,
+        0xC9BCA72D, 0x142A7EA8, 0x695978F0, 0xB4CFA175, 0x0905CDBB, 0xD493143E,
+        0xF3E3C10B, 0x2E75188E, 0x93BF7440, 0x4E29ADC5, 0x335AAB9D, 0xEECC7218,
+        0x53061ED6, 0x8E90C753, 0xAE99FF49, 0x730F26CC, 0xCEC54A02, 0x13539387,
+        0x6E2095DF, 0xB3B64C5A, 0x0E7C2094, 0xD3EAF911, 0xF49A2C24, 0x290CF5A1,
+        0x94C6996F, 0x495040EA, 0x342346B2, 0xE9B59F37, 0x547FF3F9, 0x89E92A7C,
+        0x1A9E5993, 0xC7088016, 0x7AC2ECD8, 0xA754355D, 0xDA273305, 0x07B1EA80,
+        0xBA7B864E, 0x67ED5FCB, 0x409D8AFE, 0x9D0B537B, 0x20C13FB5, 0xFD57E630,
+        0x8024E068, 0x5DB239ED, 0xE0785523, 0x3DEE8CA6
+    },
+    {
+        0x00000000, 0x9D0FE176, 0xE16EC4AD, 0x7C6125DB, 0x19AC8F1B, 0x84A36E6D,
+        0xF8C24BB6, 0x65CDAAC0, 0x33591E36, 0xAE56FF40, 0xD237DA9B, 0x4F383BED,
+        0x2AF5912D, 0xB7FA705B, 0xCB9B5580, 0x5694B4F6, 0x66B23C6C, 0xFBBDDD1A,
+        0x87DCF8C1, 0x1AD319B7, 0x7F1EB377, 0xE2115201, 0x9E7077DA, 0x037F96AC,
+        0x55EB225A, 0xC8E4C32C, 0xB485E6F7, 0x298A0781, 0x4C47AD41, 0xD1484C37,
+        0xAD2969EC, 0x3026889A, 0xCD6478D8, 0x506B99AE, 0x2C0ABC75, 0xB1055D03,
+        0xD4C8F7C3, 0x49C716B5, 0x35A6336E, 0xA8A9D218, 0xFE3D66EE, 0x63328798,
+        0x1F53A243, 0x825C4335, 0xE791E9F5, 0x7A9E0883, 0x06FF2D58, 0x9BF0CC2E,
+        0xABD644B4, 0x36D9A5C2, 0x4AB88019, 0xD7B7616F, 0xB27ACBAF, 0x2F752AD9,
+        0x53140F02, 0xCE1BEE74, 0x988F5A82, 0x0580BBF4, 0x79E19E2F, 0xE4EE7F59,
+        0x8123D599, 0x1C2C34EF, 0x604D1134, 0xFD42F042, 0x41B9F7F1, 0xDCB61687,
+        0xA0D7335C, 0x3DD8D22A, 0x581578EA, 0xC51A999C, 0xB97BBC47, 0x24745D31,
+        0x72E0E9C7, 0xEFEF08B1, 0x938E2D6A, 0x0E81CC1C, 0x6B4C66DC, 0xF64387AA,
+        0x8A22A271, 0x172D4307, 0x270BCB9D, 0xBA042AEB, 0xC6650F30, 0x5B6AEE46,
+        0x3EA74486, 0xA3A8A5F0, 0xDFC9802B, 0x42C6615D, 0x1452D5AB, 0x895D34DD,
+        0xF53C1106, 0x6833F070, 0x0DFE5AB0, 0x90F1BBC6, 0xEC909E1D, 0x719F7F6B,
+        0x8CDD8F29, 0x11D26E5F, 0x6DB34B84, 0xF0BCAAF2, 0x95710032, 0x087EE144,
+        0x741FC49F, 0xE91025E9, 0xBF84911F, 0x228B7069, 0x5EEA55B2, 0xC3E5B4C4,
+        0xA6281E04, 0x3B27FF72, 0x4746DAA9, 0xDA493BDF, 0xEA6FB345, 0x77605233,
+        0x0B0177E8, 0x960E969E, 0xF3C33C5E, 0x6ECCDD28, 0x12ADF8F3, 0x8FA21985,
+        0xD936AD73, 0x44394C05, 0x385869DE, 0xA55788A8, 0xC09A2268, 0x5D95C31E,
+        0x21F4E6C5, 0xBCFB07B3, 0x8373EFE2, 0x1E7C0E94, 0x621D2B4F, 0xFF12CA39,
+        0x9ADF60F9, 0x07D0818F, 0x7BB1A454, 0xE6BE4522, 0xB02AF1D4, 0x2D2510A2,
+        0x51443579, 0xCC4BD40F, 0xA9867ECF, 0x34899FB9, 0x48E8BA62, 0xD5E75B14,
+        0xE5C1D38E, 0x78CE32F8, 0x04AF1723, 0x99A0F655, 0xFC6D5C95, 0x6162BDE3,
+        0x1D039838, 0x800C794E, 0xD698CDB8, 0x4B972CCE, 0x37F60915, 0xAAF9E863,
+        0xCF3442A3, 0x523BA3D5, 0x2E5A860E, 0xB3556778, 0x4E17973A, 0xD318764C,
+        0xAF795397, 0x3276B2E1, 0x57BB1821, 0xCAB4F957, 0xB6D5DC8C, 0x2BDA3DFA,
+        0x7D4E890C, 0xE041687A, 0x9C204DA1, 0x012FACD7, 0x64E20617, 0xF9EDE761,
+        0x858CC2BA, 0x188323CC, 0x28A5AB56, 0xB5AA4A20, 0xC9CB6FFB, 0x54C48E8D,
+        0x3109244D, 0xAC06C53B, 0xD067E0E0, 0x4D680196, 0x1BFCB560, 0x86F35416,
+        0xFA9271CD, 0x679D90BB, 0x02503A7B, 0x9F5FDB0D, 0xE33EFED6, 0x7E311FA0,
+        0xC2CA1813, 0x5FC5F965, 0x23A4DCBE, 0xBEAB3DC8, 0xDB669708, 0x4669767E,
+        0x3A0853A5, 0xA707B2D3, 0xF1930625, 0x6C9CE753, 0x10FDC288, 0x8DF223FE,
+        0xE83F893E, 0x75306848, 0x09514D93, 0x945EACE5, 0xA478247F, 0x3977C509,
+        0x4516E0D2, 0xD81901A4, 0xBDD4AB64, 0x20DB4A12, 0x5CBA6FC9, 0xC1B58EBF,
+        0x97213A49, 0x0A2EDB3F, 0x764FFEE4, 0xEB401F92, 0x8E8DB552, 0x13825424,
+        0x6FE371FF, 0xF2EC9089, 0x0FAE60CB, 0x92A181BD, 0xEEC0A466, 0x73CF4510,
+        0x1602EFD0, 0x8B0D0EA6, 0xF76C2B7D, 0x6A63CA0B, 0x3CF77EFD, 0xA1F89F8B,
+        0xDD99BA50, 0x40965B26, 0x255BF1E6, 0xB8541090, 0xC435354B, 0x593AD43D,
+        0x691C5CA7, 0xF413BDD1, 0x8872980A, 0x157D797C, 0x70B0D3BC, 0xEDBF32CA,
+        0x91DE1711, 0x0CD1F667, 0x5A454291, 0xC74AA3E7, 0xBB2B863C, 0x2624674A,
+        0x43E9CD8A, 0xDEE62CFC, 0xA2870927, 0x3F88E851
+    },
+    {
+        0x00000000, 0xB9FBDBE8, 0xA886B191, 0x117D6A79, 0x8A7C6563, 0x3387BE8B,
+        0x22FAD4F2, 0x9B010F1A, 0xCF89CC87, 0x7672176F, 0x670F7D16, 0xDEF4A6FE,
+        0x45F5A9E4, 0xFC0E720C, 0xED731875, 0x5488C39D, 0x44629F4F, 0xFD9944A7,
+        0xECE42EDE, 0x551FF536, 0xCE1EFA2C, 0x77E521C4, 0x66984BBD, 0xDF639055,
+        0x8BEB53C8, 0x32108820, 0x236DE259, 0x9A9639B1, 0x019736AB, 0xB86CED43,
+        0xA911873A, 0x10EA5CD2, 0x88C53E9E, 0x313EE576, 0x20438F0F, 0x99B854E7,
+        0x02B95BFD, 0xBB428015, 0xAA3FEA6C, 0x13C43184, 0x474CF219, 0xFEB729F1,
+        0xEFCA4388, 0x56319860, 0xCD30977A, 0x74CB4C92, 0x65B626EB, 0xDC4DFD03,
+        0xCCA7A1D1, 0x755C7A39, 0x64211040, 0xDDDACBA8, 0x46DBC4B2, 0xFF201F5A,
+        0xEE5D7523, 0x57A6AECB, 0x032E6D56, 0xBAD5B6BE, 0xABA8DCC7, 0x1253072F,
+        0x89520835, 0x30A9D3DD, 0x21D4B9A4, 0x982F624C, 0xCAFB7B7D, 0x7300A095,
+        0x627DCAEC, 0xDB861104, 0x40871E1E, 0xF97CC5F6, 0xE801AF8F, 0x51FA7467,
+        0x0572B7FA, 0xBC896C12, 0xADF4066B, 0x140FDD83, 0x8F0ED299, 0x36F50971,
+        0x27886308, 0x9E73B8E0, 0x8E99E432, 0x37623FDA, 0x261F55A3, 0x9FE48E4B,
+        0x04E58151, 0xBD1E5AB9, 0xAC6330C0, 0x1598EB28, 0x411028B5, 0xF8EBF35D,
+        0xE9969924, 0x506D42CC, 0xCB6C4DD6, 0x7297963E, 0x63EAFC47, 0xDA1127AF,
+        0x423E45E3, 0xFBC59E0B, 0xEAB8F472, 0x53432F9A, 0xC8422080, 0x71B9FB68,
+        0x60C49111, 0xD93F4AF9, 0x8DB78964, 0x344C528C, 0x253138F5, 0x9CCAE31D,
+        0x07CBEC07, 0xBE3037EF, 0xAF4D5D96, 0x16B6867E, 0x065CDAAC, 0xBFA70144,
+        0xAEDA6B3D, 0x1721B0D5, 0x8C20BFCF, 0x35DB6427, 0x24A60E5E, 0x9D5DD5B6,
+        0xC9D5162B, 0x702ECDC3, 0x6153A7BA, 0xD8A87C52, 0x43A97348, 0xFA52A8A0,
+        0xEB2FC2D9, 0x52D41931, 0x4E87F0BB, 0xF77C2B53, 0xE601412A, 0x5FFA9AC2,
+        0xC4FB95D8, 0x7D004E30, 0x6C7D2449, 0xD586FFA1, 0x810E3C3C, 0x38F5E7D4,
+        0x29888DAD, 0x90735645, 0x0B72595F, 0xB28982B7, 0xA3F4E8CE, 0x1A0F3326,
+        0x0AE56FF4, 0xB31EB41C, 0xA263DE65, 0x1B98058D, 0x80990A97, 0x3962D17F,
+        0x281FBB06, 0x91E460EE, 0xC56CA373, 0x7C97789B, 0x6DEA12E2, 0xD411C90A,
+        0x4F10C610, 0xF6EB1DF8, 0xE7967781, 0x5E6DAC69, 0xC642CE25, 0x7FB915CD,
+        0x6EC47FB4, 0xD73FA45C, 0x4C3EAB46, 0xF5C570AE, 0xE4B81AD7, 0x5D43C13F,
+        0x09CB02A2, 0xB030D94A, 0xA14DB333, 0x18B668DB, 0x83B767C1, 0x3A4CBC29,
+        0x2B31D650, 0x92CA0DB8, 0x8220516A, 0x3BDB8A82, 0x2AA6E0FB, 0x935D3B13,
+        0x085C3409, 0xB1A7EFE1, 0xA0DA8598, 0x19215E70, 0x4DA99DED, 0xF4524605,
+        0xE52F2C7C, 0x5CD4F794, 0xC7D5F88E, 0x7E2E2366, 0x6F53491F, 0xD6A892F7,
+        0x847C8BC6, 0x3D87502E, 0x2CFA3A57, 0x9501E1BF, 0x0E00EEA5, 0xB7FB354D,
+        0xA6865F34, 0x1F7D84DC, 0x4BF54741, 0xF20E9CA9, 0xE373F6D0, 0x5A882D38,
+        0xC1892222, 0x7872F9CA, 0x690F93B3, 0xD0F4485B, 0xC01E1489, 0x79E5CF61,
+        0x6898A518, 0xD1637EF0, 0x4A6271EA, 0xF399AA02, 0xE2E4C07B, 0x5B1F1B93,
+        0x0F97D80E, 0xB66C03E6, 0xA711699F, 0x1EEAB277, 0x85EBBD6D, 0x3C106685,
+        0x2D6D0CFC, 0x9496D714, 0x0CB9B558, 0xB5426EB0, 0xA43F04C9, 0x1DC4DF21,
+        0x86C5D03B, 0x3F3E0BD3, 0x2E4361AA, 0x97B8BA42, 0xC33079DF, 0x7ACBA237,
+        0x6BB6C84E, 0xD24D13A6, 0x494C1CBC, 0xF0B7C754, 0xE1CAAD2D, 0x583176C5,
+        0x48DB2A17, 0xF120F1FF, 0xE05D9B86, 0x59A6406E, 0xC2A74F74, 0x7B5C949C,
+        0x6A21FEE5, 0xD3DA250D, 0x8752E690, 0x3EA93D78, 0x2FD45701, 0x962F8CE9,
+        0x0D2E83F3, 0xB4D5581B, 0xA5A83262, 0x1C53E98A
+    },
+    {
+        0x00000000, 0xAE689191, 0x87A02563, 0x29C8B4F2, 0xD4314C87, 0x7A59DD16,
+        0x539169E4, 0xFDF9F875, 0x73139F4F, 0xDD7B0EDE, 0xF4B3BA2C, 0x5ADB2BBD,
+        0xA722D3C8, 0x094A4259, 0x2082F6AB, 0x8EEA673A, 0xE6273E9E, 0x484FAF0F,
+        0x61871BFD, 0xCFEF8A6C, 0x32167219, 0x9C7EE388, 0xB5B6577A, 0x1BDEC6EB,
+        0x9534A1D1, 0x3B5C3040, 0x129484B2, 0xBCFC1523, 0x4105ED56, 0xEF6D7CC7,
+        0xC6A5C835, 0x68CD59A4, 0x173F7B7D, 0xB957EAEC, 0x909F5E1E, 0x3EF7CF8F,
+        0xC30E37FA, 0x6D66A66B, 0x44AE1299, 0xEAC68308, 0x642CE432, 0xCA4475A3,
+        0xE38CC151, 0x4DE450C0, 0xB01DA8B5, 0x1E753924, 0x37BD8DD6, 0x99D51C47,
+        0xF11845E3, 0x5F70D472, 0x76B86080, 0xD8D0F111, 0x25290964, 0x8B4198F5,
+        0xA2892C07, 0x0CE1BD96, 0x820BDAAC, 0x2C634B3D, 0x05ABFFCF, 0xABC36E5E,
+        0x563A962B, 0xF85207BA, 0xD19AB348, 0x7FF222D9, 0x2E7EF6FA, 0x8016676B,
+        0xA9DED399, 0x07B64208, 0xFA4FBA7D, 0x54272BEC, 0x7DEF9F1E, 0xD3870E8F,
+        0x5D6D69B5, 0xF305F824, 0xDACD4CD6, 0x74A5DD47, 0x895C2532, 0x2734B4A3,
+        0x0EFC0051, 0xA09491C0, 0xC859C864, 0x663159F5, 0x4FF9ED07, 0xE1917C96,
+        0x1C6884E3, 0xB2001572, 0x9BC8A180, 0x35A03011, 0xBB4A572B, 0x1522C6BA,
+        0x3CEA7248, 0x9282E3D9, 0x6F7B1BAC, 0xC1138A3D, 0xE8DB3ECF, 0x46B3AF5E,
+        0x39418D87, 0x97291C16, 0xBEE1A8E4, 0x10893975, 0xED70C100, 0x43185091,
+        0x6AD0E463, 0xC4B875F2, 0x4A5212C8, 0xE43A8359, 0xCDF237AB, 0x639AA63A,
+        0x9E635E4F, 0x300BCFDE, 0x19C37B2C, 0xB7ABEABD, 0xDF66B319, 0x710E2288,
+        0x58C6967A, 0xF6AE07EB, 0x0B57FF9E, 0xA53F6E0F, 0x8CF7DAFD, 0x229F4B6C,
+        0xAC752C56, 0x021DBDC7, 0x2BD50935, 0x85BD98A4, 0x784460D1, 0xD62CF140,
+        0xFFE445B2, 0x518CD423, 0x5CFDEDF4, 0xF2957C65, 0xDB5DC897, 0x75355906,
+        0x88CCA173, 0x26A430E2, 0x0F6C8410, 0xA1041581, 0x2FEE72BB, 0x8186E32A,
+        0xA84E57D8, 0x0626C649, 0xFBDF3E3C, 0x55B7AFAD, 0x7C7F1B5F, 0xD2178ACE,
+        0xBADAD36A, 0x14B242FB, 0x3D7AF609, 0x93126798, 0x6EEB9FED, 0xC0830E7C,
+        0xE94BBA8E, 0x47232B1F, 0xC9C94C25, 0x67A1DDB4, 0x4E696946, 0xE001F8D7,
+        0x1DF800A2, 0xB3909133, 0x9A5825C1, 0x3430B450, 0x4BC29689, 0xE5AA0718,
+        0xCC62B3EA, 0x620A227B, 0x9FF3DA0E, 0x319B4B9F, 0x1853FF6D, 0xB63B6EFC,
+        0x38D109C6, 0x96B99857, 0xBF712CA5, 0x1119BD34, 0xECE04541, 0x4288D4D0,
+        0x6B406022, 0xC528F1B3, 0xADE5A817, 0x038D3986, 0x2A458D74, 0x842D1CE5,
+        0x79D4E490, 0xD7BC7501, 0xFE74C1F3, 0x501C5062, 0xDEF63758, 0x709EA6C9,
+        0x5956123B, 0xF73E83AA, 0x0AC77BDF, 0xA4AFEA4E, 0x8D675EBC, 0x230FCF2D,
+        0x72831B0E, 0xDCEB8A9F, 0xF5233E6D, 0x5B4BAFFC, 0xA6B25789, 0x08DAC618,
+        0x211272EA, 0x8F7AE37B, 0x01908441, 0xAFF815D0, 0x8630A122, 0x285830B3,
+        0xD5A1C8C6, 0x7BC95957, 0x5201EDA5, 0xFC697C34, 0x94A42590, 0x3ACCB401,
+        0x130400F3, 0xBD6C9162, 0x40956917, 0xEEFDF886, 0xC7354C74, 0x695DDDE5,
+        0xE7B7BADF, 0x49DF2B4E, 0x60179FBC, 0xCE7F0E2D, 0x3386F658, 0x9DEE67C9,
+        0xB426D33B, 0x1A4E42AA, 0x65BC6073, 0xCBD4F1E2, 0xE21C4510, 0x4C74D481,
+        0xB18D2CF4, 0x1FE5BD65, 0x362D0997, 0x98459806, 0x16AFFF3C, 0xB8C76EAD,
+        0x910FDA5F, 0x3F674BCE, 0xC29EB3BB, 0x6CF6222A, 0x453E96D8, 0xEB560749,
+        0x839B5EED, 0x2DF3CF7C, 0x043B7B8E, 0xAA53EA1F, 0x57AA126A, 0xF9C283FB,
+        0xD00A3709, 0x7E62A698, 0xF088C1A2, 0x5EE05033, 0x7728E4C1, 0xD9407550,
+        0x24B98D25, 0x8AD11CB4, 0xA319A846, 0x0D7139D7
+    }
+};
+
+static const uint64_t crc64_table[16][256] =
+{
+    {
+        0x0000000000000000ULL, 0xB32E4CBE03A75F6FULL, 0xF4843657A840A05BULL,
+        0x47AA7AE9ABE7FF34ULL, 0x7BD0C384FF8F5E33ULL, 0xC8FE8F3AFC28015CULL,
+        0x8F54F5D357CFFE68ULL, 0x3C7AB96D5468A107ULL, 0xF7A18709FF1EBC66ULL,
+        0x448FCBB7FCB9E309ULL, 0x0325B15E575E1C3DULL, 0xB00BFDE054F94352ULL,
+        0x8C71448D0091E255ULL, 0x3F5F08330336BD3AULL, 0x78F572DAA8D1420EULL,
+        0xCBDB3E64AB761D61ULL, 0x7D9BA13851336649ULL, 0xCEB5ED8652943926ULL,
+        0x891F976FF973C612ULL, 0x3A31DBD1FAD4997DULL, 0x064B62BCAEBC387AULL,
+        0xB5652E02AD1B6715ULL, 0xF2CF54EB06FC9821ULL, 0x41E11855055BC74EULL,
+        0x8A3A2631AE2DDA2FULL, 0x39146A8FAD8A8540ULL, 0x7EBE1066066D7A74ULL,
+        0xCD905CD805CA251BULL, 0xF1EAE5B551A2841CULL, 0x42C4A90B5205DB73ULL,
+        0x056ED3E2F9E22447ULL, 0xB6409F5CFA457B28ULL, 0xFB374270A266CC92ULL,
+        0x48190ECEA1C193FDULL, 0x0FB374270A266CC9ULL, 0xBC9D3899098133A6ULL,
+        0x80E781F45DE992A1ULL, 0x33C9CD4A5E4ECDCEULL, 0x7463B7A3F5A932FAULL,
+        0xC74DFB1DF60E6D95ULL, 0x0C96C5795D7870F4ULL, 0xBFB889C75EDF2F9BULL,
+        0xF812F32EF538D0AFULL, 0x4B3CBF90F69F8FC0ULL, 0x774606FDA2F72EC7ULL,
+        0xC4684A43A15071A8ULL, 0x83C230AA0AB78E9CULL, 0x30EC7C140910D1F3ULL,
+        0x86ACE348F355AADBULL, 0x3582AFF6F0F2F5B4ULL, 0x7228D51F5B150A80ULL,
+        0xC10699A158B255EFULL, 0xFD7C20CC0CDAF4E8ULL, 0x4E526C720F7DAB87ULL,
+        0x09F8169BA49A54B3ULL, 0xBAD65A25A73D0BDCULL, 0x710D64410C4B16BDULL,
+        0xC22328FF0FEC49D2ULL, 0x85895216A40BB6E6ULL, 0x36A71EA8A7ACE989ULL,
+        0x0ADDA7C5F3C4488EULL, 0xB9F3EB7BF06317E1ULL, 0xFE5991925B84E8D5ULL,
+        0x4D77DD2C5823B7BAULL, 0x64B62BCAEBC387A1ULL, 0xD7986774E864D8CEULL,
+        0x90321D9D438327FAULL, 0x231C512340247895ULL, 0x1F66E84E144CD992ULL,
+        0xAC48A4F017EB86FDULL, 0xEBE2DE19BC0C79C9ULL, 0x58CC92A7BFAB26A6ULL,
+        0x9317ACC314DD3BC7ULL, 0x2039E07D177A64A8ULL, 0x67939A94BC9D9B9CULL,
+        0xD4BDD62ABF3AC4F3ULL, 0xE8C76F47EB5265F4ULL, 0x5BE923F9E8F53A9BULL,
+        0x1C4359104312C5AFULL, 0xAF6D15AE40B59AC0ULL, 0x192D8AF2BAF0E1E8ULL,
+        0xAA03C64CB957BE87ULL, 0xEDA9BCA512B041B3ULL, 0x5E87F01B11171EDCULL,
+        0x62FD4976457FBFDBULL, 0xD1D305C846D8E0B4ULL, 0x96797F21ED3F1F80ULL,
+        0x2557339FEE9840EFULL, 0xEE8C0DFB45EE5D8EULL, 0x5DA24145464902E1ULL,
+        0x1A083BACEDAEFDD5ULL, 0xA9267712EE09A2BAULL, 0x955CCE7FBA6103BDULL,
+        0x267282C1B9C65CD2ULL, 0x61D8F8281221A3E6ULL, 0xD2F6B4961186FC89ULL,
+        0x9F8169BA49A54B33ULL, 0x2CAF25044A02145CULL, 0x6B055FEDE1E5EB68ULL,
+        0xD82B1353E242B407ULL, 0xE451AA3EB62A1500ULL, 0x577FE680B58D4A6FULL,
+        0x10D59C691E6AB55BULL, 0xA3FBD0D71DCDEA34ULL, 0x6820EEB3B6BBF755ULL,
+        0xDB0EA20DB51CA83AULL, 0x9CA4D8E41EFB570EULL, 0x2F8A945A1D5C0861ULL,
+        0x13F02D374934A966ULL, 0xA0DE61894A93F609ULL, 0xE7741B60E174093DULL,
+        0x545A57DEE2D35652ULL, 0xE21AC88218962D7AULL, 0x5134843C1B317215ULL,
+        0x169EFED5B0D68D21ULL, 0xA5B0B26BB371D24EULL, 0x99CA0B06E7197349ULL,
+        0x2AE447B8E4BE2C26ULL, 0x6D4E3D514F59D312ULL, 0xDE6071EF4CFE8C7DULL,
+        0x15BB4F8BE788911CULL, 0xA6950335E42FCE73ULL, 0xE13F79DC4FC83147ULL,
+        0x521135624C6F6E28ULL, 0x6E6B8C0F1807CF2FULL, 0xDD45C0B11BA09040ULL,
+        0x9AEFBA58B0476F74ULL, 0x29C1F6E6B3E0301BULL, 0xC96C5795D7870F42ULL,
+        0x7A421B2BD420502DULL, 0x3DE861C27FC7AF19ULL, 0x8EC62D7C7C60F076ULL,
+        0xB2BC941128085171ULL, 0x0192D8AF2BAF0E1EULL, 0x4638A2468048F12AULL,
+        0xF516EEF883EFAE45ULL, 0x3ECDD09C2899B324ULL, 0x8DE39C222B3EEC4BULL,
+        0xCA49E6CB80D9137FULL, 0x7967AA75837E4C10ULL, 0x451D1318D716ED17ULL,
+        0xF6335FA6D4B1B278ULL, 0xB199254F7F564D4CULL, 0x02B769F17CF11223ULL,
+        0xB4F7F6AD86B4690BULL, 0x07D9BA1385133664ULL, 0x4073C0FA2EF4C950ULL,
+        0xF35D8C442D53963FULL, 0xCF273529793B3738ULL, 0x7C0979977A9C6857ULL,
+        0x3BA3037ED17B9763ULL, 0x888D4FC0D2DCC80CULL, 0x435671A479AAD56DULL,
+        0xF0783D1A7A0D8A02ULL, 0xB7D247F3D1EA7536ULL, 0x04FC0B4DD24D2A59ULL,
+        0x3886B22086258B5EULL, 0x8BA8FE9E8582D431ULL, 0xCC0284772E652B05ULL,
+        0x7F2CC8C92DC2746AULL, 0x325B15E575E1C3D0ULL, 0x8175595B76469CBFULL,
+        0xC6DF23B2DDA1638BULL, 0x75F16F0CDE063CE4ULL, 0x498BD6618A6E9DE3ULL,
+        0xFAA59ADF89C9C28CULL, 0xBD0FE036222E3DB8ULL, 0x0E21AC88218962D7ULL,
+        0xC5FA92EC8AFF7FB6ULL, 0x76D4DE52895820D9ULL, 0x317EA4BB22BFDFEDULL,
+        0x8250E80521188082ULL, 0xBE2A516875702185ULL, 0x0D041DD676D77EEAULL,
+        0x4AAE673FDD3081DEULL, 0xF9802B81DE97DEB1ULL, 0x4FC0B4DD24D2A599ULL,
+        0xFCEEF8632775FAF6ULL, 0xBB44828A8C9205C2ULL, 0x086ACE348F355AADULL,
+        0x34107759DB5DFBAAULL, 0x873E3BE7D8FAA4C5ULL, 0xC094410E731D5BF1ULL,
+        0x73BA0DB070BA049EULL, 0xB86133D4DBCC19FFULL, 0x0B4F7F6AD86B4690ULL,
+        0x4CE50583738CB9A4ULL, 0xFFCB493D702BE6CBULL, 0xC3B1F050244347CCULL,
+        0x709FBCEE27E418A3ULL, 0x3735C6078C03E797ULL, 0x841B8AB98FA4B8F8ULL,
+        0xADDA7C5F3C4488E3ULL, 0x1EF430E13FE3D78CULL, 0x595E4A08940428B8ULL,
+        0xEA7006B697A377D7ULL, 0xD60ABFDBC3CBD6D0ULL, 0x6524F365C06C89BFULL,
+        0x228E898C6B8B768BULL, 0x91A0C532682C29E4ULL, 0x5A7BFB56C35A3485ULL,
+        0xE955B7E8C0FD6BEAULL, 0xAEFFCD016B1A94DEULL, 0x1DD181BF68BDCBB1ULL,
+        0x21AB38D23CD56AB6ULL, 0x9285746C3F7235D9ULL, 0xD52F0E859495CAEDULL,
+        0x6601423B97329582ULL, 0xD041DD676D77EEAAULL, 0x636F91D96ED0B1C5ULL,
+        0x24C5EB30C5374EF1ULL, 0x97EBA78EC690119EULL, 0xAB911EE392F8B099ULL,
+        0x18BF525D915FEFF6ULL, 0x5F1528B43AB810C2ULL, 0xEC3B640A391F4FADULL,
+        0x27E05A6E926952CCULL, 0x94CE16D091CE0DA3ULL, 0xD3646C393A29F297ULL,
+        0x604A2087398EADF8ULL, 0x5C3099EA6DE60CFFULL, 0xEF1ED5546E415390ULL,
+        0xA8B4AFBDC5A6ACA4ULL, 0x1B9AE303C601F3CBULL, 0x56ED3E2F9E224471ULL,
+        0xE5C372919D851B1EULL, 0xA26908783662E42AULL, 0x114744C635C5BB45ULL,
+        0x2D3DFDAB61AD1A42ULL, 0x9E13B115620A452DULL, 0xD9B9CBFCC9EDBA19ULL,
+        0x6A978742CA4AE576ULL, 0xA14CB926613CF817ULL, 0x1262F598629BA778ULL,
+        0x55C88F71C97C584CULL, 0xE6E6C3CFCADB0723ULL, 0xDA9C7AA29EB3A624ULL,
+        0x69B2361C9D14F94BULL, 0x2E184CF536F3067FULL, 0x9D36004B35545910ULL,
+        0x2B769F17CF112238ULL, 0x9858D3A9CCB67D57ULL, 0xDFF2A94067518263ULL,
+        0x6CDCE5FE64F6DD0CULL, 0x50A65C93309E7C0BULL, 0xE388102D33392364ULL,
+        0xA4226AC498DEDC50ULL, 0x170C267A9B79833FULL, 0xDCD7181E300F9E5EULL,
+        0x6FF954A033A8C131ULL, 0x28532E49984F3E05ULL, 0x9B7D62F79BE8616AULL,
+        0xA707DB9ACF80C06DULL, 0x14299724CC279F02ULL, 0x5383EDCD67C06036ULL,
+        0xE0ADA17364673F59ULL
+    },
+    {
+        0x0000000000000000ULL, 0x54E979925CD0F10DULL, 0xA9D2F324B9A1E21AULL,
+        0xFD3B8AB6E5711317ULL, 0xC17D4962DC4DDAB1ULL, 0x959430F0809D2BBCULL,
+        0x68AFBA4665EC38ABULL, 0x3C46C3D4393CC9A6ULL, 0x10223DEE1795ABE7ULL,
+        0x44CB447C4B455AEAULL, 0xB9F0CECAAE3449FDULL, 0xED19B758F2E4B8F0ULL,
+        0xD15F748CCBD87156ULL, 0x85B60D1E9708805BULL, 0x788D87A87279934CULL,
+        0x2C64FE3A2EA96241ULL, 0x20447BDC2F2B57CEULL, 0x74AD024E73FBA6C3ULL,
+        0x899688F8968AB5D4ULL, 0xDD7FF16ACA5A44D9ULL, 0xE13932BEF3668D7FULL,
+        0xB5D04B2CAFB67C72ULL, 0x48EBC19A4AC76F65ULL, 0x1C02B80816179E68ULL,
+        0x3066463238BEFC29ULL, 0x648F3FA0646E0D24ULL, 0x99B4B516811F1E33ULL,
+        0xCD5DCC84DDCFEF3EULL, 0xF11B0F50E4F32698ULL, 0xA5F276C2B823D795ULL,
+        0x58C9FC745D52C482ULL, 0x0C2085E60182358FULL, 0x4088F7B85E56AF9CULL,
+        0x14618E2A02865E91ULL, 0xE95A049CE7F74D86ULL, 0xBDB37D0EBB27BC8BULL,
+        0x81F5BEDA821B752DULL, 0xD51CC748DECB8420ULL, 0x28274DFE3BBA9737ULL,
+        0x7CCE346C676A663AULL, 0x50AACA5649C3047BULL, 0x0443B3C41513F576ULL,
+        0xF9783972F062E661ULL, 0xAD9140E0ACB2176CULL, 0x91D78334958EDECAULL,
+        0xC53EFAA6C95E2FC7ULL, 0x380570102C2F3CD0ULL, 0x6CEC098270FFCDDDULL,
+        0x60CC8C64717DF852ULL, 0x3425F5F62DAD095FULL, 0xC91E7F40C8DC1A48ULL,
+        0x9DF706D2940CEB45ULL, 0xA1B1C506AD3022E3ULL, 0xF558BC94F1E0D3EEULL,
+        0x086336221491C0F9ULL, 0x5C8A4FB0484131F4ULL, 0x70EEB18A66E853B5ULL,
+        0x2407C8183A38A2B8ULL, 0xD93C42AEDF49B1AFULL, 0x8DD53B3C839940A2ULL,
+        0xB193F8E8BAA58904ULL, 0xE57A817AE6757809ULL, 0x18410BCC03046B1EULL,
+        0x4CA8725E5FD49A13ULL, 0x8111EF70BCAD5F38ULL, 0xD5F896E2E07DAE35ULL,
+        0x28C31C54050CBD22ULL, 0x7C2A65C659DC4C2FULL, 0x406CA61260E08589ULL,
+        0x1485DF803C307484ULL, 0xE9BE5536D9416793ULL, 0xBD572CA48591969EULL,
+        0x9133D29EAB38F4DFULL, 0xC5DAAB0CF7E805D2ULL, 0x38E121BA129916C5ULL,
+        0x6C0858284E49E7C8ULL, 0x504E9BFC77752E6EULL, 0x04A7E26E2BA5DF63ULL,
+        0xF99C68D8CED4CC74ULL, 0xAD75114A92043D79ULL, 0xA15594AC938608F6ULL,
+        0xF5BCED3ECF56F9FBULL, 0x088767882A27EAECULL, 0x5C6E1E1A76F71BE1ULL,
+        0x6028DDCE4FCBD247ULL, 0x34C1A45C131B234AULL, 0xC9FA2EEAF66A305DULL,
+        0x9D135778AABAC150ULL, 0xB177A9428413A311ULL, 0xE59ED0D0D8C3521CULL,
+        0x18A55A663DB2410BULL, 0x4C4C23F46162B006ULL, 0x700AE020585E79A0ULL,
+        0x24E399B2048E88ADULL, 0xD9D81304E1FF9BBAULL, 0x8D316A96BD2F6AB7ULL,
+        0xC19918C8E2FBF0A4ULL, 0x9570615ABE2B01A9ULL, 0x684BEBEC5B5A12BEULL,
+        0x3CA2927E078AE3B3ULL, 0x00E451AA3EB62A15ULL, 0x540D28386266DB18ULL,
+        0xA936A28E8717C80FULL, 0xFDDFDB1CDBC73902ULL, 0xD1BB2526F56E5B43ULL,
+        0x85525CB4A9BEAA4EULL, 0x7869D6024CCFB959ULL, 0x2C80AF90101F4854ULL,
+        0x10C66C44292381F2ULL, 0x442F15D675F370FFULL, 0xB9149F60908263E8ULL,
+        0xEDFDE6F2CC5292E5ULL, 0xE1DD6314CDD0A76AULL, 0xB5341A8691005667ULL,
+        0x480F903074714570ULL, 0x1CE6E9A228A1B47DULL, 0x20A02A76119D7DDBULL,
+        0x744953E44D4D8CD6ULL, 0x8972D952A83C9FC1ULL, 0xDD9BA0C0F4EC6ECCULL,
+        0xF1FF5EFADA450C8DULL, 0xA51627688695FD80ULL, 0x582DADDE63E4EE97ULL,
+        0x0CC4D44C3F341F9AULL, 0x308217980608D63CULL, 0x646B6E0A5AD82731ULL,
+        0x9950E4BCBFA93426ULL, 0xCDB99D2EE379C52BULL, 0x90FB71CAD654A0F5ULL,
+        0xC41208588A8451F8ULL, 0x392982EE6FF542EFULL, 0x6DC0FB7C3325B3E2ULL,
+        0x518638A80A197A44ULL, 0x056F413A56C98B49ULL, 0xF854CB8CB3B8985EULL,
+        0xACBDB21EEF686953ULL, 0x80D94C24C1C10B12ULL, 0xD43035B69D11FA1FULL,
+        0x290BBF007860E908ULL, 0x7DE2C69224B01805ULL, 0x41A405461D8CD1A3ULL,
+        0x154D7CD4415C20AEULL, 0xE876F662A42D33B9ULL, 0xBC9F8FF0F8FDC2B4ULL,
+        0xB0BF0A16F97FF73BULL, 0xE4567384A5AF0636ULL, 0x196DF93240DE1521ULL,
+        0x4D8480A01C0EE42CULL, 0x71C2437425322D8AULL, 0x252B3AE679E2DC87ULL,
+        0xD810B0509C93CF90ULL, 0x8CF9C9C2C0433E9DULL, 0xA09D37F8EEEA5CDCULL,
+        0xF4744E6AB23AADD1ULL, 0x094FC4DC574BBEC6ULL, 0x5DA6BD4E0B9B4FCBULL,
+        0x61E07E9A32A7866DULL, 0x350907086E777760ULL, 0xC8328DBE8B066477ULL,
+        0x9CDBF42CD7D6957AULL, 0xD073867288020F69ULL, 0x849AFFE0D4D2FE64ULL,
+        0x79A1755631A3ED73ULL, 0x2D480CC46D731C7EULL, 0x110ECF10544FD5D8ULL,
+        0x45E7B682089F24D5ULL, 0xB8DC3C34EDEE37C2ULL, 0xEC3545A6B13EC6CFULL,
+        0xC051BB9C9F97A48EULL, 0x94B8C20EC3475583ULL, 0x698348B826364694ULL,
+        0x3D6A312A7AE6B799ULL, 0x012CF2FE43DA7E3FULL, 0x55C58B6C1F0A8F32ULL,
+        0xA8FE01DAFA7B9C25ULL, 0xFC177848A6AB6D28ULL, 0xF037FDAEA72958A7ULL,
+        0xA4DE843CFBF9A9AAULL, 0x59E50E8A1E88BABDULL, 0x0D0C771842584BB0ULL,
+        0x314AB4CC7B648216ULL, 0x65A3CD5E27B4731BULL, 0x989847E8C2C5600CULL,
+        0xCC713E7A9E159101ULL, 0xE015C040B0BCF340ULL, 0xB4FCB9D2EC6C024DULL,
+        0x49C73364091D115AULL, 0x1D2E4AF655CDE057ULL, 0x216889226CF129F1ULL,
+        0x7581F0B03021D8FCULL, 0x88BA7A06D550CBEBULL, 0xDC53039489803AE6ULL,
+        0x11EA9EBA6AF9FFCDULL, 0x4503E72836290EC0ULL, 0xB8386D9ED3581DD7ULL,
+        0xECD1140C8F88ECDAULL, 0xD097D7D8B6B4257CULL, 0x847EAE4AEA64D471ULL,
+        0x794524FC0F15C766ULL, 0x2DAC5D6E53C5366BULL, 0x01C8A3547D6C542AULL,
+        0x5521DAC621BCA527ULL, 0xA81A5070C4CDB630ULL, 0xFCF329E2981D473DULL,
+        0xC0B5EA36A1218E9BULL, 0x945C93A4FDF17F96ULL, 0x6967191218806C81ULL,
+        0x3D8E608044509D8CULL, 0x31AEE56645D2A803ULL, 0x65479CF41902590EULL,
+        0x987C1642FC734A19ULL, 0xCC956FD0A0A3BB14ULL, 0xF0D3AC04999F72B2ULL,
+        0xA43AD596C54F83BFULL, 0x59015F20203E90A8ULL, 0x0DE826B27CEE61A5ULL,
+        0x218CD888524703E4ULL, 0x7565A11A0E97F2E9ULL, 0x885E2BACEBE6E1FEULL,
+        0xDCB7523EB73610F3ULL, 0xE0F191EA8E0AD955ULL, 0xB418E878D2DA2858ULL,
+        0x492362CE37AB3B4FULL, 0x1DCA1B5C6B7BCA42ULL, 0x5162690234AF5051ULL,
+        0x058B1090687FA15CULL, 0xF8B09A268D0EB24BULL, 0xAC59E3B4D1DE4346ULL,
+        0x901F2060E8E28AE0ULL, 0xC4F659F2B4327BEDULL, 0x39CDD344514368FAULL,
+        0x6D24AAD60D9399F7ULL, 0x414054EC233AFBB6ULL, 0x15A92D7E7FEA0ABBULL,
+        0xE892A7C89A9B19ACULL, 0xBC7BDE5AC64BE8A1ULL, 0x803D1D8EFF772107ULL,
+        0xD4D4641CA3A7D00AULL, 0x29EFEEAA46D6C31DULL, 0x7D0697381A063210ULL,
+        0x712612DE1B84079FULL, 0x25CF6B4C4754F692ULL, 0xD8F4E1FAA225E585ULL,
+        0x8C1D9868FEF51488ULL, 0xB05B5BBCC7C9DD2EULL, 0xE4B2222E9B192C23ULL,
+        0x1989A8987E683F34ULL, 0x4D60D10A22B8CE39ULL, 0x61042F300C11AC78ULL,
+        0x35ED56A250C15D75ULL, 0xC8D6DC14B5B04E62ULL, 0x9C3FA586E960BF6FULL,
+        0xA0796652D05C76C9ULL, 0xF4901FC08C8C87C4ULL, 0x09AB957669FD94D3ULL,
+        0x5D42ECE4352D65DEULL
+    },
+    {
+        0x0000000000000000ULL, 0x3F0BE14A916A6DCBULL, 0x7E17C29522D4DB96ULL,
+        0x411C23DFB3BEB65DULL, 0xFC2F852A45A9B72CULL, 0xC3246460D4C3DAE7ULL,
+        0x823847BF677D6CBAULL, 0xBD33A6F5F6170171ULL, 0x6A87A57F245D70DDULL,
+        0x558C4435B5371D16ULL, 0x149067EA0689AB4BULL, 0x2B9B86A097E3C680ULL,
+        0x96A8205561F4C7F1ULL, 0xA9A3C11FF09EAA3AULL, 0xE8BFE2C043201C67ULL,
+        0xD7B4038AD24A71ACULL, 0xD50F4AFE48BAE1BAULL, 0xEA04ABB4D9D08C71ULL,
+        0xAB18886B6A6E3A2CULL, 0x94136921FB0457E7ULL, 0x2920CFD40D135696ULL,
+        0x162B2E9E9C793B5DULL, 0x57370D412FC78D00ULL, 0x683CEC0BBEADE0CBULL,
+        0xBF88EF816CE79167ULL, 0x80830ECBFD8DFCACULL, 0xC19F2D144E334AF1ULL,
+        0xFE94CC5EDF59273AULL, 0x43A76AAB294E264BULL, 0x7CAC8BE1B8244B80ULL,
+        0x3DB0A83E0B9AFDDDULL, 0x02BB49749AF09016ULL, 0x38C63AD73E7BDDF1ULL,
+        0x07CDDB9DAF11B03AULL, 0x46D1F8421CAF0667ULL, 0x79DA19088DC56BACULL,
+        0xC4E9BFFD7BD26ADDULL, 0xFBE25EB7EAB80716ULL, 0xBAFE7D685906B14BULL,
+        0x85F59C22C86CDC80ULL, 0x52419FA81A26AD2CULL, 0x6D4A7EE28B4CC0E7ULL,
+        0x2C565D3D38F276BAULL, 0x135DBC77A9981B71ULL, 0xAE6E1A825F8F1A00ULL,
+        0x9165FBC8CEE577CBULL, 0xD079D8177D5BC196ULL, 0xEF72395DEC31AC5DULL,
+        0xEDC9702976C13C4BULL, 0xD2C29163E7AB5180ULL, 0x93DEB2BC5415E7DDULL,
+        0xACD553F6C57F8A16ULL, 0x11E6F50333688B67ULL, 0x2EED1449A202E6ACULL,
+        0x6FF1379611BC50F1ULL, 0x50FAD6DC80D63D3AULL, 0x874ED556529C4C96ULL,
+        0xB845341CC3F6215DULL, 0xF95917C370489700ULL, 0xC652F689E122FACBULL,
+        0x7B61507C1735FBBAULL, 0x446AB136865F9671ULL, 0x057692E935E1202CULL,
+        0x3A7D73A3A48B4DE7ULL, 0x718C75AE7CF7BBE2ULL, 0x4E8794E4ED9DD629ULL,
+        0x0F9BB73B5E236074ULL, 0x30905671CF490DBFULL, 0x8DA3F084395E0CCEULL,
+        0xB2A811CEA8346105ULL, 0xF3B432111B8AD758ULL, 0xCCBFD35B8AE0BA93ULL,
+        0x1B0BD0D158AACB3FULL, 0x2400319BC9C0A6F4ULL, 0x651C12447A7E10A9ULL,
+        0x5A17F30EEB147D62ULL, 0xE72455FB1D037C13ULL, 0xD82FB4B18C6911D8ULL,
+        0x9933976E3FD7A785ULL, 0xA6387624AEBDCA4EULL, 0xA4833F50344D5A58ULL,
+        0x9B88DE1AA5273793ULL, 0xDA94FDC5169981CEULL, 0xE59F1C8F87F3EC05ULL,
+        0x58ACBA7A71E4ED74ULL, 0x67A75B30E08E80BFULL, 0x26BB78EF533036E2ULL,
+        0x19B099A5C25A5B29ULL, 0xCE049A2F10102A85ULL, 0xF10F7B65817A474EULL,
+        0xB01358BA32C4F113ULL, 0x8F18B9F0A3AE9CD8ULL, 0x322B1F0555B99DA9ULL,
+        0x0D20FE4FC4D3F062ULL, 0x4C3CDD90776D463FULL, 0x73373CDAE6072BF4ULL,
+        0x494A4F79428C6613ULL, 0x7641AE33D3E60BD8ULL, 0x375D8DEC6058BD85ULL,
+        0x08566CA6F132D04EULL, 0xB565CA530725D13FULL, 0x8A6E2B19964FBCF4ULL,
+        0xCB7208C625F10AA9ULL, 0xF479E98CB49B6762ULL, 0x23CDEA0666D116CEULL,
+        0x1CC60B4CF7BB7B05ULL, 0x5DDA28934405CD58ULL, 0x62D1C9D9D56FA093ULL,
+        0xDFE26F2C2378A1E2ULL, 0xE0E98E66B212CC29ULL, 0xA1F5ADB901AC7A74ULL,
+        0x9EFE4CF390C617BFULL, 0x9C4505870A3687A9ULL, 0xA34EE4CD9B5CEA62ULL,
+        0xE252C71228E25C3FULL, 0xDD592658B98831F4ULL, 0x606A80AD4F9F3085ULL,
+        0x5F6161E7DEF55D4EULL, 0x1E7D42386D4BEB13ULL, 0x2176A372FC2186D8ULL,
+        0xF6C2A0F82E6BF774ULL, 0xC9C941B2BF019ABFULL, 0x88D5626D0CBF2CE2ULL,
+        0xB7DE83279DD54129ULL, 0x0AED25D26BC24058ULL, 0x35E6C498FAA82D93ULL,
+        0x74FAE74749169BCEULL, 0x4BF1060DD87CF605ULL, 0xE318EB5CF9EF77C4ULL,
+        0xDC130A1668851A0FULL, 0x9D0F29C9DB3BAC52ULL, 0xA204C8834A51C199ULL,
+        0x1F376E76BC46C0E8ULL, 0x203C8F3C2D2CAD23ULL, 0x6120ACE39E921B7EULL,
+        0x5E2B4DA90FF876B5ULL, 0x899F4E23DDB20719ULL, 0xB694AF694CD86AD2ULL,
+        0xF7888CB6FF66DC8FULL, 0xC8836DFC6E0CB144ULL, 0x75B0CB09981BB035ULL,
+        0x4ABB2A430971DDFEULL, 0x0BA7099CBACF6BA3ULL, 0x34ACE8D62BA50668ULL,
+        0x3617A1A2B155967EULL, 0x091C40E8203FFBB5ULL, 0x4800633793814DE8ULL,
+        0x770B827D02EB2023ULL, 0xCA382488F4FC2152ULL, 0xF533C5C265964C99ULL,
+        0xB42FE61DD628FAC4ULL, 0x8B2407574742970FULL, 0x5C9004DD9508E6A3ULL,
+        0x639BE59704628B68ULL, 0x2287C648B7DC3D35ULL, 0x1D8C270226B650FEULL,
+        0xA0BF81F7D0A1518FULL, 0x9FB460BD41CB3C44ULL, 0xDEA84362F2758A19ULL,
+        0xE1A3A228631FE7D2ULL, 0xDBDED18BC794AA35ULL, 0xE4D530C156FEC7FEULL,
+        0xA5C9131EE54071A3ULL, 0x9AC2F254742A1C68ULL, 0x27F154A1823D1D19ULL,
+        0x18FAB5EB135770D2ULL, 0x59E69634A0E9C68FULL, 0x66ED777E3183AB44ULL,
+        0xB15974F4E3C9DAE8ULL, 0x8E5295BE72A3B723ULL, 0xCF4EB661C11D017EULL,
+        0xF045572B50776CB5ULL, 0x4D76F1DEA6606DC4ULL, 0x727D1094370A000FULL,
+        0x3361334B84B4B652ULL, 0x0C6AD20115DEDB99ULL, 0x0ED19B758F2E4B8FULL,
+        0x31DA7A3F1E442644ULL, 0x70C659E0ADFA9019ULL, 0x4FCDB8AA3C90FDD2ULL,
+        0xF2FE1E5FCA87FCA3ULL, 0xCDF5FF155BED9168ULL, 0x8CE9DCCAE8532735ULL,
+        0xB3E23D8079394AFEULL, 0x64563E0AAB733B52ULL, 0x5B5DDF403A195699ULL,
+        0x1A41FC9F89A7E0C4ULL, 0x254A1DD518CD8D0FULL, 0x9879BB20EEDA8C7EULL,
+        0xA7725A6A7FB0E1B5ULL, 0xE66E79B5CC0E57E8ULL, 0xD96598FF5D643A23ULL,
+        0x92949EF28518CC26ULL, 0xAD9F7FB81472A1EDULL, 0xEC835C67A7CC17B0ULL,
+        0xD388BD2D36A67A7BULL, 0x6EBB1BD8C0B17B0AULL, 0x51B0FA9251DB16C1ULL,
+        0x10ACD94DE265A09CULL, 0x2FA73807730FCD57ULL, 0xF8133B8DA145BCFBULL,
+        0xC718DAC7302FD130ULL, 0x8604F9188391676DULL, 0xB90F185212FB0AA6ULL,
+        0x043CBEA7E4EC0BD7ULL, 0x3B375FED7586661CULL, 0x7A2B7C32C638D041ULL,
+        0x45209D785752BD8AULL, 0x479BD40CCDA22D9CULL, 0x789035465CC84057ULL,
+        0x398C1699EF76F60AULL, 0x0687F7D37E1C9BC1ULL, 0xBBB45126880B9AB0ULL,
+        0x84BFB06C1961F77BULL, 0xC5A393B3AADF4126ULL, 0xFAA872F93BB52CEDULL,
+        0x2D1C7173E9FF5D41ULL, 0x121790397895308AULL, 0x530BB3E6CB2B86D7ULL,
+        0x6C0052AC5A41EB1CULL, 0xD133F459AC56EA6DULL, 0xEE3815133D3C87A6ULL,
+        0xAF2436CC8E8231FBULL, 0x902FD7861FE85C30ULL, 0xAA52A425BB6311D7ULL,
+        0x9559456F2A097C1CULL, 0xD44566B099B7CA41ULL, 0xEB4E87FA08DDA78AULL,
+        0x567D210FFECAA6FBULL, 0x6976C0456FA0CB30ULL, 0x286AE39ADC1E7D6DULL,
+        0x176102D04D7410A6ULL, 0xC0D5015A9F3E610AULL, 0xFFDEE0100E540CC1ULL,
+        0xBEC2C3CFBDEABA9CULL, 0x81C922852C80D757ULL, 0x3CFA8470DA97D626ULL,
+        0x03F1653A4BFDBBEDULL, 0x42ED46E5F8430DB0ULL, 0x7DE6A7AF6929607BULL,
+        0x7F5DEEDBF3D9F06DULL, 0x40560F9162B39DA6ULL, 0x014A2C4ED10D2BFBULL,
+        0x3E41CD0440674630ULL, 0x83726BF1B6704741ULL, 0xBC798ABB271A2A8AULL,
+        0xFD65A96494A49CD7ULL, 0xC26E482E05CEF11CULL, 0x15DA4BA4D78480B0ULL,
+        0x2AD1AAEE46EEED7BULL, 0x6BCD8931F5505B26ULL, 0x54C6687B643A36EDULL,
+        0xE9F5CE8E922D379CULL, 0xD6FE2FC403475A57ULL, 0x97E20C1BB0F9EC0AULL,
+        0xA8E9ED51219381C1ULL
+    },
+    {
+        0x0000000000000000ULL, 0x1DEE8A5E222CA1DCULL, 0x3BDD14BC445943B8ULL,
+        0x26339EE26675E264ULL, 0x77BA297888B28770ULL, 0x6A54A326AA9E26ACULL,
+        0x4C673DC4CCEBC4C8ULL, 0x5189B79AEEC76514ULL, 0xEF7452F111650EE0ULL,
+        0xF29AD8AF3349AF3CULL, 0xD4A9464D553C4D58ULL, 0xC947CC137710EC84ULL,
+        0x98CE7B8999D78990ULL, 0x8520F1D7BBFB284CULL, 0xA3136F35DD8ECA28ULL,
+        0xBEFDE56BFFA26BF4ULL, 0x4C300AC98DC40345ULL, 0x51DE8097AFE8A299ULL,
+        0x77ED1E75C99D40FDULL, 0x6A03942BEBB1E121ULL, 0x3B8A23B105768435ULL,
+        0x2664A9EF275A25E9ULL, 0x0057370D412FC78DULL, 0x1DB9BD5363036651ULL,
+        0xA34458389CA10DA5ULL, 0xBEAAD266BE8DAC79ULL, 0x98994C84D8F84E1DULL,
+        0x8577C6DAFAD4EFC1ULL, 0xD4FE714014138AD5ULL, 0xC910FB1E363F2B09ULL,
+        0xEF2365FC504AC96DULL, 0xF2CDEFA2726668B1ULL, 0x986015931B88068AULL,
+        0x858E9FCD39A4A756ULL, 0xA3BD012F5FD14532ULL, 0xBE538B717DFDE4EEULL,
+        0xEFDA3CEB933A81FAULL, 0xF234B6B5B1162026ULL, 0xD4072857D763C242ULL,
+        0xC9E9A209F54F639EULL, 0x771447620AED086AULL, 0x6AFACD3C28C1A9B6ULL,
+        0x4CC953DE4EB44BD2ULL, 0x5127D9806C98EA0EULL, 0x00AE6E1A825F8F1AULL,
+        0x1D40E444A0732EC6ULL, 0x3B737AA6C606CCA2ULL, 0x269DF0F8E42A6D7EULL,
+        0xD4501F5A964C05CFULL, 0xC9BE9504B460A413ULL, 0xEF8D0BE6D2154677ULL,
+        0xF26381B8F039E7ABULL, 0xA3EA36221EFE82BFULL, 0xBE04BC7C3CD22363ULL,
+        0x9837229E5AA7C107ULL, 0x85D9A8C0788B60DBULL, 0x3B244DAB87290B2FULL,
+        0x26CAC7F5A505AAF3ULL, 0x00F95917C3704897ULL, 0x1D17D349E15CE94BULL,
+        0x4C9E64D30F9B8C5FULL, 0x5170EE8D2DB72D83ULL, 0x7743706F4BC2CFE7ULL,
+        0x6AADFA3169EE6E3BULL, 0xA218840D981E1391ULL, 0xBFF60E53BA32B24DULL,
+        0x99C590B1DC475029ULL, 0x842B1AEFFE6BF1F5ULL, 0xD5A2AD7510AC94E1ULL,
+        0xC84C272B3280353DULL, 0xEE7FB9C954F5D759ULL, 0xF391339776D97685ULL,
+        0x4D6CD6FC897B1D71ULL, 0x50825CA2AB57BCADULL, 0x76B1C240CD225EC9ULL,
+        0x6B5F481EEF0EFF15ULL, 0x3AD6FF8401C99A01ULL, 0x273875DA23E53BDDULL,
+        0x010BEB384590D9B9ULL, 0x1CE5616667BC7865ULL, 0xEE288EC415DA10D4ULL,
+        0xF3C6049A37F6B108ULL, 0xD5F59A785183536CULL, 0xC81B102673AFF2B0ULL,
+        0x9992A7BC9D6897A4ULL, 0x847C2DE2BF443678ULL, 0xA24FB300D931D41CULL,
+        0xBFA1395EFB1D75C0ULL, 0x015CDC3504BF1E34ULL, 0x1CB2566B2693BFE8ULL,
+        0x3A81C88940E65D8CULL, 0x276F42D762CAFC50ULL, 0x76E6F54D8C0D9944ULL,
+        0x6B087F13AE213898ULL, 0x4D3BE1F1C854DAFCULL, 0x50D56BAFEA787B20ULL,
+        0x3A78919E8396151BULL, 0x27961BC0A1BAB4C7ULL, 0x01A58522C7CF56A3ULL,
+        0x1C4B0F7CE5E3F77FULL, 0x4DC2B8E60B24926BULL, 0x502C32B8290833B7ULL,
+        0x761FAC5A4F7DD1D3ULL, 0x6BF126046D51700FULL, 0xD50CC36F92F31BFBULL,
+        0xC8E24931B0DFBA27ULL, 0xEED1D7D3D6AA5843ULL, 0xF33F5D8DF486F99FULL,
+        0xA2B6EA171A419C8BULL, 0xBF586049386D3D57ULL, 0x996BFEAB5E18DF33ULL,
+        0x848574F57C347EEFULL, 0x76489B570E52165EULL, 0x6BA611092C7EB782ULL,
+        0x4D958FEB4A0B55E6ULL, 0x507B05B56827F43AULL, 0x01F2B22F86E0912EULL,
+        0x1C1C3871A4CC30F2ULL, 0x3A2FA693C2B9D296ULL, 0x27C12CCDE095734AULL,
+        0x993CC9A61F3718BEULL, 0x84D243F83D1BB962ULL, 0xA2E1DD1A5B6E5B06ULL,
+        0xBF0F57447942FADAULL, 0xEE86E0DE97859FCEULL, 0xF3686A80B5A93E12ULL,
+        0xD55BF462D3DCDC76ULL, 0xC8B57E3CF1F07DAAULL, 0xD6E9A7309F3239A7ULL,
+        0xCB072D6EBD1E987BULL, 0xED34B38CDB6B7A1FULL, 0xF0DA39D2F947DBC3ULL,
+        0xA1538E481780BED7ULL, 0xBCBD041635AC1F0BULL, 0x9A8E9AF453D9FD6FULL,
+        0x876010AA71F55CB3ULL, 0x399DF5C18E573747ULL, 0x24737F9FAC7B969BULL,
+        0x0240E17DCA0E74FFULL, 0x1FAE6B23E822D523ULL, 0x4E27DCB906E5B037ULL,
+        0x53C956E724C911EBULL, 0x75FAC80542BCF38FULL, 0x6814425B60905253ULL,
+        0x9AD9ADF912F63AE2ULL, 0x873727A730DA9B3EULL, 0xA104B94556AF795AULL,
+        0xBCEA331B7483D886ULL, 0xED6384819A44BD92ULL, 0xF08D0EDFB8681C4EULL,
+        0xD6BE903DDE1DFE2AULL, 0xCB501A63FC315FF6ULL, 0x75ADFF0803933402ULL,
+        0x6843755621BF95DEULL, 0x4E70EBB447CA77BAULL, 0x539E61EA65E6D666ULL,
+        0x0217D6708B21B372ULL, 0x1FF95C2EA90D12AEULL, 0x39CAC2CCCF78F0CAULL,
+        0x24244892ED545116ULL, 0x4E89B2A384BA3F2DULL, 0x536738FDA6969EF1ULL,
+        0x7554A61FC0E37C95ULL, 0x68BA2C41E2CFDD49ULL, 0x39339BDB0C08B85DULL,
+        0x24DD11852E241981ULL, 0x02EE8F674851FBE5ULL, 0x1F0005396A7D5A39ULL,
+        0xA1FDE05295DF31CDULL, 0xBC136A0CB7F39011ULL, 0x9A20F4EED1867275ULL,
+        0x87CE7EB0F3AAD3A9ULL, 0xD647C92A1D6DB6BDULL, 0xCBA943743F411761ULL,
+        0xED9ADD965934F505ULL, 0xF07457C87B1854D9ULL, 0x02B9B86A097E3C68ULL,
+        0x1F5732342B529DB4ULL, 0x3964ACD64D277FD0ULL, 0x248A26886F0BDE0CULL,
+        0x7503911281CCBB18ULL, 0x68ED1B4CA3E01AC4ULL, 0x4EDE85AEC595F8A0ULL,
+        0x53300FF0E7B9597CULL, 0xEDCDEA9B181B3288ULL, 0xF02360C53A379354ULL,
+        0xD610FE275C427130ULL, 0xCBFE74797E6ED0ECULL, 0x9A77C3E390A9B5F8ULL,
+        0x879949BDB2851424ULL, 0xA1AAD75FD4F0F640ULL, 0xBC445D01F6DC579CULL,
+        0x74F1233D072C2A36ULL, 0x691FA96325008BEAULL, 0x4F2C37814375698EULL,
+        0x52C2BDDF6159C852ULL, 0x034B0A458F9EAD46ULL, 0x1EA5801BADB20C9AULL,
+        0x38961EF9CBC7EEFEULL, 0x257894A7E9EB4F22ULL, 0x9B8571CC164924D6ULL,
+        0x866BFB923465850AULL, 0xA05865705210676EULL, 0xBDB6EF2E703CC6B2ULL,
+        0xEC3F58B49EFBA3A6ULL, 0xF1D1D2EABCD7027AULL, 0xD7E24C08DAA2E01EULL,
+        0xCA0CC656F88E41C2ULL, 0x38C129F48AE82973ULL, 0x252FA3AAA8C488AFULL,
+        0x031C3D48CEB16ACBULL, 0x1EF2B716EC9DCB17ULL, 0x4F7B008C025AAE03ULL,
+        0x52958AD220760FDFULL, 0x74A614304603EDBBULL, 0x69489E6E642F4C67ULL,
+        0xD7B57B059B8D2793ULL, 0xCA5BF15BB9A1864FULL, 0xEC686FB9DFD4642BULL,
+        0xF186E5E7FDF8C5F7ULL, 0xA00F527D133FA0E3ULL, 0xBDE1D8233113013FULL,
+        0x9BD246C15766E35BULL, 0x863CCC9F754A4287ULL, 0xEC9136AE1CA42CBCULL,
+        0xF17FBCF03E888D60ULL, 0xD74C221258FD6F04ULL, 0xCAA2A84C7AD1CED8ULL,
+        0x9B2B1FD69416ABCCULL, 0x86C59588B63A0A10ULL, 0xA0F60B6AD04FE874ULL,
+        0xBD188134F26349A8ULL, 0x03E5645F0DC1225CULL, 0x1E0BEE012FED8380ULL,
+        0x383870E3499861E4ULL, 0x25D6FABD6BB4C038ULL, 0x745F4D278573A52CULL,
+        0x69B1C779A75F04F0ULL, 0x4F82599BC12AE694ULL, 0x526CD3C5E3064748ULL,
+        0xA0A13C6791602FF9ULL, 0xBD4FB639B34C8E25ULL, 0x9B7C28DBD5396C41ULL,
+        0x8692A285F715CD9DULL, 0xD71B151F19D2A889ULL, 0xCAF59F413BFE0955ULL,
+        0xECC601A35D8BEB31ULL, 0xF1288BFD7FA74AEDULL, 0x4FD56E9680052119ULL,
+        0x523BE4C8A22980C5ULL, 0x74087A2AC45C62A1ULL, 0x69E6F074E670C37DULL,
+        0x386F47EE08B7A669ULL, 0x2581CDB02A9B07B5ULL, 0x03B253524CEEE5D1ULL,
+        0x1E5CD90C6EC2440DULL
+    },
+    {
+        0x0000000000000000ULL, 0x5C2D776033C4205EULL, 0xB85AEEC0678840BCULL,
+        0xE47799A0544C60E2ULL, 0xE26D72AB601E9FFDULL, 0xBE4005CB53DABFA3ULL,
+        0x5A379C6B0796DF41ULL, 0x061AEB0B3452FF1FULL, 0x56024A7D6F33217FULL,
+        0x0A2F3D1D5CF70121ULL, 0xEE58A4BD08BB61C3ULL, 0xB275D3DD3B7F419DULL,
+        0xB46F38D60F2DBE82ULL, 0xE8424FB63CE99EDCULL, 0x0C35D61668A5FE3EULL,
+        0x5018A1765B61DE60ULL, 0xAC0494FADE6642FEULL, 0xF029E39AEDA262A0ULL,
+        0x145E7A3AB9EE0242ULL, 0x48730D5A8A2A221CULL, 0x4E69E651BE78DD03ULL,
+        0x124491318DBCFD5DULL, 0xF6330891D9F09DBFULL, 0xAA1E7FF1EA34BDE1ULL,
+        0xFA06DE87B1556381ULL, 0xA62BA9E7829143DFULL, 0x425C3047D6DD233DULL,
+        0x1E714727E5190363ULL, 0x186BAC2CD14BFC7CULL, 0x4446DB4CE28FDC22ULL,
+        0xA03142ECB6C3BCC0ULL, 0xFC1C358C85079C9EULL, 0xCAD186DE13C29B79ULL,
+        0x96FCF1BE2006BB27ULL, 0x728B681E744ADBC5ULL, 0x2EA61F7E478EFB9BULL,
+        0x28BCF47573DC0484ULL, 0x74918315401824DAULL, 0x90E61AB514544438ULL,
+        0xCCCB6DD527906466ULL, 0x9CD3CCA37CF1BA06ULL, 0xC0FEBBC34F359A58ULL,
+        0x248922631B79FABAULL, 0x78A4550328BDDAE4ULL, 0x7EBEBE081CEF25FBULL,
+        0x2293C9682F2B05A5ULL, 0xC6E450C87B676547ULL, 0x9AC927A848A34519ULL,
+        0x66D51224CDA4D987ULL, 0x3AF86544FE60F9D9ULL, 0xDE8FFCE4AA2C993BULL,
+        0x82A28B8499E8B965ULL, 0x84B8608FADBA467AULL, 0xD89517EF9E7E6624ULL,
+        0x3CE28E4FCA3206C6ULL, 0x60CFF92FF9F62698ULL, 0x30D75859A297F8F8ULL,
+        0x6CFA2F399153D8A6ULL, 0x888DB699C51FB844ULL, 0xD4A0C1F9F6DB981AULL,
+        0xD2BA2AF2C2896705ULL, 0x8E975D92F14D475BULL, 0x6AE0C432A50127B9ULL,
+        0x36CDB35296C507E7ULL, 0x077BA297888B2877ULL, 0x5B56D5F7BB4F0829ULL,
+        0xBF214C57EF0368CBULL, 0xE30C3B37DCC74895ULL, 0xE516D03CE895B78AULL,
+        0xB93BA75CDB5197D4ULL, 0x5D4C3EFC8F1DF736ULL, 0x0161499CBCD9D768ULL,
+        0x5179E8EAE7B80908ULL, 0x0D549F8AD47C2956ULL, 0xE923062A803049B4ULL,
+        0xB50E714AB3F469EAULL, 0xB3149A4187A696F5ULL, 0xEF39ED21B462B6ABULL,
+        0x0B4E7481E02ED649ULL, 0x576303E1D3EAF617ULL, 0xAB7F366D56ED6A89ULL,
+        0xF752410D65294AD7ULL, 0x1325D8AD31652A35ULL, 0x4F08AFCD02A10A6BULL,
+        0x491244C636F3F574ULL, 0x153F33A60537D52AULL, 0xF148AA06517BB5C8ULL,
+        0xAD65DD6662BF9596ULL, 0xFD7D7C1039DE4BF6ULL, 0xA1500B700A1A6BA8ULL,
+        0x452792D05E560B4AULL, 0x190AE5B06D922B14ULL, 0x1F100EBB59C0D40BULL,
+        0x433D79DB6A04F455ULL, 0xA74AE07B3E4894B7ULL, 0xFB67971B0D8CB4E9ULL,
+        0xCDAA24499B49B30EULL, 0x91875329A88D9350ULL, 0x75F0CA89FCC1F3B2ULL,
+        0x29DDBDE9CF05D3ECULL, 0x2FC756E2FB572CF3ULL, 0x73EA2182C8930CADULL,
+        0x979DB8229CDF6C4FULL, 0xCBB0CF42AF1B4C11ULL, 0x9BA86E34F47A9271ULL,
+        0xC7851954C7BEB22FULL, 0x23F280F493F2D2CDULL, 0x7FDFF794A036F293ULL,
+        0x79C51C9F94640D8CULL, 0x25E86BFFA7A02DD2ULL, 0xC19FF25FF3EC4D30ULL,
+        0x9DB2853FC0286D6EULL, 0x61AEB0B3452FF1F0ULL, 0x3D83C7D376EBD1AEULL,
+        0xD9F45E7322A7B14CULL, 0x85D9291311639112ULL, 0x83C3C21825316E0DULL,
+        0xDFEEB57816F54E53ULL, 0x3B992CD842B92EB1ULL, 0x67B45BB8717D0EEFULL,
+        0x37ACFACE2A1CD08FULL, 0x6B818DAE19D8F0D1ULL, 0x8FF6140E4D949033ULL,
+        0xD3DB636E7E50B06DULL, 0xD5C188654A024F72ULL, 0x89ECFF0579C66F2CULL,
+        0x6D9B66A52D8A0FCEULL, 0x31B611C51E4E2F90ULL, 0x0EF7452F111650EEULL,
+        0x52DA324F22D270B0ULL, 0xB6ADABEF769E1052ULL, 0xEA80DC8F455A300CULL,
+        0xEC9A37847108CF13ULL, 0xB0B740E442CCEF4DULL, 0x54C0D94416808FAFULL,
+        0x08EDAE242544AFF1ULL, 0x58F50F527E257191ULL, 0x04D878324DE151CFULL,
+        0xE0AFE19219AD312DULL, 0xBC8296F22A691173ULL, 0xBA987DF91E3BEE6CULL,
+        0xE6B50A992DFFCE32ULL, 0x02C2933979B3AED0ULL, 0x5EEFE4594A778E8EULL,
+        0xA2F3D1D5CF701210ULL, 0xFEDEA6B5FCB4324EULL, 0x1AA93F15A8F852ACULL,
+        0x468448759B3C72F2ULL, 0x409EA37EAF6E8DEDULL, 0x1CB3D41E9CAAADB3ULL,
+        0xF8C44DBEC8E6CD51ULL, 0xA4E93ADEFB22ED0FULL, 0xF4F19BA8A043336FULL,
+        0xA8DCECC893871331ULL, 0x4CAB7568C7CB73D3ULL, 0x10860208F40F538DULL,
+        0x169CE903C05DAC92ULL, 0x4AB19E63F3998CCCULL, 0xAEC607C3A7D5EC2EULL,
+        0xF2EB70A39411CC70ULL, 0xC426C3F102D4CB97ULL, 0x980BB4913110EBC9ULL,
+        0x7C7C2D31655C8B2BULL, 0x20515A515698AB75ULL, 0x264BB15A62CA546AULL,
+        0x7A66C63A510E7434ULL, 0x9E115F9A054214D6ULL, 0xC23C28FA36863488ULL,
+        0x9224898C6DE7EAE8ULL, 0xCE09FEEC5E23CAB6ULL, 0x2A7E674C0A6FAA54ULL,
+        0x7653102C39AB8A0AULL, 0x7049FB270DF97515ULL, 0x2C648C473E3D554BULL,
+        0xC81315E76A7135A9ULL, 0x943E628759B515F7ULL, 0x6822570BDCB28969ULL,
+        0x340F206BEF76A937ULL, 0xD078B9CBBB3AC9D5ULL, 0x8C55CEAB88FEE98BULL,
+        0x8A4F25A0BCAC1694ULL, 0xD66252C08F6836CAULL, 0x3215CB60DB245628ULL,
+        0x6E38BC00E8E07676ULL, 0x3E201D76B381A816ULL, 0x620D6A1680458848ULL,
+        0x867AF3B6D409E8AAULL, 0xDA5784D6E7CDC8F4ULL, 0xDC4D6FDDD39F37EBULL,
+        0x806018BDE05B17B5ULL, 0x6417811DB4177757ULL, 0x383AF67D87D35709ULL,
+        0x098CE7B8999D7899ULL, 0x55A190D8AA5958C7ULL, 0xB1D60978FE153825ULL,
+        0xEDFB7E18CDD1187BULL, 0xEBE19513F983E764ULL, 0xB7CCE273CA47C73AULL,
+        0x53BB7BD39E0BA7D8ULL, 0x0F960CB3ADCF8786ULL, 0x5F8EADC5F6AE59E6ULL,
+        0x03A3DAA5C56A79B8ULL, 0xE7D443059126195AULL, 0xBBF93465A2E23904ULL,
+        0xBDE3DF6E96B0C61BULL, 0xE1CEA80EA574E645ULL, 0x05B931AEF13886A7ULL,
+        0x599446CEC2FCA6F9ULL, 0xA588734247FB3A67ULL, 0xF9A50422743F1A39ULL,
+        0x1DD29D8220737ADBULL, 0x41FFEAE213B75A85ULL, 0x47E501E927E5A59AULL,
+        0x1BC87689142185C4ULL, 0xFFBFEF29406DE526ULL, 0xA392984973A9C578ULL,
+        0xF38A393F28C81B18ULL, 0xAFA74E5F1B0C3B46ULL, 0x4BD0D7FF4F405BA4ULL,
+        0x17FDA09F7C847BFAULL, 0x11E74B9448D684E5ULL, 0x4DCA3CF47B12A4BBULL,
+        0xA9BDA5542F5EC459ULL, 0xF590D2341C9AE407ULL, 0xC35D61668A5FE3E0ULL,
+        0x9F701606B99BC3BEULL, 0x7B078FA6EDD7A35CULL, 0x272AF8C6DE138302ULL,
+        0x213013CDEA417C1DULL, 0x7D1D64ADD9855C43ULL, 0x996AFD0D8DC93CA1ULL,
+        0xC5478A6DBE0D1CFFULL, 0x955F2B1BE56CC29FULL, 0xC9725C7BD6A8E2C1ULL,
+        0x2D05C5DB82E48223ULL, 0x7128B2BBB120A27DULL, 0x773259B085725D62ULL,
+        0x2B1F2ED0B6B67D3CULL, 0xCF68B770E2FA1DDEULL, 0x9345C010D13E3D80ULL,
+        0x6F59F59C5439A11EULL, 0x337482FC67FD8140ULL, 0xD7031B5C33B1E1A2ULL,
+        0x8B2E6C3C0075C1FCULL, 0x8D34873734273EE3ULL, 0xD119F05707E31EBDULL,
+        0x356E69F753AF7E5FULL, 0x69431E97606B5E01ULL, 0x395BBFE13B0A8061ULL,
+        0x6576C88108CEA03FULL, 0x810151215C82C0DDULL, 0xDD2C26416F46E083ULL,
+        0xDB36CD4A5B141F9CULL, 0x871BBA2A68D03FC2ULL, 0x636C238A3C9C5F20ULL,
+        0x3F4154EA0F587F7EULL
+    },
+    {
+        0x0000000000000000ULL, 0x6184D55F721267C6ULL, 0xC309AABEE424CF8CULL,
+        0xA28D7FE19636A84AULL, 0x14CBFA566747819DULL, 0x754F2F091555E65BULL,
+        0xD7C250E883634E11ULL, 0xB64685B7F17129D7ULL, 0x2997F4ACCE8F033AULL,
+        0x481321F3BC9D64FCULL, 0xEA9E5E122AABCCB6ULL, 0x8B1A8B4D58B9AB70ULL,
+        0x3D5C0EFAA9C882A7ULL, 0x5CD8DBA5DBDAE561ULL, 0xFE55A4444DEC4D2BULL,
+        0x9FD1711B3FFE2AEDULL, 0x532FE9599D1E0674ULL, 0x32AB3C06EF0C61B2ULL,
+        0x902643E7793AC9F8ULL, 0xF1A296B80B28AE3EULL, 0x47E4130FFA5987E9ULL,
+        0x2660C650884BE02FULL, 0x84EDB9B11E7D4865ULL, 0xE5696CEE6C6F2FA3ULL,
+        0x7AB81DF55391054EULL, 0x1B3CC8AA21836288ULL, 0xB9B1B74BB7B5CAC2ULL,
+        0xD8356214C5A7AD04ULL, 0x6E73E7A334D684D3ULL, 0x0FF732FC46C4E315ULL,
+        0xAD7A4D1DD0F24B5FULL, 0xCCFE9842A2E02C99ULL, 0xA65FD2B33A3C0CE8ULL,
+        0xC7DB07EC482E6B2EULL, 0x6556780DDE18C364ULL, 0x04D2AD52AC0AA4A2ULL,
+        0xB29428E55D7B8D75ULL, 0xD310FDBA2F69EAB3ULL, 0x719D825BB95F42F9ULL,
+        0x10195704CB4D253FULL, 0x8FC8261FF4B30FD2ULL, 0xEE4CF34086A16814ULL,
+        0x4CC18CA11097C05EULL, 0x2D4559FE6285A798ULL, 0x9B03DC4993F48E4FULL,
+        0xFA870916E1E6E989ULL, 0x580A76F777D041C3ULL, 0x398EA3A805C22605ULL,
+        0xF5703BEAA7220A9CULL, 0x94F4EEB5D5306D5AULL, 0x367991544306C510ULL,
+        0x57FD440B3114A2D6ULL, 0xE1BBC1BCC0658B01ULL, 0x803F14E3B277ECC7ULL,
+        0x22B26B022441448DULL, 0x4336BE5D5653234BULL, 0xDCE7CF4669AD09A6ULL,
+        0xBD631A191BBF6E60ULL, 0x1FEE65F88D89C62AULL, 0x7E6AB0A7FF9BA1ECULL,
+        0xC82C35100EEA883BULL, 0xA9A8E04F7CF8EFFDULL, 0x0B259FAEEACE47B7ULL,
+        0x6AA14AF198DC2071ULL, 0xDE670A4DDB760755ULL, 0xBFE3DF12A9646093ULL,
+        0x1D6EA0F33F52C8D9ULL, 0x7CEA75AC4D40AF1FULL, 0xCAACF01BBC3186C8ULL,
+        0xAB282544CE23E10EULL, 0x09A55AA558154944ULL, 0x68218FFA2A072E82ULL,
+        0xF7F0FEE115F9046FULL, 0x96742BBE67EB63A9ULL, 0x34F9545FF1DDCBE3ULL,
+        0x557D810083CFAC25ULL, 0xE33B04B772BE85F2ULL, 0x82BFD1E800ACE234ULL,
+        0x2032AE09969A4A7EULL, 0x41B67B56E4882DB8ULL, 0x8D48E31446680121ULL,
+        0xECCC364B347A66E7ULL, 0x4E4149AAA24CCEADULL, 0x2FC59CF5D05EA96BULL,
+        0x99831942212F80BCULL, 0xF807CC1D533DE77AULL, 0x5A8AB3FCC50B4F30ULL,
+        0x3B0E66A3B71928F6ULL, 0xA4DF17B888E7021BULL, 0xC55BC2E7FAF565DDULL,
+        0x67D6BD066CC3CD97ULL, 0x065268591ED1AA51ULL, 0xB014EDEEEFA08386ULL,
+        0xD19038B19DB2E440ULL, 0x731D47500B844C0AULL, 0x1299920F79962BCCULL,
+        0x7838D8FEE14A0BBDULL, 0x19BC0DA193586C7BULL, 0xBB317240056EC431ULL,
+        0xDAB5A71F777CA3F7ULL, 0x6CF322A8860D8A20ULL, 0x0D77F7F7F41FEDE6ULL,
+        0xAFFA8816622945ACULL, 0xCE7E5D49103B226AULL, 0x51AF2C522FC50887ULL,
+        0x302BF90D5DD76F41ULL, 0x92A686ECCBE1C70BULL, 0xF32253B3B9F3A0CDULL,
+        0x4564D6044882891AULL, 0x24E0035B3A90EEDCULL, 0x866D7CBAACA64696ULL,
+        0xE7E9A9E5DEB42150ULL, 0x2B1731A77C540DC9ULL, 0x4A93E4F80E466A0FULL,
+        0xE81E9B199870C245ULL, 0x899A4E46EA62A583ULL, 0x3FDCCBF11B138C54ULL,
+        0x5E581EAE6901EB92ULL, 0xFCD5614FFF3743D8ULL, 0x9D51B4108D25241EULL,
+        0x0280C50BB2DB0EF3ULL, 0x63041054C0C96935ULL, 0xC1896FB556FFC17FULL,
+        0xA00DBAEA24EDA6B9ULL, 0x164B3F5DD59C8F6EULL, 0x77CFEA02A78EE8A8ULL,
+        0xD54295E331B840E2ULL, 0xB4C640BC43AA2724ULL, 0x2E16BBB019E2102FULL,
+        0x4F926EEF6BF077E9ULL, 0xED1F110EFDC6DFA3ULL, 0x8C9BC4518FD4B865ULL,
+        0x3ADD41E67EA591B2ULL, 0x5B5994B90CB7F674ULL, 0xF9D4EB589A815E3EULL,
+        0x98503E07E89339F8ULL, 0x07814F1CD76D1315ULL, 0x66059A43A57F74D3ULL,
+        0xC488E5A23349DC99ULL, 0xA50C30FD415BBB5FULL, 0x134AB54AB02A9288ULL,
+        0x72CE6015C238F54EULL, 0xD0431FF4540E5D04ULL, 0xB1C7CAAB261C3AC2ULL,
+        0x7D3952E984FC165BULL, 0x1CBD87B6F6EE719DULL, 0xBE30F85760D8D9D7ULL,
+        0xDFB42D0812CABE11ULL, 0x69F2A8BFE3BB97C6ULL, 0x08767DE091A9F000ULL,
+        0xAAFB0201079F584AULL, 0xCB7FD75E758D3F8CULL, 0x54AEA6454A731561ULL,
+        0x352A731A386172A7ULL, 0x97A70CFBAE57DAEDULL, 0xF623D9A4DC45BD2BULL,
+        0x40655C132D3494FCULL, 0x21E1894C5F26F33AULL, 0x836CF6ADC9105B70ULL,
+        0xE2E823F2BB023CB6ULL, 0x8849690323DE1CC7ULL, 0xE9CDBC5C51CC7B01ULL,
+        0x4B40C3BDC7FAD34BULL, 0x2AC416E2B5E8B48DULL, 0x9C82935544999D5AULL,
+        0xFD06460A368BFA9CULL, 0x5F8B39EBA0BD52D6ULL, 0x3E0FECB4D2AF3510ULL,
+        0xA1DE9DAFED511FFDULL, 0xC05A48F09F43783BULL, 0x62D737110975D071ULL,
+        0x0353E24E7B67B7B7ULL, 0xB51567F98A169E60ULL, 0xD491B2A6F804F9A6ULL,
+        0x761CCD476E3251ECULL, 0x179818181C20362AULL, 0xDB66805ABEC01AB3ULL,
+        0xBAE25505CCD27D75ULL, 0x186F2AE45AE4D53FULL, 0x79EBFFBB28F6B2F9ULL,
+        0xCFAD7A0CD9879B2EULL, 0xAE29AF53AB95FCE8ULL, 0x0CA4D0B23DA354A2ULL,
+        0x6D2005ED4FB13364ULL, 0xF2F174F6704F1989ULL, 0x9375A1A9025D7E4FULL,
+        0x31F8DE48946BD605ULL, 0x507C0B17E679B1C3ULL, 0xE63A8EA017089814ULL,
+        0x87BE5BFF651AFFD2ULL, 0x2533241EF32C5798ULL, 0x44B7F141813E305EULL,
+        0xF071B1FDC294177AULL, 0x91F564A2B08670BCULL, 0x33781B4326B0D8F6ULL,
+        0x52FCCE1C54A2BF30ULL, 0xE4BA4BABA5D396E7ULL, 0x853E9EF4D7C1F121ULL,
+        0x27B3E11541F7596BULL, 0x4637344A33E53EADULL, 0xD9E645510C1B1440ULL,
+        0xB862900E7E097386ULL, 0x1AEFEFEFE83FDBCCULL, 0x7B6B3AB09A2DBC0AULL,
+        0xCD2DBF076B5C95DDULL, 0xACA96A58194EF21BULL, 0x0E2415B98F785A51ULL,
+        0x6FA0C0E6FD6A3D97ULL, 0xA35E58A45F8A110EULL, 0xC2DA8DFB2D9876C8ULL,
+        0x6057F21ABBAEDE82ULL, 0x01D32745C9BCB944ULL, 0xB795A2F238CD9093ULL,
+        0xD61177AD4ADFF755ULL, 0x749C084CDCE95F1FULL, 0x1518DD13AEFB38D9ULL,
+        0x8AC9AC0891051234ULL, 0xEB4D7957E31775F2ULL, 0x49C006B67521DDB8ULL,
+        0x2844D3E90733BA7EULL, 0x9E02565EF64293A9ULL, 0xFF8683018450F46FULL,
+        0x5D0BFCE012665C25ULL, 0x3C8F29BF60743BE3ULL, 0x562E634EF8A81B92ULL,
+        0x37AAB6118ABA7C54ULL, 0x9527C9F01C8CD41EULL, 0xF4A31CAF6E9EB3D8ULL,
+        0x42E599189FEF9A0FULL, 0x23614C47EDFDFDC9ULL, 0x81EC33A67BCB5583ULL,
+        0xE068E6F909D93245ULL, 0x7FB997E2362718A8ULL, 0x1E3D42BD44357F6EULL,
+        0xBCB03D5CD203D724ULL, 0xDD34E803A011B0E2ULL, 0x6B726DB451609935ULL,
+        0x0AF6B8EB2372FEF3ULL, 0xA87BC70AB54456B9ULL, 0xC9FF1255C756317FULL,
+        0x05018A1765B61DE6ULL, 0x64855F4817A47A20ULL, 0xC60820A98192D26AULL,
+        0xA78CF5F6F380B5ACULL, 0x11CA704102F19C7BULL, 0x704EA51E70E3FBBDULL,
+        0xD2C3DAFFE6D553F7ULL, 0xB3470FA094C73431ULL, 0x2C967EBBAB391EDCULL,
+        0x4D12ABE4D92B791AULL, 0xEF9FD4054F1DD150ULL, 0x8E1B015A3D0FB696ULL,
+        0x385D84EDCC7E9F41ULL, 0x59D951B2BE6CF887ULL, 0xFB542E53285A50CDULL,
+        0x9AD0FB0C5A48370BULL
+    },
+    {
+        0x0000000000000000ULL, 0x22EF0D5934F964ECULL, 0x45DE1AB269F2C9D8ULL,
+        0x673117EB5D0BAD34ULL, 0x8BBC3564D3E593B0ULL, 0xA953383DE71CF75CULL,
+        0xCE622FD6BA175A68ULL, 0xEC8D228F8EEE3E84ULL, 0x85A0C5E208C539E5ULL,
+        0xA74FC8BB3C3C5D09ULL, 0xC07EDF506137F03DULL, 0xE291D20955CE94D1ULL,
+        0x0E1CF086DB20AA55ULL, 0x2CF3FDDFEFD9CEB9ULL, 0x4BC2EA34B2D2638DULL,
+        0x692DE76D862B0761ULL, 0x999924EFBE846D4FULL, 0xBB7629B68A7D09A3ULL,
+        0xDC473E5DD776A497ULL, 0xFEA83304E38FC07BULL, 0x1225118B6D61FEFFULL,
+        0x30CA1CD259989A13ULL, 0x57FB0B3904933727ULL, 0x75140660306A53CBULL,
+        0x1C39E10DB64154AAULL, 0x3ED6EC5482B83046ULL, 0x59E7FBBFDFB39D72ULL,
+        0x7B08F6E6EB4AF99EULL, 0x9785D46965A4C71AULL, 0xB56AD930515DA3F6ULL,
+        0xD25BCEDB0C560EC2ULL, 0xF0B4C38238AF6A2EULL, 0xA1EAE6F4D206C41BULL,
+        0x8305EBADE6FFA0F7ULL, 0xE434FC46BBF40DC3ULL, 0xC6DBF11F8F0D692FULL,
+        0x2A56D39001E357ABULL, 0x08B9DEC9351A3347ULL, 0x6F88C92268119E73ULL,
+        0x4D67C47B5CE8FA9FULL, 0x244A2316DAC3FDFEULL, 0x06A52E4FEE3A9912ULL,
+        0x619439A4B3313426ULL, 0x437B34FD87C850CAULL, 0xAFF6167209266E4EULL,
+        0x8D191B2B3DDF0AA2ULL, 0xEA280CC060D4A796ULL, 0xC8C70199542DC37AULL,
+        0x3873C21B6C82A954ULL, 0x1A9CCF42587BCDB8ULL, 0x7DADD8A90570608CULL,
+        0x5F42D5F031890460ULL, 0xB3CFF77FBF673AE4ULL, 0x9120FA268B9E5E08ULL,
+        0xF611EDCDD695F33CULL, 0xD4FEE094E26C97D0ULL, 0xBDD307F9644790B1ULL,
+        0x9F3C0AA050BEF45DULL, 0xF80D1D4B0DB55969ULL, 0xDAE21012394C3D85ULL,
+        0x366F329DB7A20301ULL, 0x14803FC4835B67EDULL, 0x73B1282FDE50CAD9ULL,
+        0x515E2576EAA9AE35ULL, 0xD10D62C20B0396B3ULL, 0xF3E26F9B3FFAF25FULL,
+        0x94D3787062F15F6BULL, 0xB63C752956083B87ULL, 0x5AB157A6D8E60503ULL,
+        0x785E5AFFEC1F61EFULL, 0x1F6F4D14B114CCDBULL, 0x3D80404D85EDA837ULL,
+        0x54ADA72003C6AF56ULL, 0x7642AA79373FCBBAULL, 0x1173BD926A34668EULL,
+        0x339CB0CB5ECD0262ULL, 0xDF119244D0233CE6ULL, 0xFDFE9F1DE4DA580AULL,
+        0x9ACF88F6B9D1F53EULL, 0xB82085AF8D2891D2ULL, 0x4894462DB587FBFCULL,
+        0x6A7B4B74817E9F10ULL, 0x0D4A5C9FDC753224ULL, 0x2FA551C6E88C56C8ULL,
+        0xC32873496662684CULL, 0xE1C77E10529B0CA0ULL, 0x86F669FB0F90A194ULL,
+        0xA41964A23B69C578ULL, 0xCD3483CFBD42C219ULL, 0xEFDB8E9689BBA6F5ULL,
+        0x88EA997DD4B00BC1ULL, 0xAA059424E0496F2DULL, 0x4688B6AB6EA751A9ULL,
+        0x6467BBF25A5E3545ULL, 0x0356AC1907559871ULL, 0x21B9A14033ACFC9DULL,
+        0x70E78436D90552A8ULL, 0x5208896FEDFC3644ULL, 0x35399E84B0F79B70ULL,
+        0x17D693DD840EFF9CULL, 0xFB5BB1520AE0C118ULL, 0xD9B4BC0B3E19A5F4ULL,
+        0xBE85ABE0631208C0ULL, 0x9C6AA6B957EB6C2CULL, 0xF54741D4D1C06B4DULL,
+        0xD7A84C8DE5390FA1ULL, 0xB0995B66B832A295ULL, 0x9276563F8CCBC679ULL,
+        0x7EFB74B00225F8FDULL, 0x5C1479E936DC9C11ULL, 0x3B256E026BD73125ULL,
+        0x19CA635B5F2E55C9ULL, 0xE97EA0D967813FE7ULL, 0xCB91AD8053785B0BULL,
+        0xACA0BA6B0E73F63FULL, 0x8E4FB7323A8A92D3ULL, 0x62C295BDB464AC57ULL,
+        0x402D98E4809DC8BBULL, 0x271C8F0FDD96658FULL, 0x05F38256E96F0163ULL,
+        0x6CDE653B6F440602ULL, 0x4E3168625BBD62EEULL, 0x29007F8906B6CFDAULL,
+        0x0BEF72D0324FAB36ULL, 0xE762505FBCA195B2ULL, 0xC58D5D068858F15EULL,
+        0xA2BC4AEDD5535C6AULL, 0x805347B4E1AA3886ULL, 0x30C26AAFB90933E3ULL,
+        0x122D67F68DF0570FULL, 0x751C701DD0FBFA3BULL, 0x57F37D44E4029ED7ULL,
+        0xBB7E5FCB6AECA053ULL, 0x999152925E15C4BFULL, 0xFEA04579031E698BULL,
+        0xDC4F482037E70D67ULL, 0xB562AF4DB1CC0A06ULL, 0x978DA21485356EEAULL,
+        0xF0BCB5FFD83EC3DEULL, 0xD253B8A6ECC7A732ULL, 0x3EDE9A29622999B6ULL,
+        0x1C31977056D0FD5AULL, 0x7B00809B0BDB506EULL, 0x59EF8DC23F223482ULL,
+        0xA95B4E40078D5EACULL, 0x8BB4431933743A40ULL, 0xEC8554F26E7F9774ULL,
+        0xCE6A59AB5A86F398ULL, 0x22E77B24D468CD1CULL, 0x0008767DE091A9F0ULL,
+        0x67396196BD9A04C4ULL, 0x45D66CCF89636028ULL, 0x2CFB8BA20F486749ULL,
+        0x0E1486FB3BB103A5ULL, 0x6925911066BAAE91ULL, 0x4BCA9C495243CA7DULL,
+        0xA747BEC6DCADF4F9ULL, 0x85A8B39FE8549015ULL, 0xE299A474B55F3D21ULL,
+        0xC076A92D81A659CDULL, 0x91288C5B6B0FF7F8ULL, 0xB3C781025FF69314ULL,
+        0xD4F696E902FD3E20ULL, 0xF6199BB036045ACCULL, 0x1A94B93FB8EA6448ULL,
+        0x387BB4668C1300A4ULL, 0x5F4AA38DD118AD90ULL, 0x7DA5AED4E5E1C97CULL,
+        0x148849B963CACE1DULL, 0x366744E05733AAF1ULL, 0x5156530B0A3807C5ULL,
+        0x73B95E523EC16329ULL, 0x9F347CDDB02F5DADULL, 0xBDDB718484D63941ULL,
+        0xDAEA666FD9DD9475ULL, 0xF8056B36ED24F099ULL, 0x08B1A8B4D58B9AB7ULL,
+        0x2A5EA5EDE172FE5BULL, 0x4D6FB206BC79536FULL, 0x6F80BF5F88803783ULL,
+        0x830D9DD0066E0907ULL, 0xA1E2908932976DEBULL, 0xC6D387626F9CC0DFULL,
+        0xE43C8A3B5B65A433ULL, 0x8D116D56DD4EA352ULL, 0xAFFE600FE9B7C7BEULL,
+        0xC8CF77E4B4BC6A8AULL, 0xEA207ABD80450E66ULL, 0x06AD58320EAB30E2ULL,
+        0x2442556B3A52540EULL, 0x437342806759F93AULL, 0x619C4FD953A09DD6ULL,
+        0xE1CF086DB20AA550ULL, 0xC320053486F3C1BCULL, 0xA41112DFDBF86C88ULL,
+        0x86FE1F86EF010864ULL, 0x6A733D0961EF36E0ULL, 0x489C30505516520CULL,
+        0x2FAD27BB081DFF38ULL, 0x0D422AE23CE49BD4ULL, 0x646FCD8FBACF9CB5ULL,
+        0x4680C0D68E36F859ULL, 0x21B1D73DD33D556DULL, 0x035EDA64E7C43181ULL,
+        0xEFD3F8EB692A0F05ULL, 0xCD3CF5B25DD36BE9ULL, 0xAA0DE25900D8C6DDULL,
+        0x88E2EF003421A231ULL, 0x78562C820C8EC81FULL, 0x5AB921DB3877ACF3ULL,
+        0x3D883630657C01C7ULL, 0x1F673B695185652BULL, 0xF3EA19E6DF6B5BAFULL,
+        0xD10514BFEB923F43ULL, 0xB6340354B6999277ULL, 0x94DB0E0D8260F69BULL,
+        0xFDF6E960044BF1FAULL, 0xDF19E43930B29516ULL, 0xB828F3D26DB93822ULL,
+        0x9AC7FE8B59405CCEULL, 0x764ADC04D7AE624AULL, 0x54A5D15DE35706A6ULL,
+        0x3394C6B6BE5CAB92ULL, 0x117BCBEF8AA5CF7EULL, 0x4025EE99600C614BULL,
+        0x62CAE3C054F505A7ULL, 0x05FBF42B09FEA893ULL, 0x2714F9723D07CC7FULL,
+        0xCB99DBFDB3E9F2FBULL, 0xE976D6A487109617ULL, 0x8E47C14FDA1B3B23ULL,
+        0xACA8CC16EEE25FCFULL, 0xC5852B7B68C958AEULL, 0xE76A26225C303C42ULL,
+        0x805B31C9013B9176ULL, 0xA2B43C9035C2F59AULL, 0x4E391E1FBB2CCB1EULL,
+        0x6CD613468FD5AFF2ULL, 0x0BE704ADD2DE02C6ULL, 0x290809F4E627662AULL,
+        0xD9BCCA76DE880C04ULL, 0xFB53C72FEA7168E8ULL, 0x9C62D0C4B77AC5DCULL,
+        0xBE8DDD9D8383A130ULL, 0x5200FF120D6D9FB4ULL, 0x70EFF24B3994FB58ULL,
+        0x17DEE5A0649F566CULL, 0x3531E8F950663280ULL, 0x5C1C0F94D64D35E1ULL,
+        0x7EF302CDE2B4510DULL, 0x19C21526BFBFFC39ULL, 0x3B2D187F8B4698D5ULL,
+        0xD7A03AF005A8A651ULL, 0xF54F37A93151C2BDULL, 0x927E20426C5A6F89ULL,
+        0xB0912D1B58A30B65ULL
+    },
+    {
+        0x0000000000000000ULL, 0xDABE95AFC7875F40ULL, 0x27A584742000A005ULL,
+        0xFD1B11DBE787FF45ULL, 0x4F4B08E84001400AULL, 0x95F59D4787861F4AULL,
+        0x68EE8C9C6001E00FULL, 0xB2501933A786BF4FULL, 0x9E9611D080028014ULL,
+        0x4428847F4785DF54ULL, 0xB93395A4A0022011ULL, 0x638D000B67857F51ULL,
+        0xD1DD1938C003C01EULL, 0x0B638C9707849F5EULL, 0xF6789D4CE003601BULL,
+        0x2CC608E327843F5BULL, 0xAFF48C8AAF0B1EADULL, 0x754A1925688C41EDULL,
+        0x885108FE8F0BBEA8ULL, 0x52EF9D51488CE1E8ULL, 0xE0BF8462EF0A5EA7ULL,
+        0x3A0111CD288D01E7ULL, 0xC71A0016CF0AFEA2ULL, 0x1DA495B9088DA1E2ULL,
+        0x31629D5A2F099EB9ULL, 0xEBDC08F5E88EC1F9ULL, 0x16C7192E0F093EBCULL,
+        0xCC798C81C88E61FCULL, 0x7E2995B26F08DEB3ULL, 0xA497001DA88F81F3ULL,
+        0x598C11C64F087EB6ULL, 0x83328469888F21F6ULL, 0xCD31B63EF11823DFULL,
+        0x178F2391369F7C9FULL, 0xEA94324AD11883DAULL, 0x302AA7E5169FDC9AULL,
+        0x827ABED6B11963D5ULL, 0x58C42B79769E3C95ULL, 0xA5DF3AA29119C3D0ULL,
+        0x7F61AF0D569E9C90ULL, 0x53A7A7EE711AA3CBULL, 0x89193241B69DFC8BULL,
+        0x7402239A511A03CEULL, 0xAEBCB635969D5C8EULL, 0x1CECAF06311BE3C1ULL,
+        0xC6523AA9F69CBC81ULL, 0x3B492B72111B43C4ULL, 0xE1F7BEDDD69C1C84ULL,
+        0x62C53AB45E133D72ULL, 0xB87BAF1B99946232ULL, 0x4560BEC07E139D77ULL,
+        0x9FDE2B6FB994C237ULL, 0x2D8E325C1E127D78ULL, 0xF730A7F3D9952238ULL,
+        0x0A2BB6283E12DD7DULL, 0xD0952387F995823DULL, 0xFC532B64DE11BD66ULL,
+        0x26EDBECB1996E226ULL, 0xDBF6AF10FE111D63ULL, 0x01483ABF39964223ULL,
+        0xB318238C9E10FD6CULL, 0x69A6B6235997A22CULL, 0x94BDA7F8BE105D69ULL,
+        0x4E03325779970229ULL, 0x08BBC3564D3E593BULL, 0xD20556F98AB9067BULL,
+        0x2F1E47226D3EF93EULL, 0xF5A0D28DAAB9A67EULL, 0x47F0CBBE0D3F1931ULL,
+        0x9D4E5E11CAB84671ULL, 0x60554FCA2D3FB934ULL, 0xBAEBDA65EAB8E674ULL,
+        0x962DD286CD3CD92FULL, 0x4C9347290ABB866FULL, 0xB18856F2ED3C792AULL,
+        0x6B36C35D2ABB266AULL, 0xD966DA6E8D3D9925ULL, 0x03D84FC14ABAC665ULL,
+        0xFEC35E1AAD3D3920ULL, 0x247DCBB56ABA6660ULL, 0xA74F4FDCE2354796ULL,
+        0x7DF1DA7325B218D6ULL, 0x80EACBA8C235E793ULL, 0x5A545E0705B2B8D3ULL,
+        0xE8044734A234079CULL, 0x32BAD29B65B358DCULL, 0xCFA1C3408234A799ULL,
+        0x151F56EF45B3F8D9ULL, 0x39D95E0C6237C782ULL, 0xE367CBA3A5B098C2ULL,
+        0x1E7CDA7842376787ULL, 0xC4C24FD785B038C7ULL, 0x769256E422368788ULL,
+        0xAC2CC34BE5B1D8C8ULL, 0x5137D2900236278DULL, 0x8B89473FC5B178CDULL,
+        0xC58A7568BC267AE4ULL, 0x1F34E0C77BA125A4ULL, 0xE22FF11C9C26DAE1ULL,
+        0x389164B35BA185A1ULL, 0x8AC17D80FC273AEEULL, 0x507FE82F3BA065AEULL,
+        0xAD64F9F4DC279AEBULL, 0x77DA6C5B1BA0C5ABULL, 0x5B1C64B83C24FAF0ULL,
+        0x81A2F117FBA3A5B0ULL, 0x7CB9E0CC1C245AF5ULL, 0xA6077563DBA305B5ULL,
+        0x14576C507C25BAFAULL, 0xCEE9F9FFBBA2E5BAULL, 0x33F2E8245C251AFFULL,
+        0xE94C7D8B9BA245BFULL, 0x6A7EF9E2132D6449ULL, 0xB0C06C4DD4AA3B09ULL,
+        0x4DDB7D96332DC44CULL, 0x9765E839F4AA9B0CULL, 0x2535F10A532C2443ULL,
+        0xFF8B64A594AB7B03ULL, 0x0290757E732C8446ULL, 0xD82EE0D1B4ABDB06ULL,
+        0xF4E8E832932FE45DULL, 0x2E567D9D54A8BB1DULL, 0xD34D6C46B32F4458ULL,
+        0x09F3F9E974A81B18ULL, 0xBBA3E0DAD32EA457ULL, 0x611D757514A9FB17ULL,
+        0x9C0664AEF32E0452ULL, 0x46B8F10134A95B12ULL, 0x117786AC9A7CB276ULL,
+        0xCBC913035DFBED36ULL, 0x36D202D8BA7C1273ULL, 0xEC6C97777DFB4D33ULL,
+        0x5E3C8E44DA7DF27CULL, 0x84821BEB1DFAAD3CULL, 0x79990A30FA7D5279ULL,
+        0xA3279F9F3DFA0D39ULL, 0x8FE1977C1A7E3262ULL, 0x555F02D3DDF96D22ULL,
+        0xA84413083A7E9267ULL, 0x72FA86A7FDF9CD27ULL, 0xC0AA9F945A7F7268ULL,
+        0x1A140A3B9DF82D28ULL, 0xE70F1BE07A7FD26DULL, 0x3DB18E4FBDF88D2DULL,
+        0xBE830A263577ACDBULL, 0x643D9F89F2F0F39BULL, 0x99268E5215770CDEULL,
+        0x43981BFDD2F0539EULL, 0xF1C802CE7576ECD1ULL, 0x2B769761B2F1B391ULL,
+        0xD66D86BA55764CD4ULL, 0x0CD3131592F11394ULL, 0x20151BF6B5752CCFULL,
+        0xFAAB8E5972F2738FULL, 0x07B09F8295758CCAULL, 0xDD0E0A2D52F2D38AULL,
+        0x6F5E131EF5746CC5ULL, 0xB5E086B132F33385ULL, 0x48FB976AD574CCC0ULL,
+        0x924502C512F39380ULL, 0xDC4630926B6491A9ULL, 0x06F8A53DACE3CEE9ULL,
+        0xFBE3B4E64B6431ACULL, 0x215D21498CE36EECULL, 0x930D387A2B65D1A3ULL,
+        0x49B3ADD5ECE28EE3ULL, 0xB4A8BC0E0B6571A6ULL, 0x6E1629A1CCE22EE6ULL,
+        0x42D02142EB6611BDULL, 0x986EB4ED2CE14EFDULL, 0x6575A536CB66B1B8ULL,
+        0xBFCB30990CE1EEF8ULL, 0x0D9B29AAAB6751B7ULL, 0xD725BC056CE00EF7ULL,
+        0x2A3EADDE8B67F1B2ULL, 0xF08038714CE0AEF2ULL, 0x73B2BC18C46F8F04ULL,
+        0xA90C29B703E8D044ULL, 0x5417386CE46F2F01ULL, 0x8EA9ADC323E87041ULL,
+        0x3CF9B4F0846ECF0EULL, 0xE647215F43E9904EULL, 0x1B5C3084A46E6F0BULL,
+        0xC1E2A52B63E9304BULL, 0xED24ADC8446D0F10ULL, 0x379A386783EA5050ULL,
+        0xCA8129BC646DAF15ULL, 0x103FBC13A3EAF055ULL, 0xA26FA520046C4F1AULL,
+        0x78D1308FC3EB105AULL, 0x85CA2154246CEF1FULL, 0x5F74B4FBE3EBB05FULL,
+        0x19CC45FAD742EB4DULL, 0xC372D05510C5B40DULL, 0x3E69C18EF7424B48ULL,
+        0xE4D7542130C51408ULL, 0x56874D129743AB47ULL, 0x8C39D8BD50C4F407ULL,
+        0x7122C966B7430B42ULL, 0xAB9C5CC970C45402ULL, 0x875A542A57406B59ULL,
+        0x5DE4C18590C73419ULL, 0xA0FFD05E7740CB5CULL, 0x7A4145F1B0C7941CULL,
+        0xC8115CC217412B53ULL, 0x12AFC96DD0C67413ULL, 0xEFB4D8B637418B56ULL,
+        0x350A4D19F0C6D416ULL, 0xB638C9707849F5E0ULL, 0x6C865CDFBFCEAAA0ULL,
+        0x919D4D04584955E5ULL, 0x4B23D8AB9FCE0AA5ULL, 0xF973C1983848B5EAULL,
+        0x23CD5437FFCFEAAAULL, 0xDED645EC184815EFULL, 0x0468D043DFCF4AAFULL,
+        0x28AED8A0F84B75F4ULL, 0xF2104D0F3FCC2AB4ULL, 0x0F0B5CD4D84BD5F1ULL,
+        0xD5B5C97B1FCC8AB1ULL, 0x67E5D048B84A35FEULL, 0xBD5B45E77FCD6ABEULL,
+        0x4040543C984A95FBULL, 0x9AFEC1935FCDCABBULL, 0xD4FDF3C4265AC892ULL,
+        0x0E43666BE1DD97D2ULL, 0xF35877B0065A6897ULL, 0x29E6E21FC1DD37D7ULL,
+        0x9BB6FB2C665B8898ULL, 0x41086E83A1DCD7D8ULL, 0xBC137F58465B289DULL,
+        0x66ADEAF781DC77DDULL, 0x4A6BE214A6584886ULL, 0x90D577BB61DF17C6ULL,
+        0x6DCE66608658E883ULL, 0xB770F3CF41DFB7C3ULL, 0x0520EAFCE659088CULL,
+        0xDF9E7F5321DE57CCULL, 0x22856E88C659A889ULL, 0xF83BFB2701DEF7C9ULL,
+        0x7B097F4E8951D63FULL, 0xA1B7EAE14ED6897FULL, 0x5CACFB3AA951763AULL,
+        0x86126E956ED6297AULL, 0x344277A6C9509635ULL, 0xEEFCE2090ED7C975ULL,
+        0x13E7F3D2E9503630ULL, 0xC959667D2ED76970ULL, 0xE59F6E9E0953562BULL,
+        0x3F21FB31CED4096BULL, 0xC23AEAEA2953F62EULL, 0x18847F45EED4A96EULL,
+        0xAAD4667649521621ULL, 0x706AF3D98ED54961ULL, 0x8D71E2026952B624ULL,
+        0x57CF77ADAED5E964ULL
+    },
+    {
+        0x0000000000000000ULL, 0x646C955F440400FEULL, 0xC8D92ABE880801FCULL,
+        0xACB5BFE1CC0C0102ULL, 0x036AFA56BF1E1D7DULL, 0x67066F09FB1A1D83ULL,
+        0xCBB3D0E837161C81ULL, 0xAFDF45B773121C7FULL, 0x06D5F4AD7E3C3AFAULL,
+        0x62B961F23A383A04ULL, 0xCE0CDE13F6343B06ULL, 0xAA604B4CB2303BF8ULL,
+        0x05BF0EFBC1222787ULL, 0x61D39BA485262779ULL, 0xCD662445492A267BULL,
+        0xA90AB11A0D2E2685ULL, 0x0DABE95AFC7875F4ULL, 0x69C77C05B87C750AULL,
+        0xC572C3E474707408ULL, 0xA11E56BB307474F6ULL, 0x0EC1130C43666889ULL,
+        0x6AAD865307626877ULL, 0xC61839B2CB6E6975ULL, 0xA274ACED8F6A698BULL,
+        0x0B7E1DF782444F0EULL, 0x6F1288A8C6404FF0ULL, 0xC3A737490A4C4EF2ULL,
+        0xA7CBA2164E484E0CULL, 0x0814E7A13D5A5273ULL, 0x6C7872FE795E528DULL,
+        0xC0CDCD1FB552538FULL, 0xA4A15840F1565371ULL, 0x1B57D2B5F8F0EBE8ULL,
+        0x7F3B47EABCF4EB16ULL, 0xD38EF80B70F8EA14ULL, 0xB7E26D5434FCEAEAULL,
+        0x183D28E347EEF695ULL, 0x7C51BDBC03EAF66BULL, 0xD0E4025DCFE6F769ULL,
+        0xB48897028BE2F797ULL, 0x1D82261886CCD112ULL, 0x79EEB347C2C8D1ECULL,
+        0xD55B0CA60EC4D0EEULL, 0xB13799F94AC0D010ULL, 0x1EE8DC4E39D2CC6FULL,
+        0x7A8449117DD6CC91ULL, 0xD631F6F0B1DACD93ULL, 0xB25D63AFF5DECD6DULL,
+        0x16FC3BEF04889E1CULL, 0x7290AEB0408C9EE2ULL, 0xDE2511518C809FE0ULL,
+        0xBA49840EC8849F1EULL, 0x1596C1B9BB968361ULL, 0x71FA54E6FF92839FULL,
+        0xDD4FEB07339E829DULL, 0xB9237E58779A8263ULL, 0x1029CF427AB4A4E6ULL,
+        0x74455A1D3EB0A418ULL, 0xD8F0E5FCF2BCA51AULL, 0xBC9C70A3B6B8A5E4ULL,
+        0x13433514C5AAB99BULL, 0x772FA04B81AEB965ULL, 0xDB9A1FAA4DA2B867ULL,
+        0xBFF68AF509A6B899ULL, 0x36AFA56BF1E1D7D0ULL, 0x52C33034B5E5D72EULL,
+        0xFE768FD579E9D62CULL, 0x9A1A1A8A3DEDD6D2ULL, 0x35C55F3D4EFFCAADULL,
+        0x51A9CA620AFBCA53ULL, 0xFD1C7583C6F7CB51ULL, 0x9970E0DC82F3CBAFULL,
+        0x307A51C68FDDED2AULL, 0x5416C499CBD9EDD4ULL, 0xF8A37B7807D5ECD6ULL,
+        0x9CCFEE2743D1EC28ULL, 0x3310AB9030C3F057ULL, 0x577C3ECF74C7F0A9ULL,
+        0xFBC9812EB8CBF1ABULL, 0x9FA51471FCCFF155ULL, 0x3B044C310D99A224ULL,
+        0x5F68D96E499DA2DAULL, 0xF3DD668F8591A3D8ULL, 0x97B1F3D0C195A326ULL,
+        0x386EB667B287BF59ULL, 0x5C022338F683BFA7ULL, 0xF0B79CD93A8FBEA5ULL,
+        0x94DB09867E8BBE5BULL, 0x3DD1B89C73A598DEULL, 0x59BD2DC337A19820ULL,
+        0xF5089222FBAD9922ULL, 0x9164077DBFA999DCULL, 0x3EBB42CACCBB85A3ULL,
+        0x5AD7D79588BF855DULL, 0xF662687444B3845FULL, 0x920EFD2B00B784A1ULL,
+        0x2DF877DE09113C38ULL, 0x4994E2814D153CC6ULL, 0xE5215D6081193DC4ULL,
+        0x814DC83FC51D3D3AULL, 0x2E928D88B60F2145ULL, 0x4AFE18D7F20B21BBULL,
+        0xE64BA7363E0720B9ULL, 0x822732697A032047ULL, 0x2B2D8373772D06C2ULL,
+        0x4F41162C3329063CULL, 0xE3F4A9CDFF25073EULL, 0x87983C92BB2107C0ULL,
+        0x28477925C8331BBFULL, 0x4C2BEC7A8C371B41ULL, 0xE09E539B403B1A43ULL,
+        0x84F2C6C4043F1ABDULL, 0x20539E84F56949CCULL, 0x443F0BDBB16D4932ULL,
+        0xE88AB43A7D614830ULL, 0x8CE62165396548CEULL, 0x233964D24A7754B1ULL,
+        0x4755F18D0E73544FULL, 0xEBE04E6CC27F554DULL, 0x8F8CDB33867B55B3ULL,
+        0x26866A298B557336ULL, 0x42EAFF76CF5173C8ULL, 0xEE5F4097035D72CAULL,
+        0x8A33D5C847597234ULL, 0x25EC907F344B6E4BULL, 0x41800520704F6EB5ULL,
+        0xED35BAC1BC436FB7ULL, 0x89592F9EF8476F49ULL, 0x6D5F4AD7E3C3AFA0ULL,
+        0x0933DF88A7C7AF5EULL, 0xA58660696BCBAE5CULL, 0xC1EAF5362FCFAEA2ULL,
+        0x6E35B0815CDDB2DDULL, 0x0A5925DE18D9B223ULL, 0xA6EC9A3FD4D5B321ULL,
+        0xC2800F6090D1B3DFULL, 0x6B8ABE7A9DFF955AULL, 0x0FE62B25D9FB95A4ULL,
+        0xA35394C415F794A6ULL, 0xC73F019B51F39458ULL, 0x68E0442C22E18827ULL,
+        0x0C8CD17366E588D9ULL, 0xA0396E92AAE989DBULL, 0xC455FBCDEEED8925ULL,
+        0x60F4A38D1FBBDA54ULL, 0x049836D25BBFDAAAULL, 0xA82D893397B3DBA8ULL,
+        0xCC411C6CD3B7DB56ULL, 0x639E59DBA0A5C729ULL, 0x07F2CC84E4A1C7D7ULL,
+        0xAB47736528ADC6D5ULL, 0xCF2BE63A6CA9C62BULL, 0x662157206187E0AEULL,
+        0x024DC27F2583E050ULL, 0xAEF87D9EE98FE152ULL, 0xCA94E8C1AD8BE1ACULL,
+        0x654BAD76DE99FDD3ULL, 0x012738299A9DFD2DULL, 0xAD9287C85691FC2FULL,
+        0xC9FE12971295FCD1ULL, 0x760898621B334448ULL, 0x12640D3D5F3744B6ULL,
+        0xBED1B2DC933B45B4ULL, 0xDABD2783D73F454AULL, 0x75626234A42D5935ULL,
+        0x110EF76BE02959CBULL, 0xBDBB488A2C2558C9ULL, 0xD9D7DDD568215837ULL,
+        0x70DD6CCF650F7EB2ULL, 0x14B1F990210B7E4CULL, 0xB8044671ED077F4EULL,
+        0xDC68D32EA9037FB0ULL, 0x73B79699DA1163CFULL, 0x17DB03C69E156331ULL,
+        0xBB6EBC2752196233ULL, 0xDF022978161D62CDULL, 0x7BA37138E74B31BCULL,
+        0x1FCFE467A34F3142ULL, 0xB37A5B866F433040ULL, 0xD716CED92B4730BEULL,
+        0x78C98B6E58552CC1ULL, 0x1CA51E311C512C3FULL, 0xB010A1D0D05D2D3DULL,
+        0xD47C348F94592DC3ULL, 0x7D76859599770B46ULL, 0x191A10CADD730BB8ULL,
+        0xB5AFAF2B117F0ABAULL, 0xD1C33A74557B0A44ULL, 0x7E1C7FC32669163BULL,
+        0x1A70EA9C626D16C5ULL, 0xB6C5557DAE6117C7ULL, 0xD2A9C022EA651739ULL,
+        0x5BF0EFBC12227870ULL, 0x3F9C7AE35626788EULL, 0x9329C5029A2A798CULL,
+        0xF745505DDE2E7972ULL, 0x589A15EAAD3C650DULL, 0x3CF680B5E93865F3ULL,
+        0x90433F54253464F1ULL, 0xF42FAA0B6130640FULL, 0x5D251B116C1E428AULL,
+        0x39498E4E281A4274ULL, 0x95FC31AFE4164376ULL, 0xF190A4F0A0124388ULL,
+        0x5E4FE147D3005FF7ULL, 0x3A23741897045F09ULL, 0x9696CBF95B085E0BULL,
+        0xF2FA5EA61F0C5EF5ULL, 0x565B06E6EE5A0D84ULL, 0x323793B9AA5E0D7AULL,
+        0x9E822C5866520C78ULL, 0xFAEEB90722560C86ULL, 0x5531FCB0514410F9ULL,
+        0x315D69EF15401007ULL, 0x9DE8D60ED94C1105ULL, 0xF98443519D4811FBULL,
+        0x508EF24B9066377EULL, 0x34E26714D4623780ULL, 0x9857D8F5186E3682ULL,
+        0xFC3B4DAA5C6A367CULL, 0x53E4081D2F782A03ULL, 0x37889D426B7C2AFDULL,
+        0x9B3D22A3A7702BFFULL, 0xFF51B7FCE3742B01ULL, 0x40A73D09EAD29398ULL,
+        0x24CBA856AED69366ULL, 0x887E17B762DA9264ULL, 0xEC1282E826DE929AULL,
+        0x43CDC75F55CC8EE5ULL, 0x27A1520011C88E1BULL, 0x8B14EDE1DDC48F19ULL,
+        0xEF7878BE99C08FE7ULL, 0x4672C9A494EEA962ULL, 0x221E5CFBD0EAA99CULL,
+        0x8EABE31A1CE6A89EULL, 0xEAC7764558E2A860ULL, 0x451833F22BF0B41FULL,
+        0x2174A6AD6FF4B4E1ULL, 0x8DC1194CA3F8B5E3ULL, 0xE9AD8C13E7FCB51DULL,
+        0x4D0CD45316AAE66CULL, 0x2960410C52AEE692ULL, 0x85D5FEED9EA2E790ULL,
+        0xE1B96BB2DAA6E76EULL, 0x4E662E05A9B4FB11ULL, 0x2A0ABB5AEDB0FBEFULL,
+        0x86BF04BB21BCFAEDULL, 0xE2D391E465B8FA13ULL, 0x4BD920FE6896DC96ULL,
+        0x2FB5B5A12C92DC68ULL, 0x83000A40E09EDD6AULL, 0xE76C9F1FA49ADD94ULL,
+        0x48B3DAA8D788C1EBULL, 0x2CDF4FF7938CC115ULL, 0x806AF0165F80C017ULL,
+        0xE40665491B84C0E9ULL
+    },
+    {
+        0x0000000000000000ULL, 0x53E7815838846436ULL, 0xA7CF02B07108C86CULL,
+        0xF42883E8498CAC5AULL, 0xDD46AA4B4D1F8E5DULL, 0x8EA12B13759BEA6BULL,
+        0x7A89A8FB3C174631ULL, 0x296E29A304932207ULL, 0x2855FBBD3531023FULL,
+        0x7BB27AE50DB56609ULL, 0x8F9AF90D4439CA53ULL, 0xDC7D78557CBDAE65ULL,
+        0xF51351F6782E8C62ULL, 0xA6F4D0AE40AAE854ULL, 0x52DC53460926440EULL,
+        0x013BD21E31A22038ULL, 0x50ABF77A6A62047EULL, 0x034C762252E66048ULL,
+        0xF764F5CA1B6ACC12ULL, 0xA483749223EEA824ULL, 0x8DED5D31277D8A23ULL,
+        0xDE0ADC691FF9EE15ULL, 0x2A225F815675424FULL, 0x79C5DED96EF12679ULL,
+        0x78FE0CC75F530641ULL, 0x2B198D9F67D76277ULL, 0xDF310E772E5BCE2DULL,
+        0x8CD68F2F16DFAA1BULL, 0xA5B8A68C124C881CULL, 0xF65F27D42AC8EC2AULL,
+        0x0277A43C63444070ULL, 0x519025645BC02446ULL, 0xA157EEF4D4C408FCULL,
+        0xF2B06FACEC406CCAULL, 0x0698EC44A5CCC090ULL, 0x557F6D1C9D48A4A6ULL,
+        0x7C1144BF99DB86A1ULL, 0x2FF6C5E7A15FE297ULL, 0xDBDE460FE8D34ECDULL,
+        0x8839C757D0572AFBULL, 0x89021549E1F50AC3ULL, 0xDAE59411D9716EF5ULL,
+        0x2ECD17F990FDC2AFULL, 0x7D2A96A1A879A699ULL, 0x5444BF02ACEA849EULL,
+        0x07A33E5A946EE0A8ULL, 0xF38BBDB2DDE24CF2ULL, 0xA06C3CEAE56628C4ULL,
+        0xF1FC198EBEA60C82ULL, 0xA21B98D6862268B4ULL, 0x56331B3ECFAEC4EEULL,
+        0x05D49A66F72AA0D8ULL, 0x2CBAB3C5F3B982DFULL, 0x7F5D329DCB3DE6E9ULL,
+        0x8B75B17582B14AB3ULL, 0xD892302DBA352E85ULL, 0xD9A9E2338B970EBDULL,
+        0x8A4E636BB3136A8BULL, 0x7E66E083FA9FC6D1ULL, 0x2D8161DBC21BA2E7ULL,
+        0x04EF4878C68880E0ULL, 0x5708C920FE0CE4D6ULL, 0xA3204AC8B780488CULL,
+        0xF0C7CB908F042CBAULL, 0xD07772C206860F7DULL, 0x8390F39A3E026B4BULL,
+        0x77B87072778EC711ULL, 0x245FF12A4F0AA327ULL, 0x0D31D8894B998120ULL,
+        0x5ED659D1731DE516ULL, 0xAAFEDA393A91494CULL, 0xF9195B6102152D7AULL,
+        0xF822897F33B70D42ULL, 0xABC508270B336974ULL, 0x5FED8BCF42BFC52EULL,
+        0x0C0A0A977A3BA118ULL, 0x256423347EA8831FULL, 0x7683A26C462CE729ULL,
+        0x82AB21840FA04B73ULL, 0xD14CA0DC37242F45ULL, 0x80DC85B86CE40B03ULL,
+        0xD33B04E054606F35ULL, 0x271387081DECC36FULL, 0x74F406502568A759ULL,
+        0x5D9A2FF321FB855EULL, 0x0E7DAEAB197FE168ULL, 0xFA552D4350F34D32ULL,
+        0xA9B2AC1B68772904ULL, 0xA8897E0559D5093CULL, 0xFB6EFF5D61516D0AULL,
+        0x0F467CB528DDC150ULL, 0x5CA1FDED1059A566ULL, 0x75CFD44E14CA8761ULL,
+        0x262855162C4EE357ULL, 0xD200D6FE65C24F0DULL, 0x81E757A65D462B3BULL,
+        0x71209C36D2420781ULL, 0x22C71D6EEAC663B7ULL, 0xD6EF9E86A34ACFEDULL,
+        0x85081FDE9BCEABDBULL, 0xAC66367D9F5D89DCULL, 0xFF81B725A7D9EDEAULL,
+        0x0BA934CDEE5541B0ULL, 0x584EB595D6D12586ULL, 0x5975678BE77305BEULL,
+        0x0A92E6D3DFF76188ULL, 0xFEBA653B967BCDD2ULL, 0xAD5DE463AEFFA9E4ULL,
+        0x8433CDC0AA6C8BE3ULL, 0xD7D44C9892E8EFD5ULL, 0x23FCCF70DB64438FULL,
+        0x701B4E28E3E027B9ULL, 0x218B6B4CB82003FFULL, 0x726CEA1480A467C9ULL,
+        0x864469FCC928CB93ULL, 0xD5A3E8A4F1ACAFA5ULL, 0xFCCDC107F53F8DA2ULL,
+        0xAF2A405FCDBBE994ULL, 0x5B02C3B7843745CEULL, 0x08E542EFBCB321F8ULL,
+        0x09DE90F18D1101C0ULL, 0x5A3911A9B59565F6ULL, 0xAE119241FC19C9ACULL,
+        0xFDF61319C49DAD9AULL, 0xD4983ABAC00E8F9DULL, 0x877FBBE2F88AEBABULL,
+        0x7357380AB10647F1ULL, 0x20B0B952898223C7ULL, 0x32364AAFA202007FULL,
+        0x61D1CBF79A866449ULL, 0x95F9481FD30AC813ULL, 0xC61EC947EB8EAC25ULL,
+        0xEF70E0E4EF1D8E22ULL, 0xBC9761BCD799EA14ULL, 0x48BFE2549E15464EULL,
+        0x1B58630CA6912278ULL, 0x1A63B11297330240ULL, 0x4984304AAFB76676ULL,
+        0xBDACB3A2E63BCA2CULL, 0xEE4B32FADEBFAE1AULL, 0xC7251B59DA2C8C1DULL,
+        0x94C29A01E2A8E82BULL, 0x60EA19E9AB244471ULL, 0x330D98B193A02047ULL,
+        0x629DBDD5C8600401ULL, 0x317A3C8DF0E46037ULL, 0xC552BF65B968CC6DULL,
+        0x96B53E3D81ECA85BULL, 0xBFDB179E857F8A5CULL, 0xEC3C96C6BDFBEE6AULL,
+        0x1814152EF4774230ULL, 0x4BF39476CCF32606ULL, 0x4AC84668FD51063EULL,
+        0x192FC730C5D56208ULL, 0xED0744D88C59CE52ULL, 0xBEE0C580B4DDAA64ULL,
+        0x978EEC23B04E8863ULL, 0xC4696D7B88CAEC55ULL, 0x3041EE93C146400FULL,
+        0x63A66FCBF9C22439ULL, 0x9361A45B76C60883ULL, 0xC08625034E426CB5ULL,
+        0x34AEA6EB07CEC0EFULL, 0x674927B33F4AA4D9ULL, 0x4E270E103BD986DEULL,
+        0x1DC08F48035DE2E8ULL, 0xE9E80CA04AD14EB2ULL, 0xBA0F8DF872552A84ULL,
+        0xBB345FE643F70ABCULL, 0xE8D3DEBE7B736E8AULL, 0x1CFB5D5632FFC2D0ULL,
+        0x4F1CDC0E0A7BA6E6ULL, 0x6672F5AD0EE884E1ULL, 0x359574F5366CE0D7ULL,
+        0xC1BDF71D7FE04C8DULL, 0x925A7645476428BBULL, 0xC3CA53211CA40CFDULL,
+        0x902DD279242068CBULL, 0x640551916DACC491ULL, 0x37E2D0C95528A0A7ULL,
+        0x1E8CF96A51BB82A0ULL, 0x4D6B7832693FE696ULL, 0xB943FBDA20B34ACCULL,
+        0xEAA47A8218372EFAULL, 0xEB9FA89C29950EC2ULL, 0xB87829C411116AF4ULL,
+        0x4C50AA2C589DC6AEULL, 0x1FB72B746019A298ULL, 0x36D902D7648A809FULL,
+        0x653E838F5C0EE4A9ULL, 0x91160067158248F3ULL, 0xC2F1813F2D062CC5ULL,
+        0xE241386DA4840F02ULL, 0xB1A6B9359C006B34ULL, 0x458E3ADDD58CC76EULL,
+        0x1669BB85ED08A358ULL, 0x3F079226E99B815FULL, 0x6CE0137ED11FE569ULL,
+        0x98C8909698934933ULL, 0xCB2F11CEA0172D05ULL, 0xCA14C3D091B50D3DULL,
+        0x99F34288A931690BULL, 0x6DDBC160E0BDC551ULL, 0x3E3C4038D839A167ULL,
+        0x1752699BDCAA8360ULL, 0x44B5E8C3E42EE756ULL, 0xB09D6B2BADA24B0CULL,
+        0xE37AEA7395262F3AULL, 0xB2EACF17CEE60B7CULL, 0xE10D4E4FF6626F4AULL,
+        0x1525CDA7BFEEC310ULL, 0x46C24CFF876AA726ULL, 0x6FAC655C83F98521ULL,
+        0x3C4BE404BB7DE117ULL, 0xC86367ECF2F14D4DULL, 0x9B84E6B4CA75297BULL,
+        0x9ABF34AAFBD70943ULL, 0xC958B5F2C3536D75ULL, 0x3D70361A8ADFC12FULL,
+        0x6E97B742B25BA519ULL, 0x47F99EE1B6C8871EULL, 0x141E1FB98E4CE328ULL,
+        0xE0369C51C7C04F72ULL, 0xB3D11D09FF442B44ULL, 0x4316D699704007FEULL,
+        0x10F157C148C463C8ULL, 0xE4D9D4290148CF92ULL, 0xB73E557139CCABA4ULL,
+        0x9E507CD23D5F89A3ULL, 0xCDB7FD8A05DBED95ULL, 0x399F7E624C5741CFULL,
+        0x6A78FF3A74D325F9ULL, 0x6B432D24457105C1ULL, 0x38A4AC7C7DF561F7ULL,
+        0xCC8C2F943479CDADULL, 0x9F6BAECC0CFDA99BULL, 0xB605876F086E8B9CULL,
+        0xE5E2063730EAEFAAULL, 0x11CA85DF796643F0ULL, 0x422D048741E227C6ULL,
+        0x13BD21E31A220380ULL, 0x405AA0BB22A667B6ULL, 0xB47223536B2ACBECULL,
+        0xE795A20B53AEAFDAULL, 0xCEFB8BA8573D8DDDULL, 0x9D1C0AF06FB9E9EBULL,
+        0x69348918263545B1ULL, 0x3AD308401EB12187ULL, 0x3BE8DA5E2F1301BFULL,
+        0x680F5B0617976589ULL, 0x9C27D8EE5E1BC9D3ULL, 0xCFC059B6669FADE5ULL,
+        0xE6AE7015620C8FE2ULL, 0xB549F14D5A88EBD4ULL, 0x416172A51304478EULL,
+        0x1286F3FD2B8023B8ULL
+    },
+    {
+        0x0000000000000000ULL, 0x09ABF11AFCA2D0D7ULL, 0x1357E235F945A1AEULL,
+        0x1AFC132F05E77179ULL, 0x26AFC46BF28B435CULL, 0x2F0435710E29938BULL,
+        0x35F8265E0BCEE2F2ULL, 0x3C53D744F76C3225ULL, 0x4D5F88D7E51686B8ULL,
+        0x44F479CD19B4566FULL, 0x5E086AE21C532716ULL, 0x57A39BF8E0F1F7C1ULL,
+        0x6BF04CBC179DC5E4ULL, 0x625BBDA6EB3F1533ULL, 0x78A7AE89EED8644AULL,
+        0x710C5F93127AB49DULL, 0x9ABF11AFCA2D0D70ULL, 0x9314E0B5368FDDA7ULL,
+        0x89E8F39A3368ACDEULL, 0x80430280CFCA7C09ULL, 0xBC10D5C438A64E2CULL,
+        0xB5BB24DEC4049EFBULL, 0xAF4737F1C1E3EF82ULL, 0xA6ECC6EB3D413F55ULL,
+        0xD7E099782F3B8BC8ULL, 0xDE4B6862D3995B1FULL, 0xC4B77B4DD67E2A66ULL,
+        0xCD1C8A572ADCFAB1ULL, 0xF14F5D13DDB0C894ULL, 0xF8E4AC0921121843ULL,
+        0xE218BF2624F5693AULL, 0xEBB34E3CD857B9EDULL, 0xA7A68C743B540465ULL,
+        0xAE0D7D6EC7F6D4B2ULL, 0xB4F16E41C211A5CBULL, 0xBD5A9F5B3EB3751CULL,
+        0x8109481FC9DF4739ULL, 0x88A2B905357D97EEULL, 0x925EAA2A309AE697ULL,
+        0x9BF55B30CC383640ULL, 0xEAF904A3DE4282DDULL, 0xE352F5B922E0520AULL,
+        0xF9AEE69627072373ULL, 0xF005178CDBA5F3A4ULL, 0xCC56C0C82CC9C181ULL,
+        0xC5FD31D2D06B1156ULL, 0xDF0122FDD58C602FULL, 0xD6AAD3E7292EB0F8ULL,
+        0x3D199DDBF1790915ULL, 0x34B26CC10DDBD9C2ULL, 0x2E4E7FEE083CA8BBULL,
+        0x27E58EF4F49E786CULL, 0x1BB659B003F24A49ULL, 0x121DA8AAFF509A9EULL,
+        0x08E1BB85FAB7EBE7ULL, 0x014A4A9F06153B30ULL, 0x7046150C146F8FADULL,
+        0x79EDE416E8CD5F7AULL, 0x6311F739ED2A2E03ULL, 0x6ABA06231188FED4ULL,
+        0x56E9D167E6E4CCF1ULL, 0x5F42207D1A461C26ULL, 0x45BE33521FA16D5FULL,
+        0x4C15C248E303BD88ULL, 0xDD95B7C3D9A6164FULL, 0xD43E46D92504C698ULL,
+        0xCEC255F620E3B7E1ULL, 0xC769A4ECDC416736ULL, 0xFB3A73A82B2D5513ULL,
+        0xF29182B2D78F85C4ULL, 0xE86D919DD268F4BDULL, 0xE1C660872ECA246AULL,
+        0x90CA3F143CB090F7ULL, 0x9961CE0EC0124020ULL, 0x839DDD21C5F53159ULL,
+        0x8A362C3B3957E18EULL, 0xB665FB7FCE3BD3ABULL, 0xBFCE0A653299037CULL,
+        0xA532194A377E7205ULL, 0xAC99E850CBDCA2D2ULL, 0x472AA66C138B1B3FULL,
+        0x4E815776EF29CBE8ULL, 0x547D4459EACEBA91ULL, 0x5DD6B543166C6A46ULL,
+        0x61856207E1005863ULL, 0x682E931D1DA288B4ULL, 0x72D280321845F9CDULL,
+        0x7B797128E4E7291AULL, 0x0A752EBBF69D9D87ULL, 0x03DEDFA10A3F4D50ULL,
+        0x1922CC8E0FD83C29ULL, 0x10893D94F37AECFEULL, 0x2CDAEAD00416DEDBULL,
+        0x25711BCAF8B40E0CULL, 0x3F8D08E5FD537F75ULL, 0x3626F9FF01F1AFA2ULL,
+        0x7A333BB7E2F2122AULL, 0x7398CAAD1E50C2FDULL, 0x6964D9821BB7B384ULL,
+        0x60CF2898E7156353ULL, 0x5C9CFFDC10795176ULL, 0x55370EC6ECDB81A1ULL,
+        0x4FCB1DE9E93CF0D8ULL, 0x4660ECF3159E200FULL, 0x376CB36007E49492ULL,
+        0x3EC7427AFB464445ULL, 0x243B5155FEA1353CULL, 0x2D90A04F0203E5EBULL,
+        0x11C3770BF56FD7CEULL, 0x1868861109CD0719ULL, 0x0294953E0C2A7660ULL,
+        0x0B3F6424F088A6B7ULL, 0xE08C2A1828DF1F5AULL, 0xE927DB02D47DCF8DULL,
+        0xF3DBC82DD19ABEF4ULL, 0xFA7039372D386E23ULL, 0xC623EE73DA545C06ULL,
+        0xCF881F6926F68CD1ULL, 0xD5740C462311FDA8ULL, 0xDCDFFD5CDFB32D7FULL,
+        0xADD3A2CFCDC999E2ULL, 0xA47853D5316B4935ULL, 0xBE8440FA348C384CULL,
+        0xB72FB1E0C82EE89BULL, 0x8B7C66A43F42DABEULL, 0x82D797BEC3E00A69ULL,
+        0x982B8491C6077B10ULL, 0x9180758B3AA5ABC7ULL, 0x29F3C0AC1C42321BULL,
+        0x205831B6E0E0E2CCULL, 0x3AA42299E50793B5ULL, 0x330FD38319A54362ULL,
+        0x0F5C04C7EEC97147ULL, 0x06F7F5DD126BA190ULL, 0x1C0BE6F2178CD0E9ULL,
+        0x15A017E8EB2E003EULL, 0x64AC487BF954B4A3ULL, 0x6D07B96105F66474ULL,
+        0x77FBAA4E0011150DULL, 0x7E505B54FCB3C5DAULL, 0x42038C100BDFF7FFULL,
+        0x4BA87D0AF77D2728ULL, 0x51546E25F29A5651ULL, 0x58FF9F3F0E388686ULL,
+        0xB34CD103D66F3F6BULL, 0xBAE720192ACDEFBCULL, 0xA01B33362F2A9EC5ULL,
+        0xA9B0C22CD3884E12ULL, 0x95E3156824E47C37ULL, 0x9C48E472D846ACE0ULL,
+        0x86B4F75DDDA1DD99ULL, 0x8F1F064721030D4EULL, 0xFE1359D43379B9D3ULL,
+        0xF7B8A8CECFDB6904ULL, 0xED44BBE1CA3C187DULL, 0xE4EF4AFB369EC8AAULL,
+        0xD8BC9DBFC1F2FA8FULL, 0xD1176CA53D502A58ULL, 0xCBEB7F8A38B75B21ULL,
+        0xC2408E90C4158BF6ULL, 0x8E554CD82716367EULL, 0x87FEBDC2DBB4E6A9ULL,
+        0x9D02AEEDDE5397D0ULL, 0x94A95FF722F14707ULL, 0xA8FA88B3D59D7522ULL,
+        0xA15179A9293FA5F5ULL, 0xBBAD6A862CD8D48CULL, 0xB2069B9CD07A045BULL,
+        0xC30AC40FC200B0C6ULL, 0xCAA135153EA26011ULL, 0xD05D263A3B451168ULL,
+        0xD9F6D720C7E7C1BFULL, 0xE5A50064308BF39AULL, 0xEC0EF17ECC29234DULL,
+        0xF6F2E251C9CE5234ULL, 0xFF59134B356C82E3ULL, 0x14EA5D77ED3B3B0EULL,
+        0x1D41AC6D1199EBD9ULL, 0x07BDBF42147E9AA0ULL, 0x0E164E58E8DC4A77ULL,
+        0x3245991C1FB07852ULL, 0x3BEE6806E312A885ULL, 0x21127B29E6F5D9FCULL,
+        0x28B98A331A57092BULL, 0x59B5D5A0082DBDB6ULL, 0x501E24BAF48F6D61ULL,
+        0x4AE23795F1681C18ULL, 0x4349C68F0DCACCCFULL, 0x7F1A11CBFAA6FEEAULL,
+        0x76B1E0D106042E3DULL, 0x6C4DF3FE03E35F44ULL, 0x65E602E4FF418F93ULL,
+        0xF466776FC5E42454ULL, 0xFDCD86753946F483ULL, 0xE731955A3CA185FAULL,
+        0xEE9A6440C003552DULL, 0xD2C9B304376F6708ULL, 0xDB62421ECBCDB7DFULL,
+        0xC19E5131CE2AC6A6ULL, 0xC835A02B32881671ULL, 0xB939FFB820F2A2ECULL,
+        0xB0920EA2DC50723BULL, 0xAA6E1D8DD9B70342ULL, 0xA3C5EC972515D395ULL,
+        0x9F963BD3D279E1B0ULL, 0x963DCAC92EDB3167ULL, 0x8CC1D9E62B3C401EULL,
+        0x856A28FCD79E90C9ULL, 0x6ED966C00FC92924ULL, 0x677297DAF36BF9F3ULL,
+        0x7D8E84F5F68C888AULL, 0x742575EF0A2E585DULL, 0x4876A2ABFD426A78ULL,
+        0x41DD53B101E0BAAFULL, 0x5B21409E0407CBD6ULL, 0x528AB184F8A51B01ULL,
+        0x2386EE17EADFAF9CULL, 0x2A2D1F0D167D7F4BULL, 0x30D10C22139A0E32ULL,
+        0x397AFD38EF38DEE5ULL, 0x05292A7C1854ECC0ULL, 0x0C82DB66E4F63C17ULL,
+        0x167EC849E1114D6EULL, 0x1FD539531DB39DB9ULL, 0x53C0FB1BFEB02031ULL,
+        0x5A6B0A010212F0E6ULL, 0x4097192E07F5819FULL, 0x493CE834FB575148ULL,
+        0x756F3F700C3B636DULL, 0x7CC4CE6AF099B3BAULL, 0x6638DD45F57EC2C3ULL,
+        0x6F932C5F09DC1214ULL, 0x1E9F73CC1BA6A689ULL, 0x173482D6E704765EULL,
+        0x0DC891F9E2E30727ULL, 0x046360E31E41D7F0ULL, 0x3830B7A7E92DE5D5ULL,
+        0x319B46BD158F3502ULL, 0x2B6755921068447BULL, 0x22CCA488ECCA94ACULL,
+        0xC97FEAB4349D2D41ULL, 0xC0D41BAEC83FFD96ULL, 0xDA280881CDD88CEFULL,
+        0xD383F99B317A5C38ULL, 0xEFD02EDFC6166E1DULL, 0xE67BDFC53AB4BECAULL,
+        0xFC87CCEA3F53CFB3ULL, 0xF52C3DF0C3F11F64ULL, 0x84206263D18BABF9ULL,
+        0x8D8B93792D297B2EULL, 0x9777805628CE0A57ULL, 0x9EDC714CD46CDA80ULL,
+        0xA28FA6082300E8A5ULL, 0xAB245712DFA23872ULL, 0xB1D8443DDA45490BULL,
+        0xB873B52726E799DCULL
+    },
+    {
+        0x0000000000000000ULL, 0xEC32CFFB23E3ED7DULL, 0x4ABD30DDE8C9C47FULL,
+        0xA68FFF26CB2A2902ULL, 0x957A61BBD19388FEULL, 0x7948AE40F2706583ULL,
+        0xDFC75166395A4C81ULL, 0x33F59E9D1AB9A1FCULL, 0xB82C6C5C0C290F79ULL,
+        0x541EA3A72FCAE204ULL, 0xF2915C81E4E0CB06ULL, 0x1EA3937AC703267BULL,
+        0x2D560DE7DDBA8787ULL, 0xC164C21CFE596AFAULL, 0x67EB3D3A357343F8ULL,
+        0x8BD9F2C11690AE85ULL, 0xE2807793B75C0077ULL, 0x0EB2B86894BFED0AULL,
+        0xA83D474E5F95C408ULL, 0x440F88B57C762975ULL, 0x77FA162866CF8889ULL,
+        0x9BC8D9D3452C65F4ULL, 0x3D4726F58E064CF6ULL, 0xD175E90EADE5A18BULL,
+        0x5AAC1BCFBB750F0EULL, 0xB69ED4349896E273ULL, 0x10112B1253BCCB71ULL,
+        0xFC23E4E9705F260CULL, 0xCFD67A746AE687F0ULL, 0x23E4B58F49056A8DULL,
+        0x856B4AA9822F438FULL, 0x69598552A1CCAEF2ULL, 0x57D8400CC1B61E6BULL,
+        0xBBEA8FF7E255F316ULL, 0x1D6570D1297FDA14ULL, 0xF157BF2A0A9C3769ULL,
+        0xC2A221B710259695ULL, 0x2E90EE4C33C67BE8ULL, 0x881F116AF8EC52EAULL,
+        0x642DDE91DB0FBF97ULL, 0xEFF42C50CD9F1112ULL, 0x03C6E3ABEE7CFC6FULL,
+        0xA5491C8D2556D56DULL, 0x497BD37606B53810ULL, 0x7A8E4DEB1C0C99ECULL,
+        0x96BC82103FEF7491ULL, 0x30337D36F4C55D93ULL, 0xDC01B2CDD726B0EEULL,
+        0xB558379F76EA1E1CULL, 0x596AF8645509F361ULL, 0xFFE507429E23DA63ULL,
+        0x13D7C8B9BDC0371EULL, 0x20225624A77996E2ULL, 0xCC1099DF849A7B9FULL,
+        0x6A9F66F94FB0529DULL, 0x86ADA9026C53BFE0ULL, 0x0D745BC37AC31165ULL,
+        0xE14694385920FC18ULL, 0x47C96B1E920AD51AULL, 0xABFBA4E5B1E93867ULL,
+        0x980E3A78AB50999BULL, 0x743CF58388B374E6ULL, 0xD2B30AA543995DE4ULL,
+        0x3E81C55E607AB099ULL, 0xAFB08019836C3CD6ULL, 0x43824FE2A08FD1ABULL,
+        0xE50DB0C46BA5F8A9ULL, 0x093F7F3F484615D4ULL, 0x3ACAE1A252FFB428ULL,
+        0xD6F82E59711C5955ULL, 0x7077D17FBA367057ULL, 0x9C451E8499D59D2AULL,
+        0x179CEC458F4533AFULL, 0xFBAE23BEACA6DED2ULL, 0x5D21DC98678CF7D0ULL,
+        0xB1131363446F1AADULL, 0x82E68DFE5ED6BB51ULL, 0x6ED442057D35562CULL,
+        0xC85BBD23B61F7F2EULL, 0x246972D895FC9253ULL, 0x4D30F78A34303CA1ULL,
+        0xA102387117D3D1DCULL, 0x078DC757DCF9F8DEULL, 0xEBBF08ACFF1A15A3ULL,
+        0xD84A9631E5A3B45FULL, 0x347859CAC6405922ULL, 0x92F7A6EC0D6A7020ULL,
+        0x7EC569172E899D5DULL, 0xF51C9BD6381933D8ULL, 0x192E542D1BFADEA5ULL,
+        0xBFA1AB0BD0D0F7A7ULL, 0x539364F0F3331ADAULL, 0x6066FA6DE98ABB26ULL,
+        0x8C543596CA69565BULL, 0x2ADBCAB001437F59ULL, 0xC6E9054B22A09224ULL,
+        0xF868C01542DA22BDULL, 0x145A0FEE6139CFC0ULL, 0xB2D5F0C8AA13E6C2ULL,
+        0x5EE73F3389F00BBFULL, 0x6D12A1AE9349AA43ULL, 0x81206E55B0AA473EULL,
+        0x27AF91737B806E3CULL, 0xCB9D5E8858638341ULL, 0x4044AC494EF32DC4ULL,
+        0xAC7663B26D10C0B9ULL, 0x0AF99C94A63AE9BBULL, 0xE6CB536F85D904C6ULL,
+        0xD53ECDF29F60A53AULL, 0x390C0209BC834847ULL, 0x9F83FD2F77A96145ULL,
+        0x73B132D4544A8C38ULL, 0x1AE8B786F58622CAULL, 0xF6DA787DD665CFB7ULL,
+        0x5055875B1D4FE6B5ULL, 0xBC6748A03EAC0BC8ULL, 0x8F92D63D2415AA34ULL,
+        0x63A019C607F64749ULL, 0xC52FE6E0CCDC6E4BULL, 0x291D291BEF3F8336ULL,
+        0xA2C4DBDAF9AF2DB3ULL, 0x4EF61421DA4CC0CEULL, 0xE879EB071166E9CCULL,
+        0x044B24FC328504B1ULL, 0x37BEBA61283CA54DULL, 0xDB8C759A0BDF4830ULL,
+        0x7D038ABCC0F56132ULL, 0x91314547E3168C4FULL, 0xCDB9AF18A9D66729ULL,
+        0x218B60E38A358A54ULL, 0x87049FC5411FA356ULL, 0x6B36503E62FC4E2BULL,
+        0x58C3CEA37845EFD7ULL, 0xB4F101585BA602AAULL, 0x127EFE7E908C2BA8ULL,
+        0xFE4C3185B36FC6D5ULL, 0x7595C344A5FF6850ULL, 0x99A70CBF861C852DULL,
+        0x3F28F3994D36AC2FULL, 0xD31A3C626ED54152ULL, 0xE0EFA2FF746CE0AEULL,
+        0x0CDD6D04578F0DD3ULL, 0xAA5292229CA524D1ULL, 0x46605DD9BF46C9ACULL,
+        0x2F39D88B1E8A675EULL, 0xC30B17703D698A23ULL, 0x6584E856F643A321ULL,
+        0x89B627ADD5A04E5CULL, 0xBA43B930CF19EFA0ULL, 0x567176CBECFA02DDULL,
+        0xF0FE89ED27D02BDFULL, 0x1CCC46160433C6A2ULL, 0x9715B4D712A36827ULL,
+        0x7B277B2C3140855AULL, 0xDDA8840AFA6AAC58ULL, 0x319A4BF1D9894125ULL,
+        0x026FD56CC330E0D9ULL, 0xEE5D1A97E0D30DA4ULL, 0x48D2E5B12BF924A6ULL,
+        0xA4E02A4A081AC9DBULL, 0x9A61EF1468607942ULL, 0x765320EF4B83943FULL,
+        0xD0DCDFC980A9BD3DULL, 0x3CEE1032A34A5040ULL, 0x0F1B8EAFB9F3F1BCULL,
+        0xE32941549A101CC1ULL, 0x45A6BE72513A35C3ULL, 0xA994718972D9D8BEULL,
+        0x224D83486449763BULL, 0xCE7F4CB347AA9B46ULL, 0x68F0B3958C80B244ULL,
+        0x84C27C6EAF635F39ULL, 0xB737E2F3B5DAFEC5ULL, 0x5B052D08963913B8ULL,
+        0xFD8AD22E5D133ABAULL, 0x11B81DD57EF0D7C7ULL, 0x78E19887DF3C7935ULL,
+        0x94D3577CFCDF9448ULL, 0x325CA85A37F5BD4AULL, 0xDE6E67A114165037ULL,
+        0xED9BF93C0EAFF1CBULL, 0x01A936C72D4C1CB6ULL, 0xA726C9E1E66635B4ULL,
+        0x4B14061AC585D8C9ULL, 0xC0CDF4DBD315764CULL, 0x2CFF3B20F0F69B31ULL,
+        0x8A70C4063BDCB233ULL, 0x66420BFD183F5F4EULL, 0x55B795600286FEB2ULL,
+        0xB9855A9B216513CFULL, 0x1F0AA5BDEA4F3ACDULL, 0xF3386A46C9ACD7B0ULL,
+        0x62092F012ABA5BFFULL, 0x8E3BE0FA0959B682ULL, 0x28B41FDCC2739F80ULL,
+        0xC486D027E19072FDULL, 0xF7734EBAFB29D301ULL, 0x1B418141D8CA3E7CULL,
+        0xBDCE7E6713E0177EULL, 0x51FCB19C3003FA03ULL, 0xDA25435D26935486ULL,
+        0x36178CA60570B9FBULL, 0x90987380CE5A90F9ULL, 0x7CAABC7BEDB97D84ULL,
+        0x4F5F22E6F700DC78ULL, 0xA36DED1DD4E33105ULL, 0x05E2123B1FC91807ULL,
+        0xE9D0DDC03C2AF57AULL, 0x808958929DE65B88ULL, 0x6CBB9769BE05B6F5ULL,
+        0xCA34684F752F9FF7ULL, 0x2606A7B456CC728AULL, 0x15F339294C75D376ULL,
+        0xF9C1F6D26F963E0BULL, 0x5F4E09F4A4BC1709ULL, 0xB37CC60F875FFA74ULL,
+        0x38A534CE91CF54F1ULL, 0xD497FB35B22CB98CULL, 0x721804137906908EULL,
+        0x9E2ACBE85AE57DF3ULL, 0xADDF5575405CDC0FULL, 0x41ED9A8E63BF3172ULL,
+        0xE76265A8A8951870ULL, 0x0B50AA538B76F50DULL, 0x35D16F0DEB0C4594ULL,
+        0xD9E3A0F6C8EFA8E9ULL, 0x7F6C5FD003C581EBULL, 0x935E902B20266C96ULL,
+        0xA0AB0EB63A9FCD6AULL, 0x4C99C14D197C2017ULL, 0xEA163E6BD2560915ULL,
+        0x0624F190F1B5E468ULL, 0x8DFD0351E7254AEDULL, 0x61CFCCAAC4C6A790ULL,
+        0xC740338C0FEC8E92ULL, 0x2B72FC772C0F63EFULL, 0x188762EA36B6C213ULL,
+        0xF4B5AD1115552F6EULL, 0x523A5237DE7F066CULL, 0xBE089DCCFD9CEB11ULL,
+        0xD751189E5C5045E3ULL, 0x3B63D7657FB3A89EULL, 0x9DEC2843B499819CULL,
+        0x71DEE7B8977A6CE1ULL, 0x422B79258DC3CD1DULL, 0xAE19B6DEAE202060ULL,
+        0x089649F8650A0962ULL, 0xE4A4860346E9E41FULL, 0x6F7D74C250794A9AULL,
+        0x834FBB39739AA7E7ULL, 0x25C0441FB8B08EE5ULL, 0xC9F28BE49B536398ULL,
+        0xFA07157981EAC264ULL, 0x1635DA82A2092F19ULL, 0xB0BA25A46923061BULL,
+        0x5C88EA5F4AC0EB66ULL
+    },
+    {
+        0x0000000000000000ULL, 0xDDA9F27EE08373ADULL, 0x298B4BD66E08F9DFULL,
+        0xF422B9A88E8B8A72ULL, 0x531697ACDC11F3BEULL, 0x8EBF65D23C928013ULL,
+        0x7A9DDC7AB2190A61ULL, 0xA7342E04529A79CCULL, 0xA62D2F59B823E77CULL,
+        0x7B84DD2758A094D1ULL, 0x8FA6648FD62B1EA3ULL, 0x520F96F136A86D0EULL,
+        0xF53BB8F5643214C2ULL, 0x28924A8B84B1676FULL, 0xDCB0F3230A3AED1DULL,
+        0x0119015DEAB99EB0ULL, 0xDE82F198DF49D07DULL, 0x032B03E63FCAA3D0ULL,
+        0xF709BA4EB14129A2ULL, 0x2AA0483051C25A0FULL, 0x8D946634035823C3ULL,
+        0x503D944AE3DB506EULL, 0xA41F2DE26D50DA1CULL, 0x79B6DF9C8DD3A9B1ULL,
+        0x78AFDEC1676A3701ULL, 0xA5062CBF87E944ACULL, 0x512495170962CEDEULL,
+        0x8C8D6769E9E1BD73ULL, 0x2BB9496DBB7BC4BFULL, 0xF610BB135BF8B712ULL,
+        0x023202BBD5733D60ULL, 0xDF9BF0C535F04ECDULL, 0x2FDD4C1A119DBE7FULL,
+        0xF274BE64F11ECDD2ULL, 0x065607CC7F9547A0ULL, 0xDBFFF5B29F16340DULL,
+        0x7CCBDBB6CD8C4DC1ULL, 0xA16229C82D0F3E6CULL, 0x55409060A384B41EULL,
+        0x88E9621E4307C7B3ULL, 0x89F06343A9BE5903ULL, 0x5459913D493D2AAEULL,
+        0xA07B2895C7B6A0DCULL, 0x7DD2DAEB2735D371ULL, 0xDAE6F4EF75AFAABDULL,
+        0x074F0691952CD910ULL, 0xF36DBF391BA75362ULL, 0x2EC44D47FB2420CFULL,
+        0xF15FBD82CED46E02ULL, 0x2CF64FFC2E571DAFULL, 0xD8D4F654A0DC97DDULL,
+        0x057D042A405FE470ULL, 0xA2492A2E12C59DBCULL, 0x7FE0D850F246EE11ULL,
+        0x8BC261F87CCD6463ULL, 0x566B93869C4E17CEULL, 0x577292DB76F7897EULL,
+        0x8ADB60A59674FAD3ULL, 0x7EF9D90D18FF70A1ULL, 0xA3502B73F87C030CULL,
+        0x04640577AAE67AC0ULL, 0xD9CDF7094A65096DULL, 0x2DEF4EA1C4EE831FULL,
+        0xF046BCDF246DF0B2ULL, 0x5FBA9834233B7CFEULL, 0x82136A4AC3B80F53ULL,
+        0x7631D3E24D338521ULL, 0xAB98219CADB0F68CULL, 0x0CAC0F98FF2A8F40ULL,
+        0xD105FDE61FA9FCEDULL, 0x2527444E9122769FULL, 0xF88EB63071A10532ULL,
+        0xF997B76D9B189B82ULL, 0x243E45137B9BE82FULL, 0xD01CFCBBF510625DULL,
+        0x0DB50EC5159311F0ULL, 0xAA8120C14709683CULL, 0x7728D2BFA78A1B91ULL,
+        0x830A6B17290191E3ULL, 0x5EA39969C982E24EULL, 0x813869ACFC72AC83ULL,
+        0x5C919BD21CF1DF2EULL, 0xA8B3227A927A555CULL, 0x751AD00472F926F1ULL,
+        0xD22EFE0020635F3DULL, 0x0F870C7EC0E02C90ULL, 0xFBA5B5D64E6BA6E2ULL,
+        0x260C47A8AEE8D54FULL, 0x271546F544514BFFULL, 0xFABCB48BA4D23852ULL,
+        0x0E9E0D232A59B220ULL, 0xD337FF5DCADAC18DULL, 0x7403D1599840B841ULL,
+        0xA9AA232778C3CBECULL, 0x5D889A8FF648419EULL, 0x802168F116CB3233ULL,
+        0x7067D42E32A6C281ULL, 0xADCE2650D225B12CULL, 0x59EC9FF85CAE3B5EULL,
+        0x84456D86BC2D48F3ULL, 0x23714382EEB7313FULL, 0xFED8B1FC0E344292ULL,
+        0x0AFA085480BFC8E0ULL, 0xD753FA2A603CBB4DULL, 0xD64AFB778A8525FDULL,
+        0x0BE309096A065650ULL, 0xFFC1B0A1E48DDC22ULL, 0x226842DF040EAF8FULL,
+        0x855C6CDB5694D643ULL, 0x58F59EA5B617A5EEULL, 0xACD7270D389C2F9CULL,
+        0x717ED573D81F5C31ULL, 0xAEE525B6EDEF12FCULL, 0x734CD7C80D6C6151ULL,
+        0x876E6E6083E7EB23ULL, 0x5AC79C1E6364988EULL, 0xFDF3B21A31FEE142ULL,
+        0x205A4064D17D92EFULL, 0xD478F9CC5FF6189DULL, 0x09D10BB2BF756B30ULL,
+        0x08C80AEF55CCF580ULL, 0xD561F891B54F862DULL, 0x214341393BC40C5FULL,
+        0xFCEAB347DB477FF2ULL, 0x5BDE9D4389DD063EULL, 0x86776F3D695E7593ULL,
+        0x7255D695E7D5FFE1ULL, 0xAFFC24EB07568C4CULL, 0xBF7530684676F9FCULL,
+        0x62DCC216A6F58A51ULL, 0x96FE7BBE287E0023ULL, 0x4B5789C0C8FD738EULL,
+        0xEC63A7C49A670A42ULL, 0x31CA55BA7AE479EFULL, 0xC5E8EC12F46FF39DULL,
+        0x18411E6C14EC8030ULL, 0x19581F31FE551E80ULL, 0xC4F1ED4F1ED66D2DULL,
+        0x30D354E7905DE75FULL, 0xED7AA69970DE94F2ULL, 0x4A4E889D2244ED3EULL,
+        0x97E77AE3C2C79E93ULL, 0x63C5C34B4C4C14E1ULL, 0xBE6C3135ACCF674CULL,
+        0x61F7C1F0993F2981ULL, 0xBC5E338E79BC5A2CULL, 0x487C8A26F737D05EULL,
+        0x95D5785817B4A3F3ULL, 0x32E1565C452EDA3FULL, 0xEF48A422A5ADA992ULL,
+        0x1B6A1D8A2B2623E0ULL, 0xC6C3EFF4CBA5504DULL, 0xC7DAEEA9211CCEFDULL,
+        0x1A731CD7C19FBD50ULL, 0xEE51A57F4F143722ULL, 0x33F85701AF97448FULL,
+        0x94CC7905FD0D3D43ULL, 0x49658B7B1D8E4EEEULL, 0xBD4732D39305C49CULL,
+        0x60EEC0AD7386B731ULL, 0x90A87C7257EB4783ULL, 0x4D018E0CB768342EULL,
+        0xB92337A439E3BE5CULL, 0x648AC5DAD960CDF1ULL, 0xC3BEEBDE8BFAB43DULL,
+        0x1E1719A06B79C790ULL, 0xEA35A008E5F24DE2ULL, 0x379C527605713E4FULL,
+        0x3685532BEFC8A0FFULL, 0xEB2CA1550F4BD352ULL, 0x1F0E18FD81C05920ULL,
+        0xC2A7EA8361432A8DULL, 0x6593C48733D95341ULL, 0xB83A36F9D35A20ECULL,
+        0x4C188F515DD1AA9EULL, 0x91B17D2FBD52D933ULL, 0x4E2A8DEA88A297FEULL,
+        0x93837F946821E453ULL, 0x67A1C63CE6AA6E21ULL, 0xBA08344206291D8CULL,
+        0x1D3C1A4654B36440ULL, 0xC095E838B43017EDULL, 0x34B751903ABB9D9FULL,
+        0xE91EA3EEDA38EE32ULL, 0xE807A2B330817082ULL, 0x35AE50CDD002032FULL,
+        0xC18CE9655E89895DULL, 0x1C251B1BBE0AFAF0ULL, 0xBB11351FEC90833CULL,
+        0x66B8C7610C13F091ULL, 0x929A7EC982987AE3ULL, 0x4F338CB7621B094EULL,
+        0xE0CFA85C654D8502ULL, 0x3D665A2285CEF6AFULL, 0xC944E38A0B457CDDULL,
+        0x14ED11F4EBC60F70ULL, 0xB3D93FF0B95C76BCULL, 0x6E70CD8E59DF0511ULL,
+        0x9A527426D7548F63ULL, 0x47FB865837D7FCCEULL, 0x46E28705DD6E627EULL,
+        0x9B4B757B3DED11D3ULL, 0x6F69CCD3B3669BA1ULL, 0xB2C03EAD53E5E80CULL,
+        0x15F410A9017F91C0ULL, 0xC85DE2D7E1FCE26DULL, 0x3C7F5B7F6F77681FULL,
+        0xE1D6A9018FF41BB2ULL, 0x3E4D59C4BA04557FULL, 0xE3E4ABBA5A8726D2ULL,
+        0x17C61212D40CACA0ULL, 0xCA6FE06C348FDF0DULL, 0x6D5BCE686615A6C1ULL,
+        0xB0F23C168696D56CULL, 0x44D085BE081D5F1EULL, 0x997977C0E89E2CB3ULL,
+        0x9860769D0227B203ULL, 0x45C984E3E2A4C1AEULL, 0xB1EB3D4B6C2F4BDCULL,
+        0x6C42CF358CAC3871ULL, 0xCB76E131DE3641BDULL, 0x16DF134F3EB53210ULL,
+        0xE2FDAAE7B03EB862ULL, 0x3F54589950BDCBCFULL, 0xCF12E44674D03B7DULL,
+        0x12BB1638945348D0ULL, 0xE699AF901AD8C2A2ULL, 0x3B305DEEFA5BB10FULL,
+        0x9C0473EAA8C1C8C3ULL, 0x41AD81944842BB6EULL, 0xB58F383CC6C9311CULL,
+        0x6826CA42264A42B1ULL, 0x693FCB1FCCF3DC01ULL, 0xB49639612C70AFACULL,
+        0x40B480C9A2FB25DEULL, 0x9D1D72B742785673ULL, 0x3A295CB310E22FBFULL,
+        0xE780AECDF0615C12ULL, 0x13A217657EEAD660ULL, 0xCE0BE51B9E69A5CDULL,
+        0x119015DEAB99EB00ULL, 0xCC39E7A04B1A98ADULL, 0x381B5E08C59112DFULL,
+        0xE5B2AC7625126172ULL, 0x42868272778818BEULL, 0x9F2F700C970B6B13ULL,
+        0x6B0DC9A41980E161ULL, 0xB6A43BDAF90392CCULL, 0xB7BD3A8713BA0C7CULL,
+        0x6A14C8F9F3397FD1ULL, 0x9E3671517DB2F5A3ULL, 0x439F832F9D31860EULL,
+        0xE4ABAD2BCFABFFC2ULL, 0x39025F552F288C6FULL, 0xCD20E6FDA1A3061DULL,
+        0x10891483412075B0ULL
+    },
+    {
+        0x0000000000000000ULL, 0x0DD9B4240837FD99ULL, 0x1BB36848106FFB32ULL,
+        0x166ADC6C185806ABULL, 0x3766D09020DFF664ULL, 0x3ABF64B428E80BFDULL,
+        0x2CD5B8D830B00D56ULL, 0x210C0CFC3887F0CFULL, 0x6ECDA12041BFECC8ULL,
+        0x6314150449881151ULL, 0x757EC96851D017FAULL, 0x78A77D4C59E7EA63ULL,
+        0x59AB71B061601AACULL, 0x5472C5946957E735ULL, 0x421819F8710FE19EULL,
+        0x4FC1ADDC79381C07ULL, 0xDD9B4240837FD990ULL, 0xD042F6648B482409ULL,
+        0xC6282A08931022A2ULL, 0xCBF19E2C9B27DF3BULL, 0xEAFD92D0A3A02FF4ULL,
+        0xE72426F4AB97D26DULL, 0xF14EFA98B3CFD4C6ULL, 0xFC974EBCBBF8295FULL,
+        0xB356E360C2C03558ULL, 0xBE8F5744CAF7C8C1ULL, 0xA8E58B28D2AFCE6AULL,
+        0xA53C3F0CDA9833F3ULL, 0x843033F0E21FC33CULL, 0x89E987D4EA283EA5ULL,
+        0x9F835BB8F270380EULL, 0x925AEF9CFA47C597ULL, 0x29EE2BAAA9F1ADA5ULL,
+        0x24379F8EA1C6503CULL, 0x325D43E2B99E5697ULL, 0x3F84F7C6B1A9AB0EULL,
+        0x1E88FB3A892E5BC1ULL, 0x13514F1E8119A658ULL, 0x053B93729941A0F3ULL,
+        0x08E2275691765D6AULL, 0x47238A8AE84E416DULL, 0x4AFA3EAEE079BCF4ULL,
+        0x5C90E2C2F821BA5FULL, 0x514956E6F01647C6ULL, 0x70455A1AC891B709ULL,
+        0x7D9CEE3EC0A64A90ULL, 0x6BF63252D8FE4C3BULL, 0x662F8676D0C9B1A2ULL,
+        0xF47569EA2A8E7435ULL, 0xF9ACDDCE22B989ACULL, 0xEFC601A23AE18F07ULL,
+        0xE21FB58632D6729EULL, 0xC313B97A0A518251ULL, 0xCECA0D5E02667FC8ULL,
+        0xD8A0D1321A3E7963ULL, 0xD5796516120984FAULL, 0x9AB8C8CA6B3198FDULL,
+        0x97617CEE63066564ULL, 0x810BA0827B5E63CFULL, 0x8CD214A673699E56ULL,
+        0xADDE185A4BEE6E99ULL, 0xA007AC7E43D99300ULL, 0xB66D70125B8195ABULL,
+        0xBBB4C43653B66832ULL, 0x53DC575553E35B4AULL, 0x5E05E3715BD4A6D3ULL,
+        0x486F3F1D438CA078ULL, 0x45B68B394BBB5DE1ULL, 0x64BA87C5733CAD2EULL,
+        0x696333E17B0B50B7ULL, 0x7F09EF8D6353561CULL, 0x72D05BA96B64AB85ULL,
+        0x3D11F675125CB782ULL, 0x30C842511A6B4A1BULL, 0x26A29E3D02334CB0ULL,
+        0x2B7B2A190A04B129ULL, 0x0A7726E5328341E6ULL, 0x07AE92C13AB4BC7FULL,
+        0x11C44EAD22ECBAD4ULL, 0x1C1DFA892ADB474DULL, 0x8E471515D09C82DAULL,
+        0x839EA131D8AB7F43ULL, 0x95F47D5DC0F379E8ULL, 0x982DC979C8C48471ULL,
+        0xB921C585F04374BEULL, 0xB4F871A1F8748927ULL, 0xA292ADCDE02C8F8CULL,
+        0xAF4B19E9E81B7215ULL, 0xE08AB43591236E12ULL, 0xED5300119914938BULL,
+        0xFB39DC7D814C9520ULL, 0xF6E06859897B68B9ULL, 0xD7EC64A5B1FC9876ULL,
+        0xDA35D081B9CB65EFULL, 0xCC5F0CEDA1936344ULL, 0xC186B8C9A9A49EDDULL,
+        0x7A327CFFFA12F6EFULL, 0x77EBC8DBF2250B76ULL, 0x618114B7EA7D0DDDULL,
+        0x6C58A093E24AF044ULL, 0x4D54AC6FDACD008BULL, 0x408D184BD2FAFD12ULL,
+        0x56E7C427CAA2FBB9ULL, 0x5B3E7003C2950620ULL, 0x14FFDDDFBBAD1A27ULL,
+        0x192669FBB39AE7BEULL, 0x0F4CB597ABC2E115ULL, 0x029501B3A3F51C8CULL,
+        0x23990D4F9B72EC43ULL, 0x2E40B96B934511DAULL, 0x382A65078B1D1771ULL,
+        0x35F3D123832AEAE8ULL, 0xA7A93EBF796D2F7FULL, 0xAA708A9B715AD2E6ULL,
+        0xBC1A56F76902D44DULL, 0xB1C3E2D3613529D4ULL, 0x90CFEE2F59B2D91BULL,
+        0x9D165A0B51852482ULL, 0x8B7C866749DD2229ULL, 0x86A5324341EADFB0ULL,
+        0xC9649F9F38D2C3B7ULL, 0xC4BD2BBB30E53E2EULL, 0xD2D7F7D728BD3885ULL,
+        0xDF0E43F3208AC51CULL, 0xFE024F0F180D35D3ULL, 0xF3DBFB2B103AC84AULL,
+        0xE5B127470862CEE1ULL, 0xE868936300553378ULL, 0xA7B8AEAAA7C6B694ULL,
+        0xAA611A8EAFF14B0DULL, 0xBC0BC6E2B7A94DA6ULL, 0xB1D272C6BF9EB03FULL,
+        0x90DE7E3A871940F0ULL, 0x9D07CA1E8F2EBD69ULL, 0x8B6D16729776BBC2ULL,
+        0x86B4A2569F41465BULL, 0xC9750F8AE6795A5CULL, 0xC4ACBBAEEE4EA7C5ULL,
+        0xD2C667C2F616A16EULL, 0xDF1FD3E6FE215CF7ULL, 0xFE13DF1AC6A6AC38ULL,
+        0xF3CA6B3ECE9151A1ULL, 0xE5A0B752D6C9570AULL, 0xE8790376DEFEAA93ULL,
+        0x7A23ECEA24B96F04ULL, 0x77FA58CE2C8E929DULL, 0x619084A234D69436ULL,
+        0x6C4930863CE169AFULL, 0x4D453C7A04669960ULL, 0x409C885E0C5164F9ULL,
+        0x56F6543214096252ULL, 0x5B2FE0161C3E9FCBULL, 0x14EE4DCA650683CCULL,
+        0x1937F9EE6D317E55ULL, 0x0F5D2582756978FEULL, 0x028491A67D5E8567ULL,
+        0x23889D5A45D975A8ULL, 0x2E51297E4DEE8831ULL, 0x383BF51255B68E9AULL,
+        0x35E241365D817303ULL, 0x8E5685000E371B31ULL, 0x838F31240600E6A8ULL,
+        0x95E5ED481E58E003ULL, 0x983C596C166F1D9AULL, 0xB93055902EE8ED55ULL,
+        0xB4E9E1B426DF10CCULL, 0xA2833DD83E871667ULL, 0xAF5A89FC36B0EBFEULL,
+        0xE09B24204F88F7F9ULL, 0xED42900447BF0A60ULL, 0xFB284C685FE70CCBULL,
+        0xF6F1F84C57D0F152ULL, 0xD7FDF4B06F57019DULL, 0xDA2440946760FC04ULL,
+        0xCC4E9CF87F38FAAFULL, 0xC19728DC770F0736ULL, 0x53CDC7408D48C2A1ULL,
+        0x5E147364857F3F38ULL, 0x487EAF089D273993ULL, 0x45A71B2C9510C40AULL,
+        0x64AB17D0AD9734C5ULL, 0x6972A3F4A5A0C95CULL, 0x7F187F98BDF8CFF7ULL,
+        0x72C1CBBCB5CF326EULL, 0x3D006660CCF72E69ULL, 0x30D9D244C4C0D3F0ULL,
+        0x26B30E28DC98D55BULL, 0x2B6ABA0CD4AF28C2ULL, 0x0A66B6F0EC28D80DULL,
+        0x07BF02D4E41F2594ULL, 0x11D5DEB8FC47233FULL, 0x1C0C6A9CF470DEA6ULL,
+        0xF464F9FFF425EDDEULL, 0xF9BD4DDBFC121047ULL, 0xEFD791B7E44A16ECULL,
+        0xE20E2593EC7DEB75ULL, 0xC302296FD4FA1BBAULL, 0xCEDB9D4BDCCDE623ULL,
+        0xD8B14127C495E088ULL, 0xD568F503CCA21D11ULL, 0x9AA958DFB59A0116ULL,
+        0x9770ECFBBDADFC8FULL, 0x811A3097A5F5FA24ULL, 0x8CC384B3ADC207BDULL,
+        0xADCF884F9545F772ULL, 0xA0163C6B9D720AEBULL, 0xB67CE007852A0C40ULL,
+        0xBBA554238D1DF1D9ULL, 0x29FFBBBF775A344EULL, 0x24260F9B7F6DC9D7ULL,
+        0x324CD3F76735CF7CULL, 0x3F9567D36F0232E5ULL, 0x1E996B2F5785C22AULL,
+        0x1340DF0B5FB23FB3ULL, 0x052A036747EA3918ULL, 0x08F3B7434FDDC481ULL,
+        0x47321A9F36E5D886ULL, 0x4AEBAEBB3ED2251FULL, 0x5C8172D7268A23B4ULL,
+        0x5158C6F32EBDDE2DULL, 0x7054CA0F163A2EE2ULL, 0x7D8D7E2B1E0DD37BULL,
+        0x6BE7A2470655D5D0ULL, 0x663E16630E622849ULL, 0xDD8AD2555DD4407BULL,
+        0xD053667155E3BDE2ULL, 0xC639BA1D4DBBBB49ULL, 0xCBE00E39458C46D0ULL,
+        0xEAEC02C57D0BB61FULL, 0xE735B6E1753C4B86ULL, 0xF15F6A8D6D644D2DULL,
+        0xFC86DEA96553B0B4ULL, 0xB34773751C6BACB3ULL, 0xBE9EC751145C512AULL,
+        0xA8F41B3D0C045781ULL, 0xA52DAF190433AA18ULL, 0x8421A3E53CB45AD7ULL,
+        0x89F817C13483A74EULL, 0x9F92CBAD2CDBA1E5ULL, 0x924B7F8924EC5C7CULL,
+        0x00119015DEAB99EBULL, 0x0DC82431D69C6472ULL, 0x1BA2F85DCEC462D9ULL,
+        0x167B4C79C6F39F40ULL, 0x37774085FE746F8FULL, 0x3AAEF4A1F6439216ULL,
+        0x2CC428CDEE1B94BDULL, 0x211D9CE9E62C6924ULL, 0x6EDC31359F147523ULL,
+        0x63058511972388BAULL, 0x756F597D8F7B8E11ULL, 0x78B6ED59874C7388ULL,
+        0x59BAE1A5BFCB8347ULL, 0x54635581B7FC7EDEULL, 0x420989EDAFA47875ULL,
+        0x4FD03DC9A79385ECULL
+    },
+    {
+        0x0000000000000000ULL, 0xF075E4AE5E05BDFFULL, 0x723366771305657BULL,
+        0x824682D94D00D884ULL, 0xE466CCEE260ACAF6ULL, 0x14132840780F7709ULL,
+        0x9655AA99350FAF8DULL, 0x66204E376B0A1272ULL, 0x5A1536F7E31B8B69ULL,
+        0xAA60D259BD1E3696ULL, 0x28265080F01EEE12ULL, 0xD853B42EAE1B53EDULL,
+        0xBE73FA19C511419FULL, 0x4E061EB79B14FC60ULL, 0xCC409C6ED61424E4ULL,
+        0x3C3578C08811991BULL, 0xB42A6DEFC63716D2ULL, 0x445F89419832AB2DULL,
+        0xC6190B98D53273A9ULL, 0x366CEF368B37CE56ULL, 0x504CA101E03DDC24ULL,
+        0xA03945AFBE3861DBULL, 0x227FC776F338B95FULL, 0xD20A23D8AD3D04A0ULL,
+        0xEE3F5B18252C9DBBULL, 0x1E4ABFB67B292044ULL, 0x9C0C3D6F3629F8C0ULL,
+        0x6C79D9C1682C453FULL, 0x0A5997F60326574DULL, 0xFA2C73585D23EAB2ULL,
+        0x786AF18110233236ULL, 0x881F152F4E268FC9ULL, 0xFA8C74F423603321ULL,
+        0x0AF9905A7D658EDEULL, 0x88BF12833065565AULL, 0x78CAF62D6E60EBA5ULL,
+        0x1EEAB81A056AF9D7ULL, 0xEE9F5CB45B6F4428ULL, 0x6CD9DE6D166F9CACULL,
+        0x9CAC3AC3486A2153ULL, 0xA0994203C07BB848ULL, 0x50ECA6AD9E7E05B7ULL,
+        0xD2AA2474D37EDD33ULL, 0x22DFC0DA8D7B60CCULL, 0x44FF8EEDE67172BEULL,
+        0xB48A6A43B874CF41ULL, 0x36CCE89AF57417C5ULL, 0xC6B90C34AB71AA3AULL,
+        0x4EA6191BE55725F3ULL, 0xBED3FDB5BB52980CULL, 0x3C957F6CF6524088ULL,
+        0xCCE09BC2A857FD77ULL, 0xAAC0D5F5C35DEF05ULL, 0x5AB5315B9D5852FAULL,
+        0xD8F3B382D0588A7EULL, 0x2886572C8E5D3781ULL, 0x14B32FEC064CAE9AULL,
+        0xE4C6CB4258491365ULL, 0x6680499B1549CBE1ULL, 0x96F5AD354B4C761EULL,
+        0xF0D5E3022046646CULL, 0x00A007AC7E43D993ULL, 0x82E6857533430117ULL,
+        0x729361DB6D46BCE8ULL, 0x67C046C3E9CE78C7ULL, 0x97B5A26DB7CBC538ULL,
+        0x15F320B4FACB1DBCULL, 0xE586C41AA4CEA043ULL, 0x83A68A2DCFC4B231ULL,
+        0x73D36E8391C10FCEULL, 0xF195EC5ADCC1D74AULL, 0x01E008F482C46AB5ULL,
+        0x3DD570340AD5F3AEULL, 0xCDA0949A54D04E51ULL, 0x4FE6164319D096D5ULL,
+        0xBF93F2ED47D52B2AULL, 0xD9B3BCDA2CDF3958ULL, 0x29C6587472DA84A7ULL,
+        0xAB80DAAD3FDA5C23ULL, 0x5BF53E0361DFE1DCULL, 0xD3EA2B2C2FF96E15ULL,
+        0x239FCF8271FCD3EAULL, 0xA1D94D5B3CFC0B6EULL, 0x51ACA9F562F9B691ULL,
+        0x378CE7C209F3A4E3ULL, 0xC7F9036C57F6191CULL, 0x45BF81B51AF6C198ULL,
+        0xB5CA651B44F37C67ULL, 0x89FF1DDBCCE2E57CULL, 0x798AF97592E75883ULL,
+        0xFBCC7BACDFE78007ULL, 0x0BB99F0281E23DF8ULL, 0x6D99D135EAE82F8AULL,
+        0x9DEC359BB4ED9275ULL, 0x1FAAB742F9ED4AF1ULL, 0xEFDF53ECA7E8F70EULL,
+        0x9D4C3237CAAE4BE6ULL, 0x6D39D69994ABF619ULL, 0xEF7F5440D9AB2E9DULL,
+        0x1F0AB0EE87AE9362ULL, 0x792AFED9ECA48110ULL, 0x895F1A77B2A13CEFULL,
+        0x0B1998AEFFA1E46BULL, 0xFB6C7C00A1A45994ULL, 0xC75904C029B5C08FULL,
+        0x372CE06E77B07D70ULL, 0xB56A62B73AB0A5F4ULL, 0x451F861964B5180BULL,
+        0x233FC82E0FBF0A79ULL, 0xD34A2C8051BAB786ULL, 0x510CAE591CBA6F02ULL,
+        0xA1794AF742BFD2FDULL, 0x29665FD80C995D34ULL, 0xD913BB76529CE0CBULL,
+        0x5B5539AF1F9C384FULL, 0xAB20DD01419985B0ULL, 0xCD0093362A9397C2ULL,
+        0x3D75779874962A3DULL, 0xBF33F5413996F2B9ULL, 0x4F4611EF67934F46ULL,
+        0x7373692FEF82D65DULL, 0x83068D81B1876BA2ULL, 0x01400F58FC87B326ULL,
+        0xF135EBF6A2820ED9ULL, 0x9715A5C1C9881CABULL, 0x6760416F978DA154ULL,
+        0xE526C3B6DA8D79D0ULL, 0x155327188488C42FULL, 0xCF808D87D39CF18EULL,
+        0x3FF569298D994C71ULL, 0xBDB3EBF0C09994F5ULL, 0x4DC60F5E9E9C290AULL,
+        0x2BE64169F5963B78ULL, 0xDB93A5C7AB938687ULL, 0x59D5271EE6935E03ULL,
+        0xA9A0C3B0B896E3FCULL, 0x9595BB7030877AE7ULL, 0x65E05FDE6E82C718ULL,
+        0xE7A6DD0723821F9CULL, 0x17D339A97D87A263ULL, 0x71F3779E168DB011ULL,
+        0x8186933048880DEEULL, 0x03C011E90588D56AULL, 0xF3B5F5475B8D6895ULL,
+        0x7BAAE06815ABE75CULL, 0x8BDF04C64BAE5AA3ULL, 0x0999861F06AE8227ULL,
+        0xF9EC62B158AB3FD8ULL, 0x9FCC2C8633A12DAAULL, 0x6FB9C8286DA49055ULL,
+        0xEDFF4AF120A448D1ULL, 0x1D8AAE5F7EA1F52EULL, 0x21BFD69FF6B06C35ULL,
+        0xD1CA3231A8B5D1CAULL, 0x538CB0E8E5B5094EULL, 0xA3F95446BBB0B4B1ULL,
+        0xC5D91A71D0BAA6C3ULL, 0x35ACFEDF8EBF1B3CULL, 0xB7EA7C06C3BFC3B8ULL,
+        0x479F98A89DBA7E47ULL, 0x350CF973F0FCC2AFULL, 0xC5791DDDAEF97F50ULL,
+        0x473F9F04E3F9A7D4ULL, 0xB74A7BAABDFC1A2BULL, 0xD16A359DD6F60859ULL,
+        0x211FD13388F3B5A6ULL, 0xA35953EAC5F36D22ULL, 0x532CB7449BF6D0DDULL,
+        0x6F19CF8413E749C6ULL, 0x9F6C2B2A4DE2F439ULL, 0x1D2AA9F300E22CBDULL,
+        0xED5F4D5D5EE79142ULL, 0x8B7F036A35ED8330ULL, 0x7B0AE7C46BE83ECFULL,
+        0xF94C651D26E8E64BULL, 0x093981B378ED5BB4ULL, 0x8126949C36CBD47DULL,
+        0x7153703268CE6982ULL, 0xF315F2EB25CEB106ULL, 0x036016457BCB0CF9ULL,
+        0x6540587210C11E8BULL, 0x9535BCDC4EC4A374ULL, 0x17733E0503C47BF0ULL,
+        0xE706DAAB5DC1C60FULL, 0xDB33A26BD5D05F14ULL, 0x2B4646C58BD5E2EBULL,
+        0xA900C41CC6D53A6FULL, 0x597520B298D08790ULL, 0x3F556E85F3DA95E2ULL,
+        0xCF208A2BADDF281DULL, 0x4D6608F2E0DFF099ULL, 0xBD13EC5CBEDA4D66ULL,
+        0xA840CB443A528949ULL, 0x58352FEA645734B6ULL, 0xDA73AD332957EC32ULL,
+        0x2A06499D775251CDULL, 0x4C2607AA1C5843BFULL, 0xBC53E304425DFE40ULL,
+        0x3E1561DD0F5D26C4ULL, 0xCE60857351589B3BULL, 0xF255FDB3D9490220ULL,
+        0x0220191D874CBFDFULL, 0x80669BC4CA4C675BULL, 0x70137F6A9449DAA4ULL,
+        0x1633315DFF43C8D6ULL, 0xE646D5F3A1467529ULL, 0x6400572AEC46ADADULL,
+        0x9475B384B2431052ULL, 0x1C6AA6ABFC659F9BULL, 0xEC1F4205A2602264ULL,
+        0x6E59C0DCEF60FAE0ULL, 0x9E2C2472B165471FULL, 0xF80C6A45DA6F556DULL,
+        0x08798EEB846AE892ULL, 0x8A3F0C32C96A3016ULL, 0x7A4AE89C976F8DE9ULL,
+        0x467F905C1F7E14F2ULL, 0xB60A74F2417BA90DULL, 0x344CF62B0C7B7189ULL,
+        0xC4391285527ECC76ULL, 0xA2195CB23974DE04ULL, 0x526CB81C677163FBULL,
+        0xD02A3AC52A71BB7FULL, 0x205FDE6B74740680ULL, 0x52CCBFB01932BA68ULL,
+        0xA2B95B1E47370797ULL, 0x20FFD9C70A37DF13ULL, 0xD08A3D69543262ECULL,
+        0xB6AA735E3F38709EULL, 0x46DF97F0613DCD61ULL, 0xC49915292C3D15E5ULL,
+        0x34ECF1877238A81AULL, 0x08D98947FA293101ULL, 0xF8AC6DE9A42C8CFEULL,
+        0x7AEAEF30E92C547AULL, 0x8A9F0B9EB729E985ULL, 0xECBF45A9DC23FBF7ULL,
+        0x1CCAA10782264608ULL, 0x9E8C23DECF269E8CULL, 0x6EF9C77091232373ULL,
+        0xE6E6D25FDF05ACBAULL, 0x169336F181001145ULL, 0x94D5B428CC00C9C1ULL,
+        0x64A050869205743EULL, 0x02801EB1F90F664CULL, 0xF2F5FA1FA70ADBB3ULL,
+        0x70B378C6EA0A0337ULL, 0x80C69C68B40FBEC8ULL, 0xBCF3E4A83C1E27D3ULL,
+        0x4C860006621B9A2CULL, 0xCEC082DF2F1B42A8ULL, 0x3EB56671711EFF57ULL,
+        0x589528461A14ED25ULL, 0xA8E0CCE8441150DAULL, 0x2AA64E310911885EULL,
+        0xDAD3AA9F571435A1ULL
+    },
+    {
+        0x0000000000000000ULL, 0xE05DD497CA393AE4ULL, 0x526306043B7C6B4DULL,
+        0xB23ED293F14551A9ULL, 0xA4C60C0876F8D69AULL, 0x449BD89FBCC1EC7EULL,
+        0xF6A50A0C4D84BDD7ULL, 0x16F8DE9B87BD8733ULL, 0xDB54B73B42FFB3B1ULL,
+        0x3B0963AC88C68955ULL, 0x8937B13F7983D8FCULL, 0x696A65A8B3BAE218ULL,
+        0x7F92BB333407652BULL, 0x9FCF6FA4FE3E5FCFULL, 0x2DF1BD370F7B0E66ULL,
+        0xCDAC69A0C5423482ULL, 0x2471C15D2AF179E7ULL, 0xC42C15CAE0C84303ULL,
+        0x7612C759118D12AAULL, 0x964F13CEDBB4284EULL, 0x80B7CD555C09AF7DULL,
+        0x60EA19C296309599ULL, 0xD2D4CB516775C430ULL, 0x32891FC6AD4CFED4ULL,
+        0xFF257666680ECA56ULL, 0x1F78A2F1A237F0B2ULL, 0xAD4670625372A11BULL,
+        0x4D1BA4F5994B9BFFULL, 0x5BE37A6E1EF61CCCULL, 0xBBBEAEF9D4CF2628ULL,
+        0x09807C6A258A7781ULL, 0xE9DDA8FDEFB34D65ULL, 0x48E382BA55E2F3CEULL,
+        0xA8BE562D9FDBC92AULL, 0x1A8084BE6E9E9883ULL, 0xFADD5029A4A7A267ULL,
+        0xEC258EB2231A2554ULL, 0x0C785A25E9231FB0ULL, 0xBE4688B618664E19ULL,
+        0x5E1B5C21D25F74FDULL, 0x93B73581171D407FULL, 0x73EAE116DD247A9BULL,
+        0xC1D433852C612B32ULL, 0x2189E712E65811D6ULL, 0x3771398961E596E5ULL,
+        0xD72CED1EABDCAC01ULL, 0x65123F8D5A99FDA8ULL, 0x854FEB1A90A0C74CULL,
+        0x6C9243E77F138A29ULL, 0x8CCF9770B52AB0CDULL, 0x3EF145E3446FE164ULL,
+        0xDEAC91748E56DB80ULL, 0xC8544FEF09EB5CB3ULL, 0x28099B78C3D26657ULL,
+        0x9A3749EB329737FEULL, 0x7A6A9D7CF8AE0D1AULL, 0xB7C6F4DC3DEC3998ULL,
+        0x579B204BF7D5037CULL, 0xE5A5F2D8069052D5ULL, 0x05F8264FCCA96831ULL,
+        0x1300F8D44B14EF02ULL, 0xF35D2C43812DD5E6ULL, 0x4163FED07068844FULL,
+        0xA13E2A47BA51BEABULL, 0x91C70574ABC5E79CULL, 0x719AD1E361FCDD78ULL,
+        0xC3A4037090B98CD1ULL, 0x23F9D7E75A80B635ULL, 0x3501097CDD3D3106ULL,
+        0xD55CDDEB17040BE2ULL, 0x67620F78E6415A4BULL, 0x873FDBEF2C7860AFULL,
+        0x4A93B24FE93A542DULL, 0xAACE66D823036EC9ULL, 0x18F0B44BD2463F60ULL,
+        0xF8AD60DC187F0584ULL, 0xEE55BE479FC282B7ULL, 0x0E086AD055FBB853ULL,
+        0xBC36B843A4BEE9FAULL, 0x5C6B6CD46E87D31EULL, 0xB5B6C42981349E7BULL,
+        0x55EB10BE4B0DA49FULL, 0xE7D5C22DBA48F536ULL, 0x078816BA7071CFD2ULL,
+        0x1170C821F7CC48E1ULL, 0xF12D1CB63DF57205ULL, 0x4313CE25CCB023ACULL,
+        0xA34E1AB206891948ULL, 0x6EE27312C3CB2DCAULL, 0x8EBFA78509F2172EULL,
+        0x3C817516F8B74687ULL, 0xDCDCA181328E7C63ULL, 0xCA247F1AB533FB50ULL,
+        0x2A79AB8D7F0AC1B4ULL, 0x9847791E8E4F901DULL, 0x781AAD894476AAF9ULL,
+        0xD92487CEFE271452ULL, 0x39795359341E2EB6ULL, 0x8B4781CAC55B7F1FULL,
+        0x6B1A555D0F6245FBULL, 0x7DE28BC688DFC2C8ULL, 0x9DBF5F5142E6F82CULL,
+        0x2F818DC2B3A3A985ULL, 0xCFDC5955799A9361ULL, 0x027030F5BCD8A7E3ULL,
+        0xE22DE46276E19D07ULL, 0x501336F187A4CCAEULL, 0xB04EE2664D9DF64AULL,
+        0xA6B63CFDCA207179ULL, 0x46EBE86A00194B9DULL, 0xF4D53AF9F15C1A34ULL,
+        0x1488EE6E3B6520D0ULL, 0xFD554693D4D66DB5ULL, 0x1D0892041EEF5751ULL,
+        0xAF364097EFAA06F8ULL, 0x4F6B940025933C1CULL, 0x59934A9BA22EBB2FULL,
+        0xB9CE9E0C681781CBULL, 0x0BF04C9F9952D062ULL, 0xEBAD9808536BEA86ULL,
+        0x2601F1A89629DE04ULL, 0xC65C253F5C10E4E0ULL, 0x7462F7ACAD55B549ULL,
+        0x943F233B676C8FADULL, 0x82C7FDA0E0D1089EULL, 0x629A29372AE8327AULL,
+        0xD0A4FBA4DBAD63D3ULL, 0x30F92F3311945937ULL, 0xB156A5C2F885D1BDULL,
+        0x510B715532BCEB59ULL, 0xE335A3C6C3F9BAF0ULL, 0x0368775109C08014ULL,
+        0x1590A9CA8E7D0727ULL, 0xF5CD7D5D44443DC3ULL, 0x47F3AFCEB5016C6AULL,
+        0xA7AE7B597F38568EULL, 0x6A0212F9BA7A620CULL, 0x8A5FC66E704358E8ULL,
+        0x386114FD81060941ULL, 0xD83CC06A4B3F33A5ULL, 0xCEC41EF1CC82B496ULL,
+        0x2E99CA6606BB8E72ULL, 0x9CA718F5F7FEDFDBULL, 0x7CFACC623DC7E53FULL,
+        0x9527649FD274A85AULL, 0x757AB008184D92BEULL, 0xC744629BE908C317ULL,
+        0x2719B60C2331F9F3ULL, 0x31E16897A48C7EC0ULL, 0xD1BCBC006EB54424ULL,
+        0x63826E939FF0158DULL, 0x83DFBA0455C92F69ULL, 0x4E73D3A4908B1BEBULL,
+        0xAE2E07335AB2210FULL, 0x1C10D5A0ABF770A6ULL, 0xFC4D013761CE4A42ULL,
+        0xEAB5DFACE673CD71ULL, 0x0AE80B3B2C4AF795ULL, 0xB8D6D9A8DD0FA63CULL,
+        0x588B0D3F17369CD8ULL, 0xF9B52778AD672273ULL, 0x19E8F3EF675E1897ULL,
+        0xABD6217C961B493EULL, 0x4B8BF5EB5C2273DAULL, 0x5D732B70DB9FF4E9ULL,
+        0xBD2EFFE711A6CE0DULL, 0x0F102D74E0E39FA4ULL, 0xEF4DF9E32ADAA540ULL,
+        0x22E19043EF9891C2ULL, 0xC2BC44D425A1AB26ULL, 0x70829647D4E4FA8FULL,
+        0x90DF42D01EDDC06BULL, 0x86279C4B99604758ULL, 0x667A48DC53597DBCULL,
+        0xD4449A4FA21C2C15ULL, 0x34194ED8682516F1ULL, 0xDDC4E62587965B94ULL,
+        0x3D9932B24DAF6170ULL, 0x8FA7E021BCEA30D9ULL, 0x6FFA34B676D30A3DULL,
+        0x7902EA2DF16E8D0EULL, 0x995F3EBA3B57B7EAULL, 0x2B61EC29CA12E643ULL,
+        0xCB3C38BE002BDCA7ULL, 0x0690511EC569E825ULL, 0xE6CD85890F50D2C1ULL,
+        0x54F3571AFE158368ULL, 0xB4AE838D342CB98CULL, 0xA2565D16B3913EBFULL,
+        0x420B898179A8045BULL, 0xF0355B1288ED55F2ULL, 0x10688F8542D46F16ULL,
+        0x2091A0B653403621ULL, 0xC0CC742199790CC5ULL, 0x72F2A6B2683C5D6CULL,
+        0x92AF7225A2056788ULL, 0x8457ACBE25B8E0BBULL, 0x640A7829EF81DA5FULL,
+        0xD634AABA1EC48BF6ULL, 0x36697E2DD4FDB112ULL, 0xFBC5178D11BF8590ULL,
+        0x1B98C31ADB86BF74ULL, 0xA9A611892AC3EEDDULL, 0x49FBC51EE0FAD439ULL,
+        0x5F031B856747530AULL, 0xBF5ECF12AD7E69EEULL, 0x0D601D815C3B3847ULL,
+        0xED3DC916960202A3ULL, 0x04E061EB79B14FC6ULL, 0xE4BDB57CB3887522ULL,
+        0x568367EF42CD248BULL, 0xB6DEB37888F41E6FULL, 0xA0266DE30F49995CULL,
+        0x407BB974C570A3B8ULL, 0xF2456BE73435F211ULL, 0x1218BF70FE0CC8F5ULL,
+        0xDFB4D6D03B4EFC77ULL, 0x3FE90247F177C693ULL, 0x8DD7D0D40032973AULL,
+        0x6D8A0443CA0BADDEULL, 0x7B72DAD84DB62AEDULL, 0x9B2F0E4F878F1009ULL,
+        0x2911DCDC76CA41A0ULL, 0xC94C084BBCF37B44ULL, 0x6872220C06A2C5EFULL,
+        0x882FF69BCC9BFF0BULL, 0x3A1124083DDEAEA2ULL, 0xDA4CF09FF7E79446ULL,
+        0xCCB42E04705A1375ULL, 0x2CE9FA93BA632991ULL, 0x9ED728004B267838ULL,
+        0x7E8AFC97811F42DCULL, 0xB3269537445D765EULL, 0x537B41A08E644CBAULL,
+        0xE14593337F211D13ULL, 0x011847A4B51827F7ULL, 0x17E0993F32A5A0C4ULL,
+        0xF7BD4DA8F89C9A20ULL, 0x45839F3B09D9CB89ULL, 0xA5DE4BACC3E0F16DULL,
+        0x4C03E3512C53BC08ULL, 0xAC5E37C6E66A86ECULL, 0x1E60E555172FD745ULL,
+        0xFE3D31C2DD16EDA1ULL, 0xE8C5EF595AAB6A92ULL, 0x08983BCE90925076ULL,
+        0xBAA6E95D61D701DFULL, 0x5AFB3DCAABEE3B3BULL, 0x9757546A6EAC0FB9ULL,
+        0x770A80FDA495355DULL, 0xC534526E55D064F4ULL, 0x256986F99FE95E10ULL,
+        0x339158621854D923ULL, 0xD3CC8CF5D26DE3C7ULL, 0x61F25E662328B26EULL,
+        0x81AF8AF1E911888AULL
+    }
+};
+
+static const uint32_t crc32_x2n[32] =
+{
+    0x40000000, 0x20000000, 0x08000000, 0x00800000, 0x00008000, 0xEDB88320,
+    0xB1E6B092, 0xA06A2517, 0xED627DAE, 0x88D14467, 0xD7BBFE6A, 0xEC447F11,
+    0x8E7EA170, 0x6427800E, 0x4D47BAE0, 0x09FE548F, 0x83852D0F, 0x30362F1A,
+    0x7B5A9CC3, 0x31FEC169, 0x9FEC022A, 0x6C8DEDC4, 0x15D6874D, 0x5FDE7A4E,
+    0xBAD90E37, 0x2E4E5EEF, 0x4EABA214, 0xA8A472C0, 0x429A969E, 0x148D302A,
+    0xC40BA6D0, 0xC4E22C3C
+};
+
+static const uint64_t crc64_x2n[64] =
+{
+    0x4000000000000000ULL, 0x2000000000000000ULL, 0x0800000000000000ULL,
+    0x0080000000000000ULL, 0x0000800000000000ULL, 0x0000000080000000ULL,
+    0xC96C5795D7870F42ULL, 0x6D5F4AD7E3C3AFA0ULL, 0xD49F7E445077D8EAULL,
+    0x040FB02A53C216FAULL, 0x6BEC35957B9EF3A0ULL, 0xB0E3BB0658964AFEULL,
+    0x218578C7A2DFF638ULL, 0x6DBB920F24DD5CF2ULL, 0x7A140CFCDB4D5EB5ULL,
+    0x41B3705ECBC4057BULL, 0xD46AB656ACCAC1EAULL, 0x329BEDA6FC34FB73ULL,
+    0x51A4FCD4350B9797ULL, 0x314FA85637EFAE9DULL, 0xACF27E9A1518D512ULL,
+    0xFFE2A3388A4D8CE7ULL, 0x48B9697E60CC2E4EULL, 0xADA73CB78DD62460ULL,
+    0x3EA5454D8CE5C1BBULL, 0x5E84E3A6C70FEAF1ULL, 0x90FD49B66CBD81D1ULL,
+    0xE2943E0C1DB254E8ULL, 0xECFA6ADECA8834A1ULL, 0xF513E212593EE321ULL,
+    0xF36AE57331040916ULL, 0x63FBD333B87B6717ULL, 0xBD60F8E152F50B8BULL,
+    0xA5CE4A8299C1567DULL, 0x0BD445F0CBDB55EEULL, 0xFDD6824E20134285ULL,
+    0xCEAD8B6EBDA2227AULL, 0xE44B17E4F5D4FB5CULL, 0x9B29C81AD01CA7C5ULL,
+    0x1B4366E40FEA4055ULL, 0x27BCA1551AAE167BULL, 0xAA57BCD1B39A5690ULL,
+    0xD7FCE83FA1234DB9ULL, 0xCCE4986EFEA3FF8EULL, 0x3602A4D9E65341F1ULL,
+    0x722B1DA2DF516145ULL, 0xECFC3DDD3A08DA83ULL, 0x0FB96DCCA83507E6ULL,
+    0x125F2FE78D70F080ULL, 0x842F50B7651AA516ULL, 0x09BC34188CD9836FULL,
+    0xF43666C84196D909ULL, 0xB56FEB30C0DF6CCBULL, 0xAA66E04CE7F30958ULL,
+    0xB7B1187E9AF29547ULL, 0x113255F8476495DEULL, 0x8FB19F783095D77EULL,
+    0xAEC4AACC7C82B133ULL, 0xF64E6D09218428CFULL, 0x036A72EA5AC258A0ULL,
+    0x5235EF12EB7AAA6AULL, 0x2FED7B1685657853ULL, 0x8EF8951D46606FB5ULL,
+    0x9D58C1090F034D14ULL
+};
+
+static const uint64_t crc32_fold[4] =
+{
+    0x653D982200000000ULL, 0xCAD38E8F00000000ULL, 0x65673B4600000000ULL, 0x9BA54C6F00000000ULL
+};
+
+static const uint64_t crc64_fold[4] =
+{
+    0x6AE3EFBB9DD441F3ULL, 0x081F6054A7842DF4ULL, 0xE05DD497CA393AE4ULL, 0xDABE95AFC7875F40ULL
+};
+
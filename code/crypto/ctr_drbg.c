@@ -135,26 +135,13 @@ int block_cipher_df( uint8_t *output, const uint8_t *data, size_t data_len )
 int ctr_drbg_update_internal( ctr_drbg_context_t *ctx, const uint8_t data[CTR_DRBG_SEEDLEN] )
 {
     uint8_t tmp[CTR_DRBG_SEEDLEN];
-    uint8_t *p = tmp;
-    int i, j;
-
-    __stosb( tmp, 0, CTR_DRBG_SEEDLEN );
-
-    for( j = 0; j < CTR_DRBG_SEEDLEN; j += CTR_DRBG_BLOCKSIZE ) {
-        /*
-         * Increase counter
-         */
-        for( i = CTR_DRBG_BLOCKSIZE; i > 0; i-- )
-            if( ++ctx->counter[i - 1] != 0 )
-                break;
-
-        /*
-         * Crypt counter block
-         */
-        aes_crypt_ecb( &ctx->aes_ctx, AES_ENCRYPT, ctx->counter, p );
+    int i;
 
-        p += CTR_DRBG_BLOCKSIZE;
-    }
+    /*
+     * Crypt the next counter blocks
+     */
+    aes_crypt_ctr_blocks( &ctx->aes_ctx, ctx->counter,
+                          CTR_DRBG_SEEDLEN / CTR_DRBG_BLOCKSIZE, tmp );
 
     for (i = 0; i < CTR_DRBG_SEEDLEN; ++i) {
         tmp[i] ^= data[i];
@@ -166,6 +153,8 @@ int ctr_drbg_update_internal( ctr_drbg_context_t *ctx, const uint8_t data[CTR_DR
     aes_setkey_enc( &ctx->aes_ctx, tmp);
     __movsb( ctx->counter, tmp + CTR_DRBG_KEYSIZE, CTR_DRBG_BLOCKSIZE );
 
+    __stosb( tmp, 0, CTR_DRBG_SEEDLEN );
+
     return 0;
 }
 
@@ -225,10 +214,8 @@ int ctr_drbg_random_with_add(void *p_rng, uint8_t *output, size_t output_len, co
     int ret = 0;
     ctr_drbg_context_t *ctx = (ctr_drbg_context_t *) p_rng;
     uint8_t add_input[CTR_DRBG_SEEDLEN];
-    uint8_t *p = output;
     uint8_t tmp[CTR_DRBG_BLOCKSIZE];
-    int i;
-    size_t use_len;
+    size_t blocks;
 
     if (output_len > CTR_DRBG_MAX_REQUEST) {
         return(POLARSSL_ERR_CTR_DRBG_REQUEST_TOO_BIG);
@@ -253,28 +240,19 @@ int ctr_drbg_random_with_add(void *p_rng, uint8_t *output, size_t output_len, co
         ctr_drbg_update_internal( ctx, add_input );
     }
 
-    while (output_len > 0) {
-        /*
-         * Increase counter
-         */
-        for (i = CTR_DRBG_BLOCKSIZE; i > 0; --i) {
-            if (++ctx->counter[i - 1] != 0) {
-                break;
-            }
-        }
+    /*
+     * Whole blocks are written straight to the destination, all at once
+     */
+    blocks = output_len / CTR_DRBG_BLOCKSIZE;
+    aes_crypt_ctr_blocks( &ctx->aes_ctx, ctx->counter, blocks, output );
 
-        /*
-         * Crypt counter block
-         */
-        aes_crypt_ecb( &ctx->aes_ctx, AES_ENCRYPT, ctx->counter, tmp );
+    output += blocks * CTR_DRBG_BLOCKSIZE;
+    output_len -= blocks * CTR_DRBG_BLOCKSIZE;
 
-        use_len = (output_len > CTR_DRBG_BLOCKSIZE ) ? CTR_DRBG_BLOCKSIZE : output_len;
-        /*
-         * Copy random block to destination
-         */
-        __movsb( p, tmp, use_len );
-        p += use_len;
-        output_len -= use_len;
+    if (output_len > 0) {
+        aes_crypt_ctr_blocks( &ctx->aes_ctx, ctx->counter, 1, tmp );
+        __movsb( output, tmp, output_len );
+        __stosb( tmp, 0, CTR_DRBG_BLOCKSIZE );
     }
 
     ctr_drbg_update_internal( ctx, add_input );
@@ -288,3 +266,238 @@ int ctr_drbg_random( void *p_rng, uint8_t *output, size_t output_len )
 {
     return ctr_drbg_random_with_add( p_rng, output, output_len, NULL, 0 );
 }
+
+/*
+ * Buffered front end
+ */
+void ctr_drbg_buffer_init( ctr_drbg_buffer_t *buf, ctr_drbg_context_t *drbg )
+{
+    __stosb( buf, 0, sizeof( ctr_drbg_buffer_t ) );
+
+    buf->drbg = drbg;
+}
+
+void ctr_drbg_buffer_flush( ctr_drbg_buffer_t *buf )
+{
+    __stosb( buf->pool, 0, CTR_DRBG_POOL_SIZE );
+    buf->left = 0;
+}
+
+int ctr_drbg_buffered_random( void *p_rng, uint8_t *output, size_t output_len )
+{
+    int ret;
+    ctr_drbg_buffer_t *buf = (ctr_drbg_buffer_t *) p_rng;
+    uint8_t *p;
+    size_t use_len;
+
+    /*
+     * Prediction resistance asks for a reseed before every request, and
+     * large requests gain nothing from the pool
+     */
+    if( buf->drbg->prediction_resistance || output_len >= CTR_DRBG_POOL_SIZE / 2 )
+    {
+        while( output_len > 0 )
+        {
+            use_len = ( output_len > CTR_DRBG_MAX_REQUEST ) ?
+                      CTR_DRBG_MAX_REQUEST : output_len;
+
+            if( ( ret = ctr_drbg_random( buf->drbg, output, use_len ) ) != 0 )
+                return( ret );
+
+            output += use_len;
+            output_len -= use_len;
+        }
+
+        return( 0 );
+    }
+
+    while( output_len > 0 )
+    {
+        if( buf->left == 0 )
+        {
+            if( ( ret = ctr_drbg_random( buf->drbg, buf->pool,
+                                         CTR_DRBG_POOL_SIZE ) ) != 0 )
+                return( ret );
+
+            buf->left = CTR_DRBG_POOL_SIZE;
+        }
+
+        /*
+         * Serve from the end of the pool and wipe what was handed out
+         */
+        use_len = ( output_len > buf->left ) ? buf->left : output_len;
+        p = buf->pool + buf->left - use_len;
+
+        __movsb( output, p, use_len );
+        __stosb( p, 0, use_len );
+
+        buf->left -= use_len;
+        output += use_len;
+        output_len -= use_len;
+    }
+
+    return( 0 );
+}
+
+void ctr_drbg_buffer_free( ctr_drbg_buffer_t *buf )
+{
+    __stosb( buf, 0, sizeof( ctr_drbg_buffer_t ) );
+}
+
+/*
+ * Per-thread instances, linked so that ctr_drbg_thread_free() can reach
+ * those of threads that never released theirs
+ */
+typedef struct ctr_drbg_thread_s
+{
+    ctr_drbg_context_t drbg;
+    ctr_drbg_buffer_t buf;
+    struct ctr_drbg_thread_s *prev;
+    struct ctr_drbg_thread_s *next;
+}
+ctr_drbg_thread;
+
+int ctr_drbg_thread_init( ctr_drbg_thread_context_t *ctx,
+                          int (*f_entropy)(void *, uint8_t *, size_t),
+                          void *p_entropy,
+                          const uint8_t *custom,
+                          size_t len )
+{
+    if( len > CTR_DRBG_MAX_INPUT - 8 )
+        return( POLARSSL_ERR_CTR_DRBG_INPUT_TOO_BIG );
+
+    __stosb( ctx, 0, sizeof( ctr_drbg_thread_context_t ) );
+
+    if( async_key_create( &ctx->key ) != 0 )
+        return( POLARSSL_ERR_CTR_DRBG_MALLOC_FAILED );
+
+    ctx->f_entropy = f_entropy;
+    ctx->p_entropy = p_entropy;
+    ctx->reseed_interval = CTR_DRBG_RESEED_INTERVAL;
+
+    if( len > 0 )
+        __movsb( ctx->custom, custom, len );
+    ctx->custom_len = len;
+
+    mutex_init( &ctx->mutex );
+
+    return( 0 );
+}
+
+void ctr_drbg_thread_set_reseed_interval( ctr_drbg_thread_context_t *ctx,
+                                          int interval )
+{
+    ctx->reseed_interval = interval;
+}
+
+static void ctr_drbg_thread_wipe( ctr_drbg_thread *t )
+{
+    __stosb( t, 0, sizeof( ctr_drbg_thread ) );
+    memory_free( t );
+}
+
+static int ctr_drbg_thread_create( ctr_drbg_thread_context_t *ctx,
+                                   ctr_drbg_thread **thread )
+{
+    int ret;
+    ctr_drbg_thread *t;
+    uint8_t custom[CTR_DRBG_MAX_INPUT];
+    uint32_t id[2];
+
+    t = (ctr_drbg_thread *) memory_alloc( sizeof( ctr_drbg_thread ) );
+    if( t == NULL )
+        return( POLARSSL_ERR_CTR_DRBG_MALLOC_FAILED );
+
+    /*
+     * Thread and process ids keep the seed material of two instances apart
+     * even if the entropy source were to repeat itself
+     */
+    id[0] = (uint32_t) fn_GetCurrentThreadId();
+    id[1] = (uint32_t) fn_GetCurrentProcessId();
+
+    __movsb( custom, ctx->custom, ctx->custom_len );
+    __movsb( custom + ctx->custom_len, id, sizeof( id ) );
+
+    if( ( ret = ctr_drbg_init( &t->drbg, ctx->f_entropy, ctx->p_entropy,
+                               custom, ctx->custom_len + sizeof( id ) ) ) != 0 )
+    {
+        ctr_drbg_thread_wipe( t );
+        return( ret );
+    }
+
+    ctr_drbg_set_reseed_interval( &t->drbg, ctx->reseed_interval );
+    ctr_drbg_buffer_init( &t->buf, &t->drbg );
+
+    mutex_lock( &ctx->mutex );
+
+    t->prev = NULL;
+    t->next = ctx->list;
+    if( ctx->list != NULL )
+        ctx->list->prev = t;
+    ctx->list = t;
+
+    mutex_unlock( &ctx->mutex );
+
+    async_key_set( &ctx->key, t );
+
+    *thread = t;
+
+    return( 0 );
+}
+
+int ctr_drbg_thread_random( void *p_rng, uint8_t *output, size_t output_len )
+{
+    int ret;
+    ctr_drbg_thread_context_t *ctx = (ctr_drbg_thread_context_t *) p_rng;
+    ctr_drbg_thread *t;
+
+    t = (ctr_drbg_thread *) async_key_get( &ctx->key );
+
+    if( t == NULL &&
+        ( ret = ctr_drbg_thread_create( ctx, &t ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    return( ctr_drbg_buffered_random( &t->buf, output, output_len ) );
+}
+
+void ctr_drbg_thread_release( ctr_drbg_thread_context_t *ctx )
+{
+    ctr_drbg_thread *t;
+
+    if( ( t = (ctr_drbg_thread *) async_key_get( &ctx->key ) ) == NULL )
+        return;
+
+    async_key_set( &ctx->key, NULL );
+
+    mutex_lock( &ctx->mutex );
+
+    if( t->prev != NULL )
+        t->prev->next = t->next;
+    else
+        ctx->list = t->next;
+
+    if( t->next != NULL )
+        t->next->prev = t->prev;
+
+    mutex_unlock( &ctx->mutex );
+
+    ctr_drbg_thread_wipe( t );
+}
+
+void ctr_drbg_thread_free( ctr_drbg_thread_context_t *ctx )
+{
+    ctr_drbg_thread *cur, *next;
+
+    for( cur = ctx->list; cur != NULL; cur = next )
+    {
+        next = cur->next;
+        ctr_drbg_thread_wipe( cur );
+    }
+
+    async_key_delete( &ctx->key );
+    mutex_destroy( &ctx->mutex );
+
+    __stosb( ctx, 0, sizeof( ctr_drbg_thread_context_t ) );
+}
@@ -7,6 +7,7 @@
 #define POLARSSL_ERR_CTR_DRBG_REQUEST_TOO_BIG              -0x0036  /**< Too many random requested in single call. */
 #define POLARSSL_ERR_CTR_DRBG_INPUT_TOO_BIG                -0x0038  /**< Input too large (Entropy + additional). */
 #define POLARSSL_ERR_CTR_DRBG_FILE_IO_ERROR                -0x003A  /**< Read/write error in file. */
+#define POLARSSL_ERR_CTR_DRBG_MALLOC_FAILED                -0x0032  /**< Failed to allocate a per-thread instance. */
 
 #define CTR_DRBG_BLOCKSIZE          16      /**< Block size used by the cipher                  */
 #define CTR_DRBG_KEYSIZE            32      /**< Key size used by the cipher                    */
@@ -27,6 +28,7 @@
 #define CTR_DRBG_MAX_INPUT          256     /**< Maximum number of additional input bytes */
 #define CTR_DRBG_MAX_REQUEST        1024    /**< Maximum number of requested bytes per call */
 #define CTR_DRBG_MAX_SEED_INPUT     384     /**< Maximum size of (re)seed buffer */
+#define CTR_DRBG_POOL_SIZE          CTR_DRBG_MAX_REQUEST    /**< Bytes generated ahead by ctr_drbg_buffered_random() */
 
 /* \} name SECTION: Module settings */
 
@@ -57,6 +59,44 @@ typedef struct
     void *p_entropy;            /*!<  context for the entropy function */
 } ctr_drbg_context_t;
 
+/**
+ * \brief          Buffered front end to a CTR_DRBG context
+ *
+ * Small requests are served from a pool refilled with one
+ * CTR_DRBG_POOL_SIZE request, so that the generate and update steps are
+ * paid once per pool instead of once per call. The front end does no
+ * locking: give each thread its own, over its own CTR_DRBG context.
+ */
+typedef struct
+{
+    ctr_drbg_context_t *drbg;   /*!<  generator that refills the pool   */
+    size_t left;                /*!<  unread bytes at the start of pool */
+    uint8_t pool[CTR_DRBG_POOL_SIZE];   /*!<  pre-generated output      */
+} ctr_drbg_buffer_t;
+
+struct ctr_drbg_thread_s;
+
+/**
+ * \brief          Per-thread CTR_DRBG instances
+ *
+ * Each thread that calls ctr_drbg_thread_random() gets its own CTR_DRBG
+ * context and buffered front end, seeded from the shared entropy
+ * callback. Generating takes no lock; only seeding and reseeding go
+ * through the entropy callback, which must therefore be thread-safe (as
+ * entropy_func() is).
+ */
+typedef struct
+{
+    int (*f_entropy)(void *, uint8_t *, size_t);    /*!<  shared entropy source     */
+    void *p_entropy;                                /*!<  context for f_entropy     */
+    uint8_t custom[CTR_DRBG_MAX_INPUT];             /*!<  personalization string    */
+    size_t custom_len;                              /*!<  length of custom          */
+    int reseed_interval;                            /*!<  for new instances         */
+    async_key_t key;                                /*!<  instance of each thread   */
+    mutex_t mutex;                                  /*!<  guards the instance list  */
+    struct ctr_drbg_thread_s *list;                 /*!<  all live instances        */
+} ctr_drbg_thread_context_t;
+
 /**
  * \brief               CTR_DRBG initialization
  *
@@ -169,6 +209,116 @@ int ctr_drbg_random_with_add( void *p_rng,
  */
 int ctr_drbg_random( void *p_rng, uint8_t *output, size_t output_len );
 
+/**
+ * \brief               Set up a buffered front end (empty pool)
+ *
+ * \param buf           Front end to initialize
+ * \param drbg          Seeded CTR_DRBG context that refills the pool
+ */
+void ctr_drbg_buffer_init( ctr_drbg_buffer_t *buf, ctr_drbg_context_t *drbg );
+
+/**
+ * \brief               Wipe the bytes left in the pool
+ *
+ * Note: The pool holds output generated before any later call to
+ *       ctr_drbg_reseed() or ctr_drbg_update() on the underlying context;
+ *       flush it after these so that the next bytes come from the new state.
+ *
+ * \param buf           Buffered front end
+ */
+void ctr_drbg_buffer_flush( ctr_drbg_buffer_t *buf );
+
+/**
+ * \brief               Generate random from the pool
+ *
+ * Note: Requests of at least half the pool, and all requests while
+ *       prediction resistance is on, bypass the pool and go to the CTR_DRBG
+ *       context, split in CTR_DRBG_MAX_REQUEST chunks. Each refill is one
+ *       request, so reseeding still happens every reseed_interval requests.
+ *
+ * \param p_rng         Buffered front end (ctr_drbg_buffer_t)
+ * \param output        Buffer to fill
+ * \param output_len    Length of the buffer
+ *
+ * \return              0 if successful, or
+ *                      POLARSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED
+ */
+int ctr_drbg_buffered_random( void *p_rng, uint8_t *output, size_t output_len );
+
+/**
+ * \brief               Wipe a buffered front end
+ *
+ * \param buf           Buffered front end
+ */
+void ctr_drbg_buffer_free( ctr_drbg_buffer_t *buf );
+
+/**
+ * \brief               Set up per-thread CTR_DRBG instances. No instance is
+ *                      seeded before a thread first asks for random.
+ *
+ * \param ctx           Context to initialize
+ * \param f_entropy     Entropy callback, shared by all threads
+ *                      (e.g. entropy_func() over a master entropy context)
+ * \param p_entropy     Entropy context
+ * \param custom        Personalization data, followed in each thread by
+ *                      its thread and process ids (Can be NULL)
+ * \param len           Length of personalization data, at most
+ *                      CTR_DRBG_MAX_INPUT - 8
+ *
+ * \return              0 if successful,
+ *                      POLARSSL_ERR_CTR_DRBG_INPUT_TOO_BIG, or
+ *                      POLARSSL_ERR_CTR_DRBG_MALLOC_FAILED if no thread-local
+ *                      slot is left
+ */
+int ctr_drbg_thread_init( ctr_drbg_thread_context_t *ctx,
+                          int (*f_entropy)(void *, uint8_t *, size_t),
+                          void *p_entropy,
+                          const uint8_t *custom,
+                          size_t len );
+
+/**
+ * \brief               Set the reseed interval of the instances created
+ *                      from now on (Default: CTR_DRBG_RESEED_INTERVAL)
+ *
+ * \param ctx           Per-thread CTR_DRBG context
+ * \param interval      Reseed interval
+ */
+void ctr_drbg_thread_set_reseed_interval( ctr_drbg_thread_context_t *ctx,
+                                          int interval );
+
+/**
+ * \brief               Generate random from the calling thread's instance,
+ *                      creating and seeding it on first use
+ *                      (Thread-safe, lock-free once the instance exists)
+ *
+ * \param p_rng         Per-thread CTR_DRBG context
+ *                      (ctr_drbg_thread_context_t)
+ * \param output        Buffer to fill
+ * \param output_len    Length of the buffer
+ *
+ * \return              0 if successful,
+ *                      POLARSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED, or
+ *                      POLARSSL_ERR_CTR_DRBG_MALLOC_FAILED
+ */
+int ctr_drbg_thread_random( void *p_rng, uint8_t *output, size_t output_len );
+
+/**
+ * \brief               Wipe and free the calling thread's instance, if any.
+ *                      Threads that leave before ctr_drbg_thread_free()
+ *                      should call this first.
+ *
+ * \param ctx           Per-thread CTR_DRBG context
+ */
+void ctr_drbg_thread_release( ctr_drbg_thread_context_t *ctx );
+
+/**
+ * \brief               Wipe and free all instances. No thread may use the
+ *                      context any more.
+ *
+ * \param ctx           Per-thread CTR_DRBG context
+ */
+void ctr_drbg_thread_free( ctr_drbg_thread_context_t *ctx );
+
 
 /* Internal functions (do not call directly) */
 int ctr_drbg_init_entropy_len( ctr_drbg_context_t *, int (*)(void *, uint8_t *, size_t), void *, const uint8_t *, size_t, size_t );
@@ -2,13 +2,477 @@
 #include "config.h"
 #include "ecdh.h"
 
+#if defined(POLARSSL_ECP_DP_M255_ENABLED)
 /*
- * Generate public key: simple wrapper around ecp_gen_keypair
+ * X25519 (RFC 7748) on fixed-size field elements.
+ *
+ * Elements of GF(2^255 - 19) use ten 32-bit limbs in radix 2^25.5
+ * (alternately 26 and 25 bits), so that every partial product fits in
+ * 64 bits on 32-bit targets. Limbs are "carried" when they fit in their
+ * nominal width, give or take a few bits in limb 1; fe25519_add() and
+ * fe25519_sub() take carried inputs and produce outputs that are valid
+ * inputs for fe25519_mul() and fe25519_sq() but not for another add/sub.
+ */
+typedef uint32_t fe25519[10];
+
+#define FE25519_MASK26      0x03FFFFFF
+#define FE25519_MASK25      0x01FFFFFF
+
+/* 2 * p, limb by limb */
+static const fe25519 fe25519_2p =
+{
+    0x07FFFFDA, 0x03FFFFFE, 0x07FFFFFE, 0x03FFFFFE, 0x07FFFFFE,
+    0x03FFFFFE, 0x07FFFFFE, 0x03FFFFFE, 0x07FFFFFE, 0x03FFFFFE,
+};
+
+/*
+ * Propagate the carries of a 64-bit accumulator into a carried element
+ */
+static void fe25519_carry( fe25519 r, uint64_t h[10] )
+{
+    int i;
+    uint64_t c;
+
+    for( i = 0; i < 9; i += 2 )
+    {
+        c = h[i] >> 26;     h[i + 1] += c;  h[i] &= FE25519_MASK26;
+        c = h[i + 1] >> 25;
+        if( i < 8 )
+            h[i + 2] += c;
+        else
+            h[0] += c * 19;
+        h[i + 1] &= FE25519_MASK25;
+    }
+
+    c = h[0] >> 26;         h[1] += c;      h[0] &= FE25519_MASK26;
+
+    for( i = 0; i < 10; i++ )
+        r[i] = (uint32_t) h[i];
+}
+
+static void fe25519_copy( fe25519 r, const fe25519 a )
+{
+    int i;
+
+    for( i = 0; i < 10; i++ )
+        r[i] = a[i];
+}
+
+static void fe25519_add( fe25519 r, const fe25519 a, const fe25519 b )
+{
+    int i;
+
+    for( i = 0; i < 10; i++ )
+        r[i] = a[i] + b[i];
+}
+
+static void fe25519_sub( fe25519 r, const fe25519 a, const fe25519 b )
+{
+    int i;
+
+    for( i = 0; i < 10; i++ )
+        r[i] = a[i] + fe25519_2p[i] - b[i];
+}
+
+/*
+ * r = f * g: the columns of i + j >= 10 wrap around with a factor 19,
+ * and products of two odd limbs get a factor 2 (their weights sum to one
+ * bit more than the column weight)
+ */
+static void fe25519_mul( fe25519 r, const fe25519 f, const fe25519 g )
+{
+    int i;
+    uint32_t f2[10], g19[10];
+    uint64_t h[10];
+
+    for( i = 0; i < 10; i++ )
+    {
+        f2[i] = f[i] << ( i & 1 );
+        g19[i] = g[i] * 19;
+    }
+
+    h[0] = (uint64_t) f[0] * g[0] + (uint64_t) f2[1] * g19[9] +
+           (uint64_t) f[2] * g19[8] + (uint64_t) f2[3] * g19[7] +
+           (uint64_t) f[4] * g19[6] + (uint64_t) f2[5] * g19[5] +
+           (uint64_t) f[6] * g19[4] + (uint64_t) f2[7] * g19[3] +
+           (uint64_t) f[8] * g19[2] + (uint64_t) f2[9] * g19[1];
+    h[1] = (uint64_t) f[0] * g[1] + (uint64_t) f[1] * g[0] +
+           (uint64_t) f[2] * g19[9] + (uint64_t) f[3] * g19[8] +
+           (uint64_t) f[4] * g19[7] + (uint64_t) f[5] * g19[6] +
+           (uint64_t) f[6] * g19[5] + (uint64_t) f[7] * g19[4] +
+           (uint64_t) f[8] * g19[3] + (uint64_t) f[9] * g19[2];
+    h[2] = (uint64_t) f[0] * g[2] + (uint64_t) f2[1] * g[1] +
+           (uint64_t) f[2] * g[0] + (uint64_t) f2[3] * g19[9] +
+           (uint64_t) f[4] * g19[8] + (uint64_t) f2[5] * g19[7] +
+           (uint64_t) f[6] * g19[6] + (uint64_t) f2[7] * g19[5] +
+           (uint64_t) f[8] * g19[4] + (uint64_t) f2[9] * g19[3];
+    h[3] = (uint64_t) f[0] * g[3] + (uint64_t) f[1] * g[2] +
+           (uint64_t) f[2] * g[1] + (uint64_t) f[3] * g[0] +
+           (uint64_t) f[4] * g19[9] + (uint64_t) f[5] * g19[8] +
+           (uint64_t) f[6] * g19[7] + (uint64_t) f[7] * g19[6] +
+           (uint64_t) f[8] * g19[5] + (uint64_t) f[9] * g19[4];
+    h[4] = (uint64_t) f[0] * g[4] + (uint64_t) f2[1] * g[3] +
+           (uint64_t) f[2] * g[2] + (uint64_t) f2[3] * g[1] +
+           (uint64_t) f[4] * g[0] + (uint64_t) f2[5] * g19[9] +
+           (uint64_t) f[6] * g19[8] + (uint64_t) f2[7] * g19[7] +
+           (uint64_t) f[8] * g19[6] + (uint64_t) f2[9] * g19[5];
+    h[5] = (uint64_t) f[0] * g[5] + (uint64_t) f[1] * g[4] +
+           (uint64_t) f[2] * g[3] + (uint64_t) f[3] * g[2] +
+           (uint64_t) f[4] * g[1] + (uint64_t) f[5] * g[0] +
+           (uint64_t) f[6] * g19[9] + (uint64_t) f[7] * g19[8] +
+           (uint64_t) f[8] * g19[7] + (uint64_t) f[9] * g19[6];
+    h[6] = (uint64_t) f[0] * g[6] + (uint64_t) f2[1] * g[5] +
+           (uint64_t) f[2] * g[4] + (uint64_t) f2[3] * g[3] +
+           (uint64_t) f[4] * g[2] + (uint64_t) f2[5] * g[1] +
+           (uint64_t) f[6] * g[0] + (uint64_t) f2[7] * g19[9] +
+           (uint64_t) f[8] * g19[8] + (uint64_t) f2[9] * g19[7];
+    h[7] = (uint64_t) f[0] * g[7] + (uint64_t) f[1] * g[6] +
+           (uint64_t) f[2] * g[5] + (uint64_t) f[3] * g[4] +
+           (uint64_t) f[4] * g[3] + (uint64_t) f[5] * g[2] +
+           (uint64_t) f[6] * g[1] + (uint64_t) f[7] * g[0] +
+           (uint64_t) f[8] * g19[9] + (uint64_t) f[9] * g19[8];
+    h[8] = (uint64_t) f[0] * g[8] + (uint64_t) f2[1] * g[7] +
+           (uint64_t) f[2] * g[6] + (uint64_t) f2[3] * g[5] +
+           (uint64_t) f[4] * g[4] + (uint64_t) f2[5] * g[3] +
+           (uint64_t) f[6] * g[2] + (uint64_t) f2[7] * g[1] +
+           (uint64_t) f[8] * g[0] + (uint64_t) f2[9] * g19[9];
+    h[9] = (uint64_t) f[0] * g[9] + (uint64_t) f[1] * g[8] +
+           (uint64_t) f[2] * g[7] + (uint64_t) f[3] * g[6] +
+           (uint64_t) f[4] * g[5] + (uint64_t) f[5] * g[4] +
+           (uint64_t) f[6] * g[3] + (uint64_t) f[7] * g[2] +
+           (uint64_t) f[8] * g[1] + (uint64_t) f[9] * g[0];
+    fe25519_carry( r, h );
+}
+
+static void fe25519_sq( fe25519 r, const fe25519 f )
+{
+    int i;
+    uint32_t f2[10], f4[10], f19[10];
+    uint64_t h[10];
+
+    for( i = 0; i < 10; i++ )
+    {
+        f2[i] = f[i] << 1;
+        f4[i] = f[i] << 2;
+        f19[i] = f[i] * 19;
+    }
+
+    h[0] = (uint64_t) f[0] * f[0] + (uint64_t) f4[1] * f19[9] +
+           (uint64_t) f2[2] * f19[8] + (uint64_t) f4[3] * f19[7] +
+           (uint64_t) f2[4] * f19[6] + (uint64_t) f2[5] * f19[5];
+    h[1] = (uint64_t) f2[0] * f[1] + (uint64_t) f2[2] * f19[9] +
+           (uint64_t) f2[3] * f19[8] + (uint64_t) f2[4] * f19[7] +
+           (uint64_t) f2[5] * f19[6];
+    h[2] = (uint64_t) f2[0] * f[2] + (uint64_t) f2[1] * f[1] +
+           (uint64_t) f4[3] * f19[9] + (uint64_t) f2[4] * f19[8] +
+           (uint64_t) f4[5] * f19[7] + (uint64_t) f[6] * f19[6];
+    h[3] = (uint64_t) f2[0] * f[3] + (uint64_t) f2[1] * f[2] +
+           (uint64_t) f2[4] * f19[9] + (uint64_t) f2[5] * f19[8] +
+           (uint64_t) f2[6] * f19[7];
+    h[4] = (uint64_t) f2[0] * f[4] + (uint64_t) f4[1] * f[3] +
+           (uint64_t) f[2] * f[2] + (uint64_t) f4[5] * f19[9] +
+           (uint64_t) f2[6] * f19[8] + (uint64_t) f2[7] * f19[7];
+    h[5] = (uint64_t) f2[0] * f[5] + (uint64_t) f2[1] * f[4] +
+           (uint64_t) f2[2] * f[3] + (uint64_t) f2[6] * f19[9] +
+           (uint64_t) f2[7] * f19[8];
+    h[6] = (uint64_t) f2[0] * f[6] + (uint64_t) f4[1] * f[5] +
+           (uint64_t) f2[2] * f[4] + (uint64_t) f2[3] * f[3] +
+           (uint64_t) f4[7] * f19[9] + (uint64_t) f[8] * f19[8];
+    h[7] = (uint64_t) f2[0] * f[7] + (uint64_t) f2[1] * f[6] +
+           (uint64_t) f2[2] * f[5] + (uint64_t) f2[3] * f[4] +
+           (uint64_t) f2[8] * f19[9];
+    h[8] = (uint64_t) f2[0] * f[8] + (uint64_t) f4[1] * f[7] +
+           (uint64_t) f2[2] * f[6] + (uint64_t) f4[3] * f[5] +
+           (uint64_t) f[4] * f[4] + (uint64_t) f2[9] * f19[9];
+    h[9] = (uint64_t) f2[0] * f[9] + (uint64_t) f2[1] * f[8] +
+           (uint64_t) f2[2] * f[7] + (uint64_t) f2[3] * f[6] +
+           (uint64_t) f2[4] * f[5];
+    fe25519_carry( r, h );
+}
+
+/*
+ * r = a^(2^n)
+ */
+static void fe25519_sqn( fe25519 r, const fe25519 a, int n )
+{
+    fe25519_sq( r, a );
+    while( --n > 0 )
+        fe25519_sq( r, r );
+}
+
+/*
+ * r = a * 121665, the (A - 2) / 4 of RFC 7748
+ */
+static void fe25519_mul_a24( fe25519 r, const fe25519 a )
+{
+    int i;
+    uint64_t h[10];
+
+    for( i = 0; i < 10; i++ )
+        h[i] = (uint64_t) a[i] * 121665;
+
+    fe25519_carry( r, h );
+}
+
+/*
+ * r = a^(p - 2) = 1 / a, with the usual 254 squarings and 11 multiplications
+ */
+static void fe25519_inv( fe25519 r, const fe25519 a )
+{
+    fe25519 z2, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+    fe25519_sq( z2, a );
+    fe25519_sqn( t, z2, 2 );
+    fe25519_mul( t, t, a );                     /* z^9           */
+    fe25519_mul( z11, t, z2 );                  /* z^11          */
+    fe25519_sq( z2_5_0, z11 );
+    fe25519_mul( z2_5_0, z2_5_0, t );           /* z^(2^5 - 1)   */
+    fe25519_sqn( t, z2_5_0, 5 );
+    fe25519_mul( z2_10_0, t, z2_5_0 );          /* z^(2^10 - 1)  */
+    fe25519_sqn( t, z2_10_0, 10 );
+    fe25519_mul( z2_20_0, t, z2_10_0 );         /* z^(2^20 - 1)  */
+    fe25519_sqn( t, z2_20_0, 20 );
+    fe25519_mul( t, t, z2_20_0 );               /* z^(2^40 - 1)  */
+    fe25519_sqn( t, t, 10 );
+    fe25519_mul( z2_50_0, t, z2_10_0 );         /* z^(2^50 - 1)  */
+    fe25519_sqn( t, z2_50_0, 50 );
+    fe25519_mul( z2_100_0, t, z2_50_0 );        /* z^(2^100 - 1) */
+    fe25519_sqn( t, z2_100_0, 100 );
+    fe25519_mul( t, t, z2_100_0 );              /* z^(2^200 - 1) */
+    fe25519_sqn( t, t, 50 );
+    fe25519_mul( t, t, z2_50_0 );               /* z^(2^250 - 1) */
+    fe25519_sqn( t, t, 5 );
+    fe25519_mul( r, t, z11 );                   /* z^(2^255 - 21) */
+}
+
+/*
+ * Swap a and b if swap is 1, in constant time
+ */
+static void fe25519_cswap( fe25519 a, fe25519 b, uint32_t swap )
+{
+    int i;
+    uint32_t t, mask = 0 - swap;
+
+    for( i = 0; i < 10; i++ )
+    {
+        t = mask & ( a[i] ^ b[i] );
+        a[i] ^= t;
+        b[i] ^= t;
+    }
+}
+
+/*
+ * Load 255 bits, little endian; the top bit of s[31] is ignored
+ */
+static void fe25519_read( fe25519 r, const uint8_t s[32] )
+{
+    int i, w, bits = 0;
+    size_t j = 0;
+    uint64_t acc = 0;
+
+    for( i = 0; i < 10; i++ )
+    {
+        w = 26 - ( i & 1 );
+        while( bits < w )
+        {
+            acc |= (uint64_t) s[j++] << bits;
+            bits += 8;
+        }
+
+        r[i] = (uint32_t) acc & ( ( 1u << w ) - 1 );
+        acc >>= w;
+        bits -= w;
+    }
+}
+
+/*
+ * Store the canonical representative of a carried element, little endian
+ */
+static void fe25519_write( uint8_t s[32], const fe25519 a )
+{
+    int i, w, bits = 0;
+    size_t j = 0;
+    uint32_t h[10], q;
+    uint64_t acc = 0;
+
+    /* a < 2p, so q = 1 iff a >= p, i.e. iff a + 19 >= 2^255 */
+    q = ( a[0] + 19 ) >> 26;
+    for( i = 1; i < 10; i++ )
+        q = ( a[i] + q ) >> ( 26 - ( i & 1 ) );
+
+    fe25519_copy( h, a );
+    h[0] += 19 * q;
+    for( i = 0; i < 9; i++ )
+    {
+        w = 26 - ( i & 1 );
+        h[i + 1] += h[i] >> w;
+        h[i] &= ( 1u << w ) - 1;
+    }
+    h[9] &= FE25519_MASK25;
+
+    for( i = 0; i < 10; i++ )
+    {
+        acc |= (uint64_t) h[i] << bits;
+        bits += 26 - ( i & 1 );
+        while( bits >= 8 )
+        {
+            s[j++] = (uint8_t) acc;
+            acc >>= 8;
+            bits -= 8;
+        }
+    }
+    s[j] = (uint8_t) acc;
+}
+
+/*
+ * X25519 function (RFC 7748 sec. 5): Montgomery ladder on x/z coordinates
+ * with a constant-time conditional swap per scalar bit
+ */
+int ecdh_x25519( uint8_t out[32], const uint8_t k[32], const uint8_t u[32] )
+{
+    int t;
+    uint8_t e[32];
+    uint32_t b, swap = 0, nz = 0;
+    fe25519 x1, x2, z2, x3, z3, a, aa, bb, c, d, da, cb;
+
+    for( t = 0; t < 32; t++ )
+        e[t] = k[t];
+    e[0] &= 248;
+    e[31] &= 127;
+    e[31] |= 64;
+
+    fe25519_read( x1, u );
+    for( t = 0; t < 10; t++ )
+        x2[t] = z2[t] = z3[t] = 0;
+    x2[0] = z3[0] = 1;
+    fe25519_copy( x3, x1 );
+
+    for( t = 254; t >= 0; t-- )
+    {
+        b = ( e[t >> 3] >> ( t & 7 ) ) & 1;
+        swap ^= b;
+        fe25519_cswap( x2, x3, swap );
+        fe25519_cswap( z2, z3, swap );
+        swap = b;
+
+        fe25519_add( a, x2, z2 );
+        fe25519_sub( d, x2, z2 );               /* B                */
+        fe25519_sq( aa, a );
+        fe25519_sq( bb, d );
+        fe25519_add( c, x3, z3 );
+        fe25519_sub( z2, x3, z3 );              /* D                */
+        fe25519_mul( da, z2, a );
+        fe25519_mul( cb, c, d );
+
+        fe25519_add( x3, da, cb );
+        fe25519_sq( x3, x3 );
+        fe25519_sub( z3, da, cb );
+        fe25519_sq( z3, z3 );
+        fe25519_mul( z3, z3, x1 );
+
+        fe25519_mul( x2, aa, bb );
+        fe25519_sub( d, aa, bb );               /* E                */
+        fe25519_mul_a24( c, d );
+        fe25519_add( c, c, aa );
+        fe25519_mul( z2, d, c );
+    }
+
+    fe25519_cswap( x2, x3, swap );
+    fe25519_cswap( z2, z3, swap );
+
+    fe25519_inv( z2, z2 );
+    fe25519_mul( x2, x2, z2 );
+    fe25519_write( out, x2 );
+
+    /* All-zero output means u was of small order (RFC 7748 sec. 6.1) */
+    for( t = 0; t < 32; t++ )
+        nz |= out[t];
+
+    return( nz != 0 ? 0 : POLARSSL_ERR_ECP_BAD_INPUT_DATA );
+}
+
+/*
+ * X25519 with the base point u = 9
+ */
+int ecdh_x25519_base( uint8_t out[32], const uint8_t k[32] )
+{
+    int i;
+    uint8_t u[32];
+
+    u[0] = 9;
+    for( i = 1; i < 32; i++ )
+        u[i] = 0;
+
+    return( ecdh_x25519( out, k, u ) );
+}
+
+/*
+ * Key generation on Curve25519: same clamped scalars as ecp_gen_keypair(),
+ * public key computed by X25519
+ */
+static int ecdh_gen_public_x25519( mpi_t *d, ecp_point *Q,
+                                   int (*f_rng)(void *, uint8_t *, size_t),
+                                   void *p_rng )
+{
+    int ret;
+    uint8_t k[32], u[32];
+
+    MPI_CHK( f_rng( p_rng, k, sizeof( k ) ) );
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    MPI_CHK( ecdh_x25519_base( u, k ) );
+
+    MPI_CHK( mpi_read_binary_le( d, k, sizeof( k ) ) );
+    MPI_CHK( mpi_read_binary_le( &Q->X, u, sizeof( u ) ) );
+    MPI_CHK( mpi_lset( &Q->Z, 1 ) );
+    mpi_free( &Q->Y );
+
+cleanup:
+    __stosb( k, 0, sizeof( k ) );
+
+    return( ret );
+}
+
+/*
+ * Shared secret on Curve25519, checks as in ecdh_compute_shared()
+ */
+static int ecdh_compute_shared_x25519( const ecp_group *grp, mpi_t *z,
+                                       const ecp_point *Q, const mpi_t *d )
+{
+    int ret;
+    uint8_t k[32], u[32], s[32];
+
+    MPI_CHK( ecp_check_pubkey( grp, Q ) );
+    MPI_CHK( ecp_check_privkey( grp, d ) );
+
+    MPI_CHK( mpi_write_binary_le( d, k, sizeof( k ) ) );
+    MPI_CHK( mpi_write_binary_le( &Q->X, u, sizeof( u ) ) );
+    MPI_CHK( ecdh_x25519( s, k, u ) );
+    MPI_CHK( mpi_read_binary_le( z, s, sizeof( s ) ) );
+
+cleanup:
+    __stosb( k, 0, sizeof( k ) );
+    __stosb( s, 0, sizeof( s ) );
+
+    return( ret );
+}
+#endif /* POLARSSL_ECP_DP_M255_ENABLED */
+
+/*
+ * Generate public key: simple wrapper around ecp_gen_keypair,
+ * except for Curve25519 which has its own code path
  */
 int ecdh_gen_public( ecp_group *grp, mpi_t *d, ecp_point *Q,
                      int (*f_rng)(void *, uint8_t *, size_t),
                      void *p_rng )
 {
+#if defined(POLARSSL_ECP_DP_M255_ENABLED)
+    if( grp->id == POLARSSL_ECP_DP_M255 )
+        return( ecdh_gen_public_x25519( d, Q, f_rng, p_rng ) );
+#endif
+
     return ecp_gen_keypair( grp, d, Q, f_rng, p_rng );
 }
 
@@ -23,6 +487,12 @@ int ecdh_compute_shared( ecp_group *grp, mpi_t *z,
     int ret;
     ecp_point P;
 
+#if defined(POLARSSL_ECP_DP_M255_ENABLED)
+    if( grp->id == POLARSSL_ECP_DP_M255 )
+        return( ecdh_compute_shared_x25519( grp, z, Q, d ) );
+#endif
+
+    mpi_arena_begin();
     ecp_point_init( &P );
 
     /*
@@ -42,6 +512,7 @@ int ecdh_compute_shared( ecp_group *grp, mpi_t *z,
 
 cleanup:
     ecp_point_free( &P );
+    mpi_arena_end();
 
     return( ret );
 }
@@ -222,5 +693,12 @@ int ecdh_calc_secret( ecdh_context *ctx, size_t *olen,
         return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
 
     *olen = ctx->grp.pbits / 8 + ( ( ctx->grp.pbits % 8 ) != 0 );
+
+#if defined(POLARSSL_ECP_DP_M255_ENABLED)
+    /* X25519 output is used as is, little endian (RFC 8422 sec. 5.11) */
+    if( ctx->grp.id == POLARSSL_ECP_DP_M255 )
+        return mpi_write_binary_le( &ctx->z, buf, *olen );
+#endif
+
     return mpi_write_binary( &ctx->z, buf, *olen );
 }
@@ -71,6 +71,36 @@ int ecdh_compute_shared( ecp_group *grp, mpi_t *z,
                          int (*f_rng)(void *, uint8_t *, size_t),
                          void *p_rng );
 
+#if defined(POLARSSL_ECP_DP_M255_ENABLED)
+/**
+ * \brief           X25519 function (RFC 7748): out = k * u on Curve25519
+ *
+ * \param out       Destination, 32 bytes little endian u-coordinate
+ * \param k         Scalar, 32 bytes, clamped internally
+ * \param u         Input u-coordinate, 32 bytes little endian
+ *                  (most significant bit ignored)
+ *
+ * \return          0 if successful,
+ *                  POLARSSL_ERR_ECP_BAD_INPUT_DATA if the result is zero
+ *                  (u of small order)
+ *
+ * \note            Runs in constant time on fixed-size field elements.
+ *                  ecdh_gen_public() and ecdh_compute_shared() use it for
+ *                  POLARSSL_ECP_DP_M255 groups.
+ */
+int ecdh_x25519( uint8_t out[32], const uint8_t k[32], const uint8_t u[32] );
+
+/**
+ * \brief           X25519 with the base point: out = k * 9
+ *
+ * \param out       Destination, 32 bytes little endian public key
+ * \param k         Private key, 32 bytes, clamped internally
+ *
+ * \return          0 if successful
+ */
+int ecdh_x25519_base( uint8_t out[32], const uint8_t k[32] );
+#endif /* POLARSSL_ECP_DP_M255_ENABLED */
+
 /**
  * \brief           Initialize context
  *
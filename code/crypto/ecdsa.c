@@ -0,0 +1,440 @@
+#include "..\zmodule.h"
+#include "config.h"
+#include "ecdsa.h"
+#include "asn1write.h"
+
+/*
+ * Derive a suitable integer for group grp from a buffer of length len
+ * SEC1 4.1.3 step 5 aka SEC1 4.1.4 step 3
+ */
+static int derive_mpi( const ecp_group *grp, mpi_t *x,
+                       const uint8_t *buf, size_t blen )
+{
+    int ret;
+    size_t n_size = ( grp->nbits + 7 ) / 8;
+    size_t use_size = blen > n_size ? n_size : blen;
+
+    MPI_CHK( mpi_read_binary( x, buf, use_size ) );
+    if( use_size * 8 > grp->nbits )
+        MPI_CHK( mpi_shift_r( x, use_size * 8 - grp->nbits ) );
+
+    /* While at it, reduce modulo N */
+    if( mpi_cmp_mpi( x, &grp->N ) >= 0 )
+        MPI_CHK( mpi_sub_mpi( x, x, &grp->N ) );
+
+cleanup:
+    return( ret );
+}
+
+/*
+ * Rest of the signature once the nonce k and R = k G are known
+ * (SEC1 4.1.3 steps 4 to 6): r = xR mod n, s = (e + r d) / k mod n.
+ * Returns 1 if r or s is zero and another nonce is needed.
+ *
+ * With an RNG, both e + r d and k are multiplied by a random t before the
+ * inversion, so that k itself never goes through mpi_inv_mod().
+ */
+static int ecdsa_sign_finish( const ecp_group *grp, mpi_t *r, mpi_t *s,
+                              const mpi_t *d, const uint8_t *buf, size_t blen,
+                              const mpi_t *k, const ecp_point *R,
+                              int (*f_rng)(void *, uint8_t *, size_t),
+                              void *p_rng )
+{
+    int ret;
+    mpi_t e, t, kt;
+
+    mpi_init( &e ); mpi_init( &t ); mpi_init( &kt );
+
+    MPI_CHK( mpi_mod_mpi( r, &R->X, &grp->N ) );
+    if( mpi_cmp_int( r, 0 ) == 0 )
+    {
+        ret = 1;
+        goto cleanup;
+    }
+
+    MPI_CHK( derive_mpi( grp, &e, buf, blen ) );
+
+    if( f_rng != NULL )
+    {
+        MPI_CHK( mpi_fill_random( &t, ( grp->nbits + 7 ) / 8, f_rng, p_rng ) );
+        MPI_CHK( mpi_mod_mpi( &t, &t, &grp->N ) );
+    }
+
+    if( mpi_cmp_int( &t, 0 ) == 0 )
+        MPI_CHK( mpi_lset( &t, 1 ) );
+
+    MPI_CHK( mpi_mul_mpi( s, r, d ) );
+    MPI_CHK( mpi_add_mpi( &e, &e, s ) );
+    MPI_CHK( mpi_mul_mpi( &e, &e, &t ) );
+    MPI_CHK( mpi_mul_mpi( &kt, k, &t ) );
+    MPI_CHK( mpi_mod_mpi( &kt, &kt, &grp->N ) );
+    MPI_CHK( mpi_inv_mod( s, &kt, &grp->N ) );
+    MPI_CHK( mpi_mul_mpi( s, s, &e ) );
+    MPI_CHK( mpi_mod_mpi( s, s, &grp->N ) );
+
+    if( mpi_cmp_int( s, 0 ) == 0 )
+        ret = 1;
+
+cleanup:
+    mpi_free( &e ); mpi_free( &t ); mpi_free( &kt );
+
+    return( ret );
+}
+
+/*
+ * Compute ECDSA signature of a hashed message (SEC1 4.1.3)
+ * Obviously, compared to SEC1 4.1.3, we skip step 4 (hash message)
+ */
+int ecdsa_sign( ecp_group *grp, mpi_t *r, mpi_t *s,
+                const mpi_t *d, const uint8_t *buf, size_t blen,
+                int (*f_rng)(void *, uint8_t *, size_t), void *p_rng )
+{
+    int ret, tries = 0;
+    ecp_point R;
+    mpi_t k;
+
+    /* Fail cleanly on curves such as Curve25519 that can't be used for ECDSA */
+    if( grp->N.p == NULL )
+        return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
+
+    ecp_point_init( &R );
+    mpi_init( &k );
+
+    do
+    {
+        if( tries++ > 10 )
+        {
+            ret = POLARSSL_ERR_ECP_RANDOM_FAILED;
+            goto cleanup;
+        }
+
+        /*
+         * Steps 1-3: generate a suitable ephemeral keypair
+         */
+        MPI_CHK( ecp_gen_keypair( grp, &k, &R, f_rng, p_rng ) );
+
+        if( ( ret = ecdsa_sign_finish( grp, r, s, d, buf, blen, &k, &R,
+                                       f_rng, p_rng ) ) < 0 )
+            goto cleanup;
+    }
+    while( ret != 0 );
+
+cleanup:
+    ecp_point_free( &R );
+    mpi_free( &k );
+
+    return( ret );
+}
+
+/*
+ * HMAC_DRBG state used to derive the nonce, RFC 6979 section 3.2
+ */
+typedef struct
+{
+    md_context_t md;
+    size_t len;
+    uint8_t K[POLARSSL_MD_MAX_SIZE];
+    uint8_t V[POLARSSL_MD_MAX_SIZE];
+}
+ecdsa_det_state;
+
+/*
+ * K = HMAC_K(V || sep || x || h1), V = HMAC_K(V)
+ * Steps d-e and f-g, or step h.3 without x and h1
+ */
+static void ecdsa_det_update( ecdsa_det_state *st, uint8_t sep,
+                              const uint8_t *x, const uint8_t *h1,
+                              size_t rlen )
+{
+    md_hmac_starts( &st->md, st->K, st->len );
+    md_hmac_update( &st->md, st->V, st->len );
+    md_hmac_update( &st->md, &sep, 1 );
+    if( x != NULL )
+    {
+        md_hmac_update( &st->md, x, rlen );
+        md_hmac_update( &st->md, h1, rlen );
+    }
+    md_hmac_finish( &st->md, st->K );
+
+    md_hmac_starts( &st->md, st->K, st->len );
+    md_hmac_update( &st->md, st->V, st->len );
+    md_hmac_finish( &st->md, st->V );
+}
+
+/*
+ * Deterministic signature: same as ecdsa_sign() with k taken from
+ * HMAC_DRBG(int2octets(d) || bits2octets(h)) instead of the RNG
+ */
+int ecdsa_sign_det( ecp_group *grp, mpi_t *r, mpi_t *s,
+                    const mpi_t *d, const uint8_t *buf, size_t blen,
+                    md_type_t md_alg,
+                    int (*f_rng)(void *, uint8_t *, size_t), void *p_rng )
+{
+    int ret, tries = 0;
+    const md_info_t *md_info;
+    ecdsa_det_state st;
+    uint8_t x[POLARSSL_ECP_MAX_BYTES];
+    uint8_t h1[POLARSSL_ECP_MAX_BYTES];
+    uint8_t T[POLARSSL_ECP_MAX_BYTES + POLARSSL_MD_MAX_SIZE];
+    size_t rlen = ( grp->nbits + 7 ) / 8, tlen;
+    ecp_point R;
+    mpi_t k, h;
+
+    if( grp->N.p == NULL || ( md_info = md_info_from_type( md_alg ) ) == NULL )
+        return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
+
+    ecp_point_init( &R );
+    mpi_init( &k ); mpi_init( &h );
+    __stosb( &st, 0, sizeof( st ) );
+
+    MPI_CHK( md_init_ctx( &st.md, md_info ) );
+    st.len = md_get_size( md_info );
+
+    /*
+     * Steps b-c: V = 0x01 0x01 ... 0x01, K = 0x00 0x00 ... 0x00
+     */
+    __stosb( st.V, 0x01, st.len );
+
+    MPI_CHK( mpi_write_binary( d, x, rlen ) );
+    MPI_CHK( derive_mpi( grp, &h, buf, blen ) );
+    MPI_CHK( mpi_write_binary( &h, h1, rlen ) );
+
+    ecdsa_det_update( &st, 0x00, x, h1, rlen );
+    ecdsa_det_update( &st, 0x01, x, h1, rlen );
+
+    for( ;; )
+    {
+        /*
+         * Step h: T = V || V || ... until it has qlen bits, k = bits2int(T)
+         */
+        for( tlen = 0; tlen < rlen; tlen += st.len )
+        {
+            md_hmac_starts( &st.md, st.K, st.len );
+            md_hmac_update( &st.md, st.V, st.len );
+            md_hmac_finish( &st.md, st.V );
+            __movsb( T + tlen, st.V, st.len );
+        }
+
+        MPI_CHK( mpi_read_binary( &k, T, rlen ) );
+        if( rlen * 8 > grp->nbits )
+            MPI_CHK( mpi_shift_r( &k, rlen * 8 - grp->nbits ) );
+
+        if( ecp_check_privkey( grp, &k ) == 0 )
+        {
+            MPI_CHK( ecp_mul( grp, &R, &k, &grp->G, f_rng, p_rng ) );
+
+            if( ( ret = ecdsa_sign_finish( grp, r, s, d, buf, blen, &k, &R,
+                                           f_rng, p_rng ) ) <= 0 )
+                goto cleanup;
+        }
+
+        if( tries++ > 10 )
+        {
+            ret = POLARSSL_ERR_ECP_RANDOM_FAILED;
+            goto cleanup;
+        }
+
+        ecdsa_det_update( &st, 0x00, NULL, NULL, 0 );
+    }
+
+cleanup:
+    md_free_ctx( &st.md );
+    __stosb( &st, 0, sizeof( st ) );
+    __stosb( x, 0, sizeof( x ) );
+    __stosb( T, 0, sizeof( T ) );
+
+    ecp_point_free( &R );
+    mpi_free( &k ); mpi_free( &h );
+
+    return( ret );
+}
+
+/*
+ * Verify ECDSA signature of hashed message (SEC1 4.1.4)
+ * Obviously, compared to SEC1 4.1.3, we skip step 2 (hash message)
+ */
+int ecdsa_verify( ecp_group *grp,
+                  const uint8_t *buf, size_t blen,
+                  const ecp_point *Q, const mpi_t *r, const mpi_t *s )
+{
+    int ret;
+    mpi_t e, s_inv, u1, u2;
+    ecp_point R, P;
+
+    /* Fail cleanly on curves such as Curve25519 that can't be used for ECDSA */
+    if( grp->N.p == NULL )
+        return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
+
+    ecp_point_init( &R ); ecp_point_init( &P );
+    mpi_init( &e ); mpi_init( &s_inv ); mpi_init( &u1 ); mpi_init( &u2 );
+
+    /*
+     * Step 1: make sure r and s are in range 1..n-1
+     */
+    if( mpi_cmp_int( r, 1 ) < 0 || mpi_cmp_mpi( r, &grp->N ) >= 0 ||
+        mpi_cmp_int( s, 1 ) < 0 || mpi_cmp_mpi( s, &grp->N ) >= 0 )
+    {
+        ret = POLARSSL_ERR_ECP_VERIFY_FAILED;
+        goto cleanup;
+    }
+
+    /*
+     * Additional precaution: make sure Q is valid
+     */
+    MPI_CHK( ecp_check_pubkey( grp, Q ) );
+
+    /*
+     * Step 3: derive MPI from hashed message
+     */
+    MPI_CHK( derive_mpi( grp, &e, buf, blen ) );
+
+    /*
+     * Step 4: u1 = e / s mod n, u2 = r / s mod n
+     */
+    MPI_CHK( mpi_inv_mod( &s_inv, s, &grp->N ) );
+
+    MPI_CHK( mpi_mul_mpi( &u1, &e, &s_inv ) );
+    MPI_CHK( mpi_mod_mpi( &u1, &u1, &grp->N ) );
+
+    MPI_CHK( mpi_mul_mpi( &u2, r, &s_inv ) );
+    MPI_CHK( mpi_mod_mpi( &u2, &u2, &grp->N ) );
+
+    /*
+     * Step 5: R = u1 G + u2 Q
+     *
+     * Since we're not using any secret data, no need to pass a RNG to
+     * ecp_mul() for countermesures.
+     */
+    MPI_CHK( ecp_mul( grp, &R, &u1, &grp->G, NULL, NULL ) );
+    MPI_CHK( ecp_mul( grp, &P, &u2, Q, NULL, NULL ) );
+    MPI_CHK( ecp_add( grp, &R, &R, &P ) );
+
+    if( ecp_is_zero( &R ) )
+    {
+        ret = POLARSSL_ERR_ECP_VERIFY_FAILED;
+        goto cleanup;
+    }
+
+    /*
+     * Step 6: convert xR to an integer (no-op)
+     * Step 7: reduce xR mod n (gives v)
+     */
+    MPI_CHK( mpi_mod_mpi( &R.X, &R.X, &grp->N ) );
+
+    /*
+     * Step 8: check if v (that is, R.X) is equal to r
+     */
+    if( mpi_cmp_mpi( &R.X, r ) != 0 )
+    {
+        ret = POLARSSL_ERR_ECP_VERIFY_FAILED;
+        goto cleanup;
+    }
+
+cleanup:
+    ecp_point_free( &R ); ecp_point_free( &P );
+    mpi_free( &e ); mpi_free( &s_inv ); mpi_free( &u1 ); mpi_free( &u2 );
+
+    return( ret );
+}
+
+/*
+ * Convert a signature (given by context) to ASN.1
+ */
+static int ecdsa_signature_to_asn1( mpi_t *r, mpi_t *s,
+                                    uint8_t *sig, size_t *slen )
+{
+    int ret;
+    uint8_t buf[POLARSSL_ECDSA_MAX_LEN];
+    uint8_t *p = buf + sizeof( buf );
+    size_t len = 0;
+
+    ASN1_CHK_ADD( len, asn1_write_mpi( &p, buf, s ) );
+    ASN1_CHK_ADD( len, asn1_write_mpi( &p, buf, r ) );
+
+    ASN1_CHK_ADD( len, asn1_write_len( &p, buf, len ) );
+    ASN1_CHK_ADD( len, asn1_write_tag( &p, buf,
+                                       ASN1_CONSTRUCTED | ASN1_SEQUENCE ) );
+
+    __movsb( sig, p, len );
+    *slen = len;
+
+    return( 0 );
+}
+
+/*
+ * Compute and write signature
+ */
+int ecdsa_write_signature( ecdsa_context *ctx, md_type_t md_alg,
+                           const uint8_t *hash, size_t hlen,
+                           uint8_t *sig, size_t *slen,
+                           int (*f_rng)(void *, uint8_t *, size_t),
+                           void *p_rng )
+{
+    int ret;
+    mpi_t r, s;
+
+    mpi_init( &r ); mpi_init( &s );
+
+    if( md_alg != POLARSSL_MD_NONE )
+        MPI_CHK( ecdsa_sign_det( &ctx->grp, &r, &s, &ctx->d, hash, hlen,
+                                 md_alg, f_rng, p_rng ) );
+    else
+        MPI_CHK( ecdsa_sign( &ctx->grp, &r, &s, &ctx->d, hash, hlen,
+                             f_rng, p_rng ) );
+
+    MPI_CHK( ecdsa_signature_to_asn1( &r, &s, sig, slen ) );
+
+cleanup:
+    mpi_free( &r ); mpi_free( &s );
+
+    return( ret );
+}
+
+/*
+ * Read and check signature
+ */
+int ecdsa_read_signature( ecdsa_context *ctx,
+                          const uint8_t *hash, size_t hlen,
+                          const uint8_t *sig, size_t slen )
+{
+    int ret;
+    uint8_t *p = (uint8_t *) sig;
+    const uint8_t *end = sig + slen;
+    size_t len;
+    mpi_t r, s;
+
+    mpi_init( &r ); mpi_init( &s );
+
+    if( ( ret = asn1_get_tag( &p, end, &len,
+                    ASN1_CONSTRUCTED | ASN1_SEQUENCE ) ) != 0 )
+    {
+        ret += POLARSSL_ERR_ECP_BAD_INPUT_DATA;
+        goto cleanup;
+    }
+
+    if( p + len != end )
+    {
+        ret = POLARSSL_ERR_ECP_BAD_INPUT_DATA +
+              POLARSSL_ERR_ASN1_LENGTH_MISMATCH;
+        goto cleanup;
+    }
+
+    if( ( ret = asn1_get_mpi( &p, end, &r ) ) != 0 ||
+        ( ret = asn1_get_mpi( &p, end, &s ) ) != 0 )
+    {
+        ret += POLARSSL_ERR_ECP_BAD_INPUT_DATA;
+        goto cleanup;
+    }
+
+    if( ( ret = ecdsa_verify( &ctx->grp, hash, hlen,
+                              &ctx->Q, &r, &s ) ) != 0 )
+        goto cleanup;
+
+    if( p != end )
+        ret = POLARSSL_ERR_ECP_SIG_LEN_MISMATCH;
+
+cleanup:
+    mpi_free( &r ); mpi_free( &s );
+
+    return( ret );
+}
@@ -0,0 +1,139 @@
+#ifndef POLARSSL_ECDSA_H
+#define POLARSSL_ECDSA_H
+
+#include "ecp.h"
+#include "md.h"
+
+/**
+ * Maximum size of an ECDSA signature in bytes: SEQUENCE of two INTEGERs,
+ * each with a possible leading zero, for the largest supported group
+ */
+#define POLARSSL_ECDSA_MAX_LEN  ( 3 + 2 * ( 3 + POLARSSL_ECP_MAX_BYTES ) )
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief           ECDSA context structure
+ *
+ * \note            Same layout as an EC key pair, so that keys held by the
+ *                  PK layer are used in place.
+ */
+typedef ecp_keypair ecdsa_context;
+
+/**
+ * \brief           Compute ECDSA signature of a previously hashed message
+ *
+ * \param grp       ECP group
+ * \param r         First output integer
+ * \param s         Second output integer
+ * \param d         Private signing key
+ * \param buf       Message hash
+ * \param blen      Length of buf
+ * \param f_rng     RNG function
+ * \param p_rng     RNG parameter
+ *
+ * \return          0 if successful,
+ *                  or a POLARSSL_ERR_ECP_XXX or POLARSSL_MPI_XXX error code
+ */
+int ecdsa_sign( ecp_group *grp, mpi_t *r, mpi_t *s,
+                const mpi_t *d, const uint8_t *buf, size_t blen,
+                int (*f_rng)(void *, uint8_t *, size_t), void *p_rng );
+
+/**
+ * \brief           Compute ECDSA signature of a previously hashed message,
+ *                  with the nonce derived from the key and the hash
+ *                  (deterministic ECDSA, RFC 6979)
+ *
+ * \param grp       ECP group
+ * \param r         First output integer
+ * \param s         Second output integer
+ * \param d         Private signing key
+ * \param buf       Message hash
+ * \param blen      Length of buf
+ * \param md_alg    MD algorithm used to hash the message, also used for
+ *                  the HMAC that derives the nonce
+ * \param f_rng     RNG function, may be NULL (see notes)
+ * \param p_rng     RNG parameter
+ *
+ * \return          0 if successful,
+ *                  or a POLARSSL_ERR_ECP_XXX or POLARSSL_MPI_XXX error code
+ *
+ * \note            The signature only depends on d and buf. If f_rng is not
+ *                  NULL it is only used to blind the computations, see
+ *                  \c ecp_mul().
+ */
+int ecdsa_sign_det( ecp_group *grp, mpi_t *r, mpi_t *s,
+                    const mpi_t *d, const uint8_t *buf, size_t blen,
+                    md_type_t md_alg,
+                    int (*f_rng)(void *, uint8_t *, size_t), void *p_rng );
+
+/**
+ * \brief           Verify ECDSA signature of a previously hashed message
+ *
+ * \param grp       ECP group
+ * \param buf       Message hash
+ * \param blen      Length of buf
+ * \param Q         Public key to use for verification
+ * \param r         First integer of the signature
+ * \param s         Second integer of the signature
+ *
+ * \return          0 if successful,
+ *                  POLARSSL_ERR_ECP_VERIFY_FAILED if signature is invalid
+ *                  or a POLARSSL_ERR_ECP_XXX or POLARSSL_MPI_XXX error code
+ */
+int ecdsa_verify( ecp_group *grp,
+                  const uint8_t *buf, size_t blen,
+                  const ecp_point *Q, const mpi_t *r, const mpi_t *s );
+
+/**
+ * \brief           Compute ECDSA signature and write it to buffer,
+ *                  serialized as defined in RFC 4492 page 20.
+ *
+ * \param ctx       ECDSA context
+ * \param md_alg    MD algorithm used to hash the message. If not
+ *                  POLARSSL_MD_NONE, the nonce is derived as per RFC 6979,
+ *                  otherwise it is drawn from f_rng.
+ * \param hash      Message hash
+ * \param hlen      Length of hash
+ * \param sig       Buffer that will hold the signature, at least
+ *                  POLARSSL_ECDSA_MAX_LEN bytes
+ * \param slen      Length of the signature written
+ * \param f_rng     RNG function
+ * \param p_rng     RNG parameter
+ *
+ * \return          0 if successful,
+ *                  or a POLARSSL_ERR_ECP, POLARSSL_ERR_MPI or
+ *                  POLARSSL_ERR_ASN1 error code
+ */
+int ecdsa_write_signature( ecdsa_context *ctx, md_type_t md_alg,
+                           const uint8_t *hash, size_t hlen,
+                           uint8_t *sig, size_t *slen,
+                           int (*f_rng)(void *, uint8_t *, size_t),
+                           void *p_rng );
+
+/**
+ * \brief           Read and verify an ECDSA signature
+ *
+ * \param ctx       ECDSA context
+ * \param hash      Message hash
+ * \param hlen      Size of hash
+ * \param sig       Signature to read and verify
+ * \param slen      Size of sig
+ *
+ * \return          0 if successful,
+ *                  POLARSSL_ERR_ECP_VERIFY_FAILED if signature is invalid,
+ *                  POLARSSL_ERR_ECP_SIG_LEN_MISMATCH if the signature is
+ *                  valid but its actual length is less than slen,
+ *                  or a POLARSSL_ERR_ECP or POLARSSL_ERR_MPI error code
+ */
+int ecdsa_read_signature( ecdsa_context *ctx,
+                          const uint8_t *hash, size_t hlen,
+                          const uint8_t *sig, size_t slen );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ecdsa.h */
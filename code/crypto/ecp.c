@@ -2,6 +2,7 @@
 #include "config.h"
 
 #include "ecp.h"
+#include "ecp_nist.h"
 
 #if defined(POLARSSL_ECP_DP_SECP192R1_ENABLED) ||   \
     defined(POLARSSL_ECP_DP_SECP224R1_ENABLED) ||   \
@@ -43,9 +44,15 @@ typedef enum
  *
  * Curves are listed in order: largest curves first, and for a given size,
  * fastest curves first. This provides the default order for the SSL module.
+ * Curve25519 is the exception: it has a dedicated X25519 implementation in
+ * ecdh.c that is much faster than any of the others, so it comes first
+ * (TLS NamedGroup x25519, RFC 8422 sec. 5.1.1).
  */
 static const ecp_curve_info ecp_supported_curves[] =
 {
+#if defined(POLARSSL_ECP_DP_M255_ENABLED)
+    { POLARSSL_ECP_DP_M255,         29,     256,    "x25519"            },
+#endif
 #if defined(POLARSSL_ECP_DP_SECP521R1_ENABLED)
     { POLARSSL_ECP_DP_SECP521R1,    25,     521,    "secp521r1"         },
 #endif
@@ -358,6 +365,24 @@ int ecp_point_write_binary( const ecp_group *grp, const ecp_point *P,
         format != POLARSSL_ECP_PF_COMPRESSED )
         return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
 
+    plen = mpi_size( &grp->P );
+
+#if defined(POLARSSL_ECP_MONTGOMERY)
+    /*
+     * Montgomery curves: X only, little endian (RFC 7748 sec. 5),
+     * whatever the requested format
+     */
+    if( ecp_get_type( grp ) == POLARSSL_ECP_TYPE_MONTGOMERY )
+    {
+        *olen = plen;
+
+        if( buflen < *olen )
+            return( POLARSSL_ERR_ECP_BUFFER_TOO_SMALL );
+
+        return( mpi_write_binary_le( &P->X, buf, plen ) );
+    }
+#endif
+
     /*
      * Common case: P == 0
      */
@@ -372,8 +397,6 @@ int ecp_point_write_binary( const ecp_group *grp, const ecp_point *P,
         return( 0 );
     }
 
-    plen = mpi_size( &grp->P );
-
     if( format == POLARSSL_ECP_PF_UNCOMPRESSED )
     {
         *olen = 2 * plen + 1;
@@ -411,6 +434,22 @@ int ecp_point_read_binary( const ecp_group *grp, ecp_point *pt, const uint8_t *b
     if (ilen < 1)
         return(POLARSSL_ERR_ECP_BAD_INPUT_DATA);
 
+    plen = mpi_size( &grp->P );
+
+#if defined(POLARSSL_ECP_MONTGOMERY)
+    if( ecp_get_type( grp ) == POLARSSL_ECP_TYPE_MONTGOMERY )
+    {
+        if( ilen != plen )
+            return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
+
+        MPI_CHK( mpi_read_binary_le( &pt->X, buf, plen ) );
+        MPI_CHK( mpi_lset( &pt->Z, 1 ) );
+        mpi_free( &pt->Y );
+
+        return( 0 );
+    }
+#endif
+
     if( buf[0] == 0x00 )
     {
         if( ilen == 1 )
@@ -419,8 +458,6 @@ int ecp_point_read_binary( const ecp_group *grp, ecp_point *pt, const uint8_t *b
             return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
     }
 
-    plen = mpi_size( &grp->P );
-
     if( buf[0] != 0x04 )
         return( POLARSSL_ERR_ECP_FEATURE_UNAVAILABLE );
 
@@ -1071,11 +1108,20 @@ cleanup:
 #error "POLARSSL_ECP_WINDOW_SIZE out of bounds"
 #endif
 
+#if POLARSSL_ECP_FIXED_WINDOW_SIZE < 2 || POLARSSL_ECP_FIXED_WINDOW_SIZE > 7
+#error "POLARSSL_ECP_FIXED_WINDOW_SIZE out of bounds"
+#endif
+
 /* d = ceil( n / w ) */
 #define COMB_MAX_D      ( POLARSSL_ECP_MAX_BITS + 1 ) / 2
 
 /* number of precomputed points */
+#if POLARSSL_ECP_FIXED_POINT_OPTIM == 1 && \
+    POLARSSL_ECP_FIXED_WINDOW_SIZE > POLARSSL_ECP_WINDOW_SIZE
+#define COMB_MAX_PRE    ( 1 << ( POLARSSL_ECP_FIXED_WINDOW_SIZE - 1 ) )
+#else
 #define COMB_MAX_PRE    ( 1 << ( POLARSSL_ECP_WINDOW_SIZE - 1 ) )
+#endif
 
 /*
  * Compute the representation of m that will be used with our comb method.
@@ -1251,6 +1297,129 @@ cleanup:
     return( ret );
 }
 
+/*
+ * Initialize a point kept after the current bignum scratch scope: the
+ * pre-computed tables built inside ecp_mul() and cached
+ */
+static void ecp_point_init_persistent( ecp_point *pt )
+{
+    mpi_init_persistent( &pt->X );
+    mpi_init_persistent( &pt->Y );
+    mpi_init_persistent( &pt->Z );
+}
+
+#if POLARSSL_ECP_FIXED_POINT_OPTIM == 1
+/*
+ * Process-wide comb tables for the generators of the known groups.
+ *
+ * A table is built on first use, under ecp_comb_cache_mutex, with the wider
+ * POLARSSL_ECP_FIXED_WINDOW_SIZE, and is only read afterwards. T is
+ * published last, so a reader seeing it non-NULL also sees w.
+ */
+typedef struct
+{
+    ecp_point * volatile T;     /*!<  pre-computed points, or NULL      */
+    uint8_t w;                  /*!<  comb width used to build T        */
+}
+ecp_comb_cache_entry;
+
+#define ECP_COMB_CACHE_SIZE     ( POLARSSL_ECP_DP_SECP256K1 + 1 )
+
+static ecp_comb_cache_entry ecp_comb_cache[ECP_COMB_CACHE_SIZE];
+static mutex_t ecp_comb_cache_mutex;
+static async_once_t ecp_comb_cache_once = ASYNC_ONCE_INIT;
+
+static void ecp_comb_cache_init( void )
+{
+    mutex_init( &ecp_comb_cache_mutex );
+}
+
+/*
+ * Get the shared table for the generator of a known group, building it if
+ * needed. Only valid when grp was set with ecp_use_known_dp().
+ */
+static int ecp_comb_cache_get( const ecp_group *grp,
+                               const ecp_point **T, uint8_t *w )
+{
+    int ret = 0;
+    ecp_comb_cache_entry *entry = &ecp_comb_cache[grp->id];
+    ecp_point *TT;
+    uint8_t ww, i, pre_len;
+
+    if( entry->T == NULL )
+    {
+        async_once( &ecp_comb_cache_once, ecp_comb_cache_init );
+        mutex_lock( &ecp_comb_cache_mutex );
+
+        if( entry->T == NULL )
+        {
+            ww = POLARSSL_ECP_FIXED_WINDOW_SIZE;
+            if( ww >= grp->nbits )
+                ww = 2;
+            pre_len = 1U << ( ww - 1 );
+
+            TT = (ecp_point *) memory_alloc( pre_len * sizeof( ecp_point ) );
+            if( TT == NULL )
+                ret = POLARSSL_ERR_ECP_MALLOC_FAILED;
+            else
+            {
+                for( i = 0; i < pre_len; i++ )
+                    ecp_point_init_persistent( &TT[i] );
+
+                ret = ecp_precompute_comb( grp, TT, &grp->G, ww,
+                                           ( grp->nbits + ww - 1 ) / ww );
+                if( ret != 0 )
+                {
+                    for( i = 0; i < pre_len; i++ )
+                        ecp_point_free( &TT[i] );
+                    memory_free( TT );
+                }
+                else
+                {
+                    entry->w = ww;
+                    entry->T = TT;
+                }
+            }
+        }
+
+        mutex_unlock( &ecp_comb_cache_mutex );
+
+        if( ret != 0 )
+            return( ret );
+    }
+
+    *T = entry->T;
+    *w = entry->w;
+
+    return( 0 );
+}
+
+/*
+ * Free the shared tables
+ */
+void ecp_comb_cache_free( void )
+{
+    size_t i, j;
+    ecp_point *T;
+
+    for( i = 0; i < ECP_COMB_CACHE_SIZE; i++ )
+    {
+        if( ( T = ecp_comb_cache[i].T ) == NULL )
+            continue;
+
+        for( j = 0; j < ( 1U << ( ecp_comb_cache[i].w - 1 ) ); j++ )
+            ecp_point_free( &T[j] );
+        memory_free( T );
+
+        ecp_comb_cache[i].T = NULL;
+    }
+}
+#else
+void ecp_comb_cache_free( void )
+{
+}
+#endif /* POLARSSL_ECP_FIXED_POINT_OPTIM */
+
 /*
  * Multiplication using the comb method,
  * for curves in short Weierstrass form
@@ -1264,7 +1433,8 @@ static int ecp_mul_comb( ecp_group *grp, ecp_point *R,
     uint8_t w, m_is_odd, p_eq_g, pre_len, i;
     size_t d;
     uint8_t k[COMB_MAX_D + 1];
-    ecp_point *T;
+    ecp_point *T = NULL;
+    const ecp_point *TC = NULL;
     mpi_t M, mm;
 
     mpi_init( &M );
@@ -1304,6 +1474,18 @@ static int ecp_mul_comb( ecp_group *grp, ecp_point *R,
     if( w >= grp->nbits )
         w = 2;
 
+#if POLARSSL_ECP_FIXED_POINT_OPTIM == 1
+    /*
+     * The generator of a known group uses the shared table, which sets
+     * its own (larger) w.
+     */
+    if( p_eq_g && grp->id > POLARSSL_ECP_DP_NONE &&
+        grp->id < ECP_COMB_CACHE_SIZE )
+    {
+        MPI_CHK( ecp_comb_cache_get( grp, &TC, &w ) );
+    }
+#endif
+
     /* Other sizes that depend on w */
     pre_len = 1U << ( w - 1 );
     d = ( grp->nbits + w - 1 ) / w;
@@ -1312,9 +1494,10 @@ static int ecp_mul_comb( ecp_group *grp, ecp_point *R,
      * Prepare precomputed points: if P == G we want to
      * use grp->T if already initialized, or initialize it.
      */
-    T = p_eq_g ? grp->T : NULL;
+    if( TC == NULL )
+        TC = T = p_eq_g ? grp->T : NULL;
 
-    if( T == NULL )
+    if( TC == NULL )
     {
         T = (ecp_point *) memory_alloc( pre_len * sizeof( ecp_point ) );
         if( T == NULL )
@@ -1323,8 +1506,14 @@ static int ecp_mul_comb( ecp_group *grp, ecp_point *R,
             goto cleanup;
         }
 
+        /* grp->T is kept after the scope of ecp_mul() */
         for( i = 0; i < pre_len; i++ )
-            ecp_point_init( &T[i] );
+        {
+            if( p_eq_g )
+                ecp_point_init_persistent( &T[i] );
+            else
+                ecp_point_init( &T[i] );
+        }
 
         MPI_CHK( ecp_precompute_comb( grp, T, P, w, d ) );
 
@@ -1333,6 +1522,8 @@ static int ecp_mul_comb( ecp_group *grp, ecp_point *R,
             grp->T = T;
             grp->T_size = pre_len;
         }
+
+        TC = T;
     }
 
     /*
@@ -1348,7 +1539,7 @@ static int ecp_mul_comb( ecp_group *grp, ecp_point *R,
      * Go for comb multiplication, R = M * P
      */
     ecp_comb_fixed( k, d, w, &M );
-    MPI_CHK( ecp_mul_comb_core( grp, R, T, pre_len, k, d, f_rng, p_rng ) );
+    MPI_CHK( ecp_mul_comb_core( grp, R, TC, pre_len, k, d, f_rng, p_rng ) );
 
     /*
      * Now get m * P from M * P and normalize it
@@ -1574,15 +1765,28 @@ int ecp_mul( ecp_group *grp, ecp_point *R,
         ( ret = ecp_check_pubkey( grp, P ) ) != 0 )
         return( ret );
 
+    mpi_arena_begin();
+
 #if defined(POLARSSL_ECP_MONTGOMERY)
     if( ecp_get_type( grp ) == POLARSSL_ECP_TYPE_MONTGOMERY )
-        return( ecp_mul_mxz( grp, R, m, P, f_rng, p_rng ) );
+        ret = ecp_mul_mxz( grp, R, m, P, f_rng, p_rng );
+    else
+#endif
+#if defined(POLARSSL_ECP_NIST_FIXED)
+    if( ecp_nist_can_mul( grp ) )
+        ret = ecp_nist_mul( grp, R, m, P, f_rng, p_rng );
+    else
 #endif
 #if defined(POLARSSL_ECP_SHORT_WEIERSTRASS)
     if( ecp_get_type( grp ) == POLARSSL_ECP_TYPE_SHORT_WEIERSTRASS )
-        return( ecp_mul_comb( grp, R, m, P, f_rng, p_rng ) );
+        ret = ecp_mul_comb( grp, R, m, P, f_rng, p_rng );
+    else
 #endif
-    return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
+        ret = POLARSSL_ERR_ECP_BAD_INPUT_DATA;
+
+    mpi_arena_end();
+
+    return( ret );
 }
 
 #if defined(POLARSSL_ECP_SHORT_WEIERSTRASS)
@@ -199,6 +199,20 @@ ecp_keypair;
 #define POLARSSL_ECP_FIXED_POINT_OPTIM  1   /**< Enable fixed-point speed-up */
 #endif
 
+#if !defined(POLARSSL_ECP_FIXED_WINDOW_SIZE)
+/*
+ * Window size of the generator tables shared by all groups loaded with
+ * ecp_use_known_dp() (with FIXED_POINT_OPTIM = 1).
+ * Default: 7.
+ * Minimum value: 2. Maximum value: 7.
+ *
+ * One table of 2^(w-1) points is built per curve on first use and kept
+ * until ecp_comb_cache_free(). A larger window means fewer doublings and
+ * additions per multiplication of the generator.
+ */
+#define POLARSSL_ECP_FIXED_WINDOW_SIZE  7   /**< Window size for shared tables */
+#endif
+
 /* \} name SECTION: Module settings */
 
 /*
@@ -353,6 +367,9 @@ int ecp_point_read_string( ecp_point *P, int radix,
  * \return          0 if successful,
  *                  or POLARSSL_ERR_ECP_BAD_INPUT_DATA
  *                  or POLARSSL_ERR_ECP_BUFFER_TOO_SMALL
+ *
+ * \note            For Montgomery curves only X is written, little endian,
+ *                  as in RFC 7748; format is checked but otherwise ignored.
  */
 int ecp_point_write_binary( const ecp_group *grp, const ecp_point *P,
                             int format, size_t *olen,
@@ -375,6 +392,9 @@ int ecp_point_write_binary( const ecp_group *grp, const ecp_point *P,
  * \note            This function does NOT check that the point actually
  *                  belongs to the given group, see ecp_check_pubkey() for
  *                  that.
+ *
+ * \note            For Montgomery curves the input must be X alone, little
+ *                  endian, as in RFC 7748.
  */
 int ecp_point_read_binary( const ecp_group *grp, ecp_point *P,
                            const uint8_t *buf, size_t ilen );
@@ -511,6 +531,9 @@ int ecp_sub( const ecp_group *grp, ecp_point *R,
  * \brief           Multiplication by an integer: R = m * P
  *                  (Not thread-safe to use same group in multiple threads)
  *
+ *                  Multiplications of the generator of a group set with
+ *                  ecp_use_known_dp() use a table shared by all threads.
+ *
  * \param grp       ECP group
  * \param R         Destination point
  * \param m         Integer by which to multiply
@@ -609,6 +632,14 @@ int ecp_gen_keypair( ecp_group *grp, mpi_t *d, ecp_point *Q,
 int ecp_gen_key( ecp_group_id grp_id, ecp_keypair *key,
                 int (*f_rng)(void *, uint8_t *, size_t), void *p_rng );
 
+/**
+ * \brief           Free the generator tables shared by the known groups
+ *
+ * \note            Not thread-safe: only call when no other thread uses
+ *                  the ECP module, e.g. on shutdown.
+ */
+void ecp_comb_cache_free( void );
+
 #ifdef __cplusplus
 }
 #endif
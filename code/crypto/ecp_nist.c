@@ -0,0 +1,956 @@
+#include "..\zmodule.h"
+#include "config.h"
+
+#if defined(POLARSSL_ECP_NIST_FIXED)
+
+#include "ecp.h"
+#include "ecp_nist.h"
+#include "impl.h"
+
+/*
+ * Fixed-limb arithmetic for secp256r1 and secp384r1.
+ *
+ * Field elements are arrays of n 32-bit limbs, least significant first,
+ * kept in Montgomery form (a R mod p, R = 2^(32n)) and always fully
+ * reduced. Both primes are -1 mod 2^32, so -p^-1 mod 2^32 is 1 and the
+ * Montgomery quotient digit is simply the low limb. All temporaries live
+ * on the stack; nothing is allocated during a multiplication.
+ *
+ * Points are in Jacobian coordinates and the curves have a = -3.
+ */
+
+#define NIST_MAX_LIMBS      12
+#define NIST_MAX_BITS       ( NIST_MAX_LIMBS * 32 )
+
+/* Variable-base window: 2^(w-1) odd multiples */
+#define NIST_WIN_W          5
+#define NIST_WIN_PRE        ( 1 << ( NIST_WIN_W - 1 ) )
+#define NIST_WIN_MAX_D      ( ( NIST_MAX_BITS + NIST_WIN_W - 1 ) / NIST_WIN_W )
+
+/* Fixed-base comb for the generator */
+#define NIST_COMB_W         POLARSSL_ECP_FIXED_WINDOW_SIZE
+#define NIST_COMB_PRE       ( 1 << ( NIST_COMB_W - 1 ) )
+#define NIST_COMB_MAX_D     ( ( NIST_MAX_BITS + 1 ) / 2 )
+
+typedef struct
+{
+    ecp_group_id id;
+    size_t n;                   /* number of limbs                          */
+    size_t bits;                /* bit size of p and N                      */
+    const uint32_t *p;          /* the prime                                */
+    const uint32_t *rr;         /* R^2 mod p                                */
+    const uint32_t *one;        /* R mod p, i.e. 1 in Montgomery form       */
+    impl_ecp_fe_mul_t mul;      /* field multiplication, see ecp_nist_mul() */
+}
+ecp_nist_curve;
+
+typedef struct
+{
+    uint32_t X[NIST_MAX_LIMBS];
+    uint32_t Y[NIST_MAX_LIMBS];
+    uint32_t Z[NIST_MAX_LIMBS];
+}
+ecp_nist_point;
+
+typedef struct
+{
+    uint32_t X[NIST_MAX_LIMBS];
+    uint32_t Y[NIST_MAX_LIMBS];
+}
+ecp_nist_affine;
+
+#if defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+static const uint32_t p256_p[8] = {
+    0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000,
+    0x00000000, 0x00000000, 0x00000001, 0xFFFFFFFF,
+};
+static const uint32_t p256_rr[8] = {
+    0x00000003, 0x00000000, 0xFFFFFFFF, 0xFFFFFFFB,
+    0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFD, 0x00000004,
+};
+static const uint32_t p256_one[8] = {
+    0x00000001, 0x00000000, 0x00000000, 0xFFFFFFFF,
+    0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFE, 0x00000000,
+};
+static const ecp_nist_curve ecp_nist_p256 =
+    { POLARSSL_ECP_DP_SECP256R1, 8, 256, p256_p, p256_rr, p256_one, NULL };
+#endif /* POLARSSL_ECP_DP_SECP256R1_ENABLED */
+
+#if defined(POLARSSL_ECP_DP_SECP384R1_ENABLED)
+static const uint32_t p384_p[12] = {
+    0xFFFFFFFF, 0x00000000, 0x00000000, 0xFFFFFFFF,
+    0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+    0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+};
+static const uint32_t p384_rr[12] = {
+    0x00000001, 0xFFFFFFFE, 0x00000000, 0x00000002,
+    0x00000000, 0xFFFFFFFE, 0x00000000, 0x00000002,
+    0x00000001, 0x00000000, 0x00000000, 0x00000000,
+};
+static const uint32_t p384_one[12] = {
+    0x00000001, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000,
+    0x00000001, 0x00000000, 0x00000000, 0x00000000,
+    0x00000000, 0x00000000, 0x00000000, 0x00000000,
+};
+static const ecp_nist_curve ecp_nist_p384 =
+    { POLARSSL_ECP_DP_SECP384R1, 12, 384, p384_p, p384_rr, p384_one, NULL };
+#endif /* POLARSSL_ECP_DP_SECP384R1_ENABLED */
+
+static const ecp_nist_curve *ecp_nist_curve_from_grp( const ecp_group *grp )
+{
+    /* only trust the constants of groups from ecp_use_known_dp() */
+    if( grp->h != 1 )
+        return( NULL );
+
+#if defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+    if( grp->id == POLARSSL_ECP_DP_SECP256R1 )
+        return( &ecp_nist_p256 );
+#endif
+#if defined(POLARSSL_ECP_DP_SECP384R1_ENABLED)
+    if( grp->id == POLARSSL_ECP_DP_SECP384R1 )
+        return( &ecp_nist_p384 );
+#endif
+
+    return( NULL );
+}
+
+/*
+ * All-ones if a == b, zero otherwise, without branches
+ */
+static uint32_t ct_eq( uint32_t a, uint32_t b )
+{
+    uint32_t x = a ^ b;
+
+    return( ( ( x | ( 0 - x ) ) >> 31 ) - 1 );
+}
+
+/*
+ * r = t - p if t + hi * R >= p, else t (for t + hi * R < 2p)
+ */
+static void fe_reduce_once( size_t n, const uint32_t *p, uint32_t *r,
+                            const uint32_t *t, uint32_t hi )
+{
+    uint32_t s[NIST_MAX_LIMBS], borrow = 0, keep;
+    uint64_t d;
+    size_t j;
+
+    for( j = 0; j < n; j++ )
+    {
+        d = (uint64_t) t[j] - p[j] - borrow;
+        s[j] = (uint32_t) d;
+        borrow = (uint32_t)( d >> 63 );
+    }
+
+    /* hi - borrow is 0 if t >= p and all-ones if t < p */
+    keep = hi - borrow;
+
+    for( j = 0; j < n; j++ )
+        r[j] = ( t[j] & keep ) | ( s[j] & ~keep );
+}
+
+/*
+ * r = a * b / R mod p (CIOS Montgomery multiplication)
+ */
+static void fe_mul_cios( size_t n, uint32_t *r, const uint32_t *a,
+                         const uint32_t *b, const uint32_t *p )
+{
+    uint32_t t[NIST_MAX_LIMBS + 2], m, carry;
+    size_t i, j;
+    uint64_t uv;
+
+    for( j = 0; j < n + 2; j++ )
+        t[j] = 0;
+
+    for( i = 0; i < n; i++ )
+    {
+        carry = 0;
+        for( j = 0; j < n; j++ )
+        {
+            uv = (uint64_t) a[j] * b[i] + t[j] + carry;
+            t[j] = (uint32_t) uv;
+            carry = (uint32_t)( uv >> 32 );
+        }
+        uv = (uint64_t) t[n] + carry;
+        t[n] = (uint32_t) uv;
+        t[n + 1] = (uint32_t)( uv >> 32 );
+
+        /* m = t[0] * -p^-1 = t[0]; add m * p and shift one limb */
+        m = t[0];
+        uv = (uint64_t) m * p[0] + t[0];
+        carry = (uint32_t)( uv >> 32 );
+        for( j = 1; j < n; j++ )
+        {
+            uv = (uint64_t) m * p[j] + t[j] + carry;
+            t[j - 1] = (uint32_t) uv;
+            carry = (uint32_t)( uv >> 32 );
+        }
+        uv = (uint64_t) t[n] + carry;
+        t[n - 1] = (uint32_t) uv;
+        t[n] = t[n + 1] + (uint32_t)( uv >> 32 );
+    }
+
+    fe_reduce_once( n, p, r, t, t[n] );
+}
+
+const impl_backend_t ecp_nist_fe_mul_impl =
+    { IMPL_ECP_FE_MUL, "cios", 0, 0, IMPL_FN( fe_mul_cios ) };
+
+static void fe_mul( const ecp_nist_curve *c, uint32_t *r,
+                    const uint32_t *a, const uint32_t *b )
+{
+    c->mul( c->n, r, a, b, c->p );
+}
+
+static void fe_add( const ecp_nist_curve *c, uint32_t *r,
+                    const uint32_t *a, const uint32_t *b )
+{
+    uint32_t t[NIST_MAX_LIMBS], carry = 0;
+    uint64_t s;
+    size_t j;
+
+    for( j = 0; j < c->n; j++ )
+    {
+        s = (uint64_t) a[j] + b[j] + carry;
+        t[j] = (uint32_t) s;
+        carry = (uint32_t)( s >> 32 );
+    }
+
+    fe_reduce_once( c->n, c->p, r, t, carry );
+}
+
+static void fe_sub( const ecp_nist_curve *c, uint32_t *r,
+                    const uint32_t *a, const uint32_t *b )
+{
+    uint32_t t[NIST_MAX_LIMBS], borrow = 0, mask, carry = 0;
+    uint64_t d;
+    size_t j;
+
+    for( j = 0; j < c->n; j++ )
+    {
+        d = (uint64_t) a[j] - b[j] - borrow;
+        t[j] = (uint32_t) d;
+        borrow = (uint32_t)( d >> 63 );
+    }
+
+    /* add p back if the difference went negative */
+    mask = 0 - borrow;
+    for( j = 0; j < c->n; j++ )
+    {
+        d = (uint64_t) t[j] + ( c->p[j] & mask ) + carry;
+        r[j] = (uint32_t) d;
+        carry = (uint32_t)( d >> 32 );
+    }
+}
+
+static void fe_copy( const ecp_nist_curve *c, uint32_t *r, const uint32_t *a )
+{
+    size_t j;
+
+    for( j = 0; j < c->n; j++ )
+        r[j] = a[j];
+}
+
+/*
+ * r = a if mask is all-ones, unchanged if mask is zero
+ */
+static void fe_cond_assign( const ecp_nist_curve *c, uint32_t *r,
+                            const uint32_t *a, uint32_t mask )
+{
+    size_t j;
+
+    for( j = 0; j < c->n; j++ )
+        r[j] = ( r[j] & ~mask ) | ( a[j] & mask );
+}
+
+/*
+ * r = -a if mask is all-ones, unchanged if mask is zero
+ */
+static void fe_cond_neg( const ecp_nist_curve *c, uint32_t *r, uint32_t mask )
+{
+    uint32_t zero[NIST_MAX_LIMBS], t[NIST_MAX_LIMBS];
+
+    __stosb( (uint8_t *) zero, 0, sizeof( zero ) );
+    fe_sub( c, t, zero, r );
+    fe_cond_assign( c, r, t, mask );
+}
+
+static int fe_is_zero( const ecp_nist_curve *c, const uint32_t *a )
+{
+    uint32_t acc = 0;
+    size_t j;
+
+    for( j = 0; j < c->n; j++ )
+        acc |= a[j];
+
+    return( acc == 0 );
+}
+
+/*
+ * r = a^-1 = a^(p-2) (the exponent is public)
+ */
+static void fe_inv( const ecp_nist_curve *c, uint32_t *r, const uint32_t *a )
+{
+    uint32_t x[NIST_MAX_LIMBS], e;
+    size_t i;
+
+    fe_copy( c, x, c->one );
+
+    for( i = c->n * 32; i-- > 0; )
+    {
+        fe_mul( c, x, x, x );
+
+        e = c->p[i / 32];
+        if( i < 32 )
+            e -= 2;
+
+        if( ( e >> ( i % 32 ) ) & 1 )
+            fe_mul( c, x, x, a );
+    }
+
+    fe_copy( c, r, x );
+}
+
+/*
+ * Import an MPI smaller than p, converting it to Montgomery form
+ */
+static int fe_read_mpi( const ecp_nist_curve *c, uint32_t *r, const mpi_t *X )
+{
+    int ret;
+    uint8_t buf[NIST_MAX_LIMBS * 4];
+    size_t j, len = c->n * 4;
+
+    MPI_CHK( mpi_write_binary( X, buf, len ) );
+
+    for( j = 0; j < c->n; j++ )
+        r[j] = ( (uint32_t) buf[len - 4 * j - 4] << 24 ) |
+               ( (uint32_t) buf[len - 4 * j - 3] << 16 ) |
+               ( (uint32_t) buf[len - 4 * j - 2] <<  8 ) |
+               ( (uint32_t) buf[len - 4 * j - 1]       );
+
+    fe_mul( c, r, r, c->rr );
+
+cleanup:
+    return( ret );
+}
+
+/*
+ * Export a field element, converting it out of Montgomery form
+ */
+static int fe_write_mpi( const ecp_nist_curve *c, mpi_t *X, const uint32_t *a )
+{
+    uint32_t t[NIST_MAX_LIMBS], u[NIST_MAX_LIMBS];
+    uint8_t buf[NIST_MAX_LIMBS * 4];
+    size_t j, len = c->n * 4;
+
+    /* a * 1 / R */
+    __stosb( (uint8_t *) u, 0, sizeof( u ) );
+    u[0] = 1;
+    fe_mul( c, t, a, u );
+
+    for( j = 0; j < c->n; j++ )
+    {
+        buf[len - 4 * j - 4] = (uint8_t)( t[j] >> 24 );
+        buf[len - 4 * j - 3] = (uint8_t)( t[j] >> 16 );
+        buf[len - 4 * j - 2] = (uint8_t)( t[j] >>  8 );
+        buf[len - 4 * j - 1] = (uint8_t)( t[j]       );
+    }
+
+    return( mpi_read_binary( X, buf, len ) );
+}
+
+/*
+ * Point doubling R = 2 P, "dbl-2001-b" for a = -3
+ * Cost: 3M + 5S
+ */
+static void ecp_nist_double( const ecp_nist_curve *c, ecp_nist_point *R,
+                             const ecp_nist_point *P )
+{
+    uint32_t delta[NIST_MAX_LIMBS], gamma[NIST_MAX_LIMBS];
+    uint32_t beta[NIST_MAX_LIMBS], alpha[NIST_MAX_LIMBS];
+    uint32_t t1[NIST_MAX_LIMBS], t2[NIST_MAX_LIMBS];
+
+    fe_mul( c, delta, P->Z, P->Z );
+    fe_mul( c, gamma, P->Y, P->Y );
+    fe_mul( c, beta,  P->X, gamma );
+
+    /* alpha = 3 (X - delta) (X + delta) */
+    fe_sub( c, t1, P->X, delta );
+    fe_add( c, t2, P->X, delta );
+    fe_mul( c, alpha, t1, t2 );
+    fe_add( c, t1, alpha, alpha );
+    fe_add( c, alpha, t1, alpha );
+
+    /* Z3 = (Y + Z)^2 - gamma - delta */
+    fe_add( c, t1, P->Y, P->Z );
+    fe_mul( c, t1, t1, t1 );
+    fe_sub( c, t1, t1, gamma );
+    fe_sub( c, R->Z, t1, delta );
+
+    /* X3 = alpha^2 - 8 beta */
+    fe_add( c, beta, beta, beta );
+    fe_add( c, beta, beta, beta );
+    fe_mul( c, t1, alpha, alpha );
+    fe_sub( c, t1, t1, beta );
+    fe_sub( c, R->X, t1, beta );
+
+    /* Y3 = alpha (4 beta - X3) - 8 gamma^2 */
+    fe_sub( c, t2, beta, R->X );
+    fe_mul( c, t2, alpha, t2 );
+    fe_mul( c, gamma, gamma, gamma );
+    fe_add( c, gamma, gamma, gamma );
+    fe_add( c, gamma, gamma, gamma );
+    fe_add( c, gamma, gamma, gamma );
+    fe_sub( c, R->Y, t2, gamma );
+}
+
+/*
+ * Finish an addition once H = U2 - U1 and r = S2 - S1 are known:
+ * X3 = r^2 - H^3 - 2 U1 H^2, Y3 = r (U1 H^2 - X3) - S1 H^3, Z3 = zh
+ */
+static void ecp_nist_add_finish( const ecp_nist_curve *c, ecp_nist_point *R,
+                                 const uint32_t *u1, const uint32_t *s1,
+                                 const uint32_t *h, const uint32_t *r,
+                                 const uint32_t *zh )
+{
+    uint32_t hh[NIST_MAX_LIMBS], hhh[NIST_MAX_LIMBS], v[NIST_MAX_LIMBS];
+    uint32_t x3[NIST_MAX_LIMBS], t[NIST_MAX_LIMBS];
+
+    fe_mul( c, hh, h, h );
+    fe_mul( c, hhh, h, hh );
+    fe_mul( c, v, u1, hh );
+
+    fe_mul( c, x3, r, r );
+    fe_sub( c, x3, x3, hhh );
+    fe_sub( c, x3, x3, v );
+    fe_sub( c, x3, x3, v );
+
+    fe_sub( c, t, v, x3 );
+    fe_mul( c, t, r, t );
+    fe_mul( c, v, s1, hhh );
+    fe_sub( c, R->Y, t, v );
+
+    fe_copy( c, R->X, x3 );
+    fe_copy( c, R->Z, zh );
+}
+
+/*
+ * Addition R = P + Q, both Jacobian, "add-2007-bl"
+ * Cost: 12M + 4S
+ *
+ * The special cases (zero inputs, P == +/- Q) branch; they do not occur
+ * for valid scalars except with negligible probability.
+ */
+static void ecp_nist_add( const ecp_nist_curve *c, ecp_nist_point *R,
+                          const ecp_nist_point *P, const ecp_nist_point *Q )
+{
+    uint32_t z1z1[NIST_MAX_LIMBS], z2z2[NIST_MAX_LIMBS];
+    uint32_t u1[NIST_MAX_LIMBS], u2[NIST_MAX_LIMBS];
+    uint32_t s1[NIST_MAX_LIMBS], s2[NIST_MAX_LIMBS];
+    uint32_t h[NIST_MAX_LIMBS], r[NIST_MAX_LIMBS];
+
+    if( fe_is_zero( c, P->Z ) )
+    {
+        __movsb( (uint8_t *) R, (const uint8_t *) Q, sizeof( ecp_nist_point ) );
+        return;
+    }
+    if( fe_is_zero( c, Q->Z ) )
+    {
+        __movsb( (uint8_t *) R, (const uint8_t *) P, sizeof( ecp_nist_point ) );
+        return;
+    }
+
+    fe_mul( c, z1z1, P->Z, P->Z );
+    fe_mul( c, z2z2, Q->Z, Q->Z );
+    fe_mul( c, u1, P->X, z2z2 );
+    fe_mul( c, u2, Q->X, z1z1 );
+    fe_mul( c, s1, P->Y, Q->Z );
+    fe_mul( c, s1, s1, z2z2 );
+    fe_mul( c, s2, Q->Y, P->Z );
+    fe_mul( c, s2, s2, z1z1 );
+
+    fe_sub( c, h, u2, u1 );
+    fe_sub( c, r, s2, s1 );
+
+    if( fe_is_zero( c, h ) )
+    {
+        if( fe_is_zero( c, r ) )
+            ecp_nist_double( c, R, P );
+        else
+            __stosb( (uint8_t *) R->Z, 0, sizeof( R->Z ) );
+        return;
+    }
+
+    fe_mul( c, z1z1, P->Z, Q->Z );
+    fe_mul( c, z1z1, z1z1, h );
+
+    ecp_nist_add_finish( c, R, u1, s1, h, r, z1z1 );
+}
+
+/*
+ * Mixed addition R = P + Q, Q affine, "madd-2007-bl" style
+ * Cost: 8M + 3S
+ */
+static void ecp_nist_add_mixed( const ecp_nist_curve *c, ecp_nist_point *R,
+                                const ecp_nist_point *P,
+                                const ecp_nist_affine *Q )
+{
+    uint32_t z1z1[NIST_MAX_LIMBS], u2[NIST_MAX_LIMBS], s2[NIST_MAX_LIMBS];
+    uint32_t h[NIST_MAX_LIMBS], r[NIST_MAX_LIMBS];
+    uint32_t u1[NIST_MAX_LIMBS], s1[NIST_MAX_LIMBS];
+
+    if( fe_is_zero( c, P->Z ) )
+    {
+        fe_copy( c, R->X, Q->X );
+        fe_copy( c, R->Y, Q->Y );
+        fe_copy( c, R->Z, c->one );
+        return;
+    }
+
+    fe_mul( c, z1z1, P->Z, P->Z );
+    fe_mul( c, u2, Q->X, z1z1 );
+    fe_mul( c, s2, Q->Y, P->Z );
+    fe_mul( c, s2, s2, z1z1 );
+
+    fe_sub( c, h, u2, P->X );
+    fe_sub( c, r, s2, P->Y );
+
+    if( fe_is_zero( c, h ) )
+    {
+        if( fe_is_zero( c, r ) )
+            ecp_nist_double( c, R, P );
+        else
+            __stosb( (uint8_t *) R->Z, 0, sizeof( R->Z ) );
+        return;
+    }
+
+    fe_copy( c, u1, P->X );
+    fe_copy( c, s1, P->Y );
+    fe_mul( c, z1z1, P->Z, h );
+
+    ecp_nist_add_finish( c, R, u1, s1, h, r, z1z1 );
+}
+
+/*
+ * Convert to affine coordinates (still in Montgomery form)
+ */
+static void ecp_nist_to_affine( const ecp_nist_curve *c, ecp_nist_affine *A,
+                                const ecp_nist_point *P )
+{
+    uint32_t zi[NIST_MAX_LIMBS], zi2[NIST_MAX_LIMBS];
+
+    fe_inv( c, zi, P->Z );
+    fe_mul( c, zi2, zi, zi );
+    fe_mul( c, A->X, P->X, zi2 );
+    fe_mul( c, zi2, zi2, zi );
+    fe_mul( c, A->Y, P->Y, zi2 );
+}
+
+/*
+ * Randomize jacobian coordinates: (X, Y, Z) -> (l^2 X, l^3 Y, l Z)
+ */
+static int ecp_nist_randomize( const ecp_nist_curve *c, ecp_nist_point *R,
+                               int (*f_rng)(void *, uint8_t *, size_t),
+                               void *p_rng )
+{
+    int ret, count = 0;
+    uint32_t l[NIST_MAX_LIMBS], ll[NIST_MAX_LIMBS];
+
+    /* any l < 2^(32n) < 2p reduces to a field element in one step */
+    do
+    {
+        if( ( ret = f_rng( p_rng, (uint8_t *) l, c->n * 4 ) ) != 0 )
+            return( ret );
+
+        fe_reduce_once( c->n, c->p, l, l, 0 );
+
+        if( count++ > 10 )
+            return( POLARSSL_ERR_ECP_RANDOM_FAILED );
+    }
+    while( fe_is_zero( c, l ) );
+
+    fe_mul( c, R->Z, R->Z, l );
+    fe_mul( c, ll, l, l );
+    fe_mul( c, R->X, R->X, ll );
+    fe_mul( c, ll, ll, l );
+    fe_mul( c, R->Y, R->Y, ll );
+
+    return( 0 );
+}
+
+#if POLARSSL_ECP_FIXED_POINT_OPTIM == 1
+/*
+ * Comb tables for the generators, built once and then read by all threads
+ * (see ecp_comb_cache_get() in ecp.c for the same scheme on MPIs).
+ */
+typedef struct
+{
+    ecp_nist_affine T[NIST_COMB_PRE];
+    volatile int ready;
+}
+ecp_nist_comb;
+
+#if defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+static ecp_nist_comb ecp_nist_comb_p256;
+#endif
+#if defined(POLARSSL_ECP_DP_SECP384R1_ENABLED)
+static ecp_nist_comb ecp_nist_comb_p384;
+#endif
+static mutex_t ecp_nist_comb_mutex;
+static async_once_t ecp_nist_comb_once = ASYNC_ONCE_INIT;
+
+static void ecp_nist_comb_init( void )
+{
+    mutex_init( &ecp_nist_comb_mutex );
+}
+
+/*
+ * T[i] = i_{w-1} 2^{(w-1)d} G + ... + i_1 2^d G + G, as in
+ * ecp_precompute_comb()
+ */
+static void ecp_nist_comb_build( const ecp_nist_curve *c, ecp_nist_affine T[],
+                                 const ecp_nist_affine *G, size_t d )
+{
+    ecp_nist_point J;
+    size_t i, j;
+
+    __movsb( (uint8_t *) &T[0], (const uint8_t *) G, sizeof( ecp_nist_affine ) );
+
+    for( i = 1; i < NIST_COMB_PRE; i <<= 1 )
+    {
+        fe_copy( c, J.X, T[i >> 1].X );
+        fe_copy( c, J.Y, T[i >> 1].Y );
+        fe_copy( c, J.Z, c->one );
+
+        for( j = 0; j < d; j++ )
+            ecp_nist_double( c, &J, &J );
+
+        ecp_nist_to_affine( c, &T[i], &J );
+    }
+
+    /* update T[i] last, after it has been used for the others */
+    for( i = 1; i < NIST_COMB_PRE; i <<= 1 )
+    {
+        j = i;
+        while( j-- )
+        {
+            fe_copy( c, J.X, T[j].X );
+            fe_copy( c, J.Y, T[j].Y );
+            fe_copy( c, J.Z, c->one );
+
+            ecp_nist_add_mixed( c, &J, &J, &T[i] );
+            ecp_nist_to_affine( c, &T[i + j], &J );
+        }
+    }
+}
+
+static int ecp_nist_comb_get( const ecp_nist_curve *c, const ecp_group *grp,
+                              const ecp_nist_affine **T )
+{
+    int ret = 0;
+    ecp_nist_comb *comb = NULL;
+    ecp_nist_affine G;
+
+#if defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+    if( c->id == POLARSSL_ECP_DP_SECP256R1 )
+        comb = &ecp_nist_comb_p256;
+#endif
+#if defined(POLARSSL_ECP_DP_SECP384R1_ENABLED)
+    if( c->id == POLARSSL_ECP_DP_SECP384R1 )
+        comb = &ecp_nist_comb_p384;
+#endif
+
+    if( ! comb->ready )
+    {
+        async_once( &ecp_nist_comb_once, ecp_nist_comb_init );
+        mutex_lock( &ecp_nist_comb_mutex );
+
+        if( ! comb->ready )
+        {
+            if( ( ret = fe_read_mpi( c, G.X, &grp->G.X ) ) == 0 &&
+                ( ret = fe_read_mpi( c, G.Y, &grp->G.Y ) ) == 0 )
+            {
+                ecp_nist_comb_build( c, comb->T, &G,
+                                     ( c->bits + NIST_COMB_W - 1 ) / NIST_COMB_W );
+                comb->ready = 1;
+            }
+        }
+
+        mutex_unlock( &ecp_nist_comb_mutex );
+    }
+
+    *T = comb->T;
+
+    return( ret );
+}
+
+/*
+ * Comb representation of an odd scalar, see ecp_comb_fixed()
+ */
+static void ecp_nist_comb_recode( uint8_t x[], size_t d, uint8_t w,
+                                  const uint32_t *k )
+{
+    size_t i, j, b;
+    uint8_t c, cc, adjust;
+
+    for( i = 0; i < d; i++ )
+    {
+        x[i] = 0;
+        for( j = 0; j < w; j++ )
+        {
+            b = i + d * j;
+            x[i] |= (uint8_t)( ( ( k[b / 32] >> ( b % 32 ) ) & 1 ) << j );
+        }
+    }
+    x[d] = 0;
+
+    c = 0;
+    for( i = 1; i <= d; i++ )
+    {
+        cc   = x[i] & c;
+        x[i] = x[i] ^ c;
+        c = cc;
+
+        adjust = 1 - ( x[i] & 0x01 );
+        c   |= x[i] & ( x[i-1] * adjust );
+        x[i] = x[i] ^ ( x[i-1] * adjust );
+        x[i-1] |= adjust << 7;
+    }
+}
+
+static void ecp_nist_select_affine( const ecp_nist_curve *c,
+                                    ecp_nist_affine *R,
+                                    const ecp_nist_affine T[], size_t t_len,
+                                    uint8_t i )
+{
+    size_t j;
+    uint32_t mask, ii = ( i & 0x7Fu ) >> 1;
+
+    for( j = 0; j < t_len; j++ )
+    {
+        mask = ct_eq( (uint32_t) j, ii );
+        fe_cond_assign( c, R->X, T[j].X, mask );
+        fe_cond_assign( c, R->Y, T[j].Y, mask );
+    }
+
+    fe_cond_neg( c, R->Y, 0 - (uint32_t)( i >> 7 ) );
+}
+
+/*
+ * R = k G with the shared comb table
+ */
+static int ecp_nist_mul_comb( const ecp_nist_curve *c, const ecp_group *grp,
+                              ecp_nist_point *R, const uint32_t *k,
+                              int (*f_rng)(void *, uint8_t *, size_t),
+                              void *p_rng )
+{
+    int ret;
+    const ecp_nist_affine *T;
+    ecp_nist_affine A;
+    uint8_t x[NIST_COMB_MAX_D + 1];
+    size_t i, d = ( c->bits + NIST_COMB_W - 1 ) / NIST_COMB_W;
+
+    if( ( ret = ecp_nist_comb_get( c, grp, &T ) ) != 0 )
+        return( ret );
+
+    ecp_nist_comb_recode( x, d, NIST_COMB_W, k );
+
+    i = d;
+    ecp_nist_select_affine( c, &A, T, NIST_COMB_PRE, x[i] );
+    fe_copy( c, R->X, A.X );
+    fe_copy( c, R->Y, A.Y );
+    fe_copy( c, R->Z, c->one );
+    if( f_rng != NULL )
+        ret = ecp_nist_randomize( c, R, f_rng, p_rng );
+
+    while( ret == 0 && i-- != 0 )
+    {
+        ecp_nist_double( c, R, R );
+        ecp_nist_select_affine( c, &A, T, NIST_COMB_PRE, x[i] );
+        ecp_nist_add_mixed( c, R, R, &A );
+    }
+
+    __stosb( x, 0, sizeof( x ) );
+
+    return( ret );
+}
+#endif /* POLARSSL_ECP_FIXED_POINT_OPTIM */
+
+/*
+ * Regular signed window representation of an odd scalar: k = sum d_i 2^(wi)
+ * with every d_i odd and |d_i| < 2^w, so no digit is zero. Destroys k.
+ */
+static void ecp_nist_win_recode( int8_t x[], size_t t, uint32_t *k, size_t n )
+{
+    size_t i, j;
+    uint32_t low;
+
+    for( i = 0; i < t; i++ )
+    {
+        low = k[0] & ( ( 1U << ( NIST_WIN_W + 1 ) ) - 1 );
+        x[i] = (int8_t)( (int32_t) low - ( 1 << NIST_WIN_W ) );
+
+        /* k = ( k - x[i] ) >> w, where k - x[i] = k - low + 2^w */
+        k[0] = ( k[0] & ~( ( 1U << ( NIST_WIN_W + 1 ) ) - 1 ) ) | ( 1U << NIST_WIN_W );
+        for( j = 0; j < n; j++ )
+            k[j] = ( k[j] >> NIST_WIN_W ) | ( k[j + 1] << ( 32 - NIST_WIN_W ) );
+        k[n] >>= NIST_WIN_W;
+    }
+
+    x[t] = (int8_t) k[0];
+}
+
+/*
+ * R = sign(i) * T[ (|i| - 1) / 2 ], reading the whole table
+ */
+static void ecp_nist_select( const ecp_nist_curve *c, ecp_nist_point *R,
+                             const ecp_nist_point T[], int8_t i )
+{
+    uint32_t u = (uint32_t)(int32_t) i, s = 0 - ( u >> 31 ), ii, mask;
+    size_t j;
+
+    ii = ( ( ( u ^ s ) - s ) - 1 ) >> 1;
+
+    for( j = 0; j < NIST_WIN_PRE; j++ )
+    {
+        mask = ct_eq( (uint32_t) j, ii );
+        fe_cond_assign( c, R->X, T[j].X, mask );
+        fe_cond_assign( c, R->Y, T[j].Y, mask );
+        fe_cond_assign( c, R->Z, T[j].Z, mask );
+    }
+
+    fe_cond_neg( c, R->Y, s );
+}
+
+/*
+ * R = k P with a fixed window of odd multiples
+ * Cost: (2^(w-1) - 1) A + 1 D + d (w D + 1 A)
+ */
+static int ecp_nist_mul_window( const ecp_nist_curve *c, ecp_nist_point *R,
+                                const ecp_nist_affine *P, uint32_t *k,
+                                int (*f_rng)(void *, uint8_t *, size_t),
+                                void *p_rng )
+{
+    int ret = 0;
+    ecp_nist_point T[NIST_WIN_PRE], P2, Q;
+    int8_t x[NIST_WIN_MAX_D + 1];
+    size_t i, j, t = ( c->bits + NIST_WIN_W - 1 ) / NIST_WIN_W;
+
+    /* T[j] = (2j + 1) P */
+    fe_copy( c, T[0].X, P->X );
+    fe_copy( c, T[0].Y, P->Y );
+    fe_copy( c, T[0].Z, c->one );
+    ecp_nist_double( c, &P2, &T[0] );
+    for( j = 1; j < NIST_WIN_PRE; j++ )
+        ecp_nist_add( c, &T[j], &T[j - 1], &P2 );
+
+    ecp_nist_win_recode( x, t, k, c->n );
+
+    ecp_nist_select( c, R, T, x[t] );
+    if( f_rng != NULL )
+        ret = ecp_nist_randomize( c, R, f_rng, p_rng );
+
+    for( i = t; ret == 0 && i-- != 0; )
+    {
+        for( j = 0; j < NIST_WIN_W; j++ )
+            ecp_nist_double( c, R, R );
+
+        ecp_nist_select( c, &Q, T, x[i] );
+        ecp_nist_add( c, R, R, &Q );
+    }
+
+    __stosb( (uint8_t *) x, 0, sizeof( x ) );
+
+    return( ret );
+}
+
+int ecp_nist_can_mul( const ecp_group *grp )
+{
+    return( ecp_nist_curve_from_grp( grp ) != NULL );
+}
+
+int ecp_nist_mul( const ecp_group *grp, ecp_point *R,
+                  const mpi_t *m, const ecp_point *P,
+                  int (*f_rng)(void *, uint8_t *, size_t), void *p_rng )
+{
+    int ret;
+    const ecp_nist_curve *c = ecp_nist_curve_from_grp( grp );
+    const impl_backend_t *impl = impl_select( IMPL_ECP_FE_MUL );
+    ecp_nist_curve cur;
+    uint8_t m_is_odd;
+    uint8_t buf[NIST_MAX_LIMBS * 4];
+    uint32_t k[NIST_MAX_LIMBS + 1], mask;
+    ecp_nist_affine A;
+    ecp_nist_point J;
+    size_t j, len;
+    mpi_t M, mm;
+
+    if( c == NULL )
+        return( POLARSSL_ERR_ECP_BAD_INPUT_DATA );
+
+    /* the curve constants with the registry's field multiplication, if any */
+    __movsb( &cur, c, sizeof( ecp_nist_curve ) );
+    if( impl != NULL )
+        cur.mul = (impl_ecp_fe_mul_t) impl->fn;
+    else
+        cur.mul = fe_mul_cios;
+    c = &cur;
+
+    mpi_init( &M );
+    mpi_init( &mm );
+
+    /*
+     * Make sure M is odd (M = m or M = N - m, since N is odd)
+     * using the fact that m * P = - (N - m) * P
+     */
+    m_is_odd = ( mpi_get_bit( m, 0 ) == 1 );
+    MPI_CHK( mpi_copy( &M, m ) );
+    MPI_CHK( mpi_sub_mpi( &mm, &grp->N, m ) );
+    MPI_CHK( mpi_safe_cond_assign( &M, &mm, ! m_is_odd ) );
+
+    len = c->n * 4;
+    MPI_CHK( mpi_write_binary( &M, buf, len ) );
+    for( j = 0; j < c->n; j++ )
+        k[j] = ( (uint32_t) buf[len - 4 * j - 4] << 24 ) |
+               ( (uint32_t) buf[len - 4 * j - 3] << 16 ) |
+               ( (uint32_t) buf[len - 4 * j - 2] <<  8 ) |
+               ( (uint32_t) buf[len - 4 * j - 1]       );
+    for( ; j <= NIST_MAX_LIMBS; j++ )
+        k[j] = 0;
+
+#if POLARSSL_ECP_FIXED_POINT_OPTIM == 1
+    if( mpi_cmp_mpi( &P->Y, &grp->G.Y ) == 0 &&
+        mpi_cmp_mpi( &P->X, &grp->G.X ) == 0 )
+    {
+        MPI_CHK( ecp_nist_mul_comb( c, grp, &J, k, f_rng, p_rng ) );
+    }
+    else
+#endif
+    {
+        MPI_CHK( fe_read_mpi( c, A.X, &P->X ) );
+        MPI_CHK( fe_read_mpi( c, A.Y, &P->Y ) );
+        MPI_CHK( ecp_nist_mul_window( c, &J, &A, k, f_rng, p_rng ) );
+    }
+
+    /* Now get m * P from M * P and normalize it */
+    mask = 0 - (uint32_t) ( ! m_is_odd );
+    fe_cond_neg( c, J.Y, mask );
+
+    ecp_nist_to_affine( c, &A, &J );
+    MPI_CHK( fe_write_mpi( c, &R->X, A.X ) );
+    MPI_CHK( fe_write_mpi( c, &R->Y, A.Y ) );
+    MPI_CHK( mpi_lset( &R->Z, 1 ) );
+
+cleanup:
+    __stosb( buf, 0, sizeof( buf ) );
+    __stosb( (uint8_t *) k, 0, sizeof( k ) );
+
+    mpi_free( &M );
+    mpi_free( &mm );
+
+    if( ret != 0 )
+        ecp_point_free( R );
+
+    return( ret );
+}
+
+#endif /* POLARSSL_ECP_NIST_FIXED */
@@ -0,0 +1,45 @@
+#ifndef POLARSSL_ECP_NIST_H
+#define POLARSSL_ECP_NIST_H
+
+#include "ecp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief           Tell if a group has a fixed-limb backend
+ *
+ * \param grp       ECP group
+ *
+ * \return          1 for secp256r1 and secp384r1 loaded with
+ *                  ecp_use_known_dp(), 0 otherwise
+ */
+int ecp_nist_can_mul( const ecp_group *grp );
+
+/**
+ * \brief           Multiplication by an integer: R = m * P, using
+ *                  fixed-size field elements on the stack
+ *
+ * \param grp       ECP group, see ecp_nist_can_mul()
+ * \param R         Destination point
+ * \param m         Integer by which to multiply, a valid private key
+ * \param P         Point to multiply, a valid public key
+ * \param f_rng     RNG function used for coordinate randomization, or NULL
+ * \param p_rng     RNG parameter
+ *
+ * \return          0 if successful,
+ *                  POLARSSL_ERR_MPI_MALLOC_FAILED if memory allocation failed
+ *
+ * \note            Internal use: called from ecp_mul() after the sanity
+ *                  checks on m and P.
+ */
+int ecp_nist_mul( const ecp_group *grp, ecp_point *R,
+                  const mpi_t *m, const ecp_point *P,
+                  int (*f_rng)(void *, uint8_t *, size_t), void *p_rng );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ecp_nist.h */
@@ -11,6 +11,8 @@ void entropy_init( entropy_context_t *ctx )
 {
     __stosb( ctx, 0, sizeof(entropy_context_t) );
 
+    mutex_init( &ctx->mutex );
+
     sha512_starts( &ctx->accumulator, 0 );
 
     entropy_add_source( ctx, platform_entropy_poll, NULL, ENTROPY_MIN_PLATFORM );
@@ -19,13 +21,15 @@ void entropy_init( entropy_context_t *ctx )
 
 void entropy_free( entropy_context_t *ctx )
 {
-    ((void) ctx);
+    mutex_destroy( &ctx->mutex );
 }
 
 int entropy_add_source( entropy_context_t *ctx, f_source_ptr f_source, void *p_source, size_t threshold )
 {
     int index, ret = 0;
 
+    mutex_lock( &ctx->mutex );
+
     index = ctx->source_count;
     if( index >= ENTROPY_MAX_SOURCES )
     {
@@ -40,6 +44,8 @@ int entropy_add_source( entropy_context_t *ctx, f_source_ptr f_source, void *p_s
     ctx->source_count++;
 
 exit:
+    mutex_unlock( &ctx->mutex );
+
     return( ret );
 }
 
@@ -72,8 +78,12 @@ int entropy_update_manual( entropy_context_t *ctx, const uint8_t *data, size_t l
 {
     int ret;
 
+    mutex_lock( &ctx->mutex );
+
     ret = entropy_update( ctx, ENTROPY_SOURCE_MANUAL, data, len );
 
+    mutex_unlock( &ctx->mutex );
+
     return ( ret );
 }
 
@@ -121,8 +131,12 @@ int entropy_gather( entropy_context_t *ctx )
 {
     int ret;
 
+    mutex_lock( &ctx->mutex );
+
     ret = entropy_gather_internal( ctx );
 
+    mutex_unlock( &ctx->mutex );
+
     return( ret );
 }
 
@@ -135,6 +149,8 @@ int entropy_func( void *data, uint8_t *output, size_t len )
     if( len > ENTROPY_BLOCK_SIZE )
         return( POLARSSL_ERR_ENTROPY_SOURCE_FAILED );
 
+    mutex_lock( &ctx->mutex );
+
     /*
      * Always gather extra entropy before a call
      */
@@ -181,5 +197,9 @@ int entropy_func( void *data, uint8_t *output, size_t len )
     ret = 0;
 
 exit:
+    __stosb( buf, 0, ENTROPY_BLOCK_SIZE );
+
+    mutex_unlock( &ctx->mutex );
+
     return ret;
 }
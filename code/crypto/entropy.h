@@ -63,6 +63,7 @@ typedef struct
     sha512_context  accumulator;
     int             source_count;
     source_state_t    source[ENTROPY_MAX_SOURCES];
+    mutex_t         mutex;      /**< Serializes polling and extraction */
 } entropy_context_t;
 
 /**
@@ -81,7 +82,7 @@ void entropy_free( entropy_context_t *ctx );
 
 /**
  * \brief           Adds an entropy source to poll
- *                  (Thread-safe if POLARSSL_THREADING_C is enabled)
+ *                  (Thread-safe)
  *
  * \param ctx       Entropy context
  * \param f_source  Entropy function
@@ -95,7 +96,7 @@ int entropy_add_source( entropy_context_t *ctx, f_source_ptr f_source, void *p_s
 
 /**
  * \brief           Trigger an extra gather poll for the accumulator
- *                  (Thread-safe if POLARSSL_THREADING_C is enabled)
+ *                  (Thread-safe)
  *
  * \param ctx       Entropy context
  *
@@ -106,7 +107,7 @@ int entropy_gather( entropy_context_t *ctx );
 /**
  * \brief           Retrieve entropy from the accumulator
  *                  (Maximum length: ENTROPY_BLOCK_SIZE)
- *                  (Thread-safe if POLARSSL_THREADING_C is enabled)
+ *                  (Thread-safe)
  *
  * \param data      Entropy context
  * \param output    Buffer to fill
@@ -118,7 +119,7 @@ int entropy_func( void *data, uint8_t *output, size_t len );
 
 /**
  * \brief           Add data to the accumulator manually
- *                  (Thread-safe if POLARSSL_THREADING_C is enabled)
+ *                  (Thread-safe)
  *
  * \param ctx       Entropy context
  * \param data      Data to add
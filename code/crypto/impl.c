@@ -0,0 +1,830 @@
+#include "..\zmodule.h"
+#include "config.h"
+
+#if defined(POLARSSL_IMPL_C)
+
+#include "impl.h"
+#include "cpu.h"
+#include "timing.h"
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#include <intrin.h>             /* __rdtsc() */
+#endif
+
+#define ciL    (sizeof(t_uint))         /* chars in limb  */
+#define biL    (ciL << 3)               /* bits  in limb  */
+
+#define IMPL_KAT_UNTESTED   0
+#define IMPL_KAT_PASSED     1
+#define IMPL_KAT_FAILED     2
+
+/*
+ * Registry: backends in registration order, one table per primitive.
+ * A slot is filled before count is bumped, so readers never look at a
+ * half-written one. The known-answer test of a slot runs at most a few
+ * times (it is idempotent, concurrent first selections may both run it
+ * and store the same result), and only once its CPU features are there.
+ */
+typedef struct
+{
+    const impl_backend_t *backend;
+    volatile int kat;
+}
+impl_slot;
+
+typedef struct
+{
+    impl_slot slot[IMPL_MAX_BACKENDS];
+    volatile size_t count;
+}
+impl_table;
+
+static impl_table impl_tables[IMPL_PRIMITIVES];
+static mutex_t impl_mutex;
+static async_once_t impl_once = ASYNC_ONCE_INIT;
+
+static const impl_backend_t * const impl_builtin[] =
+{
+    &aes_ctr_aesni_impl,
+    &aes_ctr_c_impl,
+#if defined(POLARSSL_SHA256_C)
+    &sha256_shani_impl,
+    &sha256_c_impl,
+#endif
+#if defined(POLARSSL_SHA512_C)
+    &sha512_avx512_impl,
+    &sha512_avx2_impl,
+    &sha512_c_impl,
+    &aes_cbc_sha512_aesni_impl,
+    &aes_cbc_sha512_c_impl,
+#endif
+    &mpi_muladd_adx_impl,
+    &mpi_muladd_c_impl,
+    &mpi_montmul_adx_impl,
+    &mpi_montmul_cios_impl,
+#if defined(POLARSSL_ECP_NIST_FIXED)
+    &ecp_nist_fe_mul_impl,
+#endif
+    NULL
+};
+
+/*
+ * Known-answer tests. Inputs are generated or little-endian byte strings,
+ * so the bignum vectors hold for 32-bit and 64-bit limbs alike.
+ */
+
+/* Message of the hash tests: 300 bytes i * 7 + 3 */
+#define IMPL_KAT_MSG_LEN    300
+
+static const uint8_t impl_aes_ctr_start[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0A, 0x0B, 0xFF, 0xFF, 0xFF, 0xFD,
+};
+
+static const uint8_t impl_aes_ctr_end[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0A, 0x0C, 0x00, 0x00, 0x00, 0x07,
+};
+
+/* AES-256, key 00 01 .. 1F, ten blocks: the 8-block stride and a tail */
+static const uint8_t impl_aes_ctr_ks[160] = {
+    0x8B, 0x64, 0xB3, 0x2F, 0xF7, 0xB3, 0x90, 0x52,
+    0xBB, 0xA9, 0x7A, 0x54, 0x8C, 0xD5, 0x4F, 0x64,
+    0x9D, 0x52, 0xEA, 0x87, 0x1D, 0x37, 0xE2, 0x06,
+    0xB6, 0x4E, 0x90, 0x2D, 0x1D, 0x85, 0x7E, 0x44,
+    0xDA, 0xA6, 0x48, 0xFF, 0xC7, 0xCF, 0xC3, 0xA6,
+    0xD9, 0xF6, 0x54, 0x99, 0xFF, 0x0B, 0x17, 0x81,
+    0x8D, 0x72, 0xDA, 0x2A, 0xC9, 0xD1, 0x94, 0x20,
+    0x14, 0x98, 0xFD, 0xB0, 0x4C, 0x4C, 0xC4, 0x01,
+    0x89, 0x0B, 0x91, 0xB9, 0x43, 0x27, 0x29, 0x11,
+    0x85, 0xB4, 0x8C, 0x8F, 0x38, 0x61, 0x0B, 0xB6,
+    0x31, 0x2D, 0xE8, 0xF4, 0x87, 0xF7, 0xA5, 0x5E,
+    0x9E, 0xF7, 0xE3, 0x08, 0x73, 0x05, 0x45, 0xEE,
+    0xF9, 0xAD, 0x71, 0xC2, 0x04, 0x84, 0x21, 0xA0,
+    0x2E, 0xE4, 0xD0, 0x0D, 0x10, 0x63, 0x3E, 0xCC,
+    0x32, 0x23, 0x8A, 0x46, 0xD4, 0x3C, 0x9C, 0xC6,
+    0x89, 0xE3, 0x9C, 0x9D, 0xA7, 0xF7, 0xF6, 0x94,
+    0x37, 0x1A, 0x3B, 0xBF, 0xD9, 0x77, 0xB9, 0x85,
+    0x87, 0x3E, 0xE2, 0x52, 0xA6, 0xA6, 0xA3, 0x77,
+    0xB4, 0x81, 0x3B, 0xA8, 0x56, 0x76, 0x79, 0xAF,
+    0xCD, 0x97, 0xAC, 0x4D, 0x9C, 0xAA, 0xDE, 0x2B,
+};
+
+#if defined(POLARSSL_SHA256_C)
+static const uint32_t impl_sha256_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static const uint8_t impl_sha256_md[32] = {
+    0x04, 0x77, 0x3F, 0x87, 0x26, 0xC8, 0x1C, 0xAF,
+    0xCF, 0xA1, 0xA0, 0x9A, 0x82, 0x66, 0x4B, 0x98,
+    0xB0, 0x0D, 0x20, 0x21, 0x03, 0x1A, 0x17, 0x15,
+    0xBC, 0xA1, 0x15, 0x4F, 0x2D, 0xAD, 0x34, 0x72,
+};
+#endif /* POLARSSL_SHA256_C */
+
+#if defined(POLARSSL_SHA512_C)
+static const uint64_t impl_sha512_iv[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL,
+    0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+    0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL,
+};
+
+static const uint8_t impl_sha512_md[64] = {
+    0x46, 0xE5, 0x6A, 0xD3, 0x0D, 0xB9, 0xEF, 0x50,
+    0xF8, 0xB6, 0x76, 0x2B, 0xA5, 0x58, 0x39, 0x73,
+    0x7F, 0x3F, 0xBA, 0x34, 0xAB, 0x47, 0x86, 0x3C,
+    0x9D, 0xAF, 0xF7, 0xB3, 0xF5, 0x8F, 0x97, 0xFE,
+    0x34, 0x65, 0xA5, 0x2D, 0xD3, 0x64, 0x56, 0x0D,
+    0xB4, 0x7F, 0x80, 0x29, 0x09, 0xCE, 0xD4, 0x90,
+    0x93, 0x32, 0x26, 0x21, 0xEA, 0x0A, 0xEB, 0xF8,
+    0xE0, 0x69, 0x6B, 0x85, 0xCA, 0x8F, 0x81, 0xF0,
+};
+#endif /* POLARSSL_SHA512_C */
+
+/* d = 2^576 - 1 on 80 bytes, plus s * 0xFEDCBA98 */
+#define IMPL_MULADD_B       0xFEDCBA98
+
+static const uint8_t impl_muladd_s[64] = {
+    0xFD, 0x4E, 0x1F, 0x11, 0xE9, 0x00, 0x26, 0x58,
+    0xE7, 0x47, 0xCA, 0x69, 0x83, 0x31, 0xEE, 0xEE,
+    0xCA, 0x09, 0x4A, 0x1C, 0x15, 0x95, 0xD0, 0x52,
+    0x73, 0x60, 0x8A, 0xC0, 0xA4, 0x3A, 0xEA, 0x8D,
+    0xBD, 0x94, 0xE3, 0x82, 0x92, 0x12, 0xC8, 0xCE,
+    0x5A, 0x6F, 0xB7, 0x0C, 0x17, 0x65, 0x0B, 0xAE,
+    0xD7, 0x80, 0x78, 0x0B, 0x71, 0x2D, 0x23, 0xC2,
+    0x3A, 0x32, 0x66, 0xBC, 0x42, 0x2F, 0xA3, 0xC6,
+};
+
+static const uint8_t impl_muladd_d[80] = {
+    0x37, 0xB8, 0x66, 0xD1, 0x19, 0xA8, 0x81, 0xFA,
+    0xF7, 0x3C, 0x9E, 0x1C, 0x11, 0x7E, 0x4C, 0xDD,
+    0xE9, 0xEB, 0x88, 0x5A, 0x6E, 0xA0, 0x5F, 0xC8,
+    0xCF, 0x2D, 0x83, 0x2B, 0x54, 0x48, 0x4D, 0x4E,
+    0x22, 0x65, 0xE6, 0xF6, 0x3E, 0xC3, 0x0F, 0x78,
+    0x85, 0x4E, 0x06, 0x9F, 0x0C, 0xB3, 0xA3, 0x5C,
+    0x9B, 0x14, 0x32, 0x15, 0xD9, 0x88, 0x6E, 0x0A,
+    0x42, 0x41, 0x4A, 0x94, 0x2B, 0xDA, 0x81, 0x55,
+    0xE9, 0x2D, 0xC1, 0xC5, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* 512-bit N, so that R = 2^512 for both limb sizes; X = A * B / R mod N */
+static const uint8_t impl_montmul_N[64] = {
+    0x05, 0x77, 0x83, 0x27, 0xD4, 0x25, 0x6F, 0x74,
+    0x9E, 0xB4, 0xD6, 0xBB, 0xEC, 0x15, 0x9F, 0x0B,
+    0x67, 0xC2, 0x64, 0xA1, 0xCB, 0x1A, 0xCD, 0x8B,
+    0x03, 0x70, 0x18, 0x81, 0xFE, 0x78, 0x1B, 0x38,
+    0x6C, 0x97, 0x15, 0xDB, 0xF0, 0xEA, 0x37, 0xE4,
+    0xC7, 0x30, 0x41, 0x9A, 0xAB, 0x6A, 0x34, 0x49,
+    0xAE, 0x80, 0xC7, 0x92, 0xA0, 0x35, 0x06, 0x5F,
+    0xE8, 0x98, 0x6B, 0x66, 0x36, 0xA8, 0xCC, 0x87,
+};
+
+static const uint8_t impl_montmul_A[64] = {
+    0x4E, 0xCD, 0xAD, 0x3F, 0x94, 0xF0, 0xF9, 0xB9,
+    0x62, 0x2E, 0x53, 0x23, 0x82, 0xDE, 0x80, 0x18,
+    0x1D, 0xD5, 0x59, 0x6C, 0x0B, 0x6E, 0x9C, 0xBA,
+    0xC6, 0x85, 0x45, 0x60, 0x2F, 0x95, 0x98, 0x53,
+    0xC6, 0xE2, 0xBF, 0xC5, 0xDE, 0xBD, 0xBD, 0x5B,
+    0xC4, 0x1D, 0xB4, 0x44, 0x1D, 0xF3, 0xC5, 0xA7,
+    0xAE, 0x02, 0x08, 0x66, 0xD3, 0xBC, 0x3C, 0xF6,
+    0x56, 0xC2, 0x34, 0xF2, 0x3C, 0xA1, 0xB6, 0x4E,
+};
+
+static const uint8_t impl_montmul_B[64] = {
+    0x5F, 0x1D, 0xCB, 0x9E, 0x6E, 0x0B, 0x65, 0x0D,
+    0xC3, 0x34, 0x48, 0xA9, 0x74, 0xD1, 0xB0, 0x69,
+    0xD0, 0x48, 0x1A, 0xB0, 0xB9, 0x91, 0x55, 0x8B,
+    0xE6, 0x46, 0xFD, 0xE8, 0xE0, 0xBD, 0x35, 0x9D,
+    0x87, 0x5C, 0xCD, 0x34, 0xED, 0x28, 0x52, 0xA6,
+    0xC4, 0xD8, 0x35, 0xC5, 0x0A, 0x34, 0xC2, 0xE8,
+    0x6A, 0xBC, 0xC8, 0x10, 0x5A, 0xC8, 0x2F, 0x90,
+    0x28, 0xFE, 0x48, 0x41, 0x3A, 0xC4, 0x34, 0x45,
+};
+
+static const uint8_t impl_montmul_X[64] = {
+    0xE2, 0x58, 0x20, 0x55, 0x5A, 0x28, 0x05, 0xA7,
+    0x63, 0x4C, 0xA5, 0xEE, 0x43, 0x21, 0xAD, 0xB5,
+    0xB0, 0xF7, 0x7C, 0xB6, 0x06, 0x30, 0x8D, 0xE7,
+    0xA4, 0x03, 0x9A, 0x11, 0x48, 0xA3, 0xBB, 0xDE,
+    0xB6, 0xEA, 0xCE, 0x53, 0x74, 0xF3, 0x5A, 0xD1,
+    0xB4, 0x4D, 0x73, 0xF2, 0x3A, 0xEB, 0x33, 0x52,
+    0x2D, 0xA6, 0x7D, 0xFC, 0xA1, 0xD1, 0x3A, 0x17,
+    0x37, 0x84, 0xFE, 0xFA, 0xB2, 0xC4, 0x2E, 0x62,
+};
+
+#if defined(POLARSSL_ECP_NIST_FIXED)
+/* Field tests: p, a, b, a * b / R mod p, 32-bit limbs */
+#if defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+static const uint32_t impl_fe_p256[4][8] = {
+    { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000,
+      0x00000000, 0x00000000, 0x00000001, 0xFFFFFFFF },
+    { 0x9882BFE9, 0x88639BAC, 0x5185875C, 0x22B82EB7,
+      0x7CD08F30, 0xF0014AA3, 0x38E29ED0, 0x5380B6CC },
+    { 0x415353FD, 0x95228CCF, 0x6FEA062B, 0xF5CCB6E3,
+      0x9CAE9BEB, 0x7D5DB41D, 0xB169BE44, 0xB3C1FE21 },
+    { 0xC7F7891C, 0x9916E805, 0xAFABA530, 0x71213FF0,
+      0xE82A678E, 0xEE300FF0, 0x30888A37, 0x2588077B },
+};
+#endif
+
+#if defined(POLARSSL_ECP_DP_SECP384R1_ENABLED)
+static const uint32_t impl_fe_p384[4][12] = {
+    { 0xFFFFFFFF, 0x00000000, 0x00000000, 0xFFFFFFFF,
+      0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+      0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF },
+    { 0x7FF86CC7, 0xC37AD9F7, 0x6109CBDF, 0x44F96C45,
+      0xF7528B24, 0xEB3DABF7, 0xC6D73738, 0xB0BDA2FE,
+      0x8C49A2EC, 0x05B28820, 0x8AD3803E, 0xE9B5D7F2 },
+    { 0x26134DFF, 0x02FB1D0C, 0x33076085, 0xECF800D5,
+      0x15B32A5D, 0xDA8E7881, 0xF120FB1B, 0xF15772AD,
+      0xD41D9A67, 0x4DB23A04, 0x101BA88A, 0x0DBC2BB3 },
+    { 0xE292C7C4, 0x283BA176, 0x0073C5FF, 0xD6F1EBB7,
+      0x536263BE, 0xABB41C40, 0x42C9EF13, 0xD204D32A,
+      0x25E28731, 0x1FDEDF31, 0x4C1170F2, 0x01C5B5AA },
+};
+#endif
+#endif /* POLARSSL_ECP_NIST_FIXED */
+
+/*
+ * Little-endian bytes to limbs, len a multiple of ciL
+ */
+static void impl_read_limbs( t_uint *X, const uint8_t *buf, size_t len )
+{
+    size_t i;
+
+    for( i = 0; i < len; i++ )
+    {
+        if( i % ciL == 0 )
+            X[i / ciL] = 0;
+
+        X[i / ciL] |= (t_uint) buf[i] << ( ( i % ciL ) << 3 );
+    }
+}
+
+/*
+ * -N^-1 mod 2^biL, by Newton's iteration (as mpi_montg_init())
+ */
+static t_uint impl_montg_init( t_uint n0 )
+{
+    t_uint x = n0;
+    unsigned int i;
+
+    x += ( ( n0 + 2 ) & 4 ) << 1;
+
+    for( i = biL; i >= 8; i /= 2 )
+        x *= ( 2 - ( n0 * x ) );
+
+    return( ~x + 1 );
+}
+
+/*
+ * The hash test message, padded to blocks of padded bytes
+ */
+static void impl_kat_message( uint8_t *buf, size_t padded )
+{
+    size_t i;
+
+    for( i = 0; i < IMPL_KAT_MSG_LEN; i++ )
+        buf[i] = (uint8_t)( i * 7 + 3 );
+
+    __stosb( buf + i, 0, padded - i );
+    buf[i] = 0x80;
+    buf[padded - 2] = (uint8_t)( ( IMPL_KAT_MSG_LEN * 8 ) >> 8 );
+    buf[padded - 1] = (uint8_t)( IMPL_KAT_MSG_LEN * 8 );
+}
+
+static int impl_kat_aes_ctr( const impl_backend_t *b )
+{
+    aes_context_t ctx;
+    uint8_t key[32], counter[16], out[160];
+    size_t i;
+
+    for( i = 0; i < 32; i++ )
+        key[i] = (uint8_t) i;
+
+    aes_setkey_enc( &ctx, key );
+    __movsb( counter, impl_aes_ctr_start, 16 );
+
+    ( (impl_aes_ctr_t) b->fn )( &ctx, counter, 10, out );
+
+    return( memcmp( out, impl_aes_ctr_ks, sizeof( out ) ) == 0 &&
+            memcmp( counter, impl_aes_ctr_end, 16 ) == 0 );
+}
+
+#if defined(POLARSSL_SHA256_C)
+static int impl_kat_sha256( const impl_backend_t *b )
+{
+    uint8_t msg[320];
+    uint32_t state[8];
+    size_t i;
+
+    impl_kat_message( msg, sizeof( msg ) );
+    __movsb( state, impl_sha256_iv, sizeof( state ) );
+
+    ( (impl_sha256_t) b->fn )( state, msg, sizeof( msg ) / 64 );
+
+    for( i = 0; i < 32; i++ )
+        if( (uint8_t)( state[i / 4] >> ( 24 - 8 * ( i % 4 ) ) ) !=
+            impl_sha256_md[i] )
+            return( 0 );
+
+    return( 1 );
+}
+#endif /* POLARSSL_SHA256_C */
+
+#if defined(POLARSSL_SHA512_C)
+static int impl_kat_sha512( const impl_backend_t *b )
+{
+    uint8_t msg[384];
+    uint64_t state[8];
+    size_t i;
+
+    impl_kat_message( msg, sizeof( msg ) );
+    __movsb( state, impl_sha512_iv, sizeof( state ) );
+
+    ( (impl_sha512_t) b->fn )( state, msg, sizeof( msg ) / 128 );
+
+    for( i = 0; i < 64; i++ )
+        if( (uint8_t)( state[i / 8] >> ( 56 - 8 * ( i % 8 ) ) ) !=
+            impl_sha512_md[i] )
+            return( 0 );
+
+    return( 1 );
+}
+
+/*
+ * The SHA-512 test with the message of the AES-CBC test, 384 bytes and a
+ * tail block. The ciphertext must decrypt back with the reference code,
+ * and the IV end as its last block.
+ */
+static int impl_kat_aes_cbc_sha512( const impl_backend_t *b )
+{
+    aes_context_t ctx;
+    uint8_t key[32], iv[16], iv0[16], msg[400], out[400];
+    uint64_t state[8];
+    size_t i;
+
+    for( i = 0; i < 32; i++ )
+        key[i] = (uint8_t) i;
+
+    for( i = 0; i < 16; i++ )
+        iv0[i] = (uint8_t)( 0xF0 - i );
+
+    impl_kat_message( msg, 384 );
+    __movsb( msg + 384, impl_aes_ctr_start, 16 );
+    __movsb( state, impl_sha512_iv, sizeof( state ) );
+    __movsb( iv, iv0, 16 );
+
+    aes_setkey_enc( &ctx, key );
+    ( (impl_aes_cbc_sha512_t) b->fn )( &ctx, iv, sizeof( msg ), msg, out,
+                                       state, msg );
+
+    for( i = 0; i < 64; i++ )
+        if( (uint8_t)( state[i / 8] >> ( 56 - 8 * ( i % 8 ) ) ) !=
+            impl_sha512_md[i] )
+            return( 0 );
+
+    if( memcmp( iv, out + sizeof( out ) - 16, 16 ) != 0 )
+        return( 0 );
+
+    aes_setkey_dec( &ctx, key );
+    aes_crypt_cbc( &ctx, AES_DECRYPT, sizeof( out ), iv0, out, out );
+
+    return( memcmp( out, msg, sizeof( msg ) ) == 0 );
+}
+#endif /* POLARSSL_SHA512_C */
+
+static int impl_kat_muladd( const impl_backend_t *b )
+{
+    t_uint s[64 / ciL], d[80 / ciL], x[80 / ciL];
+    size_t i;
+
+    impl_read_limbs( s, impl_muladd_s, 64 );
+    impl_read_limbs( x, impl_muladd_d, 80 );
+
+    for( i = 0; i < 80 / ciL; i++ )
+        d[i] = ( i < 72 / ciL ) ? ~(t_uint) 0 : 0;
+
+    ( (impl_mpi_muladd_t) b->fn )( 64 / ciL, s, d, IMPL_MULADD_B );
+
+    return( memcmp( d, x, sizeof( d ) ) == 0 );
+}
+
+static int impl_kat_montmul( const impl_backend_t *b )
+{
+    t_uint N[64 / ciL], A[64 / ciL], B[64 / ciL], X[64 / ciL];
+    t_uint d[2 * ( 64 / ciL ) + 2], *r, z, c;
+    size_t i, n = 64 / ciL;
+
+    impl_read_limbs( N, impl_montmul_N, 64 );
+    impl_read_limbs( A, impl_montmul_A, 64 );
+    impl_read_limbs( B, impl_montmul_B, 64 );
+    impl_read_limbs( X, impl_montmul_X, 64 );
+    __stosb( d, 0, sizeof( d ) );
+
+    ( (impl_mpi_montmul_t) b->fn )( n, d, A, B, N, impl_montg_init( N[0] ) );
+
+    /* the result is below 2N: subtract N once if it is not below N */
+    r = d + n;
+    for( i = n; i > 0 && r[n] == 0; i-- )
+        if( r[i - 1] != N[i - 1] )
+            break;
+
+    if( r[n] != 0 || i == 0 || r[i - 1] > N[i - 1] )
+    {
+        for( i = 0, c = 0; i < n; i++ )
+        {
+            z = r[i] - c;
+            c = ( z > r[i] );
+            r[i] = z - N[i];
+            c += ( r[i] > z );
+        }
+        r[n] -= c;
+    }
+
+    return( r[n] == 0 && memcmp( r, X, sizeof( X ) ) == 0 );
+}
+
+#if defined(POLARSSL_ECP_NIST_FIXED)
+static int impl_kat_fe_mul_one( const impl_backend_t *b, size_t n,
+                                const uint32_t *p, const uint32_t *a,
+                                const uint32_t *bb, const uint32_t *x )
+{
+    uint32_t r[12];
+
+    /* in place, as the point formulas use it */
+    __movsb( r, a, n * 4 );
+    ( (impl_ecp_fe_mul_t) b->fn )( n, r, r, bb, p );
+
+    return( memcmp( r, x, n * 4 ) == 0 );
+}
+
+static int impl_kat_fe_mul( const impl_backend_t *b )
+{
+#if defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+    if( ! impl_kat_fe_mul_one( b, 8, impl_fe_p256[0], impl_fe_p256[1],
+                               impl_fe_p256[2], impl_fe_p256[3] ) )
+        return( 0 );
+#endif
+#if defined(POLARSSL_ECP_DP_SECP384R1_ENABLED)
+    if( ! impl_kat_fe_mul_one( b, 12, impl_fe_p384[0], impl_fe_p384[1],
+                               impl_fe_p384[2], impl_fe_p384[3] ) )
+        return( 0 );
+#endif
+
+    return( 1 );
+}
+#endif /* POLARSSL_ECP_NIST_FIXED */
+
+/*
+ * Benchmark workspace: 2048-bit operands for the bignum kernels
+ */
+#define IMPL_BENCH_BYTES    4096
+#define IMPL_BENCH_LIMBS    ( 256 / ciL )
+
+typedef struct
+{
+    aes_context_t aes;
+    uint8_t counter[16];
+    uint8_t buf[IMPL_BENCH_BYTES];
+    uint32_t state32[8];
+    uint64_t state64[8];
+    t_uint A[IMPL_BENCH_LIMBS];
+    t_uint B[IMPL_BENCH_LIMBS];
+    t_uint N[IMPL_BENCH_LIMBS];
+    t_uint d[2 * IMPL_BENCH_LIMBS + 2];
+    t_uint mm;
+    uint32_t fe[2][12];
+    const uint32_t *fe_p;
+    size_t fe_n;
+}
+impl_bench_ws;
+
+static void impl_run_aes_ctr( const impl_backend_t *b, impl_bench_ws *ws )
+{
+    ( (impl_aes_ctr_t) b->fn )( &ws->aes, ws->counter,
+                                IMPL_BENCH_BYTES / 16, ws->buf );
+}
+
+#if defined(POLARSSL_SHA256_C)
+static void impl_run_sha256( const impl_backend_t *b, impl_bench_ws *ws )
+{
+    ( (impl_sha256_t) b->fn )( ws->state32, ws->buf, IMPL_BENCH_BYTES / 64 );
+}
+#endif
+
+#if defined(POLARSSL_SHA512_C)
+static void impl_run_sha512( const impl_backend_t *b, impl_bench_ws *ws )
+{
+    ( (impl_sha512_t) b->fn )( ws->state64, ws->buf, IMPL_BENCH_BYTES / 128 );
+}
+
+static void impl_run_aes_cbc_sha512( const impl_backend_t *b,
+                                     impl_bench_ws *ws )
+{
+    /* in place, the hash one chunk behind as for a record */
+    ( (impl_aes_cbc_sha512_t) b->fn )( &ws->aes, ws->counter,
+                                       IMPL_BENCH_BYTES - 128,
+                                       ws->buf + 128, ws->buf + 128,
+                                       ws->state64, ws->buf );
+}
+#endif
+
+static void impl_run_muladd( const impl_backend_t *b, impl_bench_ws *ws )
+{
+    /* one row of a 2048 x 2048-bit product; d[n + 1] absorbs the carries */
+    ( (impl_mpi_muladd_t) b->fn )( IMPL_BENCH_LIMBS, ws->A, ws->d, ws->B[0] );
+}
+
+static void impl_run_montmul( const impl_backend_t *b, impl_bench_ws *ws )
+{
+    __stosb( ws->d, 0, sizeof( ws->d ) );
+    ( (impl_mpi_montmul_t) b->fn )( IMPL_BENCH_LIMBS, ws->d, ws->A, ws->B,
+                                    ws->N, ws->mm );
+}
+
+#if defined(POLARSSL_ECP_NIST_FIXED)
+static void impl_run_fe_mul( const impl_backend_t *b, impl_bench_ws *ws )
+{
+    ( (impl_ecp_fe_mul_t) b->fn )( ws->fe_n, ws->fe[0], ws->fe[0], ws->fe[1],
+                                   ws->fe_p );
+}
+#endif
+
+typedef struct
+{
+    const char *name;
+    int (*kat)( const impl_backend_t * );
+    void (*run)( const impl_backend_t *, impl_bench_ws * );
+    size_t bytes;               /* processed by one run */
+}
+impl_primitive_info;
+
+static const impl_primitive_info impl_info[IMPL_PRIMITIVES] =
+{
+    { "AES-CTR",    impl_kat_aes_ctr, impl_run_aes_ctr, IMPL_BENCH_BYTES },
+#if defined(POLARSSL_SHA256_C)
+    { "SHA-256",    impl_kat_sha256,  impl_run_sha256,  IMPL_BENCH_BYTES },
+#else
+    { "SHA-256",    NULL,             NULL,             0 },
+#endif
+#if defined(POLARSSL_SHA512_C)
+    { "SHA-512",    impl_kat_sha512,  impl_run_sha512,  IMPL_BENCH_BYTES },
+#else
+    { "SHA-512",    NULL,             NULL,             0 },
+#endif
+    { "MPI-MULADD", impl_kat_muladd,  impl_run_muladd,  256 },
+    { "MPI-MONT",   impl_kat_montmul, impl_run_montmul, 256 },
+#if defined(POLARSSL_ECP_NIST_FIXED)
+    { "ECP-FE-MUL", impl_kat_fe_mul,  impl_run_fe_mul,  0 },
+#else
+    { "ECP-FE-MUL", NULL,             NULL,             0 },
+#endif
+#if defined(POLARSSL_SHA512_C)
+    { "CBC-SHA512", impl_kat_aes_cbc_sha512, impl_run_aes_cbc_sha512,
+                    IMPL_BENCH_BYTES - 128 },
+#else
+    { "CBC-SHA512", NULL,             NULL,             0 },
+#endif
+};
+
+/*
+ * Append a backend without testing it; the caller holds impl_mutex or
+ * runs from impl_init()
+ */
+static int impl_add( const impl_backend_t *backend, int kat )
+{
+    impl_table *t = &impl_tables[backend->prim];
+
+    if( t->count >= IMPL_MAX_BACKENDS )
+        return( POLARSSL_ERR_IMPL_TABLE_FULL );
+
+    t->slot[t->count].backend = backend;
+    t->slot[t->count].kat = kat;
+    t->count++;
+
+    return( 0 );
+}
+
+static void impl_init( void )
+{
+    size_t i;
+
+    mutex_init( &impl_mutex );
+
+    for( i = 0; impl_builtin[i] != NULL; i++ )
+        if( impl_builtin[i]->fn != NULL )
+            impl_add( impl_builtin[i], IMPL_KAT_UNTESTED );
+}
+
+/*
+ * Known-answer test result of a slot, running the test if needed. The
+ * caller checked the CPU features.
+ */
+static int impl_slot_kat( impl_slot *s )
+{
+    const impl_primitive_info *info = &impl_info[s->backend->prim];
+
+    if( s->kat == IMPL_KAT_UNTESTED )
+        s->kat = ( info->kat != NULL && info->kat( s->backend ) ) ?
+                 IMPL_KAT_PASSED : IMPL_KAT_FAILED;
+
+    return( s->kat );
+}
+
+int impl_register( const impl_backend_t *backend )
+{
+    int ret, kat = IMPL_KAT_UNTESTED;
+
+    if( backend == NULL || backend->fn == NULL ||
+        (unsigned int) backend->prim >= IMPL_PRIMITIVES ||
+        impl_info[backend->prim].kat == NULL )
+        return( POLARSSL_ERR_IMPL_BAD_INPUT_DATA );
+
+    async_once( &impl_once, impl_init );
+
+    if( cpu_supports( backend->cpu ) )
+    {
+        if( ! impl_info[backend->prim].kat( backend ) )
+            return( POLARSSL_ERR_IMPL_KAT_FAILED );
+
+        kat = IMPL_KAT_PASSED;
+    }
+
+    mutex_lock( &impl_mutex );
+    ret = impl_add( backend, kat );
+    mutex_unlock( &impl_mutex );
+
+    return( ret );
+}
+
+const impl_backend_t *impl_select( impl_primitive_t prim )
+{
+    impl_table *t;
+    impl_slot *s, *best = NULL;
+    size_t i, count;
+
+    if( (unsigned int) prim >= IMPL_PRIMITIVES )
+        return( NULL );
+
+    async_once( &impl_once, impl_init );
+
+    t = &impl_tables[prim];
+    count = t->count;
+
+    for( i = 0; i < count; i++ )
+    {
+        s = &t->slot[i];
+
+        if( best != NULL && s->backend->priority <= best->backend->priority )
+            continue;
+
+        if( cpu_supports( s->backend->cpu ) &&
+            impl_slot_kat( s ) == IMPL_KAT_PASSED )
+            best = s;
+    }
+
+    return( ( best != NULL ) ? best->backend : NULL );
+}
+
+/*
+ * Time stamp counter, or the performance counter where there is none
+ */
+static uint64_t impl_cycles( void )
+{
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    return( __rdtsc() );
+#else
+    return( hardclock() );
+#endif
+}
+
+static void impl_bench_ws_init( impl_bench_ws *ws )
+{
+    uint8_t key[32];
+    size_t i;
+
+    for( i = 0; i < 32; i++ )
+        key[i] = (uint8_t) i;
+
+    aes_setkey_enc( &ws->aes, key );
+
+    for( i = 0; i < IMPL_BENCH_BYTES; i++ )
+        ws->buf[i] = (uint8_t)( i * 7 + 3 );
+
+    /* odd, full-size modulus and operands below it */
+    impl_read_limbs( ws->A, ws->buf, sizeof( ws->A ) );
+    impl_read_limbs( ws->B, ws->buf + 1024, sizeof( ws->B ) );
+    impl_read_limbs( ws->N, ws->buf + 2048, sizeof( ws->N ) );
+    ws->N[0] |= 1;
+    ws->N[IMPL_BENCH_LIMBS - 1] |= (t_uint) 1 << ( biL - 1 );
+    ws->A[IMPL_BENCH_LIMBS - 1] >>= 1;
+    ws->B[IMPL_BENCH_LIMBS - 1] >>= 1;
+    ws->mm = impl_montg_init( ws->N[0] );
+
+#if defined(POLARSSL_ECP_NIST_FIXED)
+#if defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+    ws->fe_n = 8;
+    ws->fe_p = impl_fe_p256[0];
+    __movsb( ws->fe[0], impl_fe_p256[1], 8 * 4 );
+    __movsb( ws->fe[1], impl_fe_p256[2], 8 * 4 );
+#else
+    ws->fe_n = 12;
+    ws->fe_p = impl_fe_p384[0];
+    __movsb( ws->fe[0], impl_fe_p384[1], 12 * 4 );
+    __movsb( ws->fe[1], impl_fe_p384[2], 12 * 4 );
+#endif
+#endif /* POLARSSL_ECP_NIST_FIXED */
+}
+
+static void impl_bench_one( const impl_primitive_info *info,
+                            impl_slot *s, int selected, impl_bench_ws *ws,
+                            int ms, char *line, size_t size )
+{
+    struct hr_time timer;
+    ulong_t elapsed;
+    uint64_t start, cycles, ops = 0, batch = 1, i, bytes, cpb, ops_s;
+    const impl_backend_t *b = s->backend;
+
+    if( ! cpu_supports( b->cpu ) )
+    {
+        fn__snprintf( line, size, "%-10s %-8s   not supported by this CPU",
+                      info->name, b->name );
+        return;
+    }
+
+    if( impl_slot_kat( s ) != IMPL_KAT_PASSED )
+    {
+        fn__snprintf( line, size, "%-10s %-8s   failed its known-answer test",
+                      info->name, b->name );
+        return;
+    }
+
+    /* warm up, then grow the batches so that reading the timer is cheap */
+    info->run( b, ws );
+
+    get_timer( &timer, 1 );
+    start = impl_cycles();
+
+    do
+    {
+        for( i = 0; i < batch; i++ )
+            info->run( b, ws );
+
+        ops += batch;
+        if( batch < 1024 )
+            batch *= 2;
+    }
+    while( ( elapsed = get_timer( &timer, 0 ) ) < (ulong_t) ms );
+
+    cycles = impl_cycles() - start;
+
+    bytes = ops * ( info->bytes != 0 ? info->bytes : ws->fe_n * 4 );
+    cpb = ( cycles * 100 ) / bytes;
+    ops_s = ( elapsed != 0 ) ? ( ops * 1000 ) / elapsed : 0;
+
+    fn__snprintf( line, size, "%-10s %-8s %c %6u.%02u cycles/byte %10u ops/s",
+                  info->name, b->name, selected ? '*' : ' ',
+                  (unsigned int)( cpb / 100 ), (unsigned int)( cpb % 100 ),
+                  (unsigned int) ops_s );
+}
+
+void impl_bench( void (*f_out)( void *, const char * ), void *p_out,
+                 int ms )
+{
+    impl_bench_ws *ws;
+    impl_table *t;
+    const impl_backend_t *sel;
+    char line[128];
+    size_t i, j;
+
+    async_once( &impl_once, impl_init );
+
+    if( ( ws = (impl_bench_ws *) memory_alloc( sizeof( impl_bench_ws ) ) ) == NULL )
+        return;
+
+    impl_bench_ws_init( ws );
+
+    for( i = 0; i < IMPL_PRIMITIVES; i++ )
+    {
+        t = &impl_tables[i];
+        sel = impl_select( (impl_primitive_t) i );
+
+        for( j = 0; j < t->count; j++ )
+        {
+            impl_bench_one( &impl_info[i], &t->slot[j],
+                            t->slot[j].backend == sel, ws, ms,
+                            line, sizeof( line ) );
+            f_out( p_out, line );
+        }
+    }
+
+    __stosb( ws, 0, sizeof( impl_bench_ws ) );
+    memory_free( ws );
+}
+
+#endif /* POLARSSL_IMPL_C */
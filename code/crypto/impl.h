@@ -0,0 +1,195 @@
+#ifndef POLARSSL_IMPL_H
+#define POLARSSL_IMPL_H
+
+#include "config.h"
+#include "aes.h"
+#include "bignum.h"
+
+#define POLARSSL_ERR_IMPL_BAD_INPUT_DATA                   -0x0070  /**< Bad input parameters to function. */
+#define POLARSSL_ERR_IMPL_TABLE_FULL                       -0x0072  /**< No room left for another backend of this primitive. */
+#define POLARSSL_ERR_IMPL_KAT_FAILED                       -0x0074  /**< The backend does not pass its known-answer test. */
+
+#define IMPL_MAX_BACKENDS       8   /**< Backends per primitive */
+
+/**
+ * \brief       Primitives with interchangeable kernels.
+ *
+ *              The comment of each value gives the type of the kernel,
+ *              which all its backends implement with the same contract.
+ */
+typedef enum
+{
+    IMPL_AES_CTR = 0,       /**< impl_aes_ctr_t     */
+    IMPL_SHA256,            /**< impl_sha256_t      */
+    IMPL_SHA512,            /**< impl_sha512_t      */
+    IMPL_MPI_MULADD,        /**< impl_mpi_muladd_t  */
+    IMPL_MPI_MONTMUL,       /**< impl_mpi_montmul_t */
+    IMPL_ECP_FE_MUL,        /**< impl_ecp_fe_mul_t  */
+    IMPL_AES_CBC_SHA512,    /**< impl_aes_cbc_sha512_t */
+    IMPL_PRIMITIVES
+}
+impl_primitive_t;
+
+/**
+ * AES-CTR keystream: for each of the blocks, increment the 128-bit
+ * big-endian counter then encrypt it into output.
+ */
+typedef void (*impl_aes_ctr_t)( aes_context_t *ctx, uint8_t counter[16],
+                                size_t blocks, uint8_t *output );
+
+/**
+ * SHA-256 compression of consecutive 64-byte blocks
+ */
+typedef void (*impl_sha256_t)( uint32_t state[8], const uint8_t *data,
+                               size_t blocks );
+
+/**
+ * SHA-512 compression of consecutive 128-byte blocks
+ */
+typedef void (*impl_sha512_t)( uint64_t state[8], const uint8_t *data,
+                               size_t blocks );
+
+/**
+ * Bignum multiply-accumulate row: d[0..i] += s[0..i-1] * b, then the carry
+ * is propagated into d[i + 1], d[i + 2], ... until it is absorbed.
+ */
+typedef void (*impl_mpi_muladd_t)( size_t i, t_uint *s, t_uint *d,
+                                   t_uint b );
+
+/**
+ * Montgomery multiplication on n limbs: d has 2n + 2 limbs, all zero on
+ * entry, and receives a * b * R^-1 mod N in d[n..2n], possibly plus N.
+ * mm is -N^-1 mod 2^biL.
+ */
+typedef void (*impl_mpi_montmul_t)( size_t n, t_uint *d, const t_uint *a,
+                                    const t_uint *b, const t_uint *N,
+                                    t_uint mm );
+
+/**
+ * Field multiplication for the fixed-limb NIST curves: r = a * b / R mod p
+ * with R = 2^(32n), n <= 12, p = -1 mod 2^32, a and b fully reduced.
+ * r is fully reduced and may alias a or b.
+ */
+typedef void (*impl_ecp_fe_mul_t)( size_t n, uint32_t *r, const uint32_t *a,
+                                   const uint32_t *b, const uint32_t *p );
+
+/**
+ * AES-CBC encryption of length bytes (a multiple of 16), iv being updated,
+ * stitched with the SHA-512 compression of length / 128 blocks from hash
+ * unless hash is NULL. Block j goes with output bytes 128 j to 128 j + 127
+ * and may lie in the output written before them, never after.
+ */
+typedef void (*impl_aes_cbc_sha512_t)( aes_context_t *ctx, uint8_t iv[16],
+                                       size_t length, const uint8_t *input,
+                                       uint8_t *output, uint64_t state[8],
+                                       const uint8_t *hash );
+
+/**
+ * \brief       One implementation of a primitive
+ */
+typedef struct
+{
+    impl_primitive_t prim;  /*!< primitive implemented                  */
+    const char *name;       /*!< short name, e.g. "aesni"               */
+    uint32_t cpu;           /*!< CPU_XXX features the kernel needs      */
+    int priority;           /*!< higher is preferred                    */
+    void (*fn)( void );     /*!< kernel, cast to the type of prim       */
+}
+impl_backend_t;
+
+/**
+ * Kernel pointer for impl_backend_t.fn
+ */
+#define IMPL_FN( f )    ( (void (*)( void )) (f) )
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(POLARSSL_IMPL_C)
+/**
+ * \brief       Add a backend to the registry
+ *
+ *              If the CPU has the features the backend needs, its
+ *              known-answer test runs now; otherwise it runs the first
+ *              time the backend could be selected.
+ *
+ * \param backend   backend description, must stay valid
+ *
+ * \return      0 if successful,
+ *              POLARSSL_ERR_IMPL_BAD_INPUT_DATA, POLARSSL_ERR_IMPL_TABLE_FULL
+ *              or POLARSSL_ERR_IMPL_KAT_FAILED
+ *
+ * \note        Backends cannot be removed. Register them at start-up:
+ *              a call racing with impl_select() on the same primitive
+ *              may or may not be seen by it.
+ */
+int impl_register( const impl_backend_t *backend );
+
+/**
+ * \brief       Pick the backend to use for a primitive
+ *
+ *              The backend with the highest priority among those whose
+ *              CPU features are available (see cpu_supports()) and which
+ *              pass their known-answer test. Cheap enough to be called
+ *              once per operation, so cpu_mask() still takes effect
+ *              immediately.
+ *
+ * \param prim  primitive
+ *
+ * \return      the backend, or NULL if none is usable: callers then fall
+ *              back to their own portable code
+ */
+const impl_backend_t *impl_select( impl_primitive_t prim );
+
+/**
+ * \brief       Benchmark every usable backend of every primitive
+ *              (crypto-bench)
+ *
+ *              Writes one line per backend to f_out, giving the
+ *              cycles per byte, the operations per second and whether
+ *              impl_select() currently picks it. Each backend runs for
+ *              about ms milliseconds.
+ *
+ * \param f_out     output function, called with p_out and a line of text
+ *                  without a trailing newline
+ * \param p_out     output parameter
+ * \param ms        time to spend on each backend, in milliseconds
+ */
+void impl_bench( void (*f_out)( void *, const char * ), void *p_out,
+                 int ms );
+#else
+/* Without the registry every primitive runs its portable code */
+#define impl_select( prim )     ( (const impl_backend_t *) NULL )
+#endif /* POLARSSL_IMPL_C */
+
+/*
+ * Built-in backends, defined next to their kernels. A backend whose kernel
+ * is not compiled in this configuration has a NULL fn.
+ */
+extern const impl_backend_t aes_ctr_aesni_impl;
+extern const impl_backend_t aes_ctr_c_impl;
+#if defined(POLARSSL_SHA256_C)
+extern const impl_backend_t sha256_shani_impl;
+extern const impl_backend_t sha256_c_impl;
+#endif
+#if defined(POLARSSL_SHA512_C)
+extern const impl_backend_t sha512_avx512_impl;
+extern const impl_backend_t sha512_avx2_impl;
+extern const impl_backend_t sha512_c_impl;
+extern const impl_backend_t aes_cbc_sha512_aesni_impl;
+extern const impl_backend_t aes_cbc_sha512_c_impl;
+#endif
+extern const impl_backend_t mpi_muladd_adx_impl;
+extern const impl_backend_t mpi_muladd_c_impl;
+extern const impl_backend_t mpi_montmul_adx_impl;
+extern const impl_backend_t mpi_montmul_cios_impl;
+#if defined(POLARSSL_ECP_NIST_FIXED)
+extern const impl_backend_t ecp_nist_fe_mul_impl;
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* impl.h */
@@ -15,25 +15,102 @@
  */
 #define ADD_LEN(s)      s, OID_SIZE(s)
 
+/*
+ * Hashed index over an OID table, built on the first lookup. The tables
+ * keep their declaration order, which the reverse lookups by attribute
+ * rely on; each slot holds the position + 1 of an entry, with linear
+ * probing. Tables must have less than OID_INDEX_SLOTS / 2 entries.
+ */
+#define OID_INDEX_SLOTS     64
+
+typedef struct
+{
+    async_once_t once;
+    uint8_t slot[OID_INDEX_SLOTS];
+}
+oid_index_t;
+
+/*
+ * OIDs of a table share their leading arcs, so hash the length and the
+ * last two bytes, where they differ
+ */
+static uint32_t oid_hash( const uint8_t *p, size_t len )
+{
+    uint32_t h = (uint32_t) len;
+
+    if( len >= 2 )
+        h ^= ( (uint32_t) p[len - 1] << 8 ) ^ ( (uint32_t) p[len - 2] << 16 );
+
+    h *= 0x9E3779B1;
+
+    return( h >> 26 );  /* log2( OID_INDEX_SLOTS ) bits */
+}
+
+static void oid_index_build( oid_index_t *index, const void *list,
+                             size_t size )
+{
+    const uint8_t *p = (const uint8_t *) list;
+    const oid_descriptor_t *cur;
+    uint32_t h;
+    size_t i;
+
+    for( i = 0; ; i++, p += size )
+    {
+        cur = (const oid_descriptor_t *) p;
+        if( cur->asn1 == NULL )
+            break;
+
+        h = oid_hash( (const uint8_t *) cur->asn1, cur->asn1_len );
+        while( index->slot[h] != 0 )
+            h = ( h + 1 ) & ( OID_INDEX_SLOTS - 1 );
+
+        index->slot[h] = (uint8_t)( i + 1 );
+    }
+}
+
+/*
+ * Compare the DER length and last byte before the whole encoding: entries
+ * of a table differ mostly at the end
+ */
+static const void *oid_index_find( const oid_index_t *index, const void *list,
+                                   size_t size, const asn1_buf *oid )
+{
+    const oid_descriptor_t *cur;
+    uint32_t h;
+
+    if( oid == NULL || oid->len < 2 )
+        return( NULL );
+
+    for( h = oid_hash( oid->p, oid->len ); index->slot[h] != 0;
+         h = ( h + 1 ) & ( OID_INDEX_SLOTS - 1 ) )
+    {
+        cur = (const oid_descriptor_t *)
+              ( (const uint8_t *) list + ( index->slot[h] - 1 ) * size );
+
+        if( cur->asn1_len == oid->len &&
+            (uint8_t) cur->asn1[oid->len - 1] == oid->p[oid->len - 1] &&
+            memcmp( cur->asn1, oid->p, oid->len ) == 0 )
+            return( cur );
+    }
+
+    return( NULL );
+}
+
 /*
  * Macro to generate an internal function for oid_XXX_from_asn1() (used by
  * the other functions)
  */
 #define FN_OID_TYPED_FROM_ASN1( TYPE_T, NAME, LIST )                        \
+static oid_index_t oid_ ## NAME ## _index = { ASYNC_ONCE_INIT };            \
+static void oid_ ## NAME ## _index_build( void )                            \
+{                                                                           \
+    oid_index_build( &oid_ ## NAME ## _index, LIST, sizeof( TYPE_T ) );     \
+}                                                                           \
 static const TYPE_T * oid_ ## NAME ## _from_asn1( const asn1_buf *oid )     \
 {                                                                           \
-    const TYPE_T *p = LIST;                                                 \
-    const oid_descriptor_t *cur = (const oid_descriptor_t *) p;             \
-    if( p == NULL || oid == NULL ) return( NULL );                          \
-    while( cur->asn1 != NULL ) {                                            \
-        if( cur->asn1_len == oid->len &&                                    \
-            memcmp( cur->asn1, oid->p, oid->len ) == 0 ) {                  \
-            return( p );                                                    \
-        }                                                                   \
-        p++;                                                                \
-        cur = (const oid_descriptor_t *) p;                                 \
-    }                                                                       \
-    return( NULL );                                                         \
+    async_once( &oid_ ## NAME ## _index.once, oid_ ## NAME ## _index_build );\
+    return( (const TYPE_T *) oid_index_find( &oid_ ## NAME ## _index,       \
+                                             LIST, sizeof( TYPE_T ), oid ) );\
 }
 
 /*
@@ -290,6 +367,22 @@ static const oid_sig_alg_t oid_sig_alg[] =
         { ADD_LEN( OID_PKCS1_SHA512 ),     "sha512WithRSAEncryption",  "RSA with SHA-512" },
         POLARSSL_MD_SHA512,   POLARSSL_PK_RSA,
     },
+    {
+        { ADD_LEN( OID_ECDSA_SHA224 ),     "ecdsa-with-SHA224",    "ECDSA with SHA224" },
+        POLARSSL_MD_SHA224,   POLARSSL_PK_ECDSA,
+    },
+    {
+        { ADD_LEN( OID_ECDSA_SHA256 ),     "ecdsa-with-SHA256",    "ECDSA with SHA256" },
+        POLARSSL_MD_SHA256,   POLARSSL_PK_ECDSA,
+    },
+    {
+        { ADD_LEN( OID_ECDSA_SHA384 ),     "ecdsa-with-SHA384",    "ECDSA with SHA384" },
+        POLARSSL_MD_SHA384,   POLARSSL_PK_ECDSA,
+    },
+    {
+        { ADD_LEN( OID_ECDSA_SHA512 ),     "ecdsa-with-SHA512",    "ECDSA with SHA512" },
+        POLARSSL_MD_SHA512,   POLARSSL_PK_ECDSA,
+    },
     {
         { NULL, 0, NULL, NULL },
         0, 0,
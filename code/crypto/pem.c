@@ -6,9 +6,14 @@
 #include "base64.h"
 #include "aes.h"
 #include "cipher.h"
+#include "cpu.h"
 
 #include <stdlib.h>
 
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
+
 #if defined(POLARSSL_PEM_PARSE_C)
 void pem_init( pem_context *ctx )
 {
@@ -94,6 +99,203 @@ void pem_free( pem_context *ctx )
 
     __stosb( ctx, 0, sizeof( pem_context ) );
 }
+
+#define PEM_SIMD_NONE   0
+#define PEM_SIMD_SSE2   1
+#define PEM_SIMD_AVX2   2
+
+/*
+ * Position of the next c in [p, end), or end. A '-' only appears on armor
+ * lines, so base64 bodies are skipped a vector at a time.
+ */
+static const uint8_t *pem_find_char( const uint8_t *p, const uint8_t *end,
+                                     uint8_t c, int simd )
+{
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    if( simd == PEM_SIMD_AVX2 )
+    {
+        const __m256i v = _mm256_set1_epi8( (char) c );
+
+        while( end - p >= 32 &&
+               _mm256_movemask_epi8( _mm256_cmpeq_epi8(
+                   _mm256_loadu_si256( (const __m256i *) p ), v ) ) == 0 )
+            p += 32;
+
+        _mm256_zeroupper();
+    }
+
+    if( simd != PEM_SIMD_NONE )
+    {
+        const __m128i v = _mm_set1_epi8( (char) c );
+
+        while( end - p >= 16 &&
+               _mm_movemask_epi8( _mm_cmpeq_epi8(
+                   _mm_loadu_si128( (const __m128i *) p ), v ) ) == 0 )
+            p += 16;
+    }
+#else
+    ((void) simd);
+#endif
+
+    while( p < end && *p != c )
+        p++;
+
+    return( p );
+}
+
+static const uint8_t *pem_find( const uint8_t *p, const uint8_t *end,
+                                const char *s, size_t slen, int simd )
+{
+    while( ( p = pem_find_char( p, end, (uint8_t) s[0], simd ) ) != end )
+    {
+        if( (size_t)( end - p ) < slen )
+            break;
+
+        if( memcmp( p, s, slen ) == 0 )
+            return( p );
+
+        p++;
+    }
+
+    return( NULL );
+}
+
+void pem_bundle_init( pem_bundle *ctx )
+{
+    __stosb( ctx, 0, sizeof( pem_bundle ) );
+}
+
+/*
+ * The decoded data grows from the bottom of the arena and the objects from
+ * the top. A block takes at least over input bytes besides its body, and
+ * a body of n bytes decodes to at most 3n/4, so 3/4 of the input is enough
+ * unless an object is larger than 3/4 of over.
+ */
+int pem_read_all( pem_bundle *ctx, const char *header, const char *footer,
+                  const uint8_t *data, size_t len )
+{
+    int ret, simd = PEM_SIMD_NONE;
+    size_t hlen, flen, over, dlen, i, n;
+    const uint8_t *p, *s1, *s2, *end;
+    uint8_t *out;
+    pem_object *obj, *top, t;
+    base64_context b64;
+
+    if( ctx == NULL || header == NULL || footer == NULL || data == NULL ||
+        header[0] == '\0' || footer[0] == '\0' )
+        return( POLARSSL_ERR_PEM_BAD_INPUT_DATA );
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    if( cpu_supports( CPU_AVX2 ) )
+        simd = PEM_SIMD_AVX2;
+    else if( cpu_supports( CPU_SSE2 ) )
+        simd = PEM_SIMD_SSE2;
+#endif
+
+    hlen = strlen( header );
+    flen = strlen( footer );
+    over = hlen + 1 + flen;
+
+    ctx->size = ( len / 4 ) * 3 + 3 + 2 * sizeof( pem_object );
+    if( 4 * sizeof( pem_object ) > 3 * over )
+        ctx->size += ( len / over + 1 ) *
+                     ( sizeof( pem_object ) - ( 3 * over ) / 4 );
+
+    if( ( ctx->arena = (uint8_t *) memory_alloc( ctx->size ) ) == NULL )
+    {
+        ctx->size = 0;
+        return( POLARSSL_ERR_PEM_MALLOC_FAILED );
+    }
+
+    out = ctx->arena;
+    top = obj = (pem_object *)( ctx->arena +
+                                ctx->size - ctx->size % sizeof( pem_object ) );
+    end = data + len;
+
+    for( p = data; ; )
+    {
+        if( ( s1 = pem_find( p, end, header, hlen, simd ) ) == NULL )
+            break;
+
+        s1 += hlen;
+        if( s1 < end && *s1 == '\r' ) s1++;
+        if( s1 < end && *s1 == '\n' ) s1++;
+        else break;
+
+        if( ( s2 = pem_find( s1, end, footer, flen, simd ) ) == NULL )
+            break;
+
+        p = s2 + flen;
+        if( p < end && *p == '\r' ) p++;
+        if( p < end && *p == '\n' ) p++;
+
+        dlen = ( (size_t)( s2 - s1 ) / 4 ) * 3;
+
+        if( (uint8_t *)( obj - 1 ) < out + dlen )
+        {
+            pem_bundle_free( ctx );
+            return( POLARSSL_ERR_PEM_BAD_INPUT_DATA );
+        }
+
+        obj--;
+        obj->der = out;
+        obj->len = 0;
+        obj->ret = 0;
+
+        if( (size_t)( end - s1 ) >= 22 &&
+            memcmp( s1, "Proc-Type: 4,ENCRYPTED", 22 ) == 0 )
+        {
+            obj->ret = POLARSSL_ERR_PEM_FEATURE_UNAVAILABLE;
+            continue;
+        }
+
+        /*
+         * A trailing partial quartet is dropped, as base64_decode() does
+         */
+        base64_init( &b64 );
+
+        if( ( ret = base64_decode_update( &b64, out, &dlen, s1,
+                                          s2 - s1 ) ) != 0 )
+        {
+            obj->ret = POLARSSL_ERR_PEM_INVALID_DATA + ret;
+            continue;
+        }
+
+        obj->len = dlen;
+        out += dlen;
+    }
+
+    n = top - obj;
+
+    if( n == 0 )
+    {
+        pem_bundle_free( ctx );
+        return( 0 );
+    }
+
+    for( i = 0; i < n / 2; i++ )
+    {
+        t = obj[i];
+        obj[i] = obj[n - 1 - i];
+        obj[n - 1 - i] = t;
+    }
+
+    ctx->obj = obj;
+    ctx->count = n;
+
+    return( 0 );
+}
+
+void pem_bundle_free( pem_bundle *ctx )
+{
+    if( ctx->arena != NULL )
+    {
+        __stosb( ctx->arena, 0, ctx->size );
+        memory_free( ctx->arena );
+    }
+
+    __stosb( ctx, 0, sizeof( pem_bundle ) );
+}
 #endif /* POLARSSL_PEM_PARSE_C */
 
 #if defined(POLARSSL_PEM_WRITE_C)
@@ -74,6 +74,67 @@ int pem_read_buffer( pem_context *ctx, const char *header, const char *footer,
  * \param ctx   context to be freed
  */
 void pem_free( pem_context *ctx );
+
+/**
+ * \brief       One block found by pem_read_all()
+ */
+typedef struct
+{
+    const uint8_t *der;     /*!< decoded data, inside the bundle arena  */
+    size_t len;             /*!< length of the decoded data            */
+    int ret;                /*!< 0, or the PEM error of this block      */
+}
+pem_object;
+
+/**
+ * \brief       Every block of a PEM buffer, decoded in one allocation
+ */
+typedef struct
+{
+    uint8_t *arena;         /*!< decoded data and obj                  */
+    size_t size;            /*!< size of the arena                     */
+    pem_object *obj;        /*!< blocks, in the order of the input     */
+    size_t count;           /*!< number of blocks                      */
+}
+pem_bundle;
+
+/**
+ * \brief       PEM bundle setup
+ *
+ * \param ctx   bundle to be initialized
+ */
+void pem_bundle_init( pem_bundle *ctx );
+
+/**
+ * \brief       Find every header / footer pair of a buffer in one pass
+ *              and decode the blocks into a single arena.
+ *
+ *              Blocks that cannot be decoded (encrypted, bad base64) are
+ *              listed with their error and skipped. The scan stops at the
+ *              first header without a line break or without a footer.
+ *
+ * \param ctx       bundle to fill, initialized with pem_bundle_init()
+ * \param header    header string to seek and expect
+ * \param footer    footer string to seek and expect
+ * \param data      source data, need not be zero-terminated
+ * \param len       length of data
+ *
+ * \note            Armor lines are located with SSE2 / AVX2 when
+ *                  available; bodies are decoded with the base64 kernels.
+ *
+ * \return          0 on success (possibly with no block),
+ *                  POLARSSL_ERR_PEM_BAD_INPUT_DATA or
+ *                  POLARSSL_ERR_PEM_MALLOC_FAILED
+ */
+int pem_read_all( pem_bundle *ctx, const char *header, const char *footer,
+                  const uint8_t *data, size_t len );
+
+/**
+ * \brief       PEM bundle memory freeing
+ *
+ * \param ctx   bundle to be freed
+ */
+void pem_bundle_free( pem_bundle *ctx );
 #endif /* POLARSSL_PEM_PARSE_C */
 
 #if defined(POLARSSL_PEM_WRITE_C)
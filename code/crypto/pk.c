@@ -47,6 +47,8 @@ const pk_info_t * pk_info_from_type( pk_type_t pk_type )
             return &eckey_info;
         case POLARSSL_PK_ECKEY_DH:
             return &eckeydh_info;
+        case POLARSSL_PK_ECDSA:
+            return &ecdsa_info;
         /* POLARSSL_PK_RSA_ALT omitted on purpose */
         default:
             return NULL;
@@ -52,6 +52,7 @@ typedef enum {
     POLARSSL_PK_RSA,
     POLARSSL_PK_ECKEY,
     POLARSSL_PK_ECKEY_DH,
+    POLARSSL_PK_ECDSA,
     POLARSSL_PK_RSA_ALT,
 } pk_type_t;
 
@@ -10,6 +10,7 @@
 /* Even if RSA not activated, for the sake of RSA-alt */
 #include "rsa.h"
 #include "ecp.h"
+#include "ecdsa.h"
 
 /* Used by RSA-alt too */
 static int rsa_can_do( pk_type_t type )
@@ -127,7 +128,8 @@ const pk_info_t rsa_info = {
 static int eckey_can_do( pk_type_t type )
 {
     return( type == POLARSSL_PK_ECKEY ||
-            type == POLARSSL_PK_ECKEY_DH);
+            type == POLARSSL_PK_ECKEY_DH ||
+            type == POLARSSL_PK_ECDSA );
 }
 
 static size_t eckey_get_size( const void *ctx )
@@ -135,6 +137,35 @@ static size_t eckey_get_size( const void *ctx )
     return( ((ecp_keypair *) ctx)->grp.pbits );
 }
 
+/* Forward declarations */
+static int ecdsa_verify_wrap( void *ctx, md_type_t md_alg,
+                       const uint8_t *hash, size_t hash_len,
+                       const uint8_t *sig, size_t sig_len );
+
+static int ecdsa_sign_wrap( void *ctx, md_type_t md_alg,
+                   const uint8_t *hash, size_t hash_len,
+                   uint8_t *sig, size_t *sig_len,
+                   int (*f_rng)(void *, uint8_t *, size_t), void *p_rng );
+
+/*
+ * The key pair is an ECDSA context as is, no need to copy it
+ */
+static int eckey_verify_wrap( void *ctx, md_type_t md_alg,
+                       const uint8_t *hash, size_t hash_len,
+                       const uint8_t *sig, size_t sig_len )
+{
+    return( ecdsa_verify_wrap( ctx, md_alg, hash, hash_len, sig, sig_len ) );
+}
+
+static int eckey_sign_wrap( void *ctx, md_type_t md_alg,
+                   const uint8_t *hash, size_t hash_len,
+                   uint8_t *sig, size_t *sig_len,
+                   int (*f_rng)(void *, uint8_t *, size_t), void *p_rng )
+{
+    return( ecdsa_sign_wrap( ctx, md_alg, hash, hash_len, sig, sig_len,
+                             f_rng, p_rng ) );
+}
+
 static void *eckey_alloc_wrap( void )
 {
     void *ctx = memory_alloc( sizeof( ecp_keypair ) );
@@ -163,8 +194,8 @@ const pk_info_t eckey_info = {
     "EC",
     eckey_get_size,
     eckey_can_do,
-    NULL,
-    NULL,
+    eckey_verify_wrap,
+    eckey_sign_wrap,
     NULL,
     NULL,
     eckey_alloc_wrap,
@@ -195,6 +226,57 @@ const pk_info_t eckeydh_info = {
     eckey_debug,            /* Same underlying key structure */
 };
 
+/*
+ * EC key restricted to ECDSA
+ */
+static int ecdsa_can_do( pk_type_t type )
+{
+    return( type == POLARSSL_PK_ECDSA );
+}
+
+static int ecdsa_verify_wrap( void *ctx, md_type_t md_alg,
+                       const uint8_t *hash, size_t hash_len,
+                       const uint8_t *sig, size_t sig_len )
+{
+    int ret;
+    ((void) md_alg);
+
+    ret = ecdsa_read_signature( (ecdsa_context *) ctx,
+                                hash, hash_len, sig, sig_len );
+
+    if( ret == POLARSSL_ERR_ECP_SIG_LEN_MISMATCH )
+        return( POLARSSL_ERR_PK_SIG_LEN_MISMATCH );
+
+    return( ret );
+}
+
+/*
+ * Nonces are derived from the key and the hash (RFC 6979), so a weak RNG
+ * can't leak the key; f_rng only blinds the computations
+ */
+static int ecdsa_sign_wrap( void *ctx, md_type_t md_alg,
+                   const uint8_t *hash, size_t hash_len,
+                   uint8_t *sig, size_t *sig_len,
+                   int (*f_rng)(void *, uint8_t *, size_t), void *p_rng )
+{
+    return( ecdsa_write_signature( (ecdsa_context *) ctx, md_alg,
+                hash, hash_len, sig, sig_len, f_rng, p_rng ) );
+}
+
+const pk_info_t ecdsa_info = {
+    POLARSSL_PK_ECDSA,
+    "ECDSA",
+    eckey_get_size,     /* Compatible key structures */
+    ecdsa_can_do,
+    ecdsa_verify_wrap,
+    ecdsa_sign_wrap,
+    NULL,
+    NULL,
+    eckey_alloc_wrap,   /* Compatible key structures */
+    eckey_free_wrap,    /* Compatible key structures */
+    eckey_debug,        /* Compatible key structures */
+};
+
 /*
  * Support for alternative RSA-private implementations
  */
@@ -48,6 +48,7 @@ typedef struct
 extern const pk_info_t rsa_info;
 extern const pk_info_t eckey_info;
 extern const pk_info_t eckeydh_info;
+extern const pk_info_t ecdsa_info;
 
 extern const pk_info_t rsa_alt_info;
 
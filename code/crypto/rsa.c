@@ -3,6 +3,7 @@
 
 #include "rsa.h"
 #include "oid.h"
+#include "ctr_drbg.h"
 
 #include <stdlib.h>
 
@@ -15,6 +16,102 @@ void rsa_init( rsa_context_t *ctx, int hash_id )
     ctx->hash_id = hash_id;
 }
 
+/*
+ * Search for one prime with a CTR_DRBG of its own, seeded from the
+ * caller's RNG, since f_rng need not be thread-safe
+ */
+typedef struct
+{
+    mpi_t *X;
+    size_t nbits;
+    int seeded;
+    int ret;
+    uint8_t seed[CTR_DRBG_ENTROPY_LEN];
+}
+rsa_prime_job;
+
+/*
+ * The seed is handed out once: the DRBG is not asked to reseed
+ */
+static int rsa_prime_seed( void *data, uint8_t *output, size_t len )
+{
+    rsa_prime_job *job = (rsa_prime_job *) data;
+
+    if( job->seeded || len > sizeof( job->seed ) )
+        return( POLARSSL_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED );
+
+    __movsb( output, job->seed, len );
+    __stosb( job->seed, 0, sizeof( job->seed ) );
+    job->seeded = 1;
+
+    return( 0 );
+}
+
+static void rsa_prime_search( void *arg )
+{
+    rsa_prime_job *job = (rsa_prime_job *) arg;
+    ctr_drbg_context_t drbg;
+
+    job->ret = ctr_drbg_init( &drbg, rsa_prime_seed, job, NULL, 0 );
+
+    if( job->ret == 0 )
+    {
+        ctr_drbg_set_reseed_interval( &drbg, 0x7FFFFFFF );
+        job->ret = mpi_gen_prime( job->X, job->nbits, 0,
+                                  ctr_drbg_random, &drbg );
+    }
+
+    __stosb( &drbg, 0, sizeof( ctr_drbg_context_t ) );
+}
+
+static void rsa_prime_thread( void *arg )
+{
+    rsa_prime_search( arg );
+
+    mpi_arena_free();
+}
+
+/*
+ * Generate P and Q at the same time, one on a helper thread and one on
+ * the calling thread, or one after the other if no thread can be started
+ */
+static int rsa_gen_primes( rsa_context_t *ctx, size_t nbits,
+                           int (*f_rng)(void *, uint8_t *, size_t),
+                           void *p_rng )
+{
+    int ret;
+    rsa_prime_job job[2];
+    async_thread_t tid;
+
+    __stosb( job, 0, sizeof( job ) );
+
+    job[0].X = &ctx->P;
+    job[1].X = &ctx->Q;
+    job[0].nbits = job[1].nbits = nbits;
+
+    if( ( ret = f_rng( p_rng, job[0].seed, sizeof( job[0].seed ) ) ) != 0 ||
+        ( ret = f_rng( p_rng, job[1].seed, sizeof( job[1].seed ) ) ) != 0 )
+        goto cleanup;
+
+    if( async_thread_create( &tid, rsa_prime_thread, &job[0] ) == 0 )
+    {
+        rsa_prime_search( &job[1] );
+        async_thread_join( &tid );
+    }
+    else
+    {
+        rsa_prime_search( &job[0] );
+        rsa_prime_search( &job[1] );
+    }
+
+    ret = ( job[0].ret != 0 ) ? job[0].ret : job[1].ret;
+
+cleanup:
+    __stosb( job, 0, sizeof( job ) );
+
+    return( ret );
+}
+
 /*
  * Generate an RSA keypair
  */
@@ -39,11 +136,7 @@ int rsa_gen_key(rsa_context_t *ctx, int (*f_rng)(void *, uint8_t *, size_t), voi
     MPI_CHK( mpi_lset( &ctx->E, exponent ) );
 
     do {
-        MPI_CHK( mpi_gen_prime( &ctx->P, ( nbits + 1 ) >> 1, 0,
-                                f_rng, p_rng ) );
-
-        MPI_CHK( mpi_gen_prime( &ctx->Q, ( nbits + 1 ) >> 1, 0,
-                                f_rng, p_rng ) );
+        MPI_CHK( rsa_gen_primes( ctx, ( nbits + 1 ) >> 1, f_rng, p_rng ) );
 
         if( mpi_cmp_mpi( &ctx->P, &ctx->Q ) < 0 )
             mpi_swap( &ctx->P, &ctx->Q );
@@ -185,6 +278,7 @@ int rsa_public( rsa_context_t *ctx,
     size_t olen;
     mpi_t T;
 
+    mpi_arena_begin();
     mpi_init( &T );
 
     MPI_CHK( mpi_read_binary( &T, input, ctx->len ) );
@@ -192,6 +286,7 @@ int rsa_public( rsa_context_t *ctx,
     if( mpi_cmp_mpi( &T, &ctx->N ) >= 0 )
     {
         mpi_free( &T );
+        mpi_arena_end();
         return( POLARSSL_ERR_RSA_BAD_INPUT_DATA );
     }
 
@@ -202,6 +297,7 @@ int rsa_public( rsa_context_t *ctx,
 cleanup:
 
     mpi_free( &T );
+    mpi_arena_end();
 
     if( ret != 0 )
         return( POLARSSL_ERR_RSA_PUBLIC_FAILED + ret );
@@ -276,12 +372,14 @@ int rsa_private( rsa_context_t *ctx,
     Vi = &ctx->Vi;
     Vf = &ctx->Vf;
 
+    mpi_arena_begin();
     mpi_init( &T ); mpi_init( &T1 ); mpi_init( &T2 );
 
     MPI_CHK( mpi_read_binary( &T, input, ctx->len ) );
     if( mpi_cmp_mpi( &T, &ctx->N ) >= 0 )
     {
         mpi_free( &T );
+        mpi_arena_end();
         return( POLARSSL_ERR_RSA_BAD_INPUT_DATA );
     }
 
@@ -333,6 +431,7 @@ int rsa_private( rsa_context_t *ctx,
 
 cleanup:
     mpi_free( &T ); mpi_free( &T1 ); mpi_free( &T2 );
+    mpi_arena_end();
 
     if( ret != 0 )
         return( POLARSSL_ERR_RSA_PRIVATE_FAILED + ret );
@@ -93,6 +93,10 @@ void rsa_init( rsa_context_t *ctx, int hash_id);
  * \note           rsa_init() must be called beforehand to setup
  *                 the RSA context.
  *
+ * \note           P and Q are searched concurrently, on the calling thread
+ *                 and a helper thread, each with a CTR_DRBG seeded from
+ *                 f_rng. f_rng is only called from the calling thread.
+ *
  * \return         0 if successful, or an POLARSSL_ERR_RSA_XXX error code
  */
 int rsa_gen_key( rsa_context_t *ctx, int (*f_rng)(void *, uint8_t *, size_t), void *p_rng, uint32_t nbits, int exponent );
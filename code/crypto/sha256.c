@@ -4,6 +4,12 @@
 #if defined(POLARSSL_SHA256_C)
 
 #include "sha256.h"
+#include "cpu.h"
+#include "impl.h"
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
 
 /*
  * 32-bit integer manipulation macros (big endian)
@@ -64,7 +70,27 @@ void sha256_starts( sha256_context *ctx, int is224 )
     ctx->is224 = is224;
 }
 
-void sha256_process( sha256_context *ctx, const uint8_t data[64] )
+static const uint32_t K[64] =
+{
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static void sha256_process_c( uint32_t state[8], const uint8_t data[64] )
 {
     uint32_t temp1, temp2, W[64];
     uint32_t A, B, C, D, E, F, G, H;
@@ -111,14 +137,14 @@ void sha256_process( sha256_context *ctx, const uint8_t data[64] )
     d += temp1; h = temp1 + temp2;              \
 }
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-    F = ctx->state[5];
-    G = ctx->state[6];
-    H = ctx->state[7];
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
+    F = state[5];
+    G = state[6];
+    H = state[7];
 
     P( A, B, C, D, E, F, G, H, W[ 0], 0x428A2F98 );
     P( H, A, B, C, D, E, F, G, W[ 1], 0x71374491 );
@@ -185,14 +211,133 @@ void sha256_process( sha256_context *ctx, const uint8_t data[64] )
     P( C, D, E, F, G, H, A, B, R(62), 0xBEF9A3F7 );
     P( B, C, D, E, F, G, H, A, R(63), 0xC67178F2 );
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
-    ctx->state[5] += F;
-    ctx->state[6] += G;
-    ctx->state[7] += H;
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+    state[5] += F;
+    state[6] += G;
+    state[7] += H;
+}
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+/*
+ * SHA extensions kernel: four rounds per sha256rnds2 pair, message
+ * schedule with sha256msg1/sha256msg2.
+ */
+#define SHANI_ROUNDS(k,w)                                               \
+{                                                                       \
+    msg = _mm_add_epi32( w, _mm_loadu_si128( (const __m128i *) ( K + k ) ) ); \
+    state1 = _mm_sha256rnds2_epu32( state1, state0, msg );              \
+    msg = _mm_shuffle_epi32( msg, 0x0E );                               \
+    state0 = _mm_sha256rnds2_epu32( state0, state1, msg );              \
+}
+
+#define SHANI_SCHEDULE(w0,w1,w2,w3)                                     \
+{                                                                       \
+    w0 = _mm_add_epi32( _mm_sha256msg1_epu32( w0, w1 ),                 \
+                        _mm_alignr_epi8( w3, w2, 4 ) );                 \
+    w0 = _mm_sha256msg2_epu32( w0, w3 );                                \
+}
+
+static void sha256_process_shani( uint32_t state[8], const uint8_t *data,
+                                  size_t blocks )
+{
+    int k;
+    __m128i state0, state1, abef, cdgh, msg, tmp;
+    __m128i w0, w1, w2, w3;
+    const __m128i bswap = _mm_set_epi8( 12, 13, 14, 15,  8,  9, 10, 11,
+                                         4,  5,  6,  7,  0,  1,  2,  3 );
+
+    /* DCBA, HGFE -> ABEF, CDGH as expected by sha256rnds2 */
+    tmp    = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) state ), 0xB1 );
+    state1 = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) ( state + 4 ) ), 0x1B );
+    state0 = _mm_alignr_epi8( tmp, state1, 8 );
+    state1 = _mm_blend_epi16( state1, tmp, 0xF0 );
+
+    while( blocks-- > 0 )
+    {
+        abef = state0;
+        cdgh = state1;
+
+        w0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data      ) ), bswap );
+        w1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 16 ) ), bswap );
+        w2 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 32 ) ), bswap );
+        w3 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 48 ) ), bswap );
+
+        SHANI_ROUNDS(  0, w0 );
+        SHANI_ROUNDS(  4, w1 );
+        SHANI_ROUNDS(  8, w2 );
+        SHANI_ROUNDS( 12, w3 );
+
+        for( k = 16; k < 64; k += 16 )
+        {
+            SHANI_SCHEDULE( w0, w1, w2, w3 );
+            SHANI_ROUNDS( k     , w0 );
+            SHANI_SCHEDULE( w1, w2, w3, w0 );
+            SHANI_ROUNDS( k +  4, w1 );
+            SHANI_SCHEDULE( w2, w3, w0, w1 );
+            SHANI_ROUNDS( k +  8, w2 );
+            SHANI_SCHEDULE( w3, w0, w1, w2 );
+            SHANI_ROUNDS( k + 12, w3 );
+        }
+
+        state0 = _mm_add_epi32( state0, abef );
+        state1 = _mm_add_epi32( state1, cdgh );
+        data += 64;
+    }
+
+    /* ABEF, CDGH -> DCBA, HGFE */
+    tmp    = _mm_shuffle_epi32( state0, 0x1B );
+    state1 = _mm_shuffle_epi32( state1, 0xB1 );
+    state0 = _mm_blend_epi16( tmp, state1, 0xF0 );
+    state1 = _mm_alignr_epi8( state1, tmp, 8 );
+
+    _mm_storeu_si128( (__m128i *) state, state0 );
+    _mm_storeu_si128( (__m128i *) ( state + 4 ), state1 );
+}
+#endif /* POLARSSL_HAVE_X86_SIMD */
+
+static void sha256_process_blocks_c( uint32_t state[8], const uint8_t *data,
+                                     size_t blocks )
+{
+    while( blocks-- > 0 )
+    {
+        sha256_process_c( state, data );
+        data += 64;
+    }
+}
+
+const impl_backend_t sha256_shani_impl =
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    { IMPL_SHA256, "shani", CPU_SHA | CPU_SSE41, 10,
+      IMPL_FN( sha256_process_shani ) };
+#else
+    { IMPL_SHA256, "shani", CPU_SHA | CPU_SSE41, 10, NULL };
+#endif
+
+const impl_backend_t sha256_c_impl =
+    { IMPL_SHA256, "c", 0, 0, IMPL_FN( sha256_process_blocks_c ) };
+
+/*
+ * Compress consecutive 64-byte blocks with the kernel picked by the
+ * registry
+ */
+static void sha256_process_blocks( uint32_t state[8], const uint8_t *data,
+                                   size_t blocks )
+{
+    const impl_backend_t *impl = impl_select( IMPL_SHA256 );
+
+    if( impl != NULL )
+        ( (impl_sha256_t) impl->fn )( state, data, blocks );
+    else
+        sha256_process_blocks_c( state, data, blocks );
+}
+
+void sha256_process( sha256_context *ctx, const uint8_t data[64] )
+{
+    sha256_process_blocks( ctx->state, data, 1 );
 }
 
 /*
@@ -219,17 +364,17 @@ void sha256_update( sha256_context *ctx, const uint8_t *input,
     if( left && ilen >= fill )
     {
         __movsb( (void *) (ctx->buffer + left), input, fill );
-        sha256_process( ctx, ctx->buffer );
+        sha256_process_blocks( ctx->state, ctx->buffer, 1 );
         input += fill;
         ilen  -= fill;
         left = 0;
     }
 
-    while( ilen >= 64 )
+    if( ilen >= 64 )
     {
-        sha256_process( ctx, input );
-        input += 64;
-        ilen  -= 64;
+        sha256_process_blocks( ctx->state, input, ilen / 64 );
+        input += ilen & ~(size_t) 0x3F;
+        ilen  &= 0x3F;
     }
 
     if( ilen > 0 )
@@ -372,4 +517,294 @@ void sha256_hmac( const uint8_t *key, size_t keylen, const uint8_t *input, size_
     __stosb( &ctx, 0, sizeof( sha256_context ) );
 }
 
+/*
+ * Multi-buffer hashing: up to SHA256_LANES independent messages share one
+ * pass over the compression function, one message per 32-bit AVX2 lane.
+ */
+#define SHA256_LANES    8
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#define ROTR_X8(x,n)    _mm256_or_si256( _mm256_srli_epi32( x, n ), \
+                                         _mm256_slli_epi32( x, 32 - (n) ) )
+
+#define SIG0_X8(x)  _mm256_xor_si256( _mm256_xor_si256( ROTR_X8( x,  7 ),  \
+                        ROTR_X8( x, 18 ) ), _mm256_srli_epi32( x,  3 ) )
+#define SIG1_X8(x)  _mm256_xor_si256( _mm256_xor_si256( ROTR_X8( x, 17 ),  \
+                        ROTR_X8( x, 19 ) ), _mm256_srli_epi32( x, 10 ) )
+#define SUM0_X8(x)  _mm256_xor_si256( _mm256_xor_si256( ROTR_X8( x,  2 ),  \
+                        ROTR_X8( x, 13 ) ), ROTR_X8( x, 22 ) )
+#define SUM1_X8(x)  _mm256_xor_si256( _mm256_xor_si256( ROTR_X8( x,  6 ),  \
+                        ROTR_X8( x, 11 ) ), ROTR_X8( x, 25 ) )
+
+/*
+ * Load word i..i+7 of every lane's block and transpose so that w[k] holds
+ * word i+k of all eight lanes.
+ */
+static void sha256_load_x8( __m256i w[8], const uint8_t *p[SHA256_LANES],
+                            int offset )
+{
+    int j;
+    __m256i r[8], t[8];
+    const __m256i bswap = _mm256_set_epi8(
+        12, 13, 14, 15,  8,  9, 10, 11,  4,  5,  6,  7,  0,  1,  2,  3,
+        12, 13, 14, 15,  8,  9, 10, 11,  4,  5,  6,  7,  0,  1,  2,  3 );
+
+    for( j = 0; j < 8; j++ )
+        r[j] = _mm256_shuffle_epi8(
+                   _mm256_loadu_si256( (const __m256i *) ( p[j] + offset ) ),
+                   bswap );
+
+    for( j = 0; j < 8; j += 2 )
+    {
+        t[j    ] = _mm256_unpacklo_epi32( r[j], r[j + 1] );
+        t[j + 1] = _mm256_unpackhi_epi32( r[j], r[j + 1] );
+    }
+
+    r[0] = _mm256_unpacklo_epi64( t[0], t[2] );
+    r[1] = _mm256_unpackhi_epi64( t[0], t[2] );
+    r[2] = _mm256_unpacklo_epi64( t[1], t[3] );
+    r[3] = _mm256_unpackhi_epi64( t[1], t[3] );
+    r[4] = _mm256_unpacklo_epi64( t[4], t[6] );
+    r[5] = _mm256_unpackhi_epi64( t[4], t[6] );
+    r[6] = _mm256_unpacklo_epi64( t[5], t[7] );
+    r[7] = _mm256_unpackhi_epi64( t[5], t[7] );
+
+    for( j = 0; j < 4; j++ )
+    {
+        w[j    ] = _mm256_permute2x128_si256( r[j], r[j + 4], 0x20 );
+        w[j + 4] = _mm256_permute2x128_si256( r[j], r[j + 4], 0x31 );
+    }
+}
+
+static void sha256_process_x8( __m256i state[8],
+                               const uint8_t *p[SHA256_LANES] )
+{
+    int t;
+    __m256i W[16], s[8], temp1, temp2;
+
+    sha256_load_x8( W    , p,  0 );
+    sha256_load_x8( W + 8, p, 32 );
+
+    for( t = 0; t < 8; t++ )
+        s[t] = state[t];
+
+    for( t = 0; t < 64; t++ )
+    {
+        if( t >= 16 )
+        {
+            W[t & 15] = _mm256_add_epi32(
+                _mm256_add_epi32( SIG1_X8( W[( t - 2 ) & 15] ), W[( t - 7 ) & 15] ),
+                _mm256_add_epi32( SIG0_X8( W[( t - 15 ) & 15] ), W[t & 15] ) );
+        }
+
+        /* temp1 = h + S3(e) + F1(e,f,g) + K[t] + W[t] */
+        temp1 = _mm256_xor_si256( s[6], _mm256_and_si256( s[4],
+                                  _mm256_xor_si256( s[5], s[6] ) ) );
+        temp1 = _mm256_add_epi32( _mm256_add_epi32( s[7], SUM1_X8( s[4] ) ),
+                _mm256_add_epi32( temp1, _mm256_add_epi32( W[t & 15],
+                                  _mm256_set1_epi32( (int) K[t] ) ) ) );
+
+        /* temp2 = S2(a) + F0(a,b,c) */
+        temp2 = _mm256_or_si256( _mm256_and_si256( s[0], s[1] ),
+                    _mm256_and_si256( s[2], _mm256_or_si256( s[0], s[1] ) ) );
+        temp2 = _mm256_add_epi32( SUM0_X8( s[0] ), temp2 );
+
+        s[7] = s[6];
+        s[6] = s[5];
+        s[5] = s[4];
+        s[4] = _mm256_add_epi32( s[3], temp1 );
+        s[3] = s[2];
+        s[2] = s[1];
+        s[1] = s[0];
+        s[0] = _mm256_add_epi32( temp1, temp2 );
+    }
+
+    for( t = 0; t < 8; t++ )
+        state[t] = _mm256_add_epi32( state[t], s[t] );
+}
+
+/*
+ * Hash up to eight messages. Lanes that run out of blocks early keep
+ * compressing a dummy block, and their result is masked out.
+ */
+static void sha256_multi_x8( const uint32_t iv[8], uint32_t prefix, size_t n,
+                             const uint8_t * const input[], const size_t ilen[],
+                             uint8_t * const output[], int is224 )
+{
+    size_t j, s, rem, maxb = 0;
+    size_t full[SHA256_LANES], total[SHA256_LANES];
+    const uint8_t *p[SHA256_LANES];
+    uint8_t tail[SHA256_LANES][128];
+    uint32_t lanes[8][SHA256_LANES];
+    uint32_t high, low;
+    __m256i state[8], prev[8], mask;
+    int i;
+
+    for( j = 0; j < SHA256_LANES; j++ )
+    {
+        full[j] = total[j] = 0;
+
+        if( j >= n )
+            continue;
+
+        full[j] = ilen[j] >> 6;
+        rem = ilen[j] & 0x3F;
+
+        __stosb( tail[j], 0, sizeof( tail[j] ) );
+        __movsb( tail[j], input[j] + ( full[j] << 6 ), rem );
+        tail[j][rem] = 0x80;
+
+        total[j] = full[j] + ( ( rem < 56 ) ? 1 : 2 );
+
+        high = (uint32_t) ( ( ilen[j] + prefix ) >> 29 );
+        low  = (uint32_t) ( ( ilen[j] + prefix ) <<  3 );
+        PUT_UINT32_BE( high, tail[j], ( ( total[j] - full[j] ) << 6 ) - 8 );
+        PUT_UINT32_BE( low,  tail[j], ( ( total[j] - full[j] ) << 6 ) - 4 );
+
+        if( total[j] > maxb )
+            maxb = total[j];
+    }
+
+    for( i = 0; i < 8; i++ )
+        state[i] = _mm256_set1_epi32( (int) iv[i] );
+
+    for( s = 0; s < maxb; s++ )
+    {
+        for( j = 0; j < SHA256_LANES; j++ )
+        {
+            if( s < full[j] )
+                p[j] = input[j] + ( s << 6 );
+            else if( s < total[j] )
+                p[j] = tail[j] + ( ( s - full[j] ) << 6 );
+            else
+                p[j] = tail[0];
+        }
+
+        for( i = 0; i < 8; i++ )
+            prev[i] = state[i];
+
+        sha256_process_x8( state, p );
+
+        mask = _mm256_set_epi32( -( s < total[7] ), -( s < total[6] ),
+                                 -( s < total[5] ), -( s < total[4] ),
+                                 -( s < total[3] ), -( s < total[2] ),
+                                 -( s < total[1] ), -( s < total[0] ) );
+
+        for( i = 0; i < 8; i++ )
+            state[i] = _mm256_blendv_epi8( prev[i], state[i], mask );
+    }
+
+    for( i = 0; i < 8; i++ )
+        _mm256_storeu_si256( (__m256i *) lanes[i], state[i] );
+
+    _mm256_zeroupper();
+
+    for( j = 0; j < n; j++ )
+    {
+        for( i = 0; i < ( is224 ? 7 : 8 ); i++ )
+            PUT_UINT32_BE( lanes[i][j], output[j], i << 2 );
+    }
+
+    __stosb( tail, 0, sizeof( tail ) );
+    __stosb( lanes, 0, sizeof( lanes ) );
+}
+#endif /* POLARSSL_HAVE_X86_SIMD */
+
+/*
+ * Hash n messages starting from state iv, as if prefix bytes had already
+ * been absorbed (64 for the HMAC passes).
+ */
+static void sha256_multi_core( const uint32_t iv[8], uint32_t prefix, size_t n,
+                               const uint8_t * const input[], const size_t ilen[],
+                               uint8_t * const output[], int is224 )
+{
+    size_t i;
+    sha256_context ctx;
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    /* The SHA extensions kernel beats eight AVX2 lanes on its own */
+    if( cpu_supports( CPU_AVX2 ) &&
+        impl_select( IMPL_SHA256 ) != &sha256_shani_impl )
+    {
+        size_t m;
+
+        for( i = 0; i < n; i += m )
+        {
+            m = ( n - i < SHA256_LANES ) ? n - i : SHA256_LANES;
+            sha256_multi_x8( iv, prefix, m, input + i, ilen + i,
+                             output + i, is224 );
+        }
+        return;
+    }
+#endif
+
+    for( i = 0; i < n; i++ )
+    {
+        __movsb( (void *) ctx.state, iv, sizeof( ctx.state ) );
+        ctx.total[0] = prefix;
+        ctx.total[1] = 0;
+        ctx.is224 = is224;
+
+        sha256_update( &ctx, input[i], ilen[i] );
+        sha256_finish( &ctx, output[i] );
+    }
+
+    __stosb( &ctx, 0, sizeof( sha256_context ) );
+}
+
+/*
+ * output[i] = SHA-256( input[i] ) for i < n
+ */
+void sha256_multi( size_t n, const uint8_t * const input[],
+                   const size_t ilen[], uint8_t * const output[], int is224 )
+{
+    sha256_context ctx;
+
+    sha256_starts( &ctx, is224 );
+    sha256_multi_core( ctx.state, 0, n, input, ilen, output, is224 );
+}
+
+/*
+ * output[i] = HMAC-SHA-256( hmac key, input[i] ) for i < n
+ */
+void sha256_hmac_multi( const uint8_t *key, size_t keylen, size_t n,
+                        const uint8_t * const input[], const size_t ilen[],
+                        uint8_t * const output[], int is224 )
+{
+    size_t i, j, m;
+    sha256_context ctx;
+    uint32_t istate[8], ostate[8];
+    uint8_t inner[SHA256_LANES][32];
+    const uint8_t *inner_in[SHA256_LANES];
+    uint8_t *inner_out[SHA256_LANES];
+    size_t inner_len[SHA256_LANES];
+
+    sha256_hmac_starts( &ctx, key, keylen, is224 );
+    __movsb( (void *) istate, ctx.state, sizeof( istate ) );
+
+    sha256_starts( &ctx, is224 );
+    sha256_update( &ctx, ctx.opad, 64 );
+    __movsb( (void *) ostate, ctx.state, sizeof( ostate ) );
+
+    for( j = 0; j < SHA256_LANES; j++ )
+    {
+        inner_in[j] = inner[j];
+        inner_out[j] = inner[j];
+        inner_len[j] = ( is224 ) ? 28 : 32;
+    }
+
+    for( i = 0; i < n; i += m )
+    {
+        m = ( n - i < SHA256_LANES ) ? n - i : SHA256_LANES;
+
+        sha256_multi_core( istate, 64, m, input + i, ilen + i, inner_out, is224 );
+        sha256_multi_core( ostate, 64, m, inner_in, inner_len, output + i, is224 );
+    }
+
+    __stosb( &ctx, 0, sizeof( sha256_context ) );
+    __stosb( istate, 0, sizeof( istate ) );
+    __stosb( ostate, 0, sizeof( ostate ) );
+    __stosb( inner, 0, sizeof( inner ) );
+}
+
 #endif /* POLARSSL_SHA256_C */
@@ -127,6 +127,37 @@ void sha256_hmac( const uint8_t *key, size_t keylen,
                   const uint8_t *input, size_t ilen,
                   uint8_t output[32], int is224 );
 
+/**
+ * \brief          Output[i] = SHA-256( input[i] ) for n messages
+ *
+ *                 With AVX2 (and no SHA extensions) up to eight messages
+ *                 are compressed in parallel, one per vector lane.
+ *
+ * \param n        number of messages
+ * \param input    n buffers holding the data
+ * \param ilen     n lengths of the input data
+ * \param output   n buffers receiving the SHA-224/256 checksums
+ * \param is224    0 = use SHA256, 1 = use SHA224
+ */
+void sha256_multi( size_t n, const uint8_t * const input[],
+                   const size_t ilen[], uint8_t * const output[], int is224 );
+
+/**
+ * \brief          Output[i] = HMAC-SHA-256( hmac key, input[i] ) for n
+ *                 messages under the same key
+ *
+ * \param key      HMAC secret key
+ * \param keylen   length of the HMAC key
+ * \param n        number of messages
+ * \param input    n buffers holding the data
+ * \param ilen     n lengths of the input data
+ * \param output   n buffers receiving the HMAC-SHA-224/256 results
+ * \param is224    0 = use SHA256, 1 = use SHA224
+ */
+void sha256_hmac_multi( const uint8_t *key, size_t keylen, size_t n,
+                        const uint8_t * const input[], const size_t ilen[],
+                        uint8_t * const output[], int is224 );
+
 /**
  * \brief          Checkup routine
  *
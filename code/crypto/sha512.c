@@ -4,6 +4,12 @@
 #if defined(POLARSSL_SHA512_C)
 
 #include "sha512.h"
+#include "cpu.h"
+#include "impl.h"
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
 
 /*
  * 64-bit integer manipulation macros (big endian)
@@ -119,7 +125,7 @@ void sha512_starts( sha512_context *ctx, int is384 )
     ctx->is384 = is384;
 }
 
-void sha512_process( sha512_context *ctx, const uint8_t data[128] )
+static void sha512_process_c( uint64_t state[8], const uint8_t data[128] )
 {
     int i;
     uint64_t temp1, temp2, W[80];
@@ -155,14 +161,14 @@ void sha512_process( sha512_context *ctx, const uint8_t data[128] )
                S0(W[i - 15]) + W[i - 16];
     }
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-    F = ctx->state[5];
-    G = ctx->state[6];
-    H = ctx->state[7];
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
+    F = state[5];
+    G = state[6];
+    H = state[7];
     i = 0;
 
     do
@@ -178,14 +184,202 @@ void sha512_process( sha512_context *ctx, const uint8_t data[128] )
     }
     while( i < 80 );
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
-    ctx->state[5] += F;
-    ctx->state[6] += G;
-    ctx->state[7] += H;
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+    state[5] += F;
+    state[6] += G;
+    state[7] += H;
+}
+
+/*
+ * Vector kernels: the message schedule (pre-added to the round constants)
+ * is computed four words at a time, then the rounds run on 64-bit words
+ * kept in XMM registers, which avoids splitting every 64-bit operation into
+ * 32-bit halves. x64 builds have native 64-bit registers and the portable
+ * code is faster there.
+ */
+#if defined(POLARSSL_HAVE_X86_SIMD) && defined(_M_IX86)
+#define SHA512_HAVE_SIMD
+
+#if _MSC_VER >= 1911
+#define SHA512_HAVE_AVX512  /* AVX-512 intrinsics need VS2017 15.3 */
+#endif
+
+#define ROR64_SSE(x,n)      _mm_or_si128( _mm_srli_epi64( x, n ),      \
+                                          _mm_slli_epi64( x, 64 - (n) ) )
+#define ROR64_AVX2(x,n)     _mm256_or_si256( _mm256_srli_epi64( x, n ), \
+                                             _mm256_slli_epi64( x, 64 - (n) ) )
+
+#define SIGMA_X(x,a,b,c,ROR)        _mm_xor_si128( _mm_xor_si128(       \
+                                    ROR( x, a ), ROR( x, b ) ), ROR( x, c ) )
+#define SIGMA_SHR_X(x,a,b,c,ROR)    _mm_xor_si128( _mm_xor_si128(       \
+                                    ROR( x, a ), ROR( x, b ) ), _mm_srli_epi64( x, c ) )
+#define SIGMA_SHR_Y(x,a,b,c,ROR)    _mm256_xor_si256( _mm256_xor_si256( \
+                                    ROR( x, a ), ROR( x, b ) ), _mm256_srli_epi64( x, c ) )
+
+/*
+ * WK[t] = W[t] + K[t]; W is built in place four words per step, the
+ * second pair of each step depending on the first.
+ */
+#define SHA512_SCHEDULE(data,W,WK,RORX,RORY)                            \
+{                                                                       \
+    const __m256i bswap = _mm256_set_epi8(                              \
+        8,  9, 10, 11, 12, 13, 14, 15,  0,  1,  2,  3,  4,  5,  6,  7, \
+        8,  9, 10, 11, 12, 13, 14, 15,  0,  1,  2,  3,  4,  5,  6,  7 ); \
+    __m256i x;                                                          \
+    __m128i lo, hi;                                                     \
+                                                                        \
+    for( t = 0; t < 16; t += 4 )                                        \
+        _mm256_storeu_si256( (__m256i *) ( W + t ), _mm256_shuffle_epi8( \
+            _mm256_loadu_si256( (const __m256i *) ( data + ( t << 3 ) ) ), bswap ) ); \
+                                                                        \
+    for( t = 16; t < 80; t += 4 )                                       \
+    {                                                                   \
+        x = _mm256_add_epi64(                                           \
+            _mm256_loadu_si256( (const __m256i *) ( W + t - 16 ) ),     \
+            _mm256_loadu_si256( (const __m256i *) ( W + t - 7 ) ) );    \
+        x = _mm256_add_epi64( x, SIGMA_SHR_Y( _mm256_loadu_si256(       \
+            (const __m256i *) ( W + t - 15 ) ), 1, 8, 7, RORY ) );      \
+                                                                        \
+        lo = _mm_loadu_si128( (const __m128i *) ( W + t - 2 ) );        \
+        lo = _mm_add_epi64( _mm256_castsi256_si128( x ),                \
+                            SIGMA_SHR_X( lo, 19, 61, 6, RORX ) );       \
+        hi = _mm_add_epi64( _mm256_extracti128_si256( x, 1 ),           \
+                            SIGMA_SHR_X( lo, 19, 61, 6, RORX ) );       \
+                                                                        \
+        _mm_storeu_si128( (__m128i *) ( W + t     ), lo );              \
+        _mm_storeu_si128( (__m128i *) ( W + t + 2 ), hi );              \
+    }                                                                   \
+                                                                        \
+    for( t = 0; t < 80; t += 4 )                                        \
+        _mm256_storeu_si256( (__m256i *) ( WK + t ), _mm256_add_epi64(  \
+            _mm256_loadu_si256( (const __m256i *) ( W + t ) ),          \
+            _mm256_loadu_si256( (const __m256i *) ( K + t ) ) ) );      \
+}
+
+#define SHA512_ROUNDS(state,WK,RORX)                                    \
+{                                                                       \
+    __m128i s[8], temp1, temp2;                                         \
+                                                                        \
+    for( t = 0; t < 8; t++ )                                            \
+        s[t] = _mm_loadl_epi64( (const __m128i *) ( state + t ) );      \
+                                                                        \
+    for( t = 0; t < 80; t++ )                                           \
+    {                                                                   \
+        temp1 = _mm_xor_si128( s[6], _mm_and_si128( s[4],               \
+                               _mm_xor_si128( s[5], s[6] ) ) );         \
+        temp1 = _mm_add_epi64( _mm_add_epi64( s[7], temp1 ),            \
+                _mm_add_epi64( SIGMA_X( s[4], 14, 18, 41, RORX ),       \
+                    _mm_loadl_epi64( (const __m128i *) ( WK + t ) ) ) ); \
+        temp2 = _mm_or_si128( _mm_and_si128( s[0], s[1] ),              \
+                    _mm_and_si128( s[2], _mm_or_si128( s[0], s[1] ) ) ); \
+        temp2 = _mm_add_epi64( SIGMA_X( s[0], 28, 34, 39, RORX ), temp2 ); \
+                                                                        \
+        s[7] = s[6];                                                    \
+        s[6] = s[5];                                                    \
+        s[5] = s[4];                                                    \
+        s[4] = _mm_add_epi64( s[3], temp1 );                            \
+        s[3] = s[2];                                                    \
+        s[2] = s[1];                                                    \
+        s[1] = s[0];                                                    \
+        s[0] = _mm_add_epi64( temp1, temp2 );                           \
+    }                                                                   \
+                                                                        \
+    for( t = 0; t < 8; t++ )                                            \
+        _mm_storel_epi64( (__m128i *) ( state + t ), _mm_add_epi64(     \
+            s[t], _mm_loadl_epi64( (const __m128i *) ( state + t ) ) ) ); \
+}
+
+static void sha512_process_avx2( uint64_t state[8], const uint8_t *data,
+                                 size_t blocks )
+{
+    int t;
+    uint64_t W[80], WK[80];
+
+    while( blocks-- > 0 )
+    {
+        SHA512_SCHEDULE( data, W, WK, ROR64_SSE, ROR64_AVX2 );
+
+        /* The rounds are SSE2 code: leave the AVX state clean first */
+        _mm256_zeroupper();
+
+        SHA512_ROUNDS( state, WK, ROR64_SSE );
+        data += 128;
+    }
+}
+
+#if defined(SHA512_HAVE_AVX512)
+/* AVX-512VL has native 64-bit rotates for XMM and YMM registers */
+#define ROR64_VL128(x,n)    _mm_ror_epi64( x, n )
+#define ROR64_VL256(x,n)    _mm256_ror_epi64( x, n )
+
+static void sha512_process_avx512( uint64_t state[8], const uint8_t *data,
+                                   size_t blocks )
+{
+    int t;
+    uint64_t W[80], WK[80];
+
+    while( blocks-- > 0 )
+    {
+        SHA512_SCHEDULE( data, W, WK, ROR64_VL128, ROR64_VL256 );
+        SHA512_ROUNDS( state, WK, ROR64_VL128 );
+        data += 128;
+    }
+
+    _mm256_zeroupper();
+}
+#endif /* SHA512_HAVE_AVX512 */
+#endif /* SHA512_HAVE_SIMD */
+
+static void sha512_process_blocks_c( uint64_t state[8], const uint8_t *data,
+                                     size_t blocks )
+{
+    while( blocks-- > 0 )
+    {
+        sha512_process_c( state, data );
+        data += 128;
+    }
+}
+
+const impl_backend_t sha512_avx512_impl =
+#if defined(SHA512_HAVE_AVX512)
+    { IMPL_SHA512, "avx512", CPU_AVX512F | CPU_AVX512VL | CPU_AVX2, 20,
+      IMPL_FN( sha512_process_avx512 ) };
+#else
+    { IMPL_SHA512, "avx512", CPU_AVX512F | CPU_AVX512VL | CPU_AVX2, 20, NULL };
+#endif
+
+const impl_backend_t sha512_avx2_impl =
+#if defined(SHA512_HAVE_SIMD)
+    { IMPL_SHA512, "avx2", CPU_AVX2, 10, IMPL_FN( sha512_process_avx2 ) };
+#else
+    { IMPL_SHA512, "avx2", CPU_AVX2, 10, NULL };
+#endif
+
+const impl_backend_t sha512_c_impl =
+    { IMPL_SHA512, "c", 0, 0, IMPL_FN( sha512_process_blocks_c ) };
+
+/*
+ * Compress consecutive 128-byte blocks with the kernel picked by the
+ * registry
+ */
+static void sha512_process_blocks( uint64_t state[8], const uint8_t *data,
+                                   size_t blocks )
+{
+    const impl_backend_t *impl = impl_select( IMPL_SHA512 );
+
+    if( impl != NULL )
+        ( (impl_sha512_t) impl->fn )( state, data, blocks );
+    else
+        sha512_process_blocks_c( state, data, blocks );
+}
+
+void sha512_process( sha512_context *ctx, const uint8_t data[128] )
+{
+    sha512_process_blocks( ctx->state, data, 1 );
 }
 
 /*
@@ -210,23 +404,228 @@ void sha512_update( sha512_context *ctx, const uint8_t *input, size_t ilen )
     if( left && ilen >= fill )
     {
         __movsb( (void *) (ctx->buffer + left), input, fill );
-        sha512_process( ctx, ctx->buffer );
+        sha512_process_blocks( ctx->state, ctx->buffer, 1 );
         input += fill;
         ilen  -= fill;
         left = 0;
     }
 
-    while( ilen >= 128 )
+    if( ilen >= 128 )
     {
-        sha512_process( ctx, input );
-        input += 128;
-        ilen  -= 128;
+        sha512_process_blocks( ctx->state, input, ilen / 128 );
+        input += ilen & ~(size_t) 0x7F;
+        ilen  &= 0x7F;
     }
 
     if( ilen > 0 )
         __movsb( (void *) (ctx->buffer + left), input, ilen );
 }
 
+/*
+ * Stitched AES-CBC encryption and SHA-512 compression. Each AES block of
+ * a CBC chain waits for the previous one, so the cipher keeps the AES unit
+ * busy but leaves the integer units idle: the SHA-512 rounds of an
+ * independent block run in that shadow almost for free.
+ */
+#define CBC_AES_ROUNDS  14      /* AES-256, as aes.c */
+
+#if defined(POLARSSL_HAVE_X86_SIMD)
+#define AESENC(x,i)     x = _mm_aesenc_si128( x, k[i] )
+
+/*
+ * Ten rounds of SHA-512 from round i, a to h in their current roles, with
+ * the fourteen AES rounds of block x spread among them
+ */
+#define P10_AES(a,b,c,d,e,f,g,h,i,x)                                    \
+{                                                                       \
+    P( a, b, c, d, e, f, g, h, W[i    ], K[i    ] );                    \
+    AESENC( x,  1 ); AESENC( x,  2 );                                   \
+    P( h, a, b, c, d, e, f, g, W[i + 1], K[i + 1] );                    \
+    AESENC( x,  3 ); AESENC( x,  4 );                                   \
+    P( g, h, a, b, c, d, e, f, W[i + 2], K[i + 2] );                    \
+    AESENC( x,  5 ); AESENC( x,  6 );                                   \
+    P( f, g, h, a, b, c, d, e, W[i + 3], K[i + 3] ); AESENC( x,  7 );   \
+    P( e, f, g, h, a, b, c, d, W[i + 4], K[i + 4] ); AESENC( x,  8 );   \
+    P( d, e, f, g, h, a, b, c, W[i + 5], K[i + 5] ); AESENC( x,  9 );   \
+    P( c, d, e, f, g, h, a, b, W[i + 6], K[i + 6] ); AESENC( x, 10 );   \
+    P( b, c, d, e, f, g, h, a, W[i + 7], K[i + 7] ); AESENC( x, 11 );   \
+    P( a, b, c, d, e, f, g, h, W[i + 8], K[i + 8] ); AESENC( x, 12 );   \
+    P( h, a, b, c, d, e, f, g, W[i + 9], K[i + 9] ); AESENC( x, 13 );   \
+    x = _mm_aesenclast_si128( x, k[CBC_AES_ROUNDS] );                   \
+}
+
+/* CBC input of block j: previous ciphertext ^ plaintext ^ first round key */
+#define CBC_IN(x,j)                                                     \
+    x = _mm_xor_si128( _mm_xor_si128( x, k[0] ),                        \
+            _mm_loadu_si128( (const __m128i *) input + (j) ) )
+
+#define CBC_OUT(x,j)                                                    \
+    _mm_storeu_si128( (__m128i *) output + (j), x )
+
+/*
+ * Ten SHA-512 rounds per AES block, the eight blocks of a 128-byte chunk
+ * going with one SHA-512 block. Four blocks bring the working variables
+ * back to their roles (40 rounds), hence the unrolling.
+ */
+static void aes_cbc_sha512_aesni( aes_context_t *ctx, uint8_t iv[16],
+                                  size_t length, const uint8_t *input,
+                                  uint8_t *output, uint64_t state[8],
+                                  const uint8_t *hash )
+{
+    const uint32_t *rk = ctx->rk;
+    __m128i k[CBC_AES_ROUNDS + 1], x;
+    uint64_t temp1, temp2, W[80];
+    uint64_t A, B, C, D, E, F, G, H;
+    size_t i, j;
+
+    for( i = 0; i <= CBC_AES_ROUNDS; i++ )
+        k[i] = _mm_loadu_si128( (const __m128i *) ( rk + 4 * i ) );
+
+    x = _mm_loadu_si128( (const __m128i *) iv );
+
+    for( ; hash != NULL && length >= 128; length -= 128 )
+    {
+        for( i = 0; i < 16; i++ )
+        {
+            GET_UINT64_BE( W[i], hash, i << 3 );
+        }
+
+        for( ; i < 80; i++ )
+        {
+            W[i] = S1(W[i -  2]) + W[i -  7] +
+                   S0(W[i - 15]) + W[i - 16];
+        }
+
+        A = state[0];
+        B = state[1];
+        C = state[2];
+        D = state[3];
+        E = state[4];
+        F = state[5];
+        G = state[6];
+        H = state[7];
+
+        for( i = 0, j = 0; j < 8; i += 40, j += 4 )
+        {
+            CBC_IN( x, j     );
+            P10_AES( A, B, C, D, E, F, G, H, i,      x );
+            CBC_OUT( x, j     );
+
+            CBC_IN( x, j + 1 );
+            P10_AES( G, H, A, B, C, D, E, F, i + 10, x );
+            CBC_OUT( x, j + 1 );
+
+            CBC_IN( x, j + 2 );
+            P10_AES( E, F, G, H, A, B, C, D, i + 20, x );
+            CBC_OUT( x, j + 2 );
+
+            CBC_IN( x, j + 3 );
+            P10_AES( C, D, E, F, G, H, A, B, i + 30, x );
+            CBC_OUT( x, j + 3 );
+        }
+
+        state[0] += A;
+        state[1] += B;
+        state[2] += C;
+        state[3] += D;
+        state[4] += E;
+        state[5] += F;
+        state[6] += G;
+        state[7] += H;
+
+        input  += 128;
+        output += 128;
+        hash   += 128;
+    }
+
+    for( ; length >= 16; length -= 16 )
+    {
+        CBC_IN( x, 0 );
+
+        for( i = 1; i < CBC_AES_ROUNDS; i++ )
+            AESENC( x, i );
+
+        x = _mm_aesenclast_si128( x, k[CBC_AES_ROUNDS] );
+        CBC_OUT( x, 0 );
+
+        input  += 16;
+        output += 16;
+    }
+
+    _mm_storeu_si128( (__m128i *) iv, x );
+}
+#endif /* POLARSSL_HAVE_X86_SIMD */
+
+static void aes_cbc_sha512_c( aes_context_t *ctx, uint8_t iv[16],
+                              size_t length, const uint8_t *input,
+                              uint8_t *output, uint64_t state[8],
+                              const uint8_t *hash )
+{
+    aes_crypt_cbc( ctx, AES_ENCRYPT, length, iv, input, output );
+
+    if( hash != NULL )
+        sha512_process_blocks( state, hash, length / 128 );
+}
+
+const impl_backend_t aes_cbc_sha512_aesni_impl =
+#if defined(POLARSSL_HAVE_X86_SIMD)
+    { IMPL_AES_CBC_SHA512, "aesni", CPU_AESNI, 10,
+      IMPL_FN( aes_cbc_sha512_aesni ) };
+#else
+    { IMPL_AES_CBC_SHA512, "aesni", CPU_AESNI, 10, NULL };
+#endif
+
+const impl_backend_t aes_cbc_sha512_c_impl =
+    { IMPL_AES_CBC_SHA512, "c", 0, 0, IMPL_FN( aes_cbc_sha512_c ) };
+
+/*
+ * The hash trails the cipher: the first block is the buffered bytes and
+ * the start of chunk 0, it goes with chunk 1; block m >= 1 starts 128 m
+ * bytes into the buffered bytes and the ciphertext and goes with chunk
+ * m + 1. The blocks that end in the last chunk are hashed after it.
+ */
+int sha512_update_aes_cbc( sha512_context *ctx, aes_context_t *aes,
+                           uint8_t iv[16], size_t length,
+                           const uint8_t *input, uint8_t *output )
+{
+    const impl_backend_t *impl = impl_select( IMPL_AES_CBC_SHA512 );
+    impl_aes_cbc_sha512_t f = ( impl != NULL ) ?
+        (impl_aes_cbc_sha512_t) impl->fn : aes_cbc_sha512_c;
+    size_t left, fill, done;
+
+    if( length % 16 != 0 )
+        return( POLARSSL_ERR_AES_INVALID_INPUT_LENGTH );
+
+    if( length < 256 )
+    {
+        f( aes, iv, length, input, output, ctx->state, NULL );
+        sha512_update( ctx, output, length );
+        return( 0 );
+    }
+
+    left = (size_t)( ctx->total[0] & 0x7F );
+    fill = 128 - left;
+
+    f( aes, iv, 128, input, output, ctx->state, NULL );
+    __movsb( ctx->buffer + left, output, fill );
+
+    f( aes, iv, 128, input + 128, output + 128, ctx->state, ctx->buffer );
+    f( aes, iv, length - 256, input + 256, output + 256, ctx->state,
+       output + fill );
+
+    /* whole blocks hashed so far, the buffer is empty again */
+    done = fill + ( ( length - 256 ) & ~(size_t) 0x7F );
+
+    ctx->total[0] += (uint64_t) done;
+
+    if( ctx->total[0] < (uint64_t) done )
+        ctx->total[1]++;
+
+    sha512_update( ctx, output + done, length - done );
+
+    return( 0 );
+}
+
 static const uint8_t sha512_padding[128] =
 {
  0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -4,6 +4,8 @@
   #define UL64(x) x##ui64
   typedef unsigned __int64 uint64_t;
 
+#include "aes.h"
+
 #define POLARSSL_ERR_SHA512_FILE_IO_ERROR              -0x007A  /**< Read/write error in file. */
 
 #ifdef __cplusplus
@@ -108,6 +110,28 @@ void sha512_hmac( const uint8_t *key, size_t keylen,
                 const uint8_t *input, size_t ilen,
                 uint8_t output[64], int is384 );
 
+/**
+ * \brief          AES-CBC encryption, then SHA-512 update with the
+ *                 ciphertext (or HMAC update, the same function)
+ *
+ *                 The ciphertext is hashed 128 bytes behind the cipher, so
+ *                 it is still in the cache, and with AES-NI the SHA-512
+ *                 rounds are interleaved with the AES rounds, whose CBC
+ *                 chain leaves most execution units idle.
+ *
+ * \param ctx      SHA-512 context
+ * \param aes      AES context (encryption key)
+ * \param iv       initialization vector (updated after use)
+ * \param length   length of the input data, a multiple of 16
+ * \param input    buffer holding the input data
+ * \param output   buffer holding the output data, may be input
+ *
+ * \return         0 if successful, or POLARSSL_ERR_AES_INVALID_INPUT_LENGTH
+ */
+int sha512_update_aes_cbc( sha512_context *ctx, aes_context_t *aes,
+                           uint8_t iv[16], size_t length,
+                           const uint8_t *input, uint8_t *output );
+
 /**
  * \brief          Checkup routine
  *
@@ -119,6 +119,9 @@
 #define SSL_TRUNC_HMAC_ENABLED          1
 #define SSL_TRUNCATED_HMAC_LEN          10  /* 80 bits, rfc 6066 section 7 */
 
+#define SSL_ETM_DISABLED                0
+#define SSL_ETM_ENABLED                 1
+
 #define SSL_SESSION_TICKETS_DISABLED     0
 #define SSL_SESSION_TICKETS_ENABLED      1
 
@@ -145,21 +148,35 @@
 #define SSL_MAX_CONTENT_LEN         16384   /**< Size of the input / output buffer */
 #endif
 
+/*
+ * Records of the negotiated maximum fragment length that fit in the
+ * output buffer after the handshake, so that ssl_writev() sends them with
+ * one f_send. The buffer never grows past its handshake size, so without
+ * max_fragment_length this makes no difference.
+ */
+#if !defined(SSL_OUT_RECORDS)
+#define SSL_OUT_RECORDS                 8   /**< Records per output buffer */
+#endif
+
 /* \} name SECTION: Module settings */
 
 /*
 * Allow extra bytes for record, authentication and encryption overhead:
-* counter (8) + header (5) + IV(16) + MAC (16-48) + padding (0-256)
-* and allow for a maximum of 1024 of compression expansion if
-* enabled.
+* header (5) + IV(16) + MAC (16-48) + padding (1-256).
+* Only up to a block of padding is sent, the rest is room for what a
+* peer may legally send.
 */
 
-/* AEAD ciphersuites: GCM and CCM use a 128 bits tag */
-#define SSL_MAC_ADD                 16
+/* HMAC-SHA-384 */
+#define SSL_MAC_ADD                 48
+
+/* CBC padding, up to 256 bytes with the length byte */
+#define SSL_PADDING_ADD            256
 
 #define SSL_BUFFER_LEN  ( SSL_MAX_CONTENT_LEN               \
-                        + 29 /* counter + header + IV */    \
+                        + 21 /* header + IV */              \
                         + SSL_MAC_ADD                       \
+                        + SSL_PADDING_ADD                   \
                         )
 
 /*
@@ -259,6 +276,8 @@
 
 #define TLS_EXT_ALPN                        16
 
+#define TLS_EXT_ENCRYPT_THEN_MAC            22
+
 #define TLS_EXT_SESSION_TICKET              35
 
 #define TLS_EXT_RENEGOTIATION_INFO      0xFF01
@@ -326,10 +345,23 @@ typedef struct _ssl_session ssl_session;
 typedef struct _ssl_context ssl_context;
 typedef struct _ssl_transform ssl_transform;
 typedef struct _ssl_handshake_params ssl_handshake_params;
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+typedef struct _ssl_ticket_keys ssl_ticket_keys;
+#endif
 #if defined(POLARSSL_X509_CRT_PARSE_C)
 typedef struct _ssl_key_cert ssl_key_cert;
 #endif
 
+/*
+ * Application data buffer for ssl_writev() and ssl_write_records()
+ */
+typedef struct
+{
+    uint8_t *buf;               /*!< data               */
+    size_t len;                 /*!< length of data     */
+}
+ssl_iovec;
+
 /*
  * This structure is used for storing current session data.
  */
@@ -354,6 +386,16 @@ struct _ssl_session
 #if defined(POLARSSL_SSL_TRUNCATED_HMAC)
     int trunc_hmac;             /*!< flag for truncated hmac activation   */
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
+
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    int encrypt_then_mac;       /*!< flag for encrypt-then-MAC activation */
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    uint8_t *ticket;            /*!< RFC 5077 session ticket */
+    size_t ticket_len;          /*!< session ticket length   */
+    uint32_t ticket_lifetime;   /*!< ticket lifetime hint    */
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
 };
 
 /*
@@ -372,6 +414,9 @@ struct _ssl_transform
     size_t ivlen;                       /*!<  IV length               */
     size_t fixed_ivlen;                 /*!<  Fixed part of IV (AEAD) */
     size_t maclen;                      /*!<  MAC length              */
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    int encrypt_then_mac;               /*!<  MAC over the ciphertext */
+#endif
 
     uint8_t iv_enc[16];           /*!<  IV (encryption)         */
     uint8_t iv_dec[16];           /*!<  IV (decryption)         */
@@ -410,10 +455,18 @@ struct _ssl_handshake_params
 #endif /* POLARSSL_X509_CRT_PARSE_C */
 
     /*
-     * Checksum contexts
+     * Checksum context of the negotiated hash. Until ServerHello settles
+     * it, the transcript is kept in fin_buf.
      */
-    sha256_context fin_sha256;
-    sha512_context fin_sha512;
+    union
+    {
+        sha256_context sha256;
+        sha512_context sha512;
+    }
+    fin;
+    uint8_t *fin_buf;                   /*!<  transcript so far, or NULL  */
+    size_t fin_len;                     /*!<  bytes in fin_buf            */
+    size_t fin_size;                    /*!<  size of fin_buf             */
 
     void (*update_checksum)(ssl_context *, const uint8_t *, size_t);
     void (*calc_verify)(ssl_context *, uint8_t *);
@@ -432,7 +485,39 @@ struct _ssl_handshake_params
     int max_major_ver;                  /*!< max. major version client*/
     int max_minor_ver;                  /*!< max. minor version client*/
     int cli_exts;                       /*!< client extension presence*/
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    int new_session_ticket;             /*!< use NewSessionTicket?    */
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+};
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+/*
+ * Keys of one rotation period, derived from the ticket secret
+ */
+typedef struct
+{
+    uint32_t epoch;             /*!< rotation period                  */
+    int valid;                  /*!< keys derived for epoch           */
+    uint8_t key_name[16];       /*!< epoch and tag, put in the clear
+                                     in front of each ticket          */
+    aes_context_t enc;          /*!< encryption context               */
+    aes_context_t dec;          /*!< decryption context               */
+    uint8_t mac_key[32];        /*!< authentication key               */
+}
+ssl_ticket_key;
+
+/*
+ * Keys protecting session tickets, shared by any number of server contexts
+ */
+struct _ssl_ticket_keys
+{
+    uint8_t secret[32];         /*!< secret all ticket keys come from */
+    uint32_t rotation;          /*!< seconds per key (0: no rotation) */
+    ssl_ticket_key key[2];      /*!< keys of two consecutive periods  */
+    mutex_t mutex;              /*!< guards key                       */
 };
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
 
 #if defined(POLARSSL_X509_CRT_PARSE_C)
 /*
@@ -514,8 +599,10 @@ struct _ssl_context
     /*
      * Record layer (incoming data)
      */
-    uint8_t *in_ctr;      /*!< 64-bit incoming message counter  */
-    uint8_t *in_hdr;      /*!< 5-byte record header (in_ctr+8)  */
+    uint8_t *in_buf;      /*!< input buffer, allocated on use   */
+    size_t in_buf_len;          /*!< size of the input buffer         */
+    uint8_t in_ctr[8];    /*!< 64-bit incoming message counter  */
+    uint8_t *in_hdr;      /*!< 5-byte record header (in_buf)    */
     uint8_t *in_iv;       /*!< ivlen-byte IV (in_hdr+5)         */
     uint8_t *in_msg;      /*!< message contents (in_iv+ivlen)   */
     uint8_t *in_offt;     /*!< read offset in application data  */
@@ -531,14 +618,17 @@ struct _ssl_context
     /*
      * Record layer (outgoing data)
      */
-    uint8_t *out_ctr;     /*!< 64-bit outgoing message counter  */
-    uint8_t *out_hdr;     /*!< 5-byte record header (out_ctr+8) */
+    uint8_t *out_buf;     /*!< output buffer, allocated on use  */
+    size_t out_buf_len;         /*!< size of the output buffer        */
+    uint8_t out_ctr[8];   /*!< 64-bit outgoing message counter  */
+    uint8_t *out_hdr;     /*!< 5-byte record header (out_buf)   */
     uint8_t *out_iv;      /*!< ivlen-byte IV (out_hdr+5)        */
     uint8_t *out_msg;     /*!< message contents (out_iv+ivlen)  */
 
     int out_msgtype;            /*!< record header: message type      */
     size_t out_msglen;          /*!< record header: message length    */
     size_t out_left;            /*!< amount of data not yet written   */
+    size_t out_app_len;         /*!< application data in out_left     */
 
 #if defined(POLARSSL_SSL_MAX_FRAGMENT_LENGTH)
     uint8_t mfl_code;     /*!< MaxFragmentLength chosen by us   */
@@ -570,6 +660,14 @@ struct _ssl_context
 #if defined(POLARSSL_SSL_TRUNCATED_HMAC)
     int trunc_hmac;                     /*!<  negotiate truncated hmac?      */
 #endif
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    int encrypt_then_mac;               /*!<  negotiate encrypt-then-MAC?    */
+#endif
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    int session_tickets;                /*!<  use session tickets?           */
+    int ticket_lifetime;                /*!<  session ticket lifetime        */
+    ssl_ticket_keys *ticket_keys;       /*!<  keys protecting tickets        */
+#endif
 
 #if defined(POLARSSL_SSL_SERVER_NAME_INDICATION)
     /*
@@ -631,6 +729,11 @@ int ssl_get_ciphersuite_id( const char *ciphersuite_name );
  *
  * \param ssl      SSL context
  *
+ * \note           The record buffers and handshake structures are only
+ *                 allocated when the handshake starts. After it, the
+ *                 buffers are sized for the negotiated maximum fragment
+ *                 length, see also ssl_free_buffers().
+ *
  * \return         0 if successful, or POLARSSL_ERR_SSL_MALLOC_FAILED if
  *                 memory allocation failed
  */
@@ -648,6 +751,17 @@ int ssl_init( ssl_context *ssl );
  */
 int ssl_session_reset( ssl_context *ssl );
 
+/**
+ * \brief          Free the record buffers of an idle connection, e.g.
+ *                 before waiting for it to become readable. A buffer
+ *                 still holding data (partial record, unread application
+ *                 data, unsent output) is kept. Buffers are allocated
+ *                 again by the next call that needs them.
+ *
+ * \param ssl      SSL context
+ */
+void ssl_free_buffers( ssl_context *ssl );
+
 /**
  * \brief          Set the current endpoint type
  *
@@ -1057,6 +1171,97 @@ int ssl_set_max_frag_len( ssl_context *ssl, uint8_t mfl_code );
 int ssl_set_truncated_hmac( ssl_context *ssl, int truncate );
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+/**
+ * \brief          Enable / Disable encrypt-then-MAC (RFC 7366)
+ *                 (Default: SSL_ETM_ENABLED)
+ *
+ *                 The client offers it and the server accepts it when
+ *                 enabled. Records then carry the MAC of the CBC
+ *                 ciphertext, which is verified before decrypting.
+ *
+ * \note           It is negotiated anew on every handshake, resumed ones
+ *                 included: neither the session cache nor the tickets
+ *                 keep it, so a resumed session may use it whether or
+ *                 not the original one did.
+ *
+ * \param ssl      SSL context
+ * \param etm      Enable or disable (SSL_ETM_ENABLED or SSL_ETM_DISABLED)
+ */
+void ssl_set_encrypt_then_mac( ssl_context *ssl, int etm );
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+/**
+ * \brief          Enable / Disable session tickets
+ *                 (Default: SSL_SESSION_TICKETS_ENABLED on client,
+ *                           SSL_SESSION_TICKETS_DISABLED on server)
+ *
+ * \note           On server, tickets are only issued and accepted once
+ *                 keys are set with ssl_set_session_ticket_keys().
+ *
+ * \param ssl      SSL context
+ * \param use_tickets   Enable or disable (SSL_SESSION_TICKETS_ENABLED or
+ *                                         SSL_SESSION_TICKETS_DISABLED)
+ */
+void ssl_set_session_tickets( ssl_context *ssl, int use_tickets );
+
+/**
+ * \brief          Set session ticket lifetime (server only)
+ *                 (Default: SSL_DEFAULT_TICKET_LIFETIME (86400 secs))
+ *
+ * \param ssl      SSL context
+ * \param lifetime session ticket lifetime
+ */
+void ssl_set_session_ticket_lifetime( ssl_context *ssl, int lifetime );
+
+/**
+ * \brief          Set the keys protecting session tickets (server only)
+ *
+ * \param ssl      SSL context
+ * \param keys     keys set up with ssl_ticket_keys_init(); they may be
+ *                 shared by any number of contexts and must outlive them
+ */
+void ssl_set_session_ticket_keys( ssl_context *ssl, ssl_ticket_keys *keys );
+
+/**
+ * \brief          Set up the keys protecting session tickets
+ *
+ *                 Tickets are sealed with AES-256-CBC and HMAC-SHA-256,
+ *                 keyed from the secret and the current rotation period.
+ *                 Servers given the same secret (e.g. worker processes)
+ *                 thus accept each other's tickets and change keys at the
+ *                 same time without talking to each other. Tickets sealed
+ *                 during the previous period are still accepted, and are
+ *                 replaced by a fresh one.
+ *
+ * \note           To keep tickets usable for their whole lifetime, the
+ *                 rotation period should not be shorter than it.
+ *
+ * \param keys     ticket keys
+ * \param secret   shared secret, or NULL to draw one from f_rng
+ * \param len      length of secret
+ * \param rotation seconds between key changes, 0 to never change keys
+ * \param f_rng    RNG function (used if secret is NULL)
+ * \param p_rng    RNG parameter
+ *
+ * \return         0 if successful, POLARSSL_ERR_SSL_BAD_INPUT_DATA,
+ *                 or an error from f_rng
+ */
+int ssl_ticket_keys_init( ssl_ticket_keys *keys,
+                          const uint8_t *secret, size_t len,
+                          uint32_t rotation,
+                          int (*f_rng)(void *, uint8_t *, size_t),
+                          void *p_rng );
+
+/**
+ * \brief          Free ticket keys and clear memory
+ *
+ * \param keys     ticket keys
+ */
+void ssl_ticket_keys_free( ssl_ticket_keys *keys );
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 /**
  * \brief          Enable / Disable renegotiation support for connection when
  *                 initiated by peer
@@ -1269,6 +1474,106 @@ int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len );
  */
 int ssl_write( ssl_context *ssl, const uint8_t *buf, size_t len );
 
+/**
+ * \brief          Write application data from several buffers. Small
+ *                 buffers are coalesced into full records and the records
+ *                 are encrypted straight from the buffers, then sent with
+ *                 a single call to f_send where possible.
+ *
+ * \param ssl      SSL context
+ * \param iov      buffers holding the data
+ * \param iovcnt   number of buffers
+ *
+ * \return         This function returns the number of bytes written,
+ *                 which may be less than the total, or a negative error
+ *                 code.
+ *
+ * \note           When this function returns POLARSSL_ERR_NET_WANT_WRITE,
+ *                 it must be called later with the *same* arguments,
+ *                 until it returns a positive value.
+ */
+int ssl_writev( ssl_context *ssl, const ssl_iovec *iov, int iovcnt );
+
+/**
+ * \brief          Get the room a record needs around its content, for
+ *                 ssl_encrypt_record() and ssl_write_records()
+ *
+ * \param ssl      SSL context, handshake over
+ * \param header   set to the bytes needed before the content
+ *                 (record header and explicit IV)
+ * \param trailer  set to the most bytes needed after the content
+ *                 (MAC and padding)
+ */
+void ssl_get_record_expansion( const ssl_context *ssl,
+                               size_t *header, size_t *trailer );
+
+/**
+ * \brief          Encrypt an application data record in place, for
+ *                 applications that do their own I/O on the records.
+ *                 The content must be at buf + header, with trailer bytes
+ *                 of room after it (see ssl_get_record_expansion()).
+ *
+ * \param ssl      SSL context, handshake over
+ * \param buf      record buffer
+ * \param len      content length, at most the maximum fragment length
+ * \param olen     set to the length of the record, from buf
+ *
+ * \return         0 if successful, or a specific SSL error code
+ *
+ * \note           Records must be sent in the order they were encrypted,
+ *                 after any left in the SSL output buffer (which this
+ *                 function flushes first).
+ */
+int ssl_encrypt_record( ssl_context *ssl, uint8_t *buf, size_t len,
+                        size_t *olen );
+
+/**
+ * \brief          Encrypt application data gathered from several buffers
+ *                 into as many records as fit in out, without sending them
+ *
+ * \param ssl      SSL context, handshake over
+ * \param iov      buffers holding the data
+ * \param iovcnt   number of buffers
+ * \param out      output buffer, should fit at least one record of the
+ *                 maximum fragment length
+ * \param out_len  size of out
+ * \param olen     set to the length of the records written to out
+ *
+ * \return         the number of application bytes consumed, or a
+ *                 specific SSL error code
+ *
+ * \note           If encryption fails after some records were written,
+ *                 they are kept and their length is returned; the error
+ *                 is returned by the next call.
+ */
+int ssl_write_records( ssl_context *ssl, const ssl_iovec *iov, int iovcnt,
+                       uint8_t *out, size_t out_len, size_t *olen );
+
+/**
+ * \brief          Decrypt the first record in a buffer in place, for
+ *                 applications that do their own I/O on the records
+ *
+ * \param ssl      SSL context, handshake over
+ * \param buf      received data
+ * \param len      length of the data
+ * \param consumed set to the length of the record, to be skipped
+ * \param msg      set to the application data, inside buf
+ * \param msglen   set to the length of the application data (0 for
+ *                 ignored warning alerts)
+ *
+ * \return         0 if successful, POLARSSL_ERR_NET_WANT_READ if buf
+ *                 does not hold a full record yet,
+ *                 POLARSSL_ERR_SSL_PEER_CLOSE_NOTIFY on close_notify,
+ *                 POLARSSL_ERR_SSL_UNEXPECTED_MESSAGE for handshake
+ *                 records, or another specific SSL error code
+ *
+ * \note           Handshake records (renegotiation) are left untouched,
+ *                 sequence number included: pass them on to ssl_read()
+ *                 through the receive callback.
+ */
+int ssl_decrypt_record( ssl_context *ssl, uint8_t *buf, size_t len,
+                        size_t *consumed, uint8_t **msg, size_t *msglen );
+
 /**
  * \brief           Send an alert message
  *
@@ -1350,8 +1655,8 @@ int ssl_write_change_cipher_spec( ssl_context *ssl );
 int ssl_parse_finished( ssl_context *ssl );
 int ssl_write_finished( ssl_context *ssl );
 
-void ssl_optimize_checksum( ssl_context *ssl,
-                            const ssl_ciphersuite_t *ciphersuite_info );
+int ssl_optimize_checksum( ssl_context *ssl,
+                           const ssl_ciphersuite_t *ciphersuite_info );
 
 #if defined(POLARSSL_PK_C)
 uint8_t ssl_sig_from_pk( pk_context *pk );
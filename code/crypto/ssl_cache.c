@@ -7,12 +7,158 @@
 
 #include <stdlib.h>
 
+#define SSL_CACHE_MIN_BUCKETS   16
+
 void ssl_cache_init( ssl_cache_context *cache )
 {
+    int i;
+
     __stosb( cache, 0, sizeof( ssl_cache_context ) );
 
     cache->timeout = SSL_CACHE_DEFAULT_TIMEOUT;
     cache->max_entries = SSL_CACHE_DEFAULT_MAX_ENTRIES;
+
+    for( i = 0; i < SSL_CACHE_SHARDS; i++ )
+        mutex_init( &cache->shard[i].mutex );
+}
+
+/*
+ * FNV-1a over the session id. Ids are picked at random by the server,
+ * so the low bits choose the shard and the others the bucket.
+ */
+static uint32_t ssl_cache_hash( const uint8_t *id, size_t len )
+{
+    uint32_t h = 0x811C9DC5;
+    size_t i;
+
+    for( i = 0; i < len; i++ )
+    {
+        h ^= id[i];
+        h *= 0x01000193;
+    }
+
+    return( h );
+}
+
+#define SSL_CACHE_BUCKET( shard, hash ) \
+    ( ( (hash) / SSL_CACHE_SHARDS ) & (shard)->mask )
+
+static int ssl_cache_expired( const ssl_cache_context *cache,
+                              const ssl_cache_entry *entry, time_t t )
+{
+    return( cache->timeout != 0 &&
+            (int) ( t - entry->timestamp ) > cache->timeout );
+}
+
+static ssl_cache_entry *ssl_cache_find( ssl_cache_shard *shard, uint32_t hash,
+                                        const ssl_session *session )
+{
+    ssl_cache_entry *cur;
+
+    if( shard->bucket == NULL )
+        return( NULL );
+
+    for( cur = shard->bucket[SSL_CACHE_BUCKET( shard, hash )]; cur != NULL;
+         cur = cur->next )
+    {
+        if( cur->hash == hash &&
+            cur->session.length == session->length &&
+            memcmp( cur->session.id, session->id, session->length ) == 0 )
+            return( cur );
+    }
+
+    return( NULL );
+}
+
+/*
+ * Intrusive LRU list: head is the most recently used entry
+ */
+static void ssl_cache_lru_unlink( ssl_cache_shard *shard,
+                                  ssl_cache_entry *entry )
+{
+    if( entry->lru_prev != NULL )
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        shard->lru_head = entry->lru_next;
+
+    if( entry->lru_next != NULL )
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        shard->lru_tail = entry->lru_prev;
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void ssl_cache_lru_push( ssl_cache_shard *shard,
+                                ssl_cache_entry *entry )
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+
+    if( shard->lru_head != NULL )
+        shard->lru_head->lru_prev = entry;
+    else
+        shard->lru_tail = entry;
+
+    shard->lru_head = entry;
+}
+
+/*
+ * Double the bucket array once the load factor reaches 1. Lookups still
+ * work on the old array if the allocation fails.
+ */
+static void ssl_cache_grow( ssl_cache_shard *shard )
+{
+    size_t i, n, old_n;
+    ssl_cache_entry **bucket, *cur, *next;
+
+    old_n = ( shard->bucket != NULL ) ? shard->mask + 1 : 0;
+
+    if( (size_t) shard->count < old_n )
+        return;
+
+    n = ( old_n != 0 ) ? 2 * old_n : SSL_CACHE_MIN_BUCKETS;
+
+    bucket = (ssl_cache_entry **) memory_alloc( n * sizeof( ssl_cache_entry * ) );
+    if( bucket == NULL )
+        return;
+
+    shard->mask = n - 1;
+
+    for( i = 0; i < old_n; i++ )
+    {
+        for( cur = shard->bucket[i]; cur != NULL; cur = next )
+        {
+            next = cur->next;
+            cur->next = bucket[SSL_CACHE_BUCKET( shard, cur->hash )];
+            bucket[SSL_CACHE_BUCKET( shard, cur->hash )] = cur;
+        }
+    }
+
+    if( shard->bucket != NULL )
+        memory_free( shard->bucket );
+
+    shard->bucket = bucket;
+}
+
+/*
+ * Unlink an entry from its bucket and the LRU list, and free it
+ */
+static void ssl_cache_remove( ssl_cache_shard *shard, ssl_cache_entry *entry )
+{
+    ssl_cache_entry **prv;
+
+    prv = &shard->bucket[SSL_CACHE_BUCKET( shard, entry->hash )];
+    while( *prv != entry )
+        prv = &(*prv)->next;
+
+    *prv = entry->next;
+
+    ssl_cache_lru_unlink( shard, entry );
+    shard->count--;
+
+    ssl_session_free( &entry->session );
+    memory_free( entry );
 }
 
 int ssl_cache_get( void *data, ssl_session *session )
@@ -20,179 +166,140 @@ int ssl_cache_get( void *data, ssl_session *session )
     int ret = 1;
     time_t t = time( NULL );
     ssl_cache_context *cache = (ssl_cache_context *) data;
-    ssl_cache_entry *cur, *entry;
+    ssl_cache_shard *shard;
+    ssl_cache_entry *entry;
+    uint32_t hash;
 
-    cur = cache->chain;
-    entry = NULL;
+    hash = ssl_cache_hash( session->id, session->length );
+    shard = &cache->shard[hash & ( SSL_CACHE_SHARDS - 1 )];
 
-    while( cur != NULL )
-    {
-        entry = cur;
-        cur = cur->next;
+    mutex_lock( &shard->mutex );
 
-        if( cache->timeout != 0 &&
-            (int) ( t - entry->timestamp ) > cache->timeout )
-            continue;
+    entry = ssl_cache_find( shard, hash, session );
 
-        if( session->ciphersuite != entry->session.ciphersuite ||
-            session->compression != entry->session.compression ||
-            session->length != entry->session.length )
-            continue;
+    if( entry == NULL )
+        goto exit;
 
-        if( memcmp( session->id, entry->session.id,
-                    entry->session.length ) != 0 )
-            continue;
+    if( ssl_cache_expired( cache, entry, t ) )
+    {
+        ssl_cache_remove( shard, entry );
+        goto exit;
+    }
 
-        __movsb( session->master, entry->session.master, 48 );
+    if( session->ciphersuite != entry->session.ciphersuite ||
+        session->compression != entry->session.compression )
+        goto exit;
 
-        session->verify_result = entry->session.verify_result;
+    __movsb( session->master, entry->session.master, 48 );
 
-#if defined(POLARSSL_X509_CRT_PARSE_C)
-        /*
-         * Restore peer certificate (without rest of the original chain)
-         */
-        if( entry->peer_cert.p != NULL )
-        {
-            session->peer_cert =
-                (x509_crt *) memory_alloc( sizeof(x509_crt) );
+    session->verify_result = entry->session.verify_result;
 
-            if( session->peer_cert == NULL )
-            {
-                ret = 1;
-                goto exit;
-            }
-
-            x509_crt_init( session->peer_cert );
-            if( x509_crt_parse( session->peer_cert, entry->peer_cert.p,
-                                entry->peer_cert.len ) != 0 )
-            {
-                memory_free( session->peer_cert );
-                session->peer_cert = NULL;
-                ret = 1;
-                goto exit;
-            }
-        }
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    /*
+     * Share the stored peer certificate chain, the reference keeps the
+     * whole chain alive
+     */
+    if( entry->session.peer_cert != NULL )
+        session->peer_cert = x509_crt_ref( entry->session.peer_cert );
 #endif /* POLARSSL_X509_CRT_PARSE_C */
 
-        ret = 0;
-        goto exit;
-    }
+    ssl_cache_lru_unlink( shard, entry );
+    ssl_cache_lru_push( shard, entry );
+
+    ret = 0;
 
 exit:
+    mutex_unlock( &shard->mutex );
+
     return( ret );
 }
 
 int ssl_cache_set( void *data, const ssl_session *session )
 {
     int ret = 1;
-    time_t t = time( NULL ), oldest = 0;
-    ssl_cache_entry *old = NULL;
+    time_t t = time( NULL );
     ssl_cache_context *cache = (ssl_cache_context *) data;
-    ssl_cache_entry *cur, *prv;
-    int count = 0;
+    ssl_cache_shard *shard;
+    ssl_cache_entry *cur;
+    uint32_t hash;
+    int max;
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    x509_crt *peer_cert, *old_cert;
+#endif
 
-    cur = cache->chain;
-    prv = NULL;
+    hash = ssl_cache_hash( session->id, session->length );
+    shard = &cache->shard[hash & ( SSL_CACHE_SHARDS - 1 )];
+    max = ( cache->max_entries + SSL_CACHE_SHARDS - 1 ) / SSL_CACHE_SHARDS;
 
-    while( cur != NULL )
-    {
-        count++;
+    mutex_lock( &shard->mutex );
 
-        if( cache->timeout != 0 &&
-            (int) ( t - cur->timestamp ) > cache->timeout )
-        {
+    if( ( cur = ssl_cache_find( shard, hash, session ) ) != NULL )
+    {
+        /* client reconnected, keep timestamp for session id */
+        if( ssl_cache_expired( cache, cur, t ) )
             cur->timestamp = t;
-            break; /* expired, reuse this slot, update timestamp */
-        }
-
-        if( memcmp( session->id, cur->session.id, cur->session.length ) == 0 )
-            break; /* client reconnected, keep timestamp for session id */
 
-        if( oldest == 0 || cur->timestamp < oldest )
-        {
-            oldest = cur->timestamp;
-            old = cur;
-        }
-
-        prv = cur;
-        cur = cur->next;
+        ssl_cache_lru_unlink( shard, cur );
     }
-
-    if( cur == NULL )
+    else
     {
         /*
-         * Reuse oldest entry if max_entries reached
+         * Drop expired entries from the cold end, then the least recently
+         * used one if the shard is still full
          */
-        if( count >= cache->max_entries )
+        while( shard->lru_tail != NULL &&
+               ssl_cache_expired( cache, shard->lru_tail, t ) )
+            ssl_cache_remove( shard, shard->lru_tail );
+
+        if( shard->count >= max )
         {
-            if( old == NULL )
-            {
-                ret = 1;
+            if( shard->lru_tail == NULL )
                 goto exit;
-            }
 
-            cur = old;
+            ssl_cache_remove( shard, shard->lru_tail );
         }
-        else
-        {
-            /*
-             * max_entries not reached, create new entry
-             */
-            cur = (ssl_cache_entry *)
-                        memory_alloc( sizeof(ssl_cache_entry) );
-            if( cur == NULL )
-            {
-                ret = 1;
-                goto exit;
-            }
 
-            __stosb( cur, 0, sizeof(ssl_cache_entry) );
+        ssl_cache_grow( shard );
+        if( shard->bucket == NULL )
+            goto exit;
 
-            if( prv == NULL )
-                cache->chain = cur;
-            else
-                prv->next = cur;
-        }
+        cur = (ssl_cache_entry *) memory_alloc( sizeof(ssl_cache_entry) );
+        if( cur == NULL )
+            goto exit;
 
         cur->timestamp = t;
+        cur->hash = hash;
+        cur->next = shard->bucket[SSL_CACHE_BUCKET( shard, hash )];
+        shard->bucket[SSL_CACHE_BUCKET( shard, hash )] = cur;
+        shard->count++;
     }
 
-    __movsb( &cur->session, session, sizeof( ssl_session ) );
-
 #if defined(POLARSSL_X509_CRT_PARSE_C)
     /*
-     * If we're reusing an entry, memory_free its certificate first
+     * Take the new certificate before dropping the old one, they may be
+     * the same
      */
-    if( cur->peer_cert.p != NULL )
-    {
-        memory_free( cur->peer_cert.p );
-        __stosb( &cur->peer_cert, 0, sizeof(x509_buf) );
-    }
+    peer_cert = ( session->peer_cert != NULL ) ?
+                x509_crt_ref( session->peer_cert ) : NULL;
+    old_cert = cur->session.peer_cert;
+#endif
 
-    /*
-     * Store peer certificate
-     */
-    if( session->peer_cert != NULL )
-    {
-        cur->peer_cert.p = (uint8_t *)
-                                memory_alloc( session->peer_cert->raw.len );
-        if( cur->peer_cert.p == NULL )
-        {
-            ret = 1;
-            goto exit;
-        }
+    __movsb( &cur->session, session, sizeof( ssl_session ) );
 
-        __movsb( cur->peer_cert.p, session->peer_cert->raw.p,
-                session->peer_cert->raw.len );
-        cur->peer_cert.len = session->peer_cert->raw.len;
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    cur->session.peer_cert = peer_cert;
 
-        cur->session.peer_cert = NULL;
-    }
-#endif /* POLARSSL_X509_CRT_PARSE_C */
+    if( old_cert != NULL )
+        x509_crt_unref( old_cert );
+#endif
+
+    ssl_cache_lru_push( shard, cur );
 
     ret = 0;
 
 exit:
+    mutex_unlock( &shard->mutex );
+
     return( ret );
 }
 
@@ -212,24 +319,31 @@ void ssl_cache_set_max_entries( ssl_cache_context *cache, int max )
 
 void ssl_cache_free( ssl_cache_context *cache )
 {
+    int i;
+    ssl_cache_shard *shard;
     ssl_cache_entry *cur, *prv;
 
-    cur = cache->chain;
-
-    while( cur != NULL )
+    for( i = 0; i < SSL_CACHE_SHARDS; i++ )
     {
-        prv = cur;
-        cur = cur->next;
+        shard = &cache->shard[i];
+        cur = shard->lru_head;
 
-        ssl_session_free( &prv->session );
+        while( cur != NULL )
+        {
+            prv = cur;
+            cur = cur->lru_next;
 
-#if defined(POLARSSL_X509_CRT_PARSE_C)
-        if( prv->peer_cert.p != NULL )
-            memory_free( prv->peer_cert.p );
-#endif /* POLARSSL_X509_CRT_PARSE_C */
+            ssl_session_free( &prv->session );
+            memory_free( prv );
+        }
 
-        memory_free( prv );
+        if( shard->bucket != NULL )
+            memory_free( shard->bucket );
+
+        mutex_destroy( &shard->mutex );
     }
+
+    __stosb( cache, 0, sizeof( ssl_cache_context ) );
 }
 
 #endif /* POLARSSL_SSL_CACHE_C */
@@ -19,6 +19,10 @@
 #define SSL_CACHE_DEFAULT_MAX_ENTRIES      50   /*!< Maximum entries in cache */
 #endif
 
+#if !defined(SSL_CACHE_SHARDS)
+#define SSL_CACHE_SHARDS                    8   /*!< Separately locked parts of the cache, a power of 2 */
+#endif
+
 /* \} name SECTION: Module settings */
 
 #ifdef __cplusplus
@@ -34,19 +38,34 @@ typedef struct _ssl_cache_entry ssl_cache_entry;
 struct _ssl_cache_entry
 {
     time_t timestamp;           /*!< entry timestamp    */
-    ssl_session session;        /*!< entry session      */
-#if defined(POLARSSL_X509_CRT_PARSE_C)
-    x509_buf peer_cert;         /*!< entry peer_cert    */
-#endif
-    ssl_cache_entry *next;      /*!< chain pointer      */
+    ssl_session session;        /*!< entry session, its peer_cert is
+                                     shared with x509_crt_ref()         */
+    uint32_t hash;              /*!< hash of the session id             */
+    ssl_cache_entry *next;      /*!< bucket chain pointer               */
+    ssl_cache_entry *lru_prev;  /*!< more recently used entry           */
+    ssl_cache_entry *lru_next;  /*!< less recently used entry           */
 };
 
+/**
+ * \brief   One separately locked part of the cache
+ */
+typedef struct
+{
+    mutex_t mutex;              /*!< guards the shard                   */
+    ssl_cache_entry **bucket;   /*!< hash buckets                       */
+    size_t mask;                /*!< number of buckets - 1              */
+    int count;                  /*!< number of entries                  */
+    ssl_cache_entry *lru_head;  /*!< most recently used entry           */
+    ssl_cache_entry *lru_tail;  /*!< least recently used, evicted first */
+}
+ssl_cache_shard;
+
 /**
  * \brief Cache context
  */
 struct _ssl_cache_context
 {
-    ssl_cache_entry *chain;     /*!< start of the chain     */
+    ssl_cache_shard shard[SSL_CACHE_SHARDS];    /*!< entries by session id  */
     int timeout;                /*!< cache entry timeout    */
     int max_entries;            /*!< maximum entries        */
 };
@@ -60,7 +79,7 @@ void ssl_cache_init( ssl_cache_context *cache );
 
 /**
  * \brief          Cache get callback implementation
- *                 (Thread-safe if POLARSSL_THREADING_C is enabled)
+ *                 (Thread-safe)
  *
  * \param data     SSL cache context
  * \param session  session to retrieve entry for
@@ -69,7 +88,7 @@ int ssl_cache_get( void *data, ssl_session *session );
 
 /**
  * \brief          Cache set callback implementation
- *                 (Thread-safe if POLARSSL_THREADING_C is enabled)
+ *                 (Thread-safe)
  *
  * \param data     SSL cache context
  * \param session  session to store entry for
@@ -88,9 +107,13 @@ int ssl_cache_set( void *data, const ssl_session *session );
 void ssl_cache_set_timeout( ssl_cache_context *cache, int timeout );
 
 /**
- * \brief          Set the cache timeout
+ * \brief          Set the maximum number of entries
  *                 (Default: SSL_CACHE_DEFAULT_MAX_ENTRIES (50))
  *
+ *                 The limit is split evenly over the SSL_CACHE_SHARDS
+ *                 shards, rounded up; each evicts its least recently
+ *                 used entry when full.
+ *
  * \param cache    SSL cache context
  * \param max      cache entry maximum
  */
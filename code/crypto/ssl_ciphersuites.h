@@ -13,12 +13,14 @@ extern "C" {
  * Supported ciphersuites (Official IANA names)
  */
 
+#define TLS_ECDHE_ECDSA_WITH_AES_256_CBC_SHA384  0xC024 /**< TLS 1.2 */
 #define TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA384    0xC028 /**< TLS 1.2 */
 
 
 typedef enum {
     POLARSSL_KEY_EXCHANGE_ECDHE_RSA = 1,
     POLARSSL_KEY_EXCHANGE_ECDH_RSA,
+    POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA,
 } key_exchange_type_t;
 
 typedef struct _ssl_ciphersuite_t ssl_ciphersuite_t;
@@ -98,6 +98,18 @@ static void ssl_write_signature_algorithms_ext( ssl_context *ssl,
     /*
      * Prepare signature_algorithms extension (TLS 1.2)
      */
+#if defined(POLARSSL_SHA512_C)
+    sig_alg_list[sig_alg_len++] = SSL_HASH_SHA512;
+    sig_alg_list[sig_alg_len++] = SSL_SIG_ECDSA;
+    sig_alg_list[sig_alg_len++] = SSL_HASH_SHA384;
+    sig_alg_list[sig_alg_len++] = SSL_SIG_ECDSA;
+#endif
+#if defined(POLARSSL_SHA256_C)
+    sig_alg_list[sig_alg_len++] = SSL_HASH_SHA256;
+    sig_alg_list[sig_alg_len++] = SSL_SIG_ECDSA;
+    sig_alg_list[sig_alg_len++] = SSL_HASH_SHA224;
+    sig_alg_list[sig_alg_len++] = SSL_SIG_ECDSA;
+#endif
 #if defined(POLARSSL_SHA512_C)
     sig_alg_list[sig_alg_len++] = SSL_HASH_SHA512;
     sig_alg_list[sig_alg_len++] = SSL_SIG_RSA;
@@ -241,6 +253,57 @@ static void ssl_write_truncated_hmac_ext( ssl_context *ssl,
 }
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+static void ssl_write_encrypt_then_mac_ext( ssl_context *ssl,
+                                            uint8_t *buf, size_t *olen )
+{
+    uint8_t *p = buf;
+
+    if( ssl->encrypt_then_mac == SSL_ETM_DISABLED )
+    {
+        *olen = 0;
+        return;
+    }
+
+    *p++ = (uint8_t)( ( TLS_EXT_ENCRYPT_THEN_MAC >> 8 ) & 0xFF );
+    *p++ = (uint8_t)( ( TLS_EXT_ENCRYPT_THEN_MAC      ) & 0xFF );
+
+    *p++ = 0x00;
+    *p++ = 0x00;
+
+    *olen = 4;
+}
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+static void ssl_write_session_ticket_ext( ssl_context *ssl,
+                                          uint8_t *buf, size_t *olen )
+{
+    uint8_t *p = buf;
+    size_t tlen = ssl->session_negotiate->ticket_len;
+
+    if( ssl->session_tickets == SSL_SESSION_TICKETS_DISABLED )
+    {
+        *olen = 0;
+        return;
+    }
+
+    if( ssl->session_negotiate->ticket == NULL )
+        tlen = 0;
+
+    *p++ = (uint8_t)( ( TLS_EXT_SESSION_TICKET >> 8 ) & 0xFF );
+    *p++ = (uint8_t)( ( TLS_EXT_SESSION_TICKET      ) & 0xFF );
+
+    *p++ = (uint8_t)( ( tlen >> 8 ) & 0xFF );
+    *p++ = (uint8_t)( ( tlen      ) & 0xFF );
+
+    *olen = 4 + tlen;
+
+    if( tlen != 0 )
+        __movsb( p, ssl->session_negotiate->ticket, tlen );
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 #if defined(POLARSSL_SSL_ALPN)
 static void ssl_write_alpn_ext( ssl_context *ssl,
                                 uint8_t *buf, size_t *olen )
@@ -358,6 +421,27 @@ static int ssl_write_client_hello( ssl_context *ssl )
         n = 0;
     }
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    /*
+     * RFC 5077 section 3.4: "When presenting a ticket, the client MAY
+     * generate and include a Session ID in the TLS ClientHello."
+     * The server echoes it if it accepts the ticket.
+     */
+    if( ssl->renegotiation == SSL_INITIAL_HANDSHAKE &&
+        ssl->session_tickets == SSL_SESSION_TICKETS_ENABLED &&
+        ssl->handshake->resume != 0 &&
+        ssl->session_negotiate->ticket != NULL &&
+        ssl->session_negotiate->ticket_len != 0 )
+    {
+        ret = ssl->f_rng( ssl->p_rng, ssl->session_negotiate->id, 32 );
+
+        if( ret != 0 )
+            return( ret );
+
+        ssl->session_negotiate->length = n = 32;
+    }
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
     *p++ = (uint8_t) n;
 
     for( i = 0; i < n; i++ )
@@ -431,6 +515,16 @@ static int ssl_write_client_hello( ssl_context *ssl )
     ext_len += olen;
 #endif
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    ssl_write_encrypt_then_mac_ext( ssl, p + 2 + ext_len, &olen );
+    ext_len += olen;
+#endif
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    ssl_write_session_ticket_ext( ssl, p + 2 + ext_len, &olen );
+    ext_len += olen;
+#endif
+
 #if defined(POLARSSL_SSL_ALPN)
     ssl_write_alpn_ext( ssl, p + 2 + ext_len, &olen );
     ext_len += olen;
@@ -511,6 +605,8 @@ static int ssl_parse_max_fragment_length_ext( ssl_context *ssl,
         return( POLARSSL_ERR_SSL_BAD_HS_SERVER_HELLO );
     }
 
+    ssl->session_negotiate->mfl_code = buf[0];
+
     return( 0 );
 }
 #endif /* POLARSSL_SSL_MAX_FRAGMENT_LENGTH */
@@ -534,6 +630,44 @@ static int ssl_parse_truncated_hmac_ext( ssl_context *ssl,
 }
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+static int ssl_parse_encrypt_then_mac_ext( ssl_context *ssl,
+                                           const uint8_t *buf,
+                                           size_t len )
+{
+    if( ssl->encrypt_then_mac == SSL_ETM_DISABLED ||
+        len != 0 )
+    {
+        return( POLARSSL_ERR_SSL_BAD_HS_SERVER_HELLO );
+    }
+
+    ((void) buf);
+
+    ssl->session_negotiate->encrypt_then_mac = SSL_ETM_ENABLED;
+
+    return( 0 );
+}
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+static int ssl_parse_session_ticket_ext( ssl_context *ssl,
+                                         const uint8_t *buf,
+                                         size_t len )
+{
+    if( ssl->session_tickets == SSL_SESSION_TICKETS_DISABLED ||
+        len != 0 )
+    {
+        return( POLARSSL_ERR_SSL_BAD_HS_SERVER_HELLO );
+    }
+
+    ((void) buf);
+
+    ssl->handshake->new_session_ticket = 1;
+
+    return( 0 );
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 int ssl_parse_supported_point_formats_ext(ssl_context *ssl, const uint8_t *buf, size_t len)
 {
     size_t list_size;
@@ -698,7 +832,9 @@ static int ssl_parse_server_hello( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
     }
 
-    ssl_optimize_checksum( ssl, ssl->transform_negotiate->ciphersuite_info );
+    if( ( ret = ssl_optimize_checksum( ssl,
+                    ssl->transform_negotiate->ciphersuite_info ) ) != 0 )
+        return( ret );
 
     /*
      * Check if the session can be resumed
@@ -720,12 +856,8 @@ static int ssl_parse_server_hello( ssl_context *ssl )
     }
     else
     {
+        /* The keys are derived once the extensions are known */
         ssl->state = SSL_SERVER_CHANGE_CIPHER_SPEC;
-
-        if( ( ret = ssl_derive_keys( ssl ) ) != 0 )
-        {
-            return( ret );
-        }
     }
 
     i = 0;
@@ -751,6 +883,14 @@ static int ssl_parse_server_hello( ssl_context *ssl )
 
     ext = buf + 44 + n;
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    /*
+     * Only this ServerHello decides, even for a resumed session that used
+     * encrypt-then-MAC before
+     */
+    ssl->session_negotiate->encrypt_then_mac = SSL_ETM_DISABLED;
+#endif
+
     while( ext_len )
     {
         uint32_t ext_id   = ( ( ext[0] <<  8 )
@@ -796,6 +936,28 @@ static int ssl_parse_server_hello( ssl_context *ssl )
             break;
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+        case TLS_EXT_ENCRYPT_THEN_MAC:
+            if( ( ret = ssl_parse_encrypt_then_mac_ext( ssl,
+                            ext + 4, ext_size ) ) != 0 )
+            {
+                return( ret );
+            }
+
+            break;
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+        case TLS_EXT_SESSION_TICKET:
+            if( ( ret = ssl_parse_session_ticket_ext( ssl,
+                            ext + 4, ext_size ) ) != 0 )
+            {
+                return( ret );
+            }
+
+            break;
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
         case TLS_EXT_SUPPORTED_POINT_FORMATS:
             if( ( ret = ssl_parse_supported_point_formats_ext( ssl,
                             ext + 4, ext_size ) ) != 0 )
@@ -858,6 +1020,12 @@ static int ssl_parse_server_hello( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_BAD_HS_SERVER_HELLO );
     }
 
+    if( ssl->handshake->resume != 0 &&
+        ( ret = ssl_derive_keys( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
     return( 0 );
 }
 
@@ -977,7 +1145,8 @@ int ssl_parse_server_key_exchange( ssl_context *ssl )
     p   = ssl->in_msg + 4;
     end = ssl->in_msg + ssl->in_hslen;
 
-    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA)
+    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA ||
+        ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA )
     {
         if( ssl_parse_server_ecdh_params( ssl, &p, end ) != 0 )
         {
@@ -988,7 +1157,8 @@ int ssl_parse_server_key_exchange( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
     }
 
-    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA) {
+    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA ||
+        ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA ) {
         params_len = p - ( ssl->in_msg + 4 );
 
         /*
@@ -1145,6 +1315,12 @@ int ssl_parse_certificate_request( ssl_context *ssl )
             ssl->handshake->cert_type = SSL_CERT_TYPE_RSA_SIGN;
             break;
         }
+        else if( *p == SSL_CERT_TYPE_ECDSA_SIGN &&
+                 pk_can_do( ssl_own_key( ssl ), POLARSSL_PK_ECDSA ) )
+        {
+            ssl->handshake->cert_type = SSL_CERT_TYPE_ECDSA_SIGN;
+            break;
+        }
         else
         {
             ; /* Unsupported cert type, ignore */
@@ -1220,7 +1396,9 @@ static int ssl_write_client_key_exchange( ssl_context *ssl )
     size_t i, n;
     const ssl_ciphersuite_t *ciphersuite_info = ssl->transform_negotiate->ciphersuite_info;
 
-    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA || ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDH_RSA)
+    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA ||
+        ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA ||
+        ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDH_RSA )
     {
         /*
          * ECDH key exchange -- send client public value
@@ -1355,6 +1533,92 @@ int ssl_write_certificate_verify( ssl_context *ssl )
     return( ret );
 }
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+static int ssl_parse_new_session_ticket( ssl_context *ssl )
+{
+    int ret;
+    uint32_t lifetime;
+    size_t ticket_len;
+    uint8_t *ticket, *msg;
+
+    if( ( ret = ssl_read_record( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    if( ssl->in_msgtype != SSL_MSG_HANDSHAKE )
+    {
+        return( POLARSSL_ERR_SSL_UNEXPECTED_MESSAGE );
+    }
+
+    /*
+     * struct {
+     *     uint32 ticket_lifetime_hint;
+     *     opaque ticket<0..2^16-1>;
+     * } NewSessionTicket;
+     *
+     * 0  .  0   handshake message type
+     * 1  .  3   handshake message length
+     * 4  .  7   ticket_lifetime_hint
+     * 8  .  9   ticket_len (n)
+     * 10 .  9+n ticket content
+     */
+    if( ssl->in_msg[0] != SSL_HS_NEW_SESSION_TICKET ||
+        ssl->in_hslen < 10 )
+    {
+        return( POLARSSL_ERR_SSL_BAD_HS_NEW_SESSION_TICKET );
+    }
+
+    msg = ssl->in_msg + 4;
+    lifetime = ( (uint32_t) msg[0] << 24 ) | ( (uint32_t) msg[1] << 16 ) |
+               ( (uint32_t) msg[2] <<  8 ) | ( (uint32_t) msg[3]       );
+
+    ticket_len = ( msg[4] << 8 ) | ( msg[5] );
+
+    if( ticket_len + 10 != ssl->in_hslen )
+    {
+        return( POLARSSL_ERR_SSL_BAD_HS_NEW_SESSION_TICKET );
+    }
+
+    /* We're not waiting for a NewSessionTicket message any more */
+    ssl->handshake->new_session_ticket = 0;
+
+    /*
+     * Zero-length ticket means the server changed his mind and doesn't want
+     * to send a ticket after all, so just forget it
+     */
+    if( ticket_len == 0 )
+        return( 0 );
+
+    if( ( ticket = (uint8_t *) memory_alloc( ticket_len ) ) == NULL )
+    {
+        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+    }
+
+    __movsb( ticket, msg + 6, ticket_len );
+
+    if( ssl->session_negotiate->ticket != NULL )
+    {
+        __stosb( ssl->session_negotiate->ticket, 0,
+                 ssl->session_negotiate->ticket_len );
+        memory_free( ssl->session_negotiate->ticket );
+    }
+
+    ssl->session_negotiate->ticket = ticket;
+    ssl->session_negotiate->ticket_len = ticket_len;
+    ssl->session_negotiate->ticket_lifetime = lifetime;
+
+    /*
+     * RFC 5077 section 3.4:
+     * "If the client receives a session ticket from the server, then it
+     * discards any Session ID that was sent in the ServerHello."
+     */
+    ssl->session_negotiate->length = 0;
+
+    return( 0 );
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 /*
  * SSL handshake -- client side -- single step
  */
@@ -1441,7 +1705,12 @@ int ssl_handshake_client_step( ssl_context *ssl )
         *        Finished
         */
        case SSL_SERVER_CHANGE_CIPHER_SPEC:
-           ret = ssl_parse_change_cipher_spec( ssl );
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+           if( ssl->handshake->new_session_ticket != 0 )
+               ret = ssl_parse_new_session_ticket( ssl );
+           else
+#endif
+               ret = ssl_parse_change_cipher_spec( ssl );
            break;
 
        case SSL_SERVER_FINISHED:
@@ -250,6 +250,439 @@ static int ssl_parse_truncated_hmac_ext( ssl_context *ssl,
 }
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+static int ssl_parse_encrypt_then_mac_ext( ssl_context *ssl,
+                                           const uint8_t *buf,
+                                           size_t len )
+{
+    if( len != 0 )
+    {
+        return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_HELLO );
+    }
+
+    ((void) buf);
+
+    /*
+     * All the suites are CBC ones, to which RFC 7366 applies. This holds
+     * for resumed sessions too, the cache and tickets do not restore it.
+     */
+    if( ssl->encrypt_then_mac == SSL_ETM_ENABLED )
+        ssl->session_negotiate->encrypt_then_mac = SSL_ETM_ENABLED;
+
+    return( 0 );
+}
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+/*
+ * Serialize the parts of a session needed to resume it
+ *
+ *     0  .   7   start time
+ *     8  .   9   ciphersuite
+ *    10  .  10   compression
+ *    11  .  58   master secret
+ *    59  .  62   verify result
+ *    63  .  65   peer certificate length (n)
+ *    66  . 65+n  peer certificate
+ */
+#define SSL_TICKET_STATE_LEN    66
+
+static int ssl_save_session( const ssl_session *session,
+                             uint8_t *buf, size_t buf_len,
+                             size_t *olen )
+{
+    uint8_t *p = buf;
+    uint64_t start = (uint64_t) session->start;
+    size_t cert_len = 0;
+    int i;
+
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    if( session->peer_cert != NULL )
+        cert_len = session->peer_cert->raw.len;
+#endif
+
+    if( buf_len < SSL_TICKET_STATE_LEN + cert_len )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    for( i = 56; i >= 0; i -= 8 )
+        *p++ = (uint8_t)( start >> i );
+
+    *p++ = (uint8_t)( session->ciphersuite >> 8 );
+    *p++ = (uint8_t)( session->ciphersuite      );
+    *p++ = (uint8_t)( session->compression      );
+
+    __movsb( p, session->master, 48 );
+    p += 48;
+
+    *p++ = (uint8_t)( session->verify_result >> 24 );
+    *p++ = (uint8_t)( session->verify_result >> 16 );
+    *p++ = (uint8_t)( session->verify_result >>  8 );
+    *p++ = (uint8_t)( session->verify_result       );
+
+    *p++ = (uint8_t)( cert_len >> 16 );
+    *p++ = (uint8_t)( cert_len >>  8 );
+    *p++ = (uint8_t)( cert_len       );
+
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    if( cert_len != 0 )
+        __movsb( p, session->peer_cert->raw.p, cert_len );
+#endif
+    p += cert_len;
+
+    *olen = p - buf;
+
+    return( 0 );
+}
+
+static int ssl_load_session( ssl_session *session,
+                             const uint8_t *buf, size_t len )
+{
+    const uint8_t *p = buf;
+    uint64_t start = 0;
+    size_t cert_len;
+    int i;
+
+    if( len < SSL_TICKET_STATE_LEN )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    for( i = 0; i < 8; i++ )
+        start = ( start << 8 ) | *p++;
+
+    session->start = (time_t) start;
+    session->ciphersuite = ( p[0] << 8 ) | p[1];
+    session->compression = p[2];
+    p += 3;
+
+    __movsb( session->master, p, 48 );
+    p += 48;
+
+    session->verify_result = (int)( ( (uint32_t) p[0] << 24 ) |
+                                    ( (uint32_t) p[1] << 16 ) |
+                                    ( (uint32_t) p[2] <<  8 ) |
+                                    ( (uint32_t) p[3]       ) );
+    p += 4;
+
+    cert_len = ( p[0] << 16 ) | ( p[1] << 8 ) | p[2];
+    p += 3;
+
+    if( cert_len != len - SSL_TICKET_STATE_LEN )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    if( cert_len == 0 )
+        return( 0 );
+
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    {
+        int ret;
+
+        session->peer_cert = (x509_crt *) memory_alloc( sizeof( x509_crt ) );
+        if( session->peer_cert == NULL )
+            return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+
+        x509_crt_init( session->peer_cert );
+
+        if( ( ret = x509_crt_parse_der( session->peer_cert, p,
+                                        cert_len ) ) != 0 )
+        {
+            x509_crt_free( session->peer_cert );
+            memory_free( session->peer_cert );
+            session->peer_cert = NULL;
+            return( ret );
+        }
+    }
+
+    return( 0 );
+#else
+    return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+#endif /* POLARSSL_X509_CRT_PARSE_C */
+}
+
+static uint32_t ssl_ticket_epoch( const ssl_ticket_keys *keys )
+{
+    if( keys->rotation == 0 )
+        return( 0 );
+
+    return( (uint32_t)( time( NULL ) / keys->rotation ) );
+}
+
+/*
+ * Keys of a rotation period, derived from the secret on first use:
+ * HMAC-SHA-256( secret, label || epoch ) for the AES key, the MAC key and
+ * the tag of the key name. Must be called with keys->mutex held.
+ */
+static ssl_ticket_key *ssl_ticket_key_get( ssl_ticket_keys *keys,
+                                           uint32_t epoch )
+{
+    ssl_ticket_key *key = &keys->key[epoch & 1];
+    uint8_t label[8], out[32];
+
+    if( key->valid && key->epoch == epoch )
+        return( key );
+
+    label[4] = (uint8_t)( epoch >> 24 );
+    label[5] = (uint8_t)( epoch >> 16 );
+    label[6] = (uint8_t)( epoch >>  8 );
+    label[7] = (uint8_t)( epoch       );
+
+    __movsb( label, (const uint8_t *) "tenc", 4 );
+    sha256_hmac( keys->secret, 32, label, 8, out, 0 );
+    aes_setkey_enc( &key->enc, out );
+    aes_setkey_dec( &key->dec, out );
+
+    __movsb( label, (const uint8_t *) "tmac", 4 );
+    sha256_hmac( keys->secret, 32, label, 8, key->mac_key, 0 );
+
+    __movsb( label, (const uint8_t *) "tkey", 4 );
+    sha256_hmac( keys->secret, 32, label, 8, out, 0 );
+    __movsb( key->key_name, label + 4, 4 );
+    __movsb( key->key_name + 4, out, 12 );
+
+    __stosb( out, 0, sizeof( out ) );
+
+    key->epoch = epoch;
+    key->valid = 1;
+
+    return( key );
+}
+
+int ssl_ticket_keys_init( ssl_ticket_keys *keys,
+                          const uint8_t *secret, size_t len,
+                          uint32_t rotation,
+                          int (*f_rng)(void *, uint8_t *, size_t),
+                          void *p_rng )
+{
+    int ret;
+
+    __stosb( keys, 0, sizeof( ssl_ticket_keys ) );
+
+    if( secret != NULL )
+        sha256( secret, len, keys->secret, 0 );
+    else if( f_rng == NULL )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+    else if( ( ret = f_rng( p_rng, keys->secret, 32 ) ) != 0 )
+        return( ret );
+
+    keys->rotation = rotation;
+
+    mutex_init( &keys->mutex );
+
+    return( 0 );
+}
+
+void ssl_ticket_keys_free( ssl_ticket_keys *keys )
+{
+    mutex_destroy( &keys->mutex );
+
+    __stosb( keys, 0, sizeof( ssl_ticket_keys ) );
+}
+
+/*
+ * Create a session ticket in ssl->out_msg + 10
+ *
+ *     0  .  15   key name
+ *    16  .  31   iv
+ *    32  .  33   encrypted state length (n)
+ *    34  . 33+n  encrypted state
+ *   34+n . 65+n  HMAC-SHA-256 of all of the above
+ */
+static int ssl_write_ticket( ssl_context *ssl, size_t *tlen )
+{
+    int ret;
+    ssl_ticket_keys *keys = ssl->ticket_keys;
+    ssl_ticket_key *key;
+    uint8_t * const start = ssl->out_msg + 10;
+    uint8_t *state = start + 34;
+    uint8_t iv[16];
+    size_t clear_len, enc_len, pad_len, i;
+
+    *tlen = 0;
+
+    if( keys == NULL )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    if( ( ret = ssl_save_session( ssl->session_negotiate, state,
+                                  SSL_MAX_CONTENT_LEN - 10 - 34 - 16 - 32,
+                                  &clear_len ) ) != 0 )
+        return( ret );
+
+    /* PKCS padding, enc_len stays below 2^16 */
+    pad_len = 16 - clear_len % 16;
+    enc_len = clear_len + pad_len;
+    for( i = clear_len; i < enc_len; i++ )
+        state[i] = (uint8_t) pad_len;
+
+    if( ( ret = ssl->f_rng( ssl->p_rng, start + 16, 16 ) ) != 0 )
+        return( ret );
+
+    __movsb( iv, start + 16, 16 );
+
+    start[32] = (uint8_t)( enc_len >> 8 );
+    start[33] = (uint8_t)( enc_len      );
+
+    mutex_lock( &keys->mutex );
+
+    key = ssl_ticket_key_get( keys, ssl_ticket_epoch( keys ) );
+
+    __movsb( start, key->key_name, 16 );
+
+    aes_crypt_cbc( &key->enc, AES_ENCRYPT, enc_len, iv, state, state );
+
+    sha256_hmac( key->mac_key, 32, start, 34 + enc_len,
+                 state + enc_len, 0 );
+
+    mutex_unlock( &keys->mutex );
+
+    *tlen = 34 + enc_len + 32;
+
+    return( 0 );
+}
+
+/*
+ * Check and decrypt a ticket in place, then take the session it carries
+ * into ssl->session_negotiate. *renew is set if the ticket was sealed
+ * with the keys of the previous period.
+ */
+static int ssl_parse_ticket( ssl_context *ssl, uint8_t *buf, size_t len,
+                             int *renew )
+{
+    int ret;
+    ssl_ticket_keys *keys = ssl->ticket_keys;
+    ssl_ticket_key *key;
+    ssl_session session;
+    uint8_t *key_name = buf;
+    uint8_t *iv = buf + 16;
+    uint8_t *state = buf + 34;
+    uint8_t *mac;
+    uint8_t computed_mac[32];
+    uint8_t diff;
+    size_t enc_len, pad_len, i;
+    uint32_t epoch, now;
+
+    if( len < 34 )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    enc_len = ( buf[32] << 8 ) | buf[33];
+    mac = state + enc_len;
+
+    if( enc_len == 0 || enc_len % 16 != 0 || len != 34 + enc_len + 32 )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    /*
+     * Only the keys of the current and the previous period are accepted,
+     * so stale or forged names never cause a key derivation
+     */
+    epoch = ( (uint32_t) key_name[0] << 24 ) | ( (uint32_t) key_name[1] << 16 ) |
+            ( (uint32_t) key_name[2] <<  8 ) | ( (uint32_t) key_name[3]       );
+    now = ssl_ticket_epoch( keys );
+
+    if( epoch != now && ( keys->rotation == 0 || epoch + 1 != now ) )
+        return( POLARSSL_ERR_SSL_SESSION_TICKET_EXPIRED );
+
+    *renew = ( epoch != now );
+
+    mutex_lock( &keys->mutex );
+
+    key = ssl_ticket_key_get( keys, epoch );
+
+    /* Check key name and MAC in constant time */
+    sha256_hmac( key->mac_key, 32, buf, len - 32, computed_mac, 0 );
+
+    for( diff = 0, i = 0; i < 16; i++ )
+        diff |= key_name[i] ^ key->key_name[i];
+
+    for( i = 0; i < 32; i++ )
+        diff |= mac[i] ^ computed_mac[i];
+
+    if( diff == 0 )
+        aes_crypt_cbc( &key->dec, AES_DECRYPT, enc_len, iv, state, state );
+
+    mutex_unlock( &keys->mutex );
+
+    if( diff != 0 )
+        return( POLARSSL_ERR_SSL_INVALID_MAC );
+
+    /* The ticket is authenticated, the padding needs no care */
+    pad_len = state[enc_len - 1];
+    if( pad_len == 0 || pad_len > 16 )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    for( i = enc_len - pad_len; i < enc_len; i++ )
+        if( state[i] != pad_len )
+            return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    __stosb( &session, 0, sizeof( ssl_session ) );
+
+    if( ( ret = ssl_load_session( &session, state,
+                                  enc_len - pad_len ) ) != 0 )
+        goto exit;
+
+    /* Resume with the parameters the ticket was issued for only */
+    if( session.ciphersuite != ssl->session_negotiate->ciphersuite ||
+        session.compression != ssl->session_negotiate->compression )
+    {
+        ret = POLARSSL_ERR_SSL_BAD_INPUT_DATA;
+        goto exit;
+    }
+
+    if( ssl->ticket_lifetime != 0 &&
+        (int) ( time( NULL ) - session.start ) > ssl->ticket_lifetime )
+    {
+        ret = POLARSSL_ERR_SSL_SESSION_TICKET_EXPIRED;
+        goto exit;
+    }
+
+    /*
+     * Keep the session id the client sent, take the rest from the ticket
+     */
+    ssl->session_negotiate->start = session.start;
+    ssl->session_negotiate->verify_result = session.verify_result;
+    __movsb( ssl->session_negotiate->master, session.master, 48 );
+
+#if defined(POLARSSL_X509_CRT_PARSE_C)
+    ssl->session_negotiate->peer_cert = session.peer_cert;
+    session.peer_cert = NULL;
+#endif
+
+exit:
+    ssl_session_free( &session );
+    __stosb( state, 0, enc_len );
+
+    return( ret );
+}
+
+static int ssl_parse_session_ticket_ext( ssl_context *ssl,
+                                         uint8_t *buf,
+                                         size_t len )
+{
+    int renew = 0;
+
+    if( ssl->session_tickets == SSL_SESSION_TICKETS_DISABLED ||
+        ssl->ticket_keys == NULL )
+    {
+        return( 0 );
+    }
+
+    /* Remember the client asked us to send a new ticket */
+    ssl->handshake->new_session_ticket = 1;
+
+    if( len == 0 || ssl->renegotiation != SSL_INITIAL_HANDSHAKE )
+        return( 0 );
+
+    /*
+     * Failures are ok: just ignore the ticket and do a full handshake
+     */
+    if( ssl_parse_ticket( ssl, buf, len, &renew ) != 0 )
+        return( 0 );
+
+    ssl->handshake->resume = 1;
+
+    /* Only replace tickets sealed with last period's keys */
+    ssl->handshake->new_session_ticket = renew;
+
+    return( 0 );
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 #if defined(POLARSSL_SSL_ALPN)
 static int ssl_parse_alpn_ext( ssl_context *ssl,
                                const uint8_t *buf, size_t len )
@@ -319,6 +752,22 @@ static int ssl_parse_alpn_ext( ssl_context *ssl,
 
 #if defined(POLARSSL_X509_CRT_PARSE_C)
 
+/*
+ * Return 1 if the EC key's curve is one the client offered, 0 otherwise
+ */
+static int ssl_key_matches_curves( pk_context *pk,
+                                   const ecp_curve_info **curves )
+{
+    const ecp_curve_info **crv;
+    ecp_group_id grp_id = pk_ec( *pk )->grp.id;
+
+    for( crv = curves; *crv != NULL; crv++ )
+        if( (*crv)->grp_id == grp_id )
+            return( 1 );
+
+    return( 0 );
+}
+
 /*
  * Try picking a certificate for this ciphersuite,
  * return 0 on success and -1 on failure.
@@ -344,6 +793,16 @@ static int ssl_pick_cert( ssl_context *ssl,
         if( ! pk_can_do( cur->key, pk_alg ) )
             continue;
 
+        /*
+         * The client can only verify an ECDSA signature on a curve it
+         * announced (ssl_ciphersuite_match() ensures the list is not empty)
+         */
+        if( pk_alg == POLARSSL_PK_ECDSA &&
+            ! ssl_key_matches_curves( cur->key, ssl->handshake->curves ) )
+        {
+            continue;
+        }
+
         /*
          * This avoids sending the client a cert it'll reject based on
          * keyUsage or other extensions.
@@ -566,7 +1025,9 @@ static int ssl_parse_client_hello_v2( ssl_context *ssl )
 have_ciphersuite_v2:
     ssl->session_negotiate->ciphersuite = ciphersuites[i];
     ssl->transform_negotiate->ciphersuite_info = ciphersuite_info;
-    ssl_optimize_checksum( ssl, ssl->transform_negotiate->ciphersuite_info );
+    if( ( ret = ssl_optimize_checksum( ssl,
+                    ssl->transform_negotiate->ciphersuite_info ) ) != 0 )
+        return( ret );
 
     /*
      * SSLv2 Client Hello relevant renegotiation security checks
@@ -600,6 +1061,10 @@ static int ssl_parse_client_hello( ssl_context *ssl )
     int handshake_failure = 0;
     const int *ciphersuites;
     const ssl_ciphersuite_t *ciphersuite_info;
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    uint8_t *ticket = NULL;
+    size_t ticket_len = 0;
+#endif
 
     if( ssl->renegotiation == SSL_INITIAL_HANDSHAKE &&
         ( ret = ssl_fetch_input( ssl, 5 ) ) != 0 )
@@ -858,6 +1323,22 @@ static int ssl_parse_client_hello( ssl_context *ssl )
             break;
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+        case TLS_EXT_ENCRYPT_THEN_MAC:
+            ret = ssl_parse_encrypt_then_mac_ext( ssl, ext + 4, ext_size );
+            if( ret != 0 )
+                return( ret );
+            break;
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+        case TLS_EXT_SESSION_TICKET:
+            /* Opened once the ciphersuite is known, see below */
+            ticket = ext + 4;
+            ticket_len = ext_size;
+            break;
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 #if defined(POLARSSL_SSL_ALPN)
         case TLS_EXT_ALPN:
             ret = ssl_parse_alpn_ext( ssl, ext + 4, ext_size );
@@ -943,7 +1424,16 @@ static int ssl_parse_client_hello( ssl_context *ssl )
 have_ciphersuite:
     ssl->session_negotiate->ciphersuite = ciphersuites[i];
     ssl->transform_negotiate->ciphersuite_info = ciphersuite_info;
-    ssl_optimize_checksum( ssl, ssl->transform_negotiate->ciphersuite_info );
+    if( ( ret = ssl_optimize_checksum( ssl,
+                    ssl->transform_negotiate->ciphersuite_info ) ) != 0 )
+        return( ret );
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    if( ticket != NULL &&
+        ( ret = ssl_parse_session_ticket_ext( ssl, ticket,
+                                              ticket_len ) ) != 0 )
+        return( ret );
+#endif
 
     ssl->in_left = 0;
     ssl->state++;
@@ -974,6 +1464,52 @@ static void ssl_write_truncated_hmac_ext( ssl_context *ssl,
 }
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+static void ssl_write_encrypt_then_mac_ext( ssl_context *ssl,
+                                            uint8_t *buf,
+                                            size_t *olen )
+{
+    uint8_t *p = buf;
+
+    if( ssl->session_negotiate->encrypt_then_mac == SSL_ETM_DISABLED )
+    {
+        *olen = 0;
+        return;
+    }
+
+    *p++ = (uint8_t)( ( TLS_EXT_ENCRYPT_THEN_MAC >> 8 ) & 0xFF );
+    *p++ = (uint8_t)( ( TLS_EXT_ENCRYPT_THEN_MAC      ) & 0xFF );
+
+    *p++ = 0x00;
+    *p++ = 0x00;
+
+    *olen = 4;
+}
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+static void ssl_write_session_ticket_ext( ssl_context *ssl,
+                                          uint8_t *buf,
+                                          size_t *olen )
+{
+    uint8_t *p = buf;
+
+    if( ssl->handshake->new_session_ticket == 0 )
+    {
+        *olen = 0;
+        return;
+    }
+
+    *p++ = (uint8_t)( ( TLS_EXT_SESSION_TICKET >> 8 ) & 0xFF );
+    *p++ = (uint8_t)( ( TLS_EXT_SESSION_TICKET      ) & 0xFF );
+
+    *p++ = 0x00;
+    *p++ = 0x00;
+
+    *olen = 4;
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 void ssl_write_renegotiation_ext( ssl_context *ssl,
                                          uint8_t *buf,
                                          size_t *olen )
@@ -1131,6 +1667,11 @@ static int ssl_write_server_hello( ssl_context *ssl )
         ssl->f_get_cache( ssl->p_get_cache, ssl->session_negotiate ) == 0 )
     {
         ssl->handshake->resume = 1;
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+        /* The cached session keeps being resumed by its id */
+        ssl->handshake->new_session_ticket = 0;
+#endif
     }
 
     if( ssl->handshake->resume == 0 )
@@ -1142,6 +1683,14 @@ static int ssl_write_server_hello( ssl_context *ssl )
         ssl->state++;
         ssl->session_negotiate->start = time( NULL );
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+        if( ssl->handshake->new_session_ticket != 0 )
+        {
+            ssl->session_negotiate->length = n = 0;
+            __stosb( ssl->session_negotiate->id, 0, 32 );
+        }
+        else
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
         {
             ssl->session_negotiate->length = n = 32;
             if( ( ret = ssl->f_rng( ssl->p_rng, ssl->session_negotiate->id,
@@ -1195,6 +1744,16 @@ static int ssl_write_server_hello( ssl_context *ssl )
     ext_len += olen;
 #endif
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    ssl_write_encrypt_then_mac_ext( ssl, p + 2 + ext_len, &olen );
+    ext_len += olen;
+#endif
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    ssl_write_session_ticket_ext( ssl, p + 2 + ext_len, &olen );
+    ext_len += olen;
+#endif
+
     ssl_write_supported_point_formats_ext( ssl, p + 2 + ext_len, &olen );
     ext_len += olen;
 
@@ -1259,6 +1818,7 @@ int ssl_write_certificate_request( ssl_context *ssl )
     ct_len = 0;
 
     p[1 + ct_len++] = SSL_CERT_TYPE_RSA_SIGN;
+    p[1 + ct_len++] = SSL_CERT_TYPE_ECDSA_SIGN;
     p[0] = (uint8_t) ct_len++;
     p += ct_len;
 
@@ -1295,6 +1855,8 @@ int ssl_write_certificate_request( ssl_context *ssl )
          */
         p[2 + sa_len++] = ssl->handshake->verify_sig_alg;
         p[2 + sa_len++] = SSL_SIG_RSA;
+        p[2 + sa_len++] = ssl->handshake->verify_sig_alg;
+        p[2 + sa_len++] = SSL_SIG_ECDSA;
         p[0] = (uint8_t)( sa_len >> 8 );
         p[1] = (uint8_t)( sa_len      );
         sa_len += 2;
@@ -1346,7 +1908,8 @@ static int ssl_write_server_key_exchange( ssl_context *ssl )
     ((void) dig_signed);
     ((void) dig_signed_len);
 
-    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA)
+    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA ||
+        ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA )
     {
         /*
          * Ephemeral ECDH parameters:
@@ -1391,7 +1954,8 @@ curve_matching_done:
         n += len;
     }
 
-    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA)
+    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA ||
+        ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA )
     {
         size_t signature_len = 0;
         uint32_t hashlen = 0;
@@ -1534,7 +2098,9 @@ static int ssl_parse_client_key_exchange( ssl_context *ssl )
         return( POLARSSL_ERR_SSL_BAD_HS_CLIENT_KEY_EXCHANGE );
     }
 
-    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA || ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDH_RSA)
+    if( ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_RSA ||
+        ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA ||
+        ciphersuite_info->key_exchange == POLARSSL_KEY_EXCHANGE_ECDH_RSA )
     {
         if( ( ret = ecdh_read_public( &ssl->handshake->ecdh_ctx,
                         ssl->in_msg + 4, ssl->in_hslen - 4 ) ) != 0 )
@@ -1664,6 +2230,49 @@ int ssl_parse_certificate_verify( ssl_context *ssl )
     return( ret );
 }
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+static int ssl_write_new_session_ticket( ssl_context *ssl )
+{
+    size_t tlen;
+    uint32_t lifetime = (uint32_t) ssl->ticket_lifetime;
+
+    ssl->out_msgtype = SSL_MSG_HANDSHAKE;
+    ssl->out_msg[0]  = SSL_HS_NEW_SESSION_TICKET;
+
+    /*
+     * struct {
+     *     uint32 ticket_lifetime_hint;
+     *     opaque ticket<0..2^16-1>;
+     * } NewSessionTicket;
+     *
+     * 4  .  7   ticket_lifetime_hint (0 = unspecified)
+     * 8  .  9   ticket_len (n)
+     * 10 .  9+n ticket content
+     */
+    ssl->out_msg[4] = (uint8_t)( lifetime >> 24 );
+    ssl->out_msg[5] = (uint8_t)( lifetime >> 16 );
+    ssl->out_msg[6] = (uint8_t)( lifetime >>  8 );
+    ssl->out_msg[7] = (uint8_t)( lifetime       );
+
+    /* On failure send an empty ticket, the client just won't get one */
+    if( ssl_write_ticket( ssl, &tlen ) != 0 )
+        tlen = 0;
+
+    ssl->out_msg[8] = (uint8_t)( tlen >> 8 );
+    ssl->out_msg[9] = (uint8_t)( tlen      );
+
+    ssl->out_msglen = 10 + tlen;
+
+    /*
+     * NewSessionTicket and ChangeCipherSpec share the same state,
+     * see ssl_handshake_server_step()
+     */
+    ssl->handshake->new_session_ticket = 0;
+
+    return( ssl_write_record( ssl ) );
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 /*
  * SSL handshake -- server side -- single step
  */
@@ -1750,7 +2359,12 @@ int ssl_handshake_server_step( ssl_context *ssl )
          *        Finished
          */
         case SSL_SERVER_CHANGE_CIPHER_SPEC:
-            ret = ssl_write_change_cipher_spec( ssl );
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+            if( ssl->handshake->new_session_ticket != 0 )
+                ret = ssl_write_new_session_ticket( ssl );
+            else
+#endif
+                ret = ssl_write_change_cipher_spec( ssl );
             break;
 
         case SSL_SERVER_FINISHED:
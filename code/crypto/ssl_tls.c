@@ -36,11 +36,21 @@ static uint32_t mfl_code_to_length[SSL_MAX_FRAG_LEN_INVALID] =
 };
 #endif /* POLARSSL_SSL_MAX_FRAGMENT_LENGTH */
 
+/*
+ * Initial size of the buffer that holds ClientHello and ServerHello
+ * until the transcript hash is known
+ */
+#define SSL_FIN_BUF_LEN     512
+
 static int ssl_session_copy( ssl_session *dst, const ssl_session *src )
 {
     ssl_session_free( dst );
     __movsb( dst, src, sizeof( ssl_session ) );
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    dst->ticket = NULL;
+#endif
+
 #if defined(POLARSSL_X509_CRT_PARSE_C)
     if( src->peer_cert != NULL )
     {
@@ -62,6 +72,17 @@ static int ssl_session_copy( ssl_session *dst, const ssl_session *src )
     }
 #endif /* POLARSSL_X509_CRT_PARSE_C */
 
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    if( src->ticket != NULL )
+    {
+        dst->ticket = (uint8_t *) memory_alloc( src->ticket_len );
+        if( dst->ticket == NULL )
+            return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+
+        __movsb( dst->ticket, src->ticket, src->ticket_len );
+    }
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
     return( 0 );
 }
 
@@ -150,6 +171,7 @@ int tls_prf_sha384( const uint8_t *secret, size_t slen,
 }
 
 static void ssl_update_checksum_start(ssl_context *, const uint8_t *, size_t);
+static void ssl_update_checksum_lost(ssl_context *, const uint8_t *, size_t);
 
 
 static void ssl_update_checksum_sha256(ssl_context *, const uint8_t *, size_t);
@@ -268,6 +290,16 @@ int ssl_derive_keys( ssl_context *ssl )
     * + IV except for SSL3 and TLS 1.0
     */
     transform->minlen = transform->maclen + cipher_info->block_size - transform->maclen % cipher_info->block_size;
+
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    /*
+     * Encrypt-then-MAC: at least one block of ciphertext, then the MAC
+     * (rfc 7366 section 3), + IV below
+     */
+    transform->encrypt_then_mac = session->encrypt_then_mac;
+    if( session->encrypt_then_mac == SSL_ETM_ENABLED )
+        transform->minlen = transform->maclen + cipher_info->block_size;
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
     if (ssl->minor_ver == SSL_MINOR_VERSION_2 || ssl->minor_ver == SSL_MINOR_VERSION_3) {
         transform->minlen += transform->ivlen;
     }
@@ -370,7 +402,7 @@ void ssl_calc_verify_tls_sha256( ssl_context *ssl, uint8_t hash[32] )
 {
     sha256_context sha256;
 
-    __movsb( &sha256, &ssl->handshake->fin_sha256, sizeof(sha256_context) );
+    __movsb( &sha256, &ssl->handshake->fin.sha256, sizeof(sha256_context) );
     sha256_finish( &sha256, hash );
 
     return;
@@ -380,7 +412,7 @@ void ssl_calc_verify_tls_sha384( ssl_context *ssl, uint8_t hash[48] )
 {
     sha512_context sha512;
 
-    __movsb( &sha512, &ssl->handshake->fin_sha512, sizeof(sha512_context) );
+    __movsb( &sha512, &ssl->handshake->fin.sha512, sizeof(sha512_context) );
     sha512_finish( &sha512, hash );
 
     return;
@@ -388,349 +420,851 @@ void ssl_calc_verify_tls_sha384( ssl_context *ssl, uint8_t hash[48] )
 
 /*
  * Encryption/decryption functions
+ *
+ * A record is protected where it lies: rec points to its 5-byte header,
+ * followed by the explicit IV and the content. This serves ssl->out_hdr
+ * and ssl->in_hdr as well as buffers supplied by the application.
  */
-static int ssl_encrypt_buf( ssl_context *ssl )
+#define POLARSSL_SSL_MAX_MAC_SIZE   48
+
+/*
+ * Position in the application data of ssl_writev() / ssl_write_records()
+ */
+typedef struct
+{
+    const ssl_iovec *iov;
+    size_t off;
+}
+ssl_iov_cursor;
+
+/*
+ * Extra compression blocks for the Lucky 13 countermeasure, so that
+ * it never reads past the record
+ */
+static const uint8_t ssl_dummy_block[128] = { 0 };
+
+static int ssl_next_ctr( uint8_t ctr[8] )
 {
     size_t i;
 
-    /*
-     * Add MAC before encrypt, except for GCM
-     */
-    if (ssl->minor_ver >= SSL_MINOR_VERSION_1) {
-        md_hmac_update( &ssl->transform_out->md_ctx_enc, ssl->out_ctr, 13 );
-        md_hmac_update( &ssl->transform_out->md_ctx_enc, ssl->out_msg, ssl->out_msglen );
-        md_hmac_finish( &ssl->transform_out->md_ctx_enc, ssl->out_msg + ssl->out_msglen );
-        md_hmac_reset( &ssl->transform_out->md_ctx_enc );
-    }
-    else {
-        return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
+    for( i = 8; i > 0; i-- )
+        if( ++ctr[i - 1] != 0 )
+            break;
+
+    /* The loops goes to its end iff the counter is wrapping */
+    if( i == 0 )
+    {
+        return( POLARSSL_ERR_SSL_COUNTER_WRAPPING );
     }
 
-    ssl->out_msglen += ssl->transform_out->maclen;
+    return( 0 );
+}
+
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+/*
+ * Encrypt-then-MAC record (rfc 7366): IV || ENC( content || padding ),
+ * followed by MAC( seq_num || type || version || length || IV ||
+ * ciphertext ), length being that of the IV and the ciphertext.
+ *
+ * With AES-CBC and HMAC-SHA-384 the ciphertext is hashed as it comes
+ * out of the cipher, while it is still in the cache, and the SHA-512
+ * rounds run in the shadow of the CBC chain (sha512_update_aes_cbc()).
+ */
+static int ssl_encrypt_rec_etm( ssl_context *ssl, uint8_t *rec,
+                                ssl_iov_cursor *src, size_t len,
+                                size_t *rec_len )
+{
+    int ret;
+    ssl_transform *transform = ssl->transform_out;
+    size_t i, n, padlen, enc_len, olen;
+    uint8_t add[13];
+    uint8_t mac[POLARSSL_SSL_MAX_MAC_SIZE];
+    uint8_t *msg;
+
+    msg = rec + 5 + transform->ivlen;
 
     /*
-     * Encrypt
+     * The content is encrypted in place: gather it there first
      */
-    if( ssl->transform_out->cipher_ctx_enc.cipher_info->mode == POLARSSL_MODE_CBC ) {
-        int ret;
-        uint8_t *enc_msg;
-        size_t enc_msglen, padlen, olen = 0;
+    if( src != NULL )
+    {
+        for( i = 0; i < len; i += n )
+        {
+            while( src->off == src->iov->len )
+            {
+                src->iov++;
+                src->off = 0;
+            }
 
-        padlen = ssl->transform_out->ivlen - ( ssl->out_msglen + 1 ) % ssl->transform_out->ivlen;
-        if (padlen == ssl->transform_out->ivlen) {
-            padlen = 0;
-        }
+            n = src->iov->len - src->off;
+            if( n > len - i )
+                n = len - i;
 
-        for (i = 0; i <= padlen; i++) {
-            ssl->out_msg[ssl->out_msglen + i] = (uint8_t)padlen;
+            __movsb( msg + i, src->iov->buf + src->off, n );
+            src->off += n;
         }
+    }
 
-        ssl->out_msglen += padlen + 1;
+    padlen = transform->ivlen - ( len + 1 ) % transform->ivlen;
+    if( padlen == transform->ivlen )
+        padlen = 0;
 
-        enc_msglen = ssl->out_msglen;
-        enc_msg = ssl->out_msg;
+    for( i = 0; i <= padlen; i++ )
+        msg[len + i] = (uint8_t) padlen;
 
-        /*
-         * Prepend per-record IV for block cipher in TLS v1.1 and up as per
-         * Method 1 (6.2.3.2. in RFC4346 and RFC5246)
-         */
-        if( ssl->minor_ver >= SSL_MINOR_VERSION_2 ) {
-            /*
-             * Generate IV
-             */
-            int ret = ssl->f_rng( ssl->p_rng, ssl->transform_out->iv_enc, ssl->transform_out->ivlen );
-            if( ret != 0 )
-                return( ret );
+    enc_len = len + padlen + 1;
 
-            __movsb( ssl->out_iv, ssl->transform_out->iv_enc, ssl->transform_out->ivlen );
+    if( ( ret = ssl->f_rng( ssl->p_rng, transform->iv_enc,
+                            transform->ivlen ) ) != 0 )
+        return( ret );
 
-            /*
-             * Fix pointer positions and message length with added IV
-             */
-            enc_msg = ssl->out_msg;
-            enc_msglen = ssl->out_msglen;
-            ssl->out_msglen += ssl->transform_out->ivlen;
-        }
+    __movsb( rec + 5, transform->iv_enc, transform->ivlen );
 
-        if( ( ret = cipher_reset( &ssl->transform_out->cipher_ctx_enc ) ) != 0 )
-        {
-            return( ret );
-        }
+    n = transform->ivlen + enc_len;
+    rec[1] = (uint8_t) ssl->major_ver;
+    rec[2] = (uint8_t) ssl->minor_ver;
+    rec[3] = (uint8_t)( n >> 8 );
+    rec[4] = (uint8_t)( n      );
+
+    __movsb( add, ssl->out_ctr, 8 );
+    __movsb( add + 8, rec, 5 );
+    md_hmac_update( &transform->md_ctx_enc, add, 13 );
+    md_hmac_update( &transform->md_ctx_enc, rec + 5, transform->ivlen );
 
-        if( ( ret = cipher_set_iv( &ssl->transform_out->cipher_ctx_enc,
-                                   ssl->transform_out->iv_enc,
-                                   ssl->transform_out->ivlen ) ) != 0 )
+    if( transform->cipher_ctx_enc.cipher_info->type ==
+            POLARSSL_CIPHER_AES_256_CBC &&
+        md_get_type( transform->md_ctx_enc.md_info ) == POLARSSL_MD_SHA384 )
+    {
+        ret = sha512_update_aes_cbc(
+                    (sha512_context *) transform->md_ctx_enc.md_ctx,
+                    (aes_context_t *) transform->cipher_ctx_enc.cipher_ctx,
+                    transform->iv_enc, enc_len, msg, msg );
+        if( ret != 0 )
+            return( ret );
+    }
+    else
+    {
+        if( ( ret = cipher_reset( &transform->cipher_ctx_enc ) ) != 0 ||
+            ( ret = cipher_set_iv( &transform->cipher_ctx_enc,
+                                   transform->iv_enc,
+                                   transform->ivlen ) ) != 0 ||
+            ( ret = cipher_update( &transform->cipher_ctx_enc, msg, enc_len,
+                                   msg, &olen ) ) != 0 )
         {
             return( ret );
         }
 
-        if( ( ret = cipher_update( &ssl->transform_out->cipher_ctx_enc,
-                                   enc_msg, enc_msglen, enc_msg,
+        n = olen;
+        if( ( ret = cipher_finish( &transform->cipher_ctx_enc, msg + n,
                                    &olen ) ) != 0 )
-        {
             return( ret );
-        }
 
-        enc_msglen -= olen;
+        if( n + olen != enc_len )
+            return( POLARSSL_ERR_SSL_INTERNAL_ERROR );
+
+        md_hmac_update( &transform->md_ctx_enc, msg, enc_len );
+    }
+
+    md_hmac_finish( &transform->md_ctx_enc, mac );
+    md_hmac_reset( &transform->md_ctx_enc );
+
+    __movsb( msg + enc_len, mac, transform->maclen );
+
+    n = transform->ivlen + enc_len + transform->maclen;
+    rec[3] = (uint8_t)( n >> 8 );
+    rec[4] = (uint8_t)( n      );
+    *rec_len = 5 + n;
+
+    return( ssl_next_ctr( ssl->out_ctr ) );
+}
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+/*
+ * Protect len bytes of content into the record at rec, whose type is
+ * already in rec[0]. The content is either in place after the IV
+ * (src == NULL) or gathered from src, in which case it is MACed and
+ * encrypted straight out of the application buffers.
+ */
+static int ssl_encrypt_rec( ssl_context *ssl, uint8_t *rec,
+                            ssl_iov_cursor *src, size_t len,
+                            size_t *rec_len )
+{
+    int ret;
+    ssl_transform *transform = ssl->transform_out;
+    size_t i, n, padlen, olen;
+    uint8_t add[13];
+    uint8_t tail[POLARSSL_SSL_MAX_MAC_SIZE + 16];
+    uint8_t *msg, *out;
+
+    /*
+     * TLS 1.1+ CBC with an explicit IV only, ssl_derive_keys() sees to it
+     */
+    if( transform->cipher_ctx_enc.cipher_info->mode != POLARSSL_MODE_CBC )
+        return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
+
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    if( transform->encrypt_then_mac == SSL_ETM_ENABLED )
+        return( ssl_encrypt_rec_etm( ssl, rec, src, len, rec_len ) );
+#endif
+
+    rec[1] = (uint8_t) ssl->major_ver;
+    rec[2] = (uint8_t) ssl->minor_ver;
+    rec[3] = (uint8_t)( len >> 8 );
+    rec[4] = (uint8_t)( len      );
 
-        if( ( ret = cipher_finish( &ssl->transform_out->cipher_ctx_enc,
-                                   enc_msg + olen, &olen ) ) != 0 )
+    msg = rec + 5 + transform->ivlen;
+
+    /*
+     * Prepend per-record IV for block cipher in TLS v1.1 and up as per
+     * Method 1 (6.2.3.2. in RFC4346 and RFC5246)
+     */
+    if( ( ret = ssl->f_rng( ssl->p_rng, transform->iv_enc,
+                            transform->ivlen ) ) != 0 )
+        return( ret );
+
+    __movsb( rec + 5, transform->iv_enc, transform->ivlen );
+
+    if( ( ret = cipher_reset( &transform->cipher_ctx_enc ) ) != 0 ||
+        ( ret = cipher_set_iv( &transform->cipher_ctx_enc, transform->iv_enc,
+                               transform->ivlen ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    padlen = transform->ivlen -
+             ( len + transform->maclen + 1 ) % transform->ivlen;
+    if( padlen == transform->ivlen )
+        padlen = 0;
+
+    /*
+     * MAC( seq_num || type || version || length || content ), then encrypt
+     * content || MAC || padding. The cipher layer carries partial blocks
+     * over from one piece to the next.
+     */
+    __movsb( add, ssl->out_ctr, 8 );
+    __movsb( add + 8, rec, 5 );
+    md_hmac_update( &transform->md_ctx_enc, add, 13 );
+
+    out = msg;
+
+    if( src == NULL )
+    {
+        md_hmac_update( &transform->md_ctx_enc, msg, len );
+    }
+    else
+    {
+        for( i = len; i > 0; i -= n )
         {
-            return( ret );
+            while( src->off == src->iov->len )
+            {
+                src->iov++;
+                src->off = 0;
+            }
+
+            n = src->iov->len - src->off;
+            if( n > i )
+                n = i;
+
+            md_hmac_update( &transform->md_ctx_enc,
+                            src->iov->buf + src->off, n );
+
+            if( ( ret = cipher_update( &transform->cipher_ctx_enc,
+                                       src->iov->buf + src->off, n,
+                                       out, &olen ) ) != 0 )
+            {
+                return( ret );
+            }
+
+            out += olen;
+            src->off += n;
         }
+    }
+
+    md_hmac_finish( &transform->md_ctx_enc, tail );
+    md_hmac_reset( &transform->md_ctx_enc );
+
+    n = transform->maclen;
+    for( i = 0; i <= padlen; i++ )
+        tail[n + i] = (uint8_t) padlen;
+    n += padlen + 1;
 
-        if( enc_msglen != olen )
+    if( src == NULL )
+    {
+        /* Whole blocks, encrypted in place */
+        __movsb( msg + len, tail, n );
+
+        if( ( ret = cipher_update( &transform->cipher_ctx_enc, msg, len + n,
+                                   msg, &olen ) ) != 0 )
         {
-            return( POLARSSL_ERR_SSL_INTERNAL_ERROR );
+            return( ret );
         }
     }
-    else
+    else if( ( ret = cipher_update( &transform->cipher_ctx_enc, tail, n,
+                                    out, &olen ) ) != 0 )
     {
-        return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
+        return( ret );
     }
 
-    for( i = 8; i > 0; i-- )
-        if( ++ssl->out_ctr[i - 1] != 0 )
-            break;
+    out += olen;
 
-    /* The loops goes to its end iff the counter is wrapping */
-    if( i == 0 )
+    if( ( ret = cipher_finish( &transform->cipher_ctx_enc, out, &olen ) ) != 0 )
+        return( ret );
+
+    out += olen;
+
+    if( (size_t)( out - msg ) != len + n )
+        return( POLARSSL_ERR_SSL_INTERNAL_ERROR );
+
+    n = out - ( rec + 5 );
+    rec[3] = (uint8_t)( n >> 8 );
+    rec[4] = (uint8_t)( n      );
+    *rec_len = 5 + n;
+
+    return( ssl_next_ctr( ssl->out_ctr ) );
+}
+
+static int ssl_encrypt_buf( ssl_context *ssl )
+{
+    int ret;
+    size_t rec_len;
+
+    if( ( ret = ssl_encrypt_rec( ssl, ssl->out_hdr, NULL, ssl->out_msglen,
+                                 &rec_len ) ) != 0 )
     {
-        return( POLARSSL_ERR_SSL_COUNTER_WRAPPING );
+        return( ret );
     }
 
+    ssl->out_msglen = rec_len - 5;
+
     return( 0 );
 }
 
-#define POLARSSL_SSL_MAX_MAC_SIZE   48
+/*
+ * Count empty records: three or more in a row may be a DoS attack
+ * (excessive CPU consumption)
+ */
+static int ssl_check_empty_rec( ssl_context *ssl, size_t len )
+{
+    if( len == 0 )
+    {
+        ssl->nb_zero++;
 
-static int ssl_decrypt_buf( ssl_context *ssl )
+        if( ssl->nb_zero > 3 )
+        {
+            return( POLARSSL_ERR_SSL_INVALID_MAC );
+        }
+    }
+    else
+        ssl->nb_zero = 0;
+
+    return( 0 );
+}
+
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+/*
+ * Open an encrypt-then-MAC record (see ssl_encrypt_rec_etm()). The MAC is
+ * checked first, so the padding of an authentic record needs no
+ * constant-time care.
+ */
+static int ssl_decrypt_rec_etm( ssl_context *ssl, uint8_t *rec,
+                                size_t *msglen )
 {
-    size_t i;
-    size_t padlen = 0, correct = 1;
+    int ret;
+    ssl_transform *transform = ssl->transform_in;
+    size_t i, len, padlen, enc_len, olen;
+    uint8_t add[13];
+    uint8_t mac[POLARSSL_SSL_MAX_MAC_SIZE];
+    uint8_t *msg;
 
-    if( ssl->in_msglen < ssl->transform_in->minlen )
+    len = ( rec[3] << 8 ) | rec[4];
+
+    if( len < transform->minlen ||
+        ( len - transform->ivlen - transform->maclen ) %
+            transform->ivlen != 0 )
     {
         return( POLARSSL_ERR_SSL_INVALID_MAC );
     }
-    if( ssl->transform_in->cipher_ctx_dec.cipher_info->mode ==
-                                                       POLARSSL_MODE_CBC )
+
+    enc_len = len - transform->ivlen - transform->maclen;
+    msg = rec + 5 + transform->ivlen;
+
+    len = transform->ivlen + enc_len;
+    rec[3] = (uint8_t)( len >> 8 );
+    rec[4] = (uint8_t)( len      );
+
+    __movsb( add, ssl->in_ctr, 8 );
+    __movsb( add + 8, rec, 5 );
+
+    md_hmac_update( &transform->md_ctx_dec, add, 13 );
+    md_hmac_update( &transform->md_ctx_dec, rec + 5, len );
+    md_hmac_finish( &transform->md_ctx_dec, mac );
+    md_hmac_reset( &transform->md_ctx_dec );
+
+    if( safer_memcmp( mac, msg + enc_len, transform->maclen ) != 0 )
+        return( POLARSSL_ERR_SSL_INVALID_MAC );
+
+    __movsb( transform->iv_dec, rec + 5, transform->ivlen );
+
+    if( ( ret = cipher_reset( &transform->cipher_ctx_dec ) ) != 0 ||
+        ( ret = cipher_set_iv( &transform->cipher_ctx_dec, transform->iv_dec,
+                               transform->ivlen ) ) != 0 ||
+        ( ret = cipher_update( &transform->cipher_ctx_dec, msg, enc_len,
+                               msg, &olen ) ) != 0 )
     {
-        /*
-         * Decrypt and check the padding
-         */
-        int ret;
-        uint8_t *dec_msg;
-        uint8_t *dec_msg_result;
-        size_t dec_msglen;
-        size_t minlen = 0;
-        size_t olen = 0;
+        return( ret );
+    }
 
-        /*
-         * Check immediate ciphertext sanity
-         */
-        if( ssl->in_msglen % ssl->transform_in->ivlen != 0 )
-        {
-            return( POLARSSL_ERR_SSL_INVALID_MAC );
-        }
+    len = olen;
+    if( ( ret = cipher_finish( &transform->cipher_ctx_dec, msg + len,
+                               &olen ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    if( len + olen != enc_len )
+    {
+        return( POLARSSL_ERR_SSL_INTERNAL_ERROR );
+    }
 
-        if( ssl->minor_ver >= SSL_MINOR_VERSION_2 )
-            minlen += ssl->transform_in->ivlen;
+    padlen = msg[enc_len - 1];
+    if( padlen >= enc_len )
+        return( POLARSSL_ERR_SSL_INVALID_MAC );
 
-        if( ssl->in_msglen < minlen + ssl->transform_in->ivlen ||
-            ssl->in_msglen < minlen + ssl->transform_in->maclen + 1 )
-        {
+    len = enc_len - padlen - 1;
+    for( i = len; i < enc_len; i++ )
+        if( msg[i] != padlen )
             return( POLARSSL_ERR_SSL_INVALID_MAC );
-        }
 
-        dec_msglen = ssl->in_msglen;
-        dec_msg = ssl->in_msg;
-        dec_msg_result = ssl->in_msg;
+    rec[3] = (uint8_t)( len >> 8 );
+    rec[4] = (uint8_t)( len      );
 
-        /*
-         * Initialize for prepended IV for block cipher in TLS v1.1 and up
-         */
-        if( ssl->minor_ver >= SSL_MINOR_VERSION_2 )
-        {
-            dec_msglen -= ssl->transform_in->ivlen;
-            ssl->in_msglen -= ssl->transform_in->ivlen;
+    if( ( ret = ssl_check_empty_rec( ssl, len ) ) != 0 )
+        return( ret );
 
-            for( i = 0; i < ssl->transform_in->ivlen; i++ )
-                ssl->transform_in->iv_dec[i] = ssl->in_iv[i];
-        }
+    *msglen = len;
 
-        if( ( ret = cipher_reset( &ssl->transform_in->cipher_ctx_dec ) ) != 0 )
-        {
-            return( ret );
-        }
+    return( ssl_next_ctr( ssl->in_ctr ) );
+}
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
 
-        if( ( ret = cipher_set_iv( &ssl->transform_in->cipher_ctx_dec,
-                                   ssl->transform_in->iv_dec,
-                                   ssl->transform_in->ivlen ) ) != 0 )
-        {
-            return( ret );
-        }
+/*
+ * Open the record at rec in place. The content starts after the IV,
+ * *msglen gets its length. Only the record itself is ever read.
+ */
+static int ssl_decrypt_rec( ssl_context *ssl, uint8_t *rec, size_t *msglen )
+{
+    int ret;
+    ssl_transform *transform = ssl->transform_in;
+    size_t i, len, padlen, dec_len, olen = 0, correct = 1;
+    uint8_t add[13];
+    uint8_t mac[POLARSSL_SSL_MAX_MAC_SIZE];
+    uint8_t *msg;
 
-        if( ( ret = cipher_update( &ssl->transform_in->cipher_ctx_dec,
-                                   dec_msg, dec_msglen, dec_msg_result,
-                                   &olen ) ) != 0 )
-        {
-            return( ret );
-        }
+    len = ( rec[3] << 8 ) | rec[4];
 
-        dec_msglen -= olen;
-        if( ( ret = cipher_finish( &ssl->transform_in->cipher_ctx_dec,
-                                   dec_msg_result + olen, &olen ) ) != 0 )
-        {
-            return( ret );
-        }
+    if( len < transform->minlen )
+    {
+        return( POLARSSL_ERR_SSL_INVALID_MAC );
+    }
 
-        if( dec_msglen != olen )
-        {
-            return( POLARSSL_ERR_SSL_INTERNAL_ERROR );
-        }
+    if( transform->cipher_ctx_dec.cipher_info->mode != POLARSSL_MODE_CBC )
+        return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
 
-        padlen = 1 + ssl->in_msg[ssl->in_msglen - 1];
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    if( transform->encrypt_then_mac == SSL_ETM_ENABLED )
+        return( ssl_decrypt_rec_etm( ssl, rec, msglen ) );
+#endif
 
-        if( ssl->in_msglen < ssl->transform_in->maclen + padlen )
-        {
-            padlen = 0;
-            correct = 0;
-        }
-        if( ssl->minor_ver > SSL_MINOR_VERSION_0 )
-        {
-            /*
-             * TLSv1+: always check the padding up to the first failure
-             * and fake check up to 256 bytes of padding
-             */
-            size_t pad_count = 0, real_count = 1;
-            size_t padding_idx = ssl->in_msglen - padlen - 1;
+    /*
+     * Check immediate ciphertext sanity
+     */
+    if( len % transform->ivlen != 0 ||
+        len < transform->ivlen + transform->ivlen ||
+        len < transform->ivlen + transform->maclen + 1 )
+    {
+        return( POLARSSL_ERR_SSL_INVALID_MAC );
+    }
 
-            /*
-             * Padding is guaranteed to be incorrect if:
-             *   1. padlen >= ssl->in_msglen
-             *
-             *   2. padding_idx >= SSL_MAX_CONTENT_LEN +
-             *                     ssl->transform_in->maclen
-             *
-             * In both cases we reset padding_idx to a safe value (0) to
-             * prevent out-of-buffer reads.
-             */
-            correct &= ( ssl->in_msglen >= padlen + 1 );
-            correct &= ( padding_idx < SSL_MAX_CONTENT_LEN +
-                                       ssl->transform_in->maclen );
+    /*
+     * Decrypt and check the padding
+     */
+    len -= transform->ivlen;
+    msg = rec + 5 + transform->ivlen;
 
-            padding_idx *= correct;
+    __movsb( transform->iv_dec, rec + 5, transform->ivlen );
 
-            for( i = 1; i <= 256; i++ )
-            {
-                real_count &= ( i <= padlen );
-                pad_count += real_count *
-                             ( ssl->in_msg[padding_idx + i] == padlen - 1 );
-            }
+    if( ( ret = cipher_reset( &transform->cipher_ctx_dec ) ) != 0 ||
+        ( ret = cipher_set_iv( &transform->cipher_ctx_dec, transform->iv_dec,
+                               transform->ivlen ) ) != 0 )
+    {
+        return( ret );
+    }
 
-            correct &= ( pad_count == padlen ); /* Only 1 on correct padding */
+    if( ( ret = cipher_update( &transform->cipher_ctx_dec, msg, len,
+                               msg, &olen ) ) != 0 )
+    {
+        return( ret );
+    }
 
-            padlen &= correct * 0x1FF;
-        }
-        else
-        {
-            return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
-        }
+    dec_len = len - olen;
+    if( ( ret = cipher_finish( &transform->cipher_ctx_dec, msg + olen,
+                               &olen ) ) != 0 )
+    {
+        return( ret );
     }
-    else
+
+    if( dec_len != olen )
     {
-        return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
+        return( POLARSSL_ERR_SSL_INTERNAL_ERROR );
+    }
+
+    padlen = 1 + msg[len - 1];
+
+    if( len < transform->maclen + padlen )
+    {
+        padlen = 0;
+        correct = 0;
+    }
+
+    {
+        /*
+         * TLSv1+: always check the padding up to the first failure
+         * and fake check up to 256 bytes of padding. The fake reads are
+         * folded back into the record, which may sit in an application
+         * buffer with nothing after it.
+         */
+        size_t pad_count = 0, real_count = 1, idx;
+        size_t padding_idx = len - padlen - 1;
+
+        /*
+         * Padding is guaranteed to be incorrect if padlen >= len;
+         * reset padding_idx to a safe value (0) then.
+         */
+        correct &= ( len >= padlen + 1 );
+
+        padding_idx *= correct;
+
+        for( i = 1; i <= 256; i++ )
+        {
+            real_count &= ( i <= padlen );
+            idx = padding_idx + i;
+            idx *= ( idx < len );
+            pad_count += real_count * ( msg[idx] == padlen - 1 );
+        }
+
+        correct &= ( pad_count == padlen ); /* Only 1 on correct padding */
+
+        padlen &= correct * 0x1FF;
     }
 
     /*
-     * Always compute the MAC (RFC4346, CBCTIME), except for GCM of course
+     * Always compute the MAC (RFC4346, CBCTIME)
      */
-    uint8_t tmp[POLARSSL_SSL_MAX_MAC_SIZE];
+    len -= transform->maclen + padlen;
 
-    ssl->in_msglen -= ( ssl->transform_in->maclen + padlen );
+    rec[3] = (uint8_t)( len >> 8 );
+    rec[4] = (uint8_t)( len      );
 
-    ssl->in_hdr[3] = (uint8_t)( ssl->in_msglen >> 8 );
-    ssl->in_hdr[4] = (uint8_t)( ssl->in_msglen      );
+    __movsb( add, ssl->in_ctr, 8 );
+    __movsb( add + 8, rec, 5 );
 
-    __movsb( tmp, ssl->in_msg + ssl->in_msglen, ssl->transform_in->maclen );
-    if( ssl->minor_ver > SSL_MINOR_VERSION_0 )
     {
         /*
-            * Process MAC and always update for padlen afterwards to make
-            * total time independent of padlen
-            *
-            * extra_run compensates MAC check for padlen
-            *
-            * Known timing attacks:
-            *  - Lucky Thirteen (http://www.isg.rhul.ac.uk/tls/TLStiming.pdf)
-            *
-            * We use ( ( Lx + 8 ) / 64 ) to handle 'negative Lx' values
-            * correctly. (We round down instead of up, so -56 is the correct
-            * value for our calculations instead of -55)
-            */
+         * Process MAC and always update for padlen afterwards to make
+         * total time independent of padlen
+         *
+         * extra_run compensates MAC check for padlen
+         *
+         * Known timing attacks:
+         *  - Lucky Thirteen (http://www.isg.rhul.ac.uk/tls/TLStiming.pdf)
+         *
+         * We use ( ( Lx + 8 ) / 64 ) to handle 'negative Lx' values
+         * correctly. (We round down instead of up, so -56 is the correct
+         * value for our calculations instead of -55)
+         */
         size_t j, extra_run = 0;
-        extra_run = ( 13 + ssl->in_msglen + padlen + 8 ) / 64 -
-                    ( 13 + ssl->in_msglen          + 8 ) / 64;
+        extra_run = ( 13 + len + padlen + 8 ) / 64 -
+                    ( 13 + len          + 8 ) / 64;
 
         extra_run &= correct * 0xFF;
 
-        md_hmac_update( &ssl->transform_in->md_ctx_dec, ssl->in_ctr, 13 );
-        md_hmac_update( &ssl->transform_in->md_ctx_dec, ssl->in_msg,
-                            ssl->in_msglen );
-        md_hmac_finish( &ssl->transform_in->md_ctx_dec,
-                            ssl->in_msg + ssl->in_msglen );
+        md_hmac_update( &transform->md_ctx_dec, add, 13 );
+        md_hmac_update( &transform->md_ctx_dec, msg, len );
+        md_hmac_finish( &transform->md_ctx_dec, mac );
         for( j = 0; j < extra_run; j++ )
-            md_process( &ssl->transform_in->md_ctx_dec, ssl->in_msg );
+            md_process( &transform->md_ctx_dec, ssl_dummy_block );
 
-        md_hmac_reset( &ssl->transform_in->md_ctx_dec );
-    }
-    else
-    {
-        return( POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE );
+        md_hmac_reset( &transform->md_ctx_dec );
     }
 
-    if( safer_memcmp( tmp, ssl->in_msg + ssl->in_msglen,
-                        ssl->transform_in->maclen ) != 0 )
+    if( safer_memcmp( mac, msg + len, transform->maclen ) != 0 )
     {
         correct = 0;
     }
 
     /*
-        * Finally check the correct flag
-        */
+     * Finally check the correct flag
+     */
     if( correct == 0 )
         return( POLARSSL_ERR_SSL_INVALID_MAC );
 
-    if( ssl->in_msglen == 0 )
+    if( ( ret = ssl_check_empty_rec( ssl, len ) ) != 0 )
+        return( ret );
+
+    *msglen = len;
+
+    return( ssl_next_ctr( ssl->in_ctr ) );
+}
+
+static int ssl_decrypt_buf( ssl_context *ssl )
+{
+    int ret;
+    size_t msglen;
+
+    if( ( ret = ssl_decrypt_rec( ssl, ssl->in_hdr, &msglen ) ) != 0 )
+        return( ret );
+
+    ssl->in_msglen = msglen;
+
+    return( 0 );
+}
+
+/*
+ * Largest record content allowed on output
+ */
+static size_t ssl_get_max_out_len( const ssl_context *ssl )
+{
+    size_t max_len = SSL_MAX_CONTENT_LEN;
+
+#if defined(POLARSSL_SSL_MAX_FRAGMENT_LENGTH)
+    /*
+     * Assume mfl_code is correct since it was checked when set
+     */
+    max_len = mfl_code_to_length[ssl->mfl_code];
+
+    /*
+     * Check if a smaller max length was negotiated
+     */
+    if( ssl->session_out != NULL &&
+        mfl_code_to_length[ssl->session_out->mfl_code] < max_len )
     {
-        ssl->nb_zero++;
+        max_len = mfl_code_to_length[ssl->session_out->mfl_code];
+    }
+#endif /* POLARSSL_SSL_MAX_FRAGMENT_LENGTH */
 
-        /*
-         * Three or more empty messages may be a DoS attack
-         * (excessive CPU consumption).
-         */
-        if( ssl->nb_zero > 3 )
+    return( max_len );
+}
+
+/*
+ * Largest record content expected on input
+ */
+static size_t ssl_get_max_in_len( const ssl_context *ssl )
+{
+#if defined(POLARSSL_SSL_MAX_FRAGMENT_LENGTH)
+    if( ssl->session_in != NULL )
+        return( mfl_code_to_length[ssl->session_in->mfl_code] );
+#endif
+
+    return( SSL_MAX_CONTENT_LEN );
+}
+
+/*
+ * Record buffers
+ *
+ * The input and output buffers are allocated on first use, at full size
+ * while a handshake is in progress, and resized once it is over: the input
+ * buffer to one record of the negotiated maximum fragment length, the
+ * output buffer to SSL_OUT_RECORDS of them. Data still pending in a buffer
+ * moves along with it.
+ */
+#define SSL_BUFFER_OVERHEAD     ( SSL_BUFFER_LEN - SSL_MAX_CONTENT_LEN )
+
+/*
+ * Room a record takes on output besides its contents: header, explicit IV,
+ * MAC and one block of padding
+ */
+#define SSL_RECORD_OUT_OVERHEAD ( 21 + SSL_MAC_ADD + 16 )
+
+/*
+ * Output buffer size once the handshake is over
+ */
+static size_t ssl_get_out_buf_len( const ssl_context *ssl )
+{
+    size_t len = SSL_OUT_RECORDS *
+                 ( SSL_RECORD_OUT_OVERHEAD + ssl_get_max_out_len( ssl ) );
+
+    return( ( len < SSL_BUFFER_LEN ) ? len : SSL_BUFFER_LEN );
+}
+
+/*
+ * Offset of the message contents in a fresh buffer
+ */
+static size_t ssl_msg_offset( const ssl_transform *transform )
+{
+    if( transform == NULL )
+        return( 5 );
+
+    return( 5 + transform->ivlen - transform->fixed_ivlen );
+}
+
+static int ssl_resize_in_buf( ssl_context *ssl, size_t len )
+{
+    uint8_t *buf = NULL;
+    size_t used = 0, end;
+
+    if( ssl->in_buf != NULL )
+    {
+        /* partial record, and what is left of the last one */
+        used = ssl->in_left;
+        end = ( ( ssl->in_offt != NULL ) ? ssl->in_offt : ssl->in_msg ) -
+              ssl->in_buf + ssl->in_msglen;
+        if( end > used )
+            used = end;
+    }
+
+    /* Shrink only what fits, len 0 drops the buffer regardless */
+    if( len != 0 && used > len )
+        return( 0 );
+
+    if( len != 0 &&
+        ( buf = (uint8_t *) memory_alloc( len ) ) == NULL )
+    {
+        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+    }
+
+    if( ssl->in_buf != NULL )
+    {
+        if( buf != NULL )
         {
-            return( POLARSSL_ERR_SSL_INVALID_MAC );
+            __movsb( buf, ssl->in_buf, used );
+            ssl->in_msg = buf + ( ssl->in_msg - ssl->in_buf );
+            if( ssl->in_offt != NULL )
+                ssl->in_offt = buf + ( ssl->in_offt - ssl->in_buf );
         }
+
+        __stosb( ssl->in_buf, 0, ssl->in_buf_len );
+        memory_free( ssl->in_buf );
     }
-    else
-        ssl->nb_zero = 0;
+    else if( buf != NULL )
+        ssl->in_msg = buf + ssl_msg_offset( ssl->transform_in );
 
-    for( i = 8; i > 0; i-- )
-        if( ++ssl->in_ctr[i - 1] != 0 )
-            break;
+    if( buf == NULL )
+        ssl->in_msg = NULL;
 
-    /* The loops goes to its end iff the counter is wrapping */
-    if( i == 0 )
+    ssl->in_buf = buf;
+    ssl->in_buf_len = len;
+    ssl->in_hdr = buf;
+    ssl->in_iv  = ( buf != NULL ) ? buf + 5 : NULL;
+
+    return( 0 );
+}
+
+static int ssl_resize_out_buf( ssl_context *ssl, size_t len )
+{
+    uint8_t *buf = NULL;
+    size_t used = 0;
+
+    if( ssl->out_buf != NULL && ssl->out_left != 0 )
+        used = 5 + ssl->out_msglen;
+
+    /* Shrink only what fits, len 0 drops the buffer regardless */
+    if( len != 0 && used > len )
+        return( 0 );
+
+    if( len != 0 &&
+        ( buf = (uint8_t *) memory_alloc( len ) ) == NULL )
     {
-        return( POLARSSL_ERR_SSL_COUNTER_WRAPPING );
+        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+    }
+
+    if( ssl->out_buf != NULL )
+    {
+        if( buf != NULL )
+        {
+            __movsb( buf, ssl->out_buf, used );
+            ssl->out_msg = buf + ( ssl->out_msg - ssl->out_buf );
+        }
+
+        __stosb( ssl->out_buf, 0, ssl->out_buf_len );
+        memory_free( ssl->out_buf );
+    }
+    else if( buf != NULL )
+        ssl->out_msg = buf + ssl_msg_offset( ssl->transform_out );
+
+    if( buf == NULL )
+        ssl->out_msg = NULL;
+
+    ssl->out_buf = buf;
+    ssl->out_buf_len = len;
+    ssl->out_hdr = buf;
+    ssl->out_iv  = ( buf != NULL ) ? buf + 5 : NULL;
+
+    return( 0 );
+}
+
+/*
+ * Make sure both buffers exist and are large enough for the current
+ * state of the connection
+ */
+static int ssl_setup_buffers( ssl_context *ssl )
+{
+    int ret;
+    size_t in_len = SSL_BUFFER_LEN, out_len = SSL_BUFFER_LEN;
+
+    if( ssl->state == SSL_HANDSHAKE_OVER )
+    {
+        in_len  = SSL_BUFFER_OVERHEAD + ssl_get_max_in_len( ssl );
+        out_len = ssl_get_out_buf_len( ssl );
+    }
+
+    if( ssl->in_buf_len < in_len &&
+        ( ret = ssl_resize_in_buf( ssl, in_len ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    if( ssl->out_buf_len < out_len &&
+        ( ret = ssl_resize_out_buf( ssl, out_len ) ) != 0 )
+    {
+        return( ret );
     }
 
     return( 0 );
 }
 
+/*
+ * Give back what the handshake needed beyond the negotiated maximum
+ * fragment length. The larger buffers are kept if this fails.
+ */
+static void ssl_shrink_buffers( ssl_context *ssl )
+{
+    size_t in_len  = SSL_BUFFER_OVERHEAD + ssl_get_max_in_len( ssl );
+    size_t out_len = ssl_get_out_buf_len( ssl );
+
+    if( ssl->in_buf != NULL && ssl->in_buf_len > in_len )
+        ssl_resize_in_buf( ssl, in_len );
+
+    if( ssl->out_buf != NULL && ssl->out_buf_len > out_len )
+        ssl_resize_out_buf( ssl, out_len );
+}
+
+void ssl_free_buffers( ssl_context *ssl )
+{
+    /* Handshake messages may wait in the input buffer between records */
+    if( ssl->state != SSL_HANDSHAKE_OVER )
+        return;
+
+    if( ssl->in_left == 0 && ssl->in_offt == NULL &&
+        ( ssl->in_hslen == 0 || ssl->in_hslen >= ssl->in_msglen ) )
+    {
+        ssl->in_msglen = 0;
+        ssl_resize_in_buf( ssl, 0 );
+    }
+
+    if( ssl->out_left == 0 )
+        ssl_resize_out_buf( ssl, 0 );
+}
+
 /*
  * Fill the input message buffer
  */
@@ -739,7 +1273,7 @@ int ssl_fetch_input( ssl_context *ssl, size_t nb_want )
     int ret;
     size_t len;
 
-    if( nb_want > SSL_BUFFER_LEN - 8 )
+    if( nb_want > ssl->in_buf_len )
     {
         return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
     }
@@ -822,6 +1356,7 @@ int ssl_write_record( ssl_context *ssl )
         }
 
         ssl->out_left = 5 + ssl->out_msglen;
+        ssl->out_app_len = 0;
     }
 
     if( ( ret = ssl_flush_output( ssl ) ) != 0 )
@@ -832,6 +1367,61 @@ int ssl_write_record( ssl_context *ssl )
     return( 0 );
 }
 
+/*
+ * Validate a record header, *len gets the length of the record contents
+ */
+static int ssl_parse_record_header( const ssl_context *ssl,
+                                    const uint8_t *hdr, size_t *len )
+{
+    *len = ( hdr[3] << 8 ) | hdr[4];
+
+    if( hdr[1] != ssl->major_ver )
+    {
+        return( POLARSSL_ERR_SSL_INVALID_RECORD );
+    }
+
+    if( hdr[2] > ssl->max_minor_ver )
+    {
+        return( POLARSSL_ERR_SSL_INVALID_RECORD );
+    }
+
+    /* Sanity check (outer boundaries) */
+    if( *len < 1 || *len > SSL_BUFFER_LEN - 5 )
+    {
+        return( POLARSSL_ERR_SSL_INVALID_RECORD );
+    }
+
+    /*
+     * Make sure the message length is acceptable for the current transform
+     * and protocol version.
+     */
+    if( ssl->transform_in == NULL )
+    {
+        if( *len > SSL_MAX_CONTENT_LEN )
+        {
+            return( POLARSSL_ERR_SSL_INVALID_RECORD );
+        }
+    }
+    else
+    {
+        if( *len < ssl->transform_in->minlen )
+        {
+            return( POLARSSL_ERR_SSL_INVALID_RECORD );
+        }
+
+        /*
+         * TLS encrypted messages can have up to 256 bytes of padding
+         */
+        if( ssl->minor_ver >= SSL_MINOR_VERSION_1 &&
+            *len > ssl->transform_in->minlen + SSL_MAX_CONTENT_LEN + 256 )
+        {
+            return( POLARSSL_ERR_SSL_INVALID_RECORD );
+        }
+    }
+
+    return( 0 );
+}
+
 int ssl_read_record( ssl_context *ssl )
 {
     int ret, done = 0;
@@ -877,51 +1467,20 @@ int ssl_read_record( ssl_context *ssl )
     }
 
     ssl->in_msgtype =  ssl->in_hdr[0];
-    ssl->in_msglen = ( ssl->in_hdr[3] << 8 ) | ssl->in_hdr[4];
 
-    if( ssl->in_hdr[1] != ssl->major_ver )
+    if( ( ret = ssl_parse_record_header( ssl, ssl->in_hdr,
+                                         &ssl->in_msglen ) ) != 0 )
     {
-        return( POLARSSL_ERR_SSL_INVALID_RECORD );
-    }
-
-    if( ssl->in_hdr[2] > ssl->max_minor_ver )
-    {
-        return( POLARSSL_ERR_SSL_INVALID_RECORD );
-    }
-
-    /* Sanity check (outer boundaries) */
-    if( ssl->in_msglen < 1 || ssl->in_msglen > SSL_BUFFER_LEN - 13 )
-    {
-        return( POLARSSL_ERR_SSL_INVALID_RECORD );
+        return( ret );
     }
 
     /*
-     * Make sure the message length is acceptable for the current transform
-     * and protocol version.
+     * After the handshake the input buffer only fits records of the
+     * negotiated maximum fragment length, with any legal padding
      */
-    if( ssl->transform_in == NULL )
-    {
-        if( ssl->in_msglen > SSL_MAX_CONTENT_LEN )
-        {
-            return( POLARSSL_ERR_SSL_INVALID_RECORD );
-        }
-    }
-    else
-    {
-        if( ssl->in_msglen < ssl->transform_in->minlen )
-        {
-            return( POLARSSL_ERR_SSL_INVALID_RECORD );
-        }
-
-        /*
-         * TLS encrypted messages can have up to 256 bytes of padding
-         */
-        if( ssl->minor_ver >= SSL_MINOR_VERSION_1 &&
-            ssl->in_msglen > ssl->transform_in->minlen +
-                             SSL_MAX_CONTENT_LEN + 256 )
-        {
-            return( POLARSSL_ERR_SSL_INVALID_RECORD );
-        }
+    if( 5 + ssl->in_msglen > ssl->in_buf_len )
+    {
+        return( POLARSSL_ERR_SSL_INVALID_RECORD );
     }
 
     /*
@@ -1036,6 +1595,9 @@ int ssl_send_alert_message( ssl_context *ssl,
 {
     int ret;
 
+    if( ( ret = ssl_setup_buffers( ssl ) ) != 0 )
+        return( ret );
+
     ssl->out_msgtype = SSL_MSG_ALERT;
     ssl->out_msglen = 2;
     ssl->out_msg[0] = level;
@@ -1180,10 +1742,7 @@ int ssl_parse_certificate( ssl_context *ssl )
 
     /* In case we tried to reuse a session but it failed */
     if( ssl->session_negotiate->peer_cert != NULL )
-    {
-        x509_crt_free( ssl->session_negotiate->peer_cert );
-        memory_free( ssl->session_negotiate->peer_cert );
-    }
+        x509_crt_unref( ssl->session_negotiate->peer_cert );
 
     if( ( ssl->session_negotiate->peer_cert = (x509_crt *) memory_alloc(
                     sizeof( x509_crt ) ) ) == NULL )
@@ -1331,36 +1890,101 @@ int ssl_parse_change_cipher_spec( ssl_context *ssl )
     return( 0 );
 }
 
-void ssl_optimize_checksum( ssl_context *ssl,
-                            const ssl_ciphersuite_t *ciphersuite_info )
+/*
+ * Hash the transcript kept so far with the hash of the ciphersuite, which
+ * then takes the rest of the handshake
+ */
+int ssl_optimize_checksum( ssl_context *ssl,
+                           const ssl_ciphersuite_t *ciphersuite_info )
 {
-    ((void) ciphersuite_info);
+    ssl_handshake_params *handshake = ssl->handshake;
+
+    if( handshake->update_checksum == ssl_update_checksum_lost )
+        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
+
+    if( handshake->update_checksum != ssl_update_checksum_start )
+        return( 0 );
 
     if (ciphersuite_info->mac == POLARSSL_MD_SHA384) {
-        ssl->handshake->update_checksum = ssl_update_checksum_sha384;
+        sha512_starts( &handshake->fin.sha512, 1 );
+        sha512_update( &handshake->fin.sha512,
+                       handshake->fin_buf, handshake->fin_len );
+        handshake->update_checksum = ssl_update_checksum_sha384;
     }
     else {
-        ssl->handshake->update_checksum = ssl_update_checksum_sha256;
+        sha256_starts( &handshake->fin.sha256, 0 );
+        sha256_update( &handshake->fin.sha256,
+                       handshake->fin_buf, handshake->fin_len );
+        handshake->update_checksum = ssl_update_checksum_sha256;
     }
+
+    memory_free( handshake->fin_buf );
+    handshake->fin_buf = NULL;
+    handshake->fin_len = handshake->fin_size = 0;
+
+    return( 0 );
 }
 
+/*
+ * Keep the transcript until the hash is known
+ */
 static void ssl_update_checksum_start( ssl_context *ssl,
                                        const uint8_t *buf, size_t len )
 {
-    sha256_update( &ssl->handshake->fin_sha256, buf, len );
-    sha512_update( &ssl->handshake->fin_sha512, buf, len );
+    ssl_handshake_params *handshake = ssl->handshake;
+    uint8_t *p;
+    size_t n;
+
+    if( handshake->fin_len + len > handshake->fin_size )
+    {
+        n = ( handshake->fin_size != 0 ) ? handshake->fin_size : SSL_FIN_BUF_LEN;
+        while( n < handshake->fin_len + len )
+            n *= 2;
+
+        p = (uint8_t *) memory_alloc( n );
+
+        if( p != NULL && handshake->fin_len != 0 )
+            __movsb( p, handshake->fin_buf, handshake->fin_len );
+
+        if( handshake->fin_buf != NULL )
+            memory_free( handshake->fin_buf );
+
+        handshake->fin_buf = p;
+        handshake->fin_size = n;
+
+        if( p == NULL )
+        {
+            handshake->fin_len = handshake->fin_size = 0;
+            handshake->update_checksum = ssl_update_checksum_lost;
+            return;
+        }
+    }
+
+    __movsb( handshake->fin_buf + handshake->fin_len, buf, len );
+    handshake->fin_len += len;
+}
+
+/*
+ * Transcript dropped for lack of memory, reported by ssl_optimize_checksum()
+ */
+static void ssl_update_checksum_lost( ssl_context *ssl,
+                                      const uint8_t *buf, size_t len )
+{
+    ((void) ssl);
+    ((void) buf);
+    ((void) len);
 }
 
 void ssl_update_checksum_sha256( ssl_context *ssl,
                                         const uint8_t *buf, size_t len )
 {
-    sha256_update( &ssl->handshake->fin_sha256, buf, len );
+    sha256_update( &ssl->handshake->fin.sha256, buf, len );
 }
 
 void ssl_update_checksum_sha384( ssl_context *ssl,
                                         const uint8_t *buf, size_t len )
 {
-    sha512_update( &ssl->handshake->fin_sha512, buf, len );
+    sha512_update( &ssl->handshake->fin.sha512, buf, len );
 }
 
 void ssl_calc_finished_tls_sha256(ssl_context *ssl, uint8_t *buf, int from )
@@ -1374,7 +1998,7 @@ void ssl_calc_finished_tls_sha256(ssl_context *ssl, uint8_t *buf, int from )
     if( !session )
         session = ssl->session;
 
-    __movsb( &sha256, &ssl->handshake->fin_sha256, sizeof(sha256_context) );
+    __movsb( &sha256, &ssl->handshake->fin.sha256, sizeof(sha256_context) );
 
     /*
      * TLSv1.2:
@@ -1407,7 +2031,7 @@ void ssl_calc_finished_tls_sha384(ssl_context *ssl, uint8_t *buf, int from )
     if( !session )
         session = ssl->session;
 
-    __movsb( &sha512, &ssl->handshake->fin_sha512, sizeof(sha512_context) );
+    __movsb( &sha512, &ssl->handshake->fin.sha512, sizeof(sha512_context) );
 
     /*
      * TLSv1.2:
@@ -1474,6 +2098,8 @@ void ssl_handshake_wrapup( ssl_context *ssl )
     }
 
     ssl->state++;
+
+    ssl_shrink_buffers( ssl );
 }
 
 int ssl_write_finished( ssl_context *ssl )
@@ -1605,11 +2231,6 @@ static void ssl_handshake_params_init(ssl_handshake_params *handshake)
 {
     __stosb(handshake, 0, sizeof(ssl_handshake_params));
 
-    sha256_init(&handshake->fin_sha256);
-    sha256_starts(&handshake->fin_sha256, 0);
-    sha512_init(&handshake->fin_sha512);
-    sha512_starts(&handshake->fin_sha512, 1);
-
     handshake->update_checksum = ssl_update_checksum_start;
     handshake->sig_alg = SSL_HASH_SHA1;
 
@@ -1632,6 +2253,27 @@ void ssl_session_init(ssl_session *session)
     __stosb(session, 0, sizeof(ssl_session));
 }
 
+/*
+ * Free the structures of a handshake in progress
+ */
+static void ssl_handshake_release( ssl_context *ssl )
+{
+    if( ssl->handshake )
+    {
+        ssl_handshake_free( ssl->handshake );
+        ssl_transform_free( ssl->transform_negotiate );
+        ssl_session_free( ssl->session_negotiate );
+
+        memory_free( ssl->handshake );
+        memory_free( ssl->transform_negotiate );
+        memory_free( ssl->session_negotiate );
+
+        ssl->handshake = NULL;
+        ssl->transform_negotiate = NULL;
+        ssl->session_negotiate = NULL;
+    }
+}
+
 static int ssl_handshake_init(ssl_context *ssl)
 {
     /* Clear old handshake information if present */
@@ -1692,14 +2334,22 @@ static int ssl_handshake_init(ssl_context *ssl)
     return(0);
 }
 
+/*
+ * Allocate the handshake structures when a new handshake is about to start
+ */
+static int ssl_handshake_setup( ssl_context *ssl )
+{
+    if( ssl->handshake != NULL || ssl->state != SSL_HELLO_REQUEST )
+        return( 0 );
+
+    return( ssl_handshake_init( ssl ) );
+}
+
 /*
  * Initialize an SSL context
  */
 int ssl_init( ssl_context *ssl )
 {
-    int ret;
-    int len = SSL_BUFFER_LEN;
-
     __stosb( ssl, 0, sizeof( ssl_context ) );
 
     /*
@@ -1713,39 +2363,18 @@ int ssl_init( ssl_context *ssl )
     ssl_set_ciphersuites( ssl, ssl_list_ciphersuites() );
 
     ssl->renego_max_records = SSL_RENEGO_MAX_RECORDS_DEFAULT;
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    ssl->ticket_lifetime = SSL_DEFAULT_TICKET_LIFETIME;
+#endif
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+    ssl->encrypt_then_mac = SSL_ETM_ENABLED;
+#endif
     /*
-     * Prepare base structures
+     * Record buffers and handshake structures are allocated on first use
      */
-    ssl->in_ctr = (uint8_t *) memory_alloc( len );
-    ssl->in_hdr = ssl->in_ctr +  8;
-    ssl->in_iv  = ssl->in_ctr + 13;
-    ssl->in_msg = ssl->in_ctr + 13;
-
-    if( ssl->in_ctr == NULL )
-    {
-        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
-    }
-
-    ssl->out_ctr = (uint8_t *) memory_alloc( len );
-    ssl->out_hdr = ssl->out_ctr +  8;
-    ssl->out_iv  = ssl->out_ctr + 13;
-    ssl->out_msg = ssl->out_ctr + 13;
-
-    if( ssl->out_ctr == NULL )
-    {
-        memory_free( ssl->in_ctr );
-        ssl->in_ctr = NULL;
-        return( POLARSSL_ERR_SSL_MALLOC_FAILED );
-    }
-
-    __stosb( ssl-> in_ctr, 0, SSL_BUFFER_LEN );
-    __stosb( ssl->out_ctr, 0, SSL_BUFFER_LEN );
-
     ssl->curve_list = ecp_grp_id_list( );
 
-    if( ( ret = ssl_handshake_init( ssl ) ) != 0 )
-        return( ret );
-
     return( 0 );
 }
 
@@ -1755,8 +2384,6 @@ int ssl_init( ssl_context *ssl )
  */
 int ssl_session_reset( ssl_context *ssl )
 {
-    int ret;
-
     ssl->state = SSL_HELLO_REQUEST;
     ssl->renegotiation = SSL_INITIAL_HANDSHAKE;
     ssl->secure_renegotiation = SSL_LEGACY_RENEGOTIATION;
@@ -1767,7 +2394,6 @@ int ssl_session_reset( ssl_context *ssl )
 
     ssl->in_offt = NULL;
 
-    ssl->in_msg = ssl->in_ctr + 13;
     ssl->in_msgtype = 0;
     ssl->in_msglen = 0;
     ssl->in_left = 0;
@@ -1776,7 +2402,6 @@ int ssl_session_reset( ssl_context *ssl )
     ssl->nb_zero = 0;
     ssl->record_read = 0;
 
-    ssl->out_msg = ssl->out_ctr + 13;
     ssl->out_msgtype = 0;
     ssl->out_msglen = 0;
     ssl->out_left = 0;
@@ -1786,8 +2411,15 @@ int ssl_session_reset( ssl_context *ssl )
 
     ssl->renego_records_seen = 0;
 
-    __stosb( ssl->out_ctr, 0, SSL_BUFFER_LEN );
-    __stosb( ssl->in_ctr, 0, SSL_BUFFER_LEN );
+    /*
+     * Buffers and handshake structures are allocated again on first use
+     */
+    ssl_resize_in_buf( ssl, 0 );
+    ssl_resize_out_buf( ssl, 0 );
+    ssl_handshake_release( ssl );
+
+    __stosb( ssl->out_ctr, 0, 8 );
+    __stosb( ssl->in_ctr, 0, 8 );
 
     if( ssl->transform )
     {
@@ -1807,9 +2439,6 @@ int ssl_session_reset( ssl_context *ssl )
     ssl->alpn_chosen = NULL;
 #endif
 
-    if( ( ret = ssl_handshake_init( ssl ) ) != 0 )
-        return( ret );
-
     return( 0 );
 }
 
@@ -1820,6 +2449,11 @@ int ssl_session_reset( ssl_context *ssl )
 void ssl_set_endpoint( ssl_context *ssl, int endpoint )
 {
     ssl->endpoint   = endpoint;
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    if( endpoint == SSL_IS_CLIENT )
+        ssl->session_tickets = SSL_SESSION_TICKETS_ENABLED;
+#endif
 }
 
 void ssl_set_authmode( ssl_context *ssl, int authmode )
@@ -1879,12 +2513,17 @@ int ssl_set_session( ssl_context *ssl, const ssl_session *session )
 
     if( ssl == NULL ||
         session == NULL ||
-        ssl->session_negotiate == NULL ||
         ssl->endpoint != SSL_IS_CLIENT )
     {
         return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
     }
 
+    if( ( ret = ssl_handshake_setup( ssl ) ) != 0 )
+        return( ret );
+
+    if( ssl->session_negotiate == NULL )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
     if( ( ret = ssl_session_copy( ssl->session_negotiate, session ) ) != 0 )
         return( ret );
 
@@ -2143,6 +2782,30 @@ int ssl_set_truncated_hmac( ssl_context *ssl, int truncate )
 }
 #endif /* POLARSSL_SSL_TRUNCATED_HMAC */
 
+#if defined(POLARSSL_SSL_ENCRYPT_THEN_MAC)
+void ssl_set_encrypt_then_mac( ssl_context *ssl, int etm )
+{
+    ssl->encrypt_then_mac = etm;
+}
+#endif /* POLARSSL_SSL_ENCRYPT_THEN_MAC */
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+void ssl_set_session_tickets( ssl_context *ssl, int use_tickets )
+{
+    ssl->session_tickets = use_tickets;
+}
+
+void ssl_set_session_ticket_lifetime( ssl_context *ssl, int lifetime )
+{
+    ssl->ticket_lifetime = lifetime;
+}
+
+void ssl_set_session_ticket_keys( ssl_context *ssl, ssl_ticket_keys *keys )
+{
+    ssl->ticket_keys = keys;
+}
+#endif /* POLARSSL_SSL_SESSION_TICKETS */
+
 void ssl_set_renegotiation( ssl_context *ssl, int renegotiation )
 {
     ssl->disable_renegotiation = renegotiation;
@@ -2231,6 +2894,14 @@ int ssl_handshake_step( ssl_context *ssl )
 {
     int ret = POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE;
 
+    if( ( ret = ssl_handshake_setup( ssl ) ) != 0 ||
+        ( ret = ssl_setup_buffers( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    ret = POLARSSL_ERR_SSL_FEATURE_UNAVAILABLE;
+
 #if defined(POLARSSL_SSL_CLI_C)
     if( ssl->endpoint == SSL_IS_CLIENT )
         ret = ssl_handshake_client_step( ssl );
@@ -2327,6 +2998,9 @@ int ssl_renegotiate( ssl_context *ssl )
         if( ssl->state != SSL_HANDSHAKE_OVER )
             return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
 
+        if( ( ret = ssl_setup_buffers( ssl ) ) != 0 )
+            return( ret );
+
         return( ssl_write_hello_request( ssl ) );
     }
 #endif /* POLARSSL_SSL_SRV_C */
@@ -2374,6 +3048,9 @@ int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len )
         }
     }
 
+    if( ( ret = ssl_setup_buffers( ssl ) ) != 0 )
+        return( ret );
+
     if( ssl->in_offt == NULL )
     {
         if( ( ret = ssl_read_record( ssl ) ) != 0 )
@@ -2456,61 +3133,234 @@ int ssl_read( ssl_context *ssl, uint8_t *buf, size_t len )
     return( (int) n );
 }
 
+void ssl_get_record_expansion( const ssl_context *ssl,
+                               size_t *header, size_t *trailer )
+{
+    *header = 5;
+    *trailer = 0;
+
+    if( ssl->transform_out != NULL )
+    {
+        /* explicit IV, then MAC and up to a block of padding */
+        *header += ssl->transform_out->ivlen;
+        *trailer = ssl->transform_out->maclen + ssl->transform_out->ivlen;
+    }
+}
+
 /*
- * Send application data to be encrypted by the SSL layer
+ * Seal application data into consecutive records in out. Records are
+ * filled up to the maximum length, so small pieces share one; a short
+ * record is only written for the last of the data.
  */
-int ssl_write( ssl_context *ssl, const uint8_t *buf, size_t len )
+int ssl_write_records( ssl_context *ssl, const ssl_iovec *iov, int iovcnt,
+                       uint8_t *out, size_t out_len, size_t *olen )
 {
-    int ret;
-    size_t n;
-    uint32_t max_len = SSL_MAX_CONTENT_LEN;
+    int ret, i;
+    size_t left = 0, done = 0, n, rec_len, header, trailer;
+    size_t max_len = ssl_get_max_out_len( ssl );
+    ssl_iov_cursor src;
 
-    if( ssl->state != SSL_HANDSHAKE_OVER )
+    *olen = 0;
+
+    if( ssl->state != SSL_HANDSHAKE_OVER || ssl->transform_out == NULL )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    for( i = 0; i < iovcnt; i++ )
+        left += iov[i].len;
+
+    ssl_get_record_expansion( ssl, &header, &trailer );
+
+    src.iov = iov;
+    src.off = 0;
+
+    while( left > 0 && out_len - *olen > header + trailer )
     {
-        if( ( ret = ssl_handshake( ssl ) ) != 0 )
+        n = out_len - *olen - header - trailer;
+        if( n > max_len )
+            n = max_len;
+
+        if( n < left && n < max_len )
+            break;
+
+        if( n > left )
+            n = left;
+
+        out[*olen] = SSL_MSG_APPLICATION_DATA;
+
+        if( ( ret = ssl_encrypt_rec( ssl, out + *olen, &src, n,
+                                     &rec_len ) ) != 0 )
         {
+            /*
+             * The records sealed so far hold their sequence numbers: hand
+             * them out, the error comes back on the next call
+             */
+            md_hmac_reset( &ssl->transform_out->md_ctx_enc );
+            if( done > 0 )
+                break;
+
             return( ret );
         }
+
+        *olen += rec_len;
+        left -= n;
+        done += n;
+    }
+
+    return( (int) done );
+}
+
+int ssl_encrypt_record( ssl_context *ssl, uint8_t *buf, size_t len,
+                        size_t *olen )
+{
+    int ret;
+
+    *olen = 0;
+
+    if( ssl->state != SSL_HANDSHAKE_OVER || ssl->transform_out == NULL ||
+        len > ssl_get_max_out_len( ssl ) )
+    {
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
     }
 
-#if defined(POLARSSL_SSL_MAX_FRAGMENT_LENGTH)
     /*
-     * Assume mfl_code is correct since it was checked when set
+     * Records already queued by the library go out first
      */
-    max_len = mfl_code_to_length[ssl->mfl_code];
+    if( ( ret = ssl_flush_output( ssl ) ) != 0 )
+        return( ret );
+
+    buf[0] = SSL_MSG_APPLICATION_DATA;
+
+    return( ssl_encrypt_rec( ssl, buf, NULL, len, olen ) );
+}
+
+int ssl_decrypt_record( ssl_context *ssl, uint8_t *buf, size_t len,
+                        size_t *consumed, uint8_t **msg, size_t *msglen )
+{
+    int ret;
+    size_t rec_len;
+
+    *consumed = 0;
+    *msglen = 0;
+
+    if( ssl->state != SSL_HANDSHAKE_OVER || ssl->transform_in == NULL )
+        return( POLARSSL_ERR_SSL_BAD_INPUT_DATA );
+
+    if( len < 5 )
+        return( POLARSSL_ERR_NET_WANT_READ );
+
+    if( ( ret = ssl_parse_record_header( ssl, buf, &rec_len ) ) != 0 )
+        return( ret );
+
+    if( len < 5 + rec_len )
+        return( POLARSSL_ERR_NET_WANT_READ );
 
     /*
-     * Check if a smaller max length was negotiated
+     * Handshake messages (renegotiation) need ssl_read(): leave the record
+     * and the sequence number as they are, so it can still have them
      */
-    if( ssl->session_out != NULL &&
-        mfl_code_to_length[ssl->session_out->mfl_code] < max_len )
+    if( buf[0] != SSL_MSG_APPLICATION_DATA && buf[0] != SSL_MSG_ALERT )
+        return( POLARSSL_ERR_SSL_UNEXPECTED_MESSAGE );
+
+    if( ( ret = ssl_decrypt_rec( ssl, buf, msglen ) ) != 0 )
     {
-        max_len = mfl_code_to_length[ssl->session_out->mfl_code];
+#if defined(POLARSSL_SSL_ALERT_MESSAGES)
+        if( ret == POLARSSL_ERR_SSL_INVALID_MAC )
+        {
+            ssl_send_alert_message( ssl,
+                                    SSL_ALERT_LEVEL_FATAL,
+                                    SSL_ALERT_MSG_BAD_RECORD_MAC );
+        }
+#endif
+        return( ret );
     }
-#endif /* POLARSSL_SSL_MAX_FRAGMENT_LENGTH */
 
-    n = ( len < max_len) ? len : max_len;
+    if( *msglen > SSL_MAX_CONTENT_LEN )
+        return( POLARSSL_ERR_SSL_INVALID_RECORD );
 
-    if( ssl->out_left != 0 )
+    *consumed = 5 + rec_len;
+    *msg = buf + 5 + ssl->transform_in->ivlen;
+
+    if( buf[0] == SSL_MSG_APPLICATION_DATA )
+        return( 0 );
+
+    if( *msglen < 2 )
+        return( POLARSSL_ERR_SSL_INVALID_RECORD );
+
+    if( (*msg)[0] == SSL_ALERT_LEVEL_FATAL )
+        return( POLARSSL_ERR_SSL_FATAL_ALERT_MESSAGE );
+
+    if( (*msg)[1] == SSL_ALERT_MSG_CLOSE_NOTIFY )
+        return( POLARSSL_ERR_SSL_PEER_CLOSE_NOTIFY );
+
+    /*
+     * Ignore non-fatal alerts
+     */
+    *msglen = 0;
+    return( 0 );
+}
+
+/*
+ * Send application data to be encrypted by the SSL layer
+ */
+int ssl_writev( ssl_context *ssl, const ssl_iovec *iov, int iovcnt )
+{
+    int ret;
+    size_t olen;
+
+    if( ssl->state != SSL_HANDSHAKE_OVER )
     {
-        if( ( ret = ssl_flush_output( ssl ) ) != 0 )
+        if( ( ret = ssl_handshake( ssl ) ) != 0 )
         {
             return( ret );
         }
     }
-    else
-    {
-        ssl->out_msglen  = n;
-        ssl->out_msgtype = SSL_MSG_APPLICATION_DATA;
-        __movsb( ssl->out_msg, buf, n );
 
-        if( ( ret = ssl_write_record( ssl ) ) != 0 )
+    if( ssl->out_left != 0 )
+    {
+        if( ( ret = ssl_flush_output( ssl ) ) != 0 )
         {
             return( ret );
         }
+
+        /* Called again after WANT_WRITE: report what was queued then */
+        if( ssl->out_app_len != 0 )
+            return( (int) ssl->out_app_len );
+
+        /* Only a record of the library's own was pending */
     }
 
-    return( (int) n );
+    if( ( ret = ssl_setup_buffers( ssl ) ) != 0 )
+        return( ret );
+
+    /*
+     * Records are sealed straight from the application buffers into the
+     * output buffer, and sent with as few calls to f_send as possible
+     */
+    ret = ssl_write_records( ssl, iov, iovcnt, ssl->out_buf,
+                             ssl->out_buf_len, &olen );
+    if( ret <= 0 )
+        return( ret );
+
+    ssl->out_app_len = ret;
+    ssl->out_msglen = olen - 5;
+    ssl->out_left = olen;
+
+    if( ( ret = ssl_flush_output( ssl ) ) != 0 )
+    {
+        return( ret );
+    }
+
+    return( (int) ssl->out_app_len );
+}
+
+int ssl_write( ssl_context *ssl, const uint8_t *buf, size_t len )
+{
+    ssl_iovec iov;
+
+    iov.buf = (uint8_t *) buf;
+    iov.len = len;
+
+    return( ssl_writev( ssl, &iov, 1 ) );
 }
 
 /*
@@ -2574,6 +3424,9 @@ void ssl_handshake_free( ssl_handshake_params *handshake )
 {
     ecdh_free( &handshake->ecdh_ctx );
 
+    if( handshake->fin_buf != NULL )
+        memory_free( handshake->fin_buf );
+
     /* explicit void pointer cast for buggy MS compiler */
     memory_free( (void *) handshake->curves );
 
@@ -2602,10 +3455,16 @@ void ssl_handshake_free( ssl_handshake_params *handshake )
 void ssl_session_free( ssl_session *session )
 {
 #if defined(POLARSSL_X509_CRT_PARSE_C)
+    /* The peer certificate may be shared with the session cache */
     if( session->peer_cert != NULL )
+        x509_crt_unref( session->peer_cert );
+#endif
+
+#if defined(POLARSSL_SSL_SESSION_TICKETS)
+    if( session->ticket != NULL )
     {
-        x509_crt_free( session->peer_cert );
-        memory_free( session->peer_cert );
+        __stosb( session->ticket, 0, session->ticket_len );
+        memory_free( session->ticket );
     }
 #endif
 
@@ -2617,18 +3476,8 @@ void ssl_session_free( ssl_session *session )
  */
 void ssl_free( ssl_context *ssl )
 {
-
-    if( ssl->out_ctr != NULL )
-    {
-        __stosb( ssl->out_ctr, 0, SSL_BUFFER_LEN );
-        memory_free( ssl->out_ctr );
-    }
-
-    if( ssl->in_ctr != NULL )
-    {
-        __stosb( ssl->in_ctr, 0, SSL_BUFFER_LEN );
-        memory_free( ssl->in_ctr );
-    }
+    ssl_resize_out_buf( ssl, 0 );
+    ssl_resize_in_buf( ssl, 0 );
 
     if( ssl->transform )
     {
@@ -2636,16 +3485,7 @@ void ssl_free( ssl_context *ssl )
         memory_free( ssl->transform );
     }
 
-    if( ssl->handshake )
-    {
-        ssl_handshake_free( ssl->handshake );
-        ssl_transform_free( ssl->transform_negotiate );
-        ssl_session_free( ssl->session_negotiate );
-
-        memory_free( ssl->handshake );
-        memory_free( ssl->transform_negotiate );
-        memory_free( ssl->session_negotiate );
-    }
+    ssl_handshake_release( ssl );
 
     if( ssl->session )
     {
@@ -2678,6 +3518,8 @@ uint8_t ssl_sig_from_pk( pk_context *pk )
 {
     if( pk_can_do( pk, POLARSSL_PK_RSA ) )
         return( SSL_SIG_RSA );
+    if( pk_can_do( pk, POLARSSL_PK_ECDSA ) )
+        return( SSL_SIG_ECDSA );
     return( SSL_SIG_ANON );
 }
 
@@ -2687,6 +3529,8 @@ pk_type_t ssl_pk_alg_from_sig( uint8_t sig )
     {
         case SSL_SIG_RSA:
             return( POLARSSL_PK_RSA );
+        case SSL_SIG_ECDSA:
+            return( POLARSSL_PK_ECDSA );
         default:
             return( POLARSSL_PK_NONE );
     }
@@ -2758,6 +3602,7 @@ int ssl_check_cert_usage( const x509_crt *cert,
         switch( ciphersuite->key_exchange )
         {
             case POLARSSL_KEY_EXCHANGE_ECDHE_RSA:
+            case POLARSSL_KEY_EXCHANGE_ECDHE_ECDSA:
                 usage = KU_DIGITAL_SIGNATURE;
                 break;
 
@@ -588,3 +588,94 @@ int x509_time_future( const x509_time *from )
 
     return( x509_check_time( from, &now ) );
 }
+
+#if defined(POLARSSL_SELF_TEST)
+
+#include "x509_crt.h"
+
+#if defined(POLARSSL_X509_CRT_PARSE_C) && \
+    defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+/*
+ * Self-signed ECDSA P-256 certificate, version 3 but without the optional
+ * extensions field
+ */
+static const uint8_t x509_test_v3_noext[] =
+{
+    0x30, 0x82, 0x01, 0x36, 0x30, 0x81, 0xDD, 0xA0, 0x03, 0x02, 0x01, 0x02,
+    0x02, 0x01, 0x01, 0x30, 0x0A, 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D,
+    0x04, 0x03, 0x02, 0x30, 0x24, 0x31, 0x22, 0x30, 0x20, 0x06, 0x03, 0x55,
+    0x04, 0x03, 0x0C, 0x19, 0x50, 0x6F, 0x6C, 0x61, 0x72, 0x53, 0x53, 0x4C,
+    0x20, 0x76, 0x33, 0x20, 0x6E, 0x6F, 0x20, 0x65, 0x78, 0x74, 0x65, 0x6E,
+    0x73, 0x69, 0x6F, 0x6E, 0x73, 0x30, 0x20, 0x17, 0x0D, 0x32, 0x36, 0x31,
+    0x30, 0x31, 0x38, 0x31, 0x37, 0x35, 0x39, 0x35, 0x31, 0x5A, 0x18, 0x0F,
+    0x32, 0x31, 0x32, 0x36, 0x30, 0x39, 0x32, 0x34, 0x31, 0x37, 0x35, 0x39,
+    0x35, 0x31, 0x5A, 0x30, 0x24, 0x31, 0x22, 0x30, 0x20, 0x06, 0x03, 0x55,
+    0x04, 0x03, 0x0C, 0x19, 0x50, 0x6F, 0x6C, 0x61, 0x72, 0x53, 0x53, 0x4C,
+    0x20, 0x76, 0x33, 0x20, 0x6E, 0x6F, 0x20, 0x65, 0x78, 0x74, 0x65, 0x6E,
+    0x73, 0x69, 0x6F, 0x6E, 0x73, 0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2A,
+    0x86, 0x48, 0xCE, 0x3D, 0x02, 0x01, 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE,
+    0x3D, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00, 0x04, 0x79, 0x0B, 0x3F, 0xE7,
+    0x3A, 0x39, 0x51, 0x1D, 0xEC, 0xD0, 0xE8, 0x64, 0x45, 0x19, 0xCF, 0x42,
+    0xFC, 0x9B, 0x3E, 0xC2, 0x16, 0xD9, 0x92, 0xC9, 0x74, 0xA0, 0x72, 0x63,
+    0xCE, 0xD5, 0x95, 0x3E, 0xDD, 0x99, 0xDC, 0x5C, 0x9C, 0xE8, 0xE0, 0xFE,
+    0xFD, 0xDB, 0xB9, 0xDA, 0x63, 0xCF, 0xC6, 0x12, 0x9D, 0x90, 0xBD, 0xBC,
+    0xD5, 0xF3, 0x67, 0xC8, 0xD3, 0x22, 0x6B, 0x09, 0x60, 0xB7, 0x93, 0xCB,
+    0x30, 0x0A, 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x04, 0x03, 0x02,
+    0x03, 0x48, 0x00, 0x30, 0x45, 0x02, 0x20, 0x20, 0x3F, 0xFC, 0xD1, 0x5F,
+    0x1A, 0x51, 0x6B, 0x5F, 0xD0, 0x2C, 0xAE, 0xA2, 0x7B, 0xC4, 0x7D, 0xC9,
+    0x99, 0xD4, 0x59, 0x65, 0x31, 0xD9, 0x95, 0xF3, 0x0C, 0xE4, 0x1C, 0x17,
+    0x09, 0xF3, 0x3F, 0x02, 0x21, 0x00, 0xE4, 0x86, 0xDE, 0xC9, 0x82, 0x5D,
+    0x24, 0xCD, 0xA5, 0xD9, 0xBD, 0xE0, 0x68, 0x05, 0xC8, 0xED, 0x4E, 0x23,
+    0x99, 0xC8, 0xB3, 0xB1, 0xF1, 0xEA, 0xF4, 0x94, 0x3A, 0xC2, 0xCE, 0x56,
+    0xAC, 0xA2
+};
+#endif
+
+/*
+ * Checkup routine
+ */
+int x509_self_test( int verbose )
+{
+#if defined(POLARSSL_X509_CRT_PARSE_C) && \
+    defined(POLARSSL_ECP_DP_SECP256R1_ENABLED)
+    int i, ret;
+    x509_crt crt;
+
+    ((void) verbose);
+
+    /* Every parse mode, then the deferred decoding of the lazy ones */
+    for( i = 0; i < 3; i++ )
+    {
+        x509_crt_init( &crt );
+
+        if( i == 0 )
+            ret = x509_crt_parse( &crt, x509_test_v3_noext,
+                                  sizeof( x509_test_v3_noext ) );
+        else if( i == 1 )
+            ret = x509_crt_parse_lazy( &crt, x509_test_v3_noext,
+                                       sizeof( x509_test_v3_noext ) );
+        else
+            ret = x509_crt_parse_der_nocopy( &crt, x509_test_v3_noext,
+                                             sizeof( x509_test_v3_noext ) );
+
+        if( ret == 0 )
+            ret = x509_crt_parse_deferred( &crt );
+
+        if( ret != 0 || crt.version != 3 || crt.v3_ext.p != NULL ||
+            crt.ext_types != 0 )
+        {
+            x509_crt_free( &crt );
+            return( 1 );
+        }
+
+        x509_crt_free( &crt );
+    }
+
+    return( 0 );
+#else
+    ((void) verbose);
+    return( 0 );
+#endif
+}
+
+#endif /* POLARSSL_SELF_TEST */
@@ -190,6 +190,118 @@ static int x509_get_entries( uint8_t **p,
     return( 0 );
 }
 
+static int x509_crl_serial_cmp( const x509_buf *a, const x509_buf *b )
+{
+    if( a->len != b->len )
+        return( ( a->len < b->len ) ? -1 : 1 );
+
+    return( memcmp( a->p, b->p, a->len ) );
+}
+
+static void x509_crl_sift( x509_crl_entry **v, size_t i, size_t n )
+{
+    size_t c;
+    x509_crl_entry *t;
+
+    while( ( c = 2 * i + 1 ) < n )
+    {
+        if( c + 1 < n &&
+            x509_crl_serial_cmp( &v[c]->serial, &v[c + 1]->serial ) < 0 )
+            c++;
+
+        if( x509_crl_serial_cmp( &v[i]->serial, &v[c]->serial ) >= 0 )
+            break;
+
+        t = v[i];
+        v[i] = v[c];
+        v[c] = t;
+        i = c;
+    }
+}
+
+/*
+ * Sort the entries by serial number (heap sort, in place) for
+ * x509_crl_serial_revoked()
+ */
+static int x509_crl_index_build( x509_crl *crl )
+{
+    size_t i, n = 0;
+    x509_crl_entry *cur, **v, *t;
+
+    for( cur = &crl->entry; cur != NULL && cur->serial.len != 0;
+         cur = cur->next )
+        n++;
+
+    if( n == 0 )
+        return( 0 );
+
+    v = (x509_crl_entry **) memory_alloc( n * sizeof( x509_crl_entry * ) );
+    if( v == NULL )
+        return( POLARSSL_ERR_X509_MALLOC_FAILED );
+
+    for( cur = &crl->entry, i = 0; i < n; cur = cur->next, i++ )
+        v[i] = cur;
+
+    for( i = n / 2; i-- > 0; )
+        x509_crl_sift( v, i, n );
+
+    for( i = n; i-- > 1; )
+    {
+        t = v[0];
+        v[0] = v[i];
+        v[i] = t;
+        x509_crl_sift( v, 0, i );
+    }
+
+    crl->serial_index = v;
+    crl->serial_count = n;
+
+    return( 0 );
+}
+
+int x509_crl_serial_revoked( const x509_crl *crl, const x509_buf *serial )
+{
+    const x509_crl_entry *cur;
+    size_t lo = 0, hi = crl->serial_count, mid;
+
+    /*
+     * CRLs that were not parsed here have no index
+     */
+    if( crl->serial_index == NULL )
+    {
+        for( cur = &crl->entry; cur != NULL && cur->serial.len != 0;
+             cur = cur->next )
+        {
+            if( x509_crl_serial_cmp( &cur->serial, serial ) == 0 &&
+                x509_time_expired( &cur->revocation_date ) )
+                return( 1 );
+        }
+
+        return( 0 );
+    }
+
+    while( lo < hi )
+    {
+        mid = lo + ( hi - lo ) / 2;
+
+        if( x509_crl_serial_cmp( &crl->serial_index[mid]->serial, serial ) < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* A serial may be listed more than once */
+    for( ; lo < crl->serial_count &&
+           x509_crl_serial_cmp( &crl->serial_index[lo]->serial, serial ) == 0;
+         lo++ )
+    {
+        if( x509_time_expired( &crl->serial_index[lo]->revocation_date ) )
+            return( 1 );
+    }
+
+    return( 0 );
+}
+
 /*
  * Parse one or more CRLs and add them to the chained list
  */
@@ -453,6 +565,12 @@ int x509_crl_parse( x509_crl *chain, const uint8_t *buf, size_t buflen )
                 POLARSSL_ERR_ASN1_LENGTH_MISMATCH );
     }
 
+    if( ( ret = x509_crl_index_build( crl ) ) != 0 )
+    {
+        x509_crl_free( crl );
+        return( ret );
+    }
+
     if( buflen > 0 )
     {
         crl->next = (x509_crl *) memory_alloc( sizeof( x509_crl ) );
@@ -629,6 +747,9 @@ void x509_crl_free( x509_crl *crl )
             memory_free( entry_prv );
         }
 
+        if( crl_cur->serial_index != NULL )
+            memory_free( crl_cur->serial_index );
+
         if( crl_cur->raw.p != NULL )
         {
             __stosb( crl_cur->raw.p, 0, crl_cur->raw.len );
@@ -94,6 +94,9 @@ typedef struct _x509_crl
     md_type_t sig_md;           /**< Internal representation of the MD algorithm of the signature algorithm, e.g. POLARSSL_MD_SHA256 */
     pk_type_t sig_pk            /**< Internal representation of the Public Key algorithm of the signature algorithm, e.g. POLARSSL_PK_RSA */;
 
+    x509_crl_entry **serial_index;  /**< Internal: the entries sorted by serial number, see x509_crl_serial_revoked(). */
+    size_t serial_count;            /**< Internal: number of entries in serial_index. */
+
     struct _x509_crl *next;
 }
 x509_crl;
@@ -121,6 +124,20 @@ int x509_crl_parse( x509_crl *chain, const uint8_t *buf, size_t buflen );
  */
 int x509_crl_parse_file( x509_crl *chain, const char *path );
 
+/**
+ * \brief          Check whether a serial number is revoked by a CRL, i.e.
+ *                 listed with a revocation date that has passed
+ *
+ * \note           Parsed CRLs keep their entries sorted by serial number,
+ *                 so the lookup is a binary search.
+ *
+ * \param crl      CRL to check (only this one, not the rest of the chain)
+ * \param serial   Serial number of the certificate
+ *
+ * \return         1 if revoked, 0 otherwise
+ */
+int x509_crl_serial_revoked( const x509_crl *crl, const x509_buf *serial );
+
 /**
  * \brief          Returns an informational string about the CRL.
  *
@@ -5,6 +5,9 @@
 
 #include "x509_crt.h"
 #include "oid.h"
+#if defined(POLARSSL_X509_VERIFY_CACHE)
+#include "sha256.h"
+#endif
 #if defined(POLARSSL_PEM_PARSE_C)
 #include "pem.h"
 #endif
@@ -313,28 +316,21 @@ static int x509_get_subject_alt_name( uint8_t **p,
 }
 
 /*
- * X.509 v3 extensions
+ * X.509 v3 extensions: the list of extensions, end is the end of the
+ * Extensions SEQUENCE
  *
  * TODO: Perform all of the basic constraints tests required by the RFC
  * TODO: Set values for undetected extensions to a sane default?
  *
  */
-static int x509_get_crt_ext( uint8_t **p,
-                             const uint8_t *end,
-                             x509_crt *crt )
+static int x509_crt_ext_decode( uint8_t **p,
+                                const uint8_t *end,
+                                x509_crt *crt )
 {
     int ret;
     size_t len;
     uint8_t *end_ext_data, *end_ext_octet;
 
-    if( ( ret = x509_get_ext( p, end, &crt->v3_ext, 3 ) ) != 0 )
-    {
-        if( ret == POLARSSL_ERR_ASN1_UNEXPECTED_TAG )
-            return( 0 );
-
-        return( ret );
-    }
-
     while( *p < end )
     {
         /*
@@ -452,15 +448,57 @@ static int x509_get_crt_ext( uint8_t **p,
     return( 0 );
 }
 
+/*
+ * X.509 v3 extensions, decoded now or only located if defer is set
+ */
+static int x509_get_crt_ext( uint8_t **p,
+                             const uint8_t *end,
+                             x509_crt *crt, int defer )
+{
+    int ret;
+
+    if( ( ret = x509_get_ext( p, end, &crt->v3_ext, 3 ) ) != 0 )
+    {
+        if( ret == POLARSSL_ERR_ASN1_UNEXPECTED_TAG )
+            return( 0 );
+
+        return( ret );
+    }
+
+    /* A v3 certificate may have no extensions at all */
+    if( crt->v3_ext.p == NULL )
+        return( 0 );
+
+    end = crt->v3_ext.p + crt->v3_ext.len;
+
+    if( defer )
+    {
+        *p = (uint8_t *) end;
+        return( 0 );
+    }
+
+    return( x509_crt_ext_decode( p, end, crt ) );
+}
+
+/*
+ * Modes of x509_crt_parse_der_core()
+ */
+#define X509_CRT_COPY       0   /* raw is a copy of buf                  */
+#define X509_CRT_TAKE       1   /* buf was allocated, raw takes it over  */
+#define X509_CRT_BORROW     2   /* raw is buf, owned by the caller       */
+#define X509_CRT_DEFER      4   /* leave names, key and extensions for
+                                   x509_crt_parse_deferred()             */
+
 /*
  * Parse and fill a single X.509 certificate in DER format
  */
 static int x509_crt_parse_der_core( x509_crt *crt, const uint8_t *buf,
-                                    size_t buflen )
+                                    size_t buflen, int mode )
 {
     int ret;
     size_t len;
     uint8_t *p, *end, *crt_end;
+    int defer = ( mode & X509_CRT_DEFER ) != 0;
 
     /*
      * Check for valid input
@@ -468,13 +506,21 @@ static int x509_crt_parse_der_core( x509_crt *crt, const uint8_t *buf,
     if( crt == NULL || buf == NULL )
         return( POLARSSL_ERR_X509_BAD_INPUT_DATA );
 
-    p = (uint8_t *) memory_alloc( len = buflen );
+    len = buflen;
 
-    if( p == NULL )
-        return( POLARSSL_ERR_X509_MALLOC_FAILED );
+    if( mode & ( X509_CRT_TAKE | X509_CRT_BORROW ) )
+        p = (uint8_t *) buf;
+    else
+    {
+        p = (uint8_t *) memory_alloc( len );
+
+        if( p == NULL )
+            return( POLARSSL_ERR_X509_MALLOC_FAILED );
 
-    __movsb( p, buf, buflen );
+        __movsb( p, buf, buflen );
+    }
 
+    crt->raw_borrowed = ( mode & X509_CRT_BORROW ) != 0;
     crt->raw.p = p;
     crt->raw.len = len;
     end = p + len;
@@ -557,7 +603,9 @@ static int x509_crt_parse_der_core( x509_crt *crt, const uint8_t *buf,
         return( POLARSSL_ERR_X509_INVALID_FORMAT + ret );
     }
 
-    if( ( ret = x509_get_name( &p, p + len, &crt->issuer ) ) != 0 )
+    if( defer )
+        p += len;
+    else if( ( ret = x509_get_name( &p, p + len, &crt->issuer ) ) != 0 )
     {
         x509_crt_free( crt );
         return( ret );
@@ -590,7 +638,9 @@ static int x509_crt_parse_der_core( x509_crt *crt, const uint8_t *buf,
         return( POLARSSL_ERR_X509_INVALID_FORMAT + ret );
     }
 
-    if( len && ( ret = x509_get_name( &p, p + len, &crt->subject ) ) != 0 )
+    if( defer )
+        p += len;
+    else if( len && ( ret = x509_get_name( &p, p + len, &crt->subject ) ) != 0 )
     {
         x509_crt_free( crt );
         return( ret );
@@ -601,12 +651,27 @@ static int x509_crt_parse_der_core( x509_crt *crt, const uint8_t *buf,
     /*
      * SubjectPublicKeyInfo
      */
-    if( ( ret = pk_parse_subpubkey( &p, end, &crt->pk ) ) != 0 )
+    crt->pk_raw.p = p;
+
+    if( defer )
+    {
+        if( ( ret = asn1_get_tag( &p, end, &len,
+                ASN1_CONSTRUCTED | ASN1_SEQUENCE ) ) != 0 )
+        {
+            x509_crt_free( crt );
+            return( POLARSSL_ERR_PK_KEY_INVALID_FORMAT + ret );
+        }
+
+        p += len;
+    }
+    else if( ( ret = pk_parse_subpubkey( &p, end, &crt->pk ) ) != 0 )
     {
         x509_crt_free( crt );
         return( ret );
     }
 
+    crt->pk_raw.len = p - crt->pk_raw.p;
+
     /*
      *  issuerUniqueID  [1]  IMPLICIT UniqueIdentifier OPTIONAL,
      *                       -- If present, version shall be v2 or v3
@@ -637,7 +702,7 @@ static int x509_crt_parse_der_core( x509_crt *crt, const uint8_t *buf,
 
     if( crt->version == 3 )
     {
-        ret = x509_get_crt_ext( &p, end, crt);
+        ret = x509_get_crt_ext( &p, end, crt, defer );
         if( ret != 0 )
         {
             x509_crt_free( crt );
@@ -687,15 +752,97 @@ static int x509_crt_parse_der_core( x509_crt *crt, const uint8_t *buf,
                 POLARSSL_ERR_ASN1_LENGTH_MISMATCH );
     }
 
+    crt->deferred = defer;
+
     return( 0 );
 }
 
 /*
- * Parse one X.509 certificate in DER format from a buffer and add them to a
- * chained list
+ * Serializes x509_crt_parse_deferred() and the CA index builds
  */
-int x509_crt_parse_der( x509_crt *chain, const uint8_t *buf,
-                        size_t buflen )
+static mutex_t x509_crt_mutex;
+static async_once_t x509_crt_once = ASYNC_ONCE_INIT;
+
+static void x509_crt_mutex_init( void )
+{
+    mutex_init( &x509_crt_mutex );
+}
+
+/*
+ * Decode what x509_crt_parse_der_core() left for later. The DER was
+ * already walked, so only the inner checks can fail.
+ */
+static int x509_crt_decode_deferred( x509_crt *crt )
+{
+    int ret;
+    size_t len;
+    uint8_t *p, *end;
+
+    p = crt->issuer_raw.p;
+    end = p + crt->issuer_raw.len;
+
+    if( ( ret = asn1_get_tag( &p, end, &len,
+            ASN1_CONSTRUCTED | ASN1_SEQUENCE ) ) != 0 )
+        return( POLARSSL_ERR_X509_INVALID_FORMAT + ret );
+
+    if( ( ret = x509_get_name( &p, p + len, &crt->issuer ) ) != 0 )
+        return( ret );
+
+    p = crt->subject_raw.p;
+    end = p + crt->subject_raw.len;
+
+    if( ( ret = asn1_get_tag( &p, end, &len,
+            ASN1_CONSTRUCTED | ASN1_SEQUENCE ) ) != 0 )
+        return( POLARSSL_ERR_X509_INVALID_FORMAT + ret );
+
+    if( len && ( ret = x509_get_name( &p, p + len, &crt->subject ) ) != 0 )
+        return( ret );
+
+    p = crt->pk_raw.p;
+    end = p + crt->pk_raw.len;
+
+    if( ( ret = pk_parse_subpubkey( &p, end, &crt->pk ) ) != 0 )
+        return( ret );
+
+    if( crt->v3_ext.p != NULL )
+    {
+        p = crt->v3_ext.p;
+        end = p + crt->v3_ext.len;
+
+        if( ( ret = asn1_get_tag( &p, end, &len,
+                ASN1_CONSTRUCTED | ASN1_SEQUENCE ) ) != 0 )
+            return( POLARSSL_ERR_X509_INVALID_EXTENSIONS + ret );
+
+        if( ( ret = x509_crt_ext_decode( &p, end, crt ) ) != 0 )
+            return( ret );
+    }
+
+    return( 0 );
+}
+
+int x509_crt_parse_deferred( x509_crt *crt )
+{
+    if( crt->deferred != 1 )
+        return( crt->deferred );
+
+    async_once( &x509_crt_once, x509_crt_mutex_init );
+    mutex_lock( &x509_crt_mutex );
+
+    if( crt->deferred == 1 )
+        crt->deferred = x509_crt_decode_deferred( crt );
+
+    mutex_unlock( &x509_crt_mutex );
+
+    return( crt->deferred );
+}
+
+/*
+ * Add one DER certificate at the end of the chain, see
+ * x509_crt_parse_der_core() for the modes. With X509_CRT_TAKE, buf is
+ * released on failure too.
+ */
+static int x509_crt_add_der( x509_crt *chain, const uint8_t *buf,
+                             size_t buflen, int mode )
 {
     int ret;
     x509_crt *crt = chain, *prev = NULL;
@@ -720,34 +867,370 @@ int x509_crt_parse_der( x509_crt *chain, const uint8_t *buf,
         crt->next = (x509_crt *) memory_alloc( sizeof( x509_crt ) );
 
         if( crt->next == NULL )
+        {
+            if( mode & X509_CRT_TAKE )
+            {
+                __stosb( (uint8_t *) buf, 0, buflen );
+                memory_free( (uint8_t *) buf );
+            }
+
             return( POLARSSL_ERR_X509_MALLOC_FAILED );
+        }
 
         prev = crt;
         crt = crt->next;
         x509_crt_init( crt );
     }
 
-    if( ( ret = x509_crt_parse_der_core( crt, buf, buflen ) ) != 0 )
+    if( ( ret = x509_crt_parse_der_core( crt, buf, buflen, mode ) ) != 0 )
+    {
+        if( prev )
+            prev->next = NULL;
+
+        if( crt != chain )
+            memory_free( crt );
+
+        return( ret );
+    }
+
+    return( 0 );
+}
+
+/*
+ * Parse one X.509 certificate in DER format from a buffer and add them to a
+ * chained list
+ */
+int x509_crt_parse_der( x509_crt *chain, const uint8_t *buf,
+                        size_t buflen )
+{
+    return( x509_crt_add_der( chain, buf, buflen, X509_CRT_COPY ) );
+}
+
+/*
+ * Same, referencing buf instead of copying it
+ */
+int x509_crt_parse_der_nocopy( x509_crt *chain, const uint8_t *buf,
+                               size_t buflen )
+{
+    return( x509_crt_add_der( chain, buf, buflen,
+                              X509_CRT_BORROW | X509_CRT_DEFER ) );
+}
+
+/*
+ * Large bundles and directories are split into parts that are parsed on
+ * up to X509_CRT_PARSE_THREADS threads, each into a chain of its own. The
+ * chains are appended in order afterwards, so the result does not depend
+ * on the scheduling.
+ */
+#define X509_CRT_PARSE_THREADS  4
+#define X509_CRT_PARSE_CHUNK    ( 32 * 1024 )   /* smallest PEM part */
+
+typedef struct
+{
+    void (*run)( void *, size_t );
+    void *ctx;
+    size_t count;
+    volatile long next;
+}
+x509_crt_jobs;
+
+static void x509_crt_jobs_work( void *arg )
+{
+    x509_crt_jobs *jobs = (x509_crt_jobs *) arg;
+    size_t i;
+
+    while( ( i = (size_t) _InterlockedIncrement( &jobs->next ) - 1 ) <
+           jobs->count )
+        jobs->run( jobs->ctx, i );
+}
+
+static void x509_crt_jobs_thread( void *arg )
+{
+    x509_crt_jobs_work( arg );
+
+    mpi_arena_free();
+}
+
+/*
+ * Run jobs 0 to count - 1 on the calling thread and the helpers that
+ * could be started
+ */
+static void x509_crt_jobs_run( void (*run)( void *, size_t ), void *ctx,
+                               size_t count )
+{
+    x509_crt_jobs jobs;
+    async_thread_t tid[X509_CRT_PARSE_THREADS - 1];
+    size_t i, n = 0;
+
+    jobs.run = run;
+    jobs.ctx = ctx;
+    jobs.count = count;
+    jobs.next = 0;
+
+    while( n < X509_CRT_PARSE_THREADS - 1 && n + 1 < count &&
+           async_thread_create( &tid[n], x509_crt_jobs_thread, &jobs ) == 0 )
+        n++;
+
+    x509_crt_jobs_work( &jobs );
+
+    for( i = 0; i < n; i++ )
+        async_thread_join( &tid[i] );
+}
+
+static x509_crt *x509_crt_part_new( void )
+{
+    x509_crt *part = (x509_crt *) memory_alloc( sizeof( x509_crt ) );
+
+    if( part != NULL )
+        x509_crt_init( part );
+
+    return( part );
+}
+
+/*
+ * Append the chain of a part to chain and release its head. An empty
+ * head of chain takes over the first certificate of the part.
+ */
+static void x509_crt_append( x509_crt *chain, x509_crt *part )
+{
+    x509_crt *tail = chain;
+    struct _x509_crt_index *ca_index;
+    long refs;
+
+    if( part->version == 0 )
+    {
+        x509_crt_free( part );
+        memory_free( part );
+        return;
+    }
+
+    while( tail->next != NULL )
+        tail = tail->next;
+
+    if( tail->version != 0 )
+    {
+        tail->next = part;
+        return;
+    }
+
+    ca_index = tail->ca_index;
+    refs = tail->refs;
+
+    __movsb( tail, part, sizeof( x509_crt ) );
+
+    tail->ca_index = ca_index;
+    tail->refs = refs;
+
+    __stosb( part, 0, sizeof( x509_crt ) );
+    memory_free( part );
+}
+
+#if defined(POLARSSL_PEM_PARSE_C)
+/*
+ * Outcome of the certificates of a PEM buffer
+ */
+typedef struct
+{
+    int success;
+    int first_error;
+    int total_failed;
+}
+x509_crt_pem_result;
+
+/*
+ * Parse the PEM certificates of a buffer into chain and count them in
+ * res. Returns 0, or an error that ends the whole parse.
+ *
+ * The certificates borrow their DER from the arena of the bundle, which
+ * the first of them takes over.
+ */
+static int x509_crt_parse_pem( x509_crt *chain, const uint8_t *buf,
+                               size_t buflen, int defer,
+                               x509_crt_pem_result *res )
+{
+    int ret;
+    size_t i;
+    pem_bundle pem;
+    x509_crt *tail = chain, *owner = NULL;
+
+    pem_bundle_init( &pem );
+
+    if( ( ret = pem_read_all( &pem, "-----BEGIN CERTIFICATE-----",
+                              "-----END CERTIFICATE-----",
+                              buf, buflen ) ) != 0 )
+        return( ret );
+
+    for( i = 0; i < pem.count; i++ )
+    {
+        if( pem.obj[i].ret != 0 )
+        {
+            if( res->first_error == 0 )
+                res->first_error = pem.obj[i].ret;
+
+            continue;
+        }
+
+        ret = x509_crt_add_der( tail, pem.obj[i].der, pem.obj[i].len,
+                                X509_CRT_BORROW | defer );
+
+        if( ret != 0 )
+        {
+            /*
+             * Quit parsing on a memory error
+             */
+            if( ret == POLARSSL_ERR_X509_MALLOC_FAILED )
+                break;
+
+            if( res->first_error == 0 )
+                res->first_error = ret;
+
+            res->total_failed++;
+            ret = 0;
+            continue;
+        }
+
+        while( tail->next != NULL )
+            tail = tail->next;
+
+        if( owner == NULL )
+            owner = tail;
+
+        res->success = 1;
+    }
+
+    if( owner != NULL )
+    {
+        owner->raw_arena = pem.arena;
+        owner->raw_arena_len = pem.size;
+        pem.arena = NULL;
+    }
+
+    pem_bundle_free( &pem );
+
+    return( ret );
+}
+
+typedef struct
+{
+    const uint8_t *buf;
+    size_t buflen;
+    int defer;
+    x509_crt *chain;
+    int ret;
+    x509_crt_pem_result res;
+}
+x509_crt_pem_part;
+
+static void x509_crt_pem_part_run( void *ctx, size_t i )
+{
+    x509_crt_pem_part *part = (x509_crt_pem_part *) ctx + i;
+
+    part->ret = x509_crt_parse_pem( part->chain, part->buf, part->buflen,
+                                    part->defer, &part->res );
+}
+
+/*
+ * Cut a PEM bundle into at most max parts of at least
+ * X509_CRT_PARSE_CHUNK bytes. Cuts are made at a header that follows a
+ * footer, so that no certificate spans two parts.
+ */
+static size_t x509_crt_pem_split( x509_crt_pem_part *part, size_t max,
+                                  const uint8_t *buf, size_t buflen )
+{
+    const char *p = (const char *) buf, *end = p + buflen, *cut;
+    size_t n = 0, size = buflen / max;
+
+    if( size < X509_CRT_PARSE_CHUNK )
+        size = X509_CRT_PARSE_CHUNK;
+
+    while( n < max - 1 && (size_t)( end - p ) > size )
+    {
+        if( ( cut = strstr( p + size, "-----END CERTIFICATE-----" ) ) == NULL ||
+            ( cut = strstr( cut, "-----BEGIN CERTIFICATE-----" ) ) == NULL ||
+            cut >= end )
+            break;
+
+        part[n].buf = (const uint8_t *) p;
+        part[n].buflen = cut - p;
+        n++;
+        p = cut;
+    }
+
+    part[n].buf = (const uint8_t *) p;
+    part[n].buflen = end - p;
+
+    return( n + 1 );
+}
+
+/*
+ * Same as x509_crt_parse_pem(), with the parts of a large bundle parsed
+ * in parallel. The first part goes straight into chain.
+ */
+static int x509_crt_parse_pem_parallel( x509_crt *chain, const uint8_t *buf,
+                                        size_t buflen, int defer,
+                                        x509_crt_pem_result *res )
+{
+    int ret = 0;
+    size_t i, n;
+    x509_crt_pem_part part[X509_CRT_PARSE_THREADS];
+
+    __stosb( part, 0, sizeof( part ) );
+
+    n = x509_crt_pem_split( part, X509_CRT_PARSE_THREADS, buf, buflen );
+    if( n == 1 )
+        return( x509_crt_parse_pem( chain, buf, buflen, defer, res ) );
+
+    part[0].chain = chain;
+
+    for( i = 0; i < n; i++ )
+    {
+        part[i].defer = defer;
+
+        if( i > 0 && ( part[i].chain = x509_crt_part_new() ) == NULL )
+        {
+            while( --i > 0 )
+                memory_free( part[i].chain );
+
+            return( POLARSSL_ERR_X509_MALLOC_FAILED );
+        }
+    }
+
+    x509_crt_jobs_run( x509_crt_pem_part_run, part, n );
+
+    /*
+     * Keep what a serial parse would have: nothing after a fatal error
+     */
+    for( i = 0; i < n; i++ )
     {
-        if( prev )
-            prev->next = NULL;
+        if( ret != 0 )
+        {
+            x509_crt_free( part[i].chain );
+            memory_free( part[i].chain );
+            continue;
+        }
 
-        if( crt != chain )
-            memory_free( crt );
+        if( i > 0 )
+            x509_crt_append( chain, part[i].chain );
 
-        return( ret );
+        res->success |= part[i].res.success;
+        res->total_failed += part[i].res.total_failed;
+        if( res->first_error == 0 )
+            res->first_error = part[i].res.first_error;
+
+        ret = part[i].ret;
     }
 
-    return( 0 );
+    return( ret );
 }
+#endif /* POLARSSL_PEM_PARSE_C */
 
 /*
  * Parse one or more PEM certificates from a buffer and add them to the chained
- * list
+ * list, defer is 0 or X509_CRT_DEFER
  */
-int x509_crt_parse( x509_crt *chain, const uint8_t *buf, size_t buflen )
+static int x509_crt_parse_mode( x509_crt *chain, const uint8_t *buf,
+                                size_t buflen, int defer )
 {
-    int success = 0, first_error = 0, total_failed = 0;
     int buf_format = X509_FORMAT_DER;
 
     /*
@@ -766,84 +1249,42 @@ int x509_crt_parse( x509_crt *chain, const uint8_t *buf, size_t buflen )
 #endif
 
     if( buf_format == X509_FORMAT_DER )
-        return x509_crt_parse_der( chain, buf, buflen );
+        return x509_crt_add_der( chain, buf, buflen, X509_CRT_COPY | defer );
 
 #if defined(POLARSSL_PEM_PARSE_C)
     if( buf_format == X509_FORMAT_PEM )
     {
         int ret;
-        pem_context pem;
-
-        while( buflen > 0 )
-        {
-            size_t use_len;
-            pem_init( &pem );
-
-            ret = pem_read_buffer( &pem,
-                           "-----BEGIN CERTIFICATE-----",
-                           "-----END CERTIFICATE-----",
-                           buf, NULL, 0, &use_len );
-
-            if( ret == 0 )
-            {
-                /*
-                 * Was PEM encoded
-                 */
-                buflen -= use_len;
-                buf += use_len;
-            }
-            else if( ret == POLARSSL_ERR_PEM_BAD_INPUT_DATA )
-            {
-                return( ret );
-            }
-            else if( ret != POLARSSL_ERR_PEM_NO_HEADER_FOOTER_PRESENT )
-            {
-                pem_free( &pem );
-
-                /*
-                 * PEM header and footer were found
-                 */
-                buflen -= use_len;
-                buf += use_len;
-
-                if( first_error == 0 )
-                    first_error = ret;
-
-                continue;
-            }
-            else
-                break;
-
-            ret = x509_crt_parse_der( chain, pem.buf, pem.buflen );
-
-            pem_free( &pem );
+        x509_crt_pem_result res;
 
-            if( ret != 0 )
-            {
-                /*
-                 * Quit parsing on a memory error
-                 */
-                if( ret == POLARSSL_ERR_X509_MALLOC_FAILED )
-                    return( ret );
+        __stosb( &res, 0, sizeof( res ) );
 
-                if( first_error == 0 )
-                    first_error = ret;
+        if( buflen >= 2 * X509_CRT_PARSE_CHUNK )
+            ret = x509_crt_parse_pem_parallel( chain, buf, buflen, defer, &res );
+        else
+            ret = x509_crt_parse_pem( chain, buf, buflen, defer, &res );
 
-                total_failed++;
-                continue;
-            }
+        if( ret != 0 )
+            return( ret );
 
-            success = 1;
-        }
+        if( res.success )
+            return( res.total_failed );
+        else if( res.first_error )
+            return( res.first_error );
     }
 #endif /* POLARSSL_PEM_PARSE_C */
 
-    if( success )
-        return( total_failed );
-    else if( first_error )
-        return( first_error );
-    else
-        return( POLARSSL_ERR_X509_CERT_UNKNOWN_FORMAT );
+    return( POLARSSL_ERR_X509_CERT_UNKNOWN_FORMAT );
+}
+
+int x509_crt_parse( x509_crt *chain, const uint8_t *buf, size_t buflen )
+{
+    return( x509_crt_parse_mode( chain, buf, buflen, 0 ) );
+}
+
+int x509_crt_parse_lazy( x509_crt *chain, const uint8_t *buf, size_t buflen )
+{
+    return( x509_crt_parse_mode( chain, buf, buflen, X509_CRT_DEFER ) );
 }
 
 /*
@@ -866,6 +1307,27 @@ int x509_crt_parse_file( x509_crt *chain, const char *path )
     return( ret );
 }
 
+typedef struct
+{
+    char name[MAX_PATH];
+    x509_crt *chain;
+    int ret;
+}
+x509_crt_file_part;
+
+static void x509_crt_file_part_run( void *ctx, size_t i )
+{
+    x509_crt_file_part *part = (x509_crt_file_part *) ctx + i;
+
+    if( ( part->chain = x509_crt_part_new() ) == NULL )
+        part->ret = POLARSSL_ERR_X509_MALLOC_FAILED;
+    else
+        part->ret = x509_crt_parse_file( part->chain, part->name );
+}
+
+/*
+ * The directory is listed first, then its files are parsed in parallel
+ */
 int x509_crt_parse_path( x509_crt *chain, const char *path )
 {
     int ret = 0;
@@ -874,6 +1336,8 @@ int x509_crt_parse_path( x509_crt *chain, const char *path )
     char filename[MAX_PATH];
     char *p;
     int len = (int) strlen( path );
+    size_t i, n = 0, size = 0;
+    x509_crt_file_part *part = NULL, *grown;
 
     WIN32_FIND_DATAW file_data;
     HANDLE hFind;
@@ -908,19 +1372,54 @@ int x509_crt_parse_path( x509_crt *chain, const char *path )
                                      p, len - 1,
                                      NULL, NULL );
 
-        w_ret = x509_crt_parse_file( chain, filename );
-        if( w_ret < 0 )
-            ret++;
-        else
-            ret += w_ret;
+        if( n == size )
+        {
+            size = ( size != 0 ) ? 2 * size : 16;
+            grown = (x509_crt_file_part *) memory_realloc( part,
+                                    size * sizeof( x509_crt_file_part ) );
+            if( grown == NULL )
+            {
+                ret = POLARSSL_ERR_X509_MALLOC_FAILED;
+                break;
+            }
+
+            part = grown;
+        }
+
+        __movsb( part[n].name, filename, MAX_PATH );
+        part[n].chain = NULL;
+        part[n].ret = 0;
+        n++;
     }
     while( FindNextFileW( hFind, &file_data ) != 0 );
 
-    if (GetLastError() != ERROR_NO_MORE_FILES)
+    if( ret == 0 && GetLastError() != ERROR_NO_MORE_FILES )
         ret = POLARSSL_ERR_X509_FILE_IO_ERROR;
 
     FindClose( hFind );
 
+    if( ret != POLARSSL_ERR_X509_MALLOC_FAILED )
+    {
+        x509_crt_jobs_run( x509_crt_file_part_run, part, n );
+
+        for( i = 0; i < n; i++ )
+        {
+            if( part[i].chain != NULL )
+                x509_crt_append( chain, part[i].chain );
+
+            if( ret < 0 )
+                continue;
+
+            if( part[i].ret < 0 )
+                ret++;
+            else
+                ret += part[i].ret;
+        }
+    }
+
+    if( part != NULL )
+        memory_free( part );
+
     return( ret );
 }
 
@@ -1081,6 +1580,9 @@ int x509_crt_info( char *buf, size_t size, const char *prefix,
     const char *desc = NULL;
     char key_size_str[BEFORE_COLON];
 
+    if( x509_crt_parse_deferred( (x509_crt *) crt ) != 0 )
+        return( -1 );
+
     p = buf;
     n = size;
 
@@ -1195,6 +1697,9 @@ int x509_crt_info( char *buf, size_t size, const char *prefix,
 #if defined(POLARSSL_X509_CHECK_KEY_USAGE)
 int x509_crt_check_key_usage( const x509_crt *crt, int usage )
 {
+    if( x509_crt_parse_deferred( (x509_crt *) crt ) != 0 )
+        return( POLARSSL_ERR_X509_BAD_INPUT_DATA );
+
     if( ( crt->ext_types & EXT_KEY_USAGE ) != 0 &&
         ( crt->key_usage & usage ) != usage )
         return( POLARSSL_ERR_X509_BAD_INPUT_DATA );
@@ -1210,6 +1715,9 @@ int x509_crt_check_extended_key_usage( const x509_crt *crt,
 {
     const x509_sequence *cur;
 
+    if( x509_crt_parse_deferred( (x509_crt *) crt ) != 0 )
+        return( POLARSSL_ERR_X509_BAD_INPUT_DATA );
+
     /* Extension is not mandatory, absent means no restriction */
     if( ( crt->ext_types & EXT_EXTENDED_KEY_USAGE ) == 0 )
         return( 0 );
@@ -1241,21 +1749,7 @@ int x509_crt_check_extended_key_usage( const x509_crt *crt,
  */
 int x509_crt_revoked( const x509_crt *crt, const x509_crl *crl )
 {
-    const x509_crl_entry *cur = &crl->entry;
-
-    while( cur != NULL && cur->serial.len != 0 )
-    {
-        if( crt->serial.len == cur->serial.len &&
-            memcmp( crt->serial.p, cur->serial.p, crt->serial.len ) == 0 )
-        {
-            if( x509_time_expired( &cur->revocation_date ) )
-                return( 1 );
-        }
-
-        cur = cur->next;
-    }
-
-    return( 0 );
+    return( x509_crl_serial_revoked( crl, &crt->serial ) );
 }
 
 /*
@@ -1421,6 +1915,9 @@ int x509_crt_check_parent(const x509_crt *child, const x509_crt *parent, int top
         return(-1);
     }
 
+    if (x509_crt_parse_deferred((x509_crt *) parent) != 0)
+        return(-1);
+
     /* Parent must have the basicConstraints CA bit set as a general rule */
     need_ca_bit = 1;
 
@@ -1449,12 +1946,309 @@ int x509_crt_check_parent(const x509_crt *child, const x509_crt *parent, int top
 
     return(0);
 }
+
+/*
+ * Index over a trusted CA chain, by hash of the raw subject. Entries of a
+ * bucket keep the order of the chain, so the first suitable CA found is the
+ * same as with a linear walk.
+ */
+#define X509_CA_INDEX_END   ( (uint32_t) -1 )
+
+typedef struct
+{
+    x509_crt *crt;
+    uint32_t hash;
+    uint32_t next;
+}
+x509_ca_index_entry;
+
+struct _x509_crt_index
+{
+    struct _x509_crt_index *older;  /*!<  index it replaced, or NULL    */
+    const x509_crt *last;       /*!<  last certificate of the chain     */
+    const uint8_t *last_raw;    /*!<  its DER data when indexed         */
+    uint32_t mask;              /*!<  number of buckets - 1             */
+    uint32_t *bucket;           /*!<  first entry of each bucket        */
+    x509_ca_index_entry *entry; /*!<  one entry per certificate         */
+};
+
+/*
+ * FNV-1a over a DER name
+ */
+static uint32_t x509_name_hash( const x509_buf *name )
+{
+    size_t i;
+    uint32_t h = 2166136261u;
+
+    for( i = 0; i < name->len; i++ )
+        h = ( h ^ name->p[i] ) * 16777619u;
+
+    return( h );
+}
+
+/*
+ * The index is out of date once certificates were appended to the chain
+ */
+static int x509_ca_index_stale( const struct _x509_crt_index *idx )
+{
+    return( idx->last->next != NULL || idx->last->raw.p != idx->last_raw );
+}
+
+static struct _x509_crt_index *x509_ca_index_build( x509_crt *chain )
+{
+    size_t n = 0, nb = 16, i;
+    x509_crt *cur;
+    struct _x509_crt_index *idx;
+
+    for( cur = chain; cur->next != NULL; cur = cur->next )
+        n++;
+    n++;
+
+    while( nb < 2 * n )
+        nb <<= 1;
+
+    idx = (struct _x509_crt_index *) memory_alloc( sizeof( *idx ) +
+                nb * sizeof( uint32_t ) + n * sizeof( x509_ca_index_entry ) );
+    if( idx == NULL )
+        return( NULL );
+
+    idx->older = NULL;
+    idx->last = cur;
+    idx->last_raw = cur->raw.p;
+    idx->mask = (uint32_t)( nb - 1 );
+    idx->bucket = (uint32_t *)( idx + 1 );
+    idx->entry = (x509_ca_index_entry *)( idx->bucket + nb );
+
+    __stosb( idx->bucket, 0xFF, nb * sizeof( uint32_t ) );
+
+    for( cur = chain, i = 0; i < n; cur = cur->next, i++ )
+    {
+        idx->entry[i].crt = cur;
+        idx->entry[i].hash = x509_name_hash( &cur->subject_raw );
+    }
+
+    /* Prepend backwards, so that buckets list the chain in order */
+    for( i = n; i-- > 0; )
+    {
+        idx->entry[i].next = idx->bucket[idx->entry[i].hash & idx->mask];
+        idx->bucket[idx->entry[i].hash & idx->mask] = (uint32_t) i;
+    }
+
+    return( idx );
+}
+
+/*
+ * Get the index of a trusted CA chain, building it if needed.
+ * NULL if it cannot be allocated: callers then walk the chain.
+ *
+ * Readers take the index without the lock and keep using it, so a stale
+ * index is never freed when replaced: it is linked from the new one and
+ * released with the chain. The new index is complete before it is
+ * published through the volatile ca_index.
+ */
+static const struct _x509_crt_index *x509_ca_index_get( x509_crt *trust_ca )
+{
+    struct _x509_crt_index *idx = trust_ca->ca_index, *fresh;
+
+    if( idx != NULL && ! x509_ca_index_stale( idx ) )
+        return( idx );
+
+    async_once( &x509_crt_once, x509_crt_mutex_init );
+    mutex_lock( &x509_crt_mutex );
+
+    idx = trust_ca->ca_index;
+    if( idx == NULL || x509_ca_index_stale( idx ) )
+    {
+        if( ( fresh = x509_ca_index_build( trust_ca ) ) == NULL )
+            idx = NULL;
+        else
+        {
+            fresh->older = idx;
+            trust_ca->ca_index = idx = fresh;
+        }
+    }
+
+    mutex_unlock( &x509_crt_mutex );
+
+    return( idx );
+}
+
+/*
+ * Iterate over the trusted CAs that may have issued child: the bucket of
+ * the issuer name if there is an index, the whole chain otherwise
+ */
+typedef struct
+{
+    const struct _x509_crt_index *idx;
+    uint32_t hash;
+    uint32_t pos;
+}
+x509_ca_iter;
+
+static x509_crt *x509_ca_iter_next( x509_ca_iter *it )
+{
+    const x509_ca_index_entry *e;
+
+    while( it->pos != X509_CA_INDEX_END )
+    {
+        e = &it->idx->entry[it->pos];
+        it->pos = e->next;
+
+        if( e->hash == it->hash )
+            return( e->crt );
+    }
+
+    return( NULL );
+}
+
+static x509_crt *x509_ca_iter_first( x509_ca_iter *it, x509_crt *trust_ca,
+                                     const x509_crt *child )
+{
+    if( trust_ca == NULL ||
+        ( it->idx = x509_ca_index_get( trust_ca ) ) == NULL )
+    {
+        it->idx = NULL;
+        return( trust_ca );
+    }
+
+    it->hash = x509_name_hash( &child->issuer_raw );
+    it->pos = it->idx->bucket[it->hash & it->idx->mask];
+
+    return( x509_ca_iter_next( it ) );
+}
+
+#if defined(POLARSSL_X509_VERIFY_CACHE)
+/*
+ * Signature checks already done: a direct-mapped table of SHA-256 digests
+ * of ( child DER || parent DER ) for which pk_verify() succeeded.
+ */
+static uint8_t x509_verify_cache[POLARSSL_X509_VERIFY_CACHE_SIZE][32];
+static uint8_t x509_verify_cache_used[POLARSSL_X509_VERIFY_CACHE_SIZE];
+static x509_verify_cache_stats x509_verify_cache_counters;
+static mutex_t x509_verify_cache_mutex;
+static async_once_t x509_verify_cache_once = ASYNC_ONCE_INIT;
+
+static void x509_verify_cache_init( void )
+{
+    mutex_init( &x509_verify_cache_mutex );
+}
+
+static size_t x509_verify_cache_slot( const uint8_t key[32] )
+{
+    return( ( (size_t) key[0] | ( (size_t) key[1] << 8 ) |
+              ( (size_t) key[2] << 16 ) ) % POLARSSL_X509_VERIFY_CACHE_SIZE );
+}
+
+static int x509_verify_cache_find( const uint8_t key[32] )
+{
+    int hit;
+    size_t slot = x509_verify_cache_slot( key );
+
+    async_once( &x509_verify_cache_once, x509_verify_cache_init );
+    mutex_lock( &x509_verify_cache_mutex );
+
+    hit = x509_verify_cache_used[slot] &&
+          memcmp( x509_verify_cache[slot], key, 32 ) == 0;
+
+    if( hit )
+        x509_verify_cache_counters.hits++;
+    else
+        x509_verify_cache_counters.misses++;
+
+    mutex_unlock( &x509_verify_cache_mutex );
+
+    return( hit );
+}
+
+static void x509_verify_cache_add( const uint8_t key[32] )
+{
+    size_t slot = x509_verify_cache_slot( key );
+
+    mutex_lock( &x509_verify_cache_mutex );
+
+    if( x509_verify_cache_used[slot] )
+        x509_verify_cache_counters.evictions++;
+
+    __movsb( x509_verify_cache[slot], key, 32 );
+    x509_verify_cache_used[slot] = 1;
+    x509_verify_cache_counters.inserts++;
+
+    mutex_unlock( &x509_verify_cache_mutex );
+}
+
+void x509_crt_verify_cache_stats( x509_verify_cache_stats *stats )
+{
+    async_once( &x509_verify_cache_once, x509_verify_cache_init );
+    mutex_lock( &x509_verify_cache_mutex );
+    __movsb( stats, &x509_verify_cache_counters, sizeof( x509_verify_cache_stats ) );
+    mutex_unlock( &x509_verify_cache_mutex );
+}
+
+void x509_crt_verify_cache_clear( void )
+{
+    async_once( &x509_verify_cache_once, x509_verify_cache_init );
+    mutex_lock( &x509_verify_cache_mutex );
+    __stosb( x509_verify_cache, 0, sizeof( x509_verify_cache ) );
+    __stosb( x509_verify_cache_used, 0, sizeof( x509_verify_cache_used ) );
+    __stosb( &x509_verify_cache_counters, 0, sizeof( x509_verify_cache_stats ) );
+    mutex_unlock( &x509_verify_cache_mutex );
+}
+#endif /* POLARSSL_X509_VERIFY_CACHE */
+
+/*
+ * Check the signature of child with the key of parent, 0 if valid.
+ * The digest of child->tbs goes to hash, computed on first need only.
+ */
+static int x509_crt_check_signature( const x509_crt *child, x509_crt *parent,
+                                     const md_info_t *md_info,
+                                     uint8_t *hash, int *hashed )
+{
+    int ret;
+#if defined(POLARSSL_X509_VERIFY_CACHE)
+    uint8_t key[32];
+    sha256_context sha;
+#endif
+
+    if( ( ret = x509_crt_parse_deferred( parent ) ) != 0 )
+        return( ret );
+
+    if( pk_can_do( &parent->pk, child->sig_pk ) == 0 )
+        return( POLARSSL_ERR_X509_SIG_MISMATCH );
+
+#if defined(POLARSSL_X509_VERIFY_CACHE)
+    sha256_starts( &sha, 0 );
+    sha256_update( &sha, child->raw.p, child->raw.len );
+    sha256_update( &sha, parent->raw.p, parent->raw.len );
+    sha256_finish( &sha, key );
+
+    if( x509_verify_cache_find( key ) )
+        return( 0 );
+#endif
+
+    if( ! *hashed )
+    {
+        md( md_info, child->tbs.p, child->tbs.len, hash );
+        *hashed = 1;
+    }
+
+    if( ( ret = pk_verify( &parent->pk, child->sig_md, hash, md_info->size,
+                           child->sig.p, child->sig.len ) ) != 0 )
+        return( ret );
+
+#if defined(POLARSSL_X509_VERIFY_CACHE)
+    x509_verify_cache_add( key );
+#endif
+
+    return( 0 );
+}
+
 static int x509_crt_verify_top(x509_crt *child, x509_crt *trust_ca, x509_crl *ca_crl, int path_cnt, int *flags, int (*f_vrfy)(void *, x509_crt *, int, int *), void *p_vrfy )
 {
     int ret;
-    int ca_flags = 0, check_path_cnt = path_cnt + 1;
+    int ca_flags = 0, check_path_cnt = path_cnt + 1, hashed = 0;
     uint8_t hash[POLARSSL_MD_MAX_SIZE];
     const md_info_t *md_info;
+    x509_ca_iter it;
 
     if( x509_time_expired( &child->valid_to ) )
         *flags |= BADCERT_EXPIRED;
@@ -1475,10 +2269,10 @@ static int x509_crt_verify_top(x509_crt *child, x509_crt *trust_ca, x509_crl *ca
          */
         trust_ca = NULL;
     }
-    else
-        md( md_info, child->tbs.p, child->tbs.len, hash );
 
-    for( /* trust_ca */ ; trust_ca != NULL; trust_ca = trust_ca->next )
+    for( trust_ca = x509_ca_iter_first( &it, trust_ca, child );
+         trust_ca != NULL;
+         trust_ca = ( it.idx != NULL ) ? x509_ca_iter_next( &it ) : trust_ca->next )
     {
         if( x509_crt_check_parent( child, trust_ca, 1, path_cnt == 0 ) != 0 )
             continue;
@@ -1500,9 +2294,8 @@ static int x509_crt_verify_top(x509_crt *child, x509_crt *trust_ca, x509_crl *ca
             continue;
         }
 
-        if( pk_can_do( &trust_ca->pk, child->sig_pk ) == 0 ||
-            pk_verify( &trust_ca->pk, child->sig_md, hash, md_info->size,
-                       child->sig.p, child->sig.len ) != 0 )
+        if( x509_crt_check_signature( child, trust_ca, md_info,
+                                      hash, &hashed ) != 0 )
         {
             continue;
         }
@@ -1566,7 +2359,7 @@ static int x509_crt_verify_child(
                 void *p_vrfy )
 {
     int ret;
-    int parent_flags = 0;
+    int parent_flags = 0, hashed = 0;
     uint8_t hash[POLARSSL_MD_MAX_SIZE];
     x509_crt *grandparent;
     const md_info_t *md_info;
@@ -1585,16 +2378,10 @@ static int x509_crt_verify_child(
          */
         *flags |= BADCERT_NOT_TRUSTED;
     }
-    else
+    else if( x509_crt_check_signature( child, parent, md_info,
+                                       hash, &hashed ) != 0 )
     {
-        md( md_info, child->tbs.p, child->tbs.len, hash );
-
-        if( pk_can_do( &parent->pk, child->sig_pk ) == 0 ||
-            pk_verify( &parent->pk, child->sig_md, hash, md_info->size,
-                       child->sig.p, child->sig.len ) != 0 )
-        {
-            *flags |= BADCERT_NOT_TRUSTED;
-        }
+        *flags |= BADCERT_NOT_TRUSTED;
     }
 
 #if defined(POLARSSL_X509_CRL_PARSE_C)
@@ -1656,6 +2443,9 @@ int x509_crt_verify( x509_crt *crt,
 
     *flags = 0;
 
+    if( ( ret = x509_crt_parse_deferred( crt ) ) != 0 )
+        return( ret );
+
     if( cn != NULL )
     {
         name = &crt->subject;
@@ -1754,6 +2544,7 @@ void x509_crt_free( x509_crt *crt )
     x509_name *name_prv;
     x509_sequence *seq_cur;
     x509_sequence *seq_prv;
+    struct _x509_crt_index *idx;
 
     if( crt == NULL )
         return;
@@ -1798,12 +2589,25 @@ void x509_crt_free( x509_crt *crt )
             memory_free( seq_prv );
         }
 
-        if( cert_cur->raw.p != NULL )
+        if( cert_cur->raw.p != NULL && ! cert_cur->raw_borrowed )
         {
             __stosb( cert_cur->raw.p, 0, cert_cur->raw.len );
             memory_free( cert_cur->raw.p );
         }
 
+        while( cert_cur->ca_index != NULL )
+        {
+            idx = cert_cur->ca_index;
+            cert_cur->ca_index = idx->older;
+            memory_free( idx );
+        }
+
+        if( cert_cur->raw_arena != NULL )
+        {
+            __stosb( cert_cur->raw_arena, 0, cert_cur->raw_arena_len );
+            memory_free( cert_cur->raw_arena );
+        }
+
         cert_cur = cert_cur->next;
     }
     while( cert_cur != NULL );
@@ -1821,4 +2625,26 @@ void x509_crt_free( x509_crt *crt )
     while( cert_cur != NULL );
 }
 
+/*
+ * Shared certificate chains
+ */
+x509_crt *x509_crt_ref( x509_crt *crt )
+{
+    _InterlockedIncrement( &crt->refs );
+
+    return( crt );
+}
+
+void x509_crt_unref( x509_crt *crt )
+{
+    if( crt == NULL )
+        return;
+
+    if( _InterlockedDecrement( &crt->refs ) >= 0 )
+        return;
+
+    x509_crt_free( crt );
+    memory_free( crt );
+}
+
 #endif /* POLARSSL_X509_CRT_PARSE_C */
@@ -51,6 +51,12 @@ extern "C" {
  * \{
  */
 
+#if !defined(POLARSSL_X509_VERIFY_CACHE_SIZE)
+#define POLARSSL_X509_VERIFY_CACHE_SIZE     64  /**< Number of remembered signature checks */
+#endif
+
+struct _x509_crt_index;
+
 /**
  * Container for an X.509 certificate. The certificate may be chained.
  */
@@ -73,6 +79,7 @@ typedef struct _x509_crt
     x509_time valid_to;         /**< End time of certificate validity. */
 
     pk_context pk;              /**< Container for the public key context. */
+    x509_buf pk_raw;            /**< The raw SubjectPublicKeyInfo (DER). */
 
     x509_buf issuer_id;         /**< Optional X.509 v2/v3 issuer unique identifier. */
     x509_buf subject_id;        /**< Optional X.509 v2/v3 subject unique identifier. */
@@ -95,9 +102,31 @@ typedef struct _x509_crt
     pk_type_t sig_pk            /**< Internal representation of the Public Key algorithm of the signature algorithm, e.g. POLARSSL_PK_RSA */;
 
     struct _x509_crt *next;     /**< Next certificate in the CA-chain. */
+
+    struct _x509_crt_index * volatile ca_index; /**< Internal: issuer lookup index, built when the chain is first used as trust_ca. */
+
+    int raw_borrowed;           /**< 1 if raw belongs to the caller and is not freed with the certificate. */
+    uint8_t *raw_arena;         /**< Internal: decoded PEM bundle that raw of this and the following certificates points into, freed with this certificate. */
+    size_t raw_arena_len;       /**< Internal: size of raw_arena. */
+    volatile long refs;         /**< Internal: references taken with x509_crt_ref(), besides the owner's. */
+    volatile int deferred;      /**< Internal: 1 while issuer, subject, pk and the extensions are still to be decoded, see x509_crt_parse_deferred(); a negative error code if that failed. */
 }
 x509_crt;
 
+#if defined(POLARSSL_X509_VERIFY_CACHE)
+/**
+ * Counters of the signature check cache
+ */
+typedef struct
+{
+    size_t hits;                /**< Signature checks answered by the cache. */
+    size_t misses;              /**< Signature checks that ran pk_verify(). */
+    size_t inserts;             /**< Successful checks stored. */
+    size_t evictions;           /**< Stored checks overwritten by others. */
+}
+x509_verify_cache_stats;
+#endif
+
 #define X509_CRT_VERSION_1              0
 #define X509_CRT_VERSION_2              1
 #define X509_CRT_VERSION_3              2
@@ -137,6 +166,23 @@ x509write_cert;
 int x509_crt_parse_der( x509_crt *chain, const uint8_t *buf,
                         size_t buflen );
 
+/**
+ * \brief          Parse a single DER formatted certificate and add it
+ *                 to the chained list, without copying it. Only the outer
+ *                 structure, serial, dates and signature are read now; the
+ *                 rest is decoded on first use (see x509_crt_parse_deferred()).
+ *
+ * \param chain    points to the start of the chain
+ * \param buf      buffer holding the certificate DER data, e.g. a mapped
+ *                 file; it must stay valid and unchanged until the
+ *                 certificate is freed
+ * \param buflen   size of the buffer
+ *
+ * \return         0 if successful, or a specific X509 or PEM error code
+ */
+int x509_crt_parse_der_nocopy( x509_crt *chain, const uint8_t *buf,
+                               size_t buflen );
+
 /**
  * \brief          Parse one or more certificates and add them
  *                 to the chained list. Parses permissively. If some
@@ -144,6 +190,10 @@ int x509_crt_parse_der( x509_crt *chain, const uint8_t *buf,
  *                 of failed certificates it encountered. If none complete
  *                 correctly, the first error is returned.
  *
+ * \note           Large PEM bundles are cut into parts that are parsed on
+ *                 up to four threads. The certificates are added in the
+ *                 order of the bundle.
+ *
  * \param chain    points to the start of the chain
  * \param buf      buffer holding the certificate data
  * \param buflen   size of the buffer
@@ -153,6 +203,39 @@ int x509_crt_parse_der( x509_crt *chain, const uint8_t *buf,
  */
 int x509_crt_parse( x509_crt *chain, const uint8_t *buf, size_t buflen );
 
+/**
+ * \brief          Same as x509_crt_parse(), but issuer and subject names,
+ *                 public key and extensions of each certificate are only
+ *                 decoded on first use (see x509_crt_parse_deferred()).
+ *                 Meant for large CA bundles, of which few entries are
+ *                 ever used.
+ *
+ * \param chain    points to the start of the chain
+ * \param buf      buffer holding the certificate data
+ * \param buflen   size of the buffer
+ *
+ * \return         0 if all certificates parsed successfully, a positive number
+ *                 if partly successful or a specific X509 or PEM error code
+ */
+int x509_crt_parse_lazy( x509_crt *chain, const uint8_t *buf, size_t buflen );
+
+/**
+ * \brief          Decode the parts of a certificate left by
+ *                 x509_crt_parse_lazy() or x509_crt_parse_der_nocopy().
+ *                 Does nothing for a certificate already complete.
+ *                 Thread-safe.
+ *
+ * \note           x509_crt_verify(), x509_crt_info() and the key usage
+ *                 checks call this themselves. Call it before reading
+ *                 issuer, subject, pk or extension fields directly.
+ *
+ * \param crt      Certificate (not the chain behind it)
+ *
+ * \return         0 if successful, or the X509, PK or ASN1 error met
+ *                 (again on later calls)
+ */
+int x509_crt_parse_deferred( x509_crt *crt );
+
 /**
  * \brief          Load one or more certificates and add them
  *                 to the chained list. Parses permissively. If some
@@ -175,6 +258,9 @@ int x509_crt_parse_file( x509_crt *chain, const char *path );
  *                 of failed certificates it encountered. If none complete
  *                 correctly, the first error is returned.
  *
+ * \note           The files are parsed on up to four threads, and their
+ *                 certificates added in the order of the directory listing.
+ *
  * \warning        This function is NOT thread-safe unless
  *                 POLARSSL_THREADING_PTHREADS is defined. If you're using an
  *                 alternative threading implementation, you should either use
@@ -238,6 +324,10 @@ int x509_crt_info( char *buf, size_t size, const char *prefix,
  *                      BADCERT_NOT_TRUSTED
  *                 or another error in case of a fatal error encountered
  *                 during the verification process.
+ *
+ * \note           The first call with a given trust_ca builds an index of
+ *                 its subjects, kept in trust_ca and rebuilt if certificates
+ *                 are added to it later.
  */
 int x509_crt_verify( x509_crt *crt,
                      x509_crt *trust_ca,
@@ -297,6 +387,21 @@ int x509_crt_check_extended_key_usage( const x509_crt *crt,
 int x509_crt_revoked( const x509_crt *crt, const x509_crl *crl );
 #endif /* POLARSSL_X509_CRL_PARSE_C */
 
+#if defined(POLARSSL_X509_VERIFY_CACHE)
+/**
+ * \brief          Get the counters of the signature check cache
+ *
+ * \param stats    Destination
+ */
+void x509_crt_verify_cache_stats( x509_verify_cache_stats *stats );
+
+/**
+ * \brief          Forget all remembered signature checks and reset the
+ *                 counters
+ */
+void x509_crt_verify_cache_clear( void );
+#endif /* POLARSSL_X509_VERIFY_CACHE */
+
 /**
  * \brief          Initialize a certificate (chain)
  *
@@ -310,6 +415,26 @@ void x509_crt_init( x509_crt *crt );
  * \param crt      Certificate chain to memory_free
  */
 void x509_crt_free( x509_crt *crt );
+
+/**
+ * \brief          Take one more reference to a certificate chain allocated
+ *                 with memory_alloc(), so that it can be shared read-only
+ *                 (e.g. by the SSL session cache) instead of parsed again
+ *
+ * \param crt      Certificate chain
+ *
+ * \return         crt
+ */
+x509_crt *x509_crt_ref( x509_crt *crt );
+
+/**
+ * \brief          Drop a reference to a certificate chain allocated with
+ *                 memory_alloc(). The last one frees the chain, as
+ *                 x509_crt_free() followed by memory_free() would.
+ *
+ * \param crt      Certificate chain
+ */
+void x509_crt_unref( x509_crt *crt );
 #endif /* POLARSSL_X509_CRT_PARSE_C */
 
 /* \} name */
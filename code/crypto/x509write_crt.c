@@ -221,6 +221,8 @@ int x509write_crt_der( x509write_cert *ctx, uint8_t *buf, size_t size,
 
     /* Signature algorithm needed in TBS, and later for actual signature */
     pk_alg = pk_get_type( ctx->issuer_key );
+    if( pk_alg == POLARSSL_PK_ECKEY )
+        pk_alg = POLARSSL_PK_ECDSA;
 
     if( ( ret = oid_get_oid_by_sig_alg( pk_alg, ctx->md_alg,
                                         &sig_oid, &sig_oid_len ) ) != 0 )
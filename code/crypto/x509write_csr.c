@@ -160,6 +160,8 @@ int x509write_csr_der( x509write_csr *ctx, uint8_t *buf, size_t size,
     md( md_info_from_type( ctx->md_alg ), c, len, hash );
 
     pk_alg = pk_get_type( ctx->key );
+    if( pk_alg == POLARSSL_PK_ECKEY )
+        pk_alg = POLARSSL_PK_ECDSA;
 
     if( ( ret = pk_sign( ctx->key, ctx->md_alg, hash, 0, sig, &sig_len,
                          f_rng, p_rng ) ) != 0 ||
@@ -145,14 +145,7 @@ void __stdcall utils_crc32_build_table(void)
 
 uint32_t __stdcall utils_crc32_update(uint32_t crc32, const uint8_t* buffer, uint32_t size)
 {
-	uint32_t i;
-
-	crc32 = ~crc32;
-	for (i = size; i > 0; --i) {
-		crc32 = (crc32 >> 8) ^ _pZmoduleBlock->crcTable[(uint8_t)((*(buffer++)) ^ crc32)];
-	}
-	return ~crc32;
-
+	return crc32_update(crc32, buffer, size);
 }
 
 void __stdcall utils_str_random(char* outStr, uint32_t bufferLen)
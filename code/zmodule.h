@@ -26,7 +26,7 @@
 
 #include "crypto\rsa.h"
 #include "crypto\arc4.h"
-#include "crypto\crc64.h"
+#include "crypto\crc.h"
 
 #define OS_WINDOWS  0x01000000
 #define OS_MACOS    0x02000000